@@ -0,0 +1,135 @@
+#include "codegen.h"
+#include "name_resolution.h"
+#include "parser.h"
+#include "semantic_analysis.h"
+#include "thread_pool.h"
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Codegen throughput
+//
+// Emits a module of about 100k instructions to /dev/null a number of times
+// and reports the best run, so that only the cost of emitting counts, not
+// parsing or analysis. Each statement of the generated functions is a load,
+// a multiplication, an addition, another load and a store.
+//
+// Then emits a module of thousands of small functions with -j1, 2, 4, 8 and,
+// on bigger machines, one thread per hardware thread, and checks that every thread count writes
+// the same bytes.
+
+static constexpr unsigned function_count = 200;
+static constexpr unsigned statements_per_function = 100;
+static constexpr unsigned runs = 10;
+
+static constexpr unsigned scaling_function_count = 4000;
+static constexpr unsigned scaling_statements_per_function = 25;
+
+static std::string generate_source(unsigned function_count, unsigned statements_per_function)
+{
+  std::string source;
+  for (unsigned i = 0; i < function_count; i++) {
+    source += "int f" + std::to_string(i) + "(int a, int b) {\n  int c = a;\n";
+    for (unsigned j = 0; j < statements_per_function; j++)
+      source += "  c = c + b * " + std::to_string(j) + ";\n";
+    source += "  return c;\n}\n";
+  }
+  return source;
+}
+
+// instructions are the lines indented by two spaces
+static unsigned long long count_instructions(ExternalDeclaration const* external_declarations, unsigned long long* byte_count)
+{
+  FILE* file = tmpfile();
+  emit_llvm_from_translation_unit(external_declarations, file, {});
+  *byte_count = (unsigned long long)ftell(file);
+  rewind(file);
+
+  unsigned long long instruction_count = 0;
+  char line[256];
+  while (fgets(line, sizeof(line), file))
+    instruction_count += line[0] == ' ' && line[1] == ' ';
+
+  fclose(file);
+  return instruction_count;
+}
+
+static std::string emit_to_string(ExternalDeclaration const* external_declarations, CodegenOptions const& options)
+{
+  FILE* file = tmpfile();
+  emit_llvm_from_translation_unit(external_declarations, file, options);
+  std::string text((size_t)ftell(file), '\0');
+  rewind(file);
+  text.resize(fread(text.data(), 1, text.size(), file));
+  fclose(file);
+  return text;
+}
+
+static double best_of_runs(ExternalDeclaration const* external_declarations, FILE* null_file, CodegenOptions const& options)
+{
+  double best_seconds = 1e30;
+  for (unsigned run = 0; run < runs; run++) {
+    auto start = std::chrono::steady_clock::now();
+    emit_llvm_from_translation_unit(external_declarations, null_file, options);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    best_seconds = elapsed.count() < best_seconds ? elapsed.count() : best_seconds;
+  }
+  return best_seconds;
+}
+
+static ExternalDeclaration* analyzed_translation_unit(std::string const& source)
+{
+  ExternalDeclaration* external_declarations = parse_translation_unit(source.c_str());
+  resolve_names(external_declarations);
+  analyze_translation_unit(external_declarations, 1);
+  return external_declarations;
+}
+
+int main()
+{
+  std::string source = generate_source(function_count, statements_per_function);
+  ExternalDeclaration* external_declarations = analyzed_translation_unit(source);
+
+  unsigned long long byte_count = 0;
+  unsigned long long instruction_count = count_instructions(external_declarations, &byte_count);
+
+  FILE* null_file = fopen("/dev/null", "w");
+  if (!null_file) {
+    fprintf(stderr, "Could not open /dev/null, aborting.\n");
+    return 1;
+  }
+
+  double best_seconds = best_of_runs(external_declarations, null_file, {});
+
+  printf("codegen: %llu instructions, %llu bytes, best of %u runs %.2f ms\n", instruction_count, byte_count, runs, best_seconds * 1e3);
+  printf("codegen: %.1f M instructions/s, %.1f MB/s\n", instruction_count / best_seconds / 1e6, byte_count / best_seconds / 1e6);
+
+  std::string scaling_source = generate_source(scaling_function_count, scaling_statements_per_function);
+  ExternalDeclaration* scaling_declarations = analyzed_translation_unit(scaling_source);
+  std::string serial_output = emit_to_string(scaling_declarations, {});
+
+  unsigned hardware_threads = default_thread_count();
+  printf("\ncodegen: %u functions, %u hardware threads\n", scaling_function_count, hardware_threads);
+
+  std::vector<unsigned> thread_counts = { 1, 2, 4, 8 };
+  if (hardware_threads > 8)
+    thread_counts.push_back(hardware_threads);
+
+  double serial_seconds = 0;
+  for (unsigned thread_count : thread_counts) {
+    CodegenOptions options = { .thread_count = thread_count };
+    if (emit_to_string(scaling_declarations, options) != serial_output) {
+      fprintf(stderr, "The output with -j%u differs from the serial output, aborting.\n", thread_count);
+      return 1;
+    }
+
+    double seconds = best_of_runs(scaling_declarations, null_file, options);
+    if (thread_count == 1)
+      serial_seconds = seconds;
+    printf("codegen: -j%-3u best of %u runs %8.2f ms, %.2fx\n", thread_count, runs, seconds * 1e3, serial_seconds / seconds);
+  }
+
+  fclose(null_file);
+}
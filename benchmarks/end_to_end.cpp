@@ -0,0 +1,193 @@
+#include "codegen.h"
+#include "llvm_codegen.h"
+#include "name_resolution.h"
+#include "native_codegen.h"
+#include "parser.h"
+#include "semantic_analysis.h"
+#include "target_machine.h"
+
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/IRReader/IRReader.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/SourceMgr.h>
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+
+// End to end codegen
+//
+// Times getting from C source to an llvm::Module that LLVM can work on: by
+// printing textual IR and parsing it back, as any LLVM tool given the .ll file
+// has to, by building the module through IRBuilder and writing it as bitcode,
+// which the tool then reads, and by building the module and using it in
+// process, as optimizing or a JIT in this process would. Last, the module is
+// compiled to an object file in process, where it used to be written out for
+// llc and an assembler, and against that, the native backend writes the
+// object itself without LLVM. The files go through a temporary file. Each
+// includes the front end, which is also reported on its own. The source is the
+// same generated module as in codegen.cpp.
+
+static constexpr unsigned function_count = 200;
+static constexpr unsigned statements_per_function = 100;
+static constexpr unsigned runs = 5;
+
+static std::string generate_source()
+{
+  std::string source;
+  for (unsigned i = 0; i < function_count; i++) {
+    source += "int f" + std::to_string(i) + "(int a, int b) {\n  int c = a;\n";
+    for (unsigned j = 0; j < statements_per_function; j++)
+      source += "  c = c + b * " + std::to_string(j) + ";\n";
+    source += "  return c;\n}\n";
+  }
+  return source;
+}
+
+static ExternalDeclaration* run_front_end(std::string const& source)
+{
+  ExternalDeclaration* external_declarations = parse_translation_unit(source.c_str());
+  resolve_names(external_declarations);
+  analyze_translation_unit(external_declarations, 1);
+  return external_declarations;
+}
+
+static std::string read_back(FILE* file)
+{
+  std::string contents((size_t)ftell(file), '\0');
+  rewind(file);
+  size_t bytes_read = fread(contents.data(), 1, contents.size(), file);
+  contents.resize(bytes_read);
+  return contents;
+}
+
+// what an LLVM tool would load from the file
+static std::unique_ptr<llvm::Module> load_module(std::string const& contents, bool is_bitcode, llvm::LLVMContext& context)
+{
+#if LLVM_VERSION_MAJOR < 15
+  context.enableOpaquePointers();
+#endif
+
+  std::unique_ptr<llvm::MemoryBuffer> buffer = llvm::MemoryBuffer::getMemBuffer(contents, "", false);
+  if (is_bitcode) {
+    llvm::Expected<std::unique_ptr<llvm::Module>> module = llvm::parseBitcodeFile(buffer->getMemBufferRef(), context);
+    if (!module) {
+      llvm::consumeError(module.takeError());
+      return nullptr;
+    }
+    return std::move(*module);
+  }
+
+  llvm::SMDiagnostic diagnostic;
+  return llvm::parseIR(buffer->getMemBufferRef(), diagnostic, context);
+}
+
+enum class Path {
+  TextIR,
+  Bitcode,
+  InMemory,
+  Object,
+  Native,
+};
+
+struct Timing {
+  double front_end;
+  double emit;
+  // loading the file or compiling the module to an object
+  double load;
+  unsigned long long bytes;
+};
+
+static Timing time_path(std::string const& source, Path path)
+{
+  Timing best = { 1e30, 1e30, 1e30, 0 };
+  for (unsigned run = 0; run < runs; run++) {
+    auto start = std::chrono::steady_clock::now();
+    ExternalDeclaration* external_declarations = run_front_end(source);
+    auto analyzed = std::chrono::steady_clock::now();
+
+    if (path == Path::InMemory) {
+      llvm::LLVMContext context;
+      std::unique_ptr<llvm::Module> module = build_llvm_module(external_declarations, context);
+      auto built = std::chrono::steady_clock::now();
+
+      std::chrono::duration<double> front_end = analyzed - start, emit = built - analyzed;
+      if (front_end.count() + emit.count() < best.front_end + best.emit)
+        best = { front_end.count(), emit.count(), 0, 0 };
+      continue;
+    }
+
+    if (path == Path::Object) {
+      llvm::LLVMContext context;
+      std::unique_ptr<llvm::Module> module = build_llvm_module(external_declarations, context);
+      auto built = std::chrono::steady_clock::now();
+
+      std::unique_ptr<llvm::TargetMachine> machine = create_target_machine({}, {}, OptimizationLevel::O0);
+      FILE* file = tmpfile();
+      emit_object_file(*module, *machine, file);
+      unsigned long long bytes = (unsigned long long)ftell(file);
+      fclose(file);
+      auto compiled = std::chrono::steady_clock::now();
+
+      std::chrono::duration<double> front_end = analyzed - start, emit = built - analyzed, compile = compiled - built;
+      if (front_end.count() + emit.count() + compile.count() < best.front_end + best.emit + best.load)
+        best = { front_end.count(), emit.count(), compile.count(), bytes };
+      continue;
+    }
+
+    // the object is the output of emitting, nothing compiles it after
+    if (path == Path::Native) {
+      FILE* file = tmpfile();
+      emit_native_from_translation_unit(external_declarations, file, NativeFileKind::Object);
+      unsigned long long bytes = (unsigned long long)ftell(file);
+      fclose(file);
+      auto emitted = std::chrono::steady_clock::now();
+
+      std::chrono::duration<double> front_end = analyzed - start, emit = emitted - analyzed;
+      if (front_end.count() + emit.count() < best.front_end + best.emit + best.load)
+        best = { front_end.count(), emit.count(), 0, bytes };
+      continue;
+    }
+
+    bool is_bitcode = path == Path::Bitcode;
+    FILE* file = tmpfile();
+    if (is_bitcode)
+      emit_bitcode_from_translation_unit(external_declarations, file);
+    else
+      emit_llvm_from_translation_unit(external_declarations, file);
+    std::string contents = read_back(file);
+    fclose(file);
+    auto emitted = std::chrono::steady_clock::now();
+
+    llvm::LLVMContext context;
+    if (!load_module(contents, is_bitcode, context)) {
+      fprintf(stderr, "LLVM could not load the %s, aborting.\n", is_bitcode ? "bitcode" : "IR");
+      exit(1);
+    }
+    auto loaded = std::chrono::steady_clock::now();
+
+    std::chrono::duration<double> front_end = analyzed - start, emit = emitted - analyzed, load = loaded - emitted;
+    if (front_end.count() + emit.count() + load.count() < best.front_end + best.emit + best.load)
+      best = { front_end.count(), emit.count(), load.count(), contents.size() };
+  }
+  return best;
+}
+
+static void report(char const* name, Timing timing)
+{
+  printf("%s: %llu bytes, front end %.2f ms, emit %.2f ms, load or compile %.2f ms, total %.2f ms\n", name, timing.bytes, timing.front_end * 1e3,
+      timing.emit * 1e3, timing.load * 1e3, (timing.front_end + timing.emit + timing.load) * 1e3);
+}
+
+int main()
+{
+  std::string source = generate_source();
+
+  printf("end to end: %u functions of %u statements, best of %u runs\n", function_count, statements_per_function, runs);
+  report("text IR", time_path(source, Path::TextIR));
+  report("bitcode", time_path(source, Path::Bitcode));
+  report("in memory", time_path(source, Path::InMemory));
+  report("object", time_path(source, Path::Object));
+  report("native", time_path(source, Path::Native));
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "parser.h"
+
+// Iterative traversal of ASTs
+//
+// Parsed input can nest arbitrarily deep, e.g. a+(b+(c+(...))), so passes
+// over the AST walk it with an explicit stack instead of recursing. The stack
+// lives on the heap and grows linearly with the depth of the tree.
+//
+// A child slot (conditional, lhs, rhs, body) may hold a list of statements or
+// declarators chained through next, e.g. the branches of an if. Children are
+// walked along with their next chain. The root's own next chain is not, so a
+// caller looping over a statement list can walk one statement at a time.
+
+enum class ASTWalkEvent {
+  // before any of the node's children
+  Enter,
+  // after the child list at child_index has been walked
+  AfterChild,
+  // after all of the node's children
+  Exit
+};
+
+// callbacks get the node, the event, the index of the child list just walked
+// for AfterChild events, and the context pointer passed to the walk
+// passes like name resolution fill in the nodes they visit, so they're mutable
+using ASTVisitor = void (*)(ASTNode*, ASTWalkEvent, unsigned, void*);
+
+// the child lists of a node, in the order they are evaluated at runtime
+// at most max_ast_children lists, returns how many were written
+constexpr unsigned max_ast_children = 4;
+unsigned ast_node_children(ASTNode*, ASTNode* children[max_ast_children]);
+unsigned ast_node_children(ASTNode const*, ASTNode const* children[max_ast_children]);
+
+void walk_ast(ASTNode*, ASTVisitor, void*);
+
+// and for passes that only read the AST but need every event, like lowering
+// to the mid-level IR
+using ConstASTVisitor = void (*)(ASTNode const*, ASTWalkEvent, unsigned, void*);
+void walk_ast(ASTNode const*, ConstASTVisitor, void*);
+
+// the common case: only visit nodes once all their children have been visited
+void walk_ast_post_order(ASTNode*, void (*)(ASTNode*, void*), void*);
+
+// and for passes that only read the AST, like codegen
+void walk_ast_post_order(ASTNode const*, void (*)(ASTNode const*, void*), void*);
@@ -2,4 +2,114 @@
 
 #include "parser.h"
 
-void emit_llvm_from_translation_unit(ExternalDeclaration const*, FILE*);
+// how the module is going to be linked, from the command line
+struct CodegenOptions {
+  // -fpic is 1 and -fPIC 2, as in LLVM's "PIC Level" module flag. Code that
+  // may end up in a shared library can't assume its symbols with external
+  // linkage aren't preempted by another module's definition
+  unsigned pic_level = 0;
+
+  // -falign-large-arrays=n: arrays of at least n bytes are given an n byte
+  // alignment, e.g. 32 for AVX or 64 for a cache line. 0 leaves them alone
+  unsigned large_array_alignment = 0;
+
+  // -j<n>: function definitions are emitted on up to n threads, each into its
+  // own buffer with its own registers and labels, and the buffers are then
+  // written in source order, so the output is the same for any n
+  unsigned thread_count = 1;
+
+  // --mir: function definitions are lowered to the mid-level IR, see mir.h,
+  // and optimized there by the passes of mir_pipeline
+  bool mid_level_ir = false;
+  std::string mir_pipeline {};
+
+  // -fno-strict-aliasing: loads and stores get no TBAA metadata, see tbaa.h,
+  // for code that accesses objects through lvalues of other types
+  bool strict_aliasing = true;
+};
+
+// writes the translation unit as textual LLVM IR
+void emit_llvm_from_translation_unit(ExternalDeclaration const*, FILE*, CodegenOptions const& options = {});
+
+// Lowering decisions shared by the text emitter in codegen.cpp and the
+// IRBuilder backend in llvm_codegen.cpp, so both build the same module
+
+// the alignment _Alignas and __attribute__((aligned(n))) ask for, at least the
+// type's own, and with -falign-large-arrays what an object allocated here gets
+unsigned declared_alignment(Object const*);
+unsigned allocation_alignment(Object const*, CodegenOptions const&);
+// the alignment to access an lvalue with, 0 if the type's own is enough
+unsigned stricter_alignment(Type const*, unsigned alignment);
+
+// https://llvm.org/docs/LangRef.html#thread-local-storage-models
+enum class ThreadLocalModel { None, GeneralDynamic, LocalDynamic, InitialExec, LocalExec };
+ThreadLocalModel thread_local_model(Object const*, bool is_definition, CodegenOptions const&);
+
+// unsigned comparisons, division and conversions, which include pointers and
+// _Bool, and the element type for vectors
+bool is_unsigned_type(FundamentalType);
+Type const* scalar_type(Type const*);
+
+// what pointer arithmetic counts in, char for void pointers
+Type const* element_type(Type const* pointer_type);
+
+// integer constants wrap to the width of the type they are converted to
+long long convert_integer_constant(long long constant, FundamentalType to);
+
+// 6.7.9 the value of a constant initializer of an object with static storage
+long long static_initializer_value(ASTNode const* initializer);
+
+// locals and parameters kept in SSA values instead of a stack slot: scalars
+// whose address is never taken, that aren't _Atomic, volatile or over-aligned.
+// Reads and writes of them become uses and definitions of SSA values, with
+// phis where blocks join, as in Braun et al., "Simple and Efficient SSA
+// Construction"
+bool is_promoted_local(Object const*);
+
+// https://llvm.org/docs/LangRef.html#add-instruction
+// 6.5p5 overflow in signed integer arithmetic is undefined, so + - * and <<
+// on signed integers are marked nsw, and LLVM may assume they don't wrap, e.g.
+// to widen an induction variable. Unsigned arithmetic wraps by definition, so
+// nothing is marked nuw, and vectors are left alone, as clang leaves them
+bool has_no_signed_wrap(ASTNodeType operator_type, Type const* type);
+
+// https://llvm.org/docs/LangRef.html#parameter-attributes
+// what a pointer parameter of a function definition promises. 6.7.3.1 the
+// objects accessed through a restrict pointer aren't accessed through anything
+// else while the function runs, which is noalias, and if they are const they
+// aren't modified at all, which is readonly. 6.7.6.3p7 int a[static 4] points
+// to at least 4 ints, so it is nonnull, dereferenceable for their size, and as
+// aligned as an int
+struct ParameterAttributes {
+  bool is_noalias;
+  bool is_readonly;
+  bool is_nonnull;
+  unsigned long long dereferenceable_bytes;
+  // 0 when nothing is known
+  unsigned alignment;
+};
+
+ParameterAttributes parameter_attributes(Object const* function_object, unsigned parameter_index, Type const* parameter_type);
+
+// https://llvm.org/docs/LangRef.html#function-attributes
+// the attributes of a function that infer_function_attributes found, for its
+// definition or declaration, or for a call to it. function_object is nullptr
+// for a call through a pointer. C has no exceptions, so nothing unwinds.
+// speculatable only goes on functions, LLVM rejects it on calls
+struct FunctionAttributeNames {
+  char const* names[8];
+  unsigned count;
+};
+
+FunctionAttributeNames function_attribute_names(Object const* function_object, bool is_call_site);
+
+// whether any parameter or local of the function lives in memory. LLVM takes
+// a tail call to mean the callee doesn't touch the caller's allocas, so only
+// functions without them mark their calls in tail position tail. musttail
+// calls are marked either way
+bool has_locals_in_memory(Object const* function_object);
+
+// a call in tail position to the function it is in, with an argument for
+// each parameter, which lowering turns into a jump back to the function's
+// start with the arguments as its parameters
+bool is_self_tail_call(Object const* function_object, ASTNode const* call_node);
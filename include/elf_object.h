@@ -0,0 +1,80 @@
+#pragma once
+
+#include <llvm/ADT/StringRef.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// x86-64 ELF relocatable objects
+//
+// What the native backend writes for -c instead of running as: sections of
+// bytes, the symbols defined in them or referenced from them, and the
+// relocations that refer to those symbols. Objects LLVM compiled can be
+// merged in, section by section, for the functions the native backend leaves
+// to LLVM, so that the result is one object either way.
+
+constexpr uint32_t no_elf_section = UINT32_MAX;
+
+struct ElfRelocation {
+  uint64_t offset;
+  uint32_t symbol;
+  uint32_t type;
+  int64_t addend;
+};
+
+struct ElfSection {
+  std::string name;
+  uint32_t type;
+  uint64_t flags;
+  uint64_t alignment;
+  uint64_t entry_size;
+  // nothing for SHT_NOBITS sections, which only have a size
+  std::vector<char> bytes;
+  uint64_t size;
+  std::vector<ElfRelocation> relocations;
+};
+
+struct ElfSymbol {
+  std::string name;
+  // no_elf_section while the symbol is only referenced
+  uint32_t section;
+  uint64_t value;
+  uint64_t size;
+  uint8_t binding;
+  uint8_t type;
+  uint8_t visibility;
+};
+
+struct ElfObject {
+  std::vector<ElfSection> sections;
+  std::vector<ElfSymbol> symbols;
+  // the named symbols, section symbols have no name
+  std::unordered_map<std::string, uint32_t> symbol_indices;
+  // the STT_SECTION symbol of each section, UINT32_MAX until one is needed
+  std::vector<uint32_t> section_symbols;
+};
+
+// the section with this name, added with the rest if there is none yet
+uint32_t elf_section(ElfObject*, std::string const& name, uint32_t type, uint64_t flags);
+
+// where in the section the bytes now start, after padding to alignment.
+// Without bytes, size zeros, which for SHT_NOBITS take no space
+uint64_t append_to_elf_section(ElfObject*, uint32_t section, char const* bytes, uint64_t size, uint64_t alignment);
+
+// the index of the symbol with this name, referenced but undefined until it
+// is defined
+uint32_t elf_symbol(ElfObject*, std::string const& name);
+void define_elf_symbol(ElfObject*, uint32_t symbol, uint32_t section, uint64_t value, uint64_t size, uint8_t binding, uint8_t type);
+
+uint32_t elf_section_symbol(ElfObject*, uint32_t section);
+
+// appends the allocated sections of an object, with their symbols and
+// relocations. Symbols one object references and the other defines are the
+// same symbol from then on. False if it isn't an x86-64 object this can merge
+bool merge_elf_object(ElfObject*, llvm::StringRef object);
+
+// after anything outfile already had buffered
+void write_elf_object(ElfObject const*, FILE* outfile);
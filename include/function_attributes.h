@@ -0,0 +1,23 @@
+#pragma once
+
+#include "parser.h"
+
+// Function attribute inference
+//
+// Runs after semantic analysis, which calls it. The call graph of the function
+// definitions is split into strongly connected components, and these are
+// walked bottom-up, callees before their callers, so what a function does is
+// what its own body does plus what the functions it calls do. The functions
+// of one component call each other, and are iterated over until what they do
+// settles. Each function definition's inferred_attributes are filled in, and
+// those of the functions the C library declares never to return, so codegen
+// can put them on definitions, declarations and calls.
+//
+// Memory is either reached through a pointer parameter the function never
+// reassigns, argument memory, or other memory visible to the caller, e.g. a
+// global. A local whose address isn't passed on is neither. A call through a
+// pointer, or to a function that is only declared, may do anything
+void infer_function_attributes(ExternalDeclaration*);
+
+// the function a call calls directly, nullptr for a call through a pointer
+Object const* called_function(ASTNode const* call_node);
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "optimizer.h"
+
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+// Running programs in process
+//
+// --run compiles the translation units into this process with LLVM's ORC
+// LLJIT and calls main, instead of writing a .ll or .o to link and execute.
+// Anything the program doesn't define, e.g. printf, is looked up in this
+// process, which has libc loaded.
+
+struct JitSession {
+  std::unique_ptr<llvm::orc::LLJIT> jit;
+};
+
+// for the host only, code is compiled at the given level. Exits if LLVM can't
+// JIT for the host
+JitSession* new_jit_session(OptimizationLevel);
+void free_jit_session(JitSession*);
+
+// modules are compiled lazily, on lookup, each with the context it was built in
+void add_module_to_jit(JitSession*, std::unique_ptr<llvm::Module>, std::unique_ptr<llvm::LLVMContext>);
+
+typedef int (*MainFunction)(int, char**);
+
+// compiles whatever main needs, exits if no module defines it
+MainFunction compile_main(JitSession*);
+
+// arguments[0] is the program's name, gives main's exit code
+int run_main(MainFunction, std::vector<std::string> const& arguments);
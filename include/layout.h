@@ -0,0 +1,71 @@
+#pragma once
+
+#include "parser.h"
+#include "type.h"
+
+#include <cstdio>
+#include <vector>
+
+// Object layout
+//
+// Sizes and alignments of types in bytes, and where the members of structs
+// and unions go. A struct's layout is computed the first time something asks
+// for it, then cached on its StructData, so codegen and the padding report
+// share one computation per struct type however often the type is used.
+//
+// 6.7.2.1 members are placed in increasing order of address, each at the next
+// multiple of its alignment. The struct's alignment is the strictest of its
+// members', and its size is rounded up to that, so arrays of it stay aligned.
+// A flexible array member adds alignment but no size.
+
+struct StructLayout {
+  unsigned long long size;
+  unsigned alignment;
+
+  // indexed like StructData::members, i.e. in declaration order
+  std::vector<unsigned long long> member_offsets;
+
+  // member indices in the order they are placed in memory, the declaration
+  // order unless the struct may be reordered
+  std::vector<unsigned> member_order;
+};
+
+unsigned long long size_of_type(Type const*);
+unsigned alignment_of_type(Type const*);
+
+StructLayout const* struct_layout(Type const* struct_type);
+
+// the index of the member named identifier, or -1
+int find_struct_member(Type const* struct_type, std::string const& identifier);
+
+// -Wpadded
+//
+// the padding a struct's layout leaves, and the member order that leaves the
+// least. Sorting the members by decreasing alignment is optimal: every size is
+// a multiple of its alignment, so after the first member each one already
+// starts aligned and only the tail padding remains
+
+struct PaddingHole {
+  // the hole follows this member, the last member's hole is the tail padding
+  unsigned member_index;
+  unsigned long long size;
+};
+
+struct StructPaddingReport {
+  unsigned long long padding;
+  std::vector<PaddingHole> holes;
+
+  std::vector<unsigned> optimal_order;
+  unsigned long long optimal_size;
+};
+
+StructPaddingReport struct_padding_report(Type const* struct_type);
+
+// reports every struct used by the translation unit that has padding
+void print_padding_report(ExternalDeclaration const*, FILE*);
+
+// lets the layout of structs that never leave the translation unit use the
+// optimal member order. A struct leaves when it is reachable from the type of
+// anything with external linkage, or a pointer to it is converted to another
+// pointer type. Must run before anything asks for a layout
+void mark_reorderable_structs(ExternalDeclaration const*);
@@ -168,6 +168,7 @@ bool token_equals(Token const*, Token const*);
 
 Token* get_current_token(Lexer*);
 Token const* get_next_token(Lexer*);
+Token peek_next_token(Lexer const*);
 Token error_token(Lexer*, char const*);
 void lexer_print_error_message(Lexer*, char const*);
 Token const* expect_next_token_and_skip(Lexer* lexer, TokenType type, char const*);
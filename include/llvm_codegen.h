@@ -0,0 +1,31 @@
+#pragma once
+
+#include "codegen.h"
+
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+
+#include <memory>
+#include <unordered_set>
+
+// In-memory codegen
+//
+// The text emitter in codegen.cpp prints IR that every downstream tool has to
+// parse again. This backend lowers the AST the same way, in the same post
+// order walk, but builds an llvm::Module through IRBuilder, which can then be
+// written as bitcode, optimized or compiled without going through text.
+
+// the context must be fresh: on LLVM versions where pointers are still typed
+// by default, opaque pointers have to be enabled before the first one is made.
+// With functions, only those are defined and everything else they use is
+// declared, for the native backend to link against what it compiled itself
+std::unique_ptr<llvm::Module> build_llvm_module(ExternalDeclaration const*, llvm::LLVMContext&, CodegenOptions const& options = {},
+    std::unordered_set<Object const*> const* functions = nullptr);
+
+// writing a module out, e.g. after optimize_module, after anything outfile
+// already had buffered
+void write_bitcode(llvm::Module const&, FILE*);
+void write_textual_ir(llvm::Module const&, FILE*);
+
+// --emit=bc, build_llvm_module then write_bitcode
+void emit_bitcode_from_translation_unit(ExternalDeclaration const*, FILE*, CodegenOptions const& options = {});
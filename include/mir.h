@@ -0,0 +1,345 @@
+#pragma once
+
+#include "codegen.h"
+#include "output_buffer.h"
+#include "tbaa.h"
+
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Mid-level IR
+//
+// With --mir, function definitions are lowered from the AST to a small SSA IR
+// of our own, optimized there by the passes in mir_passes.cpp, and printed as
+// LLVM IR, without ever building an LLVM module. Functions that use something
+// it has no instructions for, e.g. atomics or vectors, are emitted by
+// codegen.cpp as before, so the two can be mixed in one module.
+//
+// A function is a control flow graph of basic blocks, each a dense array of
+// instruction numbers. Instructions, constants, arguments and globals are all
+// values in one table, numbered densely, and refer to their operands by
+// number. Each value keeps a list of its uses, so passes can replace it
+// everywhere or tell that it is dead. The arrays hanging off values and blocks
+// are allocated from an arena owned by the function, and go away with it.
+
+// bump allocation in chunks, freed all at once with the function
+struct MirArena {
+  std::vector<char*> chunks;
+  char* next = nullptr;
+  char* end = nullptr;
+};
+
+void* arena_allocate(MirArena*, size_t size, size_t alignment);
+void free_arena(MirArena*);
+
+// a growable array in an arena. Growing copies it to a block twice the size,
+// the old one is only reclaimed with the arena
+template <typename T> struct MirArray {
+  T* data = nullptr;
+  uint32_t size = 0;
+  uint32_t capacity = 0;
+
+  T& operator[](uint32_t i) { return data[i]; }
+  T const& operator[](uint32_t i) const { return data[i]; }
+  T* begin() { return data; }
+  T* end() { return data + size; }
+  T const* begin() const { return data; }
+  T const* end() const { return data + size; }
+};
+
+template <typename T> void array_push(MirArena* arena, MirArray<T>* array, T element)
+{
+  if (array->size == array->capacity) {
+    uint32_t capacity = array->capacity ? array->capacity * 2 : 4;
+    T* data = (T*)arena_allocate(arena, capacity * sizeof(T), alignof(T));
+    if (array->size)
+      memcpy((void*)data, array->data, array->size * sizeof(T));
+    array->data = data;
+    array->capacity = capacity;
+  }
+  array->data[array->size++] = element;
+}
+
+// removes the element at index, keeping the order of the rest
+template <typename T> void array_erase(MirArray<T>* array, uint32_t index)
+{
+  memmove((void*)(array->data + index), array->data + index + 1, (array->size - index - 1) * sizeof(T));
+  array->size--;
+}
+
+template <typename T> void array_insert(MirArena* arena, MirArray<T>* array, uint32_t index, T element)
+{
+  array_push(arena, array, element);
+  memmove((void*)(array->data + index + 1), array->data + index, (array->size - index - 1) * sizeof(T));
+  array->data[index] = element;
+}
+
+// values and blocks are numbered within their function
+typedef uint32_t MirValue;
+constexpr MirValue no_mir_value = UINT32_MAX;
+constexpr uint32_t no_mir_block = UINT32_MAX;
+
+// the first class types of LLVM that C scalars map to. Signedness is in the
+// instructions, as it is in LLVM's
+enum class MirType : uint8_t { Void, I1, I8, I16, I32, I64, Float, Double, Ptr };
+constexpr unsigned mir_type_count = (unsigned)MirType::Ptr + 1;
+
+enum class MirOpcode : uint8_t {
+  // values that aren't instructions and belong to no block
+  Constant,
+  Undef,
+  Argument,
+  Global,
+
+  // an erased instruction keeps its number, but is in no block and unused
+  Erased,
+
+  // https://llvm.org/docs/LangRef.html#binary-operations
+  Add,
+  Sub,
+  Mul,
+  SDiv,
+  UDiv,
+  SRem,
+  URem,
+  Shl,
+  LShr,
+  AShr,
+  And,
+  Or,
+  Xor,
+  FAdd,
+  FSub,
+  FMul,
+  FDiv,
+  FNeg,
+
+  // comparisons give an i1, see MirPredicate
+  ICmp,
+  FCmp,
+
+  // https://llvm.org/docs/LangRef.html#conversion-operations
+  Trunc,
+  ZExt,
+  SExt,
+  FPTrunc,
+  FPExt,
+  FPToSI,
+  FPToUI,
+  SIToFP,
+  UIToFP,
+  PtrToInt,
+  IntToPtr,
+
+  // Alloca is in the entry block, constant is its size in bytes. PtrAdd is a
+  // getelementptr i8, a pointer plus a byte offset
+  Alloca,
+  Load,
+  Store,
+  PtrAdd,
+
+  // operand 0 is the callee, the rest are the arguments
+  Call,
+
+  // operands pair up with incoming_blocks
+  Phi,
+
+  // the targets of a block's terminator are its successors, in order. CondBr
+  // goes to the first if its operand is true
+  Br,
+  CondBr,
+  Ret,
+  Unreachable,
+};
+
+// https://llvm.org/docs/LangRef.html#poison-values
+// promises about an instruction's operands, which make it poison when broken,
+// see has_no_signed_wrap. NoSignedWrap is for Add, Sub, Mul and Shl, Exact for
+// SDiv and InBounds for PtrAdd
+enum MirFlag : uint8_t { MirNoSignedWrap = 1, MirExact = 2, MirInBounds = 4 };
+
+enum class MirPredicate : uint8_t { None, Eq, Ne, SLT, SLE, SGT, SGE, ULT, ULE, UGT, UGE, OEq, UNe, OLT, OLE, OGT, OGE };
+
+// who uses a value, and as which of its operands
+struct MirUse {
+  MirValue user;
+  uint32_t operand;
+};
+
+struct MirInstruction {
+  MirOpcode opcode;
+  MirType type;
+  MirPredicate predicate;
+  // MirFlags
+  uint8_t flags;
+
+  // the block an instruction is in, no_mir_block for other values
+  uint32_t block;
+
+  MirArray<MirValue> operands;
+  MirArray<MirUse> uses;
+
+  // Phi: the block each operand comes from
+  MirArray<uint32_t> incoming_blocks;
+
+  // Constant: integers sign extended from their width, i1 as 0 or 1, floating
+  // point as a double's bits. Argument: its index. Alloca: its size
+  long long constant;
+
+  // Alloca, Load and Store: the alignment, 0 for the type's own
+  unsigned alignment;
+  // Load and Store: the number of their TBAA access tag, see tbaa.h, 0 for none
+  unsigned tbaa_tag;
+
+  // Global: the function or object with static storage
+  Object const* global;
+
+  // Call: the callee's type, which is printed for variadic ones
+  Type const* function_type;
+  // Call: tail or musttail, see has_locals_in_memory
+  TailCallKind tail_call_kind;
+};
+
+struct MirBlock {
+  // phis first, the terminator last
+  MirArray<MirValue> instructions;
+  MirArray<uint32_t> predecessors;
+  MirArray<uint32_t> successors;
+
+  // unreachable blocks are removed by the passes, their number stays unused
+  bool is_removed;
+
+  // see compute_dominator_tree, no_mir_block for the entry and unreachable
+  // blocks
+  uint32_t immediate_dominator;
+  MirArray<uint32_t> dominated;
+  // when a depth first walk of the dominator tree enters and leaves the
+  // block, a block dominates the ones it encloses, see mir_block_dominates
+  uint32_t dominator_tree_entry;
+  uint32_t dominator_tree_exit;
+  // the block's position in reverse post order
+  uint32_t order;
+};
+
+struct MirFunction {
+  Object const* object;
+  MirType return_type;
+  MirArena arena;
+
+  std::vector<MirInstruction> values;
+  // the entry is block 0
+  std::vector<MirBlock> blocks;
+  // arguments are values 0 to parameter_count - 1
+  unsigned parameter_count;
+
+  // constants, globals and undef are made once per function, so the same
+  // constant is always the same value
+  std::unordered_map<long long, MirValue> constants[mir_type_count];
+  std::unordered_map<Object const*, MirValue> globals;
+  MirValue undefs[mir_type_count];
+
+  // reachable blocks in reverse post order, filled in with the dominator tree
+  std::vector<uint32_t> reverse_post_order;
+};
+
+MirFunction* new_mir_function(Object const* function_object);
+void free_mir_function(MirFunction*);
+
+// the MirType of a C scalar type. Long double is only one where it is a double
+MirType mir_type(Type const*);
+bool is_mir_type(Type const*);
+unsigned mir_type_bit_width(MirType);
+inline bool is_mir_float_type(MirType t) { return t == MirType::Float || t == MirType::Double; }
+inline bool is_mir_integer_type(MirType t) { return t >= MirType::I1 && t <= MirType::I64; }
+
+// integer constants wrap to the width of their type
+long long normalize_mir_constant(MirType, long long);
+
+MirValue mir_constant(MirFunction*, MirType, long long);
+MirValue mir_float_constant(MirFunction*, MirType, double);
+MirValue mir_undef(MirFunction*, MirType);
+MirValue mir_global(MirFunction*, Object const*);
+inline bool is_mir_constant(MirFunction const* function, MirValue value) { return function->values[value].opcode == MirOpcode::Constant; }
+
+uint32_t new_mir_block(MirFunction*);
+
+// appends an instruction to the end of a block
+MirValue append_mir_instruction(MirFunction*, uint32_t block, MirOpcode, MirType, std::initializer_list<MirValue> operands);
+// inserts an instruction before the one at position in its block
+MirValue insert_mir_instruction(MirFunction*, uint32_t block, uint32_t position, MirOpcode, MirType, std::initializer_list<MirValue> operands);
+void add_mir_operand(MirFunction*, MirValue user, MirValue operand);
+void set_mir_operand(MirFunction*, MirValue user, uint32_t operand, MirValue value);
+
+// phis
+void add_mir_phi_incoming(MirFunction*, MirValue phi, MirValue value, uint32_t block);
+void remove_mir_phi_incoming(MirFunction*, MirValue phi, uint32_t incoming);
+
+// edges of the control flow graph, which terminators have to agree with
+void add_mir_edge(MirFunction*, uint32_t from, uint32_t to);
+// also takes the edge out of the phis of to
+void remove_mir_edge(MirFunction*, uint32_t from, uint32_t to);
+
+void replace_all_mir_uses(MirFunction*, MirValue value, MirValue replacement);
+// takes an instruction out of its block and drops its uses of its operands
+void erase_mir_instruction(MirFunction*, MirValue);
+// moves an instruction to before the terminator of another block
+void move_mir_instruction(MirFunction*, MirValue, uint32_t to_block);
+
+MirValue mir_terminator(MirFunction const*, uint32_t block);
+bool is_mir_terminator(MirOpcode);
+// loads, stores, calls, allocas and terminators stay where they are, and are
+// never removed for being unused, except for loads and allocas
+bool mir_has_side_effects(MirOpcode);
+// calls may trap unless the callee is speculatable, see function_attributes.h
+bool mir_may_trap(MirFunction const*, MirValue);
+// the function a call calls directly, nullptr for a call through a pointer
+Object const* mir_called_function(MirFunction const*, MirValue call);
+
+// Cooper, Harvey and Kennedy, "A Simple, Fast Dominance Algorithm", which
+// iterates over the blocks in reverse post order until the immediate
+// dominators settle
+void compute_dominator_tree(MirFunction*);
+bool mir_block_dominates(MirFunction const*, uint32_t dominator, uint32_t block);
+
+// whether the function is well formed: every use is in the use lists, phis
+// agree with their block's predecessors, and values dominate their uses.
+// Describes the first problem in error
+bool verify_mir_function(MirFunction*, std::string* error);
+
+// AST to MIR, see mir_lowering.cpp. Returns nullptr for functions that use
+// something the MIR can't express
+// tbaa_tag numbers come from tbaa, nullptr leaves loads and stores without
+MirFunction* lower_function_to_mir(Object const* function_object, CodegenOptions const&, TBAAMetadata const* tbaa = nullptr);
+
+// the blocks of the function as LLVM IR, after the define line's {
+void emit_mir_function_body(MirFunction const*, OutputBuffer*);
+
+// Passes
+//
+// Each pass runs over one function and returns whether it changed it. A
+// pipeline is a list of passes by name, e.g. "sccp,dce,gvn,licm,dce", run in
+// order on each function
+struct MirPass {
+  char const* name;
+  bool (*run)(MirFunction*);
+};
+
+// sparse conditional constant propagation, Wegman and Zadeck
+bool run_sccp(MirFunction*);
+// unused instructions without side effects, and unreachable blocks
+bool run_dce(MirFunction*);
+// dominator based global value numbering
+bool run_gvn(MirFunction*);
+// loop invariant code motion into the preheader
+bool run_licm(MirFunction*);
+
+extern char const default_mir_pipeline[];
+
+// the passes of a comma separated pipeline, false if a name is unknown, which
+// is then in unknown_pass
+bool parse_mir_pipeline(std::string const& pipeline, std::vector<MirPass const*>* passes, std::string* unknown_pass);
+void run_mir_passes(MirFunction*, std::vector<MirPass const*> const& passes);
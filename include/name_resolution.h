@@ -0,0 +1,15 @@
+#pragma once
+
+#include "parser.h"
+
+// Name resolution
+//
+// Block scope identifiers are bound while parsing, since the parser already
+// has the right scope in hand. File scope identifiers can be redeclared, and a
+// function can call another defined later in the file, so they are bound
+// afterwards, once the whole translation unit is known.
+//
+// After resolve_names, every variable reference's object points at the Object
+// it denotes: a local or parameter with a slot, or the canonical declaration
+// of a file scope identifier. Later passes never look identifiers up by name.
+void resolve_names(ExternalDeclaration*);
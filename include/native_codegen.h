@@ -0,0 +1,25 @@
+#pragma once
+
+#include "codegen.h"
+#include "target_machine.h"
+
+#include <cstdio>
+
+// Native codegen
+//
+// --backend=native skips LLVM for what it can and writes x86-64 System V code
+// itself, as assembly or straight to an ELF object, for builds where compile
+// time matters more than the code, like an edit, compile and run loop. Each
+// function definition is lowered to the mid-level IR (mir.h) and emitted in a
+// single pass over it, in the manner of TCC: every value lives in a stack
+// slot, and the registers only cache values loaded from their slots, until a
+// label or a call. Functions the mid-level IR can't express are compiled by
+// LLVM instead, at -O0, and their code ends up in the same file.
+
+enum class NativeFileKind { Assembly, Object };
+
+// writes the translation unit as assembly in AT&T syntax or as an object
+// file, after anything outfile already had buffered. The target must be x86-64
+// Linux, without -fpic. machine_options are for the functions LLVM compiles
+void emit_native_from_translation_unit(ExternalDeclaration const*, FILE* outfile, NativeFileKind file_kind, MachineOptions const& machine_options = {},
+    CodegenOptions const& options = {});
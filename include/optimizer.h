@@ -0,0 +1,34 @@
+#pragma once
+
+#include <llvm/IR/Module.h>
+#include <llvm/Target/TargetMachine.h>
+
+#include <string>
+
+// In-process optimization
+//
+// Instead of handing the .ll file to a separate opt, which launches another
+// process and parses the IR again, the module llvm_codegen.cpp builds is run
+// through the new pass manager's default pipelines right here, and only then
+// written out.
+
+enum class OptimizationLevel { O0, O1, O2, O3, Os };
+
+struct OptimizationOptions {
+  OptimizationLevel level = OptimizationLevel::O0;
+
+  // --passes=<pipeline>, in opt's syntax, e.g. "function(sroa,instcombine)",
+  // instead of the level's default pipeline
+  std::string passes;
+
+  // --time-passes: report how long each pass took, to stderr
+  bool time_passes = false;
+};
+
+// whether there is any pass to run at all. At -O0 without --passes the module
+// is left as codegen built it, and the text emitter can write it directly
+bool runs_passes(OptimizationOptions const&);
+
+// the target machine, if any, supplies the cost model, see target_machine.h.
+// Exits if the --passes pipeline doesn't parse
+void optimize_module(llvm::Module&, OptimizationOptions const&, llvm::TargetMachine* machine = nullptr);
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <type_traits>
+
+// Buffered output for codegen
+//
+// Printing an instruction with fprintf parses the format string and takes the
+// FILE's lock on every call, which is most of what emitting it costs. Codegen
+// instead appends the pieces of each instruction, i.e. opcodes, type strings
+// rendered once per type and register numbers, to one contiguous buffer,
+// which goes to the file descriptor in a single write once it holds a
+// megabyte.
+//
+// print(output, "  %", reg, " = load ", type_string, ", ptr %", address, "\n")
+// appends each argument in turn: strings as they are, integers in decimal.
+//
+// A buffer without a file descriptor keeps everything in memory, growing as
+// needed, e.g. for a function emitted on another thread, which is appended to
+// the file's buffer once the functions before it have been.
+
+// how much is buffered before it is written out
+constexpr size_t output_buffer_capacity = 1 << 20;
+
+// what an in-memory buffer starts out with
+constexpr size_t memory_output_buffer_capacity = 1 << 14;
+
+struct OutputBuffer {
+  // -1 for an in-memory buffer
+  int fd;
+  char* data;
+  size_t size;
+  size_t capacity;
+};
+
+OutputBuffer* new_output_buffer(int fd);
+OutputBuffer* new_memory_output_buffer();
+
+// writes out whatever is buffered, and exits if that fails. In-memory
+// buffers keep it
+void flush_output_buffer(OutputBuffer*);
+
+// flushes, then frees the buffer. The file descriptor stays open
+void free_output_buffer(OutputBuffer*);
+
+// the slow path of append_bytes, for when the buffer is full: a file's buffer
+// is written out, an in-memory one grows
+void flush_and_append_bytes(OutputBuffer*, char const* bytes, size_t length);
+
+inline void append_bytes(OutputBuffer* output, char const* bytes, size_t length)
+{
+  if (output->size + length > output->capacity) {
+    flush_and_append_bytes(output, bytes, length);
+    return;
+  }
+
+  memcpy(output->data + output->size, bytes, length);
+  output->size += length;
+}
+
+// in decimal, two digits at a time
+void append_unsigned(OutputBuffer*, unsigned long long);
+void append_signed(OutputBuffer*, long long);
+
+// e.g. the bits of an x86_fp80 constant, in upper case hex padded to digits
+void append_hex(OutputBuffer*, unsigned long long, unsigned digits);
+
+// string literals know their length at compile time, the terminator is not
+// part of it
+template<typename T> inline void print_part(OutputBuffer* output, T const& part)
+{
+  if constexpr (std::is_array_v<T>)
+    append_bytes(output, part, std::extent_v<T> - 1);
+  else if constexpr (std::is_same_v<T, char>)
+    append_bytes(output, &part, 1);
+  else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>)
+    append_signed(output, part);
+  else if constexpr (std::is_integral_v<T>)
+    append_unsigned(output, part);
+  else if constexpr (std::is_same_v<T, std::string>)
+    append_bytes(output, part.data(), part.size());
+  else
+    append_bytes(output, part, strlen(part));
+}
+
+// everything in an in-memory buffer, in order
+inline void append_output_buffer(OutputBuffer* output, OutputBuffer const* from) { append_bytes(output, from->data, from->size); }
+
+template<typename... Parts> inline void print(OutputBuffer* output, Parts const&... parts) { (print_part(output, parts), ...); }
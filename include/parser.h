@@ -6,6 +6,7 @@
 #include <cstdlib>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 struct ASTNode;
 
@@ -16,6 +17,38 @@ enum class ASTNodeType {
   NumericConstant,
   VariableReference,
 
+  // postfix expressions
+  FunctionCall,
+  MemberAccess,
+  PointerMemberAccess,
+  Subscript,
+
+  // GCC vector builtins, __builtin_shufflevector(lhs, rhs, indices...) and
+  // __builtin_convertvector(lhs, type)
+  ShuffleVector,
+  ConvertVector,
+
+  // C11 7.17 atomic generic functions, e.g. atomic_fetch_add_explicit. The
+  // arguments are in rhs like a call's, memory orders included
+  AtomicLoad,
+  AtomicStore,
+  AtomicExchange,
+  AtomicCompareExchangeStrong,
+  AtomicCompareExchangeWeak,
+  AtomicFetchAdd,
+  AtomicFetchSub,
+  AtomicFetchAnd,
+  AtomicFetchOr,
+  AtomicFetchXor,
+  AtomicThreadFence,
+
+  // unary expressions
+  Negation,
+  BitwiseNot,
+  LogicalNot,
+  AddressOf,
+  Dereference,
+
   // binary expressions
   Multiplication,
   Division,
@@ -38,21 +71,109 @@ enum class ASTNodeType {
   ConditionalExpression,
   Assignment,
 
+  // 6.5.16.2 compound assignments, E1 op= E2 is E1 = E1 op E2 with E1
+  // evaluated only once
+  MultiplicationAssignment,
+  DivisionAssignment,
+  ModuloAssignment,
+  AdditionAssignment,
+  SubtractionAssignment,
+  BitShiftLeftAssignment,
+  BitShiftRightAssignment,
+  BitwiseAndAssignment,
+  BitwiseXorAssignment,
+  BitwiseOrAssignment,
+
+  // inserted by semantic analysis, converts lhs to the node's expression_type
+  ImplicitConversion,
+
   // control flow
   If,
   Switch,
   For,
+  While,
+  DoWhile,
   Return,
 
   // declarations
   Declaration
 };
 
+// how a call that is the operand of a return is made, see semantic_analysis.cpp
+// and https://llvm.org/docs/LangRef.html#call-instruction
+enum class TailCallKind { None, Tail, MustTail };
+
+// C11 7.17.3 memory_order, numbered as <stdatomic.h> numbers them
+enum class MemoryOrder { Relaxed, Consume, Acquire, Release, AcquireRelease, SequentiallyConsistent };
+
+// what the declaration of a parameter says about the objects it points to,
+// which isn't part of its (adjusted) type
+struct ParameterDeclaration {
+  // e.g. const int* p or const int a[], the objects pointed to are const
+  bool is_pointee_const;
+  // int a[static N], a points to at least N elements, 0 otherwise
+  long long static_length;
+};
+
+// what a function does, and doesn't, see function_attributes.h. Functions
+// that are only declared may do anything
+struct FunctionAttributes {
+  bool reads_argument_memory;
+  bool writes_argument_memory;
+  bool reads_other_memory;
+  bool writes_other_memory;
+  // never calls itself, directly or through other functions
+  bool is_norecurse;
+  bool will_return;
+  bool is_noreturn;
+  // may be called where the program wouldn't have, e.g. hoisted out of a loop
+  // that never runs: it returns, touches no memory and can't trap
+  bool is_speculatable;
+};
+
 // functions or variables
 struct Object {
   std::string identifier;
   Type const* type;
   ASTNode* function_body;
+
+  // storage class, function and alignment specifiers, these belong to the
+  // declared object rather than to its type
+  DeclarationSpecifierFlags declaration_specifiers;
+
+  // __attribute__((aligned(n))) on this declarator, 0 without it. _Alignas
+  // is a declaration specifier and applies to every declarator
+  unsigned alignment;
+
+  // locals and parameters are numbered densely within their function in order
+  // of declaration, parameters first, so codegen can keep them in a vector
+  // objects with static storage duration have no slot and are -1
+  int local_slot;
+
+  // function definitions: how many local slots their body uses
+  unsigned local_count;
+
+  // function definitions: the objects their parameters are bound to, in order
+  std::vector<Object*> parameter_objects;
+
+  // locals: whether semantic analysis saw their address taken with &, which
+  // keeps them in memory, see is_promoted_local
+  bool is_address_taken;
+
+  // function declarators: the names given to the parameters, in order, empty
+  // for unnamed ones. Names aren't part of the (interned) function type
+  std::vector<std::string> parameter_identifiers;
+  // function declarators: what the declarations of the parameters say beyond
+  // their types, in order
+  std::vector<ParameterDeclaration> parameter_declarations;
+
+  // functions: filled in by infer_function_attributes for definitions
+  FunctionAttributes inferred_attributes;
+
+  // file scope objects: the declaration of this identifier that every
+  // reference is bound to, and that codegen emits. A definition wins over
+  // declarations, otherwise it is the first declaration
+  bool is_canonical;
 };
 
 struct Scope {
@@ -60,6 +181,8 @@ struct Scope {
   Type const* return_type;
   std::unordered_map<std::string, Object*> variables;
   std::unordered_map<std::string, Object*> typedef_names;
+  // 6.2.3 struct, union and enum tags have a name space of their own
+  std::unordered_map<std::string, Type*> tags;
 };
 
 struct ASTNode {
@@ -68,6 +191,10 @@ struct ASTNode {
 
   FundamentalType data_type;
 
+  // expressions: the type of the expression, after any conversions of its
+  // operands, filled in by semantic analysis. Null for statements
+  Type const* expression_type;
+
   union {
     char char_data;
 
@@ -92,11 +219,27 @@ struct ASTNode {
   // for ternary conditional, while, for and if
   ASTNode* conditional;
 
-  // declarations/definitions
+  // loop bodies, kept out of next so a loop can be followed by more statements
+  ASTNode* body;
+
+  // declarations/definitions, and for variable references the declaration
+  // they refer to, see name_resolution.cpp
   Object* object;
 
-  // variable references
+  // variable references, and the member named by . and ->
   std::string referenced_variable;
+
+  // member accesses: the member's index in its struct, in declaration order
+  // filled in by semantic analysis
+  unsigned member_index;
+
+  // function calls: Tail when the call is the operand of a return, MustTail
+  // when that return is marked __attribute__((musttail))
+  TailCallKind tail_call_kind;
+
+  // __builtin_shufflevector: which element of lhs then rhs each element of the
+  // result is, -1 for any
+  std::vector<int> shuffle_mask;
 };
 
 enum class ExternalDeclarationType { FunctionDefinition, Declaration };
@@ -104,7 +247,7 @@ enum class ExternalDeclarationType { FunctionDefinition, Declaration };
 struct ExternalDeclaration {
   ExternalDeclaration* next;
   ExternalDeclarationType type;
-  ASTNode const* root_ast_node;
+  ASTNode* root_ast_node;
 };
 
 ASTNode* new_ast_node(Scope*, ASTNodeType);
@@ -113,12 +256,20 @@ bool expect_token_type(Token*, TokenType);
 Type const* declaration_to_fundamental_type(DeclarationSpecifierFlags*);
 
 Object* variable_in_scope(std::string const&, Scope*);
+void declare_identifier(Scope*, Object*);
+Object* new_object(std::string const&, Type const*);
 
 // expressions
 
 ASTNode* parse_expression(Lexer*, Scope*);
 ASTNode* parse_primary_expression(Lexer*, Scope*);
 ASTNode* parse_assignment_expression(Lexer*, Scope*);
+ASTNode* parse_conditional_expression(Lexer*, Scope*);
+long long numeric_constant_value(ASTNode const*);
+
+// the binary operator of a compound assignment, e.g. Addition for +=, Void
+// for anything else
+ASTNodeType compound_assignment_operator(ASTNodeType);
 
 // declarations
 bool token_is_declaration_specifier(Token const*, Scope*);
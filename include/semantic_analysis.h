@@ -0,0 +1,16 @@
+#pragma once
+
+#include "parser.h"
+
+// Semantic analysis
+//
+// Runs after name resolution. Computes the type of every expression into
+// expression_type, checks operands against their operators (6.5), and makes
+// the implicit conversions of 6.3 explicit as ImplicitConversion nodes, so
+// codegen reads types straight off the AST.
+//
+// A function body only depends on file scope declarations, which nothing
+// writes to at this point, so function definitions are analyzed
+// independently, spread over thread_count threads. Function attributes are
+// inferred last, see function_attributes.h.
+void analyze_translation_unit(ExternalDeclaration*, unsigned thread_count);
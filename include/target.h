@@ -0,0 +1,48 @@
+#pragma once
+
+#include "type.h"
+
+// Target description
+//
+// What the C types look like on the machine being compiled for. 6.2.5 leaves
+// the widths of long, pointers and long double, and the signedness of plain
+// char, to the implementation, and the ABIs disagree: long is 64 bits on LP64
+// targets and 32 on ILP32 and LLP64 ones. Everything that needs a size or an
+// alignment (layout, codegen, constant conversions) asks the current target,
+// and codegen names it in the module, so LLVM lays out memory the same way.
+
+struct TargetDescription {
+  char const* triple;
+  // the architecture, also accepted on its own by --target
+  char const* architecture;
+  // https://llvm.org/docs/LangRef.html#data-layout
+  char const* datalayout;
+
+  unsigned pointer_width;
+  unsigned long_width;
+  // long long and double are 8 bytes everywhere, but only 4 byte aligned on i386
+  unsigned long_long_alignment;
+  unsigned double_alignment;
+
+  // the LLVM type of long double, how many of its bits hold the value, and
+  // what it takes up in memory, e.g. x86_fp80 has 80 bits padded out to 16 bytes
+  char const* long_double_type;
+  unsigned long_double_width;
+  unsigned long_double_size;
+  unsigned long_double_alignment;
+
+  bool char_is_signed;
+};
+
+extern TargetDescription const* current_target;
+
+// selects the target by triple or architecture name, false if there is no
+// such target. Types remember their sizes and LLVM spelling, so this must run
+// before anything is compiled
+bool set_target(char const* name);
+
+// the machine the compiler itself runs on, the default target
+TargetDescription const* host_target();
+
+// 7.19 ptrdiff_t, the signed integer type as wide as a pointer
+Type const* ptrdiff_type();
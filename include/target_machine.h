@@ -0,0 +1,42 @@
+#pragma once
+
+#include "codegen.h"
+#include "optimizer.h"
+
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Target/TargetMachine.h>
+
+#include <memory>
+#include <string>
+
+// Native code
+//
+// An LLVM TargetMachine for the current target compiles the module straight
+// to an object file, in process, where it used to be handed to llc and then
+// an assembler as text. The same TargetMachine tells the optimization
+// pipelines what the target's instructions cost.
+
+// what to compile for beyond the triple, from the command line
+struct MachineOptions {
+  // -mcpu=<cpu>, the triple's generic CPU if empty, the host's for "native"
+  std::string cpu;
+
+  // -mattr=<features>, e.g. "+avx2,-sse4a", added to the CPU's own
+  std::string features;
+};
+
+// registers the backends of the targets in target.cpp with LLVM, once
+void initialize_backends();
+
+// for current_target, exits if LLVM was built without its backend. Code is
+// position independent with -fpic/-fPIC, otherwise static as llc's is
+std::unique_ptr<llvm::TargetMachine> create_target_machine(MachineOptions const&, CodegenOptions const&, OptimizationLevel);
+
+// -c, writes an ELF (or whatever the target's format is) object file to
+// outfile, after anything it already had buffered
+void emit_object_file(llvm::Module&, llvm::TargetMachine&, FILE* outfile);
+
+// an object or assembly file in memory, e.g. for the native backend to take
+// in the functions it left to LLVM
+llvm::SmallVector<char, 0> compile_module_to_memory(llvm::Module&, llvm::TargetMachine&, llvm::CodeGenFileType);
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "output_buffer.h"
+#include "parser.h"
+
+#include <vector>
+
+// Type-based alias analysis metadata
+//
+// https://llvm.org/docs/LangRef.html#tbaa-metadata
+// 6.5p7 an object may only be accessed through an lvalue of its own type, up
+// to signedness and qualifiers, or through one of character type. With strict
+// aliasing, the default, loads and stores of scalars say which type they
+// access, and LLVM assumes that accesses to different types don't alias, so a
+// store through a float* doesn't make it reload an int. The type nodes form a
+// tree as clang builds it: the character types are the "omnipotent char" all
+// other types descend from, signed and unsigned variants share a node, and
+// every pointer is "any pointer". Atomic accesses aren't annotated.
+//
+// A member access also says which struct it goes through, and at what offset,
+// so s.a and s.b don't alias though both are ints. The path runs through
+// nested members, s.inner.x, and starts over at a subscript or a dereference.
+// 6.5.2.3p3 a union member may be read as another member's type, so union
+// members are accessed as char, which aliases everything.
+
+// where an lvalue is in the object it is accessed through
+struct TBAAAccess {
+  // the outermost struct of a member access, CharType for a union member,
+  // nullptr for an object accessed as its own type
+  Type const* base_type;
+  unsigned long long offset;
+};
+
+// the member of a struct or union, accessed through struct_access, e.g.
+// s.inner.x through s.inner
+TBAAAccess tbaa_member_access(TBAAAccess struct_access, Type const* struct_type, unsigned member_index);
+
+// scalars and vectors, which are loaded and stored as a whole. Structs and
+// arrays aren't annotated
+bool has_tbaa_type(Type const*);
+
+// the scalar type nodes, children of the root in this order, the rest of them
+// children of omnipotent char
+constexpr unsigned tbaa_scalar_type_count = 10;
+extern char const* const tbaa_scalar_type_names[tbaa_scalar_type_count];
+
+// the scalar type node a scalar or vector type is accessed as
+unsigned tbaa_scalar_type(Type const*);
+
+// the fields of a struct's type node: the types of the members' nodes, arrays
+// as their elements and unions as char, in order of offset
+struct TBAAField {
+  Type const* type;
+  unsigned long long offset;
+};
+
+std::vector<TBAAField> tbaa_struct_fields(Type const* struct_type);
+
+// The text emitters number metadata module-wide, while functions may be
+// emitted on several threads, so the nodes of every member access are collected
+// from the function bodies up front, and printed at the end of the module.
+// Numbers start at 1, as the module flags take !0. nullptr for a module without
+// function definitions
+struct TBAAMetadata;
+
+TBAAMetadata* collect_tbaa_metadata(ExternalDeclaration const*);
+void free_tbaa_metadata(TBAAMetadata*);
+
+// the number of the access tag of an access to an lvalue of access_type, 0 if
+// it isn't annotated, or without metadata
+unsigned tbaa_tag(TBAAMetadata const*, TBAAAccess, Type const* access_type);
+
+void print_tbaa_metadata(TBAAMetadata const*, OutputBuffer*);
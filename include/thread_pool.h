@@ -0,0 +1,44 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads running jobs off a shared queue
+//
+// Passes that work on one function at a time, like semantic analysis, submit a
+// job per function and wait for all of them to finish. Jobs must only touch
+// their own function's AST and read shared state that nothing is writing.
+
+struct ThreadPoolJob {
+  void (*function)(void*);
+  void* argument;
+};
+
+struct ThreadPool {
+  std::vector<std::thread> workers;
+
+  std::mutex mutex;
+  // workers wait here for jobs, or for the pool to shut down
+  std::condition_variable job_available;
+  // thread_pool_wait waits here for the queue to drain
+  std::condition_variable all_jobs_done;
+
+  std::deque<ThreadPoolJob> jobs;
+  unsigned running_jobs;
+  bool shutting_down;
+};
+
+// one thread per hardware thread, at least one
+unsigned default_thread_count();
+
+ThreadPool* new_thread_pool(unsigned thread_count);
+void thread_pool_submit(ThreadPool*, void (*)(void*), void*);
+
+// blocks until every submitted job has finished running
+void thread_pool_wait(ThreadPool*);
+
+// waits for outstanding jobs, then joins the workers
+void free_thread_pool(ThreadPool*);
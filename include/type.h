@@ -2,12 +2,18 @@
 
 #include "lexer.h"
 
+#include <atomic>
+#include <string>
+#include <vector>
+
 struct Type;
+struct StructLayout;
 
+// parameter lists are interned like types, see intern_parameter_list, so the
+// names of parameters are kept on the declared Object rather than in here
 struct FunctionParameter {
   Type const* parameter_type;
-  std::string identifier;
-  FunctionParameter* next_parameter;
+  FunctionParameter const* next_parameter;
 };
 
 // a function type is defined by its parameters and return type
@@ -17,8 +23,46 @@ struct FunctionData {
   bool is_variadic;
 };
 
+// a member of a struct or union, in declaration order
+struct StructMember {
+  std::string identifier;
+  Type const* member_type;
+  // from _Alignas or __attribute__((aligned(n))), 0 if the member has its
+  // type's alignment
+  unsigned alignment;
+};
+
+// 6.7.2.1 each struct-or-union-specifier with a member list declares a new
+// type, so struct types are not interned. A tag declared before its members
+// names an incomplete type, completed when the member list is parsed
+struct StructData {
+  std::string tag;
+  std::vector<StructMember> members;
+  bool is_complete;
+
+  // __attribute__((packed)) and __attribute__((aligned(n)))
+  bool is_packed;
+  unsigned alignment;
+
+  // the layout may place the members in any order, see
+  // mark_reorderable_structs in layout.h
+  bool may_reorder_members;
+
+  // computed the first time it's needed, see struct_layout in layout.h
+  std::atomic<StructLayout const*> layout;
+};
+
 struct DeclarationSpecifierFlags {
   int flags;
+
+  // struct or union specifiers: the type they name
+  Type const* tag_type = nullptr;
+
+  // the strictest _Alignas, 0 if there is none
+  unsigned alignment = 0;
+
+  // typedef names and _Atomic ( type-name ): the type they stand for
+  Type const* typedef_type = nullptr;
 };
 
 enum class FundamentalType {
@@ -47,7 +91,10 @@ enum class FundamentalType {
   EnumeratedValue,
   TypedefName,
   Pointer,
-  Function
+  Function,
+  Array,
+  // GCC vector extensions, __attribute__((vector_size(n)))
+  Vector
 };
 
 // these are defined so pointers/functions/arrays can point to a real C object
@@ -80,11 +127,26 @@ extern Type const* const TypedefNameType;
 // a type name is a list of type specifiers/qualifiers and an optional abstract
 // declarator
 // i.e., a const int *[]
+//
+// derived types are interned, so two types are the same type exactly when
+// they are the same Type object
 struct Type {
   FunctionData const* function_data;
+  // pointers: the pointed to type, arrays and vectors: the element type
   Type const* pointed_type;
   FundamentalType fundamental_type;
   DeclarationSpecifierFlags declaration_specifier_flags;
+
+  // arrays: the number of elements, -1 if unspecified, e.g. a flexible array
+  // member. Vectors: the number of elements
+  long long array_length;
+
+  // structs and unions
+  StructData* struct_data;
+
+  // codegen's spelling of the type, computed the first time it's needed
+  // codegen may run on several threads, hence the atomic
+  mutable std::atomic<char const*> codegen_string;
 };
 
 enum TypeModifierFlag {
@@ -125,16 +187,38 @@ enum TypeModifierFlag {
   // forgot the unbolded type-specifiers
   TypeDefName = 1 << 25,
   Struct = 1 << 26,
-  Enum = 1 << 27
+  Enum = 1 << 27,
+  Union = 1 << 28
 };
 
 void update_declaration_specifiers(Token const*, DeclarationSpecifierFlags*);
 FundamentalType fundamental_type_from_declaration(DeclarationSpecifierFlags* declaration);
 
-Type* new_type(FundamentalType, Type* = nullptr);
-Type* fundamental_type(FundamentalType);
+// interned derived types, built from already interned parts
+Type const* intern_pointer_type(Type const* pointed_type, DeclarationSpecifierFlags qualifiers = { 0 });
+FunctionParameter const* intern_parameter_list(Type const* parameter_type, FunctionParameter const* rest_of_list);
+Type const* intern_function_type(Type const* return_type, FunctionParameter const* parameter_list, bool is_variadic);
+Type const* intern_array_type(Type const* element_type, long long array_length);
+Type const* intern_vector_type(Type const* element_type, long long element_count);
+Type const* intern_atomic_type(Type const* type);
+Type const* intern_volatile_type(Type const* type);
+
+bool is_atomic_type(Type const*);
+Type const* non_atomic_type(Type const*);
+bool is_volatile_type(Type const*);
+
+// a new, incomplete struct or union type
+Type* new_struct_type(FundamentalType struct_or_union, std::string const& tag);
+
+// void, arrays of unknown size and structs or unions without a member list
+bool is_incomplete_type(Type const*);
 
 bool is_arithmetic_type(FundamentalType t);
 bool is_integer_type(FundamentalType t);
 bool is_floating_type(FundamentalType t);
+bool is_scalar_type(FundamentalType t);
+bool is_unsigned_integer_type(FundamentalType t);
+unsigned integer_conversion_rank(FundamentalType t);
+unsigned fundamental_type_bit_width(FundamentalType t);
+FundamentalType unsigned_integer_type(FundamentalType t);
 Type const* get_fundamental_type_pointer(FundamentalType);
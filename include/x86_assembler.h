@@ -0,0 +1,167 @@
+#pragma once
+
+#include "output_buffer.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// x86-64 instructions
+//
+// The native backend says which instructions it wants through the functions
+// here, which either print them in AT&T syntax, for a .s file, or encode them
+// as machine code, for an object file written without an assembler. Only the
+// instructions and addressing modes the backend uses are supported.
+//
+// Jumps go to labels numbered per function. One to a label already bound
+// takes an 8 bit displacement where that reaches, every other one 32 bits, so
+// nothing is relaxed after the fact and the only fixups left once the
+// function is done are the forward jumps.
+
+// in the order of their encoding
+enum X86Register : uint8_t { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15, x86_register_count };
+
+// the instruction suffix, b, w, l or q for integers and ss or sd for SSE
+enum class X86Width : uint8_t { Byte, Word, Long, Quad, Single, Double };
+
+// the condition codes, in the order of their encoding
+enum class X86Condition : uint8_t { O, NO, B, AE, E, NE, BE, A, S, NS, P, NP, L, GE, LE, G, Always };
+
+enum class X86Opcode : uint8_t {
+  // source, destination, the width is the destination's
+  Add,
+  Or,
+  And,
+  Sub,
+  Xor,
+  Cmp,
+  Test,
+  Mov,
+  Lea,
+  IMul,
+  // the source is an immediate, %cl, or none for a shift by 1
+  Shl,
+  Shr,
+  Sar,
+  // bit test and complement, with the bit as an immediate
+  Btc,
+  // only a destination
+  Neg,
+  Div,
+  IDiv,
+  Push,
+  // zero or sign extension of a byte or word, the width, to a long, and
+  // sign extension of a long to a quad
+  MovZX,
+  MovSX,
+  MovSXD,
+  // movabsq, a 64 bit immediate to a register
+  MovAbs,
+  // neither
+  Leave,
+  Ret,
+  Ud2,
+  // cltd or cqto, %eax or %rax sign extended into %edx or %rdx
+  SignExtendAccumulator,
+  // SSE, the width is Single or Double
+  MovS,
+  AddS,
+  SubS,
+  MulS,
+  DivS,
+  UComiS,
+  XorPS,
+  // cvtss2sd from Single, cvtsd2ss from Double
+  ConvertFloat,
+  // movq, a general purpose register's 64 bits to an xmm register
+  MovQToXmm,
+};
+
+// how a symbol's address makes it into a memory operand, as the psABI's
+// relocations put it
+enum class X86Relocation : uint8_t {
+  None,
+  // sym(%rip)
+  PcRelative,
+  // sym@GOTPCREL(%rip), for symbols that may be in another module
+  GotPcRelative,
+  // sym@gottpoff(%rip), where the offset of an initial exec thread local from
+  // %fs:0 is
+  GotThreadPointerOffset,
+  // sym@tpoff(base), that offset for a local exec one
+  ThreadPointerOffset,
+};
+
+enum class X86OperandKind : uint8_t { None, Register, Xmm, Immediate, Memory };
+
+// memory operands without a base register: relative to %rip, or at an
+// absolute address in the %fs segment
+constexpr uint8_t x86_rip = 16;
+constexpr uint8_t x86_fs = 17;
+
+struct X86Operand {
+  X86OperandKind kind;
+  // the register, the xmm register, or a memory operand's base
+  uint8_t reg;
+  X86Relocation relocation;
+  // an immediate, or a memory operand's displacement
+  long long value;
+  std::string const* symbol;
+};
+
+inline X86Operand x86_register(X86Register reg) { return { X86OperandKind::Register, reg, X86Relocation::None, 0, nullptr }; }
+inline X86Operand x86_xmm(unsigned xmm) { return { X86OperandKind::Xmm, (uint8_t)xmm, X86Relocation::None, 0, nullptr }; }
+inline X86Operand x86_immediate(long long value) { return { X86OperandKind::Immediate, 0, X86Relocation::None, value, nullptr }; }
+inline X86Operand x86_memory(uint8_t base, long long displacement) { return { X86OperandKind::Memory, base, X86Relocation::None, displacement, nullptr }; }
+inline X86Operand x86_symbol(X86Relocation relocation, std::string const* symbol, uint8_t base = x86_rip)
+{
+  return { X86OperandKind::Memory, base, relocation, 0, symbol };
+}
+
+// where an object file has to fill in a symbol's address, or the offset of
+// its GOT entry or thread local, with an R_X86_64_* type
+struct X86SymbolFixup {
+  uint32_t offset;
+  uint32_t type;
+  long long addend;
+  std::string const* symbol;
+};
+
+struct X86Assembler {
+  // AT&T syntax goes to text if there is one, otherwise machine code to code
+  OutputBuffer* text;
+  OutputBuffer* code;
+
+  // labels are printed as .L<label_prefix>.<label>
+  std::string const* label_prefix;
+  // where each label is bound, UINT32_MAX until it is
+  std::vector<uint32_t> labels;
+  // the 32 bit displacements of jumps to labels not bound when they were made
+  std::vector<std::pair<uint32_t, uint32_t>> label_fixups;
+
+  std::vector<X86SymbolFixup> symbol_fixups;
+};
+
+// labels 0 to label_count - 1 exist from the start, e.g. one per block
+void begin_x86_function(X86Assembler*, std::string const* label_prefix, uint32_t label_count);
+uint32_t new_x86_label(X86Assembler*);
+void bind_x86_label(X86Assembler*, uint32_t label);
+// fills in the forward jumps, every label they go to must be bound by now
+void end_x86_function(X86Assembler*);
+
+void emit_x86(X86Assembler*, X86Opcode, X86Width, X86Operand source = {}, X86Operand destination = {});
+
+// cvtts?2si, truncating an xmm register to a Long or Quad register, and
+// cvtsi2s?q, a Quad register to an xmm register
+void emit_x86_float_to_integer(X86Assembler*, X86Width from, X86Width to, unsigned xmm, X86Register destination);
+void emit_x86_integer_to_float(X86Assembler*, X86Width to, X86Register source, unsigned xmm);
+
+// setcc into the low byte of a register
+void emit_x86_set(X86Assembler*, X86Condition, X86Register destination);
+void emit_x86_jump(X86Assembler*, X86Condition, uint32_t label);
+
+// a call, or with is_jump a jump that leaves the callee to return for us.
+// Symbols the module doesn't define are printed with @PLT, though the
+// relocation is the same either way
+void emit_x86_call(X86Assembler*, std::string const* symbol, bool is_defined, bool is_jump);
+void emit_x86_indirect_call(X86Assembler*, X86Register callee, bool is_jump);
@@ -0,0 +1,162 @@
+#include "ast_walk.h"
+
+#include <vector>
+
+unsigned ast_node_children(ASTNode* ast_node, ASTNode* children[max_ast_children])
+{
+  unsigned count = 0;
+
+  switch (ast_node->type) {
+    // loops: for (lhs; conditional; rhs) body
+    // the increment runs after the body
+  case ASTNodeType::For:
+    if (ast_node->lhs)
+      children[count++] = ast_node->lhs;
+    if (ast_node->conditional)
+      children[count++] = ast_node->conditional;
+    if (ast_node->body)
+      children[count++] = ast_node->body;
+    if (ast_node->rhs)
+      children[count++] = ast_node->rhs;
+    return count;
+
+  case ASTNodeType::DoWhile:
+    if (ast_node->body)
+      children[count++] = ast_node->body;
+    if (ast_node->conditional)
+      children[count++] = ast_node->conditional;
+    return count;
+
+    // everything else evaluates its condition first, then operands left to right
+  default:
+    if (ast_node->conditional)
+      children[count++] = ast_node->conditional;
+    if (ast_node->lhs)
+      children[count++] = ast_node->lhs;
+    if (ast_node->rhs)
+      children[count++] = ast_node->rhs;
+    if (ast_node->body)
+      children[count++] = ast_node->body;
+    return count;
+  }
+}
+
+unsigned ast_node_children(ASTNode const* ast_node, ASTNode const* children[max_ast_children])
+{
+  return ast_node_children(const_cast<ASTNode*>(ast_node), const_cast<ASTNode**>(children));
+}
+
+// one frame per node on the path from the root to the current node
+// the frame keeps the child list being walked and how far along it we are
+struct ASTWalkFrame {
+  ASTNode* node;
+  ASTNode* children[max_ast_children];
+  unsigned child_count;
+  unsigned child_index;
+  // the next sibling in the child list currently being walked
+  ASTNode* next_in_list;
+};
+
+static void push_frame(std::vector<ASTWalkFrame>* stack, ASTNode* ast_node, ASTVisitor visitor, void* context)
+{
+  visitor(ast_node, ASTWalkEvent::Enter, 0, context);
+
+  ASTWalkFrame frame;
+  frame.node = ast_node;
+  frame.child_count = ast_node_children(ast_node, frame.children);
+  frame.child_index = 0;
+  frame.next_in_list = frame.child_count ? frame.children[0] : nullptr;
+  stack->push_back(frame);
+}
+
+void walk_ast(ASTNode* root, ASTVisitor visitor, void* context)
+{
+  if (!root)
+    return;
+
+  std::vector<ASTWalkFrame> stack;
+  push_frame(&stack, root, visitor, context);
+
+  while (!stack.empty()) {
+    ASTWalkFrame* frame = &stack.back();
+
+    // descend into the next node of the current child list
+    if (frame->next_in_list) {
+      ASTNode* child = frame->next_in_list;
+      frame->next_in_list = child->next;
+      push_frame(&stack, child, visitor, context);
+      continue;
+    }
+
+    // finished a child list, move on to the next one
+    if (frame->child_index < frame->child_count) {
+      visitor(frame->node, ASTWalkEvent::AfterChild, frame->child_index, context);
+      frame->child_index++;
+      if (frame->child_index < frame->child_count)
+        frame->next_in_list = frame->children[frame->child_index];
+      continue;
+    }
+
+    ASTNode* finished_node = frame->node;
+    stack.pop_back();
+    visitor(finished_node, ASTWalkEvent::Exit, 0, context);
+  }
+}
+
+struct ConstVisitor {
+  ConstASTVisitor visit;
+  void* context;
+};
+
+static void visit_const(ASTNode* ast_node, ASTWalkEvent event, unsigned child_index, void* context)
+{
+  ConstVisitor* const_visitor = (ConstVisitor*)context;
+  const_visitor->visit(ast_node, event, child_index, const_visitor->context);
+}
+
+void walk_ast(ASTNode const* root, ConstASTVisitor visit, void* context)
+{
+  ConstVisitor const_visitor { visit, context };
+  walk_ast(const_cast<ASTNode*>(root), visit_const, &const_visitor);
+}
+
+struct PostOrderVisitor {
+  void (*visit)(ASTNode*, void*);
+  void* context;
+};
+
+static void visit_on_exit(ASTNode* ast_node, ASTWalkEvent event, unsigned, void* context)
+{
+  if (event != ASTWalkEvent::Exit)
+    return;
+
+  PostOrderVisitor* post_order_visitor = (PostOrderVisitor*)context;
+  post_order_visitor->visit(ast_node, post_order_visitor->context);
+}
+
+void walk_ast_post_order(ASTNode* root, void (*visit)(ASTNode*, void*), void* context)
+{
+  PostOrderVisitor post_order_visitor { visit, context };
+  walk_ast(root, visit_on_exit, &post_order_visitor);
+}
+
+struct ConstPostOrderVisitor {
+  void (*visit)(ASTNode const*, void*);
+  void* context;
+};
+
+static void visit_const_on_exit(ASTNode* ast_node, ASTWalkEvent event, unsigned, void* context)
+{
+  if (event != ASTWalkEvent::Exit)
+    return;
+
+  ConstPostOrderVisitor* post_order_visitor = (ConstPostOrderVisitor*)context;
+  post_order_visitor->visit(ast_node, post_order_visitor->context);
+}
+
+// the walk itself never writes to the tree, only the visitor could
+void walk_ast_post_order(ASTNode const* root, void (*visit)(ASTNode const*, void*), void* context)
+{
+  ConstPostOrderVisitor post_order_visitor { visit, context };
+  walk_ast(const_cast<ASTNode*>(root), visit_const_on_exit, &post_order_visitor);
+}
@@ -1,9 +1,139 @@
+#include "ast_walk.h"
+#include "codegen.h"
+#include "function_attributes.h"
+#include "layout.h"
+#include "mir.h"
+#include "output_buffer.h"
 #include "parser.h"
+#include "tbaa.h"
+#include "target.h"
+#include "thread_pool.h"
 #include "type.h"
 
+#include <algorithm>
 #include <cassert>
+#include <string>
+#include <string.h>
+#include <unordered_map>
+#include <vector>
 
-using IdentifierMap = std::unordered_map<std::string, unsigned>;
+// the result of emitting code for an expression
+//
+// constants are kept as immediates and printed inline
+// lvalues are addresses of objects in memory, they are only loaded from when
+// their value is actually needed, so that e.g. the lhs of an assignment or the
+// operand of & can use the address instead
+//
+// objects with static storage and functions are addressed by their global
+// name instead of a register
+//
+// promoted locals, see is_promoted_local, are lvalues without an address, that
+// name the variable instead
+struct Value {
+  Type const* type;
+  bool is_constant;
+  bool is_lvalue;
+  long long constant;
+  unsigned reg;
+  Object const* global;
+
+  // lvalues: the alignment to access them with, 0 for their type's own
+  // e.g. the members of packed structs, or _Alignas objects
+  unsigned alignment;
+
+  // a phi, numbered on its own and named %phi.<reg>
+  bool is_phi;
+
+  // lvalues of promoted locals: their slot, otherwise -1
+  int variable;
+
+  // lvalues in memory: what they are part of, for their TBAA tag
+  TBAAAccess tbaa;
+};
+
+// locals live in stack slots, indexed by the slot name resolution gave them,
+// each holding the register with the slot's address. Promoted locals have no
+// stack slot, their value is looked up in the current block
+struct LocalVariable {
+  unsigned address;
+  Type const* type;
+  // the slot's alignment if it is stricter than its type's, otherwise 0
+  unsigned alignment;
+};
+
+// Braun et al., "Simple and Efficient SSA Construction", section 2
+//
+// Each block knows the value every promoted local was last given in it. A
+// local read in a block that didn't define it is looked up in the blocks
+// before it, through a phi where several join. A block is sealed once all of
+// its predecessors are known, until then reads in it get phis whose operands
+// are only filled in when it is sealed
+struct BasicBlock {
+  // entry, a register number, or e.g. atomic.retry.0
+  std::string label;
+
+  // where in the function's body the block's phis go, after its label
+  size_t phi_offset;
+
+  std::vector<unsigned> predecessors;
+  bool is_sealed;
+
+  // promoted locals by slot
+  std::unordered_map<int, Value> definitions;
+
+  // phis of an unsealed block, and the slot each one is for
+  std::vector<std::pair<int, unsigned>> incomplete_phis;
+
+  std::vector<unsigned> phis;
+};
+
+struct Phi {
+  Type const* type;
+  unsigned block;
+  // one per predecessor, in order
+  std::vector<Value> operands;
+  bool is_complete;
+
+  // a trivial phi, one that only ever has one value, is replaced by it
+  bool is_removed;
+  Value replacement;
+  // the phis with this one as an operand, which may become trivial with it
+  std::vector<unsigned> users;
+
+  // whether it was used by an instruction already printed, see emit_blocks
+  bool is_used;
+};
+
+// state for emitting a single function definition
+struct FunctionContext {
+  OutputBuffer* output;
+  CodegenOptions const* options;
+  // nullptr without strict aliasing
+  TBAAMetadata const* tbaa;
+  std::vector<LocalVariable> local_variables;
+  Type const* return_type;
+
+  // SSA values and basic blocks without names share one counter
+  unsigned next_register;
+
+  // named basic blocks, e.g. the retry loop of an atomic compound assignment,
+  // are numbered on their own
+  unsigned next_label;
+
+  // emitting anything after a terminator needs a new basic block
+  bool block_terminated;
+
+  // see has_locals_in_memory, calls in tail position aren't marked tail then
+  bool has_locals_in_memory;
+
+  // in the order they are printed, with the one being emitted last
+  std::vector<BasicBlock> blocks;
+  unsigned current_block;
+  std::vector<Phi> phis;
+
+  // post-order emission leaves each node's result here for its parent
+  std::vector<Value> value_stack;
+};
 
 static void error_and_stop(char const* message)
 {
@@ -11,18 +141,62 @@ static void error_and_stop(char const* message)
   exit(1);
 }
 
-static char const* print_numeric_literal_as_string(FILE* outfile, ASTNode const* ast_node)
+static char const* type_to_string(Type const*);
+
+static void append_padding(std::string* type_string, unsigned long long padding)
+{
+  if (padding)
+    *type_string += ", [" + std::to_string(padding) + " x i8]";
+}
+
+// structs are spelled as packed LLVM structs with explicit padding, so LLVM
+// puts every member at the offset our layout gave it, e.g.
+// struct { char c; int i; } is <{ i8, [3 x i8], i32 }>
+// members are addressed by byte offset, see emit_member_address, and a union
+// is just its bytes
+static char const* struct_type_to_string(Type const* struct_type)
 {
-  assert(ast_node->type == ASTNodeType::NumericConstant);
-  switch (ast_node->data_type) {
-  case FundamentalType::Int:
-    fprintf(outfile, "%d", ast_node->data_as.int_data);
-  default:
-    assert(false);
+  StructLayout const* layout = struct_layout(struct_type);
+  std::string type_string;
+  unsigned long long end = 0;
+
+  if (struct_type->fundamental_type == FundamentalType::Struct) {
+    for (unsigned index : layout->member_order) {
+      Type const* member_type = struct_type->struct_data->members[index].member_type;
+
+      // a flexible array member takes no space
+      if (member_type->fundamental_type == FundamentalType::Array && member_type->array_length < 0)
+        break;
+
+      append_padding(&type_string, layout->member_offsets[index] - end);
+      type_string += std::string(", ") + type_to_string(member_type);
+      end = layout->member_offsets[index] + size_of_type(member_type);
+    }
   }
+
+  append_padding(&type_string, layout->size - end);
+
+  // drop the first ", "
+  return strdup(type_string.empty() ? "<{}>" : ("<{ " + type_string.substr(2) + " }>").c_str());
 }
 
-static char const* type_to_string(Type const* type)
+static char const* array_type_to_string(Type const* array_type)
+{
+  if (array_type->array_length < 0)
+    error_and_stop("Emitting an array of unknown size\n");
+
+  std::string type_string = "[" + std::to_string(array_type->array_length) + " x " + type_to_string(array_type->pointed_type) + "]";
+  return strdup(type_string.c_str());
+}
+
+// e.g. <4 x float>
+static char const* vector_type_to_string(Type const* vector_type)
+{
+  std::string type_string = "<" + std::to_string(vector_type->array_length) + " x " + type_to_string(vector_type->pointed_type) + ">";
+  return strdup(type_string.c_str());
+}
+
+static char const* uncached_type_to_string(Type const* type)
 {
   switch (type->fundamental_type) {
   case FundamentalType::Void:
@@ -33,63 +207,1407 @@ static char const* type_to_string(Type const* type)
   case FundamentalType::UnsignedChar:
     return "i8";
 
-  case FundamentalType::Short:
-  case FundamentalType::UnsignedShort:
-    return "i16";
+  case FundamentalType::Short:
+  case FundamentalType::UnsignedShort:
+    return "i16";
+
+  case FundamentalType::Int:
+  case FundamentalType::UnsignedInt:
+    return "i32";
+
+  case FundamentalType::Long:
+  case FundamentalType::UnsignedLong:
+    return current_target->long_width == 64 ? "i64" : "i32";
+
+  case FundamentalType::LongLong:
+  case FundamentalType::UnsignedLongLong:
+    return "i64";
+
+  case FundamentalType::Float:
+    return "float";
+  case FundamentalType::Double:
+    return "double";
+  case FundamentalType::LongDouble:
+    return current_target->long_double_type;
+
+  case FundamentalType::Bool:
+    return "i1";
+
+    // LLVM pointers are opaque, the pointee type goes on loads and stores
+  case FundamentalType::Pointer:
+    return "ptr";
+
+  case FundamentalType::Struct:
+  case FundamentalType::Union:
+    return struct_type_to_string(type);
+
+  case FundamentalType::Array:
+    return array_type_to_string(type);
+
+  case FundamentalType::Vector:
+    return vector_type_to_string(type);
+
+    // FIXME incomplete
+  case FundamentalType::FloatComplex:
+  case FundamentalType::DoubleComplex:
+  case FundamentalType::LongDoubleComplex:
+  case FundamentalType::Enum:
+  case FundamentalType::EnumeratedValue:
+  case FundamentalType::TypedefName:
+  case FundamentalType::Function:
+  default:
+    assert(false && "emitting code for this type not implemented\n");
+    return "";
+  }
+}
+
+// types are interned, so each one's string is worked out once and kept on it
+static char const* type_to_string(Type const* type)
+{
+  char const* type_string = type->codegen_string.load(std::memory_order_acquire);
+  if (!type_string) {
+    type_string = uncached_type_to_string(type);
+    type->codegen_string.store(type_string, std::memory_order_release);
+  }
+
+  return type_string;
+}
+
+bool is_unsigned_type(FundamentalType t)
+{
+  switch (t) {
+  case FundamentalType::Char:
+    return !current_target->char_is_signed;
+  case FundamentalType::UnsignedChar:
+  case FundamentalType::UnsignedShort:
+  case FundamentalType::UnsignedInt:
+  case FundamentalType::UnsignedLong:
+  case FundamentalType::UnsignedLongLong:
+  case FundamentalType::Bool:
+  case FundamentalType::Pointer:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// vector instructions work on each element, the element type picks the opcode
+Type const* scalar_type(Type const* type) { return type->fundamental_type == FundamentalType::Vector ? type->pointed_type : type; }
+
+// LLVM only takes decimal constants for float and double, x86_fp80 and fp128
+// are spelled as their bits in hex
+// https://llvm.org/docs/LangRef.html#simple-constants
+static void print_extended_float_constant(OutputBuffer* output, long long constant)
+{
+  unsigned long long sign = constant < 0;
+  unsigned long long magnitude = constant < 0 ? 0ull - (unsigned long long)constant : (unsigned long long)constant;
+  bool is_x86_fp80 = strcmp(current_target->long_double_type, "x86_fp80") == 0;
+
+  if (magnitude == 0) {
+    print(output, is_x86_fp80 ? "0xK00000000000000000000" : "0xL00000000000000000000000000000000");
+    return;
+  }
+
+  // both have a 15 bit exponent biased by 16383
+  unsigned exponent = 63 - __builtin_clzll(magnitude);
+  unsigned long long sign_and_exponent = sign << 15 | (16383 + exponent);
+
+  // x86_fp80 keeps the leading 1 of its 64 bit significand, fp128 drops it
+  // from its 112 bit one, and LLVM prints the low half of an fp128 first
+  if (is_x86_fp80) {
+    print(output, "0xK");
+    append_hex(output, sign_and_exponent, 4);
+    append_hex(output, magnitude << (63 - exponent), 16);
+    return;
+  }
+
+  unsigned long long fraction = magnitude & ~(1ull << exponent);
+  unsigned shift = 112 - exponent;
+  unsigned long long low = shift < 64 ? fraction << shift : 0;
+  unsigned long long high = sign_and_exponent << 48 | (shift < 64 ? fraction >> (64 - shift) : fraction << (shift - 64));
+  print(output, "0xL");
+  append_hex(output, low, 16);
+  append_hex(output, high, 16);
+}
+
+static void print_value(OutputBuffer* output, Value value);
+
+// a constant vector has the same constant in every element, e.g.
+// <i32 -1, i32 -1>
+static void print_vector_constant(OutputBuffer* output, Value value)
+{
+  if (value.constant == 0) {
+    print(output, "zeroinitializer");
+    return;
+  }
+
+  Value element = value;
+  element.type = value.type->pointed_type;
+  char const* element_type_string = type_to_string(element.type);
+
+  print(output, "<");
+  for (long long i = 0; i < value.type->array_length; i++) {
+    print(output, i ? ", " : "", element_type_string, " ");
+    print_value(output, element);
+  }
+  print(output, ">");
+}
+
+// LLVM spells a null pointer null, and wants a decimal point on floating
+// point constants
+static void print_value(OutputBuffer* output, Value value)
+{
+  if (value.is_constant && value.type->fundamental_type == FundamentalType::Vector)
+    print_vector_constant(output, value);
+  else if (value.is_constant && value.type->fundamental_type == FundamentalType::Pointer && value.constant == 0)
+    print(output, "null");
+  else if (value.is_constant && value.type->fundamental_type == FundamentalType::LongDouble && current_target->long_double_width > 64)
+    print_extended_float_constant(output, value.constant);
+  else if (value.is_constant && is_floating_type(value.type->fundamental_type))
+    print(output, value.constant, ".0");
+  else if (value.is_constant)
+    print(output, value.constant);
+  else if (value.global)
+    print(output, "@", value.global->identifier);
+  else if (value.is_phi)
+    print(output, "%phi.", value.reg);
+  else
+    print(output, "%", value.reg);
+}
+
+static Value register_value(Type const* type, unsigned reg)
+{
+  Value value;
+  value.type = type;
+  value.is_constant = false;
+  value.is_lvalue = false;
+  value.constant = 0;
+  value.reg = reg;
+  value.global = nullptr;
+  value.alignment = 0;
+  value.is_phi = false;
+  value.variable = -1;
+  value.tbaa = {};
+  return value;
+}
+
+static Value constant_value(Type const* type, long long constant)
+{
+  Value value = register_value(type, 0);
+  value.is_constant = true;
+  value.constant = constant;
+  return value;
+}
+
+static Value lvalue(Type const* type, unsigned address)
+{
+  Value value = register_value(type, address);
+  value.is_lvalue = true;
+  return value;
+}
+
+// 6.7.5 _Alignas and __attribute__((aligned(n))) can only make an object
+// more strictly aligned than its type
+unsigned declared_alignment(Object const* object)
+{
+  return std::max({ alignment_of_type(object->type), object->declaration_specifiers.alignment, object->alignment });
+}
+
+// objects allocated here, i.e. locals and global definitions. With
+// -falign-large-arrays=n, arrays of at least n bytes start at an n byte
+// boundary, so that vectorized loops over them only do aligned accesses
+unsigned allocation_alignment(Object const* object, CodegenOptions const& options)
+{
+  unsigned alignment = declared_alignment(object);
+  unsigned large_array_alignment = options.large_array_alignment;
+  if (large_array_alignment && object->type->fundamental_type == FundamentalType::Array && !is_incomplete_type(object->type)
+      && size_of_type(object->type) >= large_array_alignment)
+    alignment = std::max(alignment, large_array_alignment);
+  return alignment;
+}
+
+// the alignment an lvalue of this type is accessed with, 0 if it is the type's
+unsigned stricter_alignment(Type const* type, unsigned alignment) { return alignment > alignment_of_type(type) ? alignment : 0; }
+
+// variables with static storage are lvalues at their global's address
+// functions designate the function itself
+static Value global_value(Object const* object)
+{
+  Value value = register_value(object->type, 0);
+  value.is_lvalue = object->type->fundamental_type != FundamentalType::Function;
+  value.global = object;
+  if (value.is_lvalue)
+    value.alignment = stricter_alignment(object->type, declared_alignment(object));
+  return value;
+}
+
+// starts a basic block, after its predecessors have branched to it. It is
+// sealed if those are all of them
+static unsigned begin_block(FunctionContext* context, std::string label, std::vector<unsigned> predecessors, bool is_sealed)
+{
+  print(context->output, label, ":\n");
+
+  BasicBlock block;
+  block.label = std::move(label);
+  block.phi_offset = context->output->size;
+  block.predecessors = std::move(predecessors);
+  block.is_sealed = is_sealed;
+  context->blocks.push_back(std::move(block));
+
+  context->current_block = (unsigned)context->blocks.size() - 1;
+  context->block_terminated = false;
+  return context->current_block;
+}
+
+// after a ret, any following (dead) code still needs a block to live in
+static void start_block_if_terminated(FunctionContext* context)
+{
+  if (!context->block_terminated)
+    return;
+
+  begin_block(context, std::to_string(context->next_register++), {}, true);
+}
+
+// SSA construction, see BasicBlock
+
+static Value phi_value(Type const* type, unsigned phi)
+{
+  Value value = register_value(type, phi);
+  value.is_phi = true;
+  return value;
+}
+
+// what a removed phi stands for
+static Value resolve_phi(FunctionContext const* context, Value value)
+{
+  while (value.is_phi && context->phis[value.reg].is_removed) {
+    Type const* type = value.type;
+    value = context->phis[value.reg].replacement;
+    value.type = type;
+  }
+  return value;
+}
+
+static bool is_same_value(Value lhs, Value rhs)
+{
+  if (lhs.is_constant || rhs.is_constant)
+    return lhs.is_constant && rhs.is_constant && lhs.constant == rhs.constant;
+  if (lhs.global || rhs.global)
+    return lhs.global == rhs.global;
+  return lhs.is_phi == rhs.is_phi && lhs.reg == rhs.reg;
+}
+
+static unsigned new_phi(FunctionContext* context, Type const* type, unsigned block)
+{
+  unsigned phi = (unsigned)context->phis.size();
+  context->phis.push_back({ type, block, {}, false, false, {}, {}, false });
+  context->blocks[block].phis.push_back(phi);
+  return phi;
+}
+
+static void write_variable(FunctionContext* context, int slot, unsigned block, Value value)
+{
+  value.type = context->local_variables[slot].type;
+  context->blocks[block].definitions[slot] = value;
+}
+
+// the value of a local at the end of a block, following single predecessors
+// up without recursion. A sealed block with several predecessors gets a phi
+// whose operands are left for complete_phis, through pending_phis, so that a
+// long chain of joins, e.g. of else ifs, doesn't use the stack either
+static Value lookup_variable(FunctionContext* context, int slot, unsigned block, std::vector<unsigned>* pending_phis)
+{
+  Type const* type = context->local_variables[slot].type;
+
+  // the blocks passed through, which get the value found as well
+  std::vector<unsigned> path;
+  Value value;
+  for (;;) {
+    auto definition = context->blocks[block].definitions.find(slot);
+    if (definition != context->blocks[block].definitions.end()) {
+      value = resolve_phi(context, definition->second);
+      break;
+    }
+
+    BasicBlock const& current = context->blocks[block];
+    if (!current.is_sealed) {
+      unsigned phi = new_phi(context, type, block);
+      context->blocks[block].incomplete_phis.push_back({ slot, phi });
+      value = phi_value(type, phi);
+    } else if (current.predecessors.empty()) {
+      // the entry or an unreachable block, the local was read before it was
+      // given a value, which is indeterminate
+      value = constant_value(type, 0);
+    } else if (current.predecessors.size() == 1) {
+      path.push_back(block);
+      block = current.predecessors[0];
+      continue;
+    } else {
+      // written before the operands are read, so that a loop back to this
+      // block finds the phi instead of looking for it again
+      unsigned phi = new_phi(context, type, block);
+      pending_phis->push_back(phi);
+      value = phi_value(type, phi);
+    }
+    write_variable(context, slot, block, value);
+    break;
+  }
+
+  for (unsigned passed : path)
+    write_variable(context, slot, passed, value);
+  return value;
+}
+
+// a phi whose operands are all the same value, or itself, is that value. Phis
+// that used it may have become trivial in turn, and are tried next
+static void remove_trivial_phis(FunctionContext* context, std::vector<unsigned> worklist)
+{
+  while (!worklist.empty()) {
+    unsigned phi = worklist.back();
+    worklist.pop_back();
+    if (context->phis[phi].is_removed || !context->phis[phi].is_complete)
+      continue;
+
+    Type const* type = context->phis[phi].type;
+    Value same = constant_value(type, 0);
+    bool found_operand = false;
+    bool is_trivial = true;
+    for (Value operand : context->phis[phi].operands) {
+      operand = resolve_phi(context, operand);
+      if ((found_operand && is_same_value(operand, same)) || (operand.is_phi && operand.reg == phi))
+        continue;
+      if (found_operand) {
+        is_trivial = false;
+        break;
+      }
+      same = operand;
+      found_operand = true;
+    }
+    if (!is_trivial)
+      continue;
+
+    // without another operand the phi is only reachable from itself, i.e. not
+    // at all, and 0 does as well as anything
+    context->phis[phi].is_removed = true;
+    context->phis[phi].replacement = same;
+
+    // the users now read the replacement, and have to be tried again if that
+    // is a phi that gets removed later
+    std::vector<unsigned> users = std::move(context->phis[phi].users);
+    for (unsigned user : users)
+      if (user != phi)
+        worklist.push_back(user);
+    if (same.is_phi)
+      context->phis[same.reg].users.insert(context->phis[same.reg].users.end(), users.begin(), users.end());
+  }
+}
+
+// fills in the operands of phis of one local, and of the phis looking them up
+// makes, then removes the ones that turned out trivial
+static void complete_phis(FunctionContext* context, int slot, std::vector<unsigned> pending_phis)
+{
+  std::vector<unsigned> completed_phis;
+  while (!pending_phis.empty()) {
+    unsigned phi = pending_phis.back();
+    pending_phis.pop_back();
+
+    unsigned block = context->phis[phi].block;
+    for (size_t i = 0; i < context->blocks[block].predecessors.size(); i++) {
+      Value operand = lookup_variable(context, slot, context->blocks[block].predecessors[i], &pending_phis);
+      if (operand.is_phi)
+        context->phis[operand.reg].users.push_back(phi);
+      context->phis[phi].operands.push_back(operand);
+    }
+    context->phis[phi].is_complete = true;
+    completed_phis.push_back(phi);
+  }
+  remove_trivial_phis(context, std::move(completed_phis));
+}
+
+static Value read_variable(FunctionContext* context, int slot, unsigned block)
+{
+  std::vector<unsigned> pending_phis;
+  Value value = lookup_variable(context, slot, block, &pending_phis);
+  complete_phis(context, slot, std::move(pending_phis));
+  return resolve_phi(context, value);
+}
+
+static void seal_block(FunctionContext* context, unsigned block)
+{
+  std::vector<std::pair<int, unsigned>> incomplete_phis = std::move(context->blocks[block].incomplete_phis);
+  context->blocks[block].is_sealed = true;
+  for (auto [slot, phi] : incomplete_phis)
+    complete_phis(context, slot, { phi });
+}
+
+// the value a promoted local has where code is being emitted
+static Value use_variable(FunctionContext* context, int slot)
+{
+  start_block_if_terminated(context);
+  Value value = read_variable(context, slot, context->current_block);
+  if (value.is_phi)
+    context->phis[value.reg].is_used = true;
+  return value;
+}
+
+static void assign_variable(FunctionContext* context, int slot, Value value)
+{
+  start_block_if_terminated(context);
+  write_variable(context, slot, context->current_block, value);
+}
+
+// a promoted local as an lvalue
+static Value variable_lvalue(Type const* type, int slot)
+{
+  Value value = register_value(type, 0);
+  value.is_lvalue = true;
+  value.variable = slot;
+  return value;
+}
+
+// begins an instruction defining a new SSA value, returns its register
+static unsigned begin_instruction(FunctionContext* context)
+{
+  start_block_if_terminated(context);
+  unsigned reg = context->next_register++;
+  print(context->output, "  %", reg, " = ");
+  return reg;
+}
+
+static void print_alignment(OutputBuffer* output, unsigned alignment)
+{
+  if (alignment)
+    print(output, ", align ", alignment);
+}
+
+// https://llvm.org/docs/LangRef.html#tbaa-metadata
+static void print_tbaa_tag(OutputBuffer* output, unsigned tag)
+{
+  if (tag)
+    print(output, ", !tbaa !", tag);
+}
+
+// Atomics
+//
+// C11 atomic objects are read and written with atomic instructions, which
+// must be given an alignment and an ordering
+// https://llvm.org/docs/Atomics.html
+
+// https://llvm.org/docs/LangRef.html#ordering
+// an order that isn't a constant is made sequentially consistent
+static char const* memory_order_string(Value order)
+{
+  if (!order.is_constant)
+    return "seq_cst";
+
+  switch ((MemoryOrder)order.constant) {
+  case MemoryOrder::Relaxed:
+    return "monotonic";
+  case MemoryOrder::Consume:
+  case MemoryOrder::Acquire:
+    return "acquire";
+  case MemoryOrder::Release:
+    return "release";
+  case MemoryOrder::AcquireRelease:
+    return "acq_rel";
+  default:
+    return "seq_cst";
+  }
+}
+
+static unsigned atomic_alignment(Value address) { return address.alignment ? address.alignment : alignment_of_type(address.type); }
+
+static Value emit_bitcast(FunctionContext* context, Value value, Type const* to_type)
+{
+  char const* from_type_string = type_to_string(value.type);
+  unsigned reg = begin_instruction(context);
+  print(context->output, "bitcast ", from_type_string, " ");
+  print_value(context->output, value);
+  print(context->output, " to ", type_to_string(to_type), "\n");
+  return register_value(to_type, reg);
+}
+
+// the unsigned integer type as big as a float or double
+static Type const* same_size_integer_type(Type const* type) { return size_of_type(type) == 4 ? UnsignedIntType : UnsignedLongLongType; }
+
+static Value emit_conversion(FunctionContext* context, Value value, Type const* to_type);
+
+// atomic instructions access at least a byte, so a _Bool goes through memory
+// as an i8, and cmpxchg only compares integers and pointers, so floating
+// point values are compared by their bits
+static Value to_atomic_operand(FunctionContext* context, Value value, bool is_compared)
+{
+  if (value.type->fundamental_type == FundamentalType::Bool)
+    return emit_conversion(context, value, UnsignedCharType);
+  if (is_compared && is_floating_type(value.type->fundamental_type))
+    return emit_bitcast(context, value, same_size_integer_type(value.type));
+  return value;
+}
+
+static Value from_atomic_operand(FunctionContext* context, Value value, Type const* type)
+{
+  if (type->fundamental_type == FundamentalType::Bool)
+    return emit_conversion(context, value, BoolType);
+  if (is_floating_type(type->fundamental_type) && !is_floating_type(value.type->fundamental_type))
+    return emit_bitcast(context, value, type);
+
+  value.type = type;
+  return value;
+}
+
+// https://llvm.org/docs/LangRef.html#load-instruction
+static Value emit_atomic_load(FunctionContext* context, Value address, char const* order)
+{
+  Type const* value_type = non_atomic_type(address.type);
+  Type const* access_type = value_type->fundamental_type == FundamentalType::Bool ? UnsignedCharType : value_type;
+
+  unsigned reg = begin_instruction(context);
+  print(context->output, "load atomic ", type_to_string(access_type), ", ptr ");
+  address.is_lvalue = false;
+  print_value(context->output, address);
+  print(context->output, " ", order, ", align ", atomic_alignment(address), "\n");
+  return from_atomic_operand(context, register_value(access_type, reg), value_type);
+}
+
+// https://llvm.org/docs/LangRef.html#store-instruction
+static void emit_atomic_store(FunctionContext* context, Value value, Value address, char const* order)
+{
+  value = to_atomic_operand(context, value, false);
+
+  start_block_if_terminated(context);
+  print(context->output, "  store atomic ", type_to_string(value.type), " ");
+  print_value(context->output, value);
+  print(context->output, ", ptr ");
+  address.is_lvalue = false;
+  print_value(context->output, address);
+  print(context->output, " ", order, ", align ", atomic_alignment(address), "\n");
+}
+
+// https://llvm.org/docs/LangRef.html#atomicrmw-instruction
+// gives the value the object had before
+static Value emit_atomicrmw(FunctionContext* context, char const* operation, Value address, Value operand, char const* order)
+{
+  Type const* value_type = operand.type;
+  operand = to_atomic_operand(context, operand, false);
+
+  unsigned reg = begin_instruction(context);
+  print(context->output, "atomicrmw ", operation, " ptr ");
+  address.is_lvalue = false;
+  print_value(context->output, address);
+  print(context->output, ", ", type_to_string(operand.type), " ");
+  print_value(context->output, operand);
+  print(context->output, " ", order, ", align ", atomic_alignment(address), "\n");
+  return from_atomic_operand(context, register_value(operand.type, reg), value_type);
+}
+
+// https://llvm.org/docs/LangRef.html#cmpxchg-instruction
+// gives whether the object held the expected value, and leaves the value it
+// did hold, as an atomic operand, in found
+static Value emit_cmpxchg(FunctionContext* context, bool is_weak, Value address, Value expected, Value desired, char const* success_order,
+    char const* failure_order, Value* found)
+{
+  expected = to_atomic_operand(context, expected, true);
+  desired = to_atomic_operand(context, desired, true);
+  char const* type_string = type_to_string(expected.type);
+
+  unsigned pair = begin_instruction(context);
+  print(context->output, "cmpxchg ", is_weak ? "weak " : "", "ptr ");
+  address.is_lvalue = false;
+  print_value(context->output, address);
+  print(context->output, ", ", type_string, " ");
+  print_value(context->output, expected);
+  print(context->output, ", ", type_string, " ");
+  print_value(context->output, desired);
+  print(context->output, " ", success_order, " ", failure_order, ", align ", atomic_alignment(address), "\n");
+
+  unsigned found_reg = begin_instruction(context);
+  print(context->output, "extractvalue { ", type_string, ", i1 } %", pair, ", 0\n");
+  *found = register_value(expected.type, found_reg);
+
+  unsigned success = begin_instruction(context);
+  print(context->output, "extractvalue { ", type_string, ", i1 } %", pair, ", 1\n");
+  return register_value(BoolType, success);
+}
+
+// https://www.llvm.org/docs/LangRef.html#load-instruction
+static Value load_if_lvalue(FunctionContext* context, Value value)
+{
+  if (!value.is_lvalue)
+    return value;
+
+  if (value.variable >= 0) {
+    Value variable_value = use_variable(context, value.variable);
+    variable_value.type = value.type;
+    return variable_value;
+  }
+
+  if (is_atomic_type(value.type))
+    return emit_atomic_load(context, value, "seq_cst");
+
+  char const* type_string = type_to_string(value.type);
+  unsigned reg = begin_instruction(context);
+  print(context->output, "load ", type_string, ", ptr ");
+  value.is_lvalue = false;
+  print_value(context->output, value);
+  print_alignment(context->output, value.alignment);
+  print_tbaa_tag(context->output, tbaa_tag(context->tbaa, value.tbaa, value.type));
+  print(context->output, "\n");
+  return register_value(value.type, reg);
+}
+
+// a store's semantics are, in short, "store <type> <value>, ptr <ptr>"
+// https://www.llvm.org/docs/LangRef.html#store-instruction
+static void emit_store(FunctionContext* context, Value value, Value address)
+{
+  if (address.variable >= 0) {
+    assign_variable(context, address.variable, value);
+    return;
+  }
+
+  if (is_atomic_type(address.type)) {
+    emit_atomic_store(context, value, address, "seq_cst");
+    return;
+  }
+
+  start_block_if_terminated(context);
+  print(context->output, "  store ", type_to_string(value.type), " ");
+  print_value(context->output, value);
+  print(context->output, ", ptr ");
+  address.is_lvalue = false;
+  print_value(context->output, address);
+  print_alignment(context->output, address.alignment);
+  print_tbaa_tag(context->output, tbaa_tag(context->tbaa, address.tbaa, address.type));
+  print(context->output, "\n");
+}
+
+// variables are put on the LLVM stack using the alloca instruction
+// https://www.llvm.org/docs/LangRef.html#alloca-instruction
+static bool is_aggregate_type(FundamentalType t) { return t == FundamentalType::Struct || t == FundamentalType::Union || t == FundamentalType::Array; }
+
+// LLVM would align aggregates as their (packed) LLVM type, and vectors wider
+// than 16 bytes to 16, so their alignment is given explicitly. So is that of
+// atomic objects, which can be more aligned than their LLVM type
+static bool needs_explicit_alignment(FundamentalType t) { return is_aggregate_type(t) || t == FundamentalType::Vector; }
+
+static unsigned emit_alloca(FunctionContext* context, Type const* type, unsigned alignment)
+{
+  unsigned reg = begin_instruction(context);
+  print(context->output, "alloca ", type_to_string(type));
+  if (needs_explicit_alignment(type->fundamental_type) || is_atomic_type(type) || stricter_alignment(type, alignment))
+    print_alignment(context->output, alignment);
+  print(context->output, "\n");
+  return reg;
+}
+
+static Value pop_value(FunctionContext* context)
+{
+  assert(!context->value_stack.empty() && "Codegen value stack underflow");
+  Value value = context->value_stack.back();
+  context->value_stack.pop_back();
+  return value;
+}
+
+static Value pop_rvalue(FunctionContext* context) { return load_if_lvalue(context, pop_value(context)); }
+
+// operands are loaded left to right, even though the rhs is on top of the stack
+static void pop_binary_operands(FunctionContext* context, Value* lhs, Value* rhs)
+{
+  Value rhs_value = pop_value(context);
+  *lhs = pop_rvalue(context);
+  *rhs = load_if_lvalue(context, rhs_value);
+}
+
+static Value emit_binary_instruction(FunctionContext* context, char const* opcode, Value lhs, Value rhs)
+{
+  unsigned reg = begin_instruction(context);
+  print(context->output, opcode, " ", type_to_string(lhs.type), " ");
+  print_value(context->output, lhs);
+  print(context->output, ", ");
+  print_value(context->output, rhs);
+  print(context->output, "\n");
+  return register_value(lhs.type, reg);
+}
+
+// comparisons give an i1, C wants an int
+static Value emit_comparison(FunctionContext* context, char const* opcode, Value lhs, Value rhs)
+{
+  Value i1_result = emit_binary_instruction(context, opcode, lhs, rhs);
+
+  unsigned reg = begin_instruction(context);
+  print(context->output, "zext i1 %", i1_result.reg, " to ", type_to_string(IntType), "\n");
+  return register_value(IntType, reg);
+}
+
+// comparing vectors gives a vector of i1, GCC wants -1 for true in each element
+static Value emit_vector_comparison(FunctionContext* context, char const* opcode, Value lhs, Value rhs, Type const* result_type)
+{
+  Value i1_result = emit_binary_instruction(context, opcode, lhs, rhs);
+
+  unsigned reg = begin_instruction(context);
+  print(context->output, "sext <", result_type->array_length, " x i1> %", i1_result.reg, " to ", type_to_string(result_type), "\n");
+  return register_value(result_type, reg);
+}
+
+// integer constants are converted at compile time, wrapping to the width of
+// the new type and sign extending signed types back out to a long long
+long long convert_integer_constant(long long constant, FundamentalType to)
+{
+  unsigned width = fundamental_type_bit_width(to);
+  if (width >= 64)
+    return constant;
+
+  unsigned long long truncated = (unsigned long long)constant & ((1ull << width) - 1);
+  unsigned long long sign_bit = 1ull << (width - 1);
+  if (!is_unsigned_integer_type(to) && (truncated & sign_bit))
+    truncated |= ~((1ull << width) - 1);
+
+  return (long long)truncated;
+}
+
+static char const* conversion_opcode(FundamentalType from, FundamentalType to)
+{
+  bool from_is_float = is_floating_type(from);
+  bool to_is_float = is_floating_type(to);
+
+  if (from == FundamentalType::Pointer)
+    return "ptrtoint";
+  if (to == FundamentalType::Pointer)
+    return "inttoptr";
+
+  if (from_is_float && to_is_float)
+    return fundamental_type_bit_width(to) > fundamental_type_bit_width(from) ? "fpext" : "fptrunc";
+  if (from_is_float)
+    return is_unsigned_integer_type(to) ? "fptoui" : "fptosi";
+  if (to_is_float)
+    return is_unsigned_integer_type(from) ? "uitofp" : "sitofp";
+
+  if (fundamental_type_bit_width(to) < fundamental_type_bit_width(from))
+    return "trunc";
+  return is_unsigned_integer_type(from) ? "zext" : "sext";
+}
+
+// a scalar operand of a vector operator, already converted to the element
+// type, goes into every element: insert it into element 0, then shuffle
+// element 0 everywhere
+static Value emit_splat(FunctionContext* context, Value element, Type const* vector_type)
+{
+  if (element.is_constant)
+    return constant_value(vector_type, element.constant);
+
+  char const* vector_type_string = type_to_string(vector_type);
+  unsigned inserted = begin_instruction(context);
+  print(context->output, "insertelement ", vector_type_string, " poison, ", type_to_string(element.type), " ");
+  print_value(context->output, element);
+  print(context->output, ", i32 0\n");
+
+  unsigned reg = begin_instruction(context);
+  print(context->output, "shufflevector ", vector_type_string, " %", inserted, ", ", vector_type_string, " poison, <", vector_type->array_length,
+      " x i32> zeroinitializer\n");
+  return register_value(vector_type, reg);
+}
+
+// implicit conversions between scalar types, inserted by semantic analysis,
+// and __builtin_convertvector's between vectors
+// https://llvm.org/docs/LangRef.html#conversion-operations
+static Value emit_conversion(FunctionContext* context, Value value, Type const* to_type)
+{
+  FundamentalType from = value.type->fundamental_type;
+  FundamentalType to = to_type->fundamental_type;
+
+  // pointers are opaque, and a function designator already is its address
+  if (to == FundamentalType::Pointer && (from == FundamentalType::Pointer || from == FundamentalType::Function)) {
+    value.type = to_type;
+    return value;
+  }
+
+  if (to == FundamentalType::Vector && from != FundamentalType::Vector)
+    return emit_splat(context, value, to_type);
+
+  // __builtin_convertvector converts each element
+  if (from == FundamentalType::Vector) {
+    from = value.type->pointed_type->fundamental_type;
+    to = to_type->pointed_type->fundamental_type;
+  }
+
+  // 6.3.1.2 converting to _Bool compares against 0
+  if (to == FundamentalType::Bool) {
+    if (value.is_constant)
+      return constant_value(to_type, value.constant != 0);
+
+    Value i1_result = emit_binary_instruction(context, is_floating_type(from) ? "fcmp une" : "icmp ne", value, constant_value(value.type, 0));
+    i1_result.type = to_type;
+    return i1_result;
+  }
+
+  bool is_integer_conversion = is_integer_type(from) && is_integer_type(to);
+  if (is_integer_conversion && value.is_constant)
+    return constant_value(to_type, convert_integer_constant(value.constant, to));
+
+  // e.g. int and unsigned int are both i32, and where long double is double
+  // converting to it changes nothing either
+  bool is_floating_conversion = is_floating_type(from) && is_floating_type(to);
+  if ((is_integer_conversion || is_floating_conversion) && fundamental_type_bit_width(from) == fundamental_type_bit_width(to)) {
+    value.type = to_type;
+    return value;
+  }
+
+  char const* from_type_string = type_to_string(value.type);
+  unsigned reg = begin_instruction(context);
+  print(context->output, conversion_opcode(from, to), " ", from_type_string, " ");
+  print_value(context->output, value);
+  print(context->output, " to ", type_to_string(to_type), "\n");
+  return register_value(to_type, reg);
+}
+
+// pointer arithmetic counts in elements of the pointed to type
+// GNU C allows it on void pointers, with a size of 1
+Type const* element_type(Type const* pointer_type)
+{
+  Type const* pointed_type = pointer_type->pointed_type;
+  return pointed_type->fundamental_type == FundamentalType::Void ? CharType : pointed_type;
+}
+
+// https://llvm.org/docs/GetElementPtr.html
+// the index was converted to a ptrdiff_t by semantic analysis. 6.5.6p8 the
+// result has to point into the same array as the pointer, or one past its
+// end, so the getelementptr is inbounds
+static Value emit_pointer_offset(FunctionContext* context, Value pointer, Value index, bool is_subtraction)
+{
+  if (is_subtraction)
+    index = emit_binary_instruction(context, "sub nsw", constant_value(index.type, 0), index);
+
+  unsigned reg = begin_instruction(context);
+  print(context->output, "getelementptr inbounds ", type_to_string(element_type(pointer.type)), ", ptr ");
+  print_value(context->output, pointer);
+  print(context->output, ", ", type_to_string(index.type), " ");
+  print_value(context->output, index);
+  print(context->output, "\n");
+  return register_value(pointer.type, reg);
+}
+
+// 6.5.6.9 the difference of two pointers is in elements, not bytes
+static Value emit_pointer_difference(FunctionContext* context, Value lhs, Value rhs, Type const* difference_type)
+{
+  Value lhs_address = emit_conversion(context, lhs, difference_type);
+  Value rhs_address = emit_conversion(context, rhs, difference_type);
+  Value byte_difference = emit_binary_instruction(context, "sub nsw", lhs_address, rhs_address);
+
+  long long element_size = size_of_type(element_type(lhs.type));
+  return emit_binary_instruction(context, "sdiv exact", byte_difference, constant_value(difference_type, element_size));
+}
+
+// 6.5.2.3 a member is an lvalue at its offset from the start of its struct
+// the offset comes from the layout, so the member's position in the LLVM
+// struct type never matters
+static Value emit_member_address(FunctionContext* context, Value struct_address, Type const* struct_type, ASTNode const* access_node)
+{
+  StructLayout const* layout = struct_layout(struct_type);
+  unsigned long long offset = layout->member_offsets[access_node->member_index];
+
+  Value member = struct_address;
+  if (offset) {
+    unsigned reg = begin_instruction(context);
+    print(context->output, "getelementptr inbounds i8, ptr ");
+    print_value(context->output, struct_address);
+    print(context->output, ", ", type_to_string(ptrdiff_type()), " ", offset, "\n");
+    member = register_value(access_node->expression_type, reg);
+  }
+
+  member.type = access_node->expression_type;
+  member.is_lvalue = true;
+  member.tbaa = tbaa_member_access(struct_address.is_lvalue ? struct_address.tbaa : TBAAAccess {}, struct_type, access_node->member_index);
+
+  // the member is as aligned as both the struct and its offset allow, which in
+  // a packed struct may be less than its type wants, and in an over-aligned
+  // one more
+  unsigned known_alignment = struct_address.alignment ? struct_address.alignment : layout->alignment;
+  while (offset % known_alignment)
+    known_alignment /= 2;
+  member.alignment = known_alignment != alignment_of_type(member.type) ? known_alignment : 0;
+
+  return member;
+}
+
+// 6.5.2.1 a pointer is offset by the index. An array or vector in memory is
+// indexed in place, so the element is an lvalue, and a vector in a register
+// has its element extracted
+static Value emit_subscript(FunctionContext* context, Value base, Value index, Type const* element_type)
+{
+  if (base.type->fundamental_type == FundamentalType::Vector && !base.is_lvalue) {
+    unsigned reg = begin_instruction(context);
+    print(context->output, "extractelement ", type_to_string(base.type), " ");
+    print_value(context->output, base);
+    print(context->output, ", ", type_to_string(index.type), " ");
+    print_value(context->output, index);
+    print(context->output, "\n");
+    return register_value(element_type, reg);
+  }
+
+  if (base.type->fundamental_type == FundamentalType::Pointer)
+    base = load_if_lvalue(context, base);
+  else if (!base.is_lvalue)
+    error_and_stop("Subscripting an array rvalue not implemented\n");
+
+  if (base.is_constant)
+    error_and_stop("Dereferencing a constant address not implemented\n");
+
+  unsigned reg = begin_instruction(context);
+  print(context->output, "getelementptr inbounds ", type_to_string(element_type), ", ptr ");
+  base.is_lvalue = false;
+  print_value(context->output, base);
+  print(context->output, ", ", type_to_string(index.type), " ");
+  print_value(context->output, index);
+  print(context->output, "\n");
+  return lvalue(element_type, reg);
+}
+
+// https://llvm.org/docs/LangRef.html#shufflevector-instruction
+static Value emit_shufflevector(FunctionContext* context, Value lhs, Value rhs, ASTNode const* shuffle_node)
+{
+  char const* vector_type_string = type_to_string(lhs.type);
+  unsigned reg = begin_instruction(context);
+  print(context->output, "shufflevector ", vector_type_string, " ");
+  print_value(context->output, lhs);
+  print(context->output, ", ", vector_type_string, " ");
+  print_value(context->output, rhs);
+
+  print(context->output, ", <", shuffle_node->shuffle_mask.size(), " x i32> <");
+  for (size_t i = 0; i < shuffle_node->shuffle_mask.size(); i++) {
+    int index = shuffle_node->shuffle_mask[i];
+    if (index < 0)
+      print(context->output, i ? ", " : "", "i32 undef");
+    else
+      print(context->output, i ? ", " : "", "i32 ", index);
+  }
+  print(context->output, ">\n");
+  return register_value(shuffle_node->expression_type, reg);
+}
+
+// the type of a call, e.g. i32 (ptr, ...), only needed for variadic callees
+static void print_function_type(OutputBuffer* output, FunctionData const* function_data)
+{
+  print(output, type_to_string(function_data->return_type), " (");
+  for (FunctionParameter const* current_param = function_data->parameter_list; current_param; current_param = current_param->next_parameter)
+    print(output, type_to_string(current_param->parameter_type), ", ");
+  print(output, "...)");
+}
+
+// https://llvm.org/docs/LangRef.html#call-instruction
+static void print_function_attributes(OutputBuffer* output, FunctionAttributeNames const& attributes)
+{
+  for (unsigned i = 0; i < attributes.count; i++)
+    print(output, " ", attributes.names[i]);
+}
+
+// the arguments were emitted left to right and sit on top of the callee
+static Value emit_call(FunctionContext* context, ASTNode const* call_node)
+{
+  unsigned argument_count = 0;
+  for (ASTNode const* argument = call_node->rhs; argument; argument = argument->next)
+    argument_count++;
+
+  assert(context->value_stack.size() > argument_count && "Codegen value stack underflow");
+  std::vector<Value> arguments(context->value_stack.end() - argument_count, context->value_stack.end());
+  context->value_stack.resize(context->value_stack.size() - argument_count);
+
+  // calling through a function pointer loads the pointer
+  Value callee = pop_value(context);
+  Type const* function_type = callee.type;
+  if (function_type->fundamental_type == FundamentalType::Pointer) {
+    callee = load_if_lvalue(context, callee);
+    function_type = function_type->pointed_type;
+  }
+
+  if (function_type->fundamental_type != FundamentalType::Function)
+    error_and_stop("Calling something that is not a function\n");
+
+  FunctionData const* function_data = function_type->function_data;
+
+  // semantic analysis already converted the arguments to the parameter types
+  for (Value& argument : arguments)
+    argument = load_if_lvalue(context, argument);
+
+  Type const* return_type = function_data->return_type;
+  bool returns_void = return_type->fundamental_type == FundamentalType::Void;
+
+  unsigned reg = 0;
+  if (returns_void) {
+    start_block_if_terminated(context);
+    print(context->output, "  ");
+  } else {
+    reg = begin_instruction(context);
+  }
+
+  if (call_node->tail_call_kind == TailCallKind::MustTail)
+    print(context->output, "musttail ");
+  else if (call_node->tail_call_kind == TailCallKind::Tail && !context->has_locals_in_memory)
+    print(context->output, "tail ");
+  print(context->output, "call ");
+  if (function_data->is_variadic)
+    print_function_type(context->output, function_data);
+  else
+    print(context->output, type_to_string(return_type));
+  print(context->output, " ");
+  print_value(context->output, callee);
+
+  print(context->output, "(");
+  for (size_t i = 0; i < arguments.size(); i++) {
+    print(context->output, i ? ", " : "", type_to_string(arguments[i].type), " ");
+    print_value(context->output, arguments[i]);
+  }
+  print(context->output, ")");
+  print_function_attributes(context->output, function_attribute_names(called_function(call_node), true));
+  print(context->output, "\n");
+
+  // a void call's value is never used, it just has to take up a stack entry
+  return returns_void ? constant_value(return_type, 0) : register_value(return_type, reg);
+}
+
+static char const* comparison_opcode(ASTNodeType node_type, Type const* type)
+{
+  bool is_float = is_floating_type(scalar_type(type)->fundamental_type);
+  bool is_unsigned = is_unsigned_type(scalar_type(type)->fundamental_type);
+
+  switch (node_type) {
+  case ASTNodeType::LessThan:
+    return is_float ? "fcmp olt" : is_unsigned ? "icmp ult" : "icmp slt";
+  case ASTNodeType::LessThanOrEqualTo:
+    return is_float ? "fcmp ole" : is_unsigned ? "icmp ule" : "icmp sle";
+  case ASTNodeType::GreaterThan:
+    return is_float ? "fcmp ogt" : is_unsigned ? "icmp ugt" : "icmp sgt";
+  case ASTNodeType::GreaterThanOrEqualTo:
+    return is_float ? "fcmp oge" : is_unsigned ? "icmp uge" : "icmp sge";
+  case ASTNodeType::EqualityComparison:
+    return is_float ? "fcmp oeq" : "icmp eq";
+  case ASTNodeType::InequalityComparison:
+    return is_float ? "fcmp une" : "icmp ne";
+  default:
+    assert(false && "Not a comparison");
+    return "";
+  }
+}
+
+// the read-modify-writes of atomics wrap, as the atomic_fetch_ functions do
+static char const* arithmetic_opcode(ASTNodeType node_type, Type const* type, bool is_atomic)
+{
+  bool is_float = is_floating_type(scalar_type(type)->fundamental_type);
+  bool is_unsigned = is_unsigned_type(scalar_type(type)->fundamental_type);
+  bool is_no_signed_wrap = !is_atomic && has_no_signed_wrap(node_type, type);
+
+  switch (node_type) {
+  case ASTNodeType::Multiplication:
+    return is_float ? "fmul" : is_no_signed_wrap ? "mul nsw" : "mul";
+  case ASTNodeType::Division:
+    return is_float ? "fdiv" : is_unsigned ? "udiv" : "sdiv";
+  case ASTNodeType::Modulo:
+    return is_unsigned ? "urem" : "srem";
+  case ASTNodeType::Addition:
+    return is_float ? "fadd" : is_no_signed_wrap ? "add nsw" : "add";
+  case ASTNodeType::Subtraction:
+    return is_float ? "fsub" : is_no_signed_wrap ? "sub nsw" : "sub";
+  case ASTNodeType::BitShiftLeft:
+    return is_no_signed_wrap ? "shl nsw" : "shl";
+  case ASTNodeType::BitShiftRight:
+    return is_unsigned ? "lshr" : "ashr";
+  case ASTNodeType::BitwiseAnd:
+    return "and";
+  case ASTNodeType::BitwiseXor:
+    return "xor";
+  case ASTNodeType::BitwiseOr:
+    return "or";
+  default:
+    assert(false && "Not an arithmetic operator");
+    return "";
+  }
+}
+
+// 6.5.16.2 the new value of E1 in E1 op= E2, the rhs was converted to the
+// type the operation is done in
+static Value emit_compound_operation(FunctionContext* context, ASTNodeType operator_type, Value old_value, Value rhs, Type const* result_type, bool is_atomic)
+{
+  if (old_value.type->fundamental_type == FundamentalType::Pointer) {
+    Value new_value = emit_pointer_offset(context, old_value, rhs, operator_type == ASTNodeType::Subtraction);
+    new_value.type = result_type;
+    return new_value;
+  }
+
+  Value lhs = emit_conversion(context, old_value, rhs.type);
+  Value result = emit_binary_instruction(context, arithmetic_opcode(operator_type, lhs.type, is_atomic), lhs, rhs);
+  return emit_conversion(context, result, result_type);
+}
+
+// the atomicrmw operation that does E1 op= E2 in one instruction, if any
+// wrapping integer arithmetic gives the same result in the (narrower) type of
+// E1 as in the type of the operation, so the rhs can be truncated to it
+static char const* atomicrmw_operation(ASTNodeType operator_type, Type const* result_type, Type const* operation_type)
+{
+  FundamentalType t = result_type->fundamental_type;
+
+  if (is_integer_type(t) && t != FundamentalType::Bool && is_integer_type(operation_type->fundamental_type)) {
+    switch (operator_type) {
+    case ASTNodeType::Addition:
+      return "add";
+    case ASTNodeType::Subtraction:
+      return "sub";
+    case ASTNodeType::BitwiseAnd:
+      return "and";
+    case ASTNodeType::BitwiseOr:
+      return "or";
+    case ASTNodeType::BitwiseXor:
+      return "xor";
+    default:
+      return nullptr;
+    }
+  }
+
+  if (is_floating_type(t) && operation_type == result_type) {
+    if (operator_type == ASTNodeType::Addition)
+      return "fadd";
+    if (operator_type == ASTNodeType::Subtraction)
+      return "fsub";
+  }
+
+  return nullptr;
+}
+
+// 6.5.16.2 a compound assignment to an atomic object is one atomic
+// read-modify-write, with sequentially consistent ordering. Those atomicrmw
+// can't do are retried with cmpxchg until no other thread got in between
+static Value emit_atomic_compound_assignment(FunctionContext* context, ASTNodeType operator_type, Value address, Value rhs, Type const* result_type)
+{
+  if (char const* operation = atomicrmw_operation(operator_type, result_type, rhs.type)) {
+    Value operand = emit_conversion(context, rhs, result_type);
+    Value old_value = emit_atomicrmw(context, operation, address, operand, "seq_cst");
+    return emit_binary_instruction(context, arithmetic_opcode(operator_type, result_type, true), old_value, operand);
+  }
+
+  std::string label = std::to_string(context->next_label++);
+  start_block_if_terminated(context);
+  print(context->output, "  br label %atomic.retry.", label, "\n");
+  unsigned retry = begin_block(context, "atomic.retry." + label, { context->current_block }, false);
+
+  Value old_value = emit_atomic_load(context, address, "monotonic");
+  Value new_value = emit_compound_operation(context, operator_type, old_value, rhs, result_type, true);
+
+  // the loop branches back to itself, its last predecessor
+  Value found;
+  Value success = emit_cmpxchg(context, true, address, old_value, new_value, "seq_cst", "monotonic", &found);
+  print(context->output, "  br i1 %", success.reg, ", label %atomic.done.", label, ", label %atomic.retry.", label, "\n");
+  unsigned loop_end = context->current_block;
+  context->blocks[retry].predecessors.push_back(loop_end);
+  seal_block(context, retry);
+  begin_block(context, "atomic.done." + label, { loop_end }, true);
+  return new_value;
+}
+
+static Value emit_compound_assignment(FunctionContext* context, ASTNode const* assignment_node, Value lhs, Value rhs)
+{
+  ASTNodeType operator_type = compound_assignment_operator(assignment_node->type);
+  if (is_atomic_type(lhs.type))
+    return emit_atomic_compound_assignment(context, operator_type, lhs, rhs, assignment_node->expression_type);
+
+  Value new_value = emit_compound_operation(context, operator_type, load_if_lvalue(context, lhs), rhs, assignment_node->expression_type, false);
+  emit_store(context, new_value, lhs);
+  return new_value;
+}
+
+// the arguments of an atomic operation, in order, left on the value stack
+static std::vector<Value> pop_arguments(FunctionContext* context, ASTNode const* first_argument)
+{
+  size_t argument_count = 0;
+  for (ASTNode const* argument = first_argument; argument; argument = argument->next)
+    argument_count++;
+
+  std::vector<Value> arguments(argument_count);
+  for (size_t i = argument_count; i-- > 0;)
+    arguments[i] = pop_value(context);
+  for (Value& argument : arguments)
+    argument = load_if_lvalue(context, argument);
+  return arguments;
+}
+
+// 7.17.7.4 a failed compare exchange writes the value it found to *expected
+static Value emit_atomic_compare_exchange(FunctionContext* context, ASTNode const* atomic_node, Value address, std::vector<Value> const& arguments)
+{
+  if (arguments[1].is_constant)
+    error_and_stop("Dereferencing a constant address not implemented\n");
+
+  Value expected_address = arguments[1];
+  expected_address.type = non_atomic_type(address.type);
+  expected_address.is_lvalue = true;
+
+  Value expected = load_if_lvalue(context, expected_address);
+  Value found;
+  Value success = emit_cmpxchg(context, atomic_node->type == ASTNodeType::AtomicCompareExchangeWeak, address, expected, arguments[2],
+      memory_order_string(arguments[3]), memory_order_string(arguments[4]), &found);
+
+  std::string label = std::to_string(context->next_label++);
+  unsigned exchanged = context->current_block;
+  print(context->output, "  br i1 %", success.reg, ", label %atomic.continue.", label, ", label %atomic.failure.", label, "\n");
+  unsigned failure = begin_block(context, "atomic.failure." + label, { exchanged }, true);
+  expected_address.type = found.type;
+  emit_store(context, found, expected_address);
+  print(context->output, "  br label %atomic.continue.", label, "\n");
+  begin_block(context, "atomic.continue." + label, { exchanged, failure }, true);
+  return success;
+}
+
+// 7.17.7 the atomic generic functions, each one instruction
+static Value emit_atomic_operation(FunctionContext* context, ASTNode const* atomic_node)
+{
+  std::vector<Value> arguments = pop_arguments(context, atomic_node->rhs);
+
+  if (atomic_node->type == ASTNodeType::AtomicThreadFence) {
+    // a relaxed fence orders nothing
+    if (arguments[0].is_constant && arguments[0].constant == (long long)MemoryOrder::Relaxed)
+      return constant_value(VoidType, 0);
+
+    start_block_if_terminated(context);
+    print(context->output, "  fence ", memory_order_string(arguments[0]), "\n");
+    return constant_value(VoidType, 0);
+  }
+
+  if (arguments[0].is_constant)
+    error_and_stop("Atomic operations on a constant address not implemented\n");
 
-  case FundamentalType::Int:
-  case FundamentalType::UnsignedInt:
-  case FundamentalType::Long:
-  case FundamentalType::UnsignedLong:
-    return "i32";
+  // the pointer's value is the atomic object
+  Value address = arguments[0];
+  address.type = address.type->pointed_type;
+  address.is_lvalue = true;
+  Type const* value_type = non_atomic_type(address.type);
 
-  case FundamentalType::LongLong:
-  case FundamentalType::UnsignedLongLong:
-    return "i64";
+  switch (atomic_node->type) {
+  case ASTNodeType::AtomicLoad:
+    return emit_atomic_load(context, address, memory_order_string(arguments[1]));
 
-  case FundamentalType::Float:
-    return "float";
-  case FundamentalType::Double:
-    return "double";
-  case FundamentalType::LongDouble:
-    return "fp128";
+  case ASTNodeType::AtomicStore:
+    emit_atomic_store(context, arguments[1], address, memory_order_string(arguments[2]));
+    return constant_value(VoidType, 0);
 
-  case FundamentalType::Bool:
-    return "i1";
+  case ASTNodeType::AtomicExchange:
+    return emit_atomicrmw(context, "xchg", address, arguments[1], memory_order_string(arguments[2]));
+
+  case ASTNodeType::AtomicCompareExchangeStrong:
+  case ASTNodeType::AtomicCompareExchangeWeak:
+    return emit_atomic_compare_exchange(context, atomic_node, address, arguments);
 
-    // FIXME incomplete
-  case FundamentalType::FloatComplex:
-  case FundamentalType::DoubleComplex:
-  case FundamentalType::LongDoubleComplex:
-  case FundamentalType::Struct:
-  case FundamentalType::Union:
-  case FundamentalType::Enum:
-  case FundamentalType::EnumeratedValue:
-  case FundamentalType::TypedefName:
-  case FundamentalType::Pointer:
-  case FundamentalType::Function:
   default:
-    assert(false && "emitting code for this type not implemented\n");
-    return "";
+    break;
+  }
+
+  char const* operation = "";
+  switch (atomic_node->type) {
+  case ASTNodeType::AtomicFetchAdd:
+    operation = "add";
+    break;
+  case ASTNodeType::AtomicFetchSub:
+    operation = "sub";
+    break;
+  case ASTNodeType::AtomicFetchAnd:
+    operation = "and";
+    break;
+  case ASTNodeType::AtomicFetchOr:
+    operation = "or";
+    break;
+  case ASTNodeType::AtomicFetchXor:
+    operation = "xor";
+    break;
+  default:
+    assert(false && "Not an atomic operation");
   }
+
+  if (value_type->fundamental_type != FundamentalType::Pointer)
+    return emit_atomicrmw(context, operation, address, arguments[1], memory_order_string(arguments[2]));
+
+  // atomicrmw can't add to a pointer, but it can add the offset in bytes to
+  // the address as an integer as wide as it
+  Value offset = arguments[1];
+  long long element_size = size_of_type(element_type(value_type));
+  if (offset.is_constant)
+    offset.constant *= element_size;
+  else if (element_size != 1)
+    offset = emit_binary_instruction(context, "mul", offset, constant_value(offset.type, element_size));
+
+  Value old_address = emit_atomicrmw(context, operation, address, offset, memory_order_string(arguments[2]));
+  return emit_conversion(context, old_address, value_type);
 }
 
-static void emit_code_from_node(ASTNode const* ast_node, FILE* outfile, IdentifierMap& identifier_map, unsigned* count)
+// visited in post order, so every child has already left its value on the
+// value stack by the time its parent is emitted
+static void emit_code_from_node(ASTNode const* ast_node, void* context_pointer)
 {
+  FunctionContext* context = (FunctionContext*)context_pointer;
+  OutputBuffer* output = context->output;
+
   switch (ast_node->type) {
 
   case ASTNodeType::Void:
     return;
 
   case ASTNodeType::NumericConstant:
-    print_numeric_literal_as_string(outfile, ast_node);
+    context->value_stack.push_back(constant_value(ast_node->expression_type, numeric_constant_value(ast_node)));
+    return;
+
+  case ASTNodeType::ImplicitConversion:
+    context->value_stack.push_back(emit_conversion(context, pop_rvalue(context), ast_node->expression_type));
+    return;
+
+  case ASTNodeType::VariableReference: {
+    Object const* object = ast_node->object;
+    assert(object && "Emitting code for a variable reference that was never resolved");
+
+    if (object->local_slot < 0) {
+      context->value_stack.push_back(global_value(object));
+      return;
+    }
+
+    LocalVariable const& local_variable = context->local_variables[object->local_slot];
+    if (is_promoted_local(object)) {
+      context->value_stack.push_back(variable_lvalue(local_variable.type, object->local_slot));
+      return;
+    }
+
+    Value variable = lvalue(local_variable.type, local_variable.address);
+    variable.alignment = local_variable.alignment;
+    context->value_stack.push_back(variable);
+    return;
+  }
+
+  case ASTNodeType::FunctionCall:
+    context->value_stack.push_back(emit_call(context, ast_node));
+    return;
+
+  case ASTNodeType::MemberAccess: {
+    Value struct_value = pop_value(context);
+    if (!struct_value.is_lvalue)
+      error_and_stop("Accessing a member of a struct rvalue not implemented\n");
+    context->value_stack.push_back(emit_member_address(context, struct_value, struct_value.type, ast_node));
+    return;
+  }
+
+  case ASTNodeType::PointerMemberAccess: {
+    Value pointer = pop_rvalue(context);
+    if (pointer.is_constant)
+      error_and_stop("Dereferencing a constant address not implemented\n");
+    context->value_stack.push_back(emit_member_address(context, pointer, pointer.type->pointed_type, ast_node));
+    return;
+  }
+
+  case ASTNodeType::Subscript: {
+    Value index = pop_rvalue(context);
+    context->value_stack.push_back(emit_subscript(context, pop_value(context), index, ast_node->expression_type));
     return;
+  }
 
-  case ASTNodeType::VariableReference:
-    if (!identifier_map.contains(ast_node->referenced_variable))
-      error_and_stop("Local variable not found in this identifier map\n");
+  case ASTNodeType::ShuffleVector: {
+    Value lhs, rhs;
+    pop_binary_operands(context, &lhs, &rhs);
+    context->value_stack.push_back(emit_shufflevector(context, lhs, rhs, ast_node));
+    return;
+  }
 
-    fprintf(outfile, "%%%d", identifier_map.at(ast_node->referenced_variable));
+  case ASTNodeType::ConvertVector:
+    context->value_stack.push_back(emit_conversion(context, pop_rvalue(context), ast_node->expression_type));
     return;
 
   case ASTNodeType::Declaration: {
@@ -97,133 +1615,751 @@ static void emit_code_from_node(ASTNode const* ast_node, FILE* outfile, Identifi
     // this requires us to put these new variables on the stack in accord with their type
     // then potentially initialize them
     //
-    // variables are put on the LLVM stack using the alloca instruction
-    // https://www.llvm.org/docs/LangRef.html#alloca-instruction
-    //
     // alloca returns a pointer to the requested type, then the initialization can be done using loads and stores
-    // https://www.llvm.org/docs/LangRef.html#store-instruction
-    // a store's semantics are, in short, "store <type> <value>, ptr <ptr>"
     Object* current_object = ast_node->object;
     assert(current_object && "Emitting code for declaration with null object");
 
-    identifier_map[current_object->identifier] = *count;
-    fprintf(outfile, "  %%%u = alloca %s\n", *count++, type_to_string(current_object->type));
+    // block scope extern and function declarations only introduce a name
+    if (current_object->local_slot < 0) {
+      if (current_object->declaration_specifiers.flags & TypeModifierFlag::Static)
+        error_and_stop("Block scope static variables not implemented\n");
+      return;
+    }
+
+    // the initializer was emitted first, as the declaration's child
+    Value initial_value;
+    if (ast_node->rhs)
+      initial_value = pop_rvalue(context);
+
+    // a promoted local without an initializer reads as whatever it is
+    // assigned first, or 0
+    if (is_promoted_local(current_object)) {
+      context->local_variables[current_object->local_slot] = { 0, current_object->type, 0 };
+      if (ast_node->rhs)
+        assign_variable(context, current_object->local_slot, initial_value);
+      return;
+    }
 
-    // node has an initializer
-    if (ast_node->rhs) { }
+    unsigned alignment = allocation_alignment(current_object, *context->options);
+    unsigned address = emit_alloca(context, current_object->type, alignment);
+    context->local_variables[current_object->local_slot] = { address, current_object->type, stricter_alignment(current_object->type, alignment) };
+
+    // node has an initializer, already converted to the declared type
+    // 7.17.2.1 initializing an atomic object is not an atomic operation
+    if (ast_node->rhs) {
+      Value variable = lvalue(non_atomic_type(current_object->type), address);
+      variable.alignment = stricter_alignment(variable.type, alignment);
+      emit_store(context, initial_value, variable);
+    }
   }
     return;
 
-  case ASTNodeType::Return:
-    // FIXME what register to return?
+  case ASTNodeType::Return: {
     assert(ast_node->scope->return_type && "codegen for return statement with no return type");
-    fprintf(outfile, "  ret %s %%%d\n", type_to_string(ast_node->scope->return_type), 0);
+    start_block_if_terminated(context);
+
+    if (!ast_node->rhs) {
+      print(output, "  ret void\n");
+    } else {
+      Value return_value = pop_rvalue(context);
+      print(output, "  ret ", type_to_string(context->return_type), " ");
+      print_value(output, return_value);
+      print(output, "\n");
+    }
+
+    context->block_terminated = true;
+    return;
+  }
+
+  case ASTNodeType::Addition:
+  case ASTNodeType::Subtraction: {
+    Value lhs, rhs;
+    pop_binary_operands(context, &lhs, &rhs);
+    bool is_subtraction = ast_node->type == ASTNodeType::Subtraction;
+
+    if (lhs.type->fundamental_type == FundamentalType::Pointer && rhs.type->fundamental_type == FundamentalType::Pointer)
+      context->value_stack.push_back(emit_pointer_difference(context, lhs, rhs, ast_node->expression_type));
+    else if (lhs.type->fundamental_type == FundamentalType::Pointer)
+      context->value_stack.push_back(emit_pointer_offset(context, lhs, rhs, is_subtraction));
+    else if (rhs.type->fundamental_type == FundamentalType::Pointer)
+      context->value_stack.push_back(emit_pointer_offset(context, rhs, lhs, false));
+    else
+      context->value_stack.push_back(emit_binary_instruction(context, arithmetic_opcode(ast_node->type, lhs.type, false), lhs, rhs));
     return;
+  }
+
+    // semantic analysis converted both operands to the type of the result
   case ASTNodeType::Multiplication:
   case ASTNodeType::Division:
   case ASTNodeType::Modulo:
-  case ASTNodeType::Addition:
-  // https://www.llvm.org/docs/LangRef.html#add-instruction
-  // FIXME: Worry about wrap around
-  case ASTNodeType::Subtraction:
   case ASTNodeType::BitShiftLeft:
   case ASTNodeType::BitShiftRight:
+  case ASTNodeType::BitwiseAnd:
+  case ASTNodeType::BitwiseXor:
+  case ASTNodeType::BitwiseOr: {
+    Value lhs, rhs;
+    pop_binary_operands(context, &lhs, &rhs);
+
+    // shifts only promote their rhs, LLVM wants it the width of the lhs
+    if (rhs.type != lhs.type)
+      rhs = emit_conversion(context, rhs, lhs.type);
+
+    context->value_stack.push_back(emit_binary_instruction(context, arithmetic_opcode(ast_node->type, lhs.type, false), lhs, rhs));
+    return;
+  }
+
   case ASTNodeType::GreaterThan:
   case ASTNodeType::GreaterThanOrEqualTo:
   case ASTNodeType::LessThan:
   case ASTNodeType::LessThanOrEqualTo:
   case ASTNodeType::EqualityComparison:
-  case ASTNodeType::InequalityComparison:
-  case ASTNodeType::BitwiseAnd:
-  case ASTNodeType::BitwiseXor:
-  case ASTNodeType::BitwiseOr:
+  case ASTNodeType::InequalityComparison: {
+    Value lhs, rhs;
+    pop_binary_operands(context, &lhs, &rhs);
+    if (lhs.type->fundamental_type == FundamentalType::Vector)
+      context->value_stack.push_back(emit_vector_comparison(context, comparison_opcode(ast_node->type, lhs.type), lhs, rhs, ast_node->expression_type));
+    else
+      context->value_stack.push_back(emit_comparison(context, comparison_opcode(ast_node->type, lhs.type), lhs, rhs));
+    return;
+  }
+
+  case ASTNodeType::Assignment: {
+    Value rhs = pop_rvalue(context);
+    Value lhs = pop_value(context);
+    if (!lhs.is_lvalue)
+      error_and_stop("Assigning to something that is not an lvalue\n");
+
+    emit_store(context, rhs, lhs);
+    context->value_stack.push_back(rhs);
+    return;
+  }
+
+  case ASTNodeType::MultiplicationAssignment:
+  case ASTNodeType::DivisionAssignment:
+  case ASTNodeType::ModuloAssignment:
+  case ASTNodeType::AdditionAssignment:
+  case ASTNodeType::SubtractionAssignment:
+  case ASTNodeType::BitShiftLeftAssignment:
+  case ASTNodeType::BitShiftRightAssignment:
+  case ASTNodeType::BitwiseAndAssignment:
+  case ASTNodeType::BitwiseXorAssignment:
+  case ASTNodeType::BitwiseOrAssignment: {
+    Value rhs = pop_rvalue(context);
+    Value lhs = pop_value(context);
+    if (!lhs.is_lvalue)
+      error_and_stop("Assigning to something that is not an lvalue\n");
+
+    context->value_stack.push_back(emit_compound_assignment(context, ast_node, lhs, rhs));
+    return;
+  }
+
+  case ASTNodeType::AtomicLoad:
+  case ASTNodeType::AtomicStore:
+  case ASTNodeType::AtomicExchange:
+  case ASTNodeType::AtomicCompareExchangeStrong:
+  case ASTNodeType::AtomicCompareExchangeWeak:
+  case ASTNodeType::AtomicFetchAdd:
+  case ASTNodeType::AtomicFetchSub:
+  case ASTNodeType::AtomicFetchAnd:
+  case ASTNodeType::AtomicFetchOr:
+  case ASTNodeType::AtomicFetchXor:
+  case ASTNodeType::AtomicThreadFence:
+    context->value_stack.push_back(emit_atomic_operation(context, ast_node));
+    return;
+
+  case ASTNodeType::Negation: {
+    Value operand = pop_rvalue(context);
+    if (is_floating_type(scalar_type(operand.type)->fundamental_type)) {
+      unsigned reg = begin_instruction(context);
+      print(output, "fneg ", type_to_string(operand.type), " ");
+      print_value(output, operand);
+      print(output, "\n");
+      context->value_stack.push_back(register_value(operand.type, reg));
+      return;
+    }
+
+    char const* opcode = has_no_signed_wrap(ASTNodeType::Subtraction, operand.type) ? "sub nsw" : "sub";
+    context->value_stack.push_back(emit_binary_instruction(context, opcode, constant_value(operand.type, 0), operand));
+    return;
+  }
+
+  case ASTNodeType::BitwiseNot: {
+    Value operand = pop_rvalue(context);
+    context->value_stack.push_back(emit_binary_instruction(context, "xor", operand, constant_value(operand.type, -1)));
+    return;
+  }
+
+  case ASTNodeType::LogicalNot: {
+    Value operand = pop_rvalue(context);
+    char const* opcode = is_floating_type(operand.type->fundamental_type) ? "fcmp oeq" : "icmp eq";
+    context->value_stack.push_back(emit_comparison(context, opcode, operand, constant_value(operand.type, 0)));
+    return;
+  }
+
+  case ASTNodeType::AddressOf: {
+    // a function designator's address is the function itself
+    Value operand = pop_value(context);
+    if (!operand.is_lvalue && !(operand.global && operand.type->fundamental_type == FundamentalType::Function))
+      error_and_stop("Taking the address of something that is not an lvalue\n");
+
+    operand.type = ast_node->expression_type;
+    operand.is_lvalue = false;
+    context->value_stack.push_back(operand);
+    return;
+  }
+
+  case ASTNodeType::Dereference: {
+    Value operand = pop_rvalue(context);
+    if (operand.type->fundamental_type != FundamentalType::Pointer)
+      error_and_stop("Dereferencing something that is not a pointer\n");
+
+    if (operand.is_constant)
+      error_and_stop("Dereferencing a constant address not implemented\n");
+
+    // the pointer's value, a register or a global's address, is the lvalue
+    operand.type = ast_node->expression_type;
+    operand.is_lvalue = true;
+    context->value_stack.push_back(operand);
+    return;
+  }
+
   case ASTNodeType::LogicalAnd:
   case ASTNodeType::LogicalOr:
   case ASTNodeType::ConditionalExpression:
-  case ASTNodeType::Assignment:
   case ASTNodeType::If:
   case ASTNodeType::Switch:
   case ASTNodeType::For:
+  case ASTNodeType::While:
+  case ASTNodeType::DoWhile:
     assert(false && "emitting code not implemented");
   }
 }
 
+static void print_parameter_attributes(OutputBuffer* output, ParameterAttributes const& attributes)
+{
+  if (attributes.is_noalias)
+    print(output, " noalias");
+  if (attributes.is_readonly)
+    print(output, " readonly");
+  if (attributes.is_nonnull)
+    print(output, " nonnull");
+  if (attributes.alignment)
+    print(output, " align ", attributes.alignment);
+  if (attributes.dereferenceable_bytes)
+    print(output, " dereferenceable(", attributes.dereferenceable_bytes, ")");
+}
+
 // https://llvm.org/docs/LangRef.html#functions
 // LLVM function definitions begin with the line
 // define [linkage] [other stuff] <ResultType> @<FunctionName>([argument list]) [other stuff] { basic blocks }
 // this function does that first line only
-static void function_definition_signature(Object const* function_object, FILE* outfile)
+static void function_definition_signature(Object const* function_object, OutputBuffer* output)
 {
   FunctionData const* function_data = function_object->type->function_data;
-  fprintf(outfile, "define");
+  print(output, "define");
 
-  if (function_data->return_type->declaration_specifier_flags.flags & TypeModifierFlag::Static)
-    fprintf(outfile, " internal");
+  if (function_object->declaration_specifiers.flags & TypeModifierFlag::Static)
+    print(output, " internal");
 
   // room for other stuff
 
-  fprintf(outfile, " %s", type_to_string(function_data->return_type));
-  fprintf(outfile, " @%s(", function_object->identifier.c_str());
+  print(output, " ", type_to_string(function_data->return_type));
+  print(output, " @", function_object->identifier, "(");
 
   unsigned count = 0;
   for (FunctionParameter const* current_param = function_data->parameter_list; current_param; current_param = current_param->next_parameter) {
-    if (current_param->identifier == "")
+    if (function_object->parameter_identifiers[count].empty())
       error_and_stop("Function definition parameters must have identifiers");
 
-    fprintf(outfile, "%s %%%d", type_to_string(current_param->parameter_type), count++);
+    print(output, type_to_string(current_param->parameter_type));
+    print_parameter_attributes(output, parameter_attributes(function_object, count, current_param->parameter_type));
+    print(output, " %", count++);
 
     if (current_param->next_parameter)
-      fprintf(outfile, ", ");
+      print(output, ", ");
+  }
+  print(output, ")");
+  print_function_attributes(output, function_attribute_names(function_object, false));
+  print(output, " {\n");
+}
+
+// falling off the end of a function: fine for void, main returns 0, and
+// anything else that uses the value has undefined behavior
+static void emit_implicit_return(FunctionContext* context, Object const* function_object)
+{
+  if (context->block_terminated)
+    return;
+
+  if (context->return_type->fundamental_type == FundamentalType::Void)
+    print(context->output, "  ret void\n");
+  else if (function_object->identifier == "main")
+    print(context->output, "  ret ", type_to_string(context->return_type), " 0\n");
+  else
+    print(context->output, "  unreachable\n");
+}
+
+// a removed phi may have been printed as an operand before it was known to be
+// trivial, e.g. in a loop, its uses are then replaced as the body is copied
+static void append_resolving_phis(FunctionContext const* context, OutputBuffer* output, char const* bytes, size_t length)
+{
+  static constexpr char phi_prefix[] = "%phi.";
+  static constexpr size_t phi_prefix_length = sizeof(phi_prefix) - 1;
+
+  char const* end = bytes + length;
+  while (char const* found = (char const*)memmem(bytes, (size_t)(end - bytes), phi_prefix, phi_prefix_length)) {
+    char* number_end;
+    unsigned long phi = strtoul(found + phi_prefix_length, &number_end, 10);
+    append_bytes(output, bytes, (size_t)(found - bytes));
+
+    Phi const& phi_data = context->phis[phi];
+    if (phi_data.is_removed)
+      print_value(output, resolve_phi(context, phi_value(phi_data.type, (unsigned)phi)));
+    else
+      append_bytes(output, found, (size_t)(number_end - found));
+    bytes = number_end;
+  }
+  append_bytes(output, bytes, (size_t)(end - bytes));
+}
+
+// https://llvm.org/docs/LangRef.html#phi-instruction
+// the body is copied to output with each block's phis after its label
+static void emit_blocks(FunctionContext const* context, OutputBuffer const* body, OutputBuffer* output)
+{
+  bool has_phis = false;
+  bool has_removed_uses = false;
+  for (Phi const& phi : context->phis) {
+    has_phis |= !phi.is_removed;
+    has_removed_uses |= phi.is_removed && phi.is_used;
   }
-  fprintf(outfile, ")");
 
-  // room for other stuff maybe
+  if (!has_phis && !has_removed_uses) {
+    append_output_buffer(output, body);
+    return;
+  }
+
+  size_t copied = 0;
+  for (BasicBlock const& block : context->blocks) {
+    append_resolving_phis(context, output, body->data + copied, block.phi_offset - copied);
+    copied = block.phi_offset;
+
+    for (unsigned phi : block.phis) {
+      Phi const& phi_data = context->phis[phi];
+      if (phi_data.is_removed)
+        continue;
 
-  fprintf(outfile, "{\n");
+      print(output, "  %phi.", phi, " = phi ", type_to_string(phi_data.type), " ");
+      for (size_t i = 0; i < phi_data.operands.size(); i++) {
+        print(output, i ? ", [ " : "[ ");
+        print_value(output, resolve_phi(context, phi_data.operands[i]));
+        print(output, ", %", context->blocks[block.predecessors[i]].label, " ]");
+      }
+      print(output, "\n");
+    }
+  }
+  append_resolving_phis(context, output, body->data + copied, body->size - copied);
 }
 
 // this gets appended to the function definition, which ends with {\n
 // in C, the function body is a compound statment, so we just need to emit code corresponding to a compound statement
-static void emit_function_body(Object const* function_object, FILE* outfile)
+static void emit_function_body(Object const* function_object, TBAAMetadata const* tbaa, OutputBuffer* output, CodegenOptions const& options)
 {
   assert(function_object->function_body);
   assert(function_object->type->function_data->return_type);
 
+  // the body goes to a buffer of its own first, phis are only known once the
+  // blocks they are in have been emitted
+  OutputBuffer* body = new_memory_output_buffer();
+
+  FunctionContext context;
+  context.output = body;
+  context.options = &options;
+  context.tbaa = tbaa;
+  context.return_type = function_object->type->function_data->return_type;
+  context.block_terminated = false;
+  context.has_locals_in_memory = has_locals_in_memory(function_object);
+  context.next_label = 0;
+
   // begin the function definition with the "entry" basic block
-  fprintf(outfile, "entry:\n");
+  begin_block(&context, "entry", {}, true);
 
-  IdentifierMap identifier_map;
-  unsigned count = 0;
+  // parameters are %0 to %n-1, give each one a stack slot so that it can be
+  // assigned to and have its address taken like any other local, unless it
+  // is promoted
+  unsigned parameter_count = 0;
   for (FunctionParameter const* current_param = function_object->type->function_data->parameter_list; current_param != nullptr;
        current_param = current_param->next_parameter)
-    identifier_map[current_param->identifier] = count++;
-  printf("emittinf body\n");
+    parameter_count++;
+
+  context.next_register = parameter_count;
+  context.local_variables.resize(function_object->local_count);
+
+  // parameters take the first slots, in order
+  unsigned parameter_register = 0;
+  for (FunctionParameter const* current_param = function_object->type->function_data->parameter_list; current_param != nullptr;
+       current_param = current_param->next_parameter) {
+    if (is_promoted_local(function_object->parameter_objects[parameter_register])) {
+      context.local_variables[parameter_register] = { 0, current_param->parameter_type, 0 };
+      assign_variable(&context, (int)parameter_register, register_value(current_param->parameter_type, parameter_register));
+      parameter_register++;
+      continue;
+    }
+
+    unsigned address = emit_alloca(&context, current_param->parameter_type, alignment_of_type(current_param->parameter_type));
+    emit_store(&context, register_value(current_param->parameter_type, parameter_register), lvalue(non_atomic_type(current_param->parameter_type), address));
+    context.local_variables[parameter_register++] = { address, current_param->parameter_type, 0 };
+  }
 
+  // each statement is walked on its own, whatever value an expression
+  // statement leaves behind is dropped before the next one
   for (ASTNode const* current_ast_node = function_object->function_body; current_ast_node; current_ast_node = current_ast_node->next) {
-    emit_code_from_node(current_ast_node, outfile, identifier_map, &count);
+    walk_ast_post_order(current_ast_node, emit_code_from_node, &context);
+    context.value_stack.clear();
   }
+
+  emit_implicit_return(&context, function_object);
+
+  emit_blocks(&context, body, output);
+  free_output_buffer(body);
 }
 
-static void emit_function_definition(ExternalDeclaration const* function_declaration, FILE* outfile)
+static void emit_function_definition(ExternalDeclaration const* function_declaration, TBAAMetadata const* tbaa, OutputBuffer* output, CodegenOptions const& options)
 {
   assert(function_declaration->type == ExternalDeclarationType::FunctionDefinition);
   ASTNode const* head_node = function_declaration->root_ast_node;
   Object const* function_object = head_node->object;
 
-  function_definition_signature(function_object, outfile);
-  emit_function_body(function_object, outfile);
+  function_definition_signature(function_object, output);
+
+  // functions the MIR can't express take the direct path below
+  if (options.mid_level_ir) {
+    if (MirFunction* function = lower_function_to_mir(function_object, options, tbaa)) {
+      std::vector<MirPass const*> passes;
+      std::string unknown_pass;
+      bool is_valid_pipeline = parse_mir_pipeline(options.mir_pipeline, &passes, &unknown_pass);
+      assert(is_valid_pipeline && "The MIR pipeline is checked by the driver");
+      (void)is_valid_pipeline;
+
+      run_mir_passes(function, passes);
+      emit_mir_function_body(function, output);
+      free_mir_function(function);
+      print(output, "}\n");
+      return;
+    }
+  }
+
+  emit_function_body(function_object, tbaa, output, options);
+
+  print(output, "}\n");
+}
+
+// functions used but not defined here, e.g. declare i32 @f(i32, ...)
+static void emit_function_declaration(Object const* function_object, OutputBuffer* output)
+{
+  FunctionData const* function_data = function_object->type->function_data;
+  print(output, "declare ", type_to_string(function_data->return_type), " @", function_object->identifier, "(");
+
+  for (FunctionParameter const* current_param = function_data->parameter_list; current_param; current_param = current_param->next_parameter)
+    print(output, type_to_string(current_param->parameter_type), current_param->next_parameter ? ", " : "");
+
+  if (function_data->is_variadic)
+    print(output, function_data->parameter_list ? ", " : "", "...");
+
+  print(output, ")");
+  print_function_attributes(output, function_attribute_names(function_object, false));
+  print(output, "\n");
+}
+
+// 6.7.9 initializers of objects with static storage must be constant
+// FIXME: address constants, and constant expressions in general
+long long static_initializer_value(ASTNode const* initializer)
+{
+  switch (initializer->type) {
+  case ASTNodeType::NumericConstant:
+    return numeric_constant_value(initializer);
+  case ASTNodeType::ImplicitConversion:
+    if (!is_integer_type(initializer->expression_type->fundamental_type))
+      error_and_stop("Non integer constant initializers for static storage not implemented\n");
+    return convert_integer_constant(static_initializer_value(initializer->lhs), initializer->expression_type->fundamental_type);
+  case ASTNodeType::Negation:
+    return -static_initializer_value(initializer->lhs);
+  case ASTNodeType::BitwiseNot:
+    return ~static_initializer_value(initializer->lhs);
+  default:
+    error_and_stop("Non constant initializers for static storage not implemented\n");
+    return 0;
+  }
+}
+
+// semantic analysis marks the operands of &, see analyze_node
+bool is_promoted_local(Object const* object)
+{
+  bool is_volatile = object->declaration_specifiers.flags & TypeModifierFlag::Volatile;
+  return object->local_slot >= 0 && !object->is_address_taken && is_scalar_type(object->type->fundamental_type) && !is_atomic_type(object->type)
+         && !is_volatile && !stricter_alignment(object->type, declared_alignment(object));
+}
+
+bool has_no_signed_wrap(ASTNodeType operator_type, Type const* type)
+{
+  bool is_wrapping_operator = operator_type == ASTNodeType::Addition || operator_type == ASTNodeType::Subtraction
+                              || operator_type == ASTNodeType::Multiplication || operator_type == ASTNodeType::BitShiftLeft;
+  return is_wrapping_operator && is_integer_type(type->fundamental_type) && !is_unsigned_type(type->fundamental_type);
+}
+
+FunctionAttributeNames function_attribute_names(Object const* function_object, bool is_call_site)
+{
+  FunctionAttributeNames attributes = {};
+  auto add = [&](char const* name) { attributes.names[attributes.count++] = name; };
+
+  add("nounwind");
+  if (!function_object)
+    return attributes;
+
+  FunctionAttributes const& inferred = function_object->inferred_attributes;
+  bool reads = inferred.reads_argument_memory || inferred.reads_other_memory;
+  bool writes = inferred.writes_argument_memory || inferred.writes_other_memory;
+  if (!reads && !writes)
+    add("readnone");
+  else if (!writes)
+    add("readonly");
+  if ((reads || writes) && !inferred.reads_other_memory && !inferred.writes_other_memory)
+    add("argmemonly");
+
+  if (inferred.is_norecurse)
+    add("norecurse");
+  if (inferred.will_return)
+    add("willreturn");
+  if (inferred.is_noreturn)
+    add("noreturn");
+  if (inferred.is_speculatable && !is_call_site)
+    add("speculatable");
+  return attributes;
+}
+
+ParameterAttributes parameter_attributes(Object const* function_object, unsigned parameter_index, Type const* parameter_type)
+{
+  ParameterAttributes attributes = {};
+  if (parameter_type->fundamental_type != FundamentalType::Pointer)
+    return attributes;
+
+  ParameterDeclaration const& declaration = function_object->parameter_declarations[parameter_index];
+  attributes.is_noalias = parameter_type->declaration_specifier_flags.flags & TypeModifierFlag::Restrict;
+  attributes.is_readonly = attributes.is_noalias && declaration.is_pointee_const;
+
+  if (declaration.static_length) {
+    attributes.is_nonnull = true;
+    attributes.dereferenceable_bytes = (unsigned long long)declaration.static_length * size_of_type(parameter_type->pointed_type);
+    attributes.alignment = alignment_of_type(parameter_type->pointed_type);
+  }
+  return attributes;
+}
+
+static void find_local_in_memory(ASTNode const* ast_node, void* context)
+{
+  if (ast_node->type == ASTNodeType::Declaration && ast_node->object->local_slot >= 0 && !is_promoted_local(ast_node->object))
+    *(bool*)context = true;
+}
+
+bool has_locals_in_memory(Object const* function_object)
+{
+  for (Object const* parameter : function_object->parameter_objects)
+    if (!is_promoted_local(parameter))
+      return true;
+
+  bool found = false;
+  for (ASTNode const* statement = function_object->function_body; statement && !found; statement = statement->next)
+    walk_ast_post_order(statement, find_local_in_memory, &found);
+  return found;
+}
+
+bool is_self_tail_call(Object const* function_object, ASTNode const* call_node)
+{
+  if (call_node->tail_call_kind == TailCallKind::None || call_node->lhs->type != ASTNodeType::VariableReference || call_node->lhs->object != function_object)
+    return false;
+
+  size_t argument_count = 0;
+  for (ASTNode const* argument = call_node->rhs; argument; argument = argument->next)
+    argument_count++;
+  return !function_object->type->function_data->is_variadic && argument_count == function_object->parameter_objects.size();
+}
+
+// https://llvm.org/docs/LangRef.html#thread-local-storage-models
+// the cheapest model that is still correct for how the object is linked. An
+// executable's own objects are at fixed offsets from the thread pointer, the
+// ones it takes from libraries loaded at startup at offsets known once they are
+// loaded. In a shared library, only objects with internal linkage are known
+// to be its own, anything else goes through __tls_get_addr
+ThreadLocalModel thread_local_model(Object const* object, bool is_definition, CodegenOptions const& options)
+{
+  int flags = object->declaration_specifiers.flags;
+  if (!(flags & TypeModifierFlag::ThreadLocal))
+    return ThreadLocalModel::None;
+
+  if (!options.pic_level)
+    return is_definition ? ThreadLocalModel::LocalExec : ThreadLocalModel::InitialExec;
+  if (flags & TypeModifierFlag::Static)
+    return ThreadLocalModel::LocalDynamic;
+  return ThreadLocalModel::GeneralDynamic;
+}
+
+static char const* thread_local_specifier(Object const* object, bool is_definition, CodegenOptions const& options)
+{
+  switch (thread_local_model(object, is_definition, options)) {
+  case ThreadLocalModel::None:
+    return "";
+  case ThreadLocalModel::GeneralDynamic:
+    return "thread_local ";
+  case ThreadLocalModel::LocalDynamic:
+    return "thread_local(localdynamic) ";
+  case ThreadLocalModel::InitialExec:
+    return "thread_local(initialexec) ";
+  case ThreadLocalModel::LocalExec:
+    return "thread_local(localexec) ";
+  }
+  return "";
+}
+
+// https://llvm.org/docs/LangRef.html#global-variables
+// objects without an initializer are zero initialized (tentative definitions)
+// and extern declarations without any definition are external. Those only
+// promise the alignment they were declared with, 6.7.5.7 requires the
+// definition to agree
+static void emit_global_variable(ASTNode const* declaration_node, OutputBuffer* output, CodegenOptions const& options)
+{
+  Object const* object = declaration_node->object;
+  char const* type_string = type_to_string(object->type);
+  int flags = object->declaration_specifiers.flags;
+
+  if ((flags & TypeModifierFlag::Extern) && !declaration_node->rhs) {
+    print(output, "@", object->identifier, " = external ", thread_local_specifier(object, false, options), "global ", type_string);
+    print_alignment(output, stricter_alignment(object->type, declared_alignment(object)));
+    print(output, "\n");
+    return;
+  }
 
-  fprintf(outfile, "}\n");
+  unsigned alignment = allocation_alignment(object, options);
+
+  // the linkage and thread local model, which come before "global"
+  std::string linkage = (flags & TypeModifierFlag::Static) ? "internal " : "";
+  linkage += thread_local_specifier(object, true, options);
+
+  // FIXME: initializer lists
+  if (needs_explicit_alignment(object->type->fundamental_type)) {
+    if (declaration_node->rhs)
+      error_and_stop("Initializers for static structs, unions, arrays and vectors not implemented\n");
+    print(output, "@", object->identifier, " = ", linkage, "global ", type_string, " zeroinitializer, align ", alignment, "\n");
+    return;
+  }
+
+  long long initial_value = declaration_node->rhs ? static_initializer_value(declaration_node->rhs) : 0;
+
+  if (object->type->fundamental_type == FundamentalType::Pointer && initial_value == 0)
+    print(output, "@", object->identifier, " = ", linkage, "global ptr null");
+  else
+    print(output, "@", object->identifier, " = ", linkage, "global ", type_string, " ", initial_value);
+
+  print_alignment(output, is_atomic_type(object->type) ? alignment : stricter_alignment(object->type, alignment));
+  print(output, "\n");
+}
+
+// only the canonical declaration of each identifier is emitted, see
+// name_resolution.cpp
+static void emit_declarations(ExternalDeclaration const* declaration, OutputBuffer* output, CodegenOptions const& options)
+{
+  for (ASTNode const* declaration_node = declaration->root_ast_node; declaration_node; declaration_node = declaration_node->next) {
+    Object const* object = declaration_node->object;
+    if (!object->is_canonical || (object->declaration_specifiers.flags & TypeModifierFlag::TypeDef))
+      continue;
+
+    if (object->type->fundamental_type == FundamentalType::Function)
+      emit_function_declaration(object, output);
+    else
+      emit_global_variable(declaration_node, output, options);
+  }
+}
+
+// a function definition emitted on a worker thread, into its own buffer
+struct FunctionJob {
+  ExternalDeclaration const* declaration;
+  CodegenOptions const* options;
+  TBAAMetadata const* tbaa;
+  OutputBuffer* output;
+};
+
+static void emit_function_job(void* job_pointer)
+{
+  FunctionJob* job = (FunctionJob*)job_pointer;
+  emit_function_definition(job->declaration, job->tbaa, job->output, *job->options);
 }
 
-void emit_llvm_from_translation_unit(ExternalDeclaration const* external_declaration, FILE* outfile)
+// registers and labels are numbered per function, and the types and layouts
+// cached on Type are safe to fill in from several threads, so the definitions
+// are independent of each other. Returns them in source order
+static std::vector<FunctionJob> emit_function_definitions_in_parallel(
+    ExternalDeclaration const* external_declaration, TBAAMetadata const* tbaa, CodegenOptions const& options)
 {
+  std::vector<FunctionJob> jobs;
+  for (ExternalDeclaration const* current_declaration = external_declaration; current_declaration; current_declaration = current_declaration->next)
+    if (current_declaration->type == ExternalDeclarationType::FunctionDefinition)
+      jobs.push_back({ current_declaration, &options, tbaa, nullptr });
+
+  size_t thread_count = std::min<size_t>(options.thread_count, jobs.size());
+  if (thread_count <= 1) {
+    jobs.clear();
+    return jobs;
+  }
+
+  ThreadPool* thread_pool = new_thread_pool(thread_count);
+  for (FunctionJob& job : jobs) {
+    job.output = new_memory_output_buffer();
+    thread_pool_submit(thread_pool, emit_function_job, &job);
+  }
+
+  thread_pool_wait(thread_pool);
+  free_thread_pool(thread_pool);
+  return jobs;
+}
+
+// the module is built up in an OutputBuffer and written to outfile's file
+// descriptor directly, after anything outfile already had buffered
+void emit_llvm_from_translation_unit(ExternalDeclaration const* external_declaration, FILE* outfile, CodegenOptions const& options)
+{
+  TBAAMetadata* tbaa = options.strict_aliasing ? collect_tbaa_metadata(external_declaration) : nullptr;
+
+  // empty when emitting serially, the definitions are then emitted in place
+  std::vector<FunctionJob> emitted_functions = emit_function_definitions_in_parallel(external_declaration, tbaa, options);
+  size_t next_function = 0;
+
+  fflush(outfile);
+  OutputBuffer* output = new_output_buffer(fileno(outfile));
+
+  print(output, "target datalayout = \"", current_target->datalayout, "\"\n");
+  print(output, "target triple = \"", current_target->triple, "\"\n\n");
+
   for (ExternalDeclaration const* current_declaration = external_declaration; current_declaration; current_declaration = current_declaration->next) {
     switch (current_declaration->type) {
     case ExternalDeclarationType::Declaration:
-      assert(false && "codegen for declarations not implemented\n");
+      emit_declarations(current_declaration, output, options);
+      break;
     case ExternalDeclarationType::FunctionDefinition:
-      emit_function_definition(current_declaration, outfile);
+      if (next_function < emitted_functions.size()) {
+        OutputBuffer* function_output = emitted_functions[next_function++].output;
+        append_output_buffer(output, function_output);
+        free_output_buffer(function_output);
+      } else {
+        emit_function_definition(current_declaration, tbaa, output, options);
+      }
+      break;
     }
   }
+
+  // https://llvm.org/docs/LangRef.html#module-flags-metadata
+  if (options.pic_level)
+    print(output, "\n!llvm.module.flags = !{!0}\n!0 = !{i32 7, !\"PIC Level\", i32 ", options.pic_level, "}\n");
+
+  if (tbaa) {
+    print_tbaa_metadata(tbaa, output);
+    free_tbaa_metadata(tbaa);
+  }
+
+  free_output_buffer(output);
 }
@@ -0,0 +1,358 @@
+#include "elf_object.h"
+#include "output_buffer.h"
+
+#include <llvm/BinaryFormat/ELF.h>
+#include <llvm/Object/ELF.h>
+
+#include <algorithm>
+
+// https://refspecs.linuxfoundation.org/elf/gabi4+/contents.html
+
+using ElfFile = llvm::object::ELF64LEFile;
+using ElfTypes = llvm::object::ELF64LE;
+
+static uint64_t align_up(uint64_t offset, uint64_t alignment) { return (offset + alignment - 1) / alignment * alignment; }
+
+uint32_t elf_section(ElfObject* object, std::string const& name, uint32_t type, uint64_t flags)
+{
+  for (uint32_t i = 0; i < object->sections.size(); i++)
+    if (object->sections[i].name == name)
+      return i;
+
+  object->sections.push_back({ name, type, flags, 1, 0, {}, 0, {} });
+  object->section_symbols.push_back(UINT32_MAX);
+  return (uint32_t)object->sections.size() - 1;
+}
+
+uint64_t append_to_elf_section(ElfObject* object, uint32_t section, char const* bytes, uint64_t size, uint64_t alignment)
+{
+  ElfSection& target = object->sections[section];
+  target.alignment = std::max(target.alignment, alignment);
+  uint64_t offset = align_up(target.size, alignment);
+  target.size = offset + size;
+
+  if (target.type != llvm::ELF::SHT_NOBITS) {
+    target.bytes.resize(offset);
+    if (bytes)
+      target.bytes.insert(target.bytes.end(), bytes, bytes + size);
+    else
+      target.bytes.resize(offset + size);
+  }
+  return offset;
+}
+
+uint32_t elf_symbol(ElfObject* object, std::string const& name)
+{
+  auto [entry, is_new] = object->symbol_indices.emplace(name, (uint32_t)object->symbols.size());
+  if (is_new)
+    object->symbols.push_back({ name, no_elf_section, 0, 0, llvm::ELF::STB_GLOBAL, llvm::ELF::STT_NOTYPE, llvm::ELF::STV_DEFAULT });
+  return entry->second;
+}
+
+void define_elf_symbol(ElfObject* object, uint32_t symbol, uint32_t section, uint64_t value, uint64_t size, uint8_t binding, uint8_t type)
+{
+  ElfSymbol& defined = object->symbols[symbol];
+  defined.section = section;
+  defined.value = value;
+  defined.size = size;
+  defined.binding = binding;
+  defined.type = type;
+}
+
+uint32_t elf_section_symbol(ElfObject* object, uint32_t section)
+{
+  uint32_t& symbol = object->section_symbols[section];
+  if (symbol == UINT32_MAX) {
+    symbol = (uint32_t)object->symbols.size();
+    object->symbols.push_back({ "", section, 0, 0, llvm::ELF::STB_LOCAL, llvm::ELF::STT_SECTION, llvm::ELF::STV_DEFAULT });
+  }
+  return symbol;
+}
+
+// a symbol the object defines. One the object references already is defined
+// by it, a local one with the name of another definition is a symbol of its
+// own, and two definitions of a global one are an error
+static bool merge_elf_symbol(ElfObject* object, std::string const& name, uint32_t section, ElfTypes::Sym const& symbol, uint64_t value, uint32_t* index)
+{
+  auto existing = object->symbol_indices.find(name);
+  if (existing != object->symbol_indices.end() && object->symbols[existing->second].section != no_elf_section) {
+    if (symbol.getBinding() != llvm::ELF::STB_LOCAL)
+      return false;
+    *index = (uint32_t)object->symbols.size();
+    object->symbols.push_back({ name, no_elf_section, 0, 0, 0, 0, 0 });
+  } else {
+    *index = elf_symbol(object, name);
+  }
+
+  define_elf_symbol(object, *index, section, value, symbol.st_size, symbol.getBinding(), symbol.getType());
+  object->symbols[*index].visibility = symbol.getVisibility();
+  return true;
+}
+
+template<typename T> static bool take(llvm::Expected<T> expected, T* value)
+{
+  if (!expected) {
+    llvm::consumeError(expected.takeError());
+    return false;
+  }
+  *value = std::move(*expected);
+  return true;
+}
+
+bool merge_elf_object(ElfObject* object, llvm::StringRef bytes)
+{
+  llvm::Expected<ElfFile> file = ElfFile::create(bytes);
+  if (!file) {
+    llvm::consumeError(file.takeError());
+    return false;
+  }
+  if (file->getHeader().e_machine != llvm::ELF::EM_X86_64 || file->getHeader().e_type != llvm::ELF::ET_REL)
+    return false;
+
+  ElfTypes::ShdrRange sections;
+  if (!take(file->sections(), &sections))
+    return false;
+
+  // where each of its sections went, and where in it they start
+  std::vector<uint32_t> section_map(sections.size(), no_elf_section);
+  std::vector<uint64_t> section_offsets(sections.size(), 0);
+  ElfTypes::Shdr const* symbol_table = nullptr;
+  for (size_t i = 0; i < sections.size(); i++) {
+    ElfTypes::Shdr const& header = sections[i];
+    if (header.sh_type == llvm::ELF::SHT_SYMTAB)
+      symbol_table = &header;
+    if (!(header.sh_flags & llvm::ELF::SHF_ALLOC))
+      continue;
+
+    llvm::StringRef name;
+    if (!take(file->getSectionName(header), &name))
+      return false;
+    uint32_t section = elf_section(object, name.str(), header.sh_type, header.sh_flags);
+    ElfSection& merged = object->sections[section];
+    if (merged.type != header.sh_type || merged.flags != header.sh_flags)
+      return false;
+    merged.entry_size = header.sh_entsize;
+
+    uint64_t alignment = std::max<uint64_t>(header.sh_addralign, 1);
+    if (header.sh_type == llvm::ELF::SHT_NOBITS) {
+      section_offsets[i] = append_to_elf_section(object, section, nullptr, header.sh_size, alignment);
+    } else {
+      llvm::ArrayRef<uint8_t> contents;
+      if (!take(file->getSectionContents(header), &contents))
+        return false;
+      section_offsets[i] = append_to_elf_section(object, section, (char const*)contents.data(), contents.size(), alignment);
+    }
+    section_map[i] = section;
+  }
+  if (!symbol_table)
+    return false;
+
+  ElfTypes::SymRange symbols;
+  llvm::StringRef names;
+  if (!take(file->symbols(symbol_table), &symbols) || !take(file->getStringTableForSymtab(*symbol_table), &names))
+    return false;
+
+  // relocations against a section symbol are relative to the start of that
+  // section, which is now further in
+  std::vector<uint32_t> symbol_map(symbols.size(), UINT32_MAX);
+  std::vector<uint64_t> symbol_offsets(symbols.size(), 0);
+  for (size_t i = 1; i < symbols.size(); i++) {
+    ElfTypes::Sym const& symbol = symbols[i];
+    uint16_t index = symbol.st_shndx;
+    if (symbol.getType() == llvm::ELF::STT_FILE)
+      continue;
+
+    if (symbol.getType() == llvm::ELF::STT_SECTION) {
+      if (index < sections.size() && section_map[index] != no_elf_section) {
+        symbol_map[i] = elf_section_symbol(object, section_map[index]);
+        symbol_offsets[i] = section_offsets[index];
+      }
+      continue;
+    }
+
+    llvm::StringRef name;
+    if (!take(symbol.getName(names), &name))
+      return false;
+
+    if (index == llvm::ELF::SHN_UNDEF) {
+      symbol_map[i] = elf_symbol(object, name.str());
+      ElfSymbol& referenced = object->symbols[symbol_map[i]];
+      if (referenced.section == no_elf_section && symbol.getType() == llvm::ELF::STT_TLS)
+        referenced.type = llvm::ELF::STT_TLS;
+      continue;
+    }
+
+    if (index >= sections.size() || section_map[index] == no_elf_section)
+      return false;
+    if (!merge_elf_symbol(object, name.str(), section_map[index], symbol, section_offsets[index] + symbol.st_value, &symbol_map[i]))
+      return false;
+  }
+
+  for (ElfTypes::Shdr const& header : sections) {
+    if (header.sh_type == llvm::ELF::SHT_REL)
+      return false;
+    if (header.sh_type != llvm::ELF::SHT_RELA || header.sh_info >= sections.size() || section_map[header.sh_info] == no_elf_section)
+      continue;
+
+    ElfTypes::RelaRange relocations;
+    if (!take(file->relas(header), &relocations))
+      return false;
+    for (ElfTypes::Rela const& relocation : relocations) {
+      uint32_t symbol = relocation.getSymbol(false);
+      if (symbol >= symbols.size() || symbol_map[symbol] == UINT32_MAX)
+        return false;
+      object->sections[section_map[header.sh_info]].relocations.push_back({ relocation.r_offset + section_offsets[header.sh_info], symbol_map[symbol],
+          relocation.getType(false), relocation.r_addend + (int64_t)symbol_offsets[symbol] });
+    }
+  }
+  return true;
+}
+
+// what is written so far, to align the next part to
+struct ElfWriter {
+  OutputBuffer* output;
+  uint64_t offset;
+};
+
+static void write_bytes(ElfWriter* writer, void const* bytes, uint64_t size)
+{
+  append_bytes(writer->output, (char const*)bytes, size);
+  writer->offset += size;
+}
+
+static void pad_to(ElfWriter* writer, uint64_t alignment)
+{
+  static char const zeros[16] = {};
+  uint64_t padding = align_up(writer->offset, alignment) - writer->offset;
+  write_bytes(writer, zeros, padding);
+}
+
+// appends a name to a string table, where it is found by its offset
+static uint32_t add_string(std::string* table, std::string const& name)
+{
+  uint32_t offset = (uint32_t)table->size();
+  table->append(name);
+  table->push_back('\0');
+  return offset;
+}
+
+static ElfTypes::Shdr section_header(uint32_t name, uint32_t type, uint64_t flags, uint64_t offset, uint64_t size, uint32_t link, uint32_t info,
+    uint64_t alignment, uint64_t entry_size)
+{
+  ElfTypes::Shdr header {};
+  header.sh_name = name;
+  header.sh_type = type;
+  header.sh_flags = flags;
+  header.sh_offset = offset;
+  header.sh_size = size;
+  header.sh_link = link;
+  header.sh_info = info;
+  header.sh_addralign = alignment;
+  header.sh_entsize = entry_size;
+  return header;
+}
+
+// the sections in order, then a .rela section for each that has
+// relocations, then the symbol and string tables. Local symbols have to come
+// before the others in the symbol table
+void write_elf_object(ElfObject const* object, FILE* outfile)
+{
+  std::vector<uint32_t> symbol_order;
+  for (uint32_t i = 0; i < object->symbols.size(); i++)
+    if (object->symbols[i].binding == llvm::ELF::STB_LOCAL)
+      symbol_order.push_back(i);
+  uint32_t first_global = (uint32_t)symbol_order.size() + 1;
+  for (uint32_t i = 0; i < object->symbols.size(); i++)
+    if (object->symbols[i].binding != llvm::ELF::STB_LOCAL)
+      symbol_order.push_back(i);
+
+  std::vector<uint32_t> symbol_indices(object->symbols.size());
+  for (uint32_t i = 0; i < symbol_order.size(); i++)
+    symbol_indices[symbol_order[i]] = i + 1;
+
+  ElfWriter writer { new_memory_output_buffer(), 0 };
+  std::string section_names(1, '\0');
+  std::vector<ElfTypes::Shdr> headers(1);
+
+  ElfTypes::Ehdr file_header {};
+  write_bytes(&writer, &file_header, sizeof(file_header));
+
+  for (ElfSection const& section : object->sections) {
+    pad_to(&writer, section.alignment);
+    headers.push_back(section_header(add_string(&section_names, section.name), section.type, section.flags, writer.offset, section.size, 0, 0,
+        section.alignment, section.entry_size));
+    write_bytes(&writer, section.bytes.data(), section.bytes.size());
+  }
+
+  uint32_t symbol_table_index = (uint32_t)headers.size();
+  for (uint32_t i = 0; i < object->sections.size(); i++)
+    if (!object->sections[i].relocations.empty())
+      symbol_table_index++;
+
+  for (uint32_t i = 0; i < object->sections.size(); i++) {
+    std::vector<ElfRelocation> const& relocations = object->sections[i].relocations;
+    if (relocations.empty())
+      continue;
+
+    pad_to(&writer, 8);
+    headers.push_back(section_header(add_string(&section_names, ".rela" + object->sections[i].name), llvm::ELF::SHT_RELA, llvm::ELF::SHF_INFO_LINK,
+        writer.offset, relocations.size() * sizeof(ElfTypes::Rela), symbol_table_index, i + 1, 8, sizeof(ElfTypes::Rela)));
+    for (ElfRelocation const& relocation : relocations) {
+      ElfTypes::Rela entry {};
+      entry.r_offset = relocation.offset;
+      entry.setSymbolAndType(symbol_indices[relocation.symbol], relocation.type, false);
+      entry.r_addend = relocation.addend;
+      write_bytes(&writer, &entry, sizeof(entry));
+    }
+  }
+
+  std::string names(1, '\0');
+  pad_to(&writer, 8);
+  headers.push_back(section_header(add_string(&section_names, ".symtab"), llvm::ELF::SHT_SYMTAB, 0, writer.offset,
+      (symbol_order.size() + 1) * sizeof(ElfTypes::Sym), symbol_table_index + 1, first_global, 8, sizeof(ElfTypes::Sym)));
+  ElfTypes::Sym null_symbol {};
+  write_bytes(&writer, &null_symbol, sizeof(null_symbol));
+  for (uint32_t i : symbol_order) {
+    ElfSymbol const& symbol = object->symbols[i];
+    ElfTypes::Sym entry {};
+    entry.st_name = symbol.name.empty() ? 0 : add_string(&names, symbol.name);
+    entry.setBindingAndType(symbol.binding, symbol.type);
+    entry.setVisibility(symbol.visibility);
+    entry.st_shndx = symbol.section == no_elf_section ? (uint16_t)llvm::ELF::SHN_UNDEF : (uint16_t)(symbol.section + 1);
+    entry.st_value = symbol.value;
+    entry.st_size = symbol.size;
+    write_bytes(&writer, &entry, sizeof(entry));
+  }
+
+  headers.push_back(section_header(add_string(&section_names, ".strtab"), llvm::ELF::SHT_STRTAB, 0, writer.offset, names.size(), 0, 0, 1, 0));
+  write_bytes(&writer, names.data(), names.size());
+
+  uint32_t section_names_index = (uint32_t)headers.size();
+  uint32_t section_names_name = add_string(&section_names, ".shstrtab");
+  headers.push_back(section_header(section_names_name, llvm::ELF::SHT_STRTAB, 0, writer.offset, section_names.size(), 0, 0, 1, 0));
+  write_bytes(&writer, section_names.data(), section_names.size());
+
+  pad_to(&writer, 8);
+  uint64_t section_headers_offset = writer.offset;
+  write_bytes(&writer, headers.data(), headers.size() * sizeof(ElfTypes::Shdr));
+
+  // the header comes first but is only known last, so it is written over
+  // the placeholder
+  memcpy(file_header.e_ident, llvm::ELF::ElfMagic, strlen(llvm::ELF::ElfMagic));
+  file_header.e_ident[llvm::ELF::EI_CLASS] = llvm::ELF::ELFCLASS64;
+  file_header.e_ident[llvm::ELF::EI_DATA] = llvm::ELF::ELFDATA2LSB;
+  file_header.e_ident[llvm::ELF::EI_VERSION] = llvm::ELF::EV_CURRENT;
+  file_header.e_ident[llvm::ELF::EI_OSABI] = llvm::ELF::ELFOSABI_NONE;
+  file_header.e_type = llvm::ELF::ET_REL;
+  file_header.e_machine = llvm::ELF::EM_X86_64;
+  file_header.e_version = llvm::ELF::EV_CURRENT;
+  file_header.e_shoff = section_headers_offset;
+  file_header.e_ehsize = sizeof(ElfTypes::Ehdr);
+  file_header.e_shentsize = sizeof(ElfTypes::Shdr);
+  file_header.e_shnum = (uint16_t)headers.size();
+  file_header.e_shstrndx = (uint16_t)section_names_index;
+  memcpy(writer.output->data, &file_header, sizeof(file_header));
+
+  fwrite(writer.output->data, 1, writer.output->size, outfile);
+  free_output_buffer(writer.output);
+}
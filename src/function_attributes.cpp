@@ -0,0 +1,509 @@
+#include "function_attributes.h"
+#include "ast_walk.h"
+
+#include <algorithm>
+#include <cassert>
+#include <climits>
+#include <string.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// where an access to memory lands. Volatile and atomic accesses are a side
+// effect of their own, and count as reading and writing other memory
+enum class MemoryLocation { Local, Argument, Other, SideEffect };
+
+struct MemoryAccess {
+  ASTNode const* lvalue;
+  bool is_read;
+  bool is_write;
+};
+
+// what the body of one function definition does, found by a single walk
+struct FunctionSummary {
+  Object* function_object;
+  std::vector<MemoryAccess> accesses;
+  std::vector<ASTNode const*> calls;
+  // the definitions called directly, as indices of their summaries
+  std::vector<unsigned> callees;
+  // parameters assigned to or with their address taken, which may then point
+  // anywhere
+  std::unordered_set<Object const*> reassigned_parameters;
+  bool has_loop;
+  // a division, or an access through a pointer or an index, which may be
+  // undefined for some arguments
+  bool may_trap;
+};
+
+// the functions of the C library that never return, 7.22.4 and 7.13.2.1
+static char const* const noreturn_library_functions[] = { "abort", "exit", "_Exit", "quick_exit", "thrd_exit", "longjmp" };
+
+static FunctionAttributes const unknown_function_attributes = { true, true, true, true, false, false, false, false };
+
+Object const* called_function(ASTNode const* call_node)
+{
+  ASTNode const* callee = call_node->lhs;
+  if (callee->type != ASTNodeType::VariableReference || callee->object->type->fundamental_type != FundamentalType::Function)
+    return nullptr;
+  return callee->object;
+}
+
+static FunctionAttributes const& callee_attributes(ASTNode const* call_node)
+{
+  Object const* callee = called_function(call_node);
+  return callee ? callee->inferred_attributes : unknown_function_attributes;
+}
+
+static bool is_parameter(Object const* function_object, Object const* object)
+{
+  return object->local_slot >= 0 && (size_t)object->local_slot < function_object->parameter_objects.size()
+         && function_object->parameter_objects[object->local_slot] == object;
+}
+
+static bool is_lvalue_expression(ASTNode const* expression)
+{
+  switch (expression->type) {
+  case ASTNodeType::VariableReference:
+    return expression->object->type->fundamental_type != FundamentalType::Function;
+  case ASTNodeType::Dereference:
+  case ASTNodeType::Subscript:
+  case ASTNodeType::MemberAccess:
+  case ASTNodeType::PointerMemberAccess:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// follows an address, or an lvalue, back to what it is based on, e.g. p + 1
+// to the parameter p, or a.b[2] to the local a
+static MemoryLocation memory_location(FunctionSummary const* summary, ASTNode const* node, bool is_address)
+{
+  for (;;) {
+    if (is_address) {
+      switch (node->type) {
+      case ASTNodeType::ImplicitConversion:
+        // a pointer made from an integer could point anywhere
+        if (node->lhs->expression_type->fundamental_type == FundamentalType::Function)
+          return MemoryLocation::Local;
+        if (node->lhs->expression_type->fundamental_type != FundamentalType::Pointer)
+          return MemoryLocation::Other;
+        node = node->lhs;
+        continue;
+      case ASTNodeType::Addition:
+      case ASTNodeType::Subtraction:
+        node = node->lhs->expression_type->fundamental_type == FundamentalType::Pointer ? node->lhs : node->rhs;
+        continue;
+      case ASTNodeType::AddressOf:
+        node = node->lhs;
+        is_address = false;
+        continue;
+      case ASTNodeType::VariableReference:
+        if (node->object->type->fundamental_type == FundamentalType::Function)
+          return MemoryLocation::Local;
+        if (is_parameter(summary->function_object, node->object) && !summary->reassigned_parameters.count(node->object))
+          return MemoryLocation::Argument;
+        return MemoryLocation::Other;
+      default:
+        return MemoryLocation::Other;
+      }
+    }
+
+    // an lvalue of volatile type, e.g. *p of a volatile int* p, and any part
+    // of an object declared volatile, e.g. s.x of a volatile struct s
+    if (is_volatile_type(node->expression_type))
+      return MemoryLocation::SideEffect;
+
+    switch (node->type) {
+    case ASTNodeType::VariableReference:
+      if (node->object->declaration_specifiers.flags & TypeModifierFlag::Volatile)
+        return MemoryLocation::SideEffect;
+      return node->object->local_slot >= 0 ? MemoryLocation::Local : MemoryLocation::Other;
+    case ASTNodeType::MemberAccess:
+      node = node->lhs;
+      continue;
+    case ASTNodeType::Subscript:
+      is_address = node->lhs->expression_type->fundamental_type == FundamentalType::Pointer;
+      node = node->lhs;
+      continue;
+    case ASTNodeType::Dereference:
+    case ASTNodeType::PointerMemberAccess:
+      node = node->lhs;
+      is_address = true;
+      continue;
+    default:
+      // a temporary, e.g. the struct a call returned
+      return MemoryLocation::Local;
+    }
+  }
+}
+
+static void record_access(FunctionSummary* summary, ASTNode const* operand, bool is_read, bool is_write)
+{
+  if (is_lvalue_expression(operand))
+    summary->accesses.push_back({ operand, is_read, is_write });
+}
+
+static bool is_compound_assignment(ASTNodeType type) { return type >= ASTNodeType::MultiplicationAssignment && type <= ASTNodeType::BitwiseOrAssignment; }
+
+static bool is_atomic_operation(ASTNodeType type) { return type >= ASTNodeType::AtomicLoad && type <= ASTNodeType::AtomicThreadFence; }
+
+// records how a node uses its operands, in post order, so an lvalue is seen
+// by the node that reads or writes it
+static void summarize_node(ASTNode const* ast_node, void* summary_pointer)
+{
+  FunctionSummary* summary = (FunctionSummary*)summary_pointer;
+
+  switch (ast_node->type) {
+  case ASTNodeType::While:
+  case ASTNodeType::For:
+  case ASTNodeType::DoWhile:
+    summary->has_loop = true;
+    break;
+  case ASTNodeType::Division:
+  case ASTNodeType::Modulo:
+  case ASTNodeType::DivisionAssignment:
+  case ASTNodeType::ModuloAssignment:
+    summary->may_trap |= is_integer_type(ast_node->lhs->expression_type->fundamental_type);
+    break;
+  case ASTNodeType::Dereference:
+  case ASTNodeType::Subscript:
+  case ASTNodeType::PointerMemberAccess:
+    summary->may_trap = true;
+    break;
+  case ASTNodeType::FunctionCall:
+    summary->calls.push_back(ast_node);
+    break;
+  case ASTNodeType::Assignment:
+  case ASTNodeType::AddressOf:
+    if (ast_node->lhs->type == ASTNodeType::VariableReference && is_parameter(summary->function_object, ast_node->lhs->object))
+      summary->reassigned_parameters.insert(ast_node->lhs->object);
+    break;
+  default:
+    break;
+  }
+
+  // the arguments of the atomic generic functions are addresses, and
+  // the operations are ordered with other threads'
+  if (is_atomic_operation(ast_node->type)) {
+    summary->accesses.push_back({ ast_node, true, true });
+    summary->may_trap = true;
+  }
+
+  // & takes an address without accessing memory, and so do . and [] on an
+  // array, the access is made by whatever uses their result
+  if (ast_node->type == ASTNodeType::AddressOf || ast_node->type == ASTNodeType::MemberAccess)
+    return;
+  if (ast_node->type == ASTNodeType::Subscript && ast_node->lhs->expression_type->fundamental_type != FundamentalType::Pointer) {
+    record_access(summary, ast_node->rhs, true, false);
+    return;
+  }
+
+  ASTNode const* children[max_ast_children];
+  unsigned child_count = ast_node_children(ast_node, children);
+  for (unsigned i = 0; i < child_count; i++) {
+    bool is_assigned = children[i] == ast_node->lhs && (ast_node->type == ASTNodeType::Assignment || is_compound_assignment(ast_node->type));
+    bool is_read = !is_assigned || ast_node->type != ASTNodeType::Assignment;
+    for (ASTNode const* operand = children[i]; operand; operand = operand->next)
+      record_access(summary, operand, is_read, is_assigned);
+  }
+}
+
+static void add_access(FunctionAttributes* effects, MemoryLocation location, bool is_read, bool is_write)
+{
+  switch (location) {
+  case MemoryLocation::Local:
+    return;
+  case MemoryLocation::Argument:
+    effects->reads_argument_memory |= is_read;
+    effects->writes_argument_memory |= is_write;
+    return;
+  case MemoryLocation::Other:
+    effects->reads_other_memory |= is_read;
+    effects->writes_other_memory |= is_write;
+    return;
+  case MemoryLocation::SideEffect:
+    effects->reads_other_memory = true;
+    effects->writes_other_memory = true;
+    return;
+  }
+}
+
+static FunctionAttributes own_memory_effects(FunctionSummary const* summary)
+{
+  FunctionAttributes effects = {};
+  for (MemoryAccess const& access : summary->accesses) {
+    MemoryLocation location = is_atomic_operation(access.lvalue->type) || is_atomic_type(access.lvalue->expression_type)
+                                  ? MemoryLocation::SideEffect
+                                  : memory_location(summary, access.lvalue, false);
+    add_access(&effects, location, access.is_read, access.is_write);
+  }
+  return effects;
+}
+
+// what the callee does to the memory of its pointer parameters, it does to
+// whatever the arguments point to
+static void add_call_effects(FunctionSummary const* summary, ASTNode const* call_node, FunctionAttributes* effects)
+{
+  FunctionAttributes const& callee = callee_attributes(call_node);
+  add_access(effects, MemoryLocation::Other, callee.reads_other_memory, callee.writes_other_memory);
+  if (!callee.reads_argument_memory && !callee.writes_argument_memory)
+    return;
+
+  for (ASTNode const* argument = call_node->rhs; argument; argument = argument->next)
+    if (argument->expression_type->fundamental_type == FundamentalType::Pointer)
+      add_access(effects, memory_location(summary, argument, true), callee.reads_argument_memory, callee.writes_argument_memory);
+}
+
+static bool same_memory_effects(FunctionAttributes const& lhs, FunctionAttributes const& rhs)
+{
+  return lhs.reads_argument_memory == rhs.reads_argument_memory && lhs.writes_argument_memory == rhs.writes_argument_memory
+         && lhs.reads_other_memory == rhs.reads_other_memory && lhs.writes_other_memory == rhs.writes_other_memory;
+}
+
+// whether a statement or expression never finishes, as it calls a function
+// that doesn't return on every path, found bottom-up like the summaries
+struct DivergenceSearch {
+  std::unordered_set<ASTNode const*> diverging;
+  std::unordered_set<ASTNode const*> returning;
+};
+
+// a list of statements diverges if one of them does before any can return
+static bool list_diverges(DivergenceSearch const* search, ASTNode const* list)
+{
+  for (ASTNode const* statement = list; statement; statement = statement->next) {
+    if (search->diverging.count(statement))
+      return true;
+    if (search->returning.count(statement))
+      return false;
+  }
+  return false;
+}
+
+static void find_divergence(ASTNode const* ast_node, void* search_pointer)
+{
+  DivergenceSearch* search = (DivergenceSearch*)search_pointer;
+
+  ASTNode const* children[max_ast_children];
+  unsigned child_count = ast_node_children(ast_node, children);
+  bool any_child_diverges = false;
+  bool is_returning = ast_node->type == ASTNodeType::Return;
+  for (unsigned i = 0; i < child_count; i++) {
+    any_child_diverges |= list_diverges(search, children[i]);
+    for (ASTNode const* child = children[i]; child; child = child->next)
+      is_returning |= search->returning.count(child) != 0;
+  }
+  if (is_returning)
+    search->returning.insert(ast_node);
+
+  // only what always runs counts: the condition of a branch, but a branch
+  // only if the other one diverges too
+  bool diverges;
+  switch (ast_node->type) {
+  case ASTNodeType::FunctionCall:
+    diverges = any_child_diverges || callee_attributes(ast_node).is_noreturn;
+    break;
+  case ASTNodeType::If:
+    diverges = list_diverges(search, ast_node->conditional) || (list_diverges(search, ast_node->lhs) && list_diverges(search, ast_node->rhs));
+    break;
+  case ASTNodeType::LogicalAnd:
+  case ASTNodeType::LogicalOr:
+    diverges = list_diverges(search, ast_node->lhs);
+    break;
+  case ASTNodeType::ConditionalExpression:
+  case ASTNodeType::While:
+  case ASTNodeType::Switch:
+    diverges = list_diverges(search, ast_node->conditional);
+    break;
+  case ASTNodeType::For:
+    diverges = list_diverges(search, ast_node->lhs) || list_diverges(search, ast_node->conditional);
+    break;
+  case ASTNodeType::DoWhile:
+    diverges = list_diverges(search, ast_node->body);
+    break;
+  default:
+    diverges = any_child_diverges;
+    break;
+  }
+  if (diverges)
+    search->diverging.insert(ast_node);
+}
+
+static bool body_diverges(Object const* function_object)
+{
+  DivergenceSearch search;
+  for (ASTNode const* statement = function_object->function_body; statement; statement = statement->next)
+    walk_ast_post_order(statement, find_divergence, &search);
+  return list_diverges(&search, function_object->function_body);
+}
+
+// a function that can't fall off its end without returning a value, which
+// would be undefined
+static bool returns_on_every_path(Object const* function_object)
+{
+  if (function_object->type->function_data->return_type->fundamental_type == FundamentalType::Void)
+    return true;
+  ASTNode const* last_statement = function_object->function_body;
+  while (last_statement->next)
+    last_statement = last_statement->next;
+  return last_statement->type == ASTNodeType::Return;
+}
+
+// Tarjan's algorithm, with an explicit stack, as call chains can be long. A
+// component is complete once everything it calls is, so they come out callees
+// first
+static std::vector<std::vector<unsigned>> strongly_connected_components(std::vector<FunctionSummary> const& summaries)
+{
+  size_t function_count = summaries.size();
+  std::vector<unsigned> index(function_count, UINT_MAX);
+  std::vector<unsigned> low_link(function_count);
+  std::vector<bool> is_on_stack(function_count);
+  std::vector<unsigned> component_stack;
+  std::vector<std::vector<unsigned>> components;
+  unsigned next_index = 0;
+
+  // the functions being visited, and how many of their callees have been
+  std::vector<std::pair<unsigned, unsigned>> visit_stack;
+  auto start_visit = [&](unsigned function) {
+    index[function] = low_link[function] = next_index++;
+    component_stack.push_back(function);
+    is_on_stack[function] = true;
+    visit_stack.push_back({ function, 0 });
+  };
+
+  for (unsigned root = 0; root < function_count; root++) {
+    if (index[root] != UINT_MAX)
+      continue;
+
+    start_visit(root);
+    while (!visit_stack.empty()) {
+      auto [function, next_callee] = visit_stack.back();
+      if (next_callee < summaries[function].callees.size()) {
+        visit_stack.back().second++;
+        unsigned callee = summaries[function].callees[next_callee];
+        if (index[callee] == UINT_MAX)
+          start_visit(callee);
+        else if (is_on_stack[callee])
+          low_link[function] = std::min(low_link[function], index[callee]);
+        continue;
+      }
+
+      visit_stack.pop_back();
+      if (!visit_stack.empty()) {
+        unsigned caller = visit_stack.back().first;
+        low_link[caller] = std::min(low_link[caller], low_link[function]);
+      }
+      if (low_link[function] != index[function])
+        continue;
+
+      components.emplace_back();
+      unsigned member;
+      do {
+        member = component_stack.back();
+        component_stack.pop_back();
+        is_on_stack[member] = false;
+        components.back().push_back(member);
+      } while (member != function);
+    }
+  }
+  return components;
+}
+
+static void infer_component(std::vector<FunctionSummary> const& summaries, std::vector<unsigned> const& component)
+{
+  assert(!component.empty());
+  FunctionSummary const& first = summaries[component[0]];
+  bool is_recursive = component.size() > 1 || std::find(first.callees.begin(), first.callees.end(), component[0]) != first.callees.end();
+
+  // the functions of the component start out doing only what their own
+  // bodies do, and take on what they call until nothing changes
+  std::vector<FunctionAttributes> own_effects;
+  for (unsigned function : component) {
+    own_effects.push_back(own_memory_effects(&summaries[function]));
+    summaries[function].function_object->inferred_attributes = own_effects.back();
+  }
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (size_t i = 0; i < component.size(); i++) {
+      FunctionSummary const* summary = &summaries[component[i]];
+      FunctionAttributes effects = own_effects[i];
+      for (ASTNode const* call_node : summary->calls)
+        add_call_effects(summary, call_node, &effects);
+
+      FunctionAttributes& attributes = summary->function_object->inferred_attributes;
+      if (!same_memory_effects(effects, attributes)) {
+        attributes = effects;
+        changed = true;
+      }
+    }
+  }
+
+  for (unsigned function : component) {
+    FunctionSummary const* summary = &summaries[function];
+    Object* function_object = summary->function_object;
+    FunctionAttributes attributes = function_object->inferred_attributes;
+
+    attributes.is_norecurse = !is_recursive;
+    attributes.will_return = !is_recursive && !summary->has_loop;
+    bool calls_speculatable = true;
+    for (ASTNode const* call_node : summary->calls) {
+      FunctionAttributes const& callee = callee_attributes(call_node);
+      attributes.is_norecurse &= callee.is_norecurse;
+      attributes.will_return &= callee.will_return;
+      calls_speculatable &= callee.is_speculatable;
+    }
+
+    attributes.is_noreturn = (function_object->declaration_specifiers.flags & TypeModifierFlag::NoReturn) || body_diverges(function_object);
+    attributes.will_return &= !attributes.is_noreturn;
+
+    bool touches_memory = attributes.reads_argument_memory || attributes.writes_argument_memory || attributes.reads_other_memory || attributes.writes_other_memory;
+    attributes.is_speculatable = attributes.will_return && !touches_memory && !summary->may_trap && calls_speculatable && returns_on_every_path(function_object);
+
+    function_object->inferred_attributes = attributes;
+  }
+}
+
+void infer_function_attributes(ExternalDeclaration* external_declarations)
+{
+  std::vector<FunctionSummary> summaries;
+  std::unordered_map<Object const*, unsigned> summary_of_function;
+
+  for (ExternalDeclaration* declaration = external_declarations; declaration; declaration = declaration->next) {
+    if (declaration->type == ExternalDeclarationType::FunctionDefinition) {
+      Object* function_object = declaration->root_ast_node->object;
+      summary_of_function.emplace(function_object, (unsigned)summaries.size());
+      summaries.push_back({ function_object, {}, {}, {}, {}, false, false });
+      continue;
+    }
+
+    // declared functions may do anything, unless they are known not to return
+    for (ASTNode* declaration_node = declaration->root_ast_node; declaration_node; declaration_node = declaration_node->next) {
+      Object* object = declaration_node->object;
+      if (!object || object->type->fundamental_type != FundamentalType::Function)
+        continue;
+
+      bool is_library_noreturn = std::any_of(std::begin(noreturn_library_functions), std::end(noreturn_library_functions),
+          [&](char const* name) { return object->identifier == name; });
+      object->inferred_attributes = unknown_function_attributes;
+      object->inferred_attributes.is_noreturn = is_library_noreturn || (object->declaration_specifiers.flags & TypeModifierFlag::NoReturn);
+    }
+  }
+
+  for (FunctionSummary& summary : summaries) {
+    Object const* function_object = summary.function_object;
+    for (ASTNode const* statement = function_object->function_body; statement; statement = statement->next) {
+      walk_ast_post_order(statement, summarize_node, &summary);
+      // a statement is evaluated for its side effects, e.g. reading a volatile
+      record_access(&summary, statement, true, false);
+    }
+
+    for (ASTNode const* call_node : summary.calls) {
+      auto found = summary_of_function.find(called_function(call_node));
+      if (found != summary_of_function.end())
+        summary.callees.push_back(found->second);
+    }
+  }
+
+  for (std::vector<unsigned> const& component : strongly_connected_components(summaries))
+    infer_component(summaries, component);
+}
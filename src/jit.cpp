@@ -0,0 +1,75 @@
+#include "jit.h"
+#include "target.h"
+#include "target_machine.h"
+
+#include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>
+#include <llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h>
+#include <llvm/ExecutionEngine/Orc/TargetProcess/TargetExecutionUtils.h>
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
+#include <llvm/Support/Error.h>
+
+#include <stdio.h>
+#include <string.h>
+
+template<typename T> static T value_or_exit(llvm::Expected<T> value, char const* what)
+{
+  if (!value) {
+    fprintf(stderr, "%s: %s, aborting.\n", what, llvm::toString(value.takeError()).c_str());
+    exit(1);
+  }
+  return std::move(*value);
+}
+
+static llvm::CodeGenOpt::Level jit_codegen_level(OptimizationLevel level)
+{
+  return level == OptimizationLevel::O0 ? llvm::CodeGenOpt::None : llvm::CodeGenOpt::Default;
+}
+
+JitSession* new_jit_session(OptimizationLevel level)
+{
+  // the module was laid out for current_target, which must be the process
+  // the code runs in
+  if (current_target != host_target()) {
+    fprintf(stderr, "--run only runs code for the host, not %s, aborting.\n", current_target->triple);
+    exit(1);
+  }
+
+  initialize_backends();
+
+  llvm::orc::JITTargetMachineBuilder machine_builder = value_or_exit(llvm::orc::JITTargetMachineBuilder::detectHost(), "Could not JIT for the host");
+  machine_builder.setCodeGenOptLevel(jit_codegen_level(level));
+
+  JitSession* session = new JitSession;
+  session->jit = value_or_exit(llvm::orc::LLJITBuilder().setJITTargetMachineBuilder(std::move(machine_builder)).create(), "Could not create the JIT");
+
+  // undefined symbols resolve to this process's, libc's included
+  llvm::orc::JITDylib& main_library = session->jit->getMainJITDylib();
+  char global_prefix = session->jit->getDataLayout().getGlobalPrefix();
+  main_library.addGenerator(value_or_exit(llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(global_prefix), "Could not search this process"));
+
+  return session;
+}
+
+void free_jit_session(JitSession* session) { delete session; }
+
+void add_module_to_jit(JitSession* session, std::unique_ptr<llvm::Module> module, std::unique_ptr<llvm::LLVMContext> context)
+{
+  llvm::orc::ThreadSafeModule thread_safe_module(std::move(module), std::move(context));
+  if (llvm::Error error = session->jit->addIRModule(std::move(thread_safe_module))) {
+    fprintf(stderr, "Could not add a module to the JIT: %s, aborting.\n", llvm::toString(std::move(error)).c_str());
+    exit(1);
+  }
+}
+
+MainFunction compile_main(JitSession* session)
+{
+  llvm::JITEvaluatedSymbol main_symbol = value_or_exit(session->jit->lookup("main"), "Could not compile main");
+  return (MainFunction)main_symbol.getAddress();
+}
+
+// main may also take no parameters, the arguments are then just ignored
+int run_main(MainFunction main_function, std::vector<std::string> const& arguments)
+{
+  std::vector<std::string> rest(arguments.begin() + 1, arguments.end());
+  return llvm::orc::runAsMain(main_function, rest, llvm::StringRef(arguments[0]));
+}
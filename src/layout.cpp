@@ -0,0 +1,398 @@
+#include "layout.h"
+#include "ast_walk.h"
+#include "target.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <string>
+#include <unordered_set>
+
+static void layout_error(char const* message)
+{
+  fprintf(stderr, "%s", message);
+  exit(1);
+}
+
+static unsigned long long align_to(unsigned long long offset, unsigned alignment) { return (offset + alignment - 1) / alignment * alignment; }
+
+static FundamentalType complex_element_type(FundamentalType t)
+{
+  switch (t) {
+  case FundamentalType::FloatComplex:
+    return FundamentalType::Float;
+  case FundamentalType::DoubleComplex:
+    return FundamentalType::Double;
+  default:
+    return FundamentalType::LongDouble;
+  }
+}
+
+unsigned long long size_of_type(Type const* type)
+{
+  switch (type->fundamental_type) {
+  case FundamentalType::Void:
+  case FundamentalType::Function:
+    layout_error("Taking the size of a void or function type\n");
+    return 0;
+
+  case FundamentalType::Bool:
+    return 1;
+
+    // x86_fp80 is padded out to a whole number of alignment units
+  case FundamentalType::LongDouble:
+    return current_target->long_double_size;
+
+    // 6.2.5.13 a complex number is laid out as an array of two of its parts
+  case FundamentalType::FloatComplex:
+  case FundamentalType::DoubleComplex:
+  case FundamentalType::LongDoubleComplex:
+    return 2 * size_of_type(get_fundamental_type_pointer(complex_element_type(type->fundamental_type)));
+
+  case FundamentalType::Array:
+    if (type->array_length < 0)
+      layout_error("Taking the size of an array of unknown size\n");
+    return type->array_length * size_of_type(type->pointed_type);
+
+  case FundamentalType::Vector:
+    return type->array_length * size_of_type(type->pointed_type);
+
+  case FundamentalType::Struct:
+  case FundamentalType::Union:
+    return struct_layout(type)->size;
+
+  default:
+    return fundamental_type_bit_width(type->fundamental_type) / 8;
+  }
+}
+
+unsigned alignment_of_type(Type const* type)
+{
+  // 6.2.5 atomic types may be more aligned than their non-atomic versions,
+  // and are aligned to their size, e.g. long long on i386, so that atomic
+  // instructions can access them without a lock
+  if (is_atomic_type(type))
+    return (unsigned)size_of_type(type);
+
+  switch (type->fundamental_type) {
+  case FundamentalType::LongLong:
+  case FundamentalType::UnsignedLongLong:
+    return current_target->long_long_alignment;
+  case FundamentalType::Double:
+    return current_target->double_alignment;
+  case FundamentalType::LongDouble:
+    return current_target->long_double_alignment;
+
+  case FundamentalType::FloatComplex:
+  case FundamentalType::DoubleComplex:
+  case FundamentalType::LongDoubleComplex:
+    return alignment_of_type(get_fundamental_type_pointer(complex_element_type(type->fundamental_type)));
+
+  case FundamentalType::Array:
+    return alignment_of_type(type->pointed_type);
+
+    // GCC aligns vectors to their size, so aligned loads and stores can move
+    // them in one piece
+  case FundamentalType::Vector:
+    return (unsigned)size_of_type(type);
+
+  case FundamentalType::Struct:
+  case FundamentalType::Union:
+    return struct_layout(type)->alignment;
+
+    // scalars are aligned to their size
+  default:
+    return (unsigned)size_of_type(type);
+  }
+}
+
+// 6.7.2.1.18 the last member of a struct may be an array of unknown size
+static bool is_flexible_array_member(StructMember const& member)
+{
+  return member.member_type->fundamental_type == FundamentalType::Array && member.member_type->array_length < 0;
+}
+
+// packing drops a member's natural alignment, _Alignas still applies
+static unsigned member_alignment(StructData const* struct_data, StructMember const& member)
+{
+  unsigned natural_alignment = struct_data->is_packed ? 1 : alignment_of_type(member.member_type);
+  return std::max(natural_alignment, member.alignment);
+}
+
+static std::vector<unsigned> declaration_order(StructData const* struct_data)
+{
+  std::vector<unsigned> member_order(struct_data->members.size());
+  for (unsigned i = 0; i < member_order.size(); i++)
+    member_order[i] = i;
+
+  return member_order;
+}
+
+// decreasing alignment, ties keep their declaration order, and a flexible
+// array member stays at the end
+static std::vector<unsigned> optimal_member_order(StructData const* struct_data)
+{
+  std::vector<unsigned> member_order = declaration_order(struct_data);
+
+  std::stable_sort(member_order.begin(), member_order.end(), [struct_data](unsigned lhs, unsigned rhs) {
+    StructMember const& lhs_member = struct_data->members[lhs];
+    StructMember const& rhs_member = struct_data->members[rhs];
+    if (is_flexible_array_member(lhs_member) != is_flexible_array_member(rhs_member))
+      return is_flexible_array_member(rhs_member);
+
+    return member_alignment(struct_data, lhs_member) > member_alignment(struct_data, rhs_member);
+  });
+
+  return member_order;
+}
+
+// the members of a union all start at offset 0
+static StructLayout compute_layout(Type const* struct_type, std::vector<unsigned> member_order)
+{
+  StructData const* struct_data = struct_type->struct_data;
+  bool is_union = struct_type->fundamental_type == FundamentalType::Union;
+
+  StructLayout layout;
+  layout.alignment = std::max(1u, struct_data->alignment);
+  layout.member_offsets.resize(struct_data->members.size());
+
+  unsigned long long end = 0;
+  for (unsigned index : member_order) {
+    StructMember const& member = struct_data->members[index];
+    unsigned alignment = member_alignment(struct_data, member);
+    unsigned long long offset = is_union ? 0 : align_to(end, alignment);
+    unsigned long long size = is_flexible_array_member(member) ? 0 : size_of_type(member.member_type);
+
+    layout.member_offsets[index] = offset;
+    layout.alignment = std::max(layout.alignment, alignment);
+    end = std::max(end, offset + size);
+  }
+
+  layout.size = align_to(end, layout.alignment);
+  layout.member_order = std::move(member_order);
+  return layout;
+}
+
+// semantic analysis and codegen may ask from several threads at once, each
+// computes the same layout and the first one to finish gets cached
+StructLayout const* struct_layout(Type const* struct_type)
+{
+  StructData* struct_data = struct_type->struct_data;
+  if (!struct_data || !struct_data->is_complete)
+    layout_error("Using an incomplete struct or union type\n");
+
+  StructLayout const* cached_layout = struct_data->layout.load(std::memory_order_acquire);
+  if (cached_layout)
+    return cached_layout;
+
+  bool reorder = struct_data->may_reorder_members && struct_type->fundamental_type == FundamentalType::Struct;
+  StructLayout* layout = new StructLayout(compute_layout(struct_type, reorder ? optimal_member_order(struct_data) : declaration_order(struct_data)));
+
+  if (!struct_data->layout.compare_exchange_strong(cached_layout, layout, std::memory_order_acq_rel)) {
+    delete layout;
+    return cached_layout;
+  }
+
+  return layout;
+}
+
+int find_struct_member(Type const* struct_type, std::string const& identifier)
+{
+  std::vector<StructMember> const& members = struct_type->struct_data->members;
+  for (size_t i = 0; i < members.size(); i++)
+    if (members[i].identifier == identifier)
+      return (int)i;
+
+  return -1;
+}
+
+StructPaddingReport struct_padding_report(Type const* struct_type)
+{
+  assert(struct_type->fundamental_type == FundamentalType::Struct);
+  StructData const* struct_data = struct_type->struct_data;
+  StructLayout const* layout = struct_layout(struct_type);
+
+  StructPaddingReport report;
+  report.padding = layout->size;
+
+  std::vector<unsigned> const& member_order = layout->member_order;
+  for (size_t i = 0; i < member_order.size(); i++) {
+    StructMember const& member = struct_data->members[member_order[i]];
+    unsigned long long size = is_flexible_array_member(member) ? 0 : size_of_type(member.member_type);
+    unsigned long long end = layout->member_offsets[member_order[i]] + size;
+    unsigned long long next_offset = i + 1 < member_order.size() ? layout->member_offsets[member_order[i + 1]] : layout->size;
+
+    report.padding -= size;
+    if (next_offset > end)
+      report.holes.push_back({ member_order[i], next_offset - end });
+  }
+
+  report.optimal_order = optimal_member_order(struct_data);
+  report.optimal_size = compute_layout(struct_type, report.optimal_order).size;
+  return report;
+}
+
+// Struct types used by a translation unit
+//
+// the structs reachable from the types of its declarations, through pointers,
+// arrays, function signatures and members, in the order they are found
+
+struct StructTypeCollector {
+  std::unordered_set<Type const*> visited_types;
+  std::vector<Type const*> struct_types;
+};
+
+static void collect_struct_types(StructTypeCollector* collector, Type const* type)
+{
+  std::vector<Type const*> worklist = { type };
+
+  while (!worklist.empty()) {
+    Type const* current_type = worklist.back();
+    worklist.pop_back();
+
+    if (!current_type || !collector->visited_types.insert(current_type).second)
+      continue;
+
+    switch (current_type->fundamental_type) {
+    case FundamentalType::Pointer:
+    case FundamentalType::Array:
+      worklist.push_back(current_type->pointed_type);
+      break;
+
+    case FundamentalType::Function:
+      worklist.push_back(current_type->function_data->return_type);
+      for (FunctionParameter const* current_param = current_type->function_data->parameter_list; current_param;
+           current_param = current_param->next_parameter)
+        worklist.push_back(current_param->parameter_type);
+      break;
+
+    case FundamentalType::Struct:
+    case FundamentalType::Union:
+      if (!current_type->struct_data)
+        break;
+
+      collector->struct_types.push_back(current_type);
+      for (StructMember const& member : current_type->struct_data->members)
+        worklist.push_back(member.member_type);
+      break;
+
+    default:
+      break;
+    }
+  }
+}
+
+static void collect_declared_struct_types(ASTNode const* ast_node, void* collector)
+{
+  if (ast_node->type == ASTNodeType::Declaration)
+    collect_struct_types((StructTypeCollector*)collector, ast_node->object->type);
+}
+
+static std::vector<Type const*> struct_types_in_translation_unit(ExternalDeclaration const* external_declarations)
+{
+  StructTypeCollector collector;
+
+  for (ExternalDeclaration const* declaration = external_declarations; declaration; declaration = declaration->next) {
+    for (ASTNode const* declaration_node = declaration->root_ast_node; declaration_node; declaration_node = declaration_node->next) {
+      Object const* object = declaration_node->object;
+      collect_struct_types(&collector, object->type);
+
+      if (declaration->type != ExternalDeclarationType::FunctionDefinition)
+        continue;
+
+      for (ASTNode const* statement = object->function_body; statement; statement = statement->next)
+        walk_ast_post_order(statement, collect_declared_struct_types, &collector);
+    }
+  }
+
+  return collector.struct_types;
+}
+
+static std::string struct_name(Type const* struct_type)
+{
+  std::string const& tag = struct_type->struct_data->tag;
+  return "struct " + (tag.empty() ? std::string("(anonymous)") : tag);
+}
+
+// worded like clang's -Wpadded, with a note when reordering would help
+void print_padding_report(ExternalDeclaration const* external_declarations, FILE* outfile)
+{
+  for (Type const* struct_type : struct_types_in_translation_unit(external_declarations)) {
+    if (struct_type->fundamental_type != FundamentalType::Struct || !struct_type->struct_data->is_complete)
+      continue;
+
+    StructPaddingReport report = struct_padding_report(struct_type);
+    if (!report.padding)
+      continue;
+
+    StructData const* struct_data = struct_type->struct_data;
+    StructLayout const* layout = struct_layout(struct_type);
+    std::string name = struct_name(struct_type);
+
+    for (PaddingHole const& hole : report.holes) {
+      auto position = std::find(layout->member_order.begin(), layout->member_order.end(), hole.member_index);
+
+      if (position + 1 == layout->member_order.end())
+        fprintf(outfile, "warning: padding size of '%s' with %llu bytes to alignment boundary [-Wpadded]\n", name.c_str(), hole.size);
+      else
+        fprintf(outfile, "warning: padding struct '%s' with %llu bytes to align '%s' [-Wpadded]\n", name.c_str(), hole.size,
+            struct_data->members[*(position + 1)].identifier.c_str());
+    }
+
+    if (report.optimal_size >= layout->size)
+      continue;
+
+    std::string optimal_order;
+    for (unsigned index : report.optimal_order)
+      optimal_order += (optimal_order.empty() ? "" : ", ") + struct_data->members[index].identifier;
+
+    fprintf(outfile, "note: ordering the members of '%s' as %s would make it %llu bytes instead of %llu\n", name.c_str(), optimal_order.c_str(),
+        report.optimal_size, layout->size);
+  }
+}
+
+// a pointer to a struct converted to another pointer type can be used to read
+// the struct's bytes, e.g. by memcpy or fwrite, so the layout has to stay put
+static void collect_escaping_conversion(ASTNode const* ast_node, void* collector)
+{
+  if (ast_node->type != ASTNodeType::ImplicitConversion || ast_node->expression_type->fundamental_type != FundamentalType::Pointer)
+    return;
+
+  Type const* from_type = ast_node->lhs->expression_type;
+  if (from_type->fundamental_type == FundamentalType::Pointer && from_type != ast_node->expression_type) {
+    collect_struct_types((StructTypeCollector*)collector, from_type);
+    collect_struct_types((StructTypeCollector*)collector, ast_node->expression_type);
+  }
+}
+
+// like GCC's old -fipa-struct-reorg, this assumes no one compares the
+// addresses of different members of a struct, which would see the new order
+void mark_reorderable_structs(ExternalDeclaration const* external_declarations)
+{
+  StructTypeCollector escaping;
+
+  for (ExternalDeclaration const* declaration = external_declarations; declaration; declaration = declaration->next) {
+    for (ASTNode const* declaration_node = declaration->root_ast_node; declaration_node; declaration_node = declaration_node->next) {
+      Object const* object = declaration_node->object;
+      if (!(object->declaration_specifiers.flags & (TypeModifierFlag::Static | TypeModifierFlag::TypeDef)))
+        collect_struct_types(&escaping, object->type);
+
+      if (declaration_node->rhs)
+        walk_ast_post_order(declaration_node->rhs, collect_escaping_conversion, &escaping);
+
+      if (declaration->type != ExternalDeclarationType::FunctionDefinition)
+        continue;
+
+      for (ASTNode const* statement = object->function_body; statement; statement = statement->next)
+        walk_ast_post_order(statement, collect_escaping_conversion, &escaping);
+    }
+  }
+
+  for (Type const* struct_type : struct_types_in_translation_unit(external_declarations)) {
+    if (escaping.visited_types.contains(struct_type))
+      continue;
+
+    assert(!struct_type->struct_data->layout.load() && "mark_reorderable_structs: layout already computed");
+    struct_type->struct_data->may_reorder_members = true;
+  }
+}
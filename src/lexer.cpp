@@ -455,7 +455,6 @@ static Token lex_ellipses(Lexer* lexer)
   assert(current_char(lexer) == '.');
   advance(lexer);
   assert(current_char(lexer) == '.');
-  advance(lexer);
   return lexer_make_token_and_advance(lexer, TokenType::Ellipsis);
 }
 
@@ -537,9 +536,8 @@ Token lex_next_token(Lexer* lexer)
       advance(lexer);
       return lexer_make_token_and_advance(lexer, TokenType::PlusPlus);
     }
-    // positive float
-    if (is_digit(peek_next_char(lexer)) || peek_next_char(lexer) == '.')
-      return lex_number(lexer);
+    // constants carry no sign in C, +5 is unary plus applied to 5,
+    // which the expression parser handles
 
     // +
     return lexer_make_token_and_advance(lexer, TokenType::Plus);
@@ -557,9 +555,13 @@ Token lex_next_token(Lexer* lexer)
       return lexer_make_token_and_advance(lexer, TokenType::MinusMinus);
     }
 
-    // negative float
-    if (is_digit(peek_next_char(lexer)) || peek_next_char(lexer) == '.')
-      return lex_number(lexer);
+    // ->
+    if (peek_next_char(lexer) == '>') {
+      advance(lexer);
+      return lexer_make_token_and_advance(lexer, TokenType::ArrowOperator);
+    }
+
+    // likewise, -5 is unary minus applied to 5
 
     // -
     return lexer_make_token_and_advance(lexer, TokenType::Minus);
@@ -643,6 +645,9 @@ Token lex_next_token(Lexer* lexer)
     }
     return lexer_make_token_and_advance(lexer, TokenType::Ampersand);
 
+  case '~':
+    return lexer_make_token_and_advance(lexer, TokenType::Tilde);
+
   case '|':
     if (peek_next_char(lexer) == '|') {
       advance(lexer);
@@ -669,6 +674,12 @@ Token lex_next_token(Lexer* lexer)
         return token_from_keyword_or_identifier(lexer, TokenType::AlignAs,
             "_Alignas");
       }
+    case 'B':
+      return token_from_keyword_or_identifier(lexer, TokenType::Bool,
+          "_Bool");
+    case 'C':
+      return token_from_keyword_or_identifier(lexer, TokenType::Complex,
+          "_Complex");
     case 'N':
       return token_from_keyword_or_identifier(lexer, TokenType::NoReturn,
           "_Noreturn");
@@ -828,6 +839,14 @@ Token lex_next_token(Lexer* lexer)
   assert(false && "Lex next token UNREACHABLE");
 }
 
+// the lexer is just a few pointers into the source, so looking ahead a token
+// is lexing one with a copy of it
+Token peek_next_token(Lexer const* lexer)
+{
+  Lexer lookahead = *lexer;
+  return *get_next_token(&lookahead);
+}
+
 Token const* get_next_token(Lexer* lexer)
 {
   if (lexer->current_token.type == TokenType::Eof)
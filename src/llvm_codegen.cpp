@@ -0,0 +1,1591 @@
+#include "llvm_codegen.h"
+#include "ast_walk.h"
+#include "function_attributes.h"
+#include "layout.h"
+#include "tbaa.h"
+#include "target.h"
+#include "type.h"
+
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/CFG.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/MDBuilder.h>
+#include <llvm/IR/ValueHandle.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <cassert>
+#include <string.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// the LLVM types and globals of one module
+struct ModuleBuilder {
+  llvm::LLVMContext* context;
+  llvm::Module* module;
+  CodegenOptions const* options;
+
+  // interned types map to one LLVM type each
+  std::unordered_map<Type const*, llvm::Type*> types;
+
+  // the canonical declaration of each file scope identifier, see
+  // name_resolution.cpp, and the global or function it became
+  std::unordered_map<Object const*, llvm::GlobalValue*> globals;
+
+  // TBAA type nodes, see tbaa.h, made the first time an access needs them
+  llvm::MDNode* tbaa_root = nullptr;
+  llvm::MDNode* tbaa_scalar_types[tbaa_scalar_type_count] = {};
+  std::unordered_map<Type const*, llvm::MDNode*> tbaa_struct_types;
+};
+
+// the result of emitting code for an expression, like codegen.cpp's Value.
+// Constants are llvm::Constants, which IRBuilder folds on its own, and lvalues
+// are addresses that are only loaded from when their value is needed
+struct Value {
+  Type const* type;
+  // nullptr for the result of a void call
+  llvm::Value* value;
+  bool is_lvalue;
+
+  // lvalues: the alignment to access them with, 0 for their type's own
+  unsigned alignment;
+
+  // lvalues of promoted locals: their slot, otherwise -1
+  int variable = -1;
+
+  // lvalues in memory: what they are part of, for their TBAA tag
+  TBAAAccess tbaa = {};
+};
+
+struct LocalVariable {
+  llvm::Value* address;
+  Type const* type;
+  unsigned alignment;
+};
+
+// state for emitting a single function definition
+struct FunctionBuilder {
+  ModuleBuilder* module_builder;
+  llvm::IRBuilder<>* builder;
+  llvm::Function* function;
+  std::vector<LocalVariable> local_variables;
+  Type const* return_type;
+
+  // see has_locals_in_memory, calls in tail position aren't marked tail then
+  bool has_locals_in_memory;
+
+  // post-order emission leaves each node's result here for its parent
+  std::vector<Value> value_stack;
+
+  // SSA construction for promoted locals, as in codegen.cpp. Blocks are
+  // sealed unless listed here, and their predecessors are the blocks that
+  // branch to them. Definitions follow trivial phis to what replaced them
+  std::unordered_map<llvm::BasicBlock*, std::unordered_map<int, llvm::WeakTrackingVH>> definitions;
+  std::unordered_set<llvm::BasicBlock*> unsealed_blocks;
+  std::unordered_map<llvm::BasicBlock*, std::vector<std::pair<int, llvm::PHINode*>>> incomplete_phis;
+
+  // trivial phis and what replaced them. A Value on the value stack may still
+  // use one, so they are only erased once the function is done
+  std::vector<std::pair<llvm::PHINode*, llvm::WeakTrackingVH>> removed_phis;
+};
+
+static void error_and_stop(char const* message)
+{
+  fprintf(stderr, "%s", message);
+  exit(1);
+}
+
+static llvm::Type* llvm_type(ModuleBuilder*, Type const*);
+
+static void append_padding(ModuleBuilder* module_builder, std::vector<llvm::Type*>* elements, unsigned long long padding)
+{
+  if (padding)
+    elements->push_back(llvm::ArrayType::get(llvm::Type::getInt8Ty(*module_builder->context), padding));
+}
+
+// packed, with the padding spelled out, exactly like struct_type_to_string in
+// codegen.cpp
+static llvm::Type* llvm_struct_type(ModuleBuilder* module_builder, Type const* struct_type)
+{
+  StructLayout const* layout = struct_layout(struct_type);
+  std::vector<llvm::Type*> elements;
+  unsigned long long end = 0;
+
+  if (struct_type->fundamental_type == FundamentalType::Struct) {
+    for (unsigned index : layout->member_order) {
+      Type const* member_type = struct_type->struct_data->members[index].member_type;
+
+      // a flexible array member takes no space
+      if (member_type->fundamental_type == FundamentalType::Array && member_type->array_length < 0)
+        break;
+
+      append_padding(module_builder, &elements, layout->member_offsets[index] - end);
+      elements.push_back(llvm_type(module_builder, member_type));
+      end = layout->member_offsets[index] + size_of_type(member_type);
+    }
+  }
+
+  append_padding(module_builder, &elements, layout->size - end);
+  return llvm::StructType::get(*module_builder->context, elements, true);
+}
+
+static llvm::Type* long_double_type(llvm::LLVMContext& context)
+{
+  if (strcmp(current_target->long_double_type, "x86_fp80") == 0)
+    return llvm::Type::getX86_FP80Ty(context);
+  if (strcmp(current_target->long_double_type, "fp128") == 0)
+    return llvm::Type::getFP128Ty(context);
+  return llvm::Type::getDoubleTy(context);
+}
+
+static llvm::Type* uncached_llvm_type(ModuleBuilder* module_builder, Type const* type)
+{
+  llvm::LLVMContext& context = *module_builder->context;
+
+  switch (type->fundamental_type) {
+  case FundamentalType::Void:
+    return llvm::Type::getVoidTy(context);
+
+  case FundamentalType::Char:
+  case FundamentalType::SignedChar:
+  case FundamentalType::UnsignedChar:
+    return llvm::Type::getInt8Ty(context);
+
+  case FundamentalType::Short:
+  case FundamentalType::UnsignedShort:
+    return llvm::Type::getInt16Ty(context);
+
+  case FundamentalType::Int:
+  case FundamentalType::UnsignedInt:
+    return llvm::Type::getInt32Ty(context);
+
+  case FundamentalType::Long:
+  case FundamentalType::UnsignedLong:
+    return llvm::Type::getIntNTy(context, current_target->long_width);
+
+  case FundamentalType::LongLong:
+  case FundamentalType::UnsignedLongLong:
+    return llvm::Type::getInt64Ty(context);
+
+  case FundamentalType::Float:
+    return llvm::Type::getFloatTy(context);
+  case FundamentalType::Double:
+    return llvm::Type::getDoubleTy(context);
+  case FundamentalType::LongDouble:
+    return long_double_type(context);
+
+  case FundamentalType::Bool:
+    return llvm::Type::getInt1Ty(context);
+
+  case FundamentalType::Pointer:
+    return llvm::PointerType::get(context, 0);
+
+  case FundamentalType::Struct:
+  case FundamentalType::Union:
+    return llvm_struct_type(module_builder, type);
+
+  case FundamentalType::Array:
+    if (type->array_length < 0)
+      error_and_stop("Emitting an array of unknown size\n");
+    return llvm::ArrayType::get(llvm_type(module_builder, type->pointed_type), type->array_length);
+
+  case FundamentalType::Vector:
+    return llvm::FixedVectorType::get(llvm_type(module_builder, type->pointed_type), type->array_length);
+
+    // FIXME incomplete
+  default:
+    assert(false && "emitting code for this type not implemented\n");
+    return nullptr;
+  }
+}
+
+static llvm::Type* llvm_type(ModuleBuilder* module_builder, Type const* type)
+{
+  auto [entry, inserted] = module_builder->types.try_emplace(type, nullptr);
+  if (inserted)
+    entry->second = uncached_llvm_type(module_builder, type);
+  return entry->second;
+}
+
+static llvm::FunctionType* llvm_function_type(ModuleBuilder* module_builder, FunctionData const* function_data)
+{
+  std::vector<llvm::Type*> parameter_types;
+  for (FunctionParameter const* current_param = function_data->parameter_list; current_param; current_param = current_param->next_parameter)
+    parameter_types.push_back(llvm_type(module_builder, current_param->parameter_type));
+
+  return llvm::FunctionType::get(llvm_type(module_builder, function_data->return_type), parameter_types, function_data->is_variadic);
+}
+
+// numeric constants are integers, floating point ones included, and a
+// constant vector has the same constant in every element
+static llvm::Constant* llvm_constant(ModuleBuilder* module_builder, Type const* type, long long constant)
+{
+  llvm::Type* constant_type = llvm_type(module_builder, type);
+
+  if (type->fundamental_type == FundamentalType::Vector)
+    return llvm::ConstantVector::getSplat(llvm::ElementCount::getFixed(type->array_length), llvm_constant(module_builder, type->pointed_type, constant));
+
+  if (type->fundamental_type == FundamentalType::Pointer) {
+    if (constant == 0)
+      return llvm::ConstantPointerNull::get(llvm::cast<llvm::PointerType>(constant_type));
+    return llvm::ConstantExpr::getIntToPtr(llvm_constant(module_builder, ptrdiff_type(), constant), constant_type);
+  }
+
+  // exactly, even where a long long doesn't fit in a double
+  if (is_floating_type(type->fundamental_type)) {
+    llvm::APFloat value(constant_type->getFltSemantics());
+    value.convertFromAPInt(llvm::APInt(64, (uint64_t)constant, true), true, llvm::APFloat::rmNearestTiesToEven);
+    return llvm::ConstantFP::get(*module_builder->context, value);
+  }
+
+  return llvm::ConstantInt::get(constant_type, (uint64_t)constant, true);
+}
+
+static Value rvalue(Type const* type, llvm::Value* value) { return { type, value, false, 0 }; }
+
+static Value lvalue(Type const* type, llvm::Value* address, unsigned alignment) { return { type, address, true, alignment }; }
+
+static Value constant_value(FunctionBuilder* function_builder, Type const* type, long long constant)
+{
+  return rvalue(type, llvm_constant(function_builder->module_builder, type, constant));
+}
+
+static llvm::MaybeAlign maybe_align(unsigned alignment) { return alignment ? llvm::MaybeAlign(alignment) : llvm::MaybeAlign(); }
+
+static llvm::ConstantInt const* as_constant_int(Value value) { return llvm::dyn_cast_or_null<llvm::ConstantInt>(value.value); }
+
+// after a ret, any following (dead) code still needs a block to live in
+static void start_block_if_terminated(FunctionBuilder* function_builder)
+{
+  if (!function_builder->builder->GetInsertBlock()->getTerminator())
+    return;
+
+  llvm::BasicBlock* block = llvm::BasicBlock::Create(*function_builder->module_builder->context, "", function_builder->function);
+  function_builder->builder->SetInsertPoint(block);
+}
+
+// a block after the ones emitted so far
+static llvm::BasicBlock* new_block(FunctionBuilder* function_builder, char const* name)
+{
+  return llvm::BasicBlock::Create(*function_builder->module_builder->context, name, function_builder->function);
+}
+
+// SSA construction, see codegen.cpp
+
+static void write_variable(FunctionBuilder* function_builder, int slot, llvm::BasicBlock* block, llvm::Value* value)
+{
+  function_builder->definitions[block][slot] = value;
+}
+
+// phis go before anything else in their block
+static llvm::PHINode* new_phi(FunctionBuilder* function_builder, int slot, llvm::BasicBlock* block)
+{
+  llvm::Type* type = llvm_type(function_builder->module_builder, function_builder->local_variables[slot].type);
+  if (block->empty())
+    return llvm::PHINode::Create(type, 0, "", block);
+  return llvm::PHINode::Create(type, 0, "", &block->front());
+}
+
+static bool is_complete_phi(FunctionBuilder* function_builder, llvm::PHINode* phi)
+{
+  llvm::BasicBlock* block = phi->getParent();
+  return !function_builder->unsealed_blocks.count(block) && phi->getNumIncomingValues() == (unsigned)llvm::pred_size(block);
+}
+
+// the value of a local at the end of a block, following single predecessors
+// up without recursion, with phis left for complete_phis like in codegen.cpp
+static llvm::Value* lookup_variable(FunctionBuilder* function_builder, int slot, llvm::BasicBlock* block, std::vector<llvm::PHINode*>* pending_phis)
+{
+  // the blocks passed through, which get the value found as well
+  std::vector<llvm::BasicBlock*> path;
+  llvm::Value* value;
+  for (;;) {
+    auto& block_definitions = function_builder->definitions[block];
+    auto definition = block_definitions.find(slot);
+    if (definition != block_definitions.end()) {
+      value = definition->second;
+      break;
+    }
+
+    if (function_builder->unsealed_blocks.count(block)) {
+      llvm::PHINode* phi = new_phi(function_builder, slot, block);
+      function_builder->incomplete_phis[block].push_back({ slot, phi });
+      value = phi;
+    } else if (llvm::pred_empty(block)) {
+      // read before it was given a value
+      value = llvm::Constant::getNullValue(llvm_type(function_builder->module_builder, function_builder->local_variables[slot].type));
+    } else if (llvm::BasicBlock* predecessor = block->getSinglePredecessor()) {
+      path.push_back(block);
+      block = predecessor;
+      continue;
+    } else {
+      llvm::PHINode* phi = new_phi(function_builder, slot, block);
+      pending_phis->push_back(phi);
+      value = phi;
+    }
+    write_variable(function_builder, slot, block, value);
+    break;
+  }
+
+  for (llvm::BasicBlock* passed : path)
+    write_variable(function_builder, slot, passed, value);
+  return value;
+}
+
+// a phi whose incoming values are all the same value, or itself, is that
+// value. The phis using it may have become trivial in turn, and are tried next
+static void remove_trivial_phis(FunctionBuilder* function_builder, std::vector<llvm::PHINode*> worklist)
+{
+  std::unordered_set<llvm::PHINode*> removed;
+  while (!worklist.empty()) {
+    llvm::PHINode* phi = worklist.back();
+    worklist.pop_back();
+    if (removed.count(phi) || !is_complete_phi(function_builder, phi))
+      continue;
+
+    llvm::Value* same = nullptr;
+    bool is_trivial = true;
+    for (llvm::Value* operand : phi->incoming_values()) {
+      if (operand == same || operand == phi)
+        continue;
+      if (same) {
+        is_trivial = false;
+        break;
+      }
+      same = operand;
+    }
+    if (!is_trivial)
+      continue;
+
+    // only reachable from itself
+    if (!same)
+      same = llvm::Constant::getNullValue(phi->getType());
+
+    for (llvm::User* user : phi->users())
+      if (llvm::PHINode* user_phi = llvm::dyn_cast<llvm::PHINode>(user); user_phi && user_phi != phi)
+        worklist.push_back(user_phi);
+
+    phi->replaceAllUsesWith(same);
+    function_builder->removed_phis.push_back({ phi, same });
+    removed.insert(phi);
+  }
+}
+
+// fills in the incoming values of phis of one local, and of the phis looking
+// them up makes, then removes the ones that turned out trivial
+static void complete_phis(FunctionBuilder* function_builder, int slot, std::vector<llvm::PHINode*> pending_phis)
+{
+  std::vector<llvm::PHINode*> completed_phis;
+  while (!pending_phis.empty()) {
+    llvm::PHINode* phi = pending_phis.back();
+    pending_phis.pop_back();
+    for (llvm::BasicBlock* predecessor : llvm::predecessors(phi->getParent()))
+      phi->addIncoming(lookup_variable(function_builder, slot, predecessor, &pending_phis), predecessor);
+    completed_phis.push_back(phi);
+  }
+  remove_trivial_phis(function_builder, std::move(completed_phis));
+}
+
+static llvm::Value* read_variable(FunctionBuilder* function_builder, int slot, llvm::BasicBlock* block)
+{
+  std::vector<llvm::PHINode*> pending_phis;
+  llvm::WeakTrackingVH value = lookup_variable(function_builder, slot, block, &pending_phis);
+  complete_phis(function_builder, slot, std::move(pending_phis));
+  return value;
+}
+
+static void seal_block(FunctionBuilder* function_builder, llvm::BasicBlock* block)
+{
+  std::vector<std::pair<int, llvm::PHINode*>> incomplete_phis = std::move(function_builder->incomplete_phis[block]);
+  function_builder->incomplete_phis.erase(block);
+  function_builder->unsealed_blocks.erase(block);
+  for (auto [slot, phi] : incomplete_phis)
+    complete_phis(function_builder, slot, { phi });
+}
+
+// Atomics, see codegen.cpp
+
+static llvm::AtomicOrdering memory_order(Value order)
+{
+  llvm::ConstantInt const* constant = as_constant_int(order);
+  if (!constant)
+    return llvm::AtomicOrdering::SequentiallyConsistent;
+
+  switch ((MemoryOrder)constant->getSExtValue()) {
+  case MemoryOrder::Relaxed:
+    return llvm::AtomicOrdering::Monotonic;
+  case MemoryOrder::Consume:
+  case MemoryOrder::Acquire:
+    return llvm::AtomicOrdering::Acquire;
+  case MemoryOrder::Release:
+    return llvm::AtomicOrdering::Release;
+  case MemoryOrder::AcquireRelease:
+    return llvm::AtomicOrdering::AcquireRelease;
+  default:
+    return llvm::AtomicOrdering::SequentiallyConsistent;
+  }
+}
+
+static llvm::Align atomic_alignment(Value address) { return llvm::Align(address.alignment ? address.alignment : alignment_of_type(address.type)); }
+
+static Value emit_bitcast(FunctionBuilder* function_builder, Value value, Type const* to_type)
+{
+  return rvalue(to_type, function_builder->builder->CreateBitCast(value.value, llvm_type(function_builder->module_builder, to_type)));
+}
+
+// the unsigned integer type as big as a float or double
+static Type const* same_size_integer_type(Type const* type) { return size_of_type(type) == 4 ? UnsignedIntType : UnsignedLongLongType; }
+
+static Value emit_conversion(FunctionBuilder* function_builder, Value value, Type const* to_type);
+
+// atomic instructions access at least a byte, and cmpxchg only compares
+// integers and pointers
+static Value to_atomic_operand(FunctionBuilder* function_builder, Value value, bool is_compared)
+{
+  if (value.type->fundamental_type == FundamentalType::Bool)
+    return emit_conversion(function_builder, value, UnsignedCharType);
+  if (is_compared && is_floating_type(value.type->fundamental_type))
+    return emit_bitcast(function_builder, value, same_size_integer_type(value.type));
+  return value;
+}
+
+static Value from_atomic_operand(FunctionBuilder* function_builder, Value value, Type const* type)
+{
+  if (type->fundamental_type == FundamentalType::Bool)
+    return emit_conversion(function_builder, value, BoolType);
+  if (is_floating_type(type->fundamental_type) && !is_floating_type(value.type->fundamental_type))
+    return emit_bitcast(function_builder, value, type);
+
+  value.type = type;
+  return value;
+}
+
+static Value emit_atomic_load(FunctionBuilder* function_builder, Value address, llvm::AtomicOrdering order)
+{
+  Type const* value_type = non_atomic_type(address.type);
+  Type const* access_type = value_type->fundamental_type == FundamentalType::Bool ? UnsignedCharType : value_type;
+
+  llvm::LoadInst* load
+      = function_builder->builder->CreateAlignedLoad(llvm_type(function_builder->module_builder, access_type), address.value, atomic_alignment(address));
+  load->setAtomic(order);
+  return from_atomic_operand(function_builder, rvalue(access_type, load), value_type);
+}
+
+static void emit_atomic_store(FunctionBuilder* function_builder, Value value, Value address, llvm::AtomicOrdering order)
+{
+  value = to_atomic_operand(function_builder, value, false);
+  llvm::StoreInst* store = function_builder->builder->CreateAlignedStore(value.value, address.value, atomic_alignment(address));
+  store->setAtomic(order);
+}
+
+// gives the value the object had before
+static Value emit_atomicrmw(FunctionBuilder* function_builder, llvm::AtomicRMWInst::BinOp operation, Value address, Value operand, llvm::AtomicOrdering order)
+{
+  Type const* value_type = operand.type;
+  operand = to_atomic_operand(function_builder, operand, false);
+
+  llvm::Value* old_value = function_builder->builder->CreateAtomicRMW(operation, address.value, operand.value, atomic_alignment(address), order);
+  return from_atomic_operand(function_builder, rvalue(operand.type, old_value), value_type);
+}
+
+// gives whether the object held the expected value, and leaves the value it
+// did hold, as an atomic operand, in found
+static Value emit_cmpxchg(FunctionBuilder* function_builder, bool is_weak, Value address, Value expected, Value desired, llvm::AtomicOrdering success_order,
+    llvm::AtomicOrdering failure_order, Value* found)
+{
+  llvm::IRBuilder<>* builder = function_builder->builder;
+  expected = to_atomic_operand(function_builder, expected, true);
+  desired = to_atomic_operand(function_builder, desired, true);
+
+  llvm::AtomicCmpXchgInst* pair
+      = builder->CreateAtomicCmpXchg(address.value, expected.value, desired.value, atomic_alignment(address), success_order, failure_order);
+  pair->setWeak(is_weak);
+
+  *found = rvalue(expected.type, builder->CreateExtractValue(pair, 0));
+  return rvalue(BoolType, builder->CreateExtractValue(pair, 1));
+}
+
+static llvm::MDNode* tbaa_scalar_type_node(ModuleBuilder* module_builder, unsigned scalar_type)
+{
+  llvm::MDNode*& node = module_builder->tbaa_scalar_types[scalar_type];
+  if (!node) {
+    llvm::MDBuilder metadata(*module_builder->context);
+    if (!module_builder->tbaa_root)
+      module_builder->tbaa_root = metadata.createTBAARoot("Simple C/C++ TBAA");
+    llvm::MDNode* parent = scalar_type ? tbaa_scalar_type_node(module_builder, 0) : module_builder->tbaa_root;
+    node = metadata.createTBAAScalarTypeNode(tbaa_scalar_type_names[scalar_type], parent);
+  }
+  return node;
+}
+
+static llvm::MDNode* tbaa_type_node(ModuleBuilder* module_builder, Type const* type)
+{
+  if (type->fundamental_type != FundamentalType::Struct)
+    return tbaa_scalar_type_node(module_builder, tbaa_scalar_type(type));
+
+  auto found = module_builder->tbaa_struct_types.find(type);
+  if (found != module_builder->tbaa_struct_types.end())
+    return found->second;
+
+  std::vector<std::pair<llvm::MDNode*, uint64_t>> fields;
+  for (TBAAField const& field : tbaa_struct_fields(type))
+    fields.push_back({ tbaa_type_node(module_builder, field.type), field.offset });
+  llvm::MDNode* node = llvm::MDBuilder(*module_builder->context).createTBAAStructTypeNode(type->struct_data->tag, fields);
+  module_builder->tbaa_struct_types.emplace(type, node);
+  return node;
+}
+
+// the access tag of a load or store of an lvalue, see tbaa.h
+static void add_tbaa_tag(ModuleBuilder* module_builder, llvm::Instruction* access, Value const& accessed)
+{
+  if (!module_builder->options->strict_aliasing || !has_tbaa_type(accessed.type) || is_atomic_type(accessed.type))
+    return;
+
+  llvm::MDNode* access_type = tbaa_scalar_type_node(module_builder, tbaa_scalar_type(accessed.type));
+  llvm::MDNode* base_type = access_type;
+  if (accessed.tbaa.base_type)
+    base_type = tbaa_type_node(module_builder, accessed.tbaa.base_type);
+  // union members are accessed as char
+  if (accessed.tbaa.base_type && accessed.tbaa.base_type->fundamental_type != FundamentalType::Struct)
+    access_type = base_type;
+
+  llvm::MDNode* tag = llvm::MDBuilder(*module_builder->context).createTBAAStructTagNode(base_type, access_type, accessed.tbaa.offset);
+  access->setMetadata(llvm::LLVMContext::MD_tbaa, tag);
+}
+
+static Value load_if_lvalue(FunctionBuilder* function_builder, Value value)
+{
+  if (!value.is_lvalue)
+    return value;
+
+  if (value.variable >= 0)
+    return rvalue(value.type, read_variable(function_builder, value.variable, function_builder->builder->GetInsertBlock()));
+
+  if (is_atomic_type(value.type))
+    return emit_atomic_load(function_builder, value, llvm::AtomicOrdering::SequentiallyConsistent);
+
+  llvm::Type* type = llvm_type(function_builder->module_builder, value.type);
+  llvm::LoadInst* load = function_builder->builder->CreateAlignedLoad(type, value.value, maybe_align(value.alignment));
+  add_tbaa_tag(function_builder->module_builder, load, value);
+  return rvalue(value.type, load);
+}
+
+static void emit_store(FunctionBuilder* function_builder, Value value, Value address)
+{
+  if (address.variable >= 0) {
+    write_variable(function_builder, address.variable, function_builder->builder->GetInsertBlock(), value.value);
+    return;
+  }
+
+  if (is_atomic_type(address.type)) {
+    emit_atomic_store(function_builder, value, address, llvm::AtomicOrdering::SequentiallyConsistent);
+    return;
+  }
+
+  llvm::StoreInst* store = function_builder->builder->CreateAlignedStore(value.value, address.value, maybe_align(address.alignment));
+  add_tbaa_tag(function_builder->module_builder, store, address);
+}
+
+// allocas are always given their alignment, IRBuilder would pick the
+// preferred one of the LLVM type, which for packed structs is 1
+static llvm::Value* emit_alloca(FunctionBuilder* function_builder, Type const* type, unsigned alignment)
+{
+  llvm::AllocaInst* alloca = function_builder->builder->CreateAlloca(llvm_type(function_builder->module_builder, type));
+  alloca->setAlignment(llvm::Align(alignment));
+  return alloca;
+}
+
+static Value pop_value(FunctionBuilder* function_builder)
+{
+  assert(!function_builder->value_stack.empty() && "Codegen value stack underflow");
+  Value value = function_builder->value_stack.back();
+  function_builder->value_stack.pop_back();
+  return value;
+}
+
+static Value pop_rvalue(FunctionBuilder* function_builder) { return load_if_lvalue(function_builder, pop_value(function_builder)); }
+
+// operands are loaded left to right, even though the rhs is on top of the stack
+static void pop_binary_operands(FunctionBuilder* function_builder, Value* lhs, Value* rhs)
+{
+  Value rhs_value = pop_value(function_builder);
+  *lhs = pop_rvalue(function_builder);
+  *rhs = load_if_lvalue(function_builder, rhs_value);
+}
+
+static Value emit_binary_instruction(FunctionBuilder* function_builder, llvm::Instruction::BinaryOps opcode, Value lhs, Value rhs)
+{
+  return rvalue(lhs.type, function_builder->builder->CreateBinOp(opcode, lhs.value, rhs.value));
+}
+
+// comparisons give an i1, C wants an int, and GCC wants -1 in each element of
+// a vector comparison
+static Value emit_comparison(FunctionBuilder* function_builder, llvm::CmpInst::Predicate predicate, Value lhs, Value rhs, Type const* result_type)
+{
+  llvm::IRBuilder<>* builder = function_builder->builder;
+  llvm::Value* i1_result = builder->CreateCmp(predicate, lhs.value, rhs.value);
+  llvm::Type* type = llvm_type(function_builder->module_builder, result_type);
+
+  if (result_type->fundamental_type == FundamentalType::Vector)
+    return rvalue(result_type, builder->CreateSExt(i1_result, type));
+  return rvalue(result_type, builder->CreateZExt(i1_result, type));
+}
+
+static llvm::Instruction::CastOps conversion_opcode(FundamentalType from, FundamentalType to)
+{
+  bool from_is_float = is_floating_type(from);
+  bool to_is_float = is_floating_type(to);
+
+  if (from == FundamentalType::Pointer)
+    return llvm::Instruction::PtrToInt;
+  if (to == FundamentalType::Pointer)
+    return llvm::Instruction::IntToPtr;
+
+  if (from_is_float && to_is_float)
+    return fundamental_type_bit_width(to) > fundamental_type_bit_width(from) ? llvm::Instruction::FPExt : llvm::Instruction::FPTrunc;
+  if (from_is_float)
+    return is_unsigned_integer_type(to) ? llvm::Instruction::FPToUI : llvm::Instruction::FPToSI;
+  if (to_is_float)
+    return is_unsigned_integer_type(from) ? llvm::Instruction::UIToFP : llvm::Instruction::SIToFP;
+
+  if (fundamental_type_bit_width(to) < fundamental_type_bit_width(from))
+    return llvm::Instruction::Trunc;
+  return is_unsigned_integer_type(from) ? llvm::Instruction::ZExt : llvm::Instruction::SExt;
+}
+
+// the same conversions as emit_conversion in codegen.cpp
+static Value emit_conversion(FunctionBuilder* function_builder, Value value, Type const* to_type)
+{
+  llvm::IRBuilder<>* builder = function_builder->builder;
+  FundamentalType from = value.type->fundamental_type;
+  FundamentalType to = to_type->fundamental_type;
+
+  // pointers are opaque, and a function designator already is its address
+  if (to == FundamentalType::Pointer && (from == FundamentalType::Pointer || from == FundamentalType::Function)) {
+    value.type = to_type;
+    return value;
+  }
+
+  if (to == FundamentalType::Vector && from != FundamentalType::Vector)
+    return rvalue(to_type, builder->CreateVectorSplat(to_type->array_length, value.value));
+
+  // __builtin_convertvector converts each element
+  if (from == FundamentalType::Vector) {
+    from = value.type->pointed_type->fundamental_type;
+    to = to_type->pointed_type->fundamental_type;
+  }
+
+  // 6.3.1.2 converting to _Bool compares against 0
+  if (to == FundamentalType::Bool) {
+    llvm::Value* zero = llvm::Constant::getNullValue(value.value->getType());
+    llvm::Value* result = is_floating_type(from) ? builder->CreateFCmpUNE(value.value, zero) : builder->CreateICmpNE(value.value, zero);
+    return rvalue(to_type, result);
+  }
+
+  bool is_integer_conversion = is_integer_type(from) && is_integer_type(to);
+  bool is_floating_conversion = is_floating_type(from) && is_floating_type(to);
+  if ((is_integer_conversion || is_floating_conversion) && fundamental_type_bit_width(from) == fundamental_type_bit_width(to)) {
+    value.type = to_type;
+    return value;
+  }
+
+  llvm::Type* type = llvm_type(function_builder->module_builder, to_type);
+  return rvalue(to_type, builder->CreateCast(conversion_opcode(from, to), value.value, type));
+}
+
+static Value emit_pointer_offset(FunctionBuilder* function_builder, Value pointer, Value index, bool is_subtraction)
+{
+  llvm::IRBuilder<>* builder = function_builder->builder;
+  if (is_subtraction)
+    index.value = builder->CreateNSWNeg(index.value);
+
+  // 6.5.6p8 the result points into the same array, or one past its end
+  llvm::Type* type = llvm_type(function_builder->module_builder, element_type(pointer.type));
+  return rvalue(pointer.type, builder->CreateInBoundsGEP(type, pointer.value, index.value));
+}
+
+// 6.5.6.9 the difference of two pointers is in elements, not bytes
+static Value emit_pointer_difference(FunctionBuilder* function_builder, Value lhs, Value rhs, Type const* difference_type)
+{
+  Value lhs_address = emit_conversion(function_builder, lhs, difference_type);
+  Value rhs_address = emit_conversion(function_builder, rhs, difference_type);
+  llvm::Value* byte_difference = function_builder->builder->CreateNSWSub(lhs_address.value, rhs_address.value);
+
+  long long element_size = size_of_type(element_type(lhs.type));
+  llvm::Value* size = llvm_constant(function_builder->module_builder, difference_type, element_size);
+  return rvalue(difference_type, function_builder->builder->CreateExactSDiv(byte_difference, size));
+}
+
+// 6.5.2.3 a member is an lvalue at its byte offset from the start of its struct
+static Value emit_member_address(FunctionBuilder* function_builder, Value struct_address, Type const* struct_type, ASTNode const* access_node)
+{
+  StructLayout const* layout = struct_layout(struct_type);
+  unsigned long long offset = layout->member_offsets[access_node->member_index];
+
+  llvm::Value* address = struct_address.value;
+  if (offset) {
+    llvm::Type* byte_type = llvm::Type::getInt8Ty(*function_builder->module_builder->context);
+    llvm::Value* byte_offset = llvm_constant(function_builder->module_builder, ptrdiff_type(), (long long)offset);
+    address = function_builder->builder->CreateInBoundsGEP(byte_type, address, byte_offset);
+  }
+
+  // the member is as aligned as both the struct and its offset allow
+  unsigned known_alignment = struct_address.alignment ? struct_address.alignment : layout->alignment;
+  while (offset % known_alignment)
+    known_alignment /= 2;
+
+  Type const* member_type = access_node->expression_type;
+  Value member = lvalue(member_type, address, known_alignment != alignment_of_type(member_type) ? known_alignment : 0);
+  member.tbaa = tbaa_member_access(struct_address.is_lvalue ? struct_address.tbaa : TBAAAccess {}, struct_type, access_node->member_index);
+  return member;
+}
+
+// 6.5.2.1 a pointer is offset by the index. An array or vector in memory is
+// indexed in place, and a vector in a register has its element extracted
+static Value emit_subscript(FunctionBuilder* function_builder, Value base, Value index, Type const* subscript_type)
+{
+  llvm::IRBuilder<>* builder = function_builder->builder;
+
+  if (base.type->fundamental_type == FundamentalType::Vector && !base.is_lvalue)
+    return rvalue(subscript_type, builder->CreateExtractElement(base.value, index.value));
+
+  if (base.type->fundamental_type == FundamentalType::Pointer)
+    base = load_if_lvalue(function_builder, base);
+  else if (!base.is_lvalue)
+    error_and_stop("Subscripting an array rvalue not implemented\n");
+
+  llvm::Type* type = llvm_type(function_builder->module_builder, subscript_type);
+  return lvalue(subscript_type, builder->CreateInBoundsGEP(type, base.value, index.value), 0);
+}
+
+// the arguments were emitted left to right and sit on top of the callee
+static Value emit_call(FunctionBuilder* function_builder, ASTNode const* call_node)
+{
+  unsigned argument_count = 0;
+  for (ASTNode const* argument = call_node->rhs; argument; argument = argument->next)
+    argument_count++;
+
+  std::vector<Value>& value_stack = function_builder->value_stack;
+  assert(value_stack.size() > argument_count && "Codegen value stack underflow");
+  std::vector<Value> arguments(value_stack.end() - argument_count, value_stack.end());
+  value_stack.resize(value_stack.size() - argument_count);
+
+  // calling through a function pointer loads the pointer
+  Value callee = pop_value(function_builder);
+  Type const* function_type = callee.type;
+  if (function_type->fundamental_type == FundamentalType::Pointer) {
+    callee = load_if_lvalue(function_builder, callee);
+    function_type = function_type->pointed_type;
+  }
+
+  if (function_type->fundamental_type != FundamentalType::Function)
+    error_and_stop("Calling something that is not a function\n");
+
+  // semantic analysis already converted the arguments to the parameter types
+  std::vector<llvm::Value*> argument_values;
+  for (Value argument : arguments)
+    argument_values.push_back(load_if_lvalue(function_builder, argument).value);
+
+  FunctionData const* function_data = function_type->function_data;
+  llvm::FunctionType* llvm_function = llvm_function_type(function_builder->module_builder, function_data);
+  llvm::CallInst* result = function_builder->builder->CreateCall(llvm_function, callee.value, argument_values);
+  if (call_node->tail_call_kind == TailCallKind::MustTail)
+    result->setTailCallKind(llvm::CallInst::TCK_MustTail);
+  else if (call_node->tail_call_kind == TailCallKind::Tail && !function_builder->has_locals_in_memory)
+    result->setTailCallKind(llvm::CallInst::TCK_Tail);
+
+  FunctionAttributeNames attributes = function_attribute_names(called_function(call_node), true);
+  for (unsigned i = 0; i < attributes.count; i++)
+    result->addFnAttr(llvm::Attribute::getAttrKindFromName(attributes.names[i]));
+
+  bool returns_void = function_data->return_type->fundamental_type == FundamentalType::Void;
+  return rvalue(function_data->return_type, returns_void ? nullptr : result);
+}
+
+static llvm::CmpInst::Predicate comparison_predicate(ASTNodeType node_type, Type const* type)
+{
+  bool is_float = is_floating_type(scalar_type(type)->fundamental_type);
+  bool is_unsigned = is_unsigned_type(scalar_type(type)->fundamental_type);
+
+  switch (node_type) {
+  case ASTNodeType::LessThan:
+    return is_float ? llvm::CmpInst::FCMP_OLT : is_unsigned ? llvm::CmpInst::ICMP_ULT : llvm::CmpInst::ICMP_SLT;
+  case ASTNodeType::LessThanOrEqualTo:
+    return is_float ? llvm::CmpInst::FCMP_OLE : is_unsigned ? llvm::CmpInst::ICMP_ULE : llvm::CmpInst::ICMP_SLE;
+  case ASTNodeType::GreaterThan:
+    return is_float ? llvm::CmpInst::FCMP_OGT : is_unsigned ? llvm::CmpInst::ICMP_UGT : llvm::CmpInst::ICMP_SGT;
+  case ASTNodeType::GreaterThanOrEqualTo:
+    return is_float ? llvm::CmpInst::FCMP_OGE : is_unsigned ? llvm::CmpInst::ICMP_UGE : llvm::CmpInst::ICMP_SGE;
+  case ASTNodeType::EqualityComparison:
+    return is_float ? llvm::CmpInst::FCMP_OEQ : llvm::CmpInst::ICMP_EQ;
+  case ASTNodeType::InequalityComparison:
+    return is_float ? llvm::CmpInst::FCMP_UNE : llvm::CmpInst::ICMP_NE;
+  default:
+    assert(false && "Not a comparison");
+    return llvm::CmpInst::BAD_ICMP_PREDICATE;
+  }
+}
+
+static llvm::Instruction::BinaryOps arithmetic_opcode(ASTNodeType node_type, Type const* type)
+{
+  bool is_float = is_floating_type(scalar_type(type)->fundamental_type);
+  bool is_unsigned = is_unsigned_type(scalar_type(type)->fundamental_type);
+
+  switch (node_type) {
+  case ASTNodeType::Multiplication:
+    return is_float ? llvm::Instruction::FMul : llvm::Instruction::Mul;
+  case ASTNodeType::Division:
+    return is_float ? llvm::Instruction::FDiv : is_unsigned ? llvm::Instruction::UDiv : llvm::Instruction::SDiv;
+  case ASTNodeType::Modulo:
+    return is_unsigned ? llvm::Instruction::URem : llvm::Instruction::SRem;
+  case ASTNodeType::Addition:
+    return is_float ? llvm::Instruction::FAdd : llvm::Instruction::Add;
+  case ASTNodeType::Subtraction:
+    return is_float ? llvm::Instruction::FSub : llvm::Instruction::Sub;
+  case ASTNodeType::BitShiftLeft:
+    return llvm::Instruction::Shl;
+  case ASTNodeType::BitShiftRight:
+    return is_unsigned ? llvm::Instruction::LShr : llvm::Instruction::AShr;
+  case ASTNodeType::BitwiseAnd:
+    return llvm::Instruction::And;
+  case ASTNodeType::BitwiseXor:
+    return llvm::Instruction::Xor;
+  case ASTNodeType::BitwiseOr:
+    return llvm::Instruction::Or;
+  default:
+    assert(false && "Not an arithmetic operator");
+    return llvm::Instruction::BinaryOpsEnd;
+  }
+}
+
+// see has_no_signed_wrap, the read-modify-writes of atomics wrap. The builder
+// folds constant operands, and a folded constant has no flags
+static Value emit_arithmetic(FunctionBuilder* function_builder, ASTNodeType operator_type, Value lhs, Value rhs, bool is_atomic)
+{
+  Value result = emit_binary_instruction(function_builder, arithmetic_opcode(operator_type, lhs.type), lhs, rhs);
+  if (!is_atomic && has_no_signed_wrap(operator_type, lhs.type))
+    if (auto* instruction = llvm::dyn_cast<llvm::BinaryOperator>(result.value))
+      instruction->setHasNoSignedWrap(true);
+  return result;
+}
+
+// 6.5.16.2 the new value of E1 in E1 op= E2
+static Value emit_compound_operation(
+    FunctionBuilder* function_builder, ASTNodeType operator_type, Value old_value, Value rhs, Type const* result_type, bool is_atomic)
+{
+  if (old_value.type->fundamental_type == FundamentalType::Pointer) {
+    Value new_value = emit_pointer_offset(function_builder, old_value, rhs, operator_type == ASTNodeType::Subtraction);
+    new_value.type = result_type;
+    return new_value;
+  }
+
+  Value lhs = emit_conversion(function_builder, old_value, rhs.type);
+  Value result = emit_arithmetic(function_builder, operator_type, lhs, rhs, is_atomic);
+  return emit_conversion(function_builder, result, result_type);
+}
+
+// the atomicrmw operation that does E1 op= E2 in one instruction, if any, see
+// atomicrmw_operation in codegen.cpp
+static bool atomicrmw_operation(ASTNodeType operator_type, Type const* result_type, Type const* operation_type, llvm::AtomicRMWInst::BinOp* operation)
+{
+  FundamentalType t = result_type->fundamental_type;
+
+  if (is_integer_type(t) && t != FundamentalType::Bool && is_integer_type(operation_type->fundamental_type)) {
+    switch (operator_type) {
+    case ASTNodeType::Addition:
+      *operation = llvm::AtomicRMWInst::Add;
+      return true;
+    case ASTNodeType::Subtraction:
+      *operation = llvm::AtomicRMWInst::Sub;
+      return true;
+    case ASTNodeType::BitwiseAnd:
+      *operation = llvm::AtomicRMWInst::And;
+      return true;
+    case ASTNodeType::BitwiseOr:
+      *operation = llvm::AtomicRMWInst::Or;
+      return true;
+    case ASTNodeType::BitwiseXor:
+      *operation = llvm::AtomicRMWInst::Xor;
+      return true;
+    default:
+      return false;
+    }
+  }
+
+  if (is_floating_type(t) && operation_type == result_type && (operator_type == ASTNodeType::Addition || operator_type == ASTNodeType::Subtraction)) {
+    *operation = operator_type == ASTNodeType::Addition ? llvm::AtomicRMWInst::FAdd : llvm::AtomicRMWInst::FSub;
+    return true;
+  }
+
+  return false;
+}
+
+// 6.5.16.2 one atomic read-modify-write, or a cmpxchg retry loop
+static Value emit_atomic_compound_assignment(FunctionBuilder* function_builder, ASTNodeType operator_type, Value address, Value rhs, Type const* result_type)
+{
+  llvm::IRBuilder<>* builder = function_builder->builder;
+
+  llvm::AtomicRMWInst::BinOp operation;
+  if (atomicrmw_operation(operator_type, result_type, rhs.type, &operation)) {
+    Value operand = emit_conversion(function_builder, rhs, result_type);
+    Value old_value = emit_atomicrmw(function_builder, operation, address, operand, llvm::AtomicOrdering::SequentiallyConsistent);
+    return emit_arithmetic(function_builder, operator_type, old_value, operand, true);
+  }
+
+  llvm::BasicBlock* retry = new_block(function_builder, "atomic.retry");
+  llvm::BasicBlock* done = new_block(function_builder, "atomic.done");
+  builder->CreateBr(retry);
+  builder->SetInsertPoint(retry);
+  function_builder->unsealed_blocks.insert(retry);
+
+  Value old_value = emit_atomic_load(function_builder, address, llvm::AtomicOrdering::Monotonic);
+  Value new_value = emit_compound_operation(function_builder, operator_type, old_value, rhs, result_type, true);
+
+  Value found;
+  Value success = emit_cmpxchg(function_builder, true, address, old_value, new_value, llvm::AtomicOrdering::SequentiallyConsistent,
+      llvm::AtomicOrdering::Monotonic, &found);
+  builder->CreateCondBr(success.value, done, retry);
+  seal_block(function_builder, retry);
+  builder->SetInsertPoint(done);
+  return new_value;
+}
+
+static Value emit_compound_assignment(FunctionBuilder* function_builder, ASTNode const* assignment_node, Value lhs, Value rhs)
+{
+  ASTNodeType operator_type = compound_assignment_operator(assignment_node->type);
+  if (is_atomic_type(lhs.type))
+    return emit_atomic_compound_assignment(function_builder, operator_type, lhs, rhs, assignment_node->expression_type);
+
+  Value old_value = load_if_lvalue(function_builder, lhs);
+  Value new_value = emit_compound_operation(function_builder, operator_type, old_value, rhs, assignment_node->expression_type, false);
+  emit_store(function_builder, new_value, lhs);
+  return new_value;
+}
+
+// the arguments of an atomic operation, in order, left on the value stack
+static std::vector<Value> pop_arguments(FunctionBuilder* function_builder, ASTNode const* first_argument)
+{
+  size_t argument_count = 0;
+  for (ASTNode const* argument = first_argument; argument; argument = argument->next)
+    argument_count++;
+
+  std::vector<Value> arguments(argument_count);
+  for (size_t i = argument_count; i-- > 0;)
+    arguments[i] = pop_value(function_builder);
+  for (Value& argument : arguments)
+    argument = load_if_lvalue(function_builder, argument);
+  return arguments;
+}
+
+// 7.17.7.4 a failed compare exchange writes the value it found to *expected
+static Value emit_atomic_compare_exchange(FunctionBuilder* function_builder, ASTNode const* atomic_node, Value address, std::vector<Value> const& arguments)
+{
+  llvm::IRBuilder<>* builder = function_builder->builder;
+
+  Value expected_address = lvalue(non_atomic_type(address.type), arguments[1].value, 0);
+  Value expected = load_if_lvalue(function_builder, expected_address);
+
+  Value found;
+  Value success = emit_cmpxchg(function_builder, atomic_node->type == ASTNodeType::AtomicCompareExchangeWeak, address, expected, arguments[2],
+      memory_order(arguments[3]), memory_order(arguments[4]), &found);
+
+  llvm::BasicBlock* failure = new_block(function_builder, "atomic.failure");
+  llvm::BasicBlock* next = new_block(function_builder, "atomic.continue");
+  builder->CreateCondBr(success.value, next, failure);
+
+  builder->SetInsertPoint(failure);
+  expected_address.type = found.type;
+  emit_store(function_builder, found, expected_address);
+  builder->CreateBr(next);
+
+  builder->SetInsertPoint(next);
+  return success;
+}
+
+// 7.17.7 the atomic generic functions
+static Value emit_atomic_operation(FunctionBuilder* function_builder, ASTNode const* atomic_node)
+{
+  std::vector<Value> arguments = pop_arguments(function_builder, atomic_node->rhs);
+
+  if (atomic_node->type == ASTNodeType::AtomicThreadFence) {
+    // a relaxed fence orders nothing
+    llvm::ConstantInt const* order = as_constant_int(arguments[0]);
+    if (!order || order->getSExtValue() != (long long)MemoryOrder::Relaxed)
+      function_builder->builder->CreateFence(memory_order(arguments[0]));
+    return rvalue(VoidType, nullptr);
+  }
+
+  // the pointer's value is the atomic object
+  Value address = lvalue(arguments[0].type->pointed_type, arguments[0].value, 0);
+  Type const* value_type = non_atomic_type(address.type);
+
+  switch (atomic_node->type) {
+  case ASTNodeType::AtomicLoad:
+    return emit_atomic_load(function_builder, address, memory_order(arguments[1]));
+
+  case ASTNodeType::AtomicStore:
+    emit_atomic_store(function_builder, arguments[1], address, memory_order(arguments[2]));
+    return rvalue(VoidType, nullptr);
+
+  case ASTNodeType::AtomicExchange:
+    return emit_atomicrmw(function_builder, llvm::AtomicRMWInst::Xchg, address, arguments[1], memory_order(arguments[2]));
+
+  case ASTNodeType::AtomicCompareExchangeStrong:
+  case ASTNodeType::AtomicCompareExchangeWeak:
+    return emit_atomic_compare_exchange(function_builder, atomic_node, address, arguments);
+
+  default:
+    break;
+  }
+
+  llvm::AtomicRMWInst::BinOp operation = llvm::AtomicRMWInst::BAD_BINOP;
+  switch (atomic_node->type) {
+  case ASTNodeType::AtomicFetchAdd:
+    operation = llvm::AtomicRMWInst::Add;
+    break;
+  case ASTNodeType::AtomicFetchSub:
+    operation = llvm::AtomicRMWInst::Sub;
+    break;
+  case ASTNodeType::AtomicFetchAnd:
+    operation = llvm::AtomicRMWInst::And;
+    break;
+  case ASTNodeType::AtomicFetchOr:
+    operation = llvm::AtomicRMWInst::Or;
+    break;
+  case ASTNodeType::AtomicFetchXor:
+    operation = llvm::AtomicRMWInst::Xor;
+    break;
+  default:
+    assert(false && "Not an atomic operation");
+  }
+
+  if (value_type->fundamental_type != FundamentalType::Pointer)
+    return emit_atomicrmw(function_builder, operation, address, arguments[1], memory_order(arguments[2]));
+
+  // atomicrmw can't add to a pointer, but it can add the offset in bytes to
+  // the address as an integer as wide as it
+  Value offset = arguments[1];
+  long long element_size = size_of_type(element_type(value_type));
+  if (element_size != 1)
+    offset.value = function_builder->builder->CreateMul(offset.value, llvm_constant(function_builder->module_builder, offset.type, element_size));
+
+  Value old_address = emit_atomicrmw(function_builder, operation, address, offset, memory_order(arguments[2]));
+  return emit_conversion(function_builder, old_address, value_type);
+}
+
+static llvm::GlobalValue* global_for_object(ModuleBuilder*, Object const*);
+
+// visited in post order, so every child has already left its value on the
+// value stack by the time its parent is emitted
+static void emit_code_from_node(ASTNode const* ast_node, void* function_builder_pointer)
+{
+  FunctionBuilder* function_builder = (FunctionBuilder*)function_builder_pointer;
+  ModuleBuilder* module_builder = function_builder->module_builder;
+  llvm::IRBuilder<>* builder = function_builder->builder;
+  std::vector<Value>& value_stack = function_builder->value_stack;
+
+  start_block_if_terminated(function_builder);
+
+  switch (ast_node->type) {
+
+  case ASTNodeType::Void:
+    return;
+
+  case ASTNodeType::NumericConstant:
+    value_stack.push_back(constant_value(function_builder, ast_node->expression_type, numeric_constant_value(ast_node)));
+    return;
+
+  case ASTNodeType::ImplicitConversion:
+  case ASTNodeType::ConvertVector:
+    value_stack.push_back(emit_conversion(function_builder, pop_rvalue(function_builder), ast_node->expression_type));
+    return;
+
+  case ASTNodeType::VariableReference: {
+    Object const* object = ast_node->object;
+    assert(object && "Emitting code for a variable reference that was never resolved");
+
+    // a function designates the function itself
+    if (object->local_slot < 0) {
+      llvm::GlobalValue* global = global_for_object(module_builder, object);
+      if (object->type->fundamental_type == FundamentalType::Function)
+        value_stack.push_back(rvalue(object->type, global));
+      else
+        value_stack.push_back(lvalue(object->type, global, stricter_alignment(object->type, declared_alignment(object))));
+      return;
+    }
+
+    LocalVariable const& local_variable = function_builder->local_variables[object->local_slot];
+    if (is_promoted_local(object)) {
+      Value variable = lvalue(local_variable.type, nullptr, 0);
+      variable.variable = object->local_slot;
+      value_stack.push_back(variable);
+      return;
+    }
+
+    value_stack.push_back(lvalue(local_variable.type, local_variable.address, local_variable.alignment));
+    return;
+  }
+
+  case ASTNodeType::FunctionCall:
+    value_stack.push_back(emit_call(function_builder, ast_node));
+    return;
+
+  case ASTNodeType::MemberAccess: {
+    Value struct_value = pop_value(function_builder);
+    if (!struct_value.is_lvalue)
+      error_and_stop("Accessing a member of a struct rvalue not implemented\n");
+    value_stack.push_back(emit_member_address(function_builder, struct_value, struct_value.type, ast_node));
+    return;
+  }
+
+  case ASTNodeType::PointerMemberAccess: {
+    Value pointer = pop_rvalue(function_builder);
+    pointer.alignment = 0;
+    value_stack.push_back(emit_member_address(function_builder, pointer, pointer.type->pointed_type, ast_node));
+    return;
+  }
+
+  case ASTNodeType::Subscript: {
+    Value index = pop_rvalue(function_builder);
+    value_stack.push_back(emit_subscript(function_builder, pop_value(function_builder), index, ast_node->expression_type));
+    return;
+  }
+
+  case ASTNodeType::ShuffleVector: {
+    Value lhs, rhs;
+    pop_binary_operands(function_builder, &lhs, &rhs);
+    value_stack.push_back(rvalue(ast_node->expression_type, builder->CreateShuffleVector(lhs.value, rhs.value, ast_node->shuffle_mask)));
+    return;
+  }
+
+  case ASTNodeType::Declaration: {
+    Object* current_object = ast_node->object;
+    assert(current_object && "Emitting code for declaration with null object");
+
+    // block scope extern and function declarations only introduce a name
+    if (current_object->local_slot < 0) {
+      if (current_object->declaration_specifiers.flags & TypeModifierFlag::Static)
+        error_and_stop("Block scope static variables not implemented\n");
+      return;
+    }
+
+    // the initializer was emitted first, as the declaration's child
+    Value initial_value;
+    if (ast_node->rhs)
+      initial_value = pop_rvalue(function_builder);
+
+    if (is_promoted_local(current_object)) {
+      function_builder->local_variables[current_object->local_slot] = { nullptr, current_object->type, 0 };
+      if (ast_node->rhs)
+        write_variable(function_builder, current_object->local_slot, builder->GetInsertBlock(), initial_value.value);
+      return;
+    }
+
+    unsigned alignment = allocation_alignment(current_object, *module_builder->options);
+    llvm::Value* address = emit_alloca(function_builder, current_object->type, alignment);
+    function_builder->local_variables[current_object->local_slot]
+        = { address, current_object->type, stricter_alignment(current_object->type, alignment) };
+
+    // 7.17.2.1 initializing an atomic object is not an atomic operation
+    if (ast_node->rhs) {
+      Type const* type = non_atomic_type(current_object->type);
+      emit_store(function_builder, initial_value, lvalue(type, address, stricter_alignment(type, alignment)));
+    }
+    return;
+  }
+
+  case ASTNodeType::Return:
+    if (ast_node->rhs)
+      builder->CreateRet(pop_rvalue(function_builder).value);
+    else
+      builder->CreateRetVoid();
+    return;
+
+  case ASTNodeType::Addition:
+  case ASTNodeType::Subtraction: {
+    Value lhs, rhs;
+    pop_binary_operands(function_builder, &lhs, &rhs);
+    bool is_subtraction = ast_node->type == ASTNodeType::Subtraction;
+
+    if (lhs.type->fundamental_type == FundamentalType::Pointer && rhs.type->fundamental_type == FundamentalType::Pointer)
+      value_stack.push_back(emit_pointer_difference(function_builder, lhs, rhs, ast_node->expression_type));
+    else if (lhs.type->fundamental_type == FundamentalType::Pointer)
+      value_stack.push_back(emit_pointer_offset(function_builder, lhs, rhs, is_subtraction));
+    else if (rhs.type->fundamental_type == FundamentalType::Pointer)
+      value_stack.push_back(emit_pointer_offset(function_builder, rhs, lhs, false));
+    else
+      value_stack.push_back(emit_arithmetic(function_builder, ast_node->type, lhs, rhs, false));
+    return;
+  }
+
+  case ASTNodeType::Multiplication:
+  case ASTNodeType::Division:
+  case ASTNodeType::Modulo:
+  case ASTNodeType::BitShiftLeft:
+  case ASTNodeType::BitShiftRight:
+  case ASTNodeType::BitwiseAnd:
+  case ASTNodeType::BitwiseXor:
+  case ASTNodeType::BitwiseOr: {
+    Value lhs, rhs;
+    pop_binary_operands(function_builder, &lhs, &rhs);
+
+    // shifts only promote their rhs, LLVM wants it the width of the lhs
+    if (rhs.type != lhs.type)
+      rhs = emit_conversion(function_builder, rhs, lhs.type);
+
+    value_stack.push_back(emit_arithmetic(function_builder, ast_node->type, lhs, rhs, false));
+    return;
+  }
+
+  case ASTNodeType::GreaterThan:
+  case ASTNodeType::GreaterThanOrEqualTo:
+  case ASTNodeType::LessThan:
+  case ASTNodeType::LessThanOrEqualTo:
+  case ASTNodeType::EqualityComparison:
+  case ASTNodeType::InequalityComparison: {
+    Value lhs, rhs;
+    pop_binary_operands(function_builder, &lhs, &rhs);
+    value_stack.push_back(emit_comparison(function_builder, comparison_predicate(ast_node->type, lhs.type), lhs, rhs, ast_node->expression_type));
+    return;
+  }
+
+  case ASTNodeType::Assignment: {
+    Value rhs = pop_rvalue(function_builder);
+    Value lhs = pop_value(function_builder);
+    if (!lhs.is_lvalue)
+      error_and_stop("Assigning to something that is not an lvalue\n");
+
+    emit_store(function_builder, rhs, lhs);
+    value_stack.push_back(rhs);
+    return;
+  }
+
+  case ASTNodeType::MultiplicationAssignment:
+  case ASTNodeType::DivisionAssignment:
+  case ASTNodeType::ModuloAssignment:
+  case ASTNodeType::AdditionAssignment:
+  case ASTNodeType::SubtractionAssignment:
+  case ASTNodeType::BitShiftLeftAssignment:
+  case ASTNodeType::BitShiftRightAssignment:
+  case ASTNodeType::BitwiseAndAssignment:
+  case ASTNodeType::BitwiseXorAssignment:
+  case ASTNodeType::BitwiseOrAssignment: {
+    Value rhs = pop_rvalue(function_builder);
+    Value lhs = pop_value(function_builder);
+    if (!lhs.is_lvalue)
+      error_and_stop("Assigning to something that is not an lvalue\n");
+
+    value_stack.push_back(emit_compound_assignment(function_builder, ast_node, lhs, rhs));
+    return;
+  }
+
+  case ASTNodeType::AtomicLoad:
+  case ASTNodeType::AtomicStore:
+  case ASTNodeType::AtomicExchange:
+  case ASTNodeType::AtomicCompareExchangeStrong:
+  case ASTNodeType::AtomicCompareExchangeWeak:
+  case ASTNodeType::AtomicFetchAdd:
+  case ASTNodeType::AtomicFetchSub:
+  case ASTNodeType::AtomicFetchAnd:
+  case ASTNodeType::AtomicFetchOr:
+  case ASTNodeType::AtomicFetchXor:
+  case ASTNodeType::AtomicThreadFence:
+    value_stack.push_back(emit_atomic_operation(function_builder, ast_node));
+    return;
+
+  case ASTNodeType::Negation: {
+    Value operand = pop_rvalue(function_builder);
+    if (is_floating_type(scalar_type(operand.type)->fundamental_type))
+      value_stack.push_back(rvalue(operand.type, builder->CreateFNeg(operand.value)));
+    else
+      value_stack.push_back(rvalue(operand.type, builder->CreateNeg(operand.value, "", false, has_no_signed_wrap(ASTNodeType::Subtraction, operand.type))));
+    return;
+  }
+
+  case ASTNodeType::BitwiseNot: {
+    Value operand = pop_rvalue(function_builder);
+    value_stack.push_back(rvalue(operand.type, builder->CreateNot(operand.value)));
+    return;
+  }
+
+  case ASTNodeType::LogicalNot: {
+    Value operand = pop_rvalue(function_builder);
+    llvm::CmpInst::Predicate predicate = is_floating_type(operand.type->fundamental_type) ? llvm::CmpInst::FCMP_OEQ : llvm::CmpInst::ICMP_EQ;
+    value_stack.push_back(emit_comparison(function_builder, predicate, operand, constant_value(function_builder, operand.type, 0), IntType));
+    return;
+  }
+
+  case ASTNodeType::AddressOf: {
+    // a function designator's address is the function itself
+    Value operand = pop_value(function_builder);
+    if (!operand.is_lvalue && operand.type->fundamental_type != FundamentalType::Function)
+      error_and_stop("Taking the address of something that is not an lvalue\n");
+
+    value_stack.push_back(rvalue(ast_node->expression_type, operand.value));
+    return;
+  }
+
+  case ASTNodeType::Dereference: {
+    Value operand = pop_rvalue(function_builder);
+    if (operand.type->fundamental_type != FundamentalType::Pointer)
+      error_and_stop("Dereferencing something that is not a pointer\n");
+
+    // the pointer's value is the lvalue
+    value_stack.push_back(lvalue(ast_node->expression_type, operand.value, 0));
+    return;
+  }
+
+  case ASTNodeType::LogicalAnd:
+  case ASTNodeType::LogicalOr:
+  case ASTNodeType::ConditionalExpression:
+  case ASTNodeType::If:
+  case ASTNodeType::Switch:
+  case ASTNodeType::For:
+  case ASTNodeType::While:
+  case ASTNodeType::DoWhile:
+    assert(false && "emitting code not implemented");
+  }
+}
+
+// falling off the end of a function: fine for void, main returns 0, and
+// anything else that uses the value has undefined behavior
+static void emit_implicit_return(FunctionBuilder* function_builder, Object const* function_object)
+{
+  llvm::IRBuilder<>* builder = function_builder->builder;
+  if (builder->GetInsertBlock()->getTerminator())
+    return;
+
+  if (function_builder->return_type->fundamental_type == FundamentalType::Void)
+    builder->CreateRetVoid();
+  else if (function_object->identifier == "main")
+    builder->CreateRet(llvm_constant(function_builder->module_builder, function_builder->return_type, 0));
+  else
+    builder->CreateUnreachable();
+}
+
+// see parameter_attributes, printed by function_definition_signature in
+// codegen.cpp
+static void add_parameter_attributes(llvm::Argument* argument, ParameterAttributes const& attributes)
+{
+  if (attributes.is_noalias)
+    argument->addAttr(llvm::Attribute::NoAlias);
+  if (attributes.is_readonly)
+    argument->addAttr(llvm::Attribute::ReadOnly);
+  if (attributes.is_nonnull)
+    argument->addAttr(llvm::Attribute::NonNull);
+  if (attributes.alignment)
+    argument->addAttr(llvm::Attribute::getWithAlignment(argument->getContext(), llvm::Align(attributes.alignment)));
+  if (attributes.dereferenceable_bytes)
+    argument->addAttr(llvm::Attribute::getWithDereferenceableBytes(argument->getContext(), attributes.dereferenceable_bytes));
+}
+
+static void emit_function_body(ModuleBuilder* module_builder, Object const* function_object)
+{
+  FunctionData const* function_data = function_object->type->function_data;
+  llvm::Function* function = llvm::cast<llvm::Function>(global_for_object(module_builder, function_object));
+
+  llvm::IRBuilder<> builder(llvm::BasicBlock::Create(*module_builder->context, "entry", function));
+
+  FunctionBuilder function_builder;
+  function_builder.module_builder = module_builder;
+  function_builder.builder = &builder;
+  function_builder.function = function;
+  function_builder.return_type = function_data->return_type;
+  function_builder.has_locals_in_memory = has_locals_in_memory(function_object);
+  function_builder.local_variables.resize(function_object->local_count);
+
+  // parameters take the first slots, in order, each in a stack slot so that
+  // it can be assigned to and have its address taken like any other local,
+  // unless it is promoted
+  unsigned parameter_index = 0;
+  for (FunctionParameter const* current_param = function_data->parameter_list; current_param; current_param = current_param->next_parameter) {
+    if (function_object->parameter_identifiers[parameter_index].empty())
+      error_and_stop("Function definition parameters must have identifiers");
+
+    Type const* parameter_type = current_param->parameter_type;
+    add_parameter_attributes(function->getArg(parameter_index), parameter_attributes(function_object, parameter_index, parameter_type));
+
+    if (is_promoted_local(function_object->parameter_objects[parameter_index])) {
+      function_builder.local_variables[parameter_index] = { nullptr, parameter_type, 0 };
+      write_variable(&function_builder, (int)parameter_index, builder.GetInsertBlock(), function->getArg(parameter_index));
+      parameter_index++;
+      continue;
+    }
+
+    llvm::Value* address = emit_alloca(&function_builder, parameter_type, alignment_of_type(parameter_type));
+    emit_store(&function_builder, rvalue(parameter_type, function->getArg(parameter_index)), lvalue(non_atomic_type(parameter_type), address, 0));
+    function_builder.local_variables[parameter_index++] = { address, parameter_type, 0 };
+  }
+
+  // each statement is walked on its own, whatever value an expression
+  // statement leaves behind is dropped before the next one
+  for (ASTNode const* current_ast_node = function_object->function_body; current_ast_node; current_ast_node = current_ast_node->next) {
+    walk_ast_post_order(current_ast_node, emit_code_from_node, &function_builder);
+    function_builder.value_stack.clear();
+  }
+
+  emit_implicit_return(&function_builder, function_object);
+
+  for (auto& [phi, replacement] : function_builder.removed_phis) {
+    phi->replaceAllUsesWith(replacement);
+    phi->eraseFromParent();
+  }
+}
+
+static llvm::GlobalValue::ThreadLocalMode thread_local_mode(Object const* object, bool is_definition, CodegenOptions const& options)
+{
+  switch (thread_local_model(object, is_definition, options)) {
+  case ThreadLocalModel::None:
+    return llvm::GlobalValue::NotThreadLocal;
+  case ThreadLocalModel::GeneralDynamic:
+    return llvm::GlobalValue::GeneralDynamicTLSModel;
+  case ThreadLocalModel::LocalDynamic:
+    return llvm::GlobalValue::LocalDynamicTLSModel;
+  case ThreadLocalModel::InitialExec:
+    return llvm::GlobalValue::InitialExecTLSModel;
+  case ThreadLocalModel::LocalExec:
+    return llvm::GlobalValue::LocalExecTLSModel;
+  }
+  return llvm::GlobalValue::NotThreadLocal;
+}
+
+static llvm::GlobalValue::LinkageTypes linkage(Object const* object)
+{
+  bool is_static = object->declaration_specifiers.flags & TypeModifierFlag::Static;
+  return is_static ? llvm::GlobalValue::InternalLinkage : llvm::GlobalValue::ExternalLinkage;
+}
+
+// functions and objects are created before any code refers to them, with
+// their definitions filled in afterwards. An object only declared at block
+// scope gets its external declaration the first time it is used
+static llvm::GlobalValue* global_for_object(ModuleBuilder* module_builder, Object const* object)
+{
+  auto entry = module_builder->globals.find(object);
+  if (entry != module_builder->globals.end())
+    return entry->second;
+
+  llvm::GlobalValue* global;
+  if (object->type->fundamental_type == FundamentalType::Function) {
+    llvm::FunctionType* function_type = llvm_function_type(module_builder, object->type->function_data);
+    llvm::Function* function = llvm::Function::Create(function_type, linkage(object), object->identifier, module_builder->module);
+    FunctionAttributeNames attributes = function_attribute_names(object, false);
+    for (unsigned i = 0; i < attributes.count; i++)
+      function->addFnAttr(llvm::Attribute::getAttrKindFromName(attributes.names[i]));
+    global = function;
+  } else {
+    llvm::GlobalValue::ThreadLocalMode mode = thread_local_mode(object, false, *module_builder->options);
+    llvm::GlobalVariable* variable = new llvm::GlobalVariable(*module_builder->module, llvm_type(module_builder, object->type), false,
+        llvm::GlobalValue::ExternalLinkage, nullptr, object->identifier, nullptr, mode);
+    variable->setAlignment(maybe_align(stricter_alignment(object->type, declared_alignment(object))));
+    global = variable;
+  }
+
+  module_builder->globals.emplace(object, global);
+  return global;
+}
+
+// objects without an initializer are zero initialized (tentative definitions)
+// and extern declarations without any definition are external
+static void define_global_variable(ModuleBuilder* module_builder, ASTNode const* declaration_node)
+{
+  Object const* object = declaration_node->object;
+  int flags = object->declaration_specifiers.flags;
+  llvm::Type* type = llvm_type(module_builder, object->type);
+
+  llvm::GlobalVariable* variable = llvm::cast<llvm::GlobalVariable>(global_for_object(module_builder, object));
+  if ((flags & TypeModifierFlag::Extern) && !declaration_node->rhs)
+    return;
+
+  // FIXME: initializer lists
+  llvm::Constant* initializer;
+  if (is_scalar_type(object->type->fundamental_type) || object->type->fundamental_type == FundamentalType::Bool) {
+    long long initial_value = declaration_node->rhs ? static_initializer_value(declaration_node->rhs) : 0;
+    initializer = llvm_constant(module_builder, object->type, initial_value);
+  } else {
+    if (declaration_node->rhs)
+      error_and_stop("Initializers for static structs, unions, arrays and vectors not implemented\n");
+    initializer = llvm::Constant::getNullValue(type);
+  }
+
+  variable->setInitializer(initializer);
+  variable->setLinkage(linkage(object));
+  variable->setThreadLocalMode(thread_local_mode(object, true, *module_builder->options));
+  variable->setAlignment(llvm::MaybeAlign(allocation_alignment(object, *module_builder->options)));
+}
+
+// only the canonical declaration of each identifier is emitted, see
+// name_resolution.cpp
+static bool is_emitted(Object const* object) { return object->is_canonical && !(object->declaration_specifiers.flags & TypeModifierFlag::TypeDef); }
+
+std::unique_ptr<llvm::Module> build_llvm_module(
+    ExternalDeclaration const* external_declaration, llvm::LLVMContext& context, CodegenOptions const& options, std::unordered_set<Object const*> const* functions)
+{
+#if LLVM_VERSION_MAJOR < 15
+  context.enableOpaquePointers();
+#endif
+
+  // IRBuilder takes default alignments from the datalayout, so it comes first
+  auto module = std::make_unique<llvm::Module>("", context);
+  module->setDataLayout(current_target->datalayout);
+  module->setTargetTriple(current_target->triple);
+  if (options.pic_level)
+    module->setPICLevel(options.pic_level == 1 ? llvm::PICLevel::SmallPIC : llvm::PICLevel::BigPIC);
+
+  ModuleBuilder module_builder;
+  module_builder.context = &context;
+  module_builder.module = module.get();
+  module_builder.options = &options;
+
+  // every global and function exists before the first body refers to it, in
+  // the order they are declared
+  for (ExternalDeclaration const* declaration = external_declaration; declaration; declaration = declaration->next)
+    for (ASTNode const* declaration_node = declaration->root_ast_node; declaration_node; declaration_node = declaration_node->next)
+      if (is_emitted(declaration_node->object))
+        global_for_object(&module_builder, declaration_node->object);
+
+  for (ExternalDeclaration const* declaration = external_declaration; declaration; declaration = declaration->next) {
+    if (declaration->type == ExternalDeclarationType::FunctionDefinition) {
+      if (!functions || functions->count(declaration->root_ast_node->object))
+        emit_function_body(&module_builder, declaration->root_ast_node->object);
+      continue;
+    }
+
+    for (ASTNode const* declaration_node = declaration->root_ast_node; declaration_node; declaration_node = declaration_node->next)
+      if (!functions && is_emitted(declaration_node->object) && declaration_node->object->type->fundamental_type != FundamentalType::Function)
+        define_global_variable(&module_builder, declaration_node);
+  }
+
+  // static functions left out are defined next to the module, not in it, and
+  // a declaration can't be internal
+  if (functions)
+    for (llvm::Function& function : *module)
+      if (function.isDeclaration())
+        function.setLinkage(llvm::GlobalValue::ExternalLinkage);
+
+  assert(!llvm::verifyModule(*module, &llvm::errs()) && "Codegen built an invalid module");
+  return module;
+}
+
+void write_bitcode(llvm::Module const& module, FILE* outfile)
+{
+  fflush(outfile);
+  llvm::raw_fd_ostream stream(fileno(outfile), false);
+  llvm::WriteBitcodeToFile(module, stream);
+}
+
+void write_textual_ir(llvm::Module const& module, FILE* outfile)
+{
+  fflush(outfile);
+  llvm::raw_fd_ostream stream(fileno(outfile), false);
+  module.print(stream, nullptr);
+}
+
+void emit_bitcode_from_translation_unit(ExternalDeclaration const* external_declaration, FILE* outfile, CodegenOptions const& options)
+{
+  llvm::LLVMContext context;
+  std::unique_ptr<llvm::Module> module = build_llvm_module(external_declaration, context, options);
+  write_bitcode(*module, outfile);
+}
@@ -1,8 +1,24 @@
 #include "codegen.h"
+#include "jit.h"
+#include "layout.h"
+#include "llvm_codegen.h"
+#include "mir.h"
+#include "name_resolution.h"
+#include "native_codegen.h"
+#include "optimizer.h"
 #include "parser.h"
+#include "semantic_analysis.h"
+#include "target.h"
+#include "target_machine.h"
+#include "thread_pool.h"
+
+#include <llvm/Support/Timer.h>
+
+#include <chrono>
 
 #include <cstdlib>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 
 // from crafting interpreters, ch 16
@@ -33,26 +49,330 @@ static char* read_file(char const* path)
   return buffer;
 }
 
+// what a translation unit is written out as
+enum class EmitKind {
+  // textual IR, printed by codegen.cpp
+  LLVM,
+  // bitcode, from the module llvm_codegen.cpp builds
+  Bitcode,
+  // -c, that module compiled to a native object file
+  Object,
+  // assembly from the native backend, which writes an object itself with -c
+  Assembly,
+};
+
+static char const* output_extension(EmitKind emit_kind)
+{
+  switch (emit_kind) {
+  case EmitKind::LLVM:
+    return ".ll";
+  case EmitKind::Bitcode:
+    return ".bc";
+  case EmitKind::Object:
+    return ".o";
+  case EmitKind::Assembly:
+    return ".s";
+  }
+  return "";
+}
+
+// foo.c is written to foo.ll, foo.bc, foo.o or foo.s
+static std::string output_path(char const* source_path, EmitKind emit_kind)
+{
+  std::string outfile_name;
+  for (char const* s = source_path; *s != '.' && *s != '\0'; s++)
+    outfile_name.push_back(*s);
+  return outfile_name + output_extension(emit_kind);
+}
+
+static FILE* open_output(char const* source_path, EmitKind emit_kind)
+{
+  bool is_text = emit_kind == EmitKind::LLVM || emit_kind == EmitKind::Assembly;
+  return fopen(output_path(source_path, emit_kind).c_str(), is_text ? "w" : "wb");
+}
+
 int main(int argc, char** argv)
 {
+  auto start = std::chrono::steady_clock::now();
+
+  unsigned thread_count = default_thread_count();
+  bool report_padding = false;
+  bool reorder_structs = false;
+  CodegenOptions codegen_options;
+  codegen_options.thread_count = thread_count;
+  EmitKind emit_kind = EmitKind::LLVM;
+  OptimizationOptions optimization_options;
+  MachineOptions machine_options;
+
+  // --backend=native writes assembly or objects itself, leaving LLVM only what
+  // it can't compile
+  bool native_backend = false;
+
+  // --run: every file is compiled into the JIT, then main is called with the
+  // arguments after --, the first file's name being argv[0]
+  bool run_program = false;
+  JitSession* jit_session = nullptr;
+  std::vector<std::string> program_arguments(1);
+
+  // --time-passes reports these along with LLVM's passes, when they go out of
+  // scope
+  llvm::TimerGroup phases("miniclang", "Miniclang phases");
+  llvm::Timer front_end_timer("front-end", "Parsing and semantic analysis", phases);
+  llvm::Timer codegen_timer("codegen", "Codegen", phases);
+  llvm::Timer optimization_timer("optimization", "Optimization", phases);
+  llvm::Timer output_timer("output", "Writing the module, or compiling it with -c", phases);
+  llvm::Timer jit_timer("jit", "Compiling in the JIT with --run", phases);
 
   for (int i = 1; i < argc; i++) {
+    // -jN or -j N: how many threads per-function passes may use
+    if (strncmp(argv[i], "-j", 2) == 0) {
+      char const* count = argv[i][2] ? argv[i] + 2 : (i + 1 < argc ? argv[++i] : "");
+      thread_count = (unsigned)atoi(count);
+      if (thread_count == 0) {
+        fprintf(stderr, "Expected a positive thread count after -j, aborting.\n");
+        return 1;
+      }
+      codegen_options.thread_count = thread_count;
+      continue;
+    }
+
+    // --target=<triple> or --target <triple>, the host by default
+    if (strncmp(argv[i], "--target", 8) == 0 && (argv[i][8] == '=' || argv[i][8] == '\0')) {
+      char const* name = argv[i][8] ? argv[i] + 9 : (i + 1 < argc ? argv[++i] : "");
+      if (!set_target(name)) {
+        fprintf(stderr, "Unknown target %s, aborting.\n", name);
+        return 1;
+      }
+      continue;
+    }
+
+    // report the padding in structs, and the member order that minimizes it
+    if (strcmp(argv[i], "-Wpadded") == 0) {
+      report_padding = true;
+      continue;
+    }
+
+    // give structs that never leave this file that order
+    if (strcmp(argv[i], "-freorder-structs") == 0) {
+      reorder_structs = true;
+      continue;
+    }
+
+    // position independent code for a shared library. -fpie and -fPIE build an
+    // executable, which is what we assume by default
+    if (strcmp(argv[i], "-fpic") == 0 || strcmp(argv[i], "-fPIC") == 0) {
+      codegen_options.pic_level = argv[i][2] == 'p' ? 1 : 2;
+      continue;
+    }
+    if (strcmp(argv[i], "-fpie") == 0 || strcmp(argv[i], "-fPIE") == 0)
+      continue;
+
+    // 6.5p7 loads and stores carry TBAA metadata unless -fno-strict-aliasing
+    if (strcmp(argv[i], "-fstrict-aliasing") == 0 || strcmp(argv[i], "-fno-strict-aliasing") == 0) {
+      codegen_options.strict_aliasing = argv[i][2] != 'n';
+      continue;
+    }
+
+    // -falign-large-arrays[=n], 32 bytes by default
+    if (strncmp(argv[i], "-falign-large-arrays", 20) == 0 && (argv[i][20] == '=' || argv[i][20] == '\0')) {
+      int alignment = argv[i][20] ? atoi(argv[i] + 21) : 32;
+      if (alignment <= 0 || (alignment & (alignment - 1))) {
+        fprintf(stderr, "Expected a power of two after -falign-large-arrays=, aborting.\n");
+        return 1;
+      }
+      codegen_options.large_array_alignment = (unsigned)alignment;
+      continue;
+    }
+
+    // --emit=llvm or --emit=bc
+    if (strncmp(argv[i], "--emit=", 7) == 0) {
+      if (strcmp(argv[i] + 7, "llvm") == 0) {
+        emit_kind = EmitKind::LLVM;
+      } else if (strcmp(argv[i] + 7, "bc") == 0) {
+        emit_kind = EmitKind::Bitcode;
+      } else {
+        fprintf(stderr, "Unknown output kind %s, aborting.\n", argv[i] + 7);
+        return 1;
+      }
+      continue;
+    }
+
+    // --backend=llvm, the default, or --backend=native
+    if (strncmp(argv[i], "--backend=", 10) == 0) {
+      if (strcmp(argv[i] + 10, "native") != 0 && strcmp(argv[i] + 10, "llvm") != 0) {
+        fprintf(stderr, "Unknown backend %s, aborting.\n", argv[i] + 10);
+        return 1;
+      }
+      native_backend = argv[i][10] == 'n';
+      continue;
+    }
+
+    // compile to an object file
+    if (strcmp(argv[i], "-c") == 0) {
+      emit_kind = EmitKind::Object;
+      continue;
+    }
+
+    // -mcpu=<cpu> and -mattr=<features>, as llc takes them
+    if (strncmp(argv[i], "-mcpu=", 6) == 0) {
+      machine_options.cpu = argv[i] + 6;
+      continue;
+    }
+    if (strncmp(argv[i], "-mattr=", 7) == 0) {
+      machine_options.features = argv[i] + 7;
+      continue;
+    }
+
+    // -O0 to -O3 and -Os, LLVM's default pipeline for that level
+    if (strcmp(argv[i], "-O0") == 0 || strcmp(argv[i], "-O1") == 0 || strcmp(argv[i], "-O2") == 0 || strcmp(argv[i], "-O3") == 0) {
+      optimization_options.level = (OptimizationLevel)(argv[i][2] - '0');
+      continue;
+    }
+    if (strcmp(argv[i], "-Os") == 0) {
+      optimization_options.level = OptimizationLevel::Os;
+      continue;
+    }
+
+    // --passes=<pipeline> runs that pipeline instead
+    if (strncmp(argv[i], "--passes=", 9) == 0) {
+      optimization_options.passes = argv[i] + 9;
+      continue;
+    }
+
+    // --mir lowers function definitions to the mid-level IR and optimizes
+    // them there, --mir-passes=<list> with those passes instead of the default
+    // ones. Only the text emitter has it, so it is for --emit=llvm without -O
+    if (strcmp(argv[i], "--mir") == 0 || strncmp(argv[i], "--mir-passes=", 13) == 0) {
+      codegen_options.mid_level_ir = true;
+      codegen_options.mir_pipeline = argv[i][5] ? argv[i] + 13 : default_mir_pipeline;
+
+      std::vector<MirPass const*> passes;
+      std::string unknown_pass;
+      if (!parse_mir_pipeline(codegen_options.mir_pipeline, &passes, &unknown_pass)) {
+        fprintf(stderr, "Unknown MIR pass %s, aborting.\n", unknown_pass.c_str());
+        return 1;
+      }
+      continue;
+    }
+
+    // how long each phase, and each LLVM pass, took
+    if (strcmp(argv[i], "--time-passes") == 0) {
+      optimization_options.time_passes = true;
+      continue;
+    }
+
+    if (strcmp(argv[i], "--run") == 0) {
+      run_program = true;
+      continue;
+    }
+
+    // the rest are the program's
+    if (strcmp(argv[i], "--") == 0) {
+      program_arguments.insert(program_arguments.end(), argv + i + 1, argv + argc);
+      break;
+    }
+
     if (access(argv[i], F_OK) == 0) {
       char* buffer = read_file(argv[i]);
 
-      std::string outfile_name;
-      for (char const* s = argv[i]; *s != '.' && *s != '\0'; s++)
-        outfile_name.push_back(*s);
-      outfile_name += ".ll";
+      ExternalDeclaration* external_declarations;
+      {
+        llvm::TimeRegion region(optimization_options.time_passes ? &front_end_timer : nullptr);
+        external_declarations = parse_translation_unit(buffer);
+        resolve_names(external_declarations);
+        analyze_translation_unit(external_declarations, thread_count);
+      }
+
+      if (reorder_structs)
+        mark_reorderable_structs(external_declarations);
+      if (report_padding)
+        print_padding_report(external_declarations, stderr);
+
+      // foo.s, or foo.o with -c
+      if (native_backend) {
+        if (run_program || emit_kind == EmitKind::Bitcode || codegen_options.pic_level || strcmp(current_target->triple, "x86_64-unknown-linux-gnu") != 0) {
+          fprintf(stderr, "The native backend only writes x86-64 Linux assembly or objects, without -fpic, aborting.\n");
+          return 1;
+        }
+
+        FILE* outfile = open_output(argv[i], emit_kind == EmitKind::Object ? EmitKind::Object : EmitKind::Assembly);
+        llvm::TimeRegion region(optimization_options.time_passes ? &codegen_timer : nullptr);
+        emit_native_from_translation_unit(external_declarations, outfile, emit_kind == EmitKind::Object ? NativeFileKind::Object : NativeFileKind::Assembly,
+            machine_options, codegen_options);
+        fclose(outfile);
+        continue;
+      }
+
+      // unoptimized text needs no module, the text emitter prints it directly
+      if (emit_kind == EmitKind::LLVM && !runs_passes(optimization_options) && !run_program) {
+        llvm::TimeRegion region(optimization_options.time_passes ? &codegen_timer : nullptr);
+        emit_llvm_from_translation_unit(external_declarations, open_output(argv[i], emit_kind), codegen_options);
+        continue;
+      }
+
+      // the JIT takes the context along with the module
+      auto context = std::make_unique<llvm::LLVMContext>();
+      std::unique_ptr<llvm::Module> module;
+      {
+        llvm::TimeRegion region(optimization_options.time_passes ? &codegen_timer : nullptr);
+        module = build_llvm_module(external_declarations, *context, codegen_options);
+      }
+
+      // the optimizer's cost model, and what compiles the module to an object
+      std::unique_ptr<llvm::TargetMachine> machine;
+      if ((emit_kind == EmitKind::Object && !run_program) || runs_passes(optimization_options))
+        machine = create_target_machine(machine_options, codegen_options, optimization_options.level);
 
-      FILE* outfile = fopen(outfile_name.c_str(), "w");
+      if (runs_passes(optimization_options)) {
+        llvm::TimeRegion region(optimization_options.time_passes ? &optimization_timer : nullptr);
+        optimize_module(*module, optimization_options, machine.get());
+      }
 
-      ExternalDeclaration* external_declarations = parse_translation_unit(buffer);
-      emit_llvm_from_translation_unit(external_declarations, outfile);
+      if (run_program) {
+        if (!jit_session) {
+          jit_session = new_jit_session(optimization_options.level);
+          program_arguments[0] = argv[i];
+        }
+        add_module_to_jit(jit_session, std::move(module), std::move(context));
+        continue;
+      }
+
+      FILE* outfile = open_output(argv[i], emit_kind);
+      llvm::TimeRegion region(optimization_options.time_passes ? &output_timer : nullptr);
+      if (emit_kind == EmitKind::Object)
+        emit_object_file(*module, *machine, outfile);
+      else if (emit_kind == EmitKind::Bitcode)
+        write_bitcode(*module, outfile);
+      else
+        write_textual_ir(*module, outfile);
     } else {
       fprintf(stderr, "File %s not found, aborting.\n", argv[i]);
     }
   }
 
-  return 0;
+  if (!run_program)
+    return 0;
+
+  if (!jit_session) {
+    fprintf(stderr, "Nothing to run, aborting.\n");
+    return 1;
+  }
+
+  MainFunction main_function;
+  {
+    llvm::TimeRegion region(optimization_options.time_passes ? &jit_timer : nullptr);
+    main_function = compile_main(jit_session);
+  }
+
+  // from starting up to the program's first instruction, of which compiling
+  // main and what it calls in the JIT is the last part
+  if (optimization_options.time_passes) {
+    std::chrono::duration<double> to_first_instruction = std::chrono::steady_clock::now() - start;
+    fprintf(stderr, "miniclang: JIT compile %.2f ms, first instruction of main after %.2f ms\n", jit_timer.getTotalTime().getWallTime() * 1e3,
+        to_first_instruction.count() * 1e3);
+  }
+
+  int exit_code = run_main(main_function, program_arguments);
+  free_jit_session(jit_session);
+  return exit_code;
 }
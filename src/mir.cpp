@@ -0,0 +1,646 @@
+#include "mir.h"
+#include "target.h"
+#include "type.h"
+
+#include <algorithm>
+#include <cassert>
+
+// chunks are big enough that a function's arrays take a handful of them
+static constexpr size_t arena_chunk_size = 1 << 16;
+
+void* arena_allocate(MirArena* arena, size_t size, size_t alignment)
+{
+  uintptr_t next = ((uintptr_t)arena->next + alignment - 1) & ~(uintptr_t)(alignment - 1);
+  if (!arena->next || next + size > (uintptr_t)arena->end) {
+    size_t chunk_size = std::max(arena_chunk_size, size + alignment);
+    char* chunk = new char[chunk_size];
+    arena->chunks.push_back(chunk);
+    arena->end = chunk + chunk_size;
+    next = ((uintptr_t)chunk + alignment - 1) & ~(uintptr_t)(alignment - 1);
+  }
+
+  arena->next = (char*)(next + size);
+  return (void*)next;
+}
+
+void free_arena(MirArena* arena)
+{
+  for (char* chunk : arena->chunks)
+    delete[] chunk;
+  arena->chunks.clear();
+  arena->next = arena->end = nullptr;
+}
+
+MirType mir_type(Type const* type)
+{
+  switch (type->fundamental_type) {
+  case FundamentalType::Void:
+    return MirType::Void;
+  case FundamentalType::Bool:
+    return MirType::I1;
+  case FundamentalType::Char:
+  case FundamentalType::SignedChar:
+  case FundamentalType::UnsignedChar:
+    return MirType::I8;
+  case FundamentalType::Short:
+  case FundamentalType::UnsignedShort:
+    return MirType::I16;
+  case FundamentalType::Int:
+  case FundamentalType::UnsignedInt:
+    return MirType::I32;
+  case FundamentalType::Long:
+  case FundamentalType::UnsignedLong:
+    return current_target->long_width == 64 ? MirType::I64 : MirType::I32;
+  case FundamentalType::LongLong:
+  case FundamentalType::UnsignedLongLong:
+    return MirType::I64;
+  case FundamentalType::Float:
+    return MirType::Float;
+  case FundamentalType::Double:
+  case FundamentalType::LongDouble:
+    return MirType::Double;
+  case FundamentalType::Pointer:
+    return MirType::Ptr;
+  default:
+    assert(false && "Not a type the mid-level IR has");
+    return MirType::Void;
+  }
+}
+
+bool is_mir_type(Type const* type)
+{
+  if (is_atomic_type(type))
+    return false;
+
+  switch (type->fundamental_type) {
+  case FundamentalType::Void:
+  case FundamentalType::Bool:
+  case FundamentalType::Char:
+  case FundamentalType::SignedChar:
+  case FundamentalType::UnsignedChar:
+  case FundamentalType::Short:
+  case FundamentalType::UnsignedShort:
+  case FundamentalType::Int:
+  case FundamentalType::UnsignedInt:
+  case FundamentalType::Long:
+  case FundamentalType::UnsignedLong:
+  case FundamentalType::LongLong:
+  case FundamentalType::UnsignedLongLong:
+  case FundamentalType::Float:
+  case FundamentalType::Double:
+  case FundamentalType::Pointer:
+    return true;
+  case FundamentalType::LongDouble:
+    return strcmp(current_target->long_double_type, "double") == 0;
+  default:
+    return false;
+  }
+}
+
+unsigned mir_type_bit_width(MirType type)
+{
+  switch (type) {
+  case MirType::Void:
+    return 0;
+  case MirType::I1:
+    return 1;
+  case MirType::I8:
+    return 8;
+  case MirType::I16:
+    return 16;
+  case MirType::I32:
+  case MirType::Float:
+    return 32;
+  case MirType::I64:
+  case MirType::Double:
+  case MirType::Ptr:
+    return 64;
+  }
+  return 0;
+}
+
+long long normalize_mir_constant(MirType type, long long constant)
+{
+  if (type == MirType::I1)
+    return constant & 1;
+  if (!is_mir_integer_type(type) || type == MirType::I64)
+    return constant;
+
+  unsigned shift = 64 - mir_type_bit_width(type);
+  return (long long)((unsigned long long)constant << shift) >> shift;
+}
+
+static MirValue new_mir_value(MirFunction* function, MirOpcode opcode, MirType type)
+{
+  MirInstruction value {};
+  value.opcode = opcode;
+  value.type = type;
+  value.predicate = MirPredicate::None;
+  value.block = no_mir_block;
+  function->values.push_back(value);
+  return (MirValue)function->values.size() - 1;
+}
+
+MirFunction* new_mir_function(Object const* function_object)
+{
+  FunctionData const* function_data = function_object->type->function_data;
+
+  MirFunction* function = new MirFunction;
+  function->object = function_object;
+  function->return_type = mir_type(function_data->return_type);
+  std::fill(std::begin(function->undefs), std::end(function->undefs), no_mir_value);
+
+  function->parameter_count = 0;
+  for (FunctionParameter const* parameter = function_data->parameter_list; parameter; parameter = parameter->next_parameter) {
+    MirValue argument = new_mir_value(function, MirOpcode::Argument, mir_type(parameter->parameter_type));
+    function->values[argument].constant = function->parameter_count++;
+  }
+
+  new_mir_block(function);
+  return function;
+}
+
+void free_mir_function(MirFunction* function)
+{
+  free_arena(&function->arena);
+  delete function;
+}
+
+MirValue mir_constant(MirFunction* function, MirType type, long long constant)
+{
+  constant = normalize_mir_constant(type, constant);
+  auto [found, inserted] = function->constants[(unsigned)type].try_emplace(constant, no_mir_value);
+  if (inserted) {
+    found->second = new_mir_value(function, MirOpcode::Constant, type);
+    function->values[found->second].constant = constant;
+  }
+  return found->second;
+}
+
+// a float constant is kept as the double it widens to, so its bits are exact
+MirValue mir_float_constant(MirFunction* function, MirType type, double constant)
+{
+  if (type == MirType::Float)
+    constant = (double)(float)constant;
+
+  long long bits;
+  memcpy(&bits, &constant, sizeof(bits));
+  return mir_constant(function, type, bits);
+}
+
+MirValue mir_undef(MirFunction* function, MirType type)
+{
+  MirValue& undef = function->undefs[(unsigned)type];
+  if (undef == no_mir_value)
+    undef = new_mir_value(function, MirOpcode::Undef, type);
+  return undef;
+}
+
+MirValue mir_global(MirFunction* function, Object const* object)
+{
+  auto [found, inserted] = function->globals.try_emplace(object, no_mir_value);
+  if (inserted) {
+    found->second = new_mir_value(function, MirOpcode::Global, MirType::Ptr);
+    function->values[found->second].global = object;
+  }
+  return found->second;
+}
+
+uint32_t new_mir_block(MirFunction* function)
+{
+  MirBlock block {};
+  block.immediate_dominator = no_mir_block;
+  block.order = UINT32_MAX;
+  function->blocks.push_back(block);
+  return (uint32_t)function->blocks.size() - 1;
+}
+
+static void add_use(MirFunction* function, MirValue value, MirValue user, uint32_t operand)
+{
+  array_push(&function->arena, &function->values[value].uses, MirUse { user, operand });
+}
+
+// uses are unordered, the last one takes the place of the removed one
+static void remove_use(MirFunction* function, MirValue value, MirValue user, uint32_t operand)
+{
+  MirArray<MirUse>& uses = function->values[value].uses;
+  for (uint32_t i = 0; i < uses.size; i++) {
+    if (uses[i].user == user && uses[i].operand == operand) {
+      uses[i] = uses[uses.size - 1];
+      uses.size--;
+      return;
+    }
+  }
+  assert(false && "Removing a use that isn't in the use list");
+}
+
+void add_mir_operand(MirFunction* function, MirValue user, MirValue operand)
+{
+  MirInstruction& instruction = function->values[user];
+  add_use(function, operand, user, instruction.operands.size);
+  array_push(&function->arena, &function->values[user].operands, operand);
+}
+
+void set_mir_operand(MirFunction* function, MirValue user, uint32_t operand, MirValue value)
+{
+  MirValue old_value = function->values[user].operands[operand];
+  if (old_value == value)
+    return;
+
+  remove_use(function, old_value, user, operand);
+  function->values[user].operands[operand] = value;
+  add_use(function, value, user, operand);
+}
+
+MirValue insert_mir_instruction(MirFunction* function, uint32_t block, uint32_t position, MirOpcode opcode, MirType type,
+    std::initializer_list<MirValue> operands)
+{
+  MirValue value = new_mir_value(function, opcode, type);
+  function->values[value].block = block;
+  for (MirValue operand : operands)
+    add_mir_operand(function, value, operand);
+
+  array_insert(&function->arena, &function->blocks[block].instructions, position, value);
+  return value;
+}
+
+MirValue append_mir_instruction(MirFunction* function, uint32_t block, MirOpcode opcode, MirType type, std::initializer_list<MirValue> operands)
+{
+  return insert_mir_instruction(function, block, function->blocks[block].instructions.size, opcode, type, operands);
+}
+
+void add_mir_phi_incoming(MirFunction* function, MirValue phi, MirValue value, uint32_t block)
+{
+  add_mir_operand(function, phi, value);
+  array_push(&function->arena, &function->values[phi].incoming_blocks, block);
+}
+
+// the operands after the removed one move down, and so do their uses
+void remove_mir_phi_incoming(MirFunction* function, MirValue phi, uint32_t incoming)
+{
+  MirInstruction& instruction = function->values[phi];
+  for (uint32_t i = incoming; i < instruction.operands.size; i++)
+    remove_use(function, instruction.operands[i], phi, i);
+
+  array_erase(&instruction.operands, incoming);
+  array_erase(&instruction.incoming_blocks, incoming);
+
+  for (uint32_t i = incoming; i < instruction.operands.size; i++)
+    add_use(function, instruction.operands[i], phi, i);
+}
+
+void add_mir_edge(MirFunction* function, uint32_t from, uint32_t to)
+{
+  array_push(&function->arena, &function->blocks[from].successors, to);
+  array_push(&function->arena, &function->blocks[to].predecessors, from);
+}
+
+static void erase_first(MirArray<uint32_t>* array, uint32_t element)
+{
+  uint32_t* found = std::find(array->begin(), array->end(), element);
+  assert(found != array->end());
+  array_erase(array, (uint32_t)(found - array->begin()));
+}
+
+void remove_mir_edge(MirFunction* function, uint32_t from, uint32_t to)
+{
+  erase_first(&function->blocks[from].successors, to);
+  erase_first(&function->blocks[to].predecessors, from);
+
+  for (MirValue phi : function->blocks[to].instructions) {
+    MirInstruction const& instruction = function->values[phi];
+    if (instruction.opcode != MirOpcode::Phi)
+      break;
+
+    uint32_t const* incoming = std::find(instruction.incoming_blocks.begin(), instruction.incoming_blocks.end(), from);
+    assert(incoming != instruction.incoming_blocks.end());
+    remove_mir_phi_incoming(function, phi, (uint32_t)(incoming - instruction.incoming_blocks.begin()));
+  }
+}
+
+void replace_all_mir_uses(MirFunction* function, MirValue value, MirValue replacement)
+{
+  if (value == replacement)
+    return;
+
+  MirArray<MirUse> uses = function->values[value].uses;
+  function->values[value].uses.size = 0;
+  for (MirUse use : uses) {
+    function->values[use.user].operands[use.operand] = replacement;
+    add_use(function, replacement, use.user, use.operand);
+  }
+}
+
+static void remove_from_block(MirFunction* function, MirValue value)
+{
+  MirArray<MirValue>& instructions = function->blocks[function->values[value].block].instructions;
+  MirValue* found = std::find(instructions.begin(), instructions.end(), value);
+  assert(found != instructions.end());
+  array_erase(&instructions, (uint32_t)(found - instructions.begin()));
+}
+
+void erase_mir_instruction(MirFunction* function, MirValue value)
+{
+  MirInstruction& instruction = function->values[value];
+  assert(instruction.block != no_mir_block && "Erasing something that is not an instruction");
+
+  for (uint32_t i = 0; i < instruction.operands.size; i++)
+    remove_use(function, instruction.operands[i], value, i);
+  instruction.operands.size = 0;
+  instruction.incoming_blocks.size = 0;
+
+  remove_from_block(function, value);
+  instruction.opcode = MirOpcode::Erased;
+  instruction.block = no_mir_block;
+}
+
+void move_mir_instruction(MirFunction* function, MirValue value, uint32_t to_block)
+{
+  remove_from_block(function, value);
+  MirArray<MirValue>& instructions = function->blocks[to_block].instructions;
+  uint32_t position = instructions.size;
+  if (mir_terminator(function, to_block) != no_mir_value)
+    position--;
+  array_insert(&function->arena, &instructions, position, value);
+  function->values[value].block = to_block;
+}
+
+bool is_mir_terminator(MirOpcode opcode)
+{
+  return opcode == MirOpcode::Br || opcode == MirOpcode::CondBr || opcode == MirOpcode::Ret || opcode == MirOpcode::Unreachable;
+}
+
+MirValue mir_terminator(MirFunction const* function, uint32_t block)
+{
+  MirArray<MirValue> const& instructions = function->blocks[block].instructions;
+  if (!instructions.size || !is_mir_terminator(function->values[instructions[instructions.size - 1]].opcode))
+    return no_mir_value;
+  return instructions[instructions.size - 1];
+}
+
+bool mir_has_side_effects(MirOpcode opcode) { return opcode == MirOpcode::Store || opcode == MirOpcode::Call || is_mir_terminator(opcode); }
+
+// division by 0 is undefined, and so is the signed division of the smallest
+// value by -1, LLVM may trap on both
+bool mir_may_trap(MirFunction const* function, MirValue value)
+{
+  MirInstruction const& instruction = function->values[value];
+  switch (instruction.opcode) {
+  case MirOpcode::SDiv:
+  case MirOpcode::SRem:
+  case MirOpcode::UDiv:
+  case MirOpcode::URem: {
+    MirInstruction const& divisor = function->values[instruction.operands[1]];
+    if (divisor.opcode != MirOpcode::Constant || divisor.constant == 0)
+      return true;
+    bool is_signed = instruction.opcode == MirOpcode::SDiv || instruction.opcode == MirOpcode::SRem;
+    return is_signed && divisor.constant == -1;
+  }
+  case MirOpcode::Call: {
+    Object const* callee = mir_called_function(function, value);
+    return !callee || !callee->inferred_attributes.is_speculatable;
+  }
+  default:
+    return false;
+  }
+}
+
+Object const* mir_called_function(MirFunction const* function, MirValue call)
+{
+  MirInstruction const& callee = function->values[function->values[call].operands[0]];
+  return callee.opcode == MirOpcode::Global && callee.global->type->fundamental_type == FundamentalType::Function ? callee.global : nullptr;
+}
+
+// Dominators
+
+static void compute_reverse_post_order(MirFunction* function)
+{
+  for (MirBlock& block : function->blocks)
+    block.order = UINT32_MAX;
+
+  // an explicit stack of blocks and how many of their successors were visited
+  std::vector<uint32_t> post_order;
+  std::vector<std::pair<uint32_t, uint32_t>> stack;
+  std::vector<bool> visited(function->blocks.size());
+  stack.push_back({ 0, 0 });
+  visited[0] = true;
+
+  while (!stack.empty()) {
+    auto& [block, next_successor] = stack.back();
+    MirArray<uint32_t> const& successors = function->blocks[block].successors;
+    if (next_successor < successors.size) {
+      uint32_t successor = successors[next_successor++];
+      if (!visited[successor]) {
+        visited[successor] = true;
+        stack.push_back({ successor, 0 });
+      }
+      continue;
+    }
+    post_order.push_back(block);
+    stack.pop_back();
+  }
+
+  function->reverse_post_order.assign(post_order.rbegin(), post_order.rend());
+  for (uint32_t i = 0; i < function->reverse_post_order.size(); i++)
+    function->blocks[function->reverse_post_order[i]].order = i;
+}
+
+// walks both up the tree to where they meet, blocks later in reverse post
+// order can't dominate earlier ones
+static uint32_t intersect_dominators(MirFunction const* function, uint32_t lhs, uint32_t rhs)
+{
+  while (lhs != rhs) {
+    while (function->blocks[lhs].order > function->blocks[rhs].order)
+      lhs = function->blocks[lhs].immediate_dominator;
+    while (function->blocks[rhs].order > function->blocks[lhs].order)
+      rhs = function->blocks[rhs].immediate_dominator;
+  }
+  return lhs;
+}
+
+void compute_dominator_tree(MirFunction* function)
+{
+  compute_reverse_post_order(function);
+
+  for (MirBlock& block : function->blocks) {
+    block.immediate_dominator = no_mir_block;
+    block.dominated.size = 0;
+  }
+
+  // the entry stands in as its own dominator while iterating
+  function->blocks[0].immediate_dominator = 0;
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (uint32_t i = 1; i < function->reverse_post_order.size(); i++) {
+      uint32_t block = function->reverse_post_order[i];
+      uint32_t new_dominator = no_mir_block;
+      for (uint32_t predecessor : function->blocks[block].predecessors) {
+        if (function->blocks[predecessor].immediate_dominator == no_mir_block)
+          continue;
+        new_dominator = new_dominator == no_mir_block ? predecessor : intersect_dominators(function, predecessor, new_dominator);
+      }
+
+      if (function->blocks[block].immediate_dominator != new_dominator) {
+        function->blocks[block].immediate_dominator = new_dominator;
+        changed = true;
+      }
+    }
+  }
+  function->blocks[0].immediate_dominator = no_mir_block;
+
+  for (uint32_t block : function->reverse_post_order)
+    if (block)
+      array_push(&function->arena, &function->blocks[function->blocks[block].immediate_dominator].dominated, block);
+
+  // an explicit stack of blocks and how many of their children were visited
+  uint32_t clock = 0;
+  std::vector<std::pair<uint32_t, uint32_t>> stack;
+  function->blocks[0].dominator_tree_entry = clock++;
+  stack.push_back({ 0, 0 });
+  while (!stack.empty()) {
+    auto& [block, next_child] = stack.back();
+    MirArray<uint32_t> const& dominated = function->blocks[block].dominated;
+    if (next_child < dominated.size) {
+      uint32_t child = dominated[next_child++];
+      function->blocks[child].dominator_tree_entry = clock++;
+      stack.push_back({ child, 0 });
+      continue;
+    }
+    function->blocks[block].dominator_tree_exit = clock++;
+    stack.pop_back();
+  }
+}
+
+// in constant time, rather than walking up the tree from block, which made
+// checking every edge of a long else if chain quadratic
+bool mir_block_dominates(MirFunction const* function, uint32_t dominator, uint32_t block)
+{
+  if (dominator == block)
+    return true;
+
+  MirBlock const& outer = function->blocks[dominator];
+  MirBlock const& inner = function->blocks[block];
+  if (outer.order == UINT32_MAX || inner.order == UINT32_MAX)
+    return false;
+  return outer.dominator_tree_entry < inner.dominator_tree_entry && inner.dominator_tree_exit < outer.dominator_tree_exit;
+}
+
+// Verification
+
+static bool verify_error(std::string* error, std::string const& message)
+{
+  *error = message;
+  return false;
+}
+
+static unsigned successor_count(MirOpcode terminator)
+{
+  switch (terminator) {
+  case MirOpcode::Br:
+    return 1;
+  case MirOpcode::CondBr:
+    return 2;
+  default:
+    return 0;
+  }
+}
+
+// whether the value is available where user uses it, which for a phi is at
+// the end of the block the operand comes from
+static bool is_available(MirFunction const* function, MirValue value, MirValue user, uint32_t operand)
+{
+  MirInstruction const& definition = function->values[value];
+  if (definition.block == no_mir_block)
+    return true;
+
+  MirInstruction const& use = function->values[user];
+  uint32_t use_block = use.opcode == MirOpcode::Phi ? use.incoming_blocks[operand] : use.block;
+  if (function->blocks[use_block].order == UINT32_MAX)
+    return true;
+
+  if (definition.block != use_block)
+    return mir_block_dominates(function, definition.block, use_block);
+  if (use.opcode == MirOpcode::Phi)
+    return true;
+
+  for (MirValue instruction : function->blocks[use_block].instructions) {
+    if (instruction == value)
+      return true;
+    if (instruction == user)
+      return false;
+  }
+  return false;
+}
+
+bool verify_mir_function(MirFunction* function, std::string* error)
+{
+  compute_dominator_tree(function);
+
+  for (uint32_t block = 0; block < function->blocks.size(); block++) {
+    MirBlock const& current = function->blocks[block];
+    if (current.is_removed)
+      continue;
+
+    std::string name = "block " + std::to_string(block);
+    MirValue terminator = mir_terminator(function, block);
+    if (terminator == no_mir_value)
+      return verify_error(error, name + " has no terminator");
+    if (successor_count(function->values[terminator].opcode) != current.successors.size)
+      return verify_error(error, name + "'s terminator doesn't match its successors");
+
+    for (uint32_t successor : current.successors)
+      if (function->blocks[successor].is_removed || std::count(current.successors.begin(), current.successors.end(), successor)
+              != std::count(function->blocks[successor].predecessors.begin(), function->blocks[successor].predecessors.end(), block))
+        return verify_error(error, name + " and its successor " + std::to_string(successor) + " disagree");
+
+    bool past_phis = false;
+    for (MirValue value : current.instructions) {
+      MirInstruction const& instruction = function->values[value];
+      std::string value_name = "value " + std::to_string(value) + " in " + name;
+
+      if (instruction.block != block)
+        return verify_error(error, value_name + " thinks it is in block " + std::to_string(instruction.block));
+      if (is_mir_terminator(instruction.opcode) && value != terminator)
+        return verify_error(error, value_name + " is a terminator in the middle of its block");
+
+      if (instruction.opcode == MirOpcode::Phi) {
+        if (past_phis)
+          return verify_error(error, value_name + " is a phi after other instructions");
+        std::vector<uint32_t> incoming(instruction.incoming_blocks.begin(), instruction.incoming_blocks.end());
+        std::vector<uint32_t> predecessors(current.predecessors.begin(), current.predecessors.end());
+        std::sort(incoming.begin(), incoming.end());
+        std::sort(predecessors.begin(), predecessors.end());
+        if (incoming != predecessors)
+          return verify_error(error, value_name + " is a phi that doesn't match its block's predecessors");
+      } else {
+        past_phis = true;
+      }
+
+      for (uint32_t i = 0; i < instruction.operands.size; i++) {
+        MirValue operand = instruction.operands[i];
+        MirInstruction const& operand_instruction = function->values[operand];
+        if (operand_instruction.opcode == MirOpcode::Erased)
+          return verify_error(error, value_name + " uses the erased value " + std::to_string(operand));
+
+        bool is_listed = false;
+        for (MirUse use : operand_instruction.uses)
+          is_listed |= use.user == value && use.operand == i;
+        if (!is_listed)
+          return verify_error(error, value_name + " is missing from the uses of " + std::to_string(operand));
+
+        if (!is_available(function, operand, value, i))
+          return verify_error(error, value_name + " uses " + std::to_string(operand) + ", which doesn't dominate it");
+      }
+    }
+  }
+
+  for (MirValue value = 0; value < function->values.size(); value++) {
+    for (MirUse use : function->values[value].uses) {
+      MirInstruction const& user = function->values[use.user];
+      if (user.opcode == MirOpcode::Erased || use.operand >= user.operands.size || user.operands[use.operand] != value)
+        return verify_error(error, "value " + std::to_string(value) + " has a stale use by " + std::to_string(use.user));
+    }
+  }
+
+  return true;
+}
@@ -0,0 +1,384 @@
+#include "mir.h"
+
+#include <cassert>
+#include <string.h>
+
+// Printing the mid-level IR as LLVM IR
+//
+// Values are renumbered in the order they are printed, arguments first, as
+// LLVM wants unnamed values numbered without gaps. Blocks are named after
+// their number in the function, so they take no numbers of their own
+
+static char const* mir_type_string(MirType type)
+{
+  switch (type) {
+  case MirType::Void:
+    return "void";
+  case MirType::I1:
+    return "i1";
+  case MirType::I8:
+    return "i8";
+  case MirType::I16:
+    return "i16";
+  case MirType::I32:
+    return "i32";
+  case MirType::I64:
+    return "i64";
+  case MirType::Float:
+    return "float";
+  case MirType::Double:
+    return "double";
+  case MirType::Ptr:
+    return "ptr";
+  }
+  return "";
+}
+
+static char const* opcode_string(MirOpcode opcode)
+{
+  switch (opcode) {
+  case MirOpcode::Add:
+    return "add";
+  case MirOpcode::Sub:
+    return "sub";
+  case MirOpcode::Mul:
+    return "mul";
+  case MirOpcode::SDiv:
+    return "sdiv";
+  case MirOpcode::UDiv:
+    return "udiv";
+  case MirOpcode::SRem:
+    return "srem";
+  case MirOpcode::URem:
+    return "urem";
+  case MirOpcode::Shl:
+    return "shl";
+  case MirOpcode::LShr:
+    return "lshr";
+  case MirOpcode::AShr:
+    return "ashr";
+  case MirOpcode::And:
+    return "and";
+  case MirOpcode::Or:
+    return "or";
+  case MirOpcode::Xor:
+    return "xor";
+  case MirOpcode::FAdd:
+    return "fadd";
+  case MirOpcode::FSub:
+    return "fsub";
+  case MirOpcode::FMul:
+    return "fmul";
+  case MirOpcode::FDiv:
+    return "fdiv";
+  case MirOpcode::Trunc:
+    return "trunc";
+  case MirOpcode::ZExt:
+    return "zext";
+  case MirOpcode::SExt:
+    return "sext";
+  case MirOpcode::FPTrunc:
+    return "fptrunc";
+  case MirOpcode::FPExt:
+    return "fpext";
+  case MirOpcode::FPToSI:
+    return "fptosi";
+  case MirOpcode::FPToUI:
+    return "fptoui";
+  case MirOpcode::SIToFP:
+    return "sitofp";
+  case MirOpcode::UIToFP:
+    return "uitofp";
+  case MirOpcode::PtrToInt:
+    return "ptrtoint";
+  case MirOpcode::IntToPtr:
+    return "inttoptr";
+  default:
+    assert(false && "Not a binary operation or conversion");
+    return "";
+  }
+}
+
+static char const* predicate_string(MirPredicate predicate)
+{
+  switch (predicate) {
+  case MirPredicate::None:
+    break;
+  case MirPredicate::Eq:
+    return "eq";
+  case MirPredicate::Ne:
+    return "ne";
+  case MirPredicate::SLT:
+    return "slt";
+  case MirPredicate::SLE:
+    return "sle";
+  case MirPredicate::SGT:
+    return "sgt";
+  case MirPredicate::SGE:
+    return "sge";
+  case MirPredicate::ULT:
+    return "ult";
+  case MirPredicate::ULE:
+    return "ule";
+  case MirPredicate::UGT:
+    return "ugt";
+  case MirPredicate::UGE:
+    return "uge";
+  case MirPredicate::OEq:
+    return "oeq";
+  case MirPredicate::UNe:
+    return "une";
+  case MirPredicate::OLT:
+    return "olt";
+  case MirPredicate::OLE:
+    return "ole";
+  case MirPredicate::OGT:
+    return "ogt";
+  case MirPredicate::OGE:
+    return "oge";
+  }
+  assert(false && "Comparison without a predicate");
+  return "";
+}
+
+struct MirPrinter {
+  MirFunction const* function;
+  OutputBuffer* output;
+  // the number each value is printed with
+  std::vector<unsigned> numbers;
+};
+
+// https://llvm.org/docs/LangRef.html#simple-constants
+// floating point constants are spelled as the bits of a double in hex, which
+// is exact, also for floats
+static void print_mir_value(MirPrinter const* printer, MirValue value)
+{
+  MirInstruction const& instruction = printer->function->values[value];
+  OutputBuffer* output = printer->output;
+
+  switch (instruction.opcode) {
+  case MirOpcode::Constant:
+    if (instruction.type == MirType::I1)
+      print(output, instruction.constant ? "true" : "false");
+    else if (instruction.type == MirType::Ptr && instruction.constant == 0)
+      print(output, "null");
+    else if (instruction.type == MirType::Ptr)
+      print(output, "inttoptr (i64 ", instruction.constant, " to ptr)");
+    else if (is_mir_float_type(instruction.type)) {
+      print(output, "0x");
+      append_hex(output, (unsigned long long)instruction.constant, 16);
+    } else
+      print(output, instruction.constant);
+    return;
+  case MirOpcode::Undef:
+    print(output, "undef");
+    return;
+  case MirOpcode::Global:
+    print(output, "@", instruction.global->identifier);
+    return;
+  default:
+    print(output, "%", printer->numbers[value]);
+    return;
+  }
+}
+
+static void print_typed_mir_value(MirPrinter const* printer, MirValue value)
+{
+  print(printer->output, mir_type_string(printer->function->values[value].type), " ");
+  print_mir_value(printer, value);
+}
+
+static void print_block_name(MirPrinter const* printer, uint32_t block)
+{
+  if (block == 0)
+    print(printer->output, "%entry");
+  else
+    print(printer->output, "%bb", block);
+}
+
+static void print_alignment(OutputBuffer* output, unsigned alignment)
+{
+  if (alignment)
+    print(output, ", align ", alignment);
+}
+
+static void print_tbaa_tag(OutputBuffer* output, unsigned tag)
+{
+  if (tag)
+    print(output, ", !tbaa !", tag);
+}
+
+// the type of a call, e.g. i32 (ptr, ...), only needed for variadic callees
+static void print_mir_function_type(OutputBuffer* output, Type const* function_type)
+{
+  FunctionData const* function_data = function_type->function_data;
+  print(output, mir_type_string(mir_type(function_data->return_type)), " (");
+  for (FunctionParameter const* parameter = function_data->parameter_list; parameter; parameter = parameter->next_parameter)
+    print(output, mir_type_string(mir_type(parameter->parameter_type)), ", ");
+  print(output, "...)");
+}
+
+static void print_instruction(MirPrinter const* printer, uint32_t block, MirValue value)
+{
+  MirInstruction const& instruction = printer->function->values[value];
+  OutputBuffer* output = printer->output;
+
+  print(output, "  ");
+  if (instruction.type != MirType::Void)
+    print(output, "%", printer->numbers[value], " = ");
+
+  switch (instruction.opcode) {
+  case MirOpcode::FNeg:
+    print(output, "fneg ");
+    print_typed_mir_value(printer, instruction.operands[0]);
+    break;
+
+  case MirOpcode::ICmp:
+  case MirOpcode::FCmp:
+    print(output, instruction.opcode == MirOpcode::ICmp ? "icmp " : "fcmp ", predicate_string(instruction.predicate), " ");
+    print_typed_mir_value(printer, instruction.operands[0]);
+    print(output, ", ");
+    print_mir_value(printer, instruction.operands[1]);
+    break;
+
+  case MirOpcode::Trunc:
+  case MirOpcode::ZExt:
+  case MirOpcode::SExt:
+  case MirOpcode::FPTrunc:
+  case MirOpcode::FPExt:
+  case MirOpcode::FPToSI:
+  case MirOpcode::FPToUI:
+  case MirOpcode::SIToFP:
+  case MirOpcode::UIToFP:
+  case MirOpcode::PtrToInt:
+  case MirOpcode::IntToPtr:
+    print(output, opcode_string(instruction.opcode), " ");
+    print_typed_mir_value(printer, instruction.operands[0]);
+    print(output, " to ", mir_type_string(instruction.type));
+    break;
+
+  case MirOpcode::Alloca:
+    print(output, "alloca [", instruction.constant, " x i8], align ", instruction.alignment);
+    break;
+
+  case MirOpcode::Load:
+    print(output, "load ", mir_type_string(instruction.type), ", ");
+    print_typed_mir_value(printer, instruction.operands[0]);
+    print_alignment(output, instruction.alignment);
+    print_tbaa_tag(output, instruction.tbaa_tag);
+    break;
+
+  case MirOpcode::Store:
+    print(output, "store ");
+    print_typed_mir_value(printer, instruction.operands[0]);
+    print(output, ", ");
+    print_typed_mir_value(printer, instruction.operands[1]);
+    print_alignment(output, instruction.alignment);
+    print_tbaa_tag(output, instruction.tbaa_tag);
+    break;
+
+  case MirOpcode::PtrAdd:
+    print(output, instruction.flags & MirInBounds ? "getelementptr inbounds i8, " : "getelementptr i8, ");
+    print_typed_mir_value(printer, instruction.operands[0]);
+    print(output, ", ");
+    print_typed_mir_value(printer, instruction.operands[1]);
+    break;
+
+  case MirOpcode::Call: {
+    if (instruction.tail_call_kind == TailCallKind::MustTail)
+      print(output, "musttail ");
+    else if (instruction.tail_call_kind == TailCallKind::Tail)
+      print(output, "tail ");
+    print(output, "call ");
+    if (instruction.function_type->function_data->is_variadic)
+      print_mir_function_type(output, instruction.function_type);
+    else
+      print(output, mir_type_string(instruction.type));
+    print(output, " ");
+    print_mir_value(printer, instruction.operands[0]);
+    print(output, "(");
+    for (uint32_t i = 1; i < instruction.operands.size; i++) {
+      print(output, i > 1 ? ", " : "");
+      print_typed_mir_value(printer, instruction.operands[i]);
+    }
+    print(output, ")");
+    FunctionAttributeNames attributes = function_attribute_names(mir_called_function(printer->function, value), true);
+    for (unsigned i = 0; i < attributes.count; i++)
+      print(output, " ", attributes.names[i]);
+    break;
+  }
+
+  case MirOpcode::Phi:
+    print(output, "phi ", mir_type_string(instruction.type), " ");
+    for (uint32_t i = 0; i < instruction.operands.size; i++) {
+      print(output, i ? ", [ " : "[ ");
+      print_mir_value(printer, instruction.operands[i]);
+      print(output, ", ");
+      print_block_name(printer, instruction.incoming_blocks[i]);
+      print(output, " ]");
+    }
+    break;
+
+  case MirOpcode::Br:
+    print(output, "br label ");
+    print_block_name(printer, printer->function->blocks[block].successors[0]);
+    break;
+
+  case MirOpcode::CondBr:
+    print(output, "br ");
+    print_typed_mir_value(printer, instruction.operands[0]);
+    print(output, ", label ");
+    print_block_name(printer, printer->function->blocks[block].successors[0]);
+    print(output, ", label ");
+    print_block_name(printer, printer->function->blocks[block].successors[1]);
+    break;
+
+  case MirOpcode::Ret:
+    print(output, "ret ");
+    if (instruction.operands.size)
+      print_typed_mir_value(printer, instruction.operands[0]);
+    else
+      print(output, "void");
+    break;
+
+  case MirOpcode::Unreachable:
+    print(output, "unreachable");
+    break;
+
+  default:
+    print(output, opcode_string(instruction.opcode), instruction.flags & MirNoSignedWrap ? " nsw" : "", instruction.flags & MirExact ? " exact" : "", " ");
+    print_typed_mir_value(printer, instruction.operands[0]);
+    print(output, ", ");
+    print_mir_value(printer, instruction.operands[1]);
+    break;
+  }
+
+  print(output, "\n");
+}
+
+void emit_mir_function_body(MirFunction const* function, OutputBuffer* output)
+{
+  MirPrinter printer { function, output, std::vector<unsigned>(function->values.size()) };
+
+  unsigned next_number = function->parameter_count;
+  for (MirValue argument = 0; argument < function->parameter_count; argument++)
+    printer.numbers[argument] = argument;
+  for (MirBlock const& block : function->blocks)
+    if (!block.is_removed)
+      for (MirValue value : block.instructions)
+        if (function->values[value].type != MirType::Void)
+          printer.numbers[value] = next_number++;
+
+  for (uint32_t block = 0; block < function->blocks.size(); block++) {
+    if (function->blocks[block].is_removed)
+      continue;
+
+    if (block == 0)
+      print(output, "entry:\n");
+    else
+      print(output, "bb", block, ":\n");
+
+    for (MirValue value : function->blocks[block].instructions)
+      print_instruction(&printer, block, value);
+  }
+}
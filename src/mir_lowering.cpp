@@ -0,0 +1,1371 @@
+#include "ast_walk.h"
+#include "layout.h"
+#include "mir.h"
+#include "target.h"
+#include "type.h"
+
+#include <cassert>
+#include <unordered_map>
+#include <vector>
+
+// Lowering the AST to the mid-level IR
+//
+// Like codegen.cpp, expressions are lowered in post order, each leaving its
+// result on a value stack for its parent. Unlike it, control flow is lowered
+// too: ifs, loops, && and || and ?: begin blocks and branch between them as
+// their children are walked, so the walk visits them on every event.
+// Promoted locals, see is_promoted_local, become SSA values the same way as
+// in codegen.cpp, after Braun et al., with phis that are MIR instructions.
+// A function that returns a call to itself loops instead: the call assigns
+// its arguments to the parameters and jumps back to a block after the entry,
+// so the recursion runs in constant stack space whether or not it is
+// optimized.
+
+// the result of lowering an expression, as in codegen.cpp's Value
+struct MirExpression {
+  Type const* type;
+  // rvalues: the value, lvalues in memory: their address
+  MirValue value;
+  bool is_lvalue;
+  // lvalues: the alignment to access them with, 0 for their type's own
+  unsigned alignment;
+  // lvalues of promoted locals: their slot, otherwise -1
+  int variable;
+  // lvalues in memory: what they are part of, for their TBAA tag
+  TBAAAccess tbaa = {};
+};
+
+struct MirLocal {
+  Type const* type;
+  // the alloca holding it, no_mir_value for promoted locals
+  MirValue address;
+  unsigned alignment;
+};
+
+// SSA construction state of a block, see codegen.cpp's BasicBlock
+struct MirBlockState {
+  bool is_sealed;
+  std::unordered_map<int, MirValue> definitions;
+  std::vector<std::pair<int, MirValue>> incomplete_phis;
+};
+
+// the blocks an if, loop, && or || or ?: branches between, while its children
+// are walked
+struct MirControlFrame {
+  ASTNode const* node;
+  // what its parent had on the value stack, statements in its branches leave
+  // their values above that
+  size_t value_stack_size;
+
+  // If and ?: where the condition branches to when false, and where the
+  // branches join, && and || join there too. Loops: the header, which the
+  // back edge goes to, and the exit
+  uint32_t false_target;
+  uint32_t join;
+  uint32_t header;
+  uint32_t exit;
+
+  // ?: the lhs's value, && and || the one they have if the rhs is skipped,
+  // and the block it comes from
+  MirValue value;
+  uint32_t value_block;
+};
+
+struct LoweringContext {
+  MirFunction* function;
+  CodegenOptions const* options;
+  TBAAMetadata const* tbaa;
+
+  // set on the first thing the MIR can't express, the rest of the walk does
+  // nothing and the function goes to codegen.cpp instead
+  bool is_unsupported;
+
+  uint32_t current_block;
+  bool block_terminated;
+  std::vector<MirBlockState> blocks;
+
+  std::vector<MirLocal> locals;
+  // allocas go at the start of the entry block, in order
+  uint32_t alloca_count;
+
+  // see has_locals_in_memory, calls in tail position aren't marked tail then
+  bool has_locals_in_memory;
+  // where self tail calls jump to, see is_self_tail_call, no_mir_block if the
+  // function has none. It is sealed once the whole body is lowered
+  uint32_t recursion_header;
+
+  // trivial phis that were removed, and the value each one stood for. Blocks
+  // may still name them as the definition of a local
+  std::unordered_map<MirValue, MirValue> removed_phis;
+  std::vector<bool> is_phi_complete;
+
+  std::vector<MirExpression> value_stack;
+  std::vector<MirControlFrame> control_stack;
+};
+
+static void mark_unsupported(LoweringContext* context) { context->is_unsupported = true; }
+
+// a type the MIR has no values of, e.g. a struct, makes the function
+// unsupported, the value is then never looked at
+static MirType value_type(LoweringContext* context, Type const* type)
+{
+  if (!is_mir_type(type)) {
+    mark_unsupported(context);
+    return MirType::I32;
+  }
+  return mir_type(type);
+}
+
+static MirExpression rvalue(Type const* type, MirValue value) { return { type, value, false, 0, -1 }; }
+static MirExpression address_lvalue(Type const* type, MirValue address, unsigned alignment) { return { type, address, true, alignment, -1 }; }
+static MirExpression variable_lvalue(Type const* type, int slot) { return { type, no_mir_value, true, 0, slot }; }
+
+// Blocks
+
+static uint32_t new_block(LoweringContext* context)
+{
+  context->blocks.push_back({ false, {}, {} });
+  return new_mir_block(context->function);
+}
+
+static void seal_block(LoweringContext*, uint32_t block);
+
+// continues in block, after its predecessors have branched to it. It is
+// sealed unless more of them are still to come, as for a loop header
+static void begin_block(LoweringContext* context, uint32_t block, bool is_sealed = true)
+{
+  assert((context->block_terminated || context->is_unsupported) && "Beginning a block before the last one was terminated");
+  context->current_block = block;
+  context->block_terminated = false;
+  if (is_sealed)
+    seal_block(context, block);
+}
+
+// after a return, any following (dead) code still needs a block to live in
+static void start_block_if_terminated(LoweringContext* context)
+{
+  if (context->block_terminated)
+    begin_block(context, new_block(context));
+}
+
+static MirValue append(LoweringContext* context, MirOpcode opcode, MirType type, std::initializer_list<MirValue> operands)
+{
+  start_block_if_terminated(context);
+  return append_mir_instruction(context->function, context->current_block, opcode, type, operands);
+}
+
+static void terminate(LoweringContext* context, MirOpcode opcode, std::initializer_list<MirValue> operands)
+{
+  append(context, opcode, MirType::Void, operands);
+  context->block_terminated = true;
+}
+
+// falls through to target, unless the block already returned
+static void branch(LoweringContext* context, uint32_t target)
+{
+  if (context->block_terminated)
+    return;
+  terminate(context, MirOpcode::Br, {});
+  add_mir_edge(context->function, context->current_block, target);
+}
+
+static void conditional_branch(LoweringContext* context, MirValue condition, uint32_t if_true, uint32_t if_false)
+{
+  terminate(context, MirOpcode::CondBr, { condition });
+  add_mir_edge(context->function, context->current_block, if_true);
+  add_mir_edge(context->function, context->current_block, if_false);
+}
+
+// SSA construction, as in codegen.cpp
+
+static MirValue resolve_phi(LoweringContext const* context, MirValue value)
+{
+  for (auto removed = context->removed_phis.find(value); removed != context->removed_phis.end(); removed = context->removed_phis.find(value))
+    value = removed->second;
+  return value;
+}
+
+static MirValue zero_value(LoweringContext* context, MirType type)
+{
+  return is_mir_float_type(type) ? mir_float_constant(context->function, type, 0) : mir_constant(context->function, type, 0);
+}
+
+static void write_variable(LoweringContext* context, int slot, uint32_t block, MirValue value) { context->blocks[block].definitions[slot] = value; }
+
+static MirValue new_phi(LoweringContext* context, int slot, uint32_t block)
+{
+  MirValue phi = insert_mir_instruction(context->function, block, 0, MirOpcode::Phi, mir_type(context->locals[slot].type), {});
+  if (context->is_phi_complete.size() <= phi)
+    context->is_phi_complete.resize(phi + 1);
+  return phi;
+}
+
+// the value of a local at the end of a block, following single predecessors
+// up without recursion. A sealed block with several predecessors gets a phi
+// whose operands are left for complete_phis, through pending_phis, so that a
+// long chain of joins, e.g. of else ifs, doesn't use the stack either
+static MirValue lookup_variable(LoweringContext* context, int slot, uint32_t block, std::vector<MirValue>* pending_phis)
+{
+  // the blocks passed through, which get the value found as well
+  std::vector<uint32_t> path;
+  MirValue value;
+  for (;;) {
+    auto definition = context->blocks[block].definitions.find(slot);
+    if (definition != context->blocks[block].definitions.end()) {
+      value = resolve_phi(context, definition->second);
+      break;
+    }
+
+    MirBlock const& current = context->function->blocks[block];
+    if (!context->blocks[block].is_sealed) {
+      value = new_phi(context, slot, block);
+      context->blocks[block].incomplete_phis.push_back({ slot, value });
+    } else if (current.predecessors.size == 0) {
+      // the entry or an unreachable block, the local was read before it was
+      // given a value, which is indeterminate
+      value = zero_value(context, mir_type(context->locals[slot].type));
+    } else if (current.predecessors.size == 1) {
+      path.push_back(block);
+      block = current.predecessors[0];
+      continue;
+    } else {
+      // written before the operands are read, so that a loop back to this
+      // block finds the phi instead of looking for it again
+      value = new_phi(context, slot, block);
+      pending_phis->push_back(value);
+    }
+    write_variable(context, slot, block, value);
+    break;
+  }
+
+  for (uint32_t passed : path)
+    write_variable(context, slot, passed, value);
+  return value;
+}
+
+// a phi whose operands are all the same value, or itself, is that value. Phis
+// that used it may have become trivial in turn, and are tried next
+static void remove_trivial_phis(LoweringContext* context, std::vector<MirValue> worklist)
+{
+  MirFunction* function = context->function;
+  while (!worklist.empty()) {
+    MirValue phi = worklist.back();
+    worklist.pop_back();
+    if (context->removed_phis.count(phi) || !context->is_phi_complete[phi])
+      continue;
+
+    MirValue same = no_mir_value;
+    bool is_trivial = true;
+    for (MirValue operand : function->values[phi].operands) {
+      if (operand == same || operand == phi)
+        continue;
+      if (same != no_mir_value) {
+        is_trivial = false;
+        break;
+      }
+      same = operand;
+    }
+    if (!is_trivial)
+      continue;
+
+    // without another operand the phi is only reachable from itself, i.e. not
+    // at all, and 0 does as well as anything
+    if (same == no_mir_value)
+      same = zero_value(context, function->values[phi].type);
+
+    for (MirUse use : function->values[phi].uses)
+      if (use.user != phi && function->values[use.user].opcode == MirOpcode::Phi)
+        worklist.push_back(use.user);
+
+    replace_all_mir_uses(function, phi, same);
+    erase_mir_instruction(function, phi);
+    context->removed_phis[phi] = same;
+  }
+}
+
+// fills in the operands of phis of one local, and of the phis looking them up
+// makes, then removes the ones that turned out trivial
+static void complete_phis(LoweringContext* context, int slot, std::vector<MirValue> pending_phis)
+{
+  std::vector<MirValue> completed_phis;
+  while (!pending_phis.empty()) {
+    MirValue phi = pending_phis.back();
+    pending_phis.pop_back();
+
+    uint32_t block = context->function->values[phi].block;
+    for (uint32_t i = 0; i < context->function->blocks[block].predecessors.size; i++) {
+      uint32_t predecessor = context->function->blocks[block].predecessors[i];
+      add_mir_phi_incoming(context->function, phi, lookup_variable(context, slot, predecessor, &pending_phis), predecessor);
+    }
+    context->is_phi_complete[phi] = true;
+    completed_phis.push_back(phi);
+  }
+  remove_trivial_phis(context, std::move(completed_phis));
+}
+
+static MirValue read_variable(LoweringContext* context, int slot, uint32_t block)
+{
+  std::vector<MirValue> pending_phis;
+  MirValue value = lookup_variable(context, slot, block, &pending_phis);
+  complete_phis(context, slot, std::move(pending_phis));
+  return resolve_phi(context, value);
+}
+
+static void seal_block(LoweringContext* context, uint32_t block)
+{
+  std::vector<std::pair<int, MirValue>> incomplete_phis = std::move(context->blocks[block].incomplete_phis);
+  context->blocks[block].is_sealed = true;
+  for (auto [slot, phi] : incomplete_phis)
+    complete_phis(context, slot, { phi });
+}
+
+// Memory
+
+static MirValue emit_alloca(LoweringContext* context, Type const* type, unsigned alignment)
+{
+  MirValue address = insert_mir_instruction(context->function, 0, context->alloca_count++, MirOpcode::Alloca, MirType::Ptr, {});
+  context->function->values[address].constant = (long long)size_of_type(type);
+  context->function->values[address].alignment = alignment;
+  return address;
+}
+
+static MirExpression load_if_lvalue(LoweringContext* context, MirExpression expression)
+{
+  if (!expression.is_lvalue)
+    return expression;
+
+  if (expression.variable >= 0) {
+    start_block_if_terminated(context);
+    return rvalue(expression.type, read_variable(context, expression.variable, context->current_block));
+  }
+
+  // a function designator, e.g. *f, already is the function's address
+  if (expression.type->fundamental_type == FundamentalType::Function)
+    return rvalue(expression.type, expression.value);
+
+  MirValue value = append(context, MirOpcode::Load, value_type(context, expression.type), { expression.value });
+  context->function->values[value].alignment = expression.alignment;
+  context->function->values[value].tbaa_tag = tbaa_tag(context->tbaa, expression.tbaa, expression.type);
+  return rvalue(expression.type, value);
+}
+
+static void emit_store(LoweringContext* context, MirExpression value, MirExpression address)
+{
+  if (address.variable >= 0) {
+    start_block_if_terminated(context);
+    write_variable(context, address.variable, context->current_block, value.value);
+    return;
+  }
+
+  value_type(context, address.type);
+  MirValue store = append(context, MirOpcode::Store, MirType::Void, { value.value, address.value });
+  context->function->values[store].alignment = address.alignment;
+  context->function->values[store].tbaa_tag = tbaa_tag(context->tbaa, address.tbaa, address.type);
+}
+
+static MirExpression pop_value(LoweringContext* context)
+{
+  assert(!context->value_stack.empty() && "Lowering value stack underflow");
+  MirExpression expression = context->value_stack.back();
+  context->value_stack.pop_back();
+  if (expression.value != no_mir_value)
+    expression.value = resolve_phi(context, expression.value);
+  return expression;
+}
+
+static MirExpression pop_rvalue(LoweringContext* context) { return load_if_lvalue(context, pop_value(context)); }
+
+// operands are loaded left to right, even though the rhs is on top of the stack
+static void pop_binary_operands(LoweringContext* context, MirExpression* lhs, MirExpression* rhs)
+{
+  MirExpression rhs_value = pop_value(context);
+  *lhs = pop_rvalue(context);
+  *rhs = load_if_lvalue(context, rhs_value);
+}
+
+// Operations
+
+static MirValue emit_binary(LoweringContext* context, MirOpcode opcode, MirValue lhs, MirValue rhs)
+{
+  return append(context, opcode, context->function->values[lhs].type, { lhs, rhs });
+}
+
+static MirValue emit_flagged_binary(LoweringContext* context, MirOpcode opcode, MirValue lhs, MirValue rhs, uint8_t flags)
+{
+  MirValue result = emit_binary(context, opcode, lhs, rhs);
+  context->function->values[result].flags = flags;
+  return result;
+}
+
+static MirValue emit_compare(LoweringContext* context, MirPredicate predicate, MirValue lhs, MirValue rhs)
+{
+  bool is_float = is_mir_float_type(context->function->values[lhs].type);
+  MirValue comparison = append(context, is_float ? MirOpcode::FCmp : MirOpcode::ICmp, MirType::I1, { lhs, rhs });
+  context->function->values[comparison].predicate = predicate;
+  return comparison;
+}
+
+// comparisons give an i1, C wants an int
+static MirExpression emit_comparison(LoweringContext* context, MirPredicate predicate, MirValue lhs, MirValue rhs)
+{
+  MirValue comparison = emit_compare(context, predicate, lhs, rhs);
+  return rvalue(IntType, append(context, MirOpcode::ZExt, MirType::I32, { comparison }));
+}
+
+// 6.8.4.1, 6.8.5 and 6.5.13 to 6.5.15 a scalar controls a branch by comparing
+// unequal to 0
+static MirValue emit_condition(LoweringContext* context, MirExpression expression)
+{
+  expression = load_if_lvalue(context, expression);
+  MirType type = value_type(context, expression.type);
+  if (type == MirType::I1)
+    return expression.value;
+
+  // the int a comparison, && or || gives is tested as the i1 it came from
+  MirInstruction const& value = context->function->values[expression.value];
+  if (value.opcode == MirOpcode::ZExt && context->function->values[value.operands[0]].type == MirType::I1)
+    return value.operands[0];
+  return emit_compare(context, is_mir_float_type(type) ? MirPredicate::UNe : MirPredicate::Ne, expression.value, zero_value(context, type));
+}
+
+// a constant's value as C sees it, unsigned types zero extended
+static bool c_constant_value(LoweringContext const* context, MirExpression expression, long long* constant)
+{
+  MirInstruction const& value = context->function->values[expression.value];
+  if (value.opcode != MirOpcode::Constant || !is_integer_type(expression.type->fundamental_type))
+    return false;
+
+  unsigned width = mir_type_bit_width(value.type);
+  *constant = value.constant;
+  if (is_unsigned_type(expression.type->fundamental_type) && width < 64)
+    *constant &= (long long)((1ull << width) - 1);
+  return true;
+}
+
+static MirOpcode conversion_opcode(FundamentalType from, FundamentalType to)
+{
+  bool from_is_float = is_floating_type(from);
+  bool to_is_float = is_floating_type(to);
+
+  if (from == FundamentalType::Pointer)
+    return MirOpcode::PtrToInt;
+  if (to == FundamentalType::Pointer)
+    return MirOpcode::IntToPtr;
+
+  if (from_is_float && to_is_float)
+    return fundamental_type_bit_width(to) > fundamental_type_bit_width(from) ? MirOpcode::FPExt : MirOpcode::FPTrunc;
+  if (from_is_float)
+    return is_unsigned_integer_type(to) ? MirOpcode::FPToUI : MirOpcode::FPToSI;
+  if (to_is_float)
+    return is_unsigned_integer_type(from) ? MirOpcode::UIToFP : MirOpcode::SIToFP;
+
+  if (fundamental_type_bit_width(to) < fundamental_type_bit_width(from))
+    return MirOpcode::Trunc;
+  return is_unsigned_integer_type(from) ? MirOpcode::ZExt : MirOpcode::SExt;
+}
+
+// implicit conversions between scalar types, as codegen.cpp's emit_conversion
+// Integer constants are converted right away, and so are those converted to
+// floating point, where C and the host round them the same way
+static MirExpression emit_conversion(LoweringContext* context, MirExpression expression, Type const* to_type)
+{
+  FundamentalType from = expression.type->fundamental_type;
+  FundamentalType to = to_type->fundamental_type;
+
+  // pointers are opaque, and a function designator already is its address
+  if (to == FundamentalType::Pointer && (from == FundamentalType::Pointer || from == FundamentalType::Function))
+    return rvalue(to_type, expression.value);
+
+  MirType from_type = value_type(context, expression.type);
+  MirType mir_to_type = value_type(context, to_type);
+  if (context->is_unsupported)
+    return rvalue(to_type, expression.value);
+
+  long long constant;
+  bool is_constant = c_constant_value(context, expression, &constant);
+
+  // 6.3.1.2 converting to _Bool compares against 0
+  if (to == FundamentalType::Bool) {
+    if (is_constant)
+      return rvalue(to_type, mir_constant(context->function, MirType::I1, constant != 0));
+    return rvalue(to_type, emit_condition(context, expression));
+  }
+
+  bool is_integer_conversion = is_integer_type(from) && is_integer_type(to);
+  if (is_integer_conversion && is_constant)
+    return rvalue(to_type, mir_constant(context->function, mir_to_type, convert_integer_constant(constant, to)));
+  if (is_constant && is_floating_type(to)) {
+    double converted = is_unsigned_type(from) ? (double)(unsigned long long)constant : (double)constant;
+    if (to == FundamentalType::Float)
+      converted = is_unsigned_type(from) ? (float)(unsigned long long)constant : (float)constant;
+    return rvalue(to_type, mir_float_constant(context->function, mir_to_type, converted));
+  }
+
+  // e.g. int and unsigned int are both i32, and where long double is double
+  // converting to it changes nothing either
+  if (from_type == mir_to_type && from != FundamentalType::Pointer && to != FundamentalType::Pointer)
+    return rvalue(to_type, expression.value);
+
+  return rvalue(to_type, append(context, conversion_opcode(from, to), mir_to_type, { expression.value }));
+}
+
+static MirValue integer_constant(LoweringContext* context, Type const* type, long long constant)
+{
+  return mir_constant(context->function, mir_type(type), constant);
+}
+
+// a byte offset of index elements of the given size
+static MirValue scaled_index(LoweringContext* context, MirValue index, unsigned long long element_size)
+{
+  MirInstruction const& index_value = context->function->values[index];
+  if (index_value.opcode == MirOpcode::Constant)
+    return mir_constant(context->function, index_value.type, index_value.constant * (long long)element_size);
+  if (element_size == 1)
+    return index;
+  return emit_flagged_binary(context, MirOpcode::Mul, index, mir_constant(context->function, index_value.type, (long long)element_size), MirNoSignedWrap);
+}
+
+// pointer arithmetic counts in elements of the pointed to type, the index was
+// converted to a ptrdiff_t by semantic analysis. 6.5.6p8 the result points
+// into the same array, or one past its end
+static MirExpression emit_pointer_offset(LoweringContext* context, MirExpression pointer, MirExpression index, bool is_subtraction)
+{
+  MirValue offset = index.value;
+  if (is_subtraction)
+    offset = emit_flagged_binary(context, MirOpcode::Sub, integer_constant(context, index.type, 0), offset, MirNoSignedWrap);
+  offset = scaled_index(context, offset, size_of_type(element_type(pointer.type)));
+  return rvalue(pointer.type, emit_flagged_binary(context, MirOpcode::PtrAdd, pointer.value, offset, MirInBounds));
+}
+
+// 6.5.6.9 the difference of two pointers is in elements, not bytes
+static MirExpression emit_pointer_difference(LoweringContext* context, MirExpression lhs, MirExpression rhs, Type const* difference_type)
+{
+  MirValue lhs_address = emit_conversion(context, lhs, difference_type).value;
+  MirValue rhs_address = emit_conversion(context, rhs, difference_type).value;
+  MirValue byte_difference = emit_flagged_binary(context, MirOpcode::Sub, lhs_address, rhs_address, MirNoSignedWrap);
+
+  long long element_size = (long long)size_of_type(element_type(lhs.type));
+  if (element_size == 1)
+    return rvalue(difference_type, byte_difference);
+  MirValue size = integer_constant(context, difference_type, element_size);
+  return rvalue(difference_type, emit_flagged_binary(context, MirOpcode::SDiv, byte_difference, size, MirExact));
+}
+
+// 6.5.2.3 a member is an lvalue at its offset from the start of its struct,
+// as aligned as both the struct and its offset allow
+static MirExpression emit_member_address(LoweringContext* context, MirExpression struct_address, Type const* struct_type, ASTNode const* access_node)
+{
+  StructLayout const* layout = struct_layout(struct_type);
+  unsigned long long offset = layout->member_offsets[access_node->member_index];
+
+  MirValue address = struct_address.value;
+  if (offset)
+    address = emit_flagged_binary(context, MirOpcode::PtrAdd, address, integer_constant(context, ptrdiff_type(), (long long)offset), MirInBounds);
+
+  unsigned known_alignment = struct_address.alignment ? struct_address.alignment : layout->alignment;
+  while (offset % known_alignment)
+    known_alignment /= 2;
+
+  Type const* member_type = access_node->expression_type;
+  MirExpression member = address_lvalue(member_type, address, known_alignment != alignment_of_type(member_type) ? known_alignment : 0);
+  member.tbaa = tbaa_member_access(struct_address.is_lvalue ? struct_address.tbaa : TBAAAccess {}, struct_type, access_node->member_index);
+  return member;
+}
+
+// 6.5.2.1 an array in memory is indexed in place, a pointer is offset
+static MirExpression emit_subscript(LoweringContext* context, MirExpression base, MirExpression index, Type const* element_type)
+{
+  if (base.type->fundamental_type == FundamentalType::Pointer)
+    base = load_if_lvalue(context, base);
+  else if (!base.is_lvalue || base.type->fundamental_type != FundamentalType::Array)
+    mark_unsupported(context);
+
+  if (context->is_unsupported)
+    return base;
+
+  MirValue offset = scaled_index(context, index.value, size_of_type(element_type));
+  return address_lvalue(element_type, emit_flagged_binary(context, MirOpcode::PtrAdd, base.value, offset, MirInBounds), 0);
+}
+
+// the arguments were lowered left to right and sit on top of the callee
+static MirExpression emit_call(LoweringContext* context, ASTNode const* call_node)
+{
+  size_t argument_count = 0;
+  for (ASTNode const* argument = call_node->rhs; argument; argument = argument->next)
+    argument_count++;
+
+  assert(context->value_stack.size() > argument_count && "Lowering value stack underflow");
+  std::vector<MirExpression> arguments(context->value_stack.end() - (ptrdiff_t)argument_count, context->value_stack.end());
+  context->value_stack.resize(context->value_stack.size() - argument_count);
+
+  // calling through a function pointer loads the pointer
+  MirExpression callee = pop_value(context);
+  Type const* function_type = callee.type;
+  if (function_type->fundamental_type == FundamentalType::Pointer) {
+    callee = load_if_lvalue(context, callee);
+    function_type = function_type->pointed_type;
+  }
+
+  if (function_type->fundamental_type != FundamentalType::Function) {
+    mark_unsupported(context);
+    return callee;
+  }
+
+  FunctionData const* function_data = function_type->function_data;
+  MirType return_type = value_type(context, function_data->return_type);
+
+  // semantic analysis already converted the arguments to the parameter types
+  for (MirExpression& argument : arguments) {
+    argument.value = resolve_phi(context, argument.value);
+    argument = load_if_lvalue(context, argument);
+    value_type(context, argument.type);
+  }
+
+  if (context->is_unsupported)
+    return callee;
+
+  MirValue call = append(context, MirOpcode::Call, return_type, { callee.value });
+  for (MirExpression const& argument : arguments)
+    add_mir_operand(context->function, call, argument.value);
+  context->function->values[call].function_type = function_type;
+  if (call_node->tail_call_kind == TailCallKind::MustTail || (call_node->tail_call_kind == TailCallKind::Tail && !context->has_locals_in_memory))
+    context->function->values[call].tail_call_kind = call_node->tail_call_kind;
+
+  // a void call's value is never used, it just has to take up a stack entry
+  return rvalue(function_data->return_type, return_type == MirType::Void ? no_mir_value : call);
+}
+
+static bool is_lowered_as_loop(LoweringContext const* context, ASTNode const* call_node)
+{
+  return context->recursion_header != no_mir_block && is_self_tail_call(context->function->object, call_node);
+}
+
+// the arguments become the parameters' values for the next time around, all
+// of them evaluated before any parameter changes
+static void emit_self_tail_call(LoweringContext* context)
+{
+  size_t parameter_count = context->function->parameter_count;
+  assert(context->value_stack.size() > parameter_count && "Lowering value stack underflow");
+  std::vector<MirExpression> arguments(context->value_stack.end() - (ptrdiff_t)parameter_count, context->value_stack.end());
+  // the callee below them is the function itself
+  context->value_stack.resize(context->value_stack.size() - parameter_count - 1);
+
+  for (MirExpression& argument : arguments) {
+    argument.value = resolve_phi(context, argument.value);
+    argument = load_if_lvalue(context, argument);
+  }
+
+  start_block_if_terminated(context);
+  for (unsigned i = 0; i < parameter_count; i++) {
+    MirLocal const& parameter = context->locals[i];
+    if (parameter.address == no_mir_value)
+      write_variable(context, (int)i, context->current_block, arguments[i].value);
+    else
+      emit_store(context, arguments[i], address_lvalue(parameter.type, parameter.address, 0));
+  }
+  branch(context, context->recursion_header);
+}
+
+struct SelfTailCallSearch {
+  Object const* function_object;
+  bool is_found;
+};
+
+static void find_self_tail_call(ASTNode const* ast_node, void* search_pointer)
+{
+  SelfTailCallSearch* search = (SelfTailCallSearch*)search_pointer;
+  if (ast_node->type == ASTNodeType::FunctionCall && is_self_tail_call(search->function_object, ast_node))
+    search->is_found = true;
+}
+
+static MirOpcode arithmetic_opcode(ASTNodeType node_type, Type const* type)
+{
+  bool is_float = is_floating_type(type->fundamental_type);
+  bool is_unsigned = is_unsigned_type(type->fundamental_type);
+
+  switch (node_type) {
+  case ASTNodeType::Multiplication:
+    return is_float ? MirOpcode::FMul : MirOpcode::Mul;
+  case ASTNodeType::Division:
+    return is_float ? MirOpcode::FDiv : is_unsigned ? MirOpcode::UDiv : MirOpcode::SDiv;
+  case ASTNodeType::Modulo:
+    return is_unsigned ? MirOpcode::URem : MirOpcode::SRem;
+  case ASTNodeType::Addition:
+    return is_float ? MirOpcode::FAdd : MirOpcode::Add;
+  case ASTNodeType::Subtraction:
+    return is_float ? MirOpcode::FSub : MirOpcode::Sub;
+  case ASTNodeType::BitShiftLeft:
+    return MirOpcode::Shl;
+  case ASTNodeType::BitShiftRight:
+    return is_unsigned ? MirOpcode::LShr : MirOpcode::AShr;
+  case ASTNodeType::BitwiseAnd:
+    return MirOpcode::And;
+  case ASTNodeType::BitwiseXor:
+    return MirOpcode::Xor;
+  case ASTNodeType::BitwiseOr:
+    return MirOpcode::Or;
+  default:
+    assert(false && "Not an arithmetic operator");
+    return MirOpcode::Add;
+  }
+}
+
+static MirValue emit_arithmetic(LoweringContext* context, ASTNodeType operator_type, Type const* type, MirValue lhs, MirValue rhs)
+{
+  return emit_flagged_binary(context, arithmetic_opcode(operator_type, type), lhs, rhs, has_no_signed_wrap(operator_type, type) ? MirNoSignedWrap : 0);
+}
+
+static MirPredicate comparison_predicate(ASTNodeType node_type, Type const* type)
+{
+  bool is_float = is_floating_type(type->fundamental_type);
+  bool is_unsigned = is_unsigned_type(type->fundamental_type);
+
+  switch (node_type) {
+  case ASTNodeType::LessThan:
+    return is_float ? MirPredicate::OLT : is_unsigned ? MirPredicate::ULT : MirPredicate::SLT;
+  case ASTNodeType::LessThanOrEqualTo:
+    return is_float ? MirPredicate::OLE : is_unsigned ? MirPredicate::ULE : MirPredicate::SLE;
+  case ASTNodeType::GreaterThan:
+    return is_float ? MirPredicate::OGT : is_unsigned ? MirPredicate::UGT : MirPredicate::SGT;
+  case ASTNodeType::GreaterThanOrEqualTo:
+    return is_float ? MirPredicate::OGE : is_unsigned ? MirPredicate::UGE : MirPredicate::SGE;
+  case ASTNodeType::EqualityComparison:
+    return is_float ? MirPredicate::OEq : MirPredicate::Eq;
+  case ASTNodeType::InequalityComparison:
+    return is_float ? MirPredicate::UNe : MirPredicate::Ne;
+  default:
+    assert(false && "Not a comparison");
+    return MirPredicate::None;
+  }
+}
+
+// 6.5.16.2 E1 op= E2, the rhs was converted to the type the operation is done
+// in, and the result is converted back to the type of E1
+static MirExpression emit_compound_assignment(LoweringContext* context, ASTNode const* assignment_node, MirExpression lhs, MirExpression rhs)
+{
+  ASTNodeType operator_type = compound_assignment_operator(assignment_node->type);
+  Type const* result_type = assignment_node->expression_type;
+  MirExpression old_value = load_if_lvalue(context, lhs);
+
+  MirExpression new_value;
+  if (old_value.type->fundamental_type == FundamentalType::Pointer) {
+    new_value = emit_pointer_offset(context, old_value, rhs, operator_type == ASTNodeType::Subtraction);
+    new_value.type = result_type;
+  } else {
+    MirExpression operand = emit_conversion(context, old_value, rhs.type);
+    MirValue result = emit_arithmetic(context, operator_type, operand.type, operand.value, rhs.value);
+    new_value = emit_conversion(context, rvalue(rhs.type, result), result_type);
+  }
+
+  emit_store(context, new_value, lhs);
+  return new_value;
+}
+
+// Control flow
+//
+// Each construct gets a frame when it is entered, its blocks are begun as
+// the walk gets to the children that go in them, and where its branches join
+// is begun on exit. A block is sealed once every branch to it is known, which
+// for a loop header is when the back edge is added
+
+static bool is_control_flow(ASTNodeType type)
+{
+  switch (type) {
+  case ASTNodeType::If:
+  case ASTNodeType::For:
+  case ASTNodeType::While:
+  case ASTNodeType::DoWhile:
+  case ASTNodeType::LogicalAnd:
+  case ASTNodeType::LogicalOr:
+  case ASTNodeType::ConditionalExpression:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// the values of expression statements in a branch or loop body are dropped
+static void drop_statement_values(LoweringContext* context, MirControlFrame const& frame) { context->value_stack.resize(frame.value_stack_size); }
+
+// the block a loop branches back to, which isn't sealed until it does. A for
+// loop without a condition runs its body right there, and only leaves it by
+// returning
+static void begin_loop_header(LoweringContext* context, ASTNode const* loop_node, MirControlFrame* frame)
+{
+  frame->header = new_block(context);
+  branch(context, frame->header);
+  begin_block(context, frame->header, false);
+
+  if (loop_node->type == ASTNodeType::For && !loop_node->conditional)
+    frame->exit = new_block(context);
+}
+
+// the condition just walked decides whether the loop runs its body
+static void branch_into_loop_body(LoweringContext* context, MirControlFrame* frame)
+{
+  MirValue condition = emit_condition(context, pop_value(context));
+  uint32_t body = new_block(context);
+  frame->exit = new_block(context);
+  conditional_branch(context, condition, body, frame->exit);
+  begin_block(context, body);
+}
+
+static void enter_control_flow(LoweringContext* context, ASTNode const* ast_node)
+{
+  MirControlFrame frame {};
+  frame.node = ast_node;
+  frame.value_stack_size = context->value_stack.size();
+
+  if (ast_node->type == ASTNodeType::While || ast_node->type == ASTNodeType::DoWhile || (ast_node->type == ASTNodeType::For && !ast_node->lhs))
+    begin_loop_header(context, ast_node, &frame);
+
+  context->control_stack.push_back(frame);
+}
+
+static void after_control_flow_child(LoweringContext* context, ASTNode const* ast_node, ASTNode const* child)
+{
+  MirControlFrame& frame = context->control_stack.back();
+  assert(frame.node == ast_node && "Control flow frames out of step with the walk");
+
+  switch (ast_node->type) {
+  case ASTNodeType::If:
+  case ASTNodeType::ConditionalExpression:
+    if (child == ast_node->conditional) {
+      MirValue condition = emit_condition(context, pop_value(context));
+      uint32_t then_block = new_block(context);
+      frame.false_target = new_block(context);
+      conditional_branch(context, condition, then_block, frame.false_target);
+      begin_block(context, then_block);
+      return;
+    }
+
+    if (child == ast_node->lhs && ast_node->type == ASTNodeType::ConditionalExpression) {
+      MirExpression value = pop_rvalue(context);
+      frame.value = value.value;
+      frame.value_block = context->current_block;
+    }
+
+    if (child == ast_node->lhs && ast_node->rhs) {
+      frame.join = new_block(context);
+      branch(context, frame.join);
+      begin_block(context, frame.false_target);
+    }
+
+    if (ast_node->type == ASTNodeType::If)
+      drop_statement_values(context, frame);
+    return;
+
+  case ASTNodeType::While:
+    if (child == ast_node->conditional)
+      branch_into_loop_body(context, &frame);
+    else
+      drop_statement_values(context, frame);
+    return;
+
+  case ASTNodeType::For:
+    if (child == ast_node->lhs) {
+      drop_statement_values(context, frame);
+      begin_loop_header(context, ast_node, &frame);
+    } else if (child == ast_node->conditional) {
+      branch_into_loop_body(context, &frame);
+    } else if (child == ast_node->body) {
+      drop_statement_values(context, frame);
+      if (ast_node->rhs) {
+        uint32_t increment = new_block(context);
+        branch(context, increment);
+        begin_block(context, increment);
+      }
+    } else {
+      drop_statement_values(context, frame);
+    }
+    return;
+
+  case ASTNodeType::DoWhile:
+    if (child == ast_node->body) {
+      drop_statement_values(context, frame);
+      return;
+    }
+    {
+      MirValue condition = emit_condition(context, pop_value(context));
+      frame.exit = new_block(context);
+      conditional_branch(context, condition, frame.header, frame.exit);
+      seal_block(context, frame.header);
+      begin_block(context, frame.exit);
+    }
+    return;
+
+  // 6.5.13 and 6.5.14 the rhs is only evaluated if the lhs doesn't already
+  // decide the result
+  case ASTNodeType::LogicalAnd:
+  case ASTNodeType::LogicalOr:
+    if (child == ast_node->lhs) {
+      bool is_and = ast_node->type == ASTNodeType::LogicalAnd;
+      MirValue condition = emit_condition(context, pop_value(context));
+      uint32_t rhs_block = new_block(context);
+      frame.join = new_block(context);
+      frame.value = mir_constant(context->function, MirType::I1, !is_and);
+      frame.value_block = context->current_block;
+      if (is_and)
+        conditional_branch(context, condition, rhs_block, frame.join);
+      else
+        conditional_branch(context, condition, frame.join, rhs_block);
+      begin_block(context, rhs_block);
+    }
+    return;
+
+  default:
+    return;
+  }
+}
+
+// the phi where the two ways through && and || or ?: join
+static MirValue join_values(LoweringContext* context, MirControlFrame const& frame, MirType type, MirValue value)
+{
+  uint32_t value_block = context->current_block;
+  branch(context, frame.join);
+  begin_block(context, frame.join);
+
+  MirValue phi = insert_mir_instruction(context->function, frame.join, 0, MirOpcode::Phi, type, {});
+  add_mir_phi_incoming(context->function, phi, frame.value, frame.value_block);
+  add_mir_phi_incoming(context->function, phi, value, value_block);
+  return phi;
+}
+
+static void exit_control_flow(LoweringContext* context, ASTNode const* ast_node)
+{
+  MirControlFrame frame = context->control_stack.back();
+  context->control_stack.pop_back();
+
+  switch (ast_node->type) {
+  case ASTNodeType::If:
+    drop_statement_values(context, frame);
+    if (!ast_node->rhs)
+      frame.join = frame.false_target;
+    branch(context, frame.join);
+    begin_block(context, frame.join);
+    return;
+
+  case ASTNodeType::While:
+  case ASTNodeType::For:
+    drop_statement_values(context, frame);
+    branch(context, frame.header);
+    seal_block(context, frame.header);
+    begin_block(context, frame.exit);
+    return;
+
+  case ASTNodeType::DoWhile:
+    drop_statement_values(context, frame);
+    return;
+
+  case ASTNodeType::LogicalAnd:
+  case ASTNodeType::LogicalOr: {
+    MirValue rhs = emit_condition(context, pop_value(context));
+    MirValue result = join_values(context, frame, MirType::I1, rhs);
+    context->value_stack.push_back(rvalue(IntType, append(context, MirOpcode::ZExt, MirType::I32, { result })));
+    return;
+  }
+
+  case ASTNodeType::ConditionalExpression: {
+    MirExpression rhs = pop_rvalue(context);
+    Type const* result_type = ast_node->expression_type;
+    MirType type = value_type(context, result_type);
+    if (type == MirType::Void) {
+      branch(context, frame.join);
+      begin_block(context, frame.join);
+      context->value_stack.push_back(rvalue(result_type, no_mir_value));
+      return;
+    }
+    context->value_stack.push_back(rvalue(result_type, join_values(context, frame, type, rhs.value)));
+    return;
+  }
+
+  default:
+    assert(false && "Not control flow");
+  }
+}
+
+// Statements and expressions, visited in post order like codegen.cpp's
+// emit_code_from_node
+
+static void lower_declaration(LoweringContext* context, ASTNode const* ast_node)
+{
+  Object const* object = ast_node->object;
+  assert(object && "Lowering a declaration with null object");
+
+  // block scope extern and function declarations only introduce a name
+  if (object->local_slot < 0) {
+    if (object->declaration_specifiers.flags & TypeModifierFlag::Static)
+      mark_unsupported(context);
+    return;
+  }
+
+  // the initializer was lowered first, as the declaration's child
+  MirExpression initial_value {};
+  if (ast_node->rhs)
+    initial_value = pop_rvalue(context);
+
+  if (is_promoted_local(object)) {
+    context->locals[object->local_slot] = { object->type, no_mir_value, 0 };
+    if (ast_node->rhs)
+      emit_store(context, initial_value, variable_lvalue(object->type, object->local_slot));
+    return;
+  }
+
+  unsigned alignment = allocation_alignment(object, *context->options);
+  MirValue address = emit_alloca(context, object->type, alignment);
+  unsigned access_alignment = stricter_alignment(object->type, alignment);
+  context->locals[object->local_slot] = { object->type, address, access_alignment };
+
+  if (ast_node->rhs)
+    emit_store(context, initial_value, address_lvalue(object->type, address, access_alignment));
+}
+
+static void lower_variable_reference(LoweringContext* context, ASTNode const* ast_node)
+{
+  Object const* object = ast_node->object;
+  assert(object && "Lowering a variable reference that was never resolved");
+
+  // functions designate the function itself, objects with static storage are
+  // lvalues at their global's address
+  if (object->local_slot < 0) {
+    MirValue global = mir_global(context->function, object);
+    if (object->type->fundamental_type == FundamentalType::Function)
+      context->value_stack.push_back(rvalue(object->type, global));
+    else
+      context->value_stack.push_back(address_lvalue(object->type, global, stricter_alignment(object->type, declared_alignment(object))));
+    return;
+  }
+
+  MirLocal const& local = context->locals[object->local_slot];
+  if (local.address == no_mir_value)
+    context->value_stack.push_back(variable_lvalue(local.type, object->local_slot));
+  else
+    context->value_stack.push_back(address_lvalue(local.type, local.address, local.alignment));
+}
+
+static void lower_node_on_exit(LoweringContext* context, ASTNode const* ast_node)
+{
+  if (ast_node->expression_type && ast_node->expression_type->fundamental_type == FundamentalType::Vector) {
+    mark_unsupported(context);
+    return;
+  }
+
+  if (is_control_flow(ast_node->type)) {
+    exit_control_flow(context, ast_node);
+    return;
+  }
+
+  switch (ast_node->type) {
+  case ASTNodeType::Void:
+    return;
+
+  case ASTNodeType::NumericConstant:
+    context->value_stack.push_back(
+        rvalue(ast_node->expression_type, mir_constant(context->function, value_type(context, ast_node->expression_type), numeric_constant_value(ast_node))));
+    return;
+
+  case ASTNodeType::ImplicitConversion:
+    context->value_stack.push_back(emit_conversion(context, pop_rvalue(context), ast_node->expression_type));
+    return;
+
+  case ASTNodeType::VariableReference:
+    lower_variable_reference(context, ast_node);
+    return;
+
+  case ASTNodeType::FunctionCall:
+    if (is_lowered_as_loop(context, ast_node)) {
+      emit_self_tail_call(context);
+      return;
+    }
+    context->value_stack.push_back(emit_call(context, ast_node));
+    return;
+
+  case ASTNodeType::MemberAccess: {
+    MirExpression struct_value = pop_value(context);
+    if (!struct_value.is_lvalue) {
+      mark_unsupported(context);
+      return;
+    }
+    context->value_stack.push_back(emit_member_address(context, struct_value, struct_value.type, ast_node));
+    return;
+  }
+
+  case ASTNodeType::PointerMemberAccess: {
+    MirExpression pointer = pop_rvalue(context);
+    context->value_stack.push_back(emit_member_address(context, pointer, pointer.type->pointed_type, ast_node));
+    return;
+  }
+
+  case ASTNodeType::Subscript: {
+    MirExpression index = pop_rvalue(context);
+    context->value_stack.push_back(emit_subscript(context, pop_value(context), index, ast_node->expression_type));
+    return;
+  }
+
+  case ASTNodeType::Declaration:
+    lower_declaration(context, ast_node);
+    return;
+
+  case ASTNodeType::Return:
+    // a call to the function itself already jumped back to its start
+    if (ast_node->rhs && is_lowered_as_loop(context, ast_node->rhs))
+      return;
+    if (ast_node->rhs)
+      terminate(context, MirOpcode::Ret, { pop_rvalue(context).value });
+    else
+      terminate(context, MirOpcode::Ret, {});
+    return;
+
+  case ASTNodeType::Addition:
+  case ASTNodeType::Subtraction: {
+    MirExpression lhs, rhs;
+    pop_binary_operands(context, &lhs, &rhs);
+    bool is_subtraction = ast_node->type == ASTNodeType::Subtraction;
+
+    if (lhs.type->fundamental_type == FundamentalType::Pointer && rhs.type->fundamental_type == FundamentalType::Pointer)
+      context->value_stack.push_back(emit_pointer_difference(context, lhs, rhs, ast_node->expression_type));
+    else if (lhs.type->fundamental_type == FundamentalType::Pointer)
+      context->value_stack.push_back(emit_pointer_offset(context, lhs, rhs, is_subtraction));
+    else if (rhs.type->fundamental_type == FundamentalType::Pointer)
+      context->value_stack.push_back(emit_pointer_offset(context, rhs, lhs, false));
+    else
+      context->value_stack.push_back(rvalue(lhs.type, emit_arithmetic(context, ast_node->type, lhs.type, lhs.value, rhs.value)));
+    return;
+  }
+
+    // semantic analysis converted both operands to the type of the result
+  case ASTNodeType::Multiplication:
+  case ASTNodeType::Division:
+  case ASTNodeType::Modulo:
+  case ASTNodeType::BitShiftLeft:
+  case ASTNodeType::BitShiftRight:
+  case ASTNodeType::BitwiseAnd:
+  case ASTNodeType::BitwiseXor:
+  case ASTNodeType::BitwiseOr: {
+    MirExpression lhs, rhs;
+    pop_binary_operands(context, &lhs, &rhs);
+
+    // shifts only promote their rhs, LLVM wants it the width of the lhs
+    if (rhs.type != lhs.type)
+      rhs = emit_conversion(context, rhs, lhs.type);
+
+    context->value_stack.push_back(rvalue(lhs.type, emit_arithmetic(context, ast_node->type, lhs.type, lhs.value, rhs.value)));
+    return;
+  }
+
+  case ASTNodeType::GreaterThan:
+  case ASTNodeType::GreaterThanOrEqualTo:
+  case ASTNodeType::LessThan:
+  case ASTNodeType::LessThanOrEqualTo:
+  case ASTNodeType::EqualityComparison:
+  case ASTNodeType::InequalityComparison: {
+    MirExpression lhs, rhs;
+    pop_binary_operands(context, &lhs, &rhs);
+    context->value_stack.push_back(emit_comparison(context, comparison_predicate(ast_node->type, lhs.type), lhs.value, rhs.value));
+    return;
+  }
+
+  case ASTNodeType::Assignment: {
+    MirExpression rhs = pop_rvalue(context);
+    MirExpression lhs = pop_value(context);
+    if (!lhs.is_lvalue) {
+      mark_unsupported(context);
+      return;
+    }
+
+    emit_store(context, rhs, lhs);
+    context->value_stack.push_back(rhs);
+    return;
+  }
+
+  case ASTNodeType::MultiplicationAssignment:
+  case ASTNodeType::DivisionAssignment:
+  case ASTNodeType::ModuloAssignment:
+  case ASTNodeType::AdditionAssignment:
+  case ASTNodeType::SubtractionAssignment:
+  case ASTNodeType::BitShiftLeftAssignment:
+  case ASTNodeType::BitShiftRightAssignment:
+  case ASTNodeType::BitwiseAndAssignment:
+  case ASTNodeType::BitwiseXorAssignment:
+  case ASTNodeType::BitwiseOrAssignment: {
+    MirExpression rhs = pop_rvalue(context);
+    MirExpression lhs = pop_value(context);
+    if (!lhs.is_lvalue || is_atomic_type(lhs.type)) {
+      mark_unsupported(context);
+      return;
+    }
+
+    context->value_stack.push_back(emit_compound_assignment(context, ast_node, lhs, rhs));
+    return;
+  }
+
+  case ASTNodeType::Negation: {
+    MirExpression operand = pop_rvalue(context);
+    if (is_floating_type(operand.type->fundamental_type)) {
+      MirType type = value_type(context, operand.type);
+      context->value_stack.push_back(rvalue(operand.type, append(context, MirOpcode::FNeg, type, { operand.value })));
+      return;
+    }
+    MirValue zero = integer_constant(context, operand.type, 0);
+    uint8_t flags = has_no_signed_wrap(ASTNodeType::Subtraction, operand.type) ? MirNoSignedWrap : 0;
+    context->value_stack.push_back(rvalue(operand.type, emit_flagged_binary(context, MirOpcode::Sub, zero, operand.value, flags)));
+    return;
+  }
+
+  case ASTNodeType::BitwiseNot: {
+    MirExpression operand = pop_rvalue(context);
+    context->value_stack.push_back(rvalue(operand.type, emit_binary(context, MirOpcode::Xor, operand.value, integer_constant(context, operand.type, -1))));
+    return;
+  }
+
+  case ASTNodeType::LogicalNot: {
+    MirExpression operand = pop_rvalue(context);
+    MirType type = value_type(context, operand.type);
+    bool is_float = is_mir_float_type(type);
+    context->value_stack.push_back(emit_comparison(context, is_float ? MirPredicate::OEq : MirPredicate::Eq, operand.value, zero_value(context, type)));
+    return;
+  }
+
+  case ASTNodeType::AddressOf: {
+    // a function designator's address is the function itself
+    MirExpression operand = pop_value(context);
+    if (operand.is_lvalue && operand.variable >= 0)
+      mark_unsupported(context);
+    context->value_stack.push_back(rvalue(ast_node->expression_type, operand.value));
+    return;
+  }
+
+  case ASTNodeType::Dereference: {
+    // the pointer's value is the lvalue's address
+    MirExpression operand = pop_rvalue(context);
+    if (operand.type->fundamental_type != FundamentalType::Pointer || is_mir_constant(context->function, operand.value)) {
+      mark_unsupported(context);
+      return;
+    }
+    context->value_stack.push_back(address_lvalue(ast_node->expression_type, operand.value, 0));
+    return;
+  }
+
+    // atomics, vector builtins and switch, which codegen.cpp emits or rejects
+  default:
+    mark_unsupported(context);
+    return;
+  }
+}
+
+static void lower_node(ASTNode const* ast_node, ASTWalkEvent event, unsigned child_index, void* context_pointer)
+{
+  LoweringContext* context = (LoweringContext*)context_pointer;
+  if (context->is_unsupported)
+    return;
+
+  switch (event) {
+  case ASTWalkEvent::Enter:
+    if (is_control_flow(ast_node->type)) {
+      start_block_if_terminated(context);
+      enter_control_flow(context, ast_node);
+    }
+    return;
+
+  case ASTWalkEvent::AfterChild:
+    if (is_control_flow(ast_node->type)) {
+      ASTNode const* children[max_ast_children];
+      ast_node_children(ast_node, children);
+      after_control_flow_child(context, ast_node, children[child_index]);
+    }
+    return;
+
+  case ASTWalkEvent::Exit:
+    lower_node_on_exit(context, ast_node);
+    return;
+  }
+}
+
+// falling off the end of a function: fine for void, main returns 0, and
+// anything else that uses the value has undefined behavior
+static void emit_implicit_return(LoweringContext* context, Object const* function_object)
+{
+  if (context->block_terminated)
+    return;
+
+  MirType return_type = context->function->return_type;
+  if (return_type == MirType::Void)
+    terminate(context, MirOpcode::Ret, {});
+  else if (function_object->identifier == "main")
+    terminate(context, MirOpcode::Ret, { zero_value(context, return_type) });
+  else
+    terminate(context, MirOpcode::Unreachable, {});
+}
+
+static bool has_mir_signature(Object const* function_object)
+{
+  FunctionData const* function_data = function_object->type->function_data;
+  if (!is_mir_type(function_data->return_type))
+    return false;
+  for (FunctionParameter const* parameter = function_data->parameter_list; parameter; parameter = parameter->next_parameter)
+    if (!is_mir_type(parameter->parameter_type) || parameter->parameter_type->fundamental_type == FundamentalType::Void)
+      return false;
+  return true;
+}
+
+MirFunction* lower_function_to_mir(Object const* function_object, CodegenOptions const& options, TBAAMetadata const* tbaa)
+{
+  assert(function_object->function_body);
+  if (!has_mir_signature(function_object))
+    return nullptr;
+
+  LoweringContext context;
+  context.function = new_mir_function(function_object);
+  context.options = &options;
+  context.tbaa = tbaa;
+  context.is_unsupported = false;
+  context.current_block = 0;
+  context.block_terminated = false;
+  context.blocks.push_back({ true, {}, {} });
+  context.locals.resize(function_object->local_count);
+  context.alloca_count = 0;
+  context.has_locals_in_memory = has_locals_in_memory(function_object);
+  context.recursion_header = no_mir_block;
+
+  // parameters take the first slots, in order. Those that aren't promoted get
+  // a stack slot, so that their address can be taken
+  for (unsigned i = 0; i < context.function->parameter_count; i++) {
+    Object const* parameter = function_object->parameter_objects[i];
+    if (is_promoted_local(parameter)) {
+      context.locals[i] = { parameter->type, no_mir_value, 0 };
+      write_variable(&context, (int)i, 0, i);
+      continue;
+    }
+
+    MirValue address = emit_alloca(&context, parameter->type, alignment_of_type(parameter->type));
+    context.locals[i] = { parameter->type, address, 0 };
+    emit_store(&context, rvalue(parameter->type, i), address_lvalue(parameter->type, address, 0));
+  }
+
+  // the parameters are set up once, before the loop
+  SelfTailCallSearch search = { function_object, false };
+  for (ASTNode const* statement = function_object->function_body; statement && !search.is_found; statement = statement->next)
+    walk_ast_post_order(statement, find_self_tail_call, &search);
+  if (search.is_found) {
+    context.recursion_header = new_block(&context);
+    branch(&context, context.recursion_header);
+    begin_block(&context, context.recursion_header, false);
+  }
+
+  // each statement is walked on its own, whatever value an expression
+  // statement leaves behind is dropped before the next one
+  for (ASTNode const* statement = function_object->function_body; statement && !context.is_unsupported; statement = statement->next) {
+    walk_ast(statement, lower_node, &context);
+    context.value_stack.clear();
+  }
+
+  if (context.is_unsupported) {
+    free_mir_function(context.function);
+    return nullptr;
+  }
+
+  if (context.recursion_header != no_mir_block)
+    seal_block(&context, context.recursion_header);
+  emit_implicit_return(&context, function_object);
+  return context.function;
+}
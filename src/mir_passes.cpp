@@ -0,0 +1,914 @@
+#include "mir.h"
+
+#include <algorithm>
+#include <cassert>
+#include <climits>
+#include <map>
+#include <stdio.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Passes over the mid-level IR
+//
+// Each one walks a single function and keeps it well formed, so they can run
+// in any order, and any number of times. In debug builds the function is
+// verified after every pass
+
+// pure instructions compute a value from their operands and nothing else, so
+// they can be moved or merged with an identical one
+static bool is_pure(MirOpcode opcode)
+{
+  switch (opcode) {
+  case MirOpcode::Add:
+  case MirOpcode::Sub:
+  case MirOpcode::Mul:
+  case MirOpcode::SDiv:
+  case MirOpcode::UDiv:
+  case MirOpcode::SRem:
+  case MirOpcode::URem:
+  case MirOpcode::Shl:
+  case MirOpcode::LShr:
+  case MirOpcode::AShr:
+  case MirOpcode::And:
+  case MirOpcode::Or:
+  case MirOpcode::Xor:
+  case MirOpcode::FAdd:
+  case MirOpcode::FSub:
+  case MirOpcode::FMul:
+  case MirOpcode::FDiv:
+  case MirOpcode::FNeg:
+  case MirOpcode::ICmp:
+  case MirOpcode::FCmp:
+  case MirOpcode::Trunc:
+  case MirOpcode::ZExt:
+  case MirOpcode::SExt:
+  case MirOpcode::FPTrunc:
+  case MirOpcode::FPExt:
+  case MirOpcode::FPToSI:
+  case MirOpcode::FPToUI:
+  case MirOpcode::SIToFP:
+  case MirOpcode::UIToFP:
+  case MirOpcode::PtrToInt:
+  case MirOpcode::IntToPtr:
+  case MirOpcode::PtrAdd:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// a call to a function that touches no memory computes its result from its
+// arguments alone, so it can be merged with an identical one like a pure
+// instruction, and moved too if it is speculatable, see mir_may_trap
+static bool is_readnone_call(MirFunction const* function, MirValue value)
+{
+  MirInstruction const& instruction = function->values[value];
+  if (instruction.opcode != MirOpcode::Call || instruction.type == MirType::Void || instruction.tail_call_kind == TailCallKind::MustTail)
+    return false;
+  Object const* callee = mir_called_function(function, value);
+  if (!callee)
+    return false;
+  FunctionAttributes const& attributes = callee->inferred_attributes;
+  return !attributes.reads_argument_memory && !attributes.writes_argument_memory && !attributes.reads_other_memory && !attributes.writes_other_memory;
+}
+
+// an unused call can go if it writes no memory and always returns
+static bool is_removable_call(MirFunction const* function, MirValue value)
+{
+  if (function->values[value].opcode != MirOpcode::Call || function->values[value].tail_call_kind == TailCallKind::MustTail)
+    return false;
+  Object const* callee = mir_called_function(function, value);
+  return callee && !callee->inferred_attributes.writes_argument_memory && !callee->inferred_attributes.writes_other_memory
+         && callee->inferred_attributes.will_return;
+}
+
+// Constant folding, on integers and pointers only. Floating point arithmetic
+// depends on the target's rounding, so it is left to LLVM
+
+static long long zero_extend(MirType type, long long constant)
+{
+  unsigned width = mir_type_bit_width(type);
+  return width >= 64 ? constant : (long long)((unsigned long long)constant & ((1ull << width) - 1));
+}
+
+static bool fold_comparison(MirPredicate predicate, MirType type, long long lhs, long long rhs, long long* result)
+{
+  unsigned long long unsigned_lhs = (unsigned long long)zero_extend(type, lhs);
+  unsigned long long unsigned_rhs = (unsigned long long)zero_extend(type, rhs);
+
+  switch (predicate) {
+  case MirPredicate::Eq:
+    *result = lhs == rhs;
+    return true;
+  case MirPredicate::Ne:
+    *result = lhs != rhs;
+    return true;
+  case MirPredicate::SLT:
+    *result = lhs < rhs;
+    return true;
+  case MirPredicate::SLE:
+    *result = lhs <= rhs;
+    return true;
+  case MirPredicate::SGT:
+    *result = lhs > rhs;
+    return true;
+  case MirPredicate::SGE:
+    *result = lhs >= rhs;
+    return true;
+  case MirPredicate::ULT:
+    *result = unsigned_lhs < unsigned_rhs;
+    return true;
+  case MirPredicate::ULE:
+    *result = unsigned_lhs <= unsigned_rhs;
+    return true;
+  case MirPredicate::UGT:
+    *result = unsigned_lhs > unsigned_rhs;
+    return true;
+  case MirPredicate::UGE:
+    *result = unsigned_lhs >= unsigned_rhs;
+    return true;
+  default:
+    return false;
+  }
+}
+
+// operations LLVM leaves undefined, e.g. dividing by 0 or shifting by the
+// width or more, aren't folded
+static bool fold_instruction(MirFunction const* function, MirInstruction const& instruction, long long const* operands, long long* result)
+{
+  MirType type = instruction.type;
+  MirType operand_type = instruction.operands.size ? function->values[instruction.operands[0]].type : MirType::Void;
+  if (is_mir_float_type(type) || is_mir_float_type(operand_type))
+    return false;
+
+  unsigned width = mir_type_bit_width(operand_type);
+  long long lhs = operands[0];
+  long long rhs = instruction.operands.size > 1 ? operands[1] : 0;
+  unsigned long long unsigned_lhs = (unsigned long long)zero_extend(operand_type, lhs);
+  unsigned long long unsigned_rhs = (unsigned long long)zero_extend(operand_type, rhs);
+  long long smallest = width >= 64 ? LLONG_MIN : -(1ll << (width - 1));
+
+  long long value;
+  switch (instruction.opcode) {
+  case MirOpcode::Add:
+    value = (long long)(unsigned_lhs + unsigned_rhs);
+    break;
+  case MirOpcode::Sub:
+    value = (long long)(unsigned_lhs - unsigned_rhs);
+    break;
+  case MirOpcode::Mul:
+    value = (long long)(unsigned_lhs * unsigned_rhs);
+    break;
+  case MirOpcode::SDiv:
+  case MirOpcode::SRem:
+    if (rhs == 0 || (rhs == -1 && lhs == smallest) || type == MirType::I1)
+      return false;
+    value = instruction.opcode == MirOpcode::SDiv ? lhs / rhs : lhs % rhs;
+    break;
+  case MirOpcode::UDiv:
+  case MirOpcode::URem:
+    if (unsigned_rhs == 0)
+      return false;
+    value = (long long)(instruction.opcode == MirOpcode::UDiv ? unsigned_lhs / unsigned_rhs : unsigned_lhs % unsigned_rhs);
+    break;
+  case MirOpcode::Shl:
+  case MirOpcode::LShr:
+  case MirOpcode::AShr:
+    if (unsigned_rhs >= width)
+      return false;
+    if (instruction.opcode == MirOpcode::Shl)
+      value = (long long)(unsigned_lhs << unsigned_rhs);
+    else if (instruction.opcode == MirOpcode::LShr)
+      value = (long long)(unsigned_lhs >> unsigned_rhs);
+    else
+      value = lhs >> unsigned_rhs;
+    break;
+  case MirOpcode::And:
+    value = lhs & rhs;
+    break;
+  case MirOpcode::Or:
+    value = lhs | rhs;
+    break;
+  case MirOpcode::Xor:
+    value = lhs ^ rhs;
+    break;
+  case MirOpcode::ICmp:
+    return fold_comparison(instruction.predicate, operand_type, lhs, rhs, result);
+  case MirOpcode::Trunc:
+  case MirOpcode::PtrToInt:
+    value = lhs;
+    break;
+  case MirOpcode::ZExt:
+  case MirOpcode::IntToPtr:
+    value = (long long)unsigned_lhs;
+    break;
+  case MirOpcode::SExt:
+    // i1 constants are 0 or 1, the others already sign extended
+    value = operand_type == MirType::I1 ? -lhs : lhs;
+    break;
+  default:
+    return false;
+  }
+
+  *result = normalize_mir_constant(type, value);
+  return true;
+}
+
+// Sparse conditional constant propagation
+//
+// Wegman and Zadeck, "Constant Propagation with Conditional Branches". Values
+// start out unknown and only ever move down to a constant, then to
+// overdefined. Blocks are only visited once an edge to them is found to be
+// executable, so a branch on a constant never makes the other side's values
+// overdefined. Afterwards constant values replace their instructions, and
+// branches on constants become unconditional; blocks that became unreachable
+// are left to dce
+
+enum class LatticeState : uint8_t { Unknown, Constant, Overdefined };
+
+struct SccpContext {
+  MirFunction* function;
+  std::vector<LatticeState> states;
+  std::vector<long long> constants;
+  std::vector<bool> is_block_executable;
+  std::unordered_set<unsigned long long> executable_edges;
+  std::vector<uint32_t> block_worklist;
+  std::vector<MirValue> value_worklist;
+};
+
+static unsigned long long edge_key(uint32_t from, uint32_t to) { return (unsigned long long)from << 32 | to; }
+
+static void lower_lattice(SccpContext* context, MirValue value, LatticeState state, long long constant)
+{
+  LatticeState& current = context->states[value];
+  if (state <= current && !(state == LatticeState::Constant && current == LatticeState::Constant && context->constants[value] != constant))
+    return;
+
+  // two different constants meet at overdefined
+  if (state == LatticeState::Constant && current == LatticeState::Constant)
+    state = LatticeState::Overdefined;
+
+  current = state;
+  context->constants[value] = constant;
+  context->value_worklist.push_back(value);
+}
+
+static void mark_edge_executable(SccpContext* context, uint32_t from, uint32_t to)
+{
+  if (!context->executable_edges.insert(edge_key(from, to)).second)
+    return;
+
+  // a block already visited only has to have its phis visited again, for the
+  // new incoming value
+  if (!context->is_block_executable[to]) {
+    context->is_block_executable[to] = true;
+    context->block_worklist.push_back(to);
+    return;
+  }
+
+  for (MirValue value : context->function->blocks[to].instructions) {
+    if (context->function->values[value].opcode != MirOpcode::Phi)
+      break;
+    context->value_worklist.push_back(value);
+  }
+}
+
+static void visit_instruction(SccpContext* context, MirValue value)
+{
+  MirFunction* function = context->function;
+  MirInstruction const& instruction = function->values[value];
+  uint32_t block = instruction.block;
+
+  switch (instruction.opcode) {
+  case MirOpcode::Phi: {
+    for (uint32_t i = 0; i < instruction.operands.size; i++) {
+      if (!context->executable_edges.count(edge_key(instruction.incoming_blocks[i], block)))
+        continue;
+      MirValue operand = instruction.operands[i];
+      lower_lattice(context, value, context->states[operand], context->constants[operand]);
+    }
+    return;
+  }
+
+  case MirOpcode::Br:
+    mark_edge_executable(context, block, function->blocks[block].successors[0]);
+    return;
+
+  case MirOpcode::CondBr: {
+    MirValue condition = instruction.operands[0];
+    MirArray<uint32_t> const& successors = function->blocks[block].successors;
+    if (context->states[condition] == LatticeState::Constant) {
+      mark_edge_executable(context, block, successors[context->constants[condition] ? 0 : 1]);
+    } else if (context->states[condition] == LatticeState::Overdefined) {
+      mark_edge_executable(context, block, successors[0]);
+      mark_edge_executable(context, block, successors[1]);
+    }
+    return;
+  }
+
+  default:
+    break;
+  }
+
+  if (instruction.type == MirType::Void)
+    return;
+
+  if (!is_pure(instruction.opcode)) {
+    lower_lattice(context, value, LatticeState::Overdefined, 0);
+    return;
+  }
+
+  long long operands[2] = {};
+  for (uint32_t i = 0; i < instruction.operands.size; i++) {
+    MirValue operand = instruction.operands[i];
+    if (context->states[operand] == LatticeState::Overdefined) {
+      lower_lattice(context, value, LatticeState::Overdefined, 0);
+      return;
+    }
+    if (context->states[operand] == LatticeState::Unknown)
+      return;
+    operands[i] = context->constants[operand];
+  }
+
+  long long result;
+  if (fold_instruction(function, instruction, operands, &result))
+    lower_lattice(context, value, LatticeState::Constant, result);
+  else
+    lower_lattice(context, value, LatticeState::Overdefined, 0);
+}
+
+// a branch on a constant only keeps the edge it takes
+static void fold_conditional_branch(MirFunction* function, uint32_t block, MirValue branch, bool condition)
+{
+  uint32_t taken = function->blocks[block].successors[condition ? 0 : 1];
+  uint32_t not_taken = function->blocks[block].successors[condition ? 1 : 0];
+
+  erase_mir_instruction(function, branch);
+  append_mir_instruction(function, block, MirOpcode::Br, MirType::Void, {});
+  remove_mir_edge(function, block, not_taken);
+
+  // the edge taken is now the only successor, in slot 0
+  assert(function->blocks[block].successors.size == 1 && function->blocks[block].successors[0] == taken);
+  (void)taken;
+}
+
+bool run_sccp(MirFunction* function)
+{
+  SccpContext context;
+  context.function = function;
+  context.states.assign(function->values.size(), LatticeState::Unknown);
+  context.constants.assign(function->values.size(), 0);
+  context.is_block_executable.assign(function->blocks.size(), false);
+
+  for (MirValue value = 0; value < function->values.size(); value++) {
+    MirInstruction const& instruction = function->values[value];
+    if (instruction.opcode == MirOpcode::Constant) {
+      context.states[value] = LatticeState::Constant;
+      context.constants[value] = instruction.constant;
+    } else if (instruction.block == no_mir_block) {
+      context.states[value] = LatticeState::Overdefined;
+    }
+  }
+
+  context.is_block_executable[0] = true;
+  context.block_worklist.push_back(0);
+
+  while (!context.block_worklist.empty() || !context.value_worklist.empty()) {
+    while (!context.value_worklist.empty()) {
+      MirValue value = context.value_worklist.back();
+      context.value_worklist.pop_back();
+
+      // the users of a value that changed, and phis whose edges did
+      MirInstruction const& instruction = function->values[value];
+      if (instruction.opcode == MirOpcode::Phi && context.is_block_executable[instruction.block])
+        visit_instruction(&context, value);
+      for (MirUse use : function->values[value].uses) {
+        uint32_t user_block = function->values[use.user].block;
+        if (user_block != no_mir_block && context.is_block_executable[user_block])
+          visit_instruction(&context, use.user);
+      }
+    }
+
+    if (!context.block_worklist.empty()) {
+      uint32_t block = context.block_worklist.back();
+      context.block_worklist.pop_back();
+      MirArray<MirValue> instructions = function->blocks[block].instructions;
+      for (MirValue value : instructions)
+        visit_instruction(&context, value);
+    }
+  }
+
+  // constants first, so all conditions that are constant are by the time the
+  // branches are looked at
+  bool changed = false;
+  for (uint32_t block = 0; block < function->blocks.size(); block++) {
+    if (!context.is_block_executable[block])
+      continue;
+
+    std::vector<MirValue> instructions(function->blocks[block].instructions.begin(), function->blocks[block].instructions.end());
+    for (MirValue value : instructions) {
+      MirInstruction const& instruction = function->values[value];
+      if (instruction.type == MirType::Void || context.states[value] != LatticeState::Constant)
+        continue;
+      replace_all_mir_uses(function, value, mir_constant(function, instruction.type, context.constants[value]));
+      erase_mir_instruction(function, value);
+      changed = true;
+    }
+  }
+
+  for (uint32_t block = 0; block < function->blocks.size(); block++) {
+    if (!context.is_block_executable[block])
+      continue;
+
+    MirValue branch = mir_terminator(function, block);
+    MirInstruction const& instruction = function->values[branch];
+    if (instruction.opcode == MirOpcode::CondBr && is_mir_constant(function, instruction.operands[0])) {
+      fold_conditional_branch(function, block, branch, function->values[instruction.operands[0]].constant);
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+// Dead code elimination
+//
+// Blocks no path from the entry reaches are removed. Then instructions are
+// marked live starting from those with side effects and following operands,
+// which also finds dead cycles, e.g. the phi of a counter nothing reads.
+// Finally a block that is its predecessor's only successor, and has no other
+// predecessor, is merged into it
+
+static bool remove_unreachable_blocks(MirFunction* function)
+{
+  std::vector<bool> is_reachable(function->blocks.size());
+  std::vector<uint32_t> worklist { 0 };
+  is_reachable[0] = true;
+  while (!worklist.empty()) {
+    uint32_t block = worklist.back();
+    worklist.pop_back();
+    for (uint32_t successor : function->blocks[block].successors) {
+      if (!is_reachable[successor]) {
+        is_reachable[successor] = true;
+        worklist.push_back(successor);
+      }
+    }
+  }
+
+  // the edges into reachable blocks go first, with their phis' incoming
+  // values. The edges among unreachable blocks go with the blocks, whose
+  // predecessors may already be gone otherwise
+  for (uint32_t block = 0; block < function->blocks.size(); block++) {
+    MirBlock& unreachable = function->blocks[block];
+    if (is_reachable[block] || unreachable.is_removed)
+      continue;
+
+    std::vector<uint32_t> successors(unreachable.successors.begin(), unreachable.successors.end());
+    for (uint32_t successor : successors)
+      if (is_reachable[successor])
+        remove_mir_edge(function, block, successor);
+  }
+
+  bool changed = false;
+  for (uint32_t block = 0; block < function->blocks.size(); block++) {
+    MirBlock& unreachable = function->blocks[block];
+    if (is_reachable[block] || unreachable.is_removed)
+      continue;
+
+    unreachable.successors.size = 0;
+
+    // values defined here can only be used in other unreachable blocks
+    while (unreachable.instructions.size) {
+      MirValue value = unreachable.instructions[unreachable.instructions.size - 1];
+      MirType type = function->values[value].type;
+      if (type != MirType::Void)
+        replace_all_mir_uses(function, value, mir_undef(function, type));
+      erase_mir_instruction(function, value);
+    }
+
+    unreachable.is_removed = true;
+    unreachable.predecessors.size = 0;
+    changed = true;
+  }
+  return changed;
+}
+
+static bool remove_dead_instructions(MirFunction* function)
+{
+  std::vector<bool> is_live(function->values.size());
+  std::vector<MirValue> worklist;
+  for (MirBlock const& block : function->blocks) {
+    for (MirValue value : block.instructions) {
+      if (mir_has_side_effects(function->values[value].opcode) && !is_removable_call(function, value)) {
+        is_live[value] = true;
+        worklist.push_back(value);
+      }
+    }
+  }
+
+  while (!worklist.empty()) {
+    MirValue value = worklist.back();
+    worklist.pop_back();
+    for (MirValue operand : function->values[value].operands) {
+      if (!is_live[operand] && function->values[operand].block != no_mir_block) {
+        is_live[operand] = true;
+        worklist.push_back(operand);
+      }
+    }
+  }
+
+  // dead instructions are only used by other dead ones, so their uses are
+  // cut first and then they can go in any order
+  std::vector<MirValue> dead;
+  for (MirBlock const& block : function->blocks)
+    for (MirValue value : block.instructions)
+      if (!is_live[value])
+        dead.push_back(value);
+
+  for (MirValue value : dead)
+    replace_all_mir_uses(function, value, mir_undef(function, function->values[value].type));
+  for (MirValue value : dead)
+    erase_mir_instruction(function, value);
+  return !dead.empty();
+}
+
+static void replace_incoming_block(MirFunction* function, uint32_t block, uint32_t old_predecessor, uint32_t new_predecessor)
+{
+  for (uint32_t& predecessor : function->blocks[block].predecessors)
+    if (predecessor == old_predecessor)
+      predecessor = new_predecessor;
+
+  for (MirValue phi : function->blocks[block].instructions) {
+    MirInstruction& instruction = function->values[phi];
+    if (instruction.opcode != MirOpcode::Phi)
+      break;
+    for (uint32_t& incoming : instruction.incoming_blocks)
+      if (incoming == old_predecessor)
+        incoming = new_predecessor;
+  }
+}
+
+static void merge_into_predecessor(MirFunction* function, uint32_t predecessor, uint32_t block)
+{
+  // with one predecessor, phis only have one value
+  MirArray<MirValue>& instructions = function->blocks[block].instructions;
+  while (instructions.size && function->values[instructions[0]].opcode == MirOpcode::Phi) {
+    MirValue phi = instructions[0];
+    replace_all_mir_uses(function, phi, function->values[phi].operands[0]);
+    erase_mir_instruction(function, phi);
+  }
+
+  erase_mir_instruction(function, mir_terminator(function, predecessor));
+  for (MirValue value : instructions) {
+    function->values[value].block = predecessor;
+    array_push(&function->arena, &function->blocks[predecessor].instructions, value);
+  }
+
+  MirBlock& merged = function->blocks[block];
+  function->blocks[predecessor].successors = merged.successors;
+  for (uint32_t successor : merged.successors)
+    replace_incoming_block(function, successor, block, predecessor);
+
+  merged.is_removed = true;
+  merged.instructions.size = 0;
+  merged.predecessors.size = 0;
+  merged.successors = {};
+}
+
+static bool merge_blocks(MirFunction* function)
+{
+  bool changed = false;
+  for (uint32_t block = 0; block < function->blocks.size(); block++) {
+    for (;;) {
+      MirBlock const& current = function->blocks[block];
+      if (current.is_removed || current.successors.size != 1)
+        break;
+      uint32_t successor = current.successors[0];
+      if (successor == block || successor == 0 || function->blocks[successor].predecessors.size != 1)
+        break;
+      merge_into_predecessor(function, block, successor);
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+bool run_dce(MirFunction* function)
+{
+  bool changed = remove_unreachable_blocks(function);
+  changed |= remove_dead_instructions(function);
+  changed |= merge_blocks(function);
+  return changed;
+}
+
+// Global value numbering
+//
+// The dominator tree is walked from the entry, with a table of the pure
+// instructions in the blocks above. An instruction that computes what one of
+// them already did, the same operation on the same operands, is replaced by
+// it. Operands of commutative operations are ordered first, so a + b and b + a
+// are found to be the same. Calls to functions that touch no memory are
+// numbered by their callee and their list of arguments
+
+struct ValueNumberKey {
+  MirOpcode opcode;
+  MirType type;
+  MirPredicate predicate;
+  MirValue operands[2];
+
+  bool operator==(ValueNumberKey const&) const = default;
+};
+
+struct ValueNumberKeyHash {
+  size_t operator()(ValueNumberKey const& key) const
+  {
+    size_t hash = (size_t)key.opcode << 16 | (size_t)key.type << 8 | (size_t)key.predicate;
+    hash = hash * 0x9E3779B97F4A7C15ull ^ key.operands[0];
+    hash = hash * 0x9E3779B97F4A7C15ull ^ key.operands[1];
+    return hash;
+  }
+};
+
+static bool is_commutative(MirInstruction const& instruction)
+{
+  switch (instruction.opcode) {
+  case MirOpcode::Add:
+  case MirOpcode::Mul:
+  case MirOpcode::And:
+  case MirOpcode::Or:
+  case MirOpcode::Xor:
+  case MirOpcode::FAdd:
+  case MirOpcode::FMul:
+    return true;
+  case MirOpcode::ICmp:
+  case MirOpcode::FCmp:
+    return instruction.predicate == MirPredicate::Eq || instruction.predicate == MirPredicate::Ne || instruction.predicate == MirPredicate::OEq
+           || instruction.predicate == MirPredicate::UNe;
+  default:
+    return false;
+  }
+}
+
+static ValueNumberKey value_number_key(MirInstruction const& instruction)
+{
+  ValueNumberKey key { instruction.opcode, instruction.type, instruction.predicate, { no_mir_value, no_mir_value } };
+  // calls have more, and their arguments are numbered by run_gvn
+  for (uint32_t i = 0; i < std::min<uint32_t>(instruction.operands.size, 2); i++)
+    key.operands[i] = instruction.operands[i];
+  if (is_commutative(instruction) && key.operands[0] > key.operands[1])
+    std::swap(key.operands[0], key.operands[1]);
+  return key;
+}
+
+bool run_gvn(MirFunction* function)
+{
+  compute_dominator_tree(function);
+
+  std::unordered_map<ValueNumberKey, MirValue, ValueNumberKeyHash> available;
+  // the argument lists of calls, numbered
+  std::map<std::vector<MirValue>, MirValue> argument_lists;
+  // the keys each block on the path from the entry added, taken out again
+  // when the walk leaves it
+  std::vector<std::vector<ValueNumberKey>> added_keys;
+  std::vector<std::pair<uint32_t, uint32_t>> stack { { 0, 0 } };
+  added_keys.emplace_back();
+  bool changed = false;
+
+  std::vector<MirValue> instructions;
+  auto number_block = [&](uint32_t block) {
+    instructions.assign(function->blocks[block].instructions.begin(), function->blocks[block].instructions.end());
+    for (MirValue value : instructions) {
+      MirInstruction const& instruction = function->values[value];
+      bool is_call = is_readnone_call(function, value);
+      if (!is_pure(instruction.opcode) && !is_call)
+        continue;
+
+      ValueNumberKey key = value_number_key(instruction);
+      if (is_call) {
+        std::vector<MirValue> arguments(instruction.operands.begin() + 1, instruction.operands.end());
+        auto argument_list = argument_lists.try_emplace(std::move(arguments), (MirValue)argument_lists.size()).first;
+        key.operands[1] = argument_list->second;
+      }
+      auto [found, inserted] = available.try_emplace(key, value);
+      if (inserted) {
+        added_keys.back().push_back(key);
+        continue;
+      }
+
+      // the instruction that stays now computes both, so it only keeps the
+      // promises both made
+      function->values[found->second].flags &= instruction.flags;
+      replace_all_mir_uses(function, value, found->second);
+      erase_mir_instruction(function, value);
+      changed = true;
+    }
+  };
+
+  number_block(0);
+  while (!stack.empty()) {
+    auto& [block, next_child] = stack.back();
+    MirArray<uint32_t> const& dominated = function->blocks[block].dominated;
+    if (next_child < dominated.size) {
+      uint32_t child = dominated[next_child++];
+      stack.push_back({ child, 0 });
+      added_keys.emplace_back();
+      number_block(child);
+      continue;
+    }
+
+    for (ValueNumberKey const& key : added_keys.back())
+      available.erase(key);
+    added_keys.pop_back();
+    stack.pop_back();
+  }
+  return changed;
+}
+
+// Loop invariant code motion
+//
+// A natural loop is a header and the blocks that reach a back edge to it
+// without going through it. Pure instructions in the loop whose operands are
+// all defined outside of it compute the same value on every iteration, and
+// move to the preheader, the one block outside the loop that branches to the
+// header, and only there. Loops are done innermost first, so an instruction
+// can move out of several in turn. Those that may trap, like a division by a
+// variable, stay, as the loop might never have run them. Loops without a
+// preheader are left alone, lowering always gives them one
+
+struct NaturalLoop {
+  uint32_t header;
+  std::vector<uint32_t> blocks;
+};
+
+// in_loop is all false, and left that way
+static std::vector<NaturalLoop> find_natural_loops(MirFunction const* function, std::vector<bool>* in_loop_storage)
+{
+  std::unordered_map<uint32_t, size_t> loop_of_header;
+  std::vector<NaturalLoop> loops;
+  std::vector<bool>& in_loop = *in_loop_storage;
+
+  for (uint32_t header : function->reverse_post_order) {
+    for (uint32_t latch : function->blocks[header].predecessors) {
+      if (!mir_block_dominates(function, header, latch))
+        continue;
+
+      auto [found, inserted] = loop_of_header.try_emplace(header, loops.size());
+      if (inserted)
+        loops.push_back({ header, { header } });
+      NaturalLoop& loop = loops[found->second];
+
+      for (uint32_t block : loop.blocks)
+        in_loop[block] = true;
+
+      std::vector<uint32_t> worklist;
+      if (!in_loop[latch]) {
+        in_loop[latch] = true;
+        loop.blocks.push_back(latch);
+        worklist.push_back(latch);
+      }
+      while (!worklist.empty()) {
+        uint32_t block = worklist.back();
+        worklist.pop_back();
+        for (uint32_t predecessor : function->blocks[block].predecessors) {
+          if (!in_loop[predecessor] && function->blocks[predecessor].order != UINT32_MAX) {
+            in_loop[predecessor] = true;
+            loop.blocks.push_back(predecessor);
+            worklist.push_back(predecessor);
+          }
+        }
+      }
+
+      for (uint32_t block : loop.blocks)
+        in_loop[block] = false;
+    }
+  }
+
+  // an inner loop has fewer blocks than any loop around it
+  std::sort(loops.begin(), loops.end(), [](NaturalLoop const& lhs, NaturalLoop const& rhs) { return lhs.blocks.size() < rhs.blocks.size(); });
+  return loops;
+}
+
+static uint32_t find_preheader(MirFunction const* function, NaturalLoop const& loop, std::vector<bool> const& in_loop)
+{
+  uint32_t preheader = no_mir_block;
+  for (uint32_t predecessor : function->blocks[loop.header].predecessors) {
+    if (in_loop[predecessor])
+      continue;
+    if (preheader != no_mir_block)
+      return no_mir_block;
+    preheader = predecessor;
+  }
+
+  if (preheader == no_mir_block || function->blocks[preheader].successors.size != 1)
+    return no_mir_block;
+  return preheader;
+}
+
+// in_loop is all false, and left that way
+static bool hoist_loop_invariants(MirFunction* function, NaturalLoop& loop, std::vector<bool>* in_loop_storage)
+{
+  std::vector<bool>& in_loop = *in_loop_storage;
+  for (uint32_t block : loop.blocks)
+    in_loop[block] = true;
+
+  uint32_t preheader = find_preheader(function, loop, in_loop);
+  if (preheader == no_mir_block) {
+    for (uint32_t block : loop.blocks)
+      in_loop[block] = false;
+    return false;
+  }
+
+  // in reverse post order, so operands are looked at before their users
+  std::sort(loop.blocks.begin(), loop.blocks.end(), [&](uint32_t lhs, uint32_t rhs) { return function->blocks[lhs].order < function->blocks[rhs].order; });
+
+  bool changed = false;
+  std::vector<MirValue> instructions;
+  for (uint32_t block : loop.blocks) {
+    instructions.assign(function->blocks[block].instructions.begin(), function->blocks[block].instructions.end());
+    for (MirValue value : instructions) {
+      MirInstruction const& instruction = function->values[value];
+      if ((!is_pure(instruction.opcode) && !is_readnone_call(function, value)) || mir_may_trap(function, value))
+        continue;
+
+      bool is_invariant = true;
+      for (MirValue operand : instruction.operands) {
+        uint32_t operand_block = function->values[operand].block;
+        is_invariant &= operand_block == no_mir_block || !in_loop[operand_block];
+      }
+
+      if (is_invariant) {
+        move_mir_instruction(function, value, preheader);
+        changed = true;
+      }
+    }
+  }
+
+  for (uint32_t block : loop.blocks)
+    in_loop[block] = false;
+  return changed;
+}
+
+bool run_licm(MirFunction* function)
+{
+  compute_dominator_tree(function);
+
+  // which blocks are in the loop at hand, shared so that each loop only
+  // costs as much as its own blocks
+  std::vector<bool> in_loop(function->blocks.size());
+  bool changed = false;
+  for (NaturalLoop& loop : find_natural_loops(function, &in_loop))
+    changed |= hoist_loop_invariants(function, loop, &in_loop);
+  return changed;
+}
+
+// Pass manager
+
+static MirPass const mir_passes[] = {
+  { "sccp", run_sccp },
+  { "dce", run_dce },
+  { "gvn", run_gvn },
+  { "licm", run_licm },
+};
+
+// constants first, so their dead branches are gone before numbering values,
+// and one more dce for what gvn and licm leave behind
+char const default_mir_pipeline[] = "sccp,dce,gvn,licm,dce";
+
+bool parse_mir_pipeline(std::string const& pipeline, std::vector<MirPass const*>* passes, std::string* unknown_pass)
+{
+  passes->clear();
+  size_t start = 0;
+  while (start < pipeline.size()) {
+    size_t end = pipeline.find(',', start);
+    if (end == std::string::npos)
+      end = pipeline.size();
+    std::string name = pipeline.substr(start, end - start);
+    start = end + 1;
+
+    MirPass const* found = nullptr;
+    for (MirPass const& pass : mir_passes)
+      if (name == pass.name)
+        found = &pass;
+    if (!found) {
+      *unknown_pass = name;
+      return false;
+    }
+    passes->push_back(found);
+  }
+  return true;
+}
+
+void run_mir_passes(MirFunction* function, std::vector<MirPass const*> const& passes)
+{
+  for (MirPass const* pass : passes) {
+    pass->run(function);
+
+#ifndef NDEBUG
+    std::string error;
+    if (!verify_mir_function(function, &error)) {
+      fprintf(stderr, "The MIR of %s is broken after %s: %s, aborting.\n", function->object->identifier.c_str(), pass->name, error.c_str());
+      exit(1);
+    }
+#endif
+  }
+}
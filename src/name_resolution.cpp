@@ -0,0 +1,150 @@
+#include "name_resolution.h"
+#include "ast_walk.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <unordered_map>
+#include <unordered_set>
+
+struct CanonicalObject {
+  Object* object;
+  bool is_definition;
+};
+
+// every file scope identifier, hashed once, mapped to its canonical object
+struct FileScopeIndex {
+  std::unordered_map<std::string, CanonicalObject> canonical_objects;
+  // all file scope declarations, so references bound to a redeclaration
+  // while parsing can be moved over to the canonical one
+  std::unordered_set<Object const*> file_scope_objects;
+};
+
+struct FunctionResolutionContext {
+  FileScopeIndex const* index;
+  Object* function_object;
+};
+
+// 6.9.2 a declaration with an initializer is a definition, as is a
+// declaration without extern (a tentative definition)
+static bool object_is_definition(Object const* object, ASTNode const* declaration_node)
+{
+  if (object->type->fundamental_type == FundamentalType::Function)
+    return object->function_body != nullptr;
+
+  return declaration_node->rhs || !(object->declaration_specifiers.flags & TypeModifierFlag::Extern);
+}
+
+static void index_file_scope_declaration(FileScopeIndex* index, Object* object, ASTNode const* declaration_node)
+{
+  index->file_scope_objects.insert(object);
+
+  bool is_definition = object_is_definition(object, declaration_node);
+  auto [entry, inserted] = index->canonical_objects.try_emplace(object->identifier, CanonicalObject { object, is_definition });
+  if (inserted) {
+    object->is_canonical = true;
+    return;
+  }
+
+  // the first definition wins over any declaration before it
+  if (entry->second.is_definition || !is_definition)
+    return;
+
+  entry->second.object->is_canonical = false;
+  object->is_canonical = true;
+  entry->second = { object, is_definition };
+}
+
+// block scope objects with automatic storage duration get the next slot
+static bool has_automatic_storage(Object const* object)
+{
+  if (object->type->fundamental_type == FundamentalType::Function)
+    return false;
+
+  return !(object->declaration_specifiers.flags & (TypeModifierFlag::Extern | TypeModifierFlag::Static | TypeModifierFlag::TypeDef));
+}
+
+static Object* canonical_object(FileScopeIndex const* index, std::string const& identifier)
+{
+  auto entry = index->canonical_objects.find(identifier);
+  return entry == index->canonical_objects.end() ? nullptr : entry->second.object;
+}
+
+static void bind_variable_reference(FileScopeIndex const* index, ASTNode* reference)
+{
+  Object* bound_object = reference->object;
+
+  // bound to a local by the parser, nothing to do
+  if (bound_object && !index->file_scope_objects.contains(bound_object) && !(bound_object->declaration_specifiers.flags & TypeModifierFlag::Extern)
+      && bound_object->type->fundamental_type != FundamentalType::Function)
+    return;
+
+  Object* canonical = canonical_object(index, reference->referenced_variable);
+
+  // block scope extern declarations and function declarations may name
+  // something never declared at file scope, they denote themselves
+  if (!canonical)
+    canonical = bound_object;
+
+  if (!canonical) {
+    fprintf(stderr, "use of undeclared identifier %s\n", reference->referenced_variable.c_str());
+    exit(1);
+  }
+
+  reference->object = canonical;
+}
+
+static void resolve_names_in_function(ASTNode* ast_node, ASTWalkEvent event, unsigned child_index, void* context)
+{
+  (void)child_index;
+  if (event != ASTWalkEvent::Enter)
+    return;
+
+  FunctionResolutionContext* resolution_context = static_cast<FunctionResolutionContext*>(context);
+
+  switch (ast_node->type) {
+  case ASTNodeType::Declaration:
+    if (has_automatic_storage(ast_node->object))
+      ast_node->object->local_slot = resolution_context->function_object->local_count++;
+    return;
+
+  case ASTNodeType::VariableReference:
+    bind_variable_reference(resolution_context->index, ast_node);
+    return;
+
+  default:
+    return;
+  }
+}
+
+// initializers of file scope objects can refer to other file scope objects,
+// e.g. int* p = &x;
+static void resolve_names_in_initializer(ASTNode* ast_node, void* context)
+{
+  if (ast_node->type == ASTNodeType::VariableReference)
+    bind_variable_reference(static_cast<FileScopeIndex const*>(context), ast_node);
+}
+
+void resolve_names(ExternalDeclaration* external_declarations)
+{
+  FileScopeIndex index;
+
+  for (ExternalDeclaration* declaration = external_declarations; declaration; declaration = declaration->next)
+    for (ASTNode const* declaration_node = declaration->root_ast_node; declaration_node; declaration_node = declaration_node->next)
+      index_file_scope_declaration(&index, declaration_node->object, declaration_node);
+
+  for (ExternalDeclaration* declaration = external_declarations; declaration; declaration = declaration->next) {
+    for (ASTNode const* declaration_node = declaration->root_ast_node; declaration_node; declaration_node = declaration_node->next) {
+      Object* object = declaration_node->object;
+
+      if (declaration->type == ExternalDeclarationType::FunctionDefinition) {
+        FunctionResolutionContext context = { &index, object };
+        for (ASTNode* statement = object->function_body; statement; statement = statement->next)
+          walk_ast(statement, resolve_names_in_function, &context);
+        continue;
+      }
+
+      if (declaration_node->rhs)
+        walk_ast_post_order(declaration_node->rhs, resolve_names_in_initializer, &index);
+    }
+  }
+}
@@ -0,0 +1,1297 @@
+#include "native_codegen.h"
+#include "elf_object.h"
+#include "layout.h"
+#include "llvm_codegen.h"
+#include "mir.h"
+#include "output_buffer.h"
+#include "thread_pool.h"
+#include "type.h"
+#include "x86_assembler.h"
+
+#include <llvm/BinaryFormat/ELF.h>
+
+#include <algorithm>
+#include <cassert>
+#include <string.h>
+#include <unordered_set>
+#include <vector>
+
+// x86-64 System V code from the mid-level IR
+//
+// Values that are instructions or arguments get an 8 byte slot below %rbp,
+// written as soon as they are computed. Constants, globals and allocas have
+// none, they are materialized where they are used. Instructions load their
+// operands into %rax and %rcx, or %xmm0 and %xmm1, compute in place and store
+// the result, so only the registers' cache of which value each holds carries
+// over from one instruction to the next. A phi has a second slot that each
+// predecessor writes its incoming value to before jumping, and that the phi's
+// block copies into the phi's own slot first thing, so phis that read each
+// other see the values from before the jump.
+//
+// Integers narrower than 64 bits only have their low bits defined in a
+// register or slot, except i1, which is always 0 or 1, so they are extended
+// where the upper bits matter: division, right shifts, comparisons and
+// conversions.
+//
+// The instructions go through x86_assembler.h, which prints them for a .s
+// file or encodes them for an object file. Functions are encoded into buffers
+// of their own, on worker threads with -j, and laid out one after the other
+// in .text, where their calls and the globals they address are relocations.
+
+// https://gitlab.com/x86-psABIs/x86-64-ABI 3.2.3 parameter passing
+static X86Register const argument_registers[] = { RDI, RSI, RDX, RCX, R8, R9 };
+constexpr unsigned argument_register_count = 6;
+constexpr unsigned xmm_argument_count = 8;
+
+static bool is_quad(MirType type) { return type == MirType::I64 || type == MirType::Ptr; }
+
+// the width integer arithmetic of a type is done in
+static X86Width integer_width(MirType type) { return is_quad(type) ? X86Width::Quad : X86Width::Long; }
+static X86Width float_width(MirType type) { return type == MirType::Double ? X86Width::Double : X86Width::Single; }
+
+// the width a type is loaded and stored with
+static X86Width memory_width(MirType type)
+{
+  switch (type) {
+  case MirType::I1:
+  case MirType::I8:
+    return X86Width::Byte;
+  case MirType::I16:
+    return X86Width::Word;
+  case MirType::I32:
+    return X86Width::Long;
+  default:
+    return X86Width::Quad;
+  }
+}
+
+static bool fits_immediate(long long constant) { return constant >= INT32_MIN && constant <= INT32_MAX; }
+
+static X86Operand reg(X86Register r) { return x86_register(r); }
+static X86Operand immediate(long long value) { return x86_immediate(value); }
+
+// what the translation unit defines, and so can be addressed relative to %rip
+// instead of through the GOT
+struct NativeModule {
+  CodegenOptions const* options;
+  std::unordered_set<Object const*> definitions;
+};
+
+struct NativeFunction {
+  MirFunction const* function;
+  NativeModule const* module;
+  X86Assembler* assembler;
+
+  // the offset from %rbp of each value's slot, and of each phi's incoming
+  // value slot. For allocas, where the memory they allocate starts
+  std::vector<int> slots;
+  std::vector<int> incoming_slots;
+  unsigned frame_size;
+
+  // the value each register holds, no_mir_value if none
+  MirValue cached[x86_register_count];
+};
+
+static void emit(NativeFunction* native, X86Opcode opcode, X86Width width, X86Operand source = {}, X86Operand destination = {})
+{
+  emit_x86(native->assembler, opcode, width, source, destination);
+}
+
+static X86Operand slot(NativeFunction const* native, MirValue value) { return x86_memory(RBP, native->slots[value]); }
+
+static void clear_register_cache(NativeFunction* native)
+{
+  for (MirValue& value : native->cached)
+    value = no_mir_value;
+}
+
+static void clobber(NativeFunction* native, X86Register r) { native->cached[r] = no_mir_value; }
+
+// the bits of a constant as they are in a register: floats are stored as a
+// double's bits, a float is narrowed to its own
+static long long constant_bits(MirInstruction const& constant)
+{
+  if (constant.type != MirType::Float)
+    return constant.constant;
+
+  double value;
+  memcpy(&value, &constant.constant, sizeof(value));
+  float narrowed = (float)value;
+  uint32_t bits;
+  memcpy(&bits, &narrowed, sizeof(bits));
+  return bits;
+}
+
+// objects defined in another module may be in a shared library, so their
+// address comes from the GOT. An executable's thread locals are at a fixed
+// offset from %fs:0, the ones of libraries it was linked against at one the
+// GOT holds
+static void emit_global_address(NativeFunction* native, Object const* object, X86Register r)
+{
+  bool is_definition = native->module->definitions.count(object);
+  std::string const* name = &object->identifier;
+
+  if (object->declaration_specifiers.flags & TypeModifierFlag::ThreadLocal) {
+    ThreadLocalModel model = thread_local_model(object, is_definition, *native->module->options);
+    if (model == ThreadLocalModel::LocalExec) {
+      emit(native, X86Opcode::Mov, X86Width::Quad, x86_memory(x86_fs, 0), reg(r));
+      emit(native, X86Opcode::Lea, X86Width::Quad, x86_symbol(X86Relocation::ThreadPointerOffset, name, r), reg(r));
+    } else {
+      assert(model == ThreadLocalModel::InitialExec && "Dynamic TLS models need -fpic, which the native backend rejects");
+      emit(native, X86Opcode::Mov, X86Width::Quad, x86_symbol(X86Relocation::GotThreadPointerOffset, name), reg(r));
+      emit(native, X86Opcode::Add, X86Width::Quad, x86_memory(x86_fs, 0), reg(r));
+    }
+    return;
+  }
+
+  if (is_definition)
+    emit(native, X86Opcode::Lea, X86Width::Quad, x86_symbol(X86Relocation::PcRelative, name), reg(r));
+  else
+    emit(native, X86Opcode::Mov, X86Width::Quad, x86_symbol(X86Relocation::GotPcRelative, name), reg(r));
+}
+
+// the whole 64 bits of a value into a general purpose register
+static void load_value(NativeFunction* native, MirValue value, X86Register r)
+{
+  for (unsigned i = 0; i < x86_register_count; i++) {
+    if (native->cached[i] != value)
+      continue;
+    if (i != r)
+      emit(native, X86Opcode::Mov, X86Width::Quad, reg((X86Register)i), reg(r));
+    native->cached[r] = value;
+    return;
+  }
+
+  MirInstruction const& instruction = native->function->values[value];
+  switch (instruction.opcode) {
+  case MirOpcode::Constant: {
+    long long bits = constant_bits(instruction);
+    if (bits == 0)
+      emit(native, X86Opcode::Xor, X86Width::Long, reg(r), reg(r));
+    else if (fits_immediate(bits))
+      emit(native, X86Opcode::Mov, X86Width::Quad, immediate(bits), reg(r));
+    else
+      emit(native, X86Opcode::MovAbs, X86Width::Quad, immediate(bits), reg(r));
+    break;
+  }
+  case MirOpcode::Undef:
+    emit(native, X86Opcode::Xor, X86Width::Long, reg(r), reg(r));
+    break;
+  case MirOpcode::Global:
+    emit_global_address(native, instruction.global, r);
+    break;
+  case MirOpcode::Alloca:
+    // over-aligned memory starts at the first aligned address of a larger area
+    if (instruction.alignment > 16) {
+      emit(native, X86Opcode::Lea, X86Width::Quad, x86_memory(RBP, native->slots[value] + (int)instruction.alignment - 1), reg(r));
+      emit(native, X86Opcode::And, X86Width::Quad, immediate(-(long long)instruction.alignment), reg(r));
+    } else {
+      emit(native, X86Opcode::Lea, X86Width::Quad, slot(native, value), reg(r));
+    }
+    break;
+  default:
+    emit(native, X86Opcode::Mov, X86Width::Quad, slot(native, value), reg(r));
+    break;
+  }
+  native->cached[r] = value;
+}
+
+static void load_float(NativeFunction* native, MirValue value, unsigned xmm)
+{
+  MirInstruction const& instruction = native->function->values[value];
+
+  if (instruction.opcode == MirOpcode::Undef || (instruction.opcode == MirOpcode::Constant && constant_bits(instruction) == 0)) {
+    emit(native, X86Opcode::XorPS, X86Width::Single, x86_xmm(xmm), x86_xmm(xmm));
+  } else if (instruction.opcode == MirOpcode::Constant) {
+    load_value(native, value, R11);
+    emit(native, X86Opcode::MovQToXmm, X86Width::Double, reg(R11), x86_xmm(xmm));
+  } else {
+    emit(native, X86Opcode::MovS, float_width(instruction.type), slot(native, value), x86_xmm(xmm));
+  }
+}
+
+static void store_result(NativeFunction* native, MirValue value, X86Register r)
+{
+  emit(native, X86Opcode::Mov, X86Width::Quad, reg(r), slot(native, value));
+  native->cached[r] = value;
+}
+
+static void store_float_result(NativeFunction* native, MirValue value, unsigned xmm)
+{
+  emit(native, X86Opcode::MovS, float_width(native->function->values[value].type), x86_xmm(xmm), slot(native, value));
+}
+
+// sign or zero extends the low bits of a narrow integer to 32, where the
+// instructions that care about the upper bits work
+static void extend_to_32(NativeFunction* native, X86Register r, MirType type, bool is_signed)
+{
+  switch (type) {
+  case MirType::I1:
+    emit(native, X86Opcode::And, X86Width::Long, immediate(1), reg(r));
+    if (is_signed)
+      emit(native, X86Opcode::Neg, X86Width::Long, {}, reg(r));
+    break;
+  case MirType::I8:
+    emit(native, is_signed ? X86Opcode::MovSX : X86Opcode::MovZX, X86Width::Byte, reg(r), reg(r));
+    break;
+  case MirType::I16:
+    emit(native, is_signed ? X86Opcode::MovSX : X86Opcode::MovZX, X86Width::Word, reg(r), reg(r));
+    break;
+  default:
+    break;
+  }
+  clobber(native, r);
+}
+
+// and on to 64, for conversions
+static void extend_to_64(NativeFunction* native, X86Register r, MirType type, bool is_signed)
+{
+  if (is_quad(type))
+    return;
+
+  extend_to_32(native, r, type, is_signed);
+  if (is_signed)
+    emit(native, X86Opcode::MovSXD, X86Width::Quad, reg(r), reg(r));
+  else
+    emit(native, X86Opcode::Mov, X86Width::Long, reg(r), reg(r));
+}
+
+// arguments and return values narrower than an int are extended to 32 bits
+// by whoever passes them, as GCC and Clang do, though the ABI leaves the upper
+// bits undefined
+static void extend_to_int(NativeFunction* native, X86Register r, MirType type, Type const* c_type)
+{
+  if (type == MirType::I1 || type == MirType::I8 || type == MirType::I16)
+    extend_to_32(native, r, type, !is_unsigned_type(c_type->fundamental_type));
+}
+
+static X86Opcode integer_operation(MirOpcode opcode)
+{
+  switch (opcode) {
+  case MirOpcode::Add:
+    return X86Opcode::Add;
+  case MirOpcode::Sub:
+    return X86Opcode::Sub;
+  case MirOpcode::Mul:
+    return X86Opcode::IMul;
+  case MirOpcode::And:
+    return X86Opcode::And;
+  case MirOpcode::Or:
+    return X86Opcode::Or;
+  case MirOpcode::Xor:
+    return X86Opcode::Xor;
+  case MirOpcode::Shl:
+    return X86Opcode::Shl;
+  case MirOpcode::LShr:
+    return X86Opcode::Shr;
+  case MirOpcode::AShr:
+    return X86Opcode::Sar;
+  default:
+    assert(false && "Not an integer operation");
+    return X86Opcode::Add;
+  }
+}
+
+static X86Condition condition_code(MirPredicate predicate)
+{
+  switch (predicate) {
+  case MirPredicate::Eq:
+    return X86Condition::E;
+  case MirPredicate::Ne:
+    return X86Condition::NE;
+  case MirPredicate::SLT:
+    return X86Condition::L;
+  case MirPredicate::SLE:
+    return X86Condition::LE;
+  case MirPredicate::SGT:
+    return X86Condition::G;
+  case MirPredicate::SGE:
+    return X86Condition::GE;
+  case MirPredicate::ULT:
+    return X86Condition::B;
+  case MirPredicate::ULE:
+    return X86Condition::BE;
+  case MirPredicate::UGT:
+    return X86Condition::A;
+  case MirPredicate::UGE:
+    return X86Condition::AE;
+  default:
+    assert(false && "Not an integer predicate");
+    return X86Condition::E;
+  }
+}
+
+static bool is_signed_predicate(MirPredicate predicate)
+{
+  return predicate == MirPredicate::SLT || predicate == MirPredicate::SLE || predicate == MirPredicate::SGT || predicate == MirPredicate::SGE;
+}
+
+static void emit_integer_operation(NativeFunction* native, MirValue value)
+{
+  MirInstruction const& instruction = native->function->values[value];
+  MirType type = instruction.type;
+  X86Width width = integer_width(type);
+  X86Opcode operation = integer_operation(instruction.opcode);
+  MirValue rhs = instruction.operands[1];
+  MirInstruction const& rhs_instruction = native->function->values[rhs];
+
+  load_value(native, instruction.operands[0], RAX);
+  clobber(native, RAX);
+
+  bool is_shift = instruction.opcode == MirOpcode::Shl || instruction.opcode == MirOpcode::LShr || instruction.opcode == MirOpcode::AShr;
+  if (instruction.opcode == MirOpcode::LShr || instruction.opcode == MirOpcode::AShr)
+    extend_to_32(native, RAX, type, instruction.opcode == MirOpcode::AShr);
+
+  // imul with an immediate is the three operand form, %rax times it into %rax
+  if (rhs_instruction.opcode == MirOpcode::Constant && fits_immediate(rhs_instruction.constant)) {
+    emit(native, operation, width, immediate(is_shift ? rhs_instruction.constant & 63 : rhs_instruction.constant), reg(RAX));
+  } else {
+    load_value(native, rhs, RCX);
+    emit(native, operation, width, reg(RCX), reg(RAX));
+  }
+
+  if (type == MirType::I1)
+    emit(native, X86Opcode::And, X86Width::Long, immediate(1), reg(RAX));
+  store_result(native, value, RAX);
+}
+
+static void emit_division(NativeFunction* native, MirValue value)
+{
+  MirInstruction const& instruction = native->function->values[value];
+  MirType type = instruction.type;
+  X86Width width = integer_width(type);
+  bool is_signed = instruction.opcode == MirOpcode::SDiv || instruction.opcode == MirOpcode::SRem;
+  bool is_remainder = instruction.opcode == MirOpcode::SRem || instruction.opcode == MirOpcode::URem;
+
+  load_value(native, instruction.operands[0], RAX);
+  load_value(native, instruction.operands[1], RCX);
+  extend_to_32(native, RAX, type, is_signed);
+  extend_to_32(native, RCX, type, is_signed);
+
+  if (is_signed)
+    emit(native, X86Opcode::SignExtendAccumulator, width);
+  else
+    emit(native, X86Opcode::Xor, X86Width::Long, reg(RDX), reg(RDX));
+  emit(native, is_signed ? X86Opcode::IDiv : X86Opcode::Div, width, {}, reg(RCX));
+  clobber(native, RAX);
+  clobber(native, RDX);
+
+  store_result(native, value, is_remainder ? RDX : RAX);
+}
+
+static void emit_integer_comparison(NativeFunction* native, MirValue value)
+{
+  MirInstruction const& instruction = native->function->values[value];
+  MirType type = native->function->values[instruction.operands[0]].type;
+  bool is_signed = is_signed_predicate(instruction.predicate);
+
+  load_value(native, instruction.operands[0], RAX);
+  load_value(native, instruction.operands[1], RCX);
+  extend_to_32(native, RAX, type, is_signed);
+  extend_to_32(native, RCX, type, is_signed);
+
+  emit(native, X86Opcode::Cmp, integer_width(type), reg(RCX), reg(RAX));
+  emit_x86_set(native->assembler, condition_code(instruction.predicate), RAX);
+  emit(native, X86Opcode::MovZX, X86Width::Byte, reg(RAX), reg(RAX));
+  store_result(native, value, RAX);
+}
+
+// ucomis sets the carry and zero flags like an unsigned comparison, and all
+// three of them and parity when either side is a NaN. Less than is greater
+// than with the operands swapped, so a NaN makes both false
+static void emit_float_comparison(NativeFunction* native, MirValue value)
+{
+  MirInstruction const& instruction = native->function->values[value];
+  X86Assembler* assembler = native->assembler;
+  MirType type = native->function->values[instruction.operands[0]].type;
+  bool is_swapped = instruction.predicate == MirPredicate::OLT || instruction.predicate == MirPredicate::OLE;
+
+  load_float(native, instruction.operands[is_swapped ? 1 : 0], 0);
+  load_float(native, instruction.operands[is_swapped ? 0 : 1], 1);
+  emit(native, X86Opcode::UComiS, float_width(type), x86_xmm(1), x86_xmm(0));
+
+  switch (instruction.predicate) {
+  case MirPredicate::OEq:
+    emit_x86_set(assembler, X86Condition::E, RAX);
+    emit_x86_set(assembler, X86Condition::NP, RCX);
+    emit(native, X86Opcode::And, X86Width::Byte, reg(RCX), reg(RAX));
+    break;
+  case MirPredicate::UNe:
+    emit_x86_set(assembler, X86Condition::NE, RAX);
+    emit_x86_set(assembler, X86Condition::P, RCX);
+    emit(native, X86Opcode::Or, X86Width::Byte, reg(RCX), reg(RAX));
+    break;
+  case MirPredicate::OGT:
+  case MirPredicate::OLT:
+    emit_x86_set(assembler, X86Condition::A, RAX);
+    break;
+  case MirPredicate::OGE:
+  case MirPredicate::OLE:
+    emit_x86_set(assembler, X86Condition::AE, RAX);
+    break;
+  default:
+    assert(false && "Not a floating point predicate");
+  }
+  emit(native, X86Opcode::MovZX, X86Width::Byte, reg(RAX), reg(RAX));
+  clobber(native, RCX);
+  store_result(native, value, RAX);
+}
+
+static void emit_float_operation(NativeFunction* native, MirValue value)
+{
+  MirInstruction const& instruction = native->function->values[value];
+
+  if (instruction.opcode == MirOpcode::FNeg) {
+    load_value(native, instruction.operands[0], RAX);
+    if (instruction.type == MirType::Double)
+      emit(native, X86Opcode::Btc, X86Width::Quad, immediate(63), reg(RAX));
+    else
+      emit(native, X86Opcode::Xor, X86Width::Long, immediate(0x80000000), reg(RAX));
+    clobber(native, RAX);
+    store_result(native, value, RAX);
+    return;
+  }
+
+  X86Opcode operation = instruction.opcode == MirOpcode::FAdd   ? X86Opcode::AddS
+                        : instruction.opcode == MirOpcode::FSub ? X86Opcode::SubS
+                        : instruction.opcode == MirOpcode::FMul ? X86Opcode::MulS
+                                                                : X86Opcode::DivS;
+  load_float(native, instruction.operands[0], 0);
+  load_float(native, instruction.operands[1], 1);
+  emit(native, operation, float_width(instruction.type), x86_xmm(1), x86_xmm(0));
+  store_float_result(native, value, 0);
+}
+
+// 2^63, the first value too large for the signed conversions, as a double and
+// as a float
+constexpr long long two_to_the_63_double = 0x43e0000000000000;
+constexpr long long two_to_the_63_float = 0x5f000000;
+
+static void emit_conversion(NativeFunction* native, MirValue value)
+{
+  MirInstruction const& instruction = native->function->values[value];
+  X86Assembler* assembler = native->assembler;
+  MirType to = instruction.type;
+  MirValue operand = instruction.operands[0];
+  MirType from = native->function->values[operand].type;
+
+  switch (instruction.opcode) {
+  case MirOpcode::Trunc:
+  case MirOpcode::PtrToInt:
+    load_value(native, operand, RAX);
+    if (to == MirType::I1) {
+      emit(native, X86Opcode::And, X86Width::Long, immediate(1), reg(RAX));
+      clobber(native, RAX);
+    }
+    store_result(native, value, RAX);
+    return;
+
+  case MirOpcode::ZExt:
+  case MirOpcode::SExt:
+  case MirOpcode::IntToPtr:
+    load_value(native, operand, RAX);
+    extend_to_64(native, RAX, from, instruction.opcode == MirOpcode::SExt);
+    clobber(native, RAX);
+    store_result(native, value, RAX);
+    return;
+
+  case MirOpcode::FPTrunc:
+  case MirOpcode::FPExt:
+    load_float(native, operand, 0);
+    emit(native, X86Opcode::ConvertFloat, float_width(from), x86_xmm(0), x86_xmm(0));
+    store_float_result(native, value, 0);
+    return;
+
+  case MirOpcode::FPToSI:
+    load_float(native, operand, 0);
+    emit_x86_float_to_integer(assembler, float_width(from), integer_width(to), 0, RAX);
+    clobber(native, RAX);
+    store_result(native, value, RAX);
+    return;
+
+  case MirOpcode::FPToUI:
+    // 32 bits and less fit the signed 64 bit conversion. Above 2^63, 2^63 is
+    // taken off before converting and its bit set after
+    load_float(native, operand, 0);
+    if (to != MirType::I64) {
+      emit_x86_float_to_integer(assembler, float_width(from), X86Width::Quad, 0, RAX);
+    } else {
+      uint32_t too_large = new_x86_label(assembler);
+      uint32_t done = new_x86_label(assembler);
+      emit(native, X86Opcode::MovAbs, X86Width::Quad, immediate(from == MirType::Double ? two_to_the_63_double : two_to_the_63_float), reg(RAX));
+      emit(native, X86Opcode::MovQToXmm, float_width(from), reg(RAX), x86_xmm(1));
+      emit(native, X86Opcode::UComiS, float_width(from), x86_xmm(1), x86_xmm(0));
+      emit_x86_jump(assembler, X86Condition::AE, too_large);
+      emit_x86_float_to_integer(assembler, float_width(from), X86Width::Quad, 0, RAX);
+      emit_x86_jump(assembler, X86Condition::Always, done);
+      bind_x86_label(assembler, too_large);
+      emit(native, X86Opcode::SubS, float_width(from), x86_xmm(1), x86_xmm(0));
+      emit_x86_float_to_integer(assembler, float_width(from), X86Width::Quad, 0, RAX);
+      emit(native, X86Opcode::Btc, X86Width::Quad, immediate(63), reg(RAX));
+      bind_x86_label(assembler, done);
+    }
+    clobber(native, RAX);
+    store_result(native, value, RAX);
+    return;
+
+  case MirOpcode::SIToFP:
+    load_value(native, operand, RAX);
+    extend_to_64(native, RAX, from, true);
+    emit_x86_integer_to_float(assembler, float_width(to), RAX, 0);
+    clobber(native, RAX);
+    store_float_result(native, value, 0);
+    return;
+
+  case MirOpcode::UIToFP:
+    // 64 bit values with the top bit set are halved, keeping the lowest bit
+    // so the result rounds the same, converted, and doubled
+    load_value(native, operand, RAX);
+    extend_to_64(native, RAX, from, false);
+    if (from != MirType::I64) {
+      emit_x86_integer_to_float(assembler, float_width(to), RAX, 0);
+    } else {
+      uint32_t too_large = new_x86_label(assembler);
+      uint32_t done = new_x86_label(assembler);
+      emit(native, X86Opcode::Test, X86Width::Quad, reg(RAX), reg(RAX));
+      emit_x86_jump(assembler, X86Condition::S, too_large);
+      emit_x86_integer_to_float(assembler, float_width(to), RAX, 0);
+      emit_x86_jump(assembler, X86Condition::Always, done);
+      bind_x86_label(assembler, too_large);
+      emit(native, X86Opcode::Mov, X86Width::Quad, reg(RAX), reg(RCX));
+      emit(native, X86Opcode::Shr, X86Width::Quad, {}, reg(RCX));
+      emit(native, X86Opcode::And, X86Width::Long, immediate(1), reg(RAX));
+      emit(native, X86Opcode::Or, X86Width::Quad, reg(RAX), reg(RCX));
+      emit_x86_integer_to_float(assembler, float_width(to), RCX, 0);
+      emit(native, X86Opcode::AddS, float_width(to), x86_xmm(0), x86_xmm(0));
+      bind_x86_label(assembler, done);
+    }
+    clobber(native, RAX);
+    clobber(native, RCX);
+    store_float_result(native, value, 0);
+    return;
+
+  default:
+    assert(false && "Not a conversion");
+  }
+}
+
+static void emit_load(NativeFunction* native, MirValue value)
+{
+  MirInstruction const& instruction = native->function->values[value];
+  MirType type = instruction.type;
+  X86Operand address = x86_memory(RCX, 0);
+
+  load_value(native, instruction.operands[0], RCX);
+  if (is_mir_float_type(type)) {
+    emit(native, X86Opcode::MovS, float_width(type), address, x86_xmm(0));
+    store_float_result(native, value, 0);
+    return;
+  }
+
+  X86Width width = memory_width(type);
+  if (width == X86Width::Byte || width == X86Width::Word)
+    emit(native, X86Opcode::MovZX, width, address, reg(RAX));
+  else
+    emit(native, X86Opcode::Mov, width, address, reg(RAX));
+  store_result(native, value, RAX);
+}
+
+static void emit_store(NativeFunction* native, MirValue value)
+{
+  MirInstruction const& instruction = native->function->values[value];
+  MirValue stored = instruction.operands[0];
+  MirType type = native->function->values[stored].type;
+  X86Operand address = x86_memory(RCX, 0);
+
+  load_value(native, instruction.operands[1], RCX);
+  if (is_mir_float_type(type)) {
+    load_float(native, stored, 0);
+    emit(native, X86Opcode::MovS, float_width(type), x86_xmm(0), address);
+    return;
+  }
+
+  load_value(native, stored, RAX);
+  emit(native, X86Opcode::Mov, memory_width(type), reg(RAX), address);
+}
+
+// getelementptr sign extends its index to the width of a pointer
+static void emit_pointer_add(NativeFunction* native, MirValue value)
+{
+  MirInstruction const& instruction = native->function->values[value];
+  MirInstruction const& offset = native->function->values[instruction.operands[1]];
+
+  load_value(native, instruction.operands[0], RAX);
+  clobber(native, RAX);
+  if (offset.opcode == MirOpcode::Constant && fits_immediate(offset.constant)) {
+    emit(native, X86Opcode::Add, X86Width::Quad, immediate(offset.constant), reg(RAX));
+  } else {
+    load_value(native, instruction.operands[1], RCX);
+    extend_to_64(native, RCX, offset.type, true);
+    emit(native, X86Opcode::Add, X86Width::Quad, reg(RCX), reg(RAX));
+  }
+  store_result(native, value, RAX);
+}
+
+// arguments go in registers by class, in order, and the rest on the stack
+// from the lowest address up, which stays 16 byte aligned. Variadic callees
+// are told in %al how many vector registers hold arguments
+// whether an argument goes on the stack, given how many of its kind went to
+// registers before it
+static bool is_stack_argument(MirType type, unsigned* integer_arguments, unsigned* float_arguments)
+{
+  unsigned* in_registers = is_mir_float_type(type) ? float_arguments : integer_arguments;
+  if (*in_registers == (is_mir_float_type(type) ? xmm_argument_count : argument_register_count))
+    return true;
+  (*in_registers)++;
+  return false;
+}
+
+// a tail or musttail call whose value is returned right away, and whose
+// arguments all go in registers, is a jump to the callee once the frame is
+// gone, so the callee returns to our caller
+static bool is_sibling_call(MirFunction const* function, MirArray<MirValue> const& instructions, uint32_t index)
+{
+  MirInstruction const& call = function->values[instructions[index]];
+  if (call.opcode != MirOpcode::Call || call.tail_call_kind == TailCallKind::None || index + 1 == instructions.size)
+    return false;
+
+  MirInstruction const& next = function->values[instructions[index + 1]];
+  if (next.opcode != MirOpcode::Ret || (next.operands.size && next.operands[0] != instructions[index]))
+    return false;
+
+  unsigned integer_arguments = 0, float_arguments = 0;
+  for (uint32_t i = 1; i < call.operands.size; i++)
+    if (is_stack_argument(function->values[call.operands[i]].type, &integer_arguments, &float_arguments))
+      return false;
+  return true;
+}
+
+// a musttail call has to be a jump, and one with arguments on the stack
+// can't be, as they would be where our own arguments are
+static bool has_musttail_calls_on_stack(MirFunction const* function)
+{
+  for (MirBlock const& block : function->blocks) {
+    if (block.is_removed)
+      continue;
+    for (uint32_t i = 0; i < block.instructions.size; i++) {
+      MirInstruction const& instruction = function->values[block.instructions[i]];
+      if (instruction.opcode == MirOpcode::Call && instruction.tail_call_kind == TailCallKind::MustTail && !is_sibling_call(function, block.instructions, i))
+        return true;
+    }
+  }
+  return false;
+}
+
+static void emit_call(NativeFunction* native, MirValue value, bool is_sibling_call)
+{
+  MirInstruction const& instruction = native->function->values[value];
+  MirFunction const* function = native->function;
+
+  std::vector<MirValue> stack_arguments;
+  std::vector<MirValue> register_arguments;
+  std::vector<MirValue> xmm_arguments;
+  unsigned integer_arguments = 0, float_arguments = 0;
+  for (uint32_t i = 1; i < instruction.operands.size; i++) {
+    MirValue argument = instruction.operands[i];
+    if (is_stack_argument(function->values[argument].type, &integer_arguments, &float_arguments))
+      stack_arguments.push_back(argument);
+    else if (is_mir_float_type(function->values[argument].type))
+      xmm_arguments.push_back(argument);
+    else
+      register_arguments.push_back(argument);
+  }
+
+  unsigned stack_bytes = (unsigned)(stack_arguments.size() + 1) / 2 * 16;
+  if (stack_bytes)
+    emit(native, X86Opcode::Sub, X86Width::Quad, immediate(stack_bytes), reg(RSP));
+  for (unsigned i = 0; i < stack_arguments.size(); i++) {
+    MirType type = function->values[stack_arguments[i]].type;
+    if (is_mir_float_type(type)) {
+      load_float(native, stack_arguments[i], 0);
+      emit(native, X86Opcode::MovS, float_width(type), x86_xmm(0), x86_memory(RSP, i * 8));
+    } else {
+      load_value(native, stack_arguments[i], RAX);
+      emit(native, X86Opcode::Mov, X86Width::Quad, reg(RAX), x86_memory(RSP, i * 8));
+    }
+  }
+
+  for (unsigned i = 0; i < xmm_arguments.size(); i++)
+    load_float(native, xmm_arguments[i], i);
+  // the types of variadic arguments are already promoted
+  std::vector<Type const*> parameter_types;
+  for (FunctionParameter const* parameter = instruction.function_type->function_data->parameter_list; parameter; parameter = parameter->next_parameter)
+    parameter_types.push_back(parameter->parameter_type);
+
+  for (unsigned i = 0; i < register_arguments.size(); i++) {
+    load_value(native, register_arguments[i], argument_registers[i]);
+    uint32_t operand = 1;
+    while (instruction.operands[operand] != register_arguments[i])
+      operand++;
+    if (operand - 1 < parameter_types.size())
+      extend_to_int(native, argument_registers[i], function->values[register_arguments[i]].type, parameter_types[operand - 1]);
+  }
+
+  MirInstruction const& callee = function->values[instruction.operands[0]];
+  bool is_direct = callee.opcode == MirOpcode::Global && callee.global->type->fundamental_type == FundamentalType::Function;
+  if (!is_direct)
+    load_value(native, instruction.operands[0], R11);
+  if (instruction.function_type->function_data->is_variadic)
+    emit(native, X86Opcode::Mov, X86Width::Long, immediate((long long)xmm_arguments.size()), reg(RAX));
+
+  if (is_sibling_call)
+    emit(native, X86Opcode::Leave, X86Width::Quad);
+  if (is_direct)
+    emit_x86_call(native->assembler, &callee.global->identifier, native->module->definitions.count(callee.global), is_sibling_call);
+  else
+    emit_x86_indirect_call(native->assembler, R11, is_sibling_call);
+  if (is_sibling_call)
+    return;
+
+  if (stack_bytes)
+    emit(native, X86Opcode::Add, X86Width::Quad, immediate(stack_bytes), reg(RSP));
+  clear_register_cache(native);
+
+  if (is_mir_float_type(instruction.type))
+    store_float_result(native, value, 0);
+  else if (instruction.type != MirType::Void)
+    store_result(native, value, RAX);
+}
+
+// the incoming values of the phis of to, for the edge from from, into their
+// incoming slots
+static void emit_phi_copies(NativeFunction* native, uint32_t from, uint32_t to)
+{
+  MirFunction const* function = native->function;
+  for (MirValue phi : function->blocks[to].instructions) {
+    MirInstruction const& instruction = function->values[phi];
+    if (instruction.opcode != MirOpcode::Phi)
+      break;
+
+    uint32_t incoming = 0;
+    while (instruction.incoming_blocks[incoming] != from)
+      incoming++;
+    load_value(native, instruction.operands[incoming], RAX);
+    emit(native, X86Opcode::Mov, X86Width::Quad, reg(RAX), x86_memory(RBP, native->incoming_slots[phi]));
+  }
+}
+
+static bool has_phis(MirFunction const* function, uint32_t block)
+{
+  MirArray<MirValue> const& instructions = function->blocks[block].instructions;
+  return instructions.size && function->values[instructions[0]].opcode == MirOpcode::Phi;
+}
+
+// blocks are labels by their number
+static void emit_jump(NativeFunction* native, uint32_t from, uint32_t to, uint32_t next_block)
+{
+  emit_phi_copies(native, from, to);
+  if (to != next_block)
+    emit_x86_jump(native->assembler, X86Condition::Always, to);
+}
+
+static void emit_terminator(NativeFunction* native, uint32_t block, MirValue value, uint32_t next_block)
+{
+  MirFunction const* function = native->function;
+  MirInstruction const& instruction = function->values[value];
+  MirArray<uint32_t> const& successors = function->blocks[block].successors;
+
+  switch (instruction.opcode) {
+  case MirOpcode::Br:
+    emit_jump(native, block, successors[0], next_block);
+    return;
+
+  case MirOpcode::CondBr: {
+    load_value(native, instruction.operands[0], RAX);
+    emit(native, X86Opcode::Test, X86Width::Byte, immediate(1), reg(RAX));
+
+    // the true edge jumps straight to its block unless it has phis to copy
+    // to, in which case the false edge jumps over them
+    if (!has_phis(function, successors[0])) {
+      emit_x86_jump(native->assembler, X86Condition::NE, successors[0]);
+      emit_jump(native, block, successors[1], next_block);
+      return;
+    }
+
+    MirValue cached[x86_register_count];
+    memcpy(cached, native->cached, sizeof(cached));
+    uint32_t false_edge = new_x86_label(native->assembler);
+    emit_x86_jump(native->assembler, X86Condition::E, false_edge);
+    emit_jump(native, block, successors[0], no_mir_block);
+    bind_x86_label(native->assembler, false_edge);
+    memcpy(native->cached, cached, sizeof(cached));
+    emit_jump(native, block, successors[1], next_block);
+    return;
+  }
+
+  case MirOpcode::Ret:
+    if (instruction.operands.size && is_mir_float_type(function->values[instruction.operands[0]].type))
+      load_float(native, instruction.operands[0], 0);
+    else if (instruction.operands.size) {
+      load_value(native, instruction.operands[0], RAX);
+      extend_to_int(native, RAX, function->values[instruction.operands[0]].type, function->object->type->function_data->return_type);
+    }
+    emit(native, X86Opcode::Leave, X86Width::Quad);
+    emit(native, X86Opcode::Ret, X86Width::Quad);
+    return;
+
+  case MirOpcode::Unreachable:
+    emit(native, X86Opcode::Ud2, X86Width::Quad);
+    return;
+
+  default:
+    assert(false && "Not a terminator");
+  }
+}
+
+static void emit_instruction(NativeFunction* native, MirValue value)
+{
+  switch (native->function->values[value].opcode) {
+  case MirOpcode::Add:
+  case MirOpcode::Sub:
+  case MirOpcode::Mul:
+  case MirOpcode::Shl:
+  case MirOpcode::LShr:
+  case MirOpcode::AShr:
+  case MirOpcode::And:
+  case MirOpcode::Or:
+  case MirOpcode::Xor:
+    emit_integer_operation(native, value);
+    return;
+  case MirOpcode::SDiv:
+  case MirOpcode::UDiv:
+  case MirOpcode::SRem:
+  case MirOpcode::URem:
+    emit_division(native, value);
+    return;
+  case MirOpcode::FAdd:
+  case MirOpcode::FSub:
+  case MirOpcode::FMul:
+  case MirOpcode::FDiv:
+  case MirOpcode::FNeg:
+    emit_float_operation(native, value);
+    return;
+  case MirOpcode::ICmp:
+    emit_integer_comparison(native, value);
+    return;
+  case MirOpcode::FCmp:
+    emit_float_comparison(native, value);
+    return;
+  case MirOpcode::Trunc:
+  case MirOpcode::ZExt:
+  case MirOpcode::SExt:
+  case MirOpcode::FPTrunc:
+  case MirOpcode::FPExt:
+  case MirOpcode::FPToSI:
+  case MirOpcode::FPToUI:
+  case MirOpcode::SIToFP:
+  case MirOpcode::UIToFP:
+  case MirOpcode::PtrToInt:
+  case MirOpcode::IntToPtr:
+    emit_conversion(native, value);
+    return;
+  case MirOpcode::Load:
+    emit_load(native, value);
+    return;
+  case MirOpcode::Store:
+    emit_store(native, value);
+    return;
+  case MirOpcode::PtrAdd:
+    emit_pointer_add(native, value);
+    return;
+  case MirOpcode::Call:
+    emit_call(native, value, false);
+    return;
+  // allocas are addresses in the frame, materialized where used, and phis
+  // are filled in by their predecessors
+  case MirOpcode::Alloca:
+  case MirOpcode::Phi:
+    return;
+  default:
+    assert(false && "Not an instruction");
+  }
+}
+
+static unsigned align_up(unsigned offset, unsigned alignment) { return (offset + alignment - 1) / alignment * alignment; }
+
+// %rbp is 16 byte aligned after the push in the prologue, so areas below it
+// at a multiple of their alignment are aligned, up to 16
+static void lay_out_frame(NativeFunction* native)
+{
+  MirFunction const* function = native->function;
+  native->slots.assign(function->values.size(), 0);
+  native->incoming_slots.assign(function->values.size(), 0);
+
+  unsigned offset = 0;
+  auto reserve = [&](unsigned long long size, unsigned alignment) {
+    offset = align_up(offset + (unsigned)size, alignment);
+    return -(int)offset;
+  };
+
+  // arguments after the sixth integer or eighth floating point one are
+  // already on the stack, above the return address and the saved %rbp
+  unsigned integer_arguments = 0, float_arguments = 0, stack_arguments = 0;
+  for (MirValue argument = 0; argument < function->parameter_count; argument++) {
+    bool is_float = is_mir_float_type(function->values[argument].type);
+    unsigned& in_registers = is_float ? float_arguments : integer_arguments;
+    if (in_registers < (is_float ? xmm_argument_count : argument_register_count)) {
+      in_registers++;
+      native->slots[argument] = reserve(8, 8);
+    } else {
+      native->slots[argument] = 16 + 8 * (int)stack_arguments++;
+    }
+  }
+
+  for (MirBlock const& block : function->blocks) {
+    if (block.is_removed)
+      continue;
+    for (MirValue value : block.instructions) {
+      MirInstruction const& instruction = function->values[value];
+      if (instruction.opcode == MirOpcode::Alloca) {
+        unsigned alignment = std::max(instruction.alignment, 1u);
+        unsigned long long size = std::max(instruction.constant, 1ll);
+        native->slots[value] = alignment > 16 ? reserve(size + alignment - 16, 16) : reserve(size, alignment);
+        continue;
+      }
+      if (instruction.type == MirType::Void)
+        continue;
+      native->slots[value] = reserve(8, 8);
+      if (instruction.opcode == MirOpcode::Phi)
+        native->incoming_slots[value] = reserve(8, 8);
+    }
+  }
+
+  native->frame_size = align_up(offset, 16);
+}
+
+static void emit_prologue(NativeFunction* native)
+{
+  MirFunction const* function = native->function;
+
+  emit(native, X86Opcode::Push, X86Width::Quad, {}, reg(RBP));
+  emit(native, X86Opcode::Mov, X86Width::Quad, reg(RSP), reg(RBP));
+  if (native->frame_size)
+    emit(native, X86Opcode::Sub, X86Width::Quad, immediate(native->frame_size), reg(RSP));
+
+  unsigned integer_arguments = 0, float_arguments = 0;
+  for (MirValue argument = 0; argument < function->parameter_count; argument++) {
+    if (native->slots[argument] > 0)
+      continue;
+    if (is_mir_float_type(function->values[argument].type))
+      emit(native, X86Opcode::MovS, X86Width::Double, x86_xmm(float_arguments++), slot(native, argument));
+    else
+      emit(native, X86Opcode::Mov, X86Width::Quad, reg(argument_registers[integer_arguments++]), slot(native, argument));
+  }
+}
+
+// false, having emitted nothing, for functions the mid-level IR can't
+// express or that make musttail calls this can't, which LLVM compiles instead
+static bool emit_native_function(Object const* function_object, NativeModule const* module, X86Assembler* assembler)
+{
+  CodegenOptions const& options = *module->options;
+  MirFunction* function = lower_function_to_mir(function_object, options);
+  if (!function)
+    return false;
+
+  if (options.mid_level_ir) {
+    std::vector<MirPass const*> passes;
+    std::string unknown_pass;
+    bool is_valid_pipeline = parse_mir_pipeline(options.mir_pipeline, &passes, &unknown_pass);
+    assert(is_valid_pipeline && "The MIR pipeline is checked by the driver");
+    (void)is_valid_pipeline;
+    run_mir_passes(function, passes);
+  }
+
+  if (has_musttail_calls_on_stack(function)) {
+    free_mir_function(function);
+    return false;
+  }
+
+  NativeFunction native { function, module, assembler, {}, {}, 0, {} };
+  lay_out_frame(&native);
+
+  std::string const& name = function_object->identifier;
+  if (OutputBuffer* text = assembler->text) {
+    print(text, "\n  .text\n");
+    if (!(function_object->declaration_specifiers.flags & TypeModifierFlag::Static))
+      print(text, "  .globl ", name, "\n");
+    print(text, "  .p2align 4\n  .type ", name, ", @function\n", name, ":\n");
+  }
+  begin_x86_function(assembler, &name, (uint32_t)function->blocks.size());
+  emit_prologue(&native);
+
+  std::vector<uint32_t> blocks;
+  for (uint32_t block = 0; block < function->blocks.size(); block++)
+    if (!function->blocks[block].is_removed)
+      blocks.push_back(block);
+
+  for (size_t i = 0; i < blocks.size(); i++) {
+    uint32_t block = blocks[i];
+    uint32_t next_block = i + 1 < blocks.size() ? blocks[i + 1] : no_mir_block;
+
+    clear_register_cache(&native);
+    if (block)
+      bind_x86_label(assembler, block);
+
+    for (MirValue value : function->blocks[block].instructions) {
+      if (function->values[value].opcode != MirOpcode::Phi)
+        break;
+      emit(&native, X86Opcode::Mov, X86Width::Quad, x86_memory(RBP, native.incoming_slots[value]), reg(RAX));
+      store_result(&native, value, RAX);
+    }
+
+    MirArray<MirValue> const& instructions = function->blocks[block].instructions;
+    for (uint32_t j = 0; j < instructions.size; j++) {
+      MirValue value = instructions[j];
+      // the call takes the place of the return after it
+      if (is_sibling_call(function, instructions, j)) {
+        emit_call(&native, value, true);
+        break;
+      }
+      if (is_mir_terminator(function->values[value].opcode))
+        emit_terminator(&native, block, value, next_block);
+      else
+        emit_instruction(&native, value);
+    }
+  }
+
+  end_x86_function(assembler);
+  if (assembler->text)
+    print(assembler->text, "  .size ", name, ", .-", name, "\n");
+  free_mir_function(function);
+  return true;
+}
+
+static char const* data_directive(unsigned long long size)
+{
+  switch (size) {
+  case 1:
+    return ".byte";
+  case 2:
+    return ".short";
+  case 4:
+    return ".long";
+  default:
+    return ".quad";
+  }
+}
+
+// where the translation unit goes, as text or as the sections of an object
+struct NativeOutput {
+  OutputBuffer* text;
+  ElfObject* object;
+};
+
+// zero initialized objects go in .bss, or .tbss for thread locals, and take
+// up no space in the object file
+static void emit_native_global_variable(ASTNode const* declaration_node, NativeModule const* module, NativeOutput const& output)
+{
+  Object const* object = declaration_node->object;
+  if (!module->definitions.count(object))
+    return;
+
+  int flags = object->declaration_specifiers.flags;
+  FundamentalType fundamental_type = object->type->fundamental_type;
+  if (!is_scalar_type(fundamental_type) && declaration_node->rhs) {
+    fprintf(stderr, "Initializers for static structs, unions, arrays and vectors not implemented\n");
+    exit(1);
+  }
+
+  long long initial_value = declaration_node->rhs ? static_initializer_value(declaration_node->rhs) : 0;
+  unsigned long long size = size_of_type(object->type);
+  unsigned alignment = allocation_alignment(object, *module->options);
+  bool is_thread_local = flags & TypeModifierFlag::ThreadLocal;
+  bool is_static = flags & TypeModifierFlag::Static;
+  std::string const& name = object->identifier;
+
+  if (OutputBuffer* text = output.text) {
+    if (initial_value)
+      print(text, is_thread_local ? "\n  .section .tdata,\"awT\",@progbits\n" : "\n  .data\n");
+    else
+      print(text, is_thread_local ? "\n  .section .tbss,\"awT\",@nobits\n" : "\n  .bss\n");
+
+    if (!is_static)
+      print(text, "  .globl ", name, "\n");
+    print(text, "  .p2align ", (unsigned)__builtin_ctz(alignment), "\n");
+    print(text, "  .type ", name, ", ", is_thread_local ? "@tls_object" : "@object", "\n  .size ", name, ", ", size, "\n", name, ":\n");
+    if (initial_value)
+      print(text, "  ", data_directive(size), " ", initial_value, "\n");
+    else
+      print(text, "  .zero ", std::max(size, 1ull), "\n");
+    return;
+  }
+
+  using namespace llvm::ELF;
+  uint64_t section_flags = SHF_ALLOC | SHF_WRITE | (is_thread_local ? (uint64_t)SHF_TLS : 0);
+  uint32_t section = initial_value ? elf_section(output.object, is_thread_local ? ".tdata" : ".data", SHT_PROGBITS, section_flags)
+                                   : elf_section(output.object, is_thread_local ? ".tbss" : ".bss", SHT_NOBITS, section_flags);
+
+  // little endian, the value's low bytes first
+  std::vector<char> bytes(std::max(size, 1ull));
+  for (unsigned i = 0; i < std::min<size_t>(bytes.size(), sizeof(initial_value)); i++)
+    bytes[i] = (char)((unsigned long long)initial_value >> (8 * i));
+  uint64_t offset = append_to_elf_section(output.object, section, initial_value ? bytes.data() : nullptr, bytes.size(), alignment);
+  define_elf_symbol(output.object, elf_symbol(output.object, name), section, offset, size, is_static ? STB_LOCAL : STB_GLOBAL,
+      is_thread_local ? STT_TLS : STT_OBJECT);
+}
+
+// a function's code into .text, with what it refers to as relocations
+static void define_native_function(ElfObject* object, Object const* function_object, X86Assembler const* assembler)
+{
+  using namespace llvm::ELF;
+  uint32_t text = elf_section(object, ".text", SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR);
+  OutputBuffer const* code = assembler->code;
+  uint64_t offset = append_to_elf_section(object, text, code->data, code->size, 16);
+
+  bool is_static = function_object->declaration_specifiers.flags & TypeModifierFlag::Static;
+  define_elf_symbol(object, elf_symbol(object, function_object->identifier), text, offset, code->size, is_static ? STB_LOCAL : STB_GLOBAL, STT_FUNC);
+
+  for (X86SymbolFixup const& fixup : assembler->symbol_fixups) {
+    uint32_t symbol = elf_symbol(object, *fixup.symbol);
+    // the linker checks that thread locals are only addressed as such
+    if (object->symbols[symbol].section == no_elf_section && (fixup.type == R_X86_64_GOTTPOFF || fixup.type == R_X86_64_TPOFF32))
+      object->symbols[symbol].type = STT_TLS;
+    object->sections[text].relocations.push_back({ offset + fixup.offset, symbol, fixup.type, fixup.addend });
+  }
+}
+
+// only the canonical declaration of each identifier defines it, see
+// name_resolution.cpp
+static void collect_definitions(ExternalDeclaration const* external_declaration, NativeModule* module)
+{
+  for (ExternalDeclaration const* current = external_declaration; current; current = current->next) {
+    for (ASTNode const* declaration_node = current->root_ast_node; declaration_node; declaration_node = declaration_node->next) {
+      Object const* object = declaration_node->object;
+      if (!object || !object->is_canonical || (object->declaration_specifiers.flags & TypeModifierFlag::TypeDef))
+        continue;
+
+      bool is_definition = object->type->fundamental_type == FundamentalType::Function
+                               ? object->function_body != nullptr
+                               : declaration_node->rhs || !(object->declaration_specifiers.flags & TypeModifierFlag::Extern);
+      if (is_definition)
+        module->definitions.insert(object);
+    }
+  }
+}
+
+// a function definition emitted on a worker thread, into its own buffer, see
+// the same in codegen.cpp. For an object file every function has a buffer of
+// its own, threads or not
+struct NativeFunctionJob {
+  Object const* function_object;
+  NativeModule const* module;
+  X86Assembler assembler;
+  bool is_emitted;
+  bool is_compiled;
+};
+
+static void emit_native_function_job(void* job_pointer)
+{
+  NativeFunctionJob* job = (NativeFunctionJob*)job_pointer;
+  job->is_compiled = emit_native_function(job->function_object, job->module, &job->assembler);
+  job->is_emitted = true;
+}
+
+// the functions the native backend left to LLVM, compiled at -O0 in a module
+// of their own, as assembly to append or as an object to merge
+static void emit_llvm_functions(ExternalDeclaration const* external_declaration, std::unordered_set<Object const*> const& functions, NativeOutput const& output,
+    MachineOptions const& machine_options, CodegenOptions const& options)
+{
+  llvm::LLVMContext context;
+  std::unique_ptr<llvm::Module> module = build_llvm_module(external_declaration, context, options, &functions);
+  std::unique_ptr<llvm::TargetMachine> machine = create_target_machine(machine_options, options, OptimizationLevel::O0);
+
+  if (output.text) {
+    llvm::SmallVector<char, 0> assembly = compile_module_to_memory(*module, *machine, llvm::CGFT_AssemblyFile);
+    print(output.text, "\n");
+    append_bytes(output.text, assembly.data(), assembly.size());
+    return;
+  }
+
+  llvm::SmallVector<char, 0> object = compile_module_to_memory(*module, *machine, llvm::CGFT_ObjectFile);
+  if (!merge_elf_object(output.object, llvm::StringRef(object.data(), object.size()))) {
+    fprintf(stderr, "Could not merge the object LLVM compiled for the native backend, aborting.\n");
+    exit(1);
+  }
+}
+
+void emit_native_from_translation_unit(ExternalDeclaration const* external_declaration, FILE* outfile, NativeFileKind file_kind,
+    MachineOptions const& machine_options, CodegenOptions const& options)
+{
+  NativeModule module { &options, {} };
+  collect_definitions(external_declaration, &module);
+
+  bool is_object = file_kind == NativeFileKind::Object;
+  std::vector<NativeFunctionJob> jobs;
+  for (ExternalDeclaration const* current = external_declaration; current; current = current->next)
+    if (current->type == ExternalDeclarationType::FunctionDefinition)
+      jobs.push_back({ current->root_ast_node->object, &module, {}, false, false });
+
+  size_t thread_count = std::min<size_t>(options.thread_count, jobs.size());
+  for (NativeFunctionJob& job : jobs) {
+    if (is_object)
+      job.assembler.code = new_memory_output_buffer();
+    else if (thread_count > 1)
+      job.assembler.text = new_memory_output_buffer();
+  }
+  if (thread_count > 1) {
+    ThreadPool* thread_pool = new_thread_pool(thread_count);
+    for (NativeFunctionJob& job : jobs)
+      thread_pool_submit(thread_pool, emit_native_function_job, &job);
+    thread_pool_wait(thread_pool);
+    free_thread_pool(thread_pool);
+  }
+
+  ElfObject object;
+  NativeOutput output { nullptr, nullptr };
+  if (is_object) {
+    output.object = &object;
+    elf_section(&object, ".text", llvm::ELF::SHT_PROGBITS, llvm::ELF::SHF_ALLOC | llvm::ELF::SHF_EXECINSTR);
+  } else {
+    fflush(outfile);
+    output.text = new_output_buffer(fileno(outfile));
+  }
+
+  std::unordered_set<Object const*> llvm_functions;
+  size_t next_function = 0;
+  for (ExternalDeclaration const* current = external_declaration; current; current = current->next) {
+    if (current->type == ExternalDeclarationType::Declaration) {
+      for (ASTNode const* declaration_node = current->root_ast_node; declaration_node; declaration_node = declaration_node->next) {
+        Object const* object = declaration_node->object;
+        if (object->type->fundamental_type != FundamentalType::Function && !(object->declaration_specifiers.flags & TypeModifierFlag::TypeDef))
+          emit_native_global_variable(declaration_node, &module, output);
+      }
+      continue;
+    }
+
+    NativeFunctionJob& job = jobs[next_function++];
+    if (!job.is_emitted) {
+      // printed straight to the file
+      if (!is_object)
+        job.assembler.text = output.text;
+      emit_native_function_job(&job);
+    }
+
+    if (!job.is_compiled)
+      llvm_functions.insert(job.function_object);
+    else if (is_object)
+      define_native_function(&object, job.function_object, &job.assembler);
+    else if (job.assembler.text != output.text)
+      append_output_buffer(output.text, job.assembler.text);
+
+    OutputBuffer* buffer = is_object ? job.assembler.code : job.assembler.text;
+    if (buffer != output.text)
+      free_output_buffer(buffer);
+  }
+
+  if (!llvm_functions.empty())
+    emit_llvm_functions(external_declaration, llvm_functions, output, machine_options, options);
+
+  // no executable stack
+  if (is_object) {
+    elf_section(&object, ".note.GNU-stack", llvm::ELF::SHT_PROGBITS, 0);
+    write_elf_object(&object, outfile);
+  } else {
+    print(output.text, "\n  .section .note.GNU-stack,\"\",@progbits\n");
+    free_output_buffer(output.text);
+  }
+}
@@ -0,0 +1,68 @@
+#include "optimizer.h"
+
+#include <llvm/Analysis/CGSCCPassManager.h>
+#include <llvm/Analysis/LoopAnalysisManager.h>
+#include <llvm/IR/PassManager.h>
+#include <llvm/Pass.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Passes/StandardInstrumentations.h>
+#include <llvm/Support/Error.h>
+
+#include <stdio.h>
+
+bool runs_passes(OptimizationOptions const& options) { return options.level != OptimizationLevel::O0 || !options.passes.empty(); }
+
+static llvm::OptimizationLevel pipeline_level(OptimizationLevel level)
+{
+  switch (level) {
+  case OptimizationLevel::O0:
+    return llvm::OptimizationLevel::O0;
+  case OptimizationLevel::O1:
+    return llvm::OptimizationLevel::O1;
+  case OptimizationLevel::O2:
+    return llvm::OptimizationLevel::O2;
+  case OptimizationLevel::O3:
+    return llvm::OptimizationLevel::O3;
+  case OptimizationLevel::Os:
+    return llvm::OptimizationLevel::Os;
+  }
+  return llvm::OptimizationLevel::O0;
+}
+
+// https://llvm.org/docs/NewPassManager.html#just-tell-me-how-to-run-the-default-optimization-pipeline-with-the-new-pass-manager
+void optimize_module(llvm::Module& module, OptimizationOptions const& options, llvm::TargetMachine* machine)
+{
+  // the timing report is printed when the instrumentation goes out of scope
+  llvm::TimePassesIsEnabled = options.time_passes;
+  llvm::PassInstrumentationCallbacks callbacks;
+  llvm::StandardInstrumentations instrumentations(false);
+  instrumentations.registerCallbacks(callbacks);
+
+  // without a target machine the pipelines only know the datalayout, not what
+  // the target's instructions cost
+  llvm::PassBuilder pass_builder(machine, llvm::PipelineTuningOptions(), llvm::None, &callbacks);
+
+  llvm::LoopAnalysisManager loop_analyses;
+  llvm::FunctionAnalysisManager function_analyses;
+  llvm::CGSCCAnalysisManager cgscc_analyses;
+  llvm::ModuleAnalysisManager module_analyses;
+  pass_builder.registerModuleAnalyses(module_analyses);
+  pass_builder.registerCGSCCAnalyses(cgscc_analyses);
+  pass_builder.registerFunctionAnalyses(function_analyses);
+  pass_builder.registerLoopAnalyses(loop_analyses);
+  pass_builder.crossRegisterProxies(loop_analyses, function_analyses, cgscc_analyses, module_analyses);
+
+  llvm::ModulePassManager passes;
+  if (!options.passes.empty()) {
+    if (llvm::Error error = pass_builder.parsePassPipeline(passes, options.passes)) {
+      fprintf(stderr, "Invalid pass pipeline %s: %s, aborting.\n", options.passes.c_str(), llvm::toString(std::move(error)).c_str());
+      exit(1);
+    }
+  } else if (options.level == OptimizationLevel::O0) {
+    passes = pass_builder.buildO0DefaultPipeline(llvm::OptimizationLevel::O0);
+  } else {
+    passes = pass_builder.buildPerModuleDefaultPipeline(pipeline_level(options.level));
+  }
+
+  passes.run(module, module_analyses);
+}
@@ -0,0 +1,151 @@
+#include "output_buffer.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+
+OutputBuffer* new_output_buffer(int fd)
+{
+  OutputBuffer* output = new OutputBuffer;
+  output->fd = fd;
+  output->data = new char[output_buffer_capacity];
+  output->size = 0;
+  output->capacity = output_buffer_capacity;
+  return output;
+}
+
+OutputBuffer* new_memory_output_buffer()
+{
+  OutputBuffer* output = new OutputBuffer;
+  output->fd = -1;
+  output->data = new char[memory_output_buffer_capacity];
+  output->size = 0;
+  output->capacity = memory_output_buffer_capacity;
+  return output;
+}
+
+// write may take less than it was given, e.g. for a pipe
+static void write_all(int fd, char const* bytes, size_t length)
+{
+  while (length) {
+    ssize_t written = write(fd, bytes, length);
+    if (written < 0 && errno == EINTR)
+      continue;
+    if (written < 0) {
+      perror("Writing the output failed");
+      exit(1);
+    }
+
+    bytes += written;
+    length -= (size_t)written;
+  }
+}
+
+void flush_output_buffer(OutputBuffer* output)
+{
+  if (output->fd < 0)
+    return;
+
+  write_all(output->fd, output->data, output->size);
+  output->size = 0;
+}
+
+// at least doubling, so appending stays linear overall
+static void grow_and_append_bytes(OutputBuffer* output, char const* bytes, size_t length)
+{
+  size_t capacity = std::max(output->capacity * 2, output->size + length);
+  char* data = new char[capacity];
+  memcpy(data, output->data, output->size);
+  delete[] output->data;
+  output->data = data;
+  output->capacity = capacity;
+
+  memcpy(output->data + output->size, bytes, length);
+  output->size += length;
+}
+
+void flush_and_append_bytes(OutputBuffer* output, char const* bytes, size_t length)
+{
+  if (output->fd < 0) {
+    grow_and_append_bytes(output, bytes, length);
+    return;
+  }
+
+  flush_output_buffer(output);
+
+  // never the case for one instruction, but a huge type string, or a function
+  // emitted on its own, could be
+  if (length > output->capacity) {
+    write_all(output->fd, bytes, length);
+    return;
+  }
+
+  memcpy(output->data, bytes, length);
+  output->size = length;
+}
+
+void free_output_buffer(OutputBuffer* output)
+{
+  flush_output_buffer(output);
+  delete[] output->data;
+  delete output;
+}
+
+static char const decimal_digit_pairs[] = "00010203040506070809"
+                                          "10111213141516171819"
+                                          "20212223242526272829"
+                                          "30313233343536373839"
+                                          "40414243444546474849"
+                                          "50515253545556575859"
+                                          "60616263646566676869"
+                                          "70717273747576777879"
+                                          "80818283848586878889"
+                                          "90919293949596979899";
+
+// digits are written from the end of a scratch buffer backwards, two per
+// division, which is what makes this faster than printf's one at a time
+void append_unsigned(OutputBuffer* output, unsigned long long value)
+{
+  char digits[20];
+  char* start = digits + sizeof(digits);
+
+  while (value >= 100) {
+    unsigned pair = (unsigned)(value % 100) * 2;
+    value /= 100;
+    start -= 2;
+    start[0] = decimal_digit_pairs[pair];
+    start[1] = decimal_digit_pairs[pair + 1];
+  }
+
+  if (value >= 10) {
+    start -= 2;
+    start[0] = decimal_digit_pairs[value * 2];
+    start[1] = decimal_digit_pairs[value * 2 + 1];
+  } else {
+    *--start = (char)('0' + value);
+  }
+
+  append_bytes(output, start, (size_t)(digits + sizeof(digits) - start));
+}
+
+void append_signed(OutputBuffer* output, long long value)
+{
+  if (value >= 0) {
+    append_unsigned(output, (unsigned long long)value);
+    return;
+  }
+
+  // negating LLONG_MIN overflows, its magnitude is fine as unsigned
+  append_bytes(output, "-", 1);
+  append_unsigned(output, 0ull - (unsigned long long)value);
+}
+
+void append_hex(OutputBuffer* output, unsigned long long value, unsigned digits)
+{
+  char hex[16];
+  for (unsigned i = digits; i-- > 0; value >>= 4)
+    hex[i] = "0123456789ABCDEF"[value & 0xf];
+  append_bytes(output, hex, digits);
+}
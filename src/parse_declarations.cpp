@@ -1,9 +1,15 @@
+#include "layout.h"
 #include "lexer.h"
 #include "parser.h"
 #include "type.h"
 
+#include <algorithm>
 #include <cassert>
 
+static Type const* parse_struct_or_union_specifier(Lexer*, Scope*);
+static void parse_alignment_specifier(Lexer*, Scope*, DeclarationSpecifierFlags*);
+static DeclarationSpecifierFlags parse_type_qualifier_list(Lexer*);
+
 static void error_and_stop_parsing(char const* message)
 {
   fprintf(stderr, "%s", message);
@@ -12,51 +18,43 @@ static void error_and_stop_parsing(char const* message)
 
 ASTNode* new_ast_node(Scope* scope, ASTNodeType type = ASTNodeType::Void)
 {
-  ASTNode* new_node = (ASTNode*)malloc(sizeof(ASTNode));
+  // ASTNodes own a std::string, so they need to be constructed, not just malloc'd
+  ASTNode* new_node = new ASTNode;
 
   new_node->type = type;
   new_node->data_type = FundamentalType::Void;
+  new_node->expression_type = nullptr;
   new_node->scope = scope;
 
   new_node->conditional = nullptr;
+  new_node->body = nullptr;
   new_node->lhs = nullptr;
   new_node->rhs = nullptr;
   new_node->next = nullptr;
+  new_node->object = nullptr;
+  new_node->member_index = 0;
+  new_node->tail_call_kind = TailCallKind::None;
 
   return new_node;
 }
 
-static Object* new_object(std::string const& identifier, Type const* type)
+Object* new_object(std::string const& identifier, Type const* type)
 {
-  Object* new_object = (Object*)malloc(sizeof(Object));
+  Object* new_object = new Object;
   new_object->identifier = identifier;
   new_object->type = type;
   new_object->function_body = nullptr;
+  new_object->declaration_specifiers.flags = 0;
+  new_object->alignment = 0;
+  new_object->local_slot = -1;
+  new_object->local_count = 0;
+  new_object->is_address_taken = false;
+  new_object->inferred_attributes = { true, true, true, true, false, false, false, false };
+  new_object->is_canonical = false;
 
   return new_object;
 }
 
-static FunctionData const* new_function_data(Type const* return_type, FunctionParameter const* parameter_list, bool is_variadic)
-{
-  FunctionData* new_function_type = (FunctionData*)malloc(sizeof(FunctionData));
-
-  new_function_type->return_type = return_type;
-  new_function_type->parameter_list = parameter_list;
-  new_function_type->is_variadic = is_variadic;
-
-  return new_function_type;
-}
-
-static FunctionParameter* new_function_parameter(Type const* parameter_type, std::string const& identifier)
-{
-  FunctionParameter* new_parameter = (FunctionParameter*)malloc(sizeof(FunctionParameter));
-
-  new_parameter->parameter_type = parameter_type;
-  new_parameter->next_parameter = nullptr;
-  new_parameter->identifier = identifier;
-
-  return new_parameter;
-}
 
 Object* variable_in_scope(std::string const& variable_name, Scope* scope)
 {
@@ -69,17 +67,34 @@ Object* variable_in_scope(std::string const& variable_name, Scope* scope)
   return nullptr;
 }
 
-static bool typedef_name_in_scope(std::string const& type_name, Scope* scope)
+// the typedef declaring type_name, or null if it isn't a typedef name here
+static Object* typedef_in_scope(std::string const& type_name, Scope* scope)
 {
-
   for (Scope* current_scope = scope; current_scope != nullptr; current_scope = current_scope->parent_scope) {
+    auto entry = current_scope->typedef_names.find(type_name);
+    if (entry != current_scope->typedef_names.end())
+      return entry->second;
 
-    if (current_scope->typedef_names.contains(type_name)) {
-      return true;
-    }
+    // an inner declaration of the name as a variable hides the typedef
+    if (current_scope->variables.contains(type_name))
+      return nullptr;
   }
 
-  return false;
+  return nullptr;
+}
+
+// 6.2.3 typedef names share the ordinary identifier name space with variables
+// and functions, but a parser has to tell them apart, so they're kept apart
+void declare_identifier(Scope* scope, Object* object)
+{
+  if (object->declaration_specifiers.flags & TypeModifierFlag::TypeDef) {
+    scope->variables.erase(object->identifier);
+    scope->typedef_names[object->identifier] = object;
+    return;
+  }
+
+  scope->typedef_names.erase(object->identifier);
+  scope->variables[object->identifier] = object;
 }
 
 static bool token_is_type_qualifier(Token const* token)
@@ -133,8 +148,10 @@ static bool token_is_type_specifier(Token const* token, Scope* scope)
   case TokenType::Enum:
   case TokenType::Union:
     return true;
+  case TokenType::Identifier:
+    return typedef_in_scope(token->string, scope) != nullptr;
   default:
-    return typedef_name_in_scope(token->string, scope);
+    return false;
   }
 }
 
@@ -162,6 +179,33 @@ bool token_is_declaration_specifier(Token const* token, Scope* scope)
 //
 // one set of declaration specifiers applies to each item in the init declarator
 // list, so we can cache all those in this DeclarationSpecifierFlags object
+// storage classes, qualifiers and the like, which can come before a typedef name
+static constexpr int type_specifier_free_flags = TypeModifierFlag::TypeDef | TypeModifierFlag::Extern | TypeModifierFlag::Static
+    | TypeModifierFlag::ThreadLocal | TypeModifierFlag::Auto | TypeModifierFlag::Register | TypeModifierFlag::Const | TypeModifierFlag::Restrict
+    | TypeModifierFlag::Volatile | TypeModifierFlag::Atomic | TypeModifierFlag::Inline | TypeModifierFlag::NoReturn | TypeModifierFlag::Alignas;
+
+// the type name of _Atomic ( type-name ), qualifiers inside the parentheses
+// are not allowed, so neither is another _Atomic
+static Type const* parse_atomic_type_specifier(Lexer* lexer, Scope* scope)
+{
+  get_next_token(lexer);
+  expect_and_get_next_token(lexer, TokenType::LParen, "Expected ( after _Atomic\n");
+
+  if (!token_is_declaration_specifier(get_current_token(lexer), scope))
+    error_and_stop_parsing("Expected a type name in _Atomic ( type-name )\n");
+
+  DeclarationSpecifierFlags type_specifiers = parse_declaration_specifiers(lexer, scope);
+  if (type_specifiers.flags & (TypeModifierFlag::Const | TypeModifierFlag::Restrict | TypeModifierFlag::Volatile | TypeModifierFlag::Atomic))
+    error_and_stop_parsing("The type name in _Atomic ( type-name ) cannot be qualified\n");
+
+  Type const* type = declaration_to_fundamental_type(&type_specifiers);
+  if (get_current_token(lexer)->type == TokenType::Asterisk)
+    type = parse_pointer(lexer, type);
+
+  expect_and_get_next_token(lexer, TokenType::RParen, "Expected ) after _Atomic type name\n");
+  return type;
+}
+
 DeclarationSpecifierFlags parse_declaration_specifiers(Lexer* lexer, Scope* scope)
 {
 
@@ -169,8 +213,48 @@ DeclarationSpecifierFlags parse_declaration_specifiers(Lexer* lexer, Scope* scop
   declaration.flags = 0;
 
   while (token_is_declaration_specifier(get_current_token(lexer), scope)) {
-    update_declaration_specifiers(get_current_token(lexer), &declaration);
-    get_next_token(lexer);
+    Token const* current_token = get_current_token(lexer);
+
+    // 6.7.2.2 a typedef name is the only type specifier in its declaration,
+    // so after any other one the name must be the declarator, e.g.
+    // typedef int T; { int T; }
+    if (current_token->type == TokenType::Identifier) {
+      if ((declaration.flags & ~type_specifier_free_flags) || declaration.tag_type || declaration.typedef_type)
+        break;
+
+      declaration.flags |= TypeModifierFlag::TypeDefName;
+      declaration.typedef_type = typedef_in_scope(current_token->string, scope)->type;
+      get_next_token(lexer);
+      continue;
+    }
+
+    // 6.7.2.4 _Atomic ( type-name ) is a type specifier, a lone _Atomic is
+    // a qualifier
+    if (current_token->type == TokenType::Atomic && peek_next_token(lexer).type == TokenType::LParen) {
+      if ((declaration.flags & ~type_specifier_free_flags) || declaration.tag_type || declaration.typedef_type)
+        error_and_stop_parsing("_Atomic ( type-name ) must be the only type specifier\n");
+
+      declaration.flags |= TypeModifierFlag::TypeDefName;
+      declaration.typedef_type = intern_atomic_type(parse_atomic_type_specifier(lexer, scope));
+      continue;
+    }
+
+    update_declaration_specifiers(current_token, &declaration);
+
+    switch (current_token->type) {
+    case TokenType::Struct:
+    case TokenType::Union:
+      declaration.tag_type = parse_struct_or_union_specifier(lexer, scope);
+      break;
+
+    case TokenType::AlignAs:
+      parse_alignment_specifier(lexer, scope, &declaration);
+      break;
+
+    default:
+      get_next_token(lexer);
+      break;
+    }
   }
 
   return declaration;
@@ -197,9 +281,16 @@ ASTNode* parse_declaration(Lexer* lexer, Scope* scope)
   DeclarationSpecifierFlags declaration = parse_declaration_specifiers(lexer, scope);
   Type const* fundamental_type_ptr = declaration_to_fundamental_type(&declaration);
 
+  // e.g. struct s { int x; }; only declares the tag
+  if (declaration.tag_type && get_current_token(lexer)->type == TokenType::Semicolon) {
+    get_next_token(lexer);
+    return nullptr;
+  }
+
   ASTNode* ast_node = new_ast_node(scope, ASTNodeType::Declaration);
   ast_node->object = parse_declarator(lexer, fundamental_type_ptr, scope);
-  scope->variables.insert_or_assign(ast_node->object->identifier, ast_node->object);
+  ast_node->object->declaration_specifiers = declaration;
+  declare_identifier(scope, ast_node->object);
 
   parse_rest_of_declaration(lexer, scope, ast_node);
 
@@ -227,12 +318,13 @@ void parse_rest_of_declaration(Lexer* lexer, Scope* scope, ASTNode* head_ast_nod
     // make new node with object from declarator
     ASTNode* current_ast_node = new_ast_node(scope, ASTNodeType::Declaration);
     current_ast_node->object = parse_declarator(lexer, head_ast_node->object->type, scope);
-    scope->variables[current_ast_node->object->identifier] = current_ast_node->object;
+    current_ast_node->object->declaration_specifiers = head_ast_node->object->declaration_specifiers;
+    declare_identifier(scope, current_ast_node->object);
 
     // new identifier is explicitly initialized - get initializer
     if (get_current_token(lexer)->type == TokenType::Equals) {
       get_next_token(lexer);
-      parse_initializer(lexer, scope);
+      current_ast_node->rhs = parse_initializer(lexer, scope);
     }
 
     previous_ast_node->next = current_ast_node;
@@ -243,15 +335,404 @@ void parse_rest_of_declaration(Lexer* lexer, Scope* scope, ASTNode* head_ast_nod
   expect_and_get_next_token(lexer, TokenType::Semicolon, "Expected semicolon at end of declaration\n");
 }
 
+// integer constant expressions, e.g. array sizes and alignments
+// FIXME: only literals for now, constant folding comes with a constant evaluator
+static long long parse_integer_constant_expression(Lexer* lexer, Scope* scope, char const* error_message)
+{
+  ASTNode* constant_expression = parse_conditional_expression(lexer, scope);
+  if (constant_expression->type != ASTNodeType::NumericConstant || !is_integer_type(constant_expression->data_type))
+    error_and_stop_parsing(error_message);
+
+  return numeric_constant_value(constant_expression);
+}
+
+// 6.2.8.4 valid alignments are powers of two
+static unsigned parse_alignment(Lexer* lexer, Scope* scope)
+{
+  long long alignment = parse_integer_constant_expression(lexer, scope, "Expected an integer constant alignment\n");
+  if (alignment < 0 || (alignment & (alignment - 1)))
+    error_and_stop_parsing("Alignment must be a power of two\n");
+
+  return (unsigned)alignment;
+}
+
+// 6.7.5 Alignment specifier
+//
+// alignment-specifier:
+//      _Alignas ( type-name )
+//      _Alignas ( constant-expression )
+//
+// with several, the strictest one wins, and _Alignas(0) has no effect
+static void parse_alignment_specifier(Lexer* lexer, Scope* scope, DeclarationSpecifierFlags* declaration)
+{
+  assert(get_current_token(lexer)->type == TokenType::AlignAs);
+  get_next_token(lexer);
+  expect_and_get_next_token(lexer, TokenType::LParen, "Expected ( after _Alignas\n");
+
+  unsigned alignment;
+  if (token_is_declaration_specifier(get_current_token(lexer), scope)) {
+    DeclarationSpecifierFlags type_specifiers = parse_declaration_specifiers(lexer, scope);
+    Type const* aligned_type = declaration_to_fundamental_type(&type_specifiers);
+    if (get_current_token(lexer)->type == TokenType::Asterisk)
+      aligned_type = parse_pointer(lexer, aligned_type);
+    alignment = alignment_of_type(aligned_type);
+  } else {
+    alignment = parse_alignment(lexer, scope);
+  }
+
+  expect_and_get_next_token(lexer, TokenType::RParen, "Expected ) after _Alignas operand\n");
+  declaration->alignment = std::max(declaration->alignment, alignment);
+}
+
+// GNU attributes
+//
+//      __attribute__ (( attribute-list ))
+//
+// only the ones that change the layout of a type are understood, packed and
+// aligned(n) on structs, and vector_size(n) on declarators. aligned without an
+// argument is the strictest fundamental alignment
+struct Attributes {
+  bool is_packed;
+  unsigned alignment;
+  // in bytes, 0 without the attribute
+  unsigned long long vector_size;
+};
+
+static constexpr unsigned maximum_fundamental_alignment = 16;
+
+static bool token_is_attribute_keyword(Token const* token)
+{
+  return token->type == TokenType::Identifier && token->string == "__attribute__";
+}
+
+static void parse_attributes(Lexer* lexer, Scope* scope, Attributes* attributes)
+{
+  while (token_is_attribute_keyword(get_current_token(lexer))) {
+    get_next_token(lexer);
+    expect_and_get_next_token(lexer, TokenType::LParen, "Expected (( after __attribute__\n");
+    expect_and_get_next_token(lexer, TokenType::LParen, "Expected (( after __attribute__\n");
+
+    while (get_current_token(lexer)->type != TokenType::RParen) {
+      Token const* attribute_token = get_current_token(lexer);
+      if (attribute_token->type != TokenType::Identifier)
+        error_token(lexer, "Expected attribute name\n");
+
+      std::string const attribute_name = attribute_token->string;
+      get_next_token(lexer);
+
+      if (attribute_name == "packed" || attribute_name == "__packed__") {
+        attributes->is_packed = true;
+      } else if (attribute_name == "aligned" || attribute_name == "__aligned__") {
+        unsigned alignment = maximum_fundamental_alignment;
+        if (get_current_token(lexer)->type == TokenType::LParen) {
+          get_next_token(lexer);
+          alignment = parse_alignment(lexer, scope);
+          expect_and_get_next_token(lexer, TokenType::RParen, "Expected ) after aligned attribute argument\n");
+        }
+        attributes->alignment = std::max(attributes->alignment, alignment);
+      } else if (attribute_name == "vector_size" || attribute_name == "__vector_size__") {
+        expect_and_get_next_token(lexer, TokenType::LParen, "Expected ( after vector_size\n");
+        long long vector_size = parse_integer_constant_expression(lexer, scope, "Expected an integer constant vector size\n");
+        if (vector_size <= 0)
+          error_and_stop_parsing("Vector size must be positive\n");
+        attributes->vector_size = (unsigned long long)vector_size;
+        expect_and_get_next_token(lexer, TokenType::RParen, "Expected ) after vector_size argument\n");
+      } else {
+        error_token(lexer, "Unsupported attribute\n");
+      }
+
+      if (get_current_token(lexer)->type != TokenType::RParen)
+        expect_and_get_next_token(lexer, TokenType::Comma, "Expected , or ) in attribute list\n");
+    }
+
+    get_next_token(lexer);
+    expect_and_get_next_token(lexer, TokenType::RParen, "Expected )) after attribute list\n");
+  }
+}
+
 // 6.7.2 Structs, unions, enums
 
+static Type* tag_in_scope(std::string const& tag, Scope* scope)
+{
+  for (Scope* current_scope = scope; current_scope != nullptr; current_scope = current_scope->parent_scope) {
+    auto entry = current_scope->tags.find(tag);
+    if (entry != current_scope->tags.end())
+      return entry->second;
+  }
+
+  return nullptr;
+}
+
+static bool is_flexible_array_type(Type const* type) { return type->fundamental_type == FundamentalType::Array && type->array_length < 0; }
+
+// 6.7.2.1.3 members can't be functions or have incomplete types, except that
+// the last member of a struct with other named members may be an array of
+// unknown size, the flexible array member
+static void check_struct_members(Type const* struct_type)
+{
+  std::vector<StructMember> const& members = struct_type->struct_data->members;
+
+  for (size_t i = 0; i < members.size(); i++) {
+    Type const* member_type = members[i].member_type;
+
+    if (member_type->fundamental_type == FundamentalType::Function)
+      error_and_stop_parsing("Struct members can't have function type\n");
+
+    if (is_flexible_array_type(member_type)) {
+      if (struct_type->fundamental_type == FundamentalType::Union || i + 1 != members.size() || members.size() == 1)
+        error_and_stop_parsing("A flexible array member must be the last member of a struct with other members\n");
+      if (is_incomplete_type(member_type->pointed_type))
+        error_and_stop_parsing("Struct member has incomplete type\n");
+      continue;
+    }
+
+    if (is_incomplete_type(member_type))
+      error_and_stop_parsing("Struct member has incomplete type\n");
+
+    for (size_t j = 0; j < i; j++)
+      if (members[j].identifier == members[i].identifier)
+        error_and_stop_parsing("Duplicate struct member\n");
+  }
+}
+
+// struct-declaration-list:
+//      struct-declaration
+//      struct-declaration-list struct-declaration
+//
+// struct-declaration:
+//      specifier-qualifier-list struct-declarator-list(opt) ;
+//      static_assert-declaration
+//
+// struct-declarator:
+//      declarator
+//      declarator(opt) : constant-expression
+static void parse_struct_declaration_list(Lexer* lexer, Scope* scope, Type* struct_type)
+{
+  assert(get_current_token(lexer)->type == TokenType::LBrace);
+  get_next_token(lexer);
+
+  int const non_member_specifiers = TypeModifierFlag::TypeDef | TypeModifierFlag::Extern | TypeModifierFlag::Static | TypeModifierFlag::ThreadLocal
+      | TypeModifierFlag::Auto | TypeModifierFlag::Register | TypeModifierFlag::Inline | TypeModifierFlag::NoReturn;
+
+  while (get_current_token(lexer)->type != TokenType::RBrace) {
+    if (!token_is_declaration_specifier(get_current_token(lexer), scope))
+      error_token(lexer, "Expected a member declaration\n");
+
+    DeclarationSpecifierFlags specifiers = parse_declaration_specifiers(lexer, scope);
+    if (specifiers.flags & non_member_specifiers)
+      error_token(lexer, "Storage class and function specifiers are not allowed on struct members\n");
+
+    Type const* base_type = declaration_to_fundamental_type(&specifiers);
+
+    // FIXME: anonymous structs and unions, C11 6.7.2.1.13
+    if (get_current_token(lexer)->type == TokenType::Semicolon)
+      error_token(lexer, "Anonymous struct members not implemented\n");
+
+    for (;;) {
+      Object* member = parse_declarator(lexer, base_type, scope);
+
+      // FIXME: bit-fields
+      if (get_current_token(lexer)->type == TokenType::Colon)
+        error_token(lexer, "Bit-fields not implemented\n");
+
+      // 6.7.5.4 _Alignas can't make a member less strictly aligned than its type
+      // flexible array members are checked with the rest of the members
+      if (specifiers.alignment && !is_flexible_array_type(member->type) && !is_incomplete_type(member->type)
+          && specifiers.alignment < alignment_of_type(member->type))
+        error_and_stop_parsing("_Alignas can't weaken the alignment of a member's type\n");
+
+      unsigned alignment = std::max(specifiers.alignment, member->alignment);
+      struct_type->struct_data->members.push_back({ member->identifier, member->type, alignment });
+      delete member;
+
+      if (get_current_token(lexer)->type != TokenType::Comma)
+        break;
+      get_next_token(lexer);
+    }
+
+    expect_and_get_next_token(lexer, TokenType::Semicolon, "Expected semicolon after struct member declaration\n");
+  }
+
+  get_next_token(lexer);
+  check_struct_members(struct_type);
+}
+
+// 6.7.2.1 Structure and union specifiers
+//
+// struct-or-union-specifier:
+//      struct-or-union identifier(opt) { struct-declaration-list }
+//      struct-or-union identifier
+//
+// a member list always declares a new type, in the current scope, unless the
+// tag was declared incomplete in this same scope, e.g. struct s; struct s {};
+// a tag on its own refers to the visible declaration of the tag, or declares
+// a new incomplete type
+//
+// GNU attributes may follow the struct keyword or the closing brace
+static Type const* parse_struct_or_union_specifier(Lexer* lexer, Scope* scope)
+{
+  Token const* keyword_token = get_current_token(lexer);
+  assert(keyword_token->type == TokenType::Struct || keyword_token->type == TokenType::Union);
+  FundamentalType struct_or_union = keyword_token->type == TokenType::Struct ? FundamentalType::Struct : FundamentalType::Union;
+  get_next_token(lexer);
+
+  Attributes attributes = { false, 0, 0 };
+  parse_attributes(lexer, scope, &attributes);
+
+  std::string tag;
+  if (get_current_token(lexer)->type == TokenType::Identifier) {
+    tag = get_current_token(lexer)->string;
+    get_next_token(lexer);
+  }
+
+  Type* struct_type = nullptr;
+
+  if (get_current_token(lexer)->type != TokenType::LBrace) {
+    if (tag.empty())
+      error_token(lexer, "Expected a tag or member list after struct or union\n");
+
+    struct_type = tag_in_scope(tag, scope);
+    if (!struct_type) {
+      struct_type = new_struct_type(struct_or_union, tag);
+      scope->tags[tag] = struct_type;
+    }
+  } else {
+    auto entry = tag.empty() ? scope->tags.end() : scope->tags.find(tag);
+    if (entry != scope->tags.end()) {
+      if (entry->second->struct_data->is_complete)
+        error_token(lexer, "Redefinition of struct or union\n");
+      struct_type = entry->second;
+    } else {
+      struct_type = new_struct_type(struct_or_union, tag);
+      if (!tag.empty())
+        scope->tags[tag] = struct_type;
+    }
+
+    // the tag is in scope from here on, so members can point to the struct
+    if (struct_type->fundamental_type == struct_or_union)
+      parse_struct_declaration_list(lexer, scope, struct_type);
+    parse_attributes(lexer, scope, &attributes);
+    if (attributes.vector_size)
+      error_token(lexer, "vector_size can't apply to a struct or union\n");
+
+    struct_type->struct_data->is_packed = attributes.is_packed;
+    struct_type->struct_data->alignment = attributes.alignment;
+    struct_type->struct_data->is_complete = true;
+  }
+
+  // 6.7.2.3.2 a tag names one kind of type
+  if (struct_type->fundamental_type != struct_or_union)
+    error_token(lexer, "Tag used for both a struct and a union\n");
+
+  return struct_type;
+}
+
 // 6.7.6 Declarators
 
-static Type const* parse_array_dimensions(Lexer* lexer)
+// GCC vector extensions
+//
+// vector_size(n) turns an integer or floating type into a vector of n bytes
+// of it. Operators then work on each element, see semantic_analysis.cpp, and
+// LLVM gets a <count x type> to select packed instructions for. The element
+// count has to be a power of two
+//
+// aligned(n) belongs to the declared object rather than its type, it is left
+// for parse_declarator
+static Type const* apply_declarator_attributes(Lexer* lexer, Type const* type, Attributes* attributes)
+{
+  if (attributes->is_packed)
+    error_token(lexer, "packed only applies to structs and unions\n");
+
+  if (!attributes->vector_size)
+    return type;
+
+  FundamentalType element_type = type->fundamental_type;
+  bool is_valid_element = (is_integer_type(element_type) && element_type != FundamentalType::Bool) || element_type == FundamentalType::Float
+      || element_type == FundamentalType::Double;
+  if (!is_valid_element)
+    error_token(lexer, "Vector elements must be integer, float or double\n");
+
+  unsigned long long element_size = size_of_type(type);
+  unsigned long long element_count = attributes->vector_size / element_size;
+  if (attributes->vector_size % element_size || (element_count & (element_count - 1)))
+    error_token(lexer, "Vector size must be a power of two multiple of the element size\n");
+
+  attributes->vector_size = 0;
+  return intern_vector_type(type, (long long)element_count);
+}
+
+// 6.7.6.2 Array declarators
+//
+// the dimensions are read left to right, but the rightmost one is innermost,
+// e.g. int x[2][3] is an array of 2 arrays of 3 ints
+// an empty [] gives an array of unknown size
+static Type const* parse_array_dimensions(Lexer* lexer, Type const* element_type, Scope* scope)
 {
   assert(get_current_token(lexer)->type == TokenType::LBracket);
-  // FIXME
-  assert(false);
+
+  std::vector<long long> array_lengths;
+
+  while (get_current_token(lexer)->type == TokenType::LBracket) {
+    get_next_token(lexer);
+
+    long long array_length = -1;
+    if (get_current_token(lexer)->type != TokenType::RBracket) {
+      // FIXME: variable length arrays
+      array_length = parse_integer_constant_expression(lexer, scope, "Array sizes must be integer constants\n");
+      if (array_length <= 0)
+        error_and_stop_parsing("Array sizes must be positive\n");
+    }
+
+    expect_and_get_next_token(lexer, TokenType::RBracket, "Expected ] after array size\n");
+    array_lengths.push_back(array_length);
+  }
+
+  Type const* array_type = element_type;
+  for (size_t i = array_lengths.size(); i-- > 0;) {
+    if (is_incomplete_type(array_type))
+      error_and_stop_parsing("Array elements can't have incomplete type\n");
+    array_type = intern_array_type(array_type, array_lengths[i]);
+  }
+
+  return array_type;
+}
+
+// 6.7.6.3p7 an array parameter is adjusted to a pointer to its element type,
+// qualified by the qualifiers in its brackets, e.g. int a[restrict 4] is an
+// int* restrict. With static, e.g. int a[static 4], the argument points to at
+// least that many elements, which is returned through static_length
+static Type const* parse_array_parameter(Lexer* lexer, Type const* element_type, Scope* scope, long long* static_length)
+{
+  assert(get_current_token(lexer)->type == TokenType::LBracket);
+  get_next_token(lexer);
+
+  // static can come before or after the qualifiers
+  bool is_static = get_current_token(lexer)->type == TokenType::Static;
+  if (is_static)
+    get_next_token(lexer);
+  DeclarationSpecifierFlags qualifiers = parse_type_qualifier_list(lexer);
+  if (!is_static && get_current_token(lexer)->type == TokenType::Static) {
+    is_static = true;
+    get_next_token(lexer);
+  }
+
+  long long array_length = -1;
+  if (get_current_token(lexer)->type != TokenType::RBracket) {
+    array_length = parse_integer_constant_expression(lexer, scope, "Array sizes must be integer constants\n");
+    if (array_length <= 0)
+      error_and_stop_parsing("Array sizes must be positive\n");
+  } else if (is_static)
+    error_and_stop_parsing("An array parameter declared static needs a size\n");
+  expect_and_get_next_token(lexer, TokenType::RBracket, "Expected ] after array size\n");
+
+  // the other dimensions stay, e.g. int a[][4] is a pointer to arrays of 4 ints
+  if (get_current_token(lexer)->type == TokenType::LBracket)
+    element_type = parse_array_dimensions(lexer, element_type, scope);
+  if (is_incomplete_type(element_type))
+    error_and_stop_parsing("Array elements can't have incomplete type\n");
+
+  *static_length = is_static ? array_length : 0;
+  return intern_pointer_type(element_type, qualifiers);
 }
 
 // parameter-list: (parameter-declaration)*
@@ -267,8 +748,11 @@ static Type const* parse_array_dimensions(Lexer* lexer)
 // abstract and concrete declarators both begin with optional pointers
 // the presence/absence of an identifier can be used to disambiguate
 //
-// this function returns a function pointer type
-static Type const* parse_parameter_list(Lexer* lexer, Type const* return_type, Scope* scope)
+// this function returns a function type, the parameters' names aren't part of
+// the type so they are returned through parameter_identifiers, and so is the
+// rest of what the declarations say, see ParameterDeclaration
+static Type const* parse_parameter_list(Lexer* lexer, Type const* return_type, Scope* scope, std::vector<std::string>* parameter_identifiers,
+    std::vector<ParameterDeclaration>* parameter_declarations)
 {
   assert(get_current_token(lexer)->type == TokenType::LParen);
   get_next_token(lexer);
@@ -276,12 +760,7 @@ static Type const* parse_parameter_list(Lexer* lexer, Type const* return_type, S
   if (scope->parent_scope)
     error_and_stop_parsing("Function declaration only allowed in global scope\n");
 
-  Type* function_type = new_type(FundamentalType::Function);
-
-  // making/traversing linked list of function params
-  FunctionParameter parameter_list_anchor;
-  parameter_list_anchor.next_parameter = nullptr;
-  FunctionParameter* previous_parameter = &parameter_list_anchor;
+  std::vector<Type const*> parameter_types;
 
   bool is_variadic = false;
   bool parsed_first_parameter_yet = false;
@@ -297,16 +776,17 @@ static Type const* parse_parameter_list(Lexer* lexer, Type const* return_type, S
     // variadic, check rparen and stop
     if (get_current_token(lexer)->type == TokenType::Ellipsis) {
       is_variadic = true;
-      expect_and_get_next_token(lexer, TokenType::RParen,
-          "Parsing parameter list, expected right "
-          "parenthesis after ellipsis\n");
-      return function_type;
+      get_next_token(lexer);
+      if (get_current_token(lexer)->type != TokenType::RParen)
+        error_token(lexer, "Parsing parameter list, expected right parenthesis after ellipsis\n");
+      break;
     }
 
     // regular parameter, definitely starting with a type specifier
     DeclarationSpecifierFlags flags = parse_declaration_specifiers(lexer, scope);
 
-    Type const* parameter_type = get_fundamental_type_pointer(fundamental_type_from_declaration(&flags));
+    Type const* base_type = declaration_to_fundamental_type(&flags);
+    Type const* parameter_type = base_type;
 
     // potentially a pointer argument
     if (get_current_token(lexer)->type == TokenType::Asterisk)
@@ -319,22 +799,34 @@ static Type const* parse_parameter_list(Lexer* lexer, Type const* return_type, S
       get_next_token(lexer);
     }
 
-    // FIXME: finally either a function pointer or array parameter
-
-    FunctionParameter* current_function_parameter = new_function_parameter(parameter_type, identifier);
-
-    previous_parameter->next_parameter = current_function_parameter;
-    previous_parameter = previous_parameter->next_parameter;
+    // FIXME: function pointer parameters
+    long long static_length = 0;
+    if (get_current_token(lexer)->type == TokenType::LBracket)
+      parameter_type = parse_array_parameter(lexer, parameter_type, scope, &static_length);
+
+    // f(void) declares a function with no parameters
+    bool is_lone_void = parameter_type == VoidType && identifier.empty() && parameter_types.empty() && get_current_token(lexer)->type == TokenType::RParen;
+    if (is_lone_void)
+      break;
+
+    parameter_types.push_back(parameter_type);
+    parameter_identifiers->push_back(identifier);
+    // the const of the declaration specifiers is only on what the parameter
+    // points to with one level of pointers, e.g. const int* p but not const int** p
+    bool is_pointee_const = (flags.flags & TypeModifierFlag::Const) && parameter_type->fundamental_type == FundamentalType::Pointer
+                            && parameter_type->pointed_type == base_type;
+    parameter_declarations->push_back({ is_pointee_const, static_length });
   } // end while loop
 
-  FunctionData const* function_data = new_function_data(return_type, parameter_list_anchor.next_parameter, is_variadic);
-
-  function_type->function_data = function_data;
+  // interned lists are built from the back, so that they can share tails
+  FunctionParameter const* parameter_list = nullptr;
+  for (size_t i = parameter_types.size(); i-- > 0;)
+    parameter_list = intern_parameter_list(parameter_types[i], parameter_list);
 
   assert(get_current_token(lexer)->type == TokenType::RParen);
   expect_and_get_next_token(lexer, TokenType::RParen, "Parsing function parameter list, expected right parenthesis\n");
 
-  return function_type;
+  return intern_function_type(return_type, parameter_list, is_variadic);
 }
 
 // Declarations end with an init-declarator-list
@@ -359,6 +851,12 @@ Object* parse_declarator(Lexer* lexer, Type const* base_type, Scope* scope)
   // and/or by becoming the return type of a function
   Type const* return_type = base_type;
 
+  // attributes before the declarator apply to the declaration specifiers' type,
+  // except aligned, which applies to the declared object
+  Attributes attributes = { false, 0, 0 };
+  parse_attributes(lexer, scope, &attributes);
+  return_type = apply_declarator_attributes(lexer, return_type, &attributes);
+
   // check for pointer type
   if (get_current_token(lexer)->type == TokenType::Asterisk) {
     return_type = parse_pointer(lexer, return_type);
@@ -375,13 +873,24 @@ Object* parse_declarator(Lexer* lexer, Type const* base_type, Scope* scope)
   // next is the direct declarators, which we don't have an function for
   // a direct declarator begins with an identifier, followed by either array
   // dimensions or function parameter lists
+  std::vector<std::string> parameter_identifiers;
+  std::vector<ParameterDeclaration> parameter_declarations;
   if (get_current_token(lexer)->type == TokenType::LParen)
-    return_type = parse_parameter_list(lexer, return_type, scope);
+    return_type = parse_parameter_list(lexer, return_type, scope, &parameter_identifiers, &parameter_declarations);
 
   else if (get_current_token(lexer)->type == TokenType::LBracket)
-    return_type = parse_array_dimensions(lexer);
-
-  return new_object(identifier, return_type);
+    return_type = parse_array_dimensions(lexer, return_type, scope);
+
+  // and after it, e.g. typedef float v4f __attribute__((vector_size(16)));
+  // to the declared type
+  parse_attributes(lexer, scope, &attributes);
+  return_type = apply_declarator_attributes(lexer, return_type, &attributes);
+
+  Object* declared_object = new_object(identifier, return_type);
+  declared_object->parameter_identifiers = std::move(parameter_identifiers);
+  declared_object->parameter_declarations = std::move(parameter_declarations);
+  declared_object->alignment = attributes.alignment;
+  return declared_object;
 }
 
 // e.g. parse a const*
@@ -420,13 +929,8 @@ Type const* parse_pointer(Lexer* lexer, Type const* base_type)
   while (get_current_token(lexer)->type == TokenType::Asterisk) {
     get_next_token(lexer);
 
-    Type* pointer_type = new_type(FundamentalType::Pointer);
-
     DeclarationSpecifierFlags type_qualifiers = parse_type_qualifier_list(lexer);
-
-    pointer_type->declaration_specifier_flags = type_qualifiers;
-    pointer_type->pointed_type = current_base_type;
-    current_base_type = pointer_type;
+    current_base_type = intern_pointer_type(current_base_type, type_qualifiers);
   }
 
   assert(base_type != current_base_type);
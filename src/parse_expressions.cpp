@@ -3,6 +3,7 @@
 #include "type.h"
 
 #include <cassert>
+#include <vector>
 
 // parsing expressions
 // this is where in the grammar operator precedence is defined
@@ -169,6 +170,228 @@ static ASTNode* parse_number(Lexer* lexer)
   }
 }
 
+// the value of an integer literal, whatever its type
+long long numeric_constant_value(ASTNode const* ast_node)
+{
+  assert(ast_node->type == ASTNodeType::NumericConstant);
+  switch (ast_node->data_type) {
+  case FundamentalType::Int:
+    return ast_node->data_as.int_data;
+  case FundamentalType::UnsignedInt:
+    return ast_node->data_as.unsigned_int_data;
+  case FundamentalType::Long:
+    return ast_node->data_as.long_data;
+  case FundamentalType::LongLong:
+    return ast_node->data_as.long_long_data;
+  case FundamentalType::UnsignedLongLong:
+    return (long long)ast_node->data_as.unsigned_long_long_data;
+  default:
+    assert(false && "numeric_constant_value: this kind of literal not implemented");
+    return 0;
+  }
+}
+
+// GCC vector builtins, their operands aren't all expressions so they are
+// parsed here rather than as calls
+//
+// __builtin_shufflevector(vector, vector, index...)
+//      the result has one element per index, the indices are constants that
+//      count through the elements of both vectors, or -1 for don't care
+static ASTNode* parse_shufflevector(Lexer* lexer, Scope* scope)
+{
+  get_next_token(lexer);
+  expect_and_get_next_token(lexer, TokenType::LParen, "Expected ( after __builtin_shufflevector\n");
+
+  ASTNode* shuffle_node = new_ast_node(scope, ASTNodeType::ShuffleVector);
+  shuffle_node->lhs = parse_assignment_expression(lexer, scope);
+  expect_and_get_next_token(lexer, TokenType::Comma, "Expected , after __builtin_shufflevector operand\n");
+  shuffle_node->rhs = parse_assignment_expression(lexer, scope);
+
+  while (get_current_token(lexer)->type == TokenType::Comma) {
+    get_next_token(lexer);
+
+    bool is_negative = get_current_token(lexer)->type == TokenType::Minus;
+    if (is_negative)
+      get_next_token(lexer);
+
+    if (get_current_token(lexer)->type != TokenType::Number)
+      error_token(lexer, "Shuffle indices must be integer constants\n");
+
+    long long index = numeric_constant_value(parse_number(lexer));
+    if (is_negative && index != 1)
+      error_token(lexer, "The only negative shuffle index is -1\n");
+    shuffle_node->shuffle_mask.push_back(is_negative ? -1 : (int)index);
+  }
+
+  expect_and_get_next_token(lexer, TokenType::RParen, "Expected ) after __builtin_shufflevector indices\n");
+  if (shuffle_node->shuffle_mask.empty())
+    error_token(lexer, "__builtin_shufflevector needs at least one index\n");
+
+  return shuffle_node;
+}
+
+// __builtin_convertvector(vector, type-name)
+//      converts each element, like a cast would, to a vector type with as
+//      many elements. The node's type is the type name's, from the start
+static ASTNode* parse_convertvector(Lexer* lexer, Scope* scope)
+{
+  get_next_token(lexer);
+  expect_and_get_next_token(lexer, TokenType::LParen, "Expected ( after __builtin_convertvector\n");
+
+  ASTNode* convert_node = new_ast_node(scope, ASTNodeType::ConvertVector);
+  convert_node->lhs = parse_assignment_expression(lexer, scope);
+  expect_and_get_next_token(lexer, TokenType::Comma, "Expected , after __builtin_convertvector operand\n");
+
+  if (!token_is_declaration_specifier(get_current_token(lexer), scope))
+    error_token(lexer, "Expected a type name in __builtin_convertvector\n");
+
+  DeclarationSpecifierFlags type_specifiers = parse_declaration_specifiers(lexer, scope);
+  convert_node->expression_type = declaration_to_fundamental_type(&type_specifiers);
+
+  expect_and_get_next_token(lexer, TokenType::RParen, "Expected ) after __builtin_convertvector type\n");
+  return convert_node;
+}
+
+// C11 7.17 <stdatomic.h>
+//
+// there is no preprocessor to include the header with, so its generic
+// functions and memory_order constants are known to the parser, along with
+// the __c11_atomic builtins and __ATOMIC constants clang's header is written
+// in. The functions aren't called, each one is lowered to an instruction
+struct AtomicBuiltin {
+  char const* name;
+  ASTNodeType node_type;
+  // the arguments before the memory orders
+  unsigned operand_count;
+  // the memory orders are arguments, otherwise they are implicit_order
+  bool is_explicit;
+  MemoryOrder implicit_order;
+};
+
+static constexpr MemoryOrder seq_cst = MemoryOrder::SequentiallyConsistent;
+
+static constexpr AtomicBuiltin atomic_builtins[] = {
+  { "atomic_init", ASTNodeType::AtomicStore, 2, false, MemoryOrder::Relaxed },
+  { "atomic_load", ASTNodeType::AtomicLoad, 1, false, seq_cst },
+  { "atomic_store", ASTNodeType::AtomicStore, 2, false, seq_cst },
+  { "atomic_exchange", ASTNodeType::AtomicExchange, 2, false, seq_cst },
+  { "atomic_compare_exchange_strong", ASTNodeType::AtomicCompareExchangeStrong, 3, false, seq_cst },
+  { "atomic_compare_exchange_weak", ASTNodeType::AtomicCompareExchangeWeak, 3, false, seq_cst },
+  { "atomic_fetch_add", ASTNodeType::AtomicFetchAdd, 2, false, seq_cst },
+  { "atomic_fetch_sub", ASTNodeType::AtomicFetchSub, 2, false, seq_cst },
+  { "atomic_fetch_and", ASTNodeType::AtomicFetchAnd, 2, false, seq_cst },
+  { "atomic_fetch_or", ASTNodeType::AtomicFetchOr, 2, false, seq_cst },
+  { "atomic_fetch_xor", ASTNodeType::AtomicFetchXor, 2, false, seq_cst },
+
+  { "atomic_load_explicit", ASTNodeType::AtomicLoad, 1, true, seq_cst },
+  { "atomic_store_explicit", ASTNodeType::AtomicStore, 2, true, seq_cst },
+  { "atomic_exchange_explicit", ASTNodeType::AtomicExchange, 2, true, seq_cst },
+  { "atomic_compare_exchange_strong_explicit", ASTNodeType::AtomicCompareExchangeStrong, 3, true, seq_cst },
+  { "atomic_compare_exchange_weak_explicit", ASTNodeType::AtomicCompareExchangeWeak, 3, true, seq_cst },
+  { "atomic_fetch_add_explicit", ASTNodeType::AtomicFetchAdd, 2, true, seq_cst },
+  { "atomic_fetch_sub_explicit", ASTNodeType::AtomicFetchSub, 2, true, seq_cst },
+  { "atomic_fetch_and_explicit", ASTNodeType::AtomicFetchAnd, 2, true, seq_cst },
+  { "atomic_fetch_or_explicit", ASTNodeType::AtomicFetchOr, 2, true, seq_cst },
+  { "atomic_fetch_xor_explicit", ASTNodeType::AtomicFetchXor, 2, true, seq_cst },
+  { "atomic_thread_fence", ASTNodeType::AtomicThreadFence, 0, true, seq_cst },
+
+  { "__c11_atomic_init", ASTNodeType::AtomicStore, 2, false, MemoryOrder::Relaxed },
+  { "__c11_atomic_load", ASTNodeType::AtomicLoad, 1, true, seq_cst },
+  { "__c11_atomic_store", ASTNodeType::AtomicStore, 2, true, seq_cst },
+  { "__c11_atomic_exchange", ASTNodeType::AtomicExchange, 2, true, seq_cst },
+  { "__c11_atomic_compare_exchange_strong", ASTNodeType::AtomicCompareExchangeStrong, 3, true, seq_cst },
+  { "__c11_atomic_compare_exchange_weak", ASTNodeType::AtomicCompareExchangeWeak, 3, true, seq_cst },
+  { "__c11_atomic_fetch_add", ASTNodeType::AtomicFetchAdd, 2, true, seq_cst },
+  { "__c11_atomic_fetch_sub", ASTNodeType::AtomicFetchSub, 2, true, seq_cst },
+  { "__c11_atomic_fetch_and", ASTNodeType::AtomicFetchAnd, 2, true, seq_cst },
+  { "__c11_atomic_fetch_or", ASTNodeType::AtomicFetchOr, 2, true, seq_cst },
+  { "__c11_atomic_fetch_xor", ASTNodeType::AtomicFetchXor, 2, true, seq_cst },
+  { "__c11_atomic_thread_fence", ASTNodeType::AtomicThreadFence, 0, true, seq_cst },
+};
+
+struct MemoryOrderConstant {
+  char const* name;
+  MemoryOrder order;
+};
+
+static constexpr MemoryOrderConstant memory_order_constants[] = {
+  { "memory_order_relaxed", MemoryOrder::Relaxed },
+  { "memory_order_consume", MemoryOrder::Consume },
+  { "memory_order_acquire", MemoryOrder::Acquire },
+  { "memory_order_release", MemoryOrder::Release },
+  { "memory_order_acq_rel", MemoryOrder::AcquireRelease },
+  { "memory_order_seq_cst", MemoryOrder::SequentiallyConsistent },
+  { "__ATOMIC_RELAXED", MemoryOrder::Relaxed },
+  { "__ATOMIC_CONSUME", MemoryOrder::Consume },
+  { "__ATOMIC_ACQUIRE", MemoryOrder::Acquire },
+  { "__ATOMIC_RELEASE", MemoryOrder::Release },
+  { "__ATOMIC_ACQ_REL", MemoryOrder::AcquireRelease },
+  { "__ATOMIC_SEQ_CST", MemoryOrder::SequentiallyConsistent },
+};
+
+static AtomicBuiltin const* find_atomic_builtin(std::string const& name)
+{
+  if (!name.starts_with("atomic_") && !name.starts_with("__c11_atomic_"))
+    return nullptr;
+
+  for (AtomicBuiltin const& builtin : atomic_builtins)
+    if (name == builtin.name)
+      return &builtin;
+  return nullptr;
+}
+
+static MemoryOrderConstant const* find_memory_order_constant(std::string const& name)
+{
+  if (!name.starts_with("memory_order_") && !name.starts_with("__ATOMIC_"))
+    return nullptr;
+
+  for (MemoryOrderConstant const& constant : memory_order_constants)
+    if (name == constant.name)
+      return &constant;
+  return nullptr;
+}
+
+// memory orders are ints, like the enumeration constants they are in C
+static ASTNode* new_memory_order_node(MemoryOrder order)
+{
+  ASTNode* order_node = new_ast_node(nullptr, ASTNodeType::NumericConstant);
+  order_node->data_type = FundamentalType::Int;
+  order_node->data_as.int_data = (int)order;
+  return order_node;
+}
+
+// the compare exchanges take an order for success and one for failure
+static ASTNode* parse_atomic_builtin(Lexer* lexer, Scope* scope, AtomicBuiltin const* builtin)
+{
+  get_next_token(lexer);
+  expect_and_get_next_token(lexer, TokenType::LParen, "Expected ( after atomic function name\n");
+
+  ASTNode* atomic_node = new_ast_node(scope, builtin->node_type);
+  bool is_compare_exchange
+      = builtin->node_type == ASTNodeType::AtomicCompareExchangeStrong || builtin->node_type == ASTNodeType::AtomicCompareExchangeWeak;
+  unsigned order_count = is_compare_exchange ? 2 : 1;
+  unsigned argument_count = builtin->operand_count + (builtin->is_explicit ? order_count : 0);
+
+  ASTNode** argument = &atomic_node->rhs;
+  for (unsigned i = 0; i < argument_count; i++) {
+    if (i > 0)
+      expect_and_get_next_token(lexer, TokenType::Comma, "Too few arguments to atomic function\n");
+    *argument = parse_assignment_expression(lexer, scope);
+    argument = &(*argument)->next;
+  }
+
+  expect_and_get_next_token(lexer, TokenType::RParen, "Expected ) after the arguments of atomic function\n");
+
+  if (!builtin->is_explicit) {
+    for (unsigned i = 0; i < order_count; i++) {
+      *argument = new_memory_order_node(builtin->implicit_order);
+      argument = &(*argument)->next;
+    }
+  }
+
+  return atomic_node;
+}
+
 // primary expressions
 //      identifier
 //          lvalues or function designator
@@ -180,6 +403,9 @@ static ASTNode* parse_number(Lexer* lexer)
 //      string-literal
 //      (expression)
 //      generic-selection
+//
+// parenthesized expressions are handled by the operator stack in
+// parse_binary_expression, so that nesting depth never turns into call depth
 ASTNode* parse_primary_expression(Lexer* lexer, Scope* scope)
 {
 
@@ -188,9 +414,25 @@ ASTNode* parse_primary_expression(Lexer* lexer, Scope* scope)
     //      handle declarations next
     // variable, enum const, or function
   case TokenType::Identifier: {
+    if (get_current_token(lexer)->string == "__builtin_shufflevector")
+      return parse_shufflevector(lexer, scope);
+    if (get_current_token(lexer)->string == "__builtin_convertvector")
+      return parse_convertvector(lexer, scope);
+    if (AtomicBuiltin const* builtin = find_atomic_builtin(get_current_token(lexer)->string))
+      return parse_atomic_builtin(lexer, scope, builtin);
+    if (MemoryOrderConstant const* constant = find_memory_order_constant(get_current_token(lexer)->string)) {
+      get_next_token(lexer);
+      return new_memory_order_node(constant->order);
+    }
 
     ASTNode* identifier_node = new_ast_node(scope, ASTNodeType::VariableReference);
     identifier_node->referenced_variable = get_current_token(lexer)->string;
+
+    // C requires locals to be declared before use, so the scope as it stands
+    // right now holds exactly the declarations this identifier can refer to
+    // anything not found is left for name resolution to find at file scope
+    identifier_node->object = variable_in_scope(identifier_node->referenced_variable, scope);
+
     get_next_token(lexer);
     return identifier_node;
   }
@@ -199,7 +441,8 @@ ASTNode* parse_primary_expression(Lexer* lexer, Scope* scope)
     return parse_number(lexer);
 
   default:
-    assert(false && "Default case in parse_primary_expression");
+    error_token(lexer, "Expected identifier, constant or parenthesized expression\n");
+    return nullptr;
   }
 }
 
@@ -214,18 +457,46 @@ ASTNode* parse_primary_expression(Lexer* lexer, Scope* scope)
 //       postfix-expression --
 //       ( type-name ) { initializer-list }
 //       ( type-name ) { initializer-list , }
-ASTNode* parse_postfix_expression(Lexer* lexer, Scope* scope)
+//
+// postfix operators bind tighter than anything else, so they are applied to an
+// operand as soon as it has been parsed, whether that operand came from a
+// primary expression or from a closing parenthesis
+//
+// function calls and subscripts contain whole expressions, and are nested just
+// as easily as parentheses, so they are handled on the operator stack in
+// parse_binary_expression rather than here
+static ASTNode* parse_postfix_operators(Lexer* lexer, Scope* scope, ASTNode* root)
 {
-  ASTNode* root = parse_primary_expression(lexer, scope);
+  for (;;) {
+    switch (get_current_token(lexer)->type) {
+      // 6.5.2.3 the member is looked up by semantic analysis, once the type
+      // of the lhs is known
+    case TokenType::Dot:
+    case TokenType::ArrowOperator: {
+      ASTNodeType node_type = get_current_token(lexer)->type == TokenType::Dot ? ASTNodeType::MemberAccess : ASTNodeType::PointerMemberAccess;
+      if (get_next_token(lexer)->type != TokenType::Identifier)
+        error_token(lexer, "Expected member name after . or ->\n");
+
+      ASTNode* access_node = new_ast_node(scope, node_type);
+      access_node->lhs = root;
+      access_node->referenced_variable = get_current_token(lexer)->string;
+      get_next_token(lexer);
+
+      root = access_node;
+      continue;
+    }
 
-  // FIXME
-  Token const* current_token = get_current_token(lexer);
-  while (current_token->type == TokenType::LBracket || current_token->type == TokenType::LParen || current_token->type == TokenType::Dot
-      || current_token->type == TokenType::ArrowOperator || current_token->type == TokenType::PlusPlus
-      || current_token->type == TokenType::MinusMinus) { }
-  // FIXME: type name initializer list ones
+    case TokenType::PlusPlus:
+    case TokenType::MinusMinus:
+      // FIXME: postfix operators
+      error_token(lexer, "Postfix operators not implemented\n");
+      return root;
 
-  return root;
+    default:
+      // FIXME: type name initializer list ones
+      return root;
+    }
+  }
 }
 
 // 6.5.3
@@ -237,101 +508,228 @@ ASTNode* parse_postfix_expression(Lexer* lexer, Scope* scope)
 //  sizeof unary-expr
 //  sizeof (typename)
 //  _Alignof (typename)
-static bool is_unary_operator(Token* token)
+static bool is_unary_operator(Token const* token)
 {
   TokenType t = token->type;
   using enum TokenType;
   return t == Ampersand || t == Asterisk || t == Plus || t == Minus || t == Tilde || t == Bang || t == PlusPlus || t == MinusMinus
       || t == SizeOf; // t== Alignof;
 }
-ASTNode* parse_unary_expression(Lexer* lexer, Scope* scope)
-{
-  Token* current_token = get_current_token(lexer);
-  // FIXME: Unary operators
-  while (is_unary_operator(current_token)) { }
-
-  ASTNode* root = parse_postfix_expression(lexer, scope);
-  return root;
-}
 
 // 6.5.4 cast-expr
 //          unary-expr
 //          (typename) cast-expr
-ASTNode* parse_cast_expression(Lexer* lexer, Scope* scope)
-{
-  if (get_current_token(lexer)->type == TokenType::LParen) {
-    // FIXME: Parse typename
-    expect_and_get_next_token(lexer, TokenType::RParen, "Type cast expected RParen");
-  }
-
-  ASTNode* root = parse_unary_expression(lexer, scope);
-
-  return root;
-}
+//
+// a cast is told apart from a parenthesized expression by the token after the
+// opening parenthesis: only a type name can start with a declaration specifier
 
 // hereafter, each binary operator and its precedence is defined through
 // left-recursive productions
 //
-// unwinding the cast-expr grammar, a simple valid cast-expr is the const 1 or
-// 2
-//
-// forward referencing the next rule for mult-exprs, a cast-expr is a valid
-// mult-expr, so 1 or 2 is also a valid mult-expr. Therefore, we are justified
-// in stopping if all we have is a cast-expr followed by no (* or / or %)
-//
-// using the second production, we could also have 1 * 2, and recurring from
-// there, 1 * 2 / 3, so on and so forth
+// 6.5.5  mult-expr:        cast-expr ((* or / or %) cast-expr)*
+// 6.5.6  add-expr:         mult-expr ((+ or -) mult-expr)*
+// 6.5.7  shift-expr:       add-expr ((<< or >>) add-expr)*
+// 6.5.8  relational-expr:  shift-expr ((< or > or <= or >=) shift-expr)*
+// 6.5.9  equality-expr:    relational-expr ((== or !=) relational-expr)*
+// 6.5.10 and-expr:         eq-expr (& eq-expr)*
+// 6.5.11 xor-expr:         and-expr (^ and-expr)*
+// 6.5.12 or-expr:          xor-expr (| xor-expr)*
+// 6.5.13 logical-and-expr: or-expr (&& or-expr)*
+// 6.5.14 logical-or-expr:  logical-and-expr (|| logical-and-expr)*
+// 6.5.15 conditional-expr: logical-or-expr (? expression : conditional-expr)?
+// 6.5.16 assignment-expr:  conditional-expr | unary-expr assignment-op assignment-expr
 //
-// What should the AST for 1 * 2 / 3 look like? It should evaluate from left to
-// right and give
-//          *
-//         / \
-//        1   operator /
-//              / \
-//             2   3
+// The earlier in the grammar an operation is defined, the higher the
+// precedence of that operation. Take 2 + 3 * 4: add-expr is defined in terms
+// of mult-expr, so the add node is the root and gets the whole multiplication
+// as its rhs. Likewise 1 * 2 / 3 evaluates from left to right,
+// so the division is the root with the multiplication as its lhs.
 //
-// we hit our Number token 1 which we want to give us the lhs of this
-// ASTNode
-//
-// we advance, and we see the next token is a *, so we recursively call
-// parse_multiplicative_expression again, and this should return us the rhs of
-// the node from the first call -  this rhs will be the division node with
-// lhs 2 and rhs 3
-//
-// What if we don't see a multiplicative operator? Then we don't have a bonafied
-// multiplication node. That's fine, then we just pop up the information from
-// the cast node parse we have to do anyway. The cast node probably doesn't even
-// have a type cast either, it's most likely we'll have to propagate up to an
-// identifier or something
-//
-// so we can transform this rule into a cast-expr followed by 0 or more (* or /
-// or %) and another cast-expr. If we see one of the right operators, we return
-// a node with rhs and lhs properly set. If not, we just return whatever the
-// cast node gave us
-//
-// the other thing to consider is how this handles operator precedence. After
-// mult-exprs, we have add-exprs. Citing PEMDAS, multiplicative expressions have
-// higher precedence than addition, so 2 + 3 * 4 should give
-//          +
-//         / \
-//        2   *
-//           / \
-//          3   4
-//
-// add-expr is defined in terms of mult-expr, so if we have a bonafide add-expr,
-// we'll be setting an lhs and rhs, and in order to set those, we'll call
-// mult-expr. If the mult-expr is a bonafide multiplication, it will return a
-// node with a multiplication operator at it's root, and an lhs and rhs with its
-// operands back to the add-expr
-//
-// finally, these "rule (operator rule)*" rules we'll implement can naturally be
-// implemented either recursively or iteratively
-// recursion is prettier, but can inflate your call stack
-// since the call stack already has to trudge through 15 levels to get to a
-// primary expression, we'll be nice to it and go iterative
+// Written as pure recursive descent, like Chibicc, every one of these rules is
+// a function calling the next one, and every parenthesis restarts the chain
+// from the top. An expression like a+(b+(c+(...))) then costs a dozen stack
+// frames per level of nesting, and machine generated inputs a hundred thousand
+// levels deep overflow the native stack.
 //
+// Instead, the rules are flattened into a precedence table and parsed with an
+// explicit operator stack (Dijkstra's shunting yard, see also clang's
+// operator precedence parser in clang/lib/Parse/ParseExpr.cpp). Operands go on
+// one stack, pending operators on another. When an operator arrives, every
+// pending operator that binds at least as tightly is reduced into an ASTNode
+// first. Parentheses and the ? of a ternary are markers on the operator stack
+// that stop reductions until their closing token shows up. Memory grows
+// linearly with nesting depth, and there is no recursion to run out of.
+
+enum class Associativity { Left, Right };
+
+struct BinaryOperator {
+  ASTNodeType node_type;
+  int precedence;
+  Associativity associativity;
+};
+
+// precedences, higher binds tighter
+static constexpr int assignment_precedence = 2;
+static constexpr int conditional_precedence = 3;
+static constexpr int unary_precedence = 14;
+
+static bool binary_operator_from_token(Token const* token, BinaryOperator* binary_operator)
+{
+  using enum Associativity;
+
+  switch (token->type) {
+  case TokenType::Asterisk:
+    *binary_operator = { ASTNodeType::Multiplication, 13, Left };
+    return true;
+  case TokenType::ForwardSlash:
+    *binary_operator = { ASTNodeType::Division, 13, Left };
+    return true;
+  case TokenType::Modulo:
+    *binary_operator = { ASTNodeType::Modulo, 13, Left };
+    return true;
+
+  case TokenType::Plus:
+    *binary_operator = { ASTNodeType::Addition, 12, Left };
+    return true;
+  case TokenType::Minus:
+    *binary_operator = { ASTNodeType::Subtraction, 12, Left };
+    return true;
+
+  case TokenType::BitShiftLeft:
+    *binary_operator = { ASTNodeType::BitShiftLeft, 11, Left };
+    return true;
+  case TokenType::BitShiftRight:
+    *binary_operator = { ASTNodeType::BitShiftRight, 11, Left };
+    return true;
+
+  case TokenType::LessThan:
+    *binary_operator = { ASTNodeType::LessThan, 10, Left };
+    return true;
+  case TokenType::LessThanOrEqualTo:
+    *binary_operator = { ASTNodeType::LessThanOrEqualTo, 10, Left };
+    return true;
+  case TokenType::GreaterThan:
+    *binary_operator = { ASTNodeType::GreaterThan, 10, Left };
+    return true;
+  case TokenType::GreaterThanOrEqualTo:
+    *binary_operator = { ASTNodeType::GreaterThanOrEqualTo, 10, Left };
+    return true;
+
+  case TokenType::DoubleEquals:
+    *binary_operator = { ASTNodeType::EqualityComparison, 9, Left };
+    return true;
+  case TokenType::NotEquals:
+    *binary_operator = { ASTNodeType::InequalityComparison, 9, Left };
+    return true;
+
+  case TokenType::Ampersand:
+    *binary_operator = { ASTNodeType::BitwiseAnd, 8, Left };
+    return true;
+  case TokenType::Caret:
+    *binary_operator = { ASTNodeType::BitwiseXor, 7, Left };
+    return true;
+  case TokenType::Pipe:
+    *binary_operator = { ASTNodeType::BitwiseOr, 6, Left };
+    return true;
+
+  case TokenType::LogicalAnd:
+    *binary_operator = { ASTNodeType::LogicalAnd, 5, Left };
+    return true;
+  case TokenType::LogicalOr:
+    *binary_operator = { ASTNodeType::LogicalOr, 4, Left };
+    return true;
+
+  case TokenType::Equals:
+    *binary_operator = { ASTNodeType::Assignment, assignment_precedence, Right };
+    return true;
+  case TokenType::TimesEquals:
+    *binary_operator = { ASTNodeType::MultiplicationAssignment, assignment_precedence, Right };
+    return true;
+  case TokenType::DividedByEquals:
+    *binary_operator = { ASTNodeType::DivisionAssignment, assignment_precedence, Right };
+    return true;
+  case TokenType::ModuloEquals:
+    *binary_operator = { ASTNodeType::ModuloAssignment, assignment_precedence, Right };
+    return true;
+  case TokenType::PlusEquals:
+    *binary_operator = { ASTNodeType::AdditionAssignment, assignment_precedence, Right };
+    return true;
+  case TokenType::MinusEquals:
+    *binary_operator = { ASTNodeType::SubtractionAssignment, assignment_precedence, Right };
+    return true;
+  case TokenType::BitShiftLeftEquals:
+    *binary_operator = { ASTNodeType::BitShiftLeftAssignment, assignment_precedence, Right };
+    return true;
+  case TokenType::BitShiftRightEquals:
+    *binary_operator = { ASTNodeType::BitShiftRightAssignment, assignment_precedence, Right };
+    return true;
+  case TokenType::BitwiseAndEquals:
+    *binary_operator = { ASTNodeType::BitwiseAndAssignment, assignment_precedence, Right };
+    return true;
+  case TokenType::XorEquals:
+    *binary_operator = { ASTNodeType::BitwiseXorAssignment, assignment_precedence, Right };
+    return true;
+  case TokenType::BitwiseOrEquals:
+    *binary_operator = { ASTNodeType::BitwiseOrAssignment, assignment_precedence, Right };
+    return true;
+
+  default:
+    return false;
+  }
+}
 
-// FIXME: When to do type checking/casting?
+ASTNodeType compound_assignment_operator(ASTNodeType node_type)
+{
+  switch (node_type) {
+  case ASTNodeType::MultiplicationAssignment:
+    return ASTNodeType::Multiplication;
+  case ASTNodeType::DivisionAssignment:
+    return ASTNodeType::Division;
+  case ASTNodeType::ModuloAssignment:
+    return ASTNodeType::Modulo;
+  case ASTNodeType::AdditionAssignment:
+    return ASTNodeType::Addition;
+  case ASTNodeType::SubtractionAssignment:
+    return ASTNodeType::Subtraction;
+  case ASTNodeType::BitShiftLeftAssignment:
+    return ASTNodeType::BitShiftLeft;
+  case ASTNodeType::BitShiftRightAssignment:
+    return ASTNodeType::BitShiftRight;
+  case ASTNodeType::BitwiseAndAssignment:
+    return ASTNodeType::BitwiseAnd;
+  case ASTNodeType::BitwiseXorAssignment:
+    return ASTNodeType::BitwiseXor;
+  case ASTNodeType::BitwiseOrAssignment:
+    return ASTNodeType::BitwiseOr;
+  default:
+    return ASTNodeType::Void;
+  }
+}
+
+static bool unary_operator_node_type(Token const* token, ASTNodeType* node_type)
+{
+  switch (token->type) {
+  case TokenType::Minus:
+    *node_type = ASTNodeType::Negation;
+    return true;
+  case TokenType::Tilde:
+    *node_type = ASTNodeType::BitwiseNot;
+    return true;
+  case TokenType::Bang:
+    *node_type = ASTNodeType::LogicalNot;
+    return true;
+  case TokenType::Ampersand:
+    *node_type = ASTNodeType::AddressOf;
+    return true;
+  case TokenType::Asterisk:
+    *node_type = ASTNodeType::Dereference;
+    return true;
+  default:
+    return false;
+  }
+}
+
+// operands are type checked and converted later, see semantic_analysis.cpp
 ASTNode* new_binary_expression_node(ASTNodeType type, ASTNode* lhs, ASTNode* rhs, Scope* scope)
 {
   ASTNode* binary_ast_node = new_ast_node(scope, type);
@@ -341,308 +739,335 @@ ASTNode* new_binary_expression_node(ASTNodeType type, ASTNode* lhs, ASTNode* rhs
   return binary_ast_node;
 }
 
-// 6.5.5 mult-expr
-//          cast-expr
-//          mult-expr (* or / or %) cast-expr
-//
-// implement as:
-//      mult-expr: cast-expr ((* or / or %) cast-expr)*
-//
-// how do we process the while loop? unless we see a *, then we just return the
-// cast node. If we see a *, the node becomes a multiplication node with an LHS
-// equal to the cast node we initially parse, and an RHS equal to the result of
-// parsing a cast starting on the next node
-ASTNode* parse_multiplicative_expression(Lexer* lexer, Scope* scope)
+enum class PendingOperatorKind {
+  Binary,
+  Unary,
+  // ( seen in operand position, waiting for its )
+  OpenParenthesis,
+  // ( seen after an operand, arguments are parsed until the )
+  FunctionCall,
+  // [ seen after an operand, the index is parsed until the ]
+  Subscript,
+  // ? seen, waiting for its :
+  TernaryCondition,
+  // : seen, the else branch is being parsed
+  TernaryBranches
+};
+
+struct PendingOperator {
+  PendingOperatorKind kind;
+  ASTNodeType node_type;
+  int precedence;
+  // function calls: how many arguments have been completed so far
+  unsigned argument_count;
+};
+
+struct ExpressionStacks {
+  std::vector<ASTNode*> operands;
+  std::vector<PendingOperator> operators;
+  // where the markers are in operators, the innermost last, so finding it
+  // doesn't scan the operators of a long right associative chain
+  std::vector<size_t> markers;
+};
+
+static bool is_marker(PendingOperator const& pending_operator)
 {
-  // get lhs, root of this parse subtree is whatever the cast expr gives us
-  ASTNode* root = parse_cast_expression(lexer, scope);
-
-  Token const* current_token = get_current_token(lexer);
-
-  while (current_token->type == TokenType::Asterisk || current_token->type == TokenType::ForwardSlash || current_token->type == TokenType::Modulo) {
-
-    switch (current_token->type) {
-      // hit *, now the root should be the multiplication operation
-    case TokenType::Asterisk:
-      current_token = get_next_token(lexer);
-      root = new_binary_expression_node(ASTNodeType::Multiplication, root, parse_cast_expression(lexer, scope), scope);
-      break;
-
-    case TokenType::ForwardSlash:
-      current_token = get_next_token(lexer);
-      root = new_binary_expression_node(ASTNodeType::Division, root, parse_cast_expression(lexer, scope), scope);
-      break;
-
-    case TokenType::Modulo:
-      current_token = get_next_token(lexer);
-      root = new_binary_expression_node(ASTNodeType::Modulo, root, parse_cast_expression(lexer, scope), scope);
-      break;
-
-    default:
-      break;
-    }
-  }
-
-  return root;
+  return pending_operator.kind == PendingOperatorKind::OpenParenthesis || pending_operator.kind == PendingOperatorKind::FunctionCall
+      || pending_operator.kind == PendingOperatorKind::Subscript || pending_operator.kind == PendingOperatorKind::TernaryCondition;
 }
 
-// 6.5.6 add-expr
-//          mult-expr
-//          add-expr (+ or -) mult-expr
-ASTNode* parse_additive_expression(Lexer* lexer, Scope* scope)
+static void push_operator(ExpressionStacks* stacks, PendingOperator pending_operator)
 {
-  ASTNode* root = parse_multiplicative_expression(lexer, scope);
-
-  Token const* current_token = get_current_token(lexer);
-
-  while (current_token->type == TokenType::Plus || current_token->type == TokenType::Minus) {
-
-    switch (current_token->type) {
-    case TokenType::Plus:
-      current_token = get_next_token(lexer);
-      root = new_binary_expression_node(ASTNodeType::Addition, root, parse_multiplicative_expression(lexer, scope), scope);
-      break;
-
-    case TokenType::Minus:
-      current_token = get_next_token(lexer);
-      root = new_binary_expression_node(ASTNodeType::Subtraction, root, parse_multiplicative_expression(lexer, scope), scope);
-      break;
-
-    default:
-      break;
-    }
-  }
+  if (is_marker(pending_operator))
+    stacks->markers.push_back(stacks->operators.size());
+  stacks->operators.push_back(pending_operator);
+}
 
-  return root;
+static PendingOperator pop_operator(ExpressionStacks* stacks)
+{
+  PendingOperator pending_operator = stacks->operators.back();
+  stacks->operators.pop_back();
+  if (is_marker(pending_operator))
+    stacks->markers.pop_back();
+  return pending_operator;
 }
 
-// 6.5.7 shift-expr
-//          add-expr
-//          shift-expr (>> or <<) add-expr
-ASTNode* parse_shift_expression(Lexer* lexer, Scope* scope)
+static ASTNode* pop_operand(ExpressionStacks* stacks)
 {
-  ASTNode* root = parse_additive_expression(lexer, scope);
+  assert(!stacks->operands.empty() && "Reducing an operator with a missing operand");
+  ASTNode* operand = stacks->operands.back();
+  stacks->operands.pop_back();
+  return operand;
+}
 
-  Token const* current_token = get_current_token(lexer);
-  while (current_token->type == TokenType::BitShiftLeft || current_token->type == TokenType::BitShiftRight) {
-    switch (current_token->type) {
-    case TokenType::BitShiftLeft:
-      current_token = get_next_token(lexer);
-      root = new_binary_expression_node(ASTNodeType::BitShiftLeft, root, parse_additive_expression(lexer, scope), scope);
-      break;
+// pop the top pending operator and fold it and its operands into a single node
+static void reduce_top_operator(ExpressionStacks* stacks, Scope* scope)
+{
+  PendingOperator pending_operator = pop_operator(stacks);
+
+  switch (pending_operator.kind) {
+  case PendingOperatorKind::Binary: {
+    ASTNode* rhs = pop_operand(stacks);
+    ASTNode* lhs = pop_operand(stacks);
+    stacks->operands.push_back(new_binary_expression_node(pending_operator.node_type, lhs, rhs, scope));
+    return;
+  }
 
-    case TokenType::BitShiftRight:
-      current_token = get_next_token(lexer);
-      root = new_binary_expression_node(ASTNodeType::BitShiftRight, root, parse_additive_expression(lexer, scope), scope);
-      break;
+  case PendingOperatorKind::Unary: {
+    ASTNode* unary_node = new_ast_node(scope, pending_operator.node_type);
+    unary_node->lhs = pop_operand(stacks);
+    stacks->operands.push_back(unary_node);
+    return;
+  }
 
-    default:
-      break;
-    }
+    // the ast here looks like
+    //          ?
+    //       /  |   \
+    // or-expr if  else
+  case PendingOperatorKind::TernaryBranches: {
+    ASTNode* conditional_node = new_ast_node(scope, ASTNodeType::ConditionalExpression);
+    conditional_node->rhs = pop_operand(stacks);
+    conditional_node->lhs = pop_operand(stacks);
+    conditional_node->conditional = pop_operand(stacks);
+    stacks->operands.push_back(conditional_node);
+    return;
   }
 
-  return root;
+  case PendingOperatorKind::OpenParenthesis:
+  case PendingOperatorKind::FunctionCall:
+  case PendingOperatorKind::Subscript:
+  case PendingOperatorKind::TernaryCondition:
+    assert(false && "Markers are never reduced");
+  }
 }
 
-// 6.5.8 relational-expr
-//          shift-expr
-//          relational-expr (< or > or <= or >=) shift-expr
-ASTNode* parse_relational_expression(Lexer* lexer, Scope* scope)
+// reduce everything that binds at least as tightly as an incoming operator
+// right associative operators only reduce what binds strictly tighter, so
+// a = b = c leaves the first = pending until the second one is done
+static void reduce_for_incoming_operator(ExpressionStacks* stacks, Scope* scope, int precedence, Associativity associativity)
 {
-  ASTNode* root = parse_shift_expression(lexer, scope);
-
-  Token const* current_token = get_current_token(lexer);
-
-  while (current_token->type == TokenType::LessThan || current_token->type == TokenType::LessThanOrEqualTo
-      || current_token->type == TokenType::GreaterThan || current_token->type == TokenType::GreaterThanOrEqualTo) {
-    switch (current_token->type) {
-
-    case TokenType::LessThan:
-      current_token = get_next_token(lexer);
-      root = new_binary_expression_node(ASTNodeType::LessThan, root, parse_shift_expression(lexer, scope), scope);
-      break;
-
-    case TokenType::LessThanOrEqualTo:
-      current_token = get_next_token(lexer);
-      root = new_binary_expression_node(ASTNodeType::LessThanOrEqualTo, root, parse_shift_expression(lexer, scope), scope);
-      break;
-
-    case TokenType::GreaterThan:
-      current_token = get_next_token(lexer);
-      root = new_binary_expression_node(ASTNodeType::GreaterThan, root, parse_shift_expression(lexer, scope), scope);
-      break;
+  while (!stacks->operators.empty() && !is_marker(stacks->operators.back())) {
+    int top_precedence = stacks->operators.back().precedence;
+    bool reduce = associativity == Associativity::Left ? top_precedence >= precedence : top_precedence > precedence;
+    if (!reduce)
+      return;
 
-    case TokenType::GreaterThanOrEqualTo:
-      current_token = get_next_token(lexer);
-      root = new_binary_expression_node(ASTNodeType::GreaterThanOrEqualTo, root, parse_shift_expression(lexer, scope), scope);
-
-    default:
-      break;
-    }
+    reduce_top_operator(stacks, scope);
   }
-
-  return root;
 }
 
-// 6.5.9 equality-expr
-//          relational-expr
-//          equality-expr (== or !=) relational-expr
-ASTNode* parse_equality_expression(Lexer* lexer, Scope* scope)
+static void reduce_to_marker(ExpressionStacks* stacks, Scope* scope)
 {
-  ASTNode* root = parse_relational_expression(lexer, scope);
-
-  Token const* current_token = get_current_token(lexer);
+  while (!stacks->operators.empty() && !is_marker(stacks->operators.back()))
+    reduce_top_operator(stacks, scope);
+}
 
-  while (current_token->type == TokenType::BitShiftLeft || current_token->type == TokenType::BitShiftRight) {
+// the innermost marker decides what a ) or : closes
+static PendingOperator const* innermost_marker(ExpressionStacks const* stacks)
+{
+  return stacks->markers.empty() ? nullptr : &stacks->operators[stacks->markers.back()];
+}
 
-    switch (current_token->type) {
-    case TokenType::BitShiftLeft:
-      current_token = get_next_token(lexer);
-      root = new_binary_expression_node(ASTNodeType::BitShiftLeft, root, parse_relational_expression(lexer, scope), scope);
-      break;
+// the arguments of a call sit on top of its callee on the operand stack
+// the call node's lhs is the callee, its rhs the arguments chained through next
+static void finish_function_call(ExpressionStacks* stacks, Scope* scope)
+{
+  PendingOperator call_marker = pop_operator(stacks);
+  assert(call_marker.kind == PendingOperatorKind::FunctionCall);
 
-    case TokenType::BitShiftRight:
-      current_token = get_next_token(lexer);
-      root = new_binary_expression_node(ASTNodeType::BitShiftRight, root, parse_relational_expression(lexer, scope), scope);
-      break;
+  ASTNode* call_node = new_ast_node(scope, ASTNodeType::FunctionCall);
 
-    default:
-      break;
-    }
+  ASTNode* arguments = nullptr;
+  for (unsigned i = 0; i < call_marker.argument_count; i++) {
+    ASTNode* argument = pop_operand(stacks);
+    argument->next = arguments;
+    arguments = argument;
   }
 
-  return root;
+  call_node->rhs = arguments;
+  call_node->lhs = pop_operand(stacks);
+  stacks->operands.push_back(call_node);
 }
 
-// 6.5.10 and-expr
-//          eq-expr
-//          and-expr & eq-expr
-ASTNode* parse_bitwise_and_expression(Lexer* lexer, Scope* scope)
+// 6.5.2.1 on pointers, arrays, and vectors
+// the index sits on top of what is subscripted on the operand stack
+static void finish_subscript(ExpressionStacks* stacks, Scope* scope)
 {
-  ASTNode* root = parse_equality_expression(lexer, scope);
-
-  // while (get_next_token(lexer)->type == TokenType::Ampersand) {
-  // get_next_token(lexer);
-  // root = new_binary_expression_node(ASTNodeType::BitwiseAnd, root,
-  // parse_equality_expression(lexer));
-  //}
-
-  return root;
+  PendingOperator subscript_marker = pop_operator(stacks);
+  assert(subscript_marker.kind == PendingOperatorKind::Subscript);
+  (void)subscript_marker;
+
+  ASTNode* subscript_node = new_ast_node(scope, ASTNodeType::Subscript);
+  subscript_node->rhs = pop_operand(stacks);
+  subscript_node->lhs = pop_operand(stacks);
+  stacks->operands.push_back(subscript_node);
 }
 
-// 6.5.11 xor-expr
-//          and-expr
-//          xor-expr ^ and-expr
-ASTNode* parse_bitwise_xor_expression(Lexer* lexer, Scope* scope)
+// parse an expression made of operators binding at least as tightly as
+// minimum_precedence, stopping at the first token that can't continue it
+static ASTNode* parse_binary_expression(Lexer* lexer, Scope* scope, int minimum_precedence)
 {
+  ExpressionStacks stacks;
 
-  ASTNode* root = parse_bitwise_and_expression(lexer, scope);
-
-  while (get_current_token(lexer)->type == TokenType::Caret) {
-    get_next_token(lexer);
-    root = new_binary_expression_node(ASTNodeType::BitwiseXor, root, parse_bitwise_and_expression(lexer, scope), scope);
-  }
-
-  return root;
-}
+  for (;;) {
+    // operand position: prefix operators and parentheses stack up until we
+    // reach something that is an operand in its own right
+    Token const* current_token = get_current_token(lexer);
 
-// 6.5.12 or-expr
-//          xor-expr
-//          or-expr | xor-expr
-ASTNode* parse_bitwise_or_expression(Lexer* lexer, Scope* scope)
-{
-  ASTNode* root = parse_bitwise_xor_expression(lexer, scope);
+    if (current_token->type == TokenType::LParen) {
+      get_next_token(lexer);
 
-  while (get_current_token(lexer)->type == TokenType::Pipe) {
-    get_next_token(lexer);
-    root = new_binary_expression_node(ASTNodeType::BitwiseOr, root, parse_bitwise_xor_expression(lexer, scope), scope);
-  }
+      // FIXME: Parse typename
+      if (token_is_declaration_specifier(get_current_token(lexer), scope))
+        error_token(lexer, "Type casts not implemented\n");
 
-  return root;
-}
+      push_operator(&stacks, { PendingOperatorKind::OpenParenthesis, ASTNodeType::Void, 0, 0 });
+      continue;
+    }
 
-// 6.5.13 logical-and-expr
-//          inclusive-or-expr
-//          local-and-expr && inclusive-or
-ASTNode* parse_logical_and_expression(Lexer* lexer, Scope* scope)
-{
-  ASTNode* root = parse_bitwise_or_expression(lexer, scope);
+    if (is_unary_operator(current_token)) {
+      ASTNodeType node_type;
 
-  while (get_current_token(lexer)->type == TokenType::LogicalAnd) {
-    get_next_token(lexer);
-    root = new_binary_expression_node(ASTNodeType::LogicalAnd, root, parse_bitwise_or_expression(lexer, scope), scope);
-  }
+      // unary plus is the identity on its (promoted) operand
+      // FIXME: integer promotions
+      if (current_token->type == TokenType::Plus) {
+        get_next_token(lexer);
+        continue;
+      }
 
-  return root;
-}
+      // FIXME: ++, -- and sizeof
+      if (!unary_operator_node_type(current_token, &node_type))
+        error_token(lexer, "Unary operator not implemented\n");
 
-// 6.5.14 logical-or-expr
-//          logical-and-expr
-//          logical-or-expr || logical-and-expr
-ASTNode* parse_logical_or_expression(Lexer* lexer, Scope* scope)
-{
-  ASTNode* root = parse_logical_and_expression(lexer, scope);
+      get_next_token(lexer);
+      push_operator(&stacks, { PendingOperatorKind::Unary, node_type, unary_precedence, 0 });
+      continue;
+    }
 
-  while (get_current_token(lexer)->type == TokenType::LogicalOr) {
-    get_next_token(lexer);
-    root = new_binary_expression_node(ASTNodeType::LogicalOr, root, parse_logical_and_expression(lexer, scope), scope);
+    stacks.operands.push_back(parse_postfix_operators(lexer, scope, parse_primary_expression(lexer, scope)));
+
+    // operator position: close parentheses and ternaries, or push a binary
+    // operator and go back for its rhs
+    for (;;) {
+      current_token = get_current_token(lexer);
+      PendingOperator const* marker = innermost_marker(&stacks);
+
+      // parentheses, arguments, indices and the middle of a ternary hold full
+      // expressions, whatever precedence the expression as a whole started at
+      int operator_minimum_precedence = marker ? assignment_precedence : minimum_precedence;
+
+      if (current_token->type == TokenType::RParen && marker && marker->kind == PendingOperatorKind::OpenParenthesis) {
+        reduce_to_marker(&stacks, scope);
+        pop_operator(&stacks);
+        get_next_token(lexer);
+
+        ASTNode* parenthesized_expression = pop_operand(&stacks);
+        stacks.operands.push_back(parse_postfix_operators(lexer, scope, parenthesized_expression));
+        continue;
+      }
+
+      // the top operand is being called, any pending prefix operators apply
+      // to the result of the call, so they stay below the call's marker
+      if (current_token->type == TokenType::LParen) {
+        push_operator(&stacks, { PendingOperatorKind::FunctionCall, ASTNodeType::FunctionCall, 0, 0 });
+
+        if (get_next_token(lexer)->type != TokenType::RParen)
+          break;
+
+        get_next_token(lexer);
+        finish_function_call(&stacks, scope);
+        stacks.operands.push_back(parse_postfix_operators(lexer, scope, pop_operand(&stacks)));
+        continue;
+      }
+
+      // like a call, the index is parsed as an operand of its own and the
+      // subscript is applied to the top operand at the ]
+      if (current_token->type == TokenType::LBracket) {
+        push_operator(&stacks, { PendingOperatorKind::Subscript, ASTNodeType::Subscript, 0, 0 });
+        get_next_token(lexer);
+        break;
+      }
+
+      if (current_token->type == TokenType::RBracket && marker && marker->kind == PendingOperatorKind::Subscript) {
+        reduce_to_marker(&stacks, scope);
+        get_next_token(lexer);
+        finish_subscript(&stacks, scope);
+        stacks.operands.push_back(parse_postfix_operators(lexer, scope, pop_operand(&stacks)));
+        continue;
+      }
+
+      if (marker && marker->kind == PendingOperatorKind::FunctionCall
+          && (current_token->type == TokenType::Comma || current_token->type == TokenType::RParen)) {
+        bool more_arguments = current_token->type == TokenType::Comma;
+        reduce_to_marker(&stacks, scope);
+        stacks.operators.back().argument_count++;
+        get_next_token(lexer);
+
+        if (more_arguments)
+          break;
+
+        finish_function_call(&stacks, scope);
+        stacks.operands.push_back(parse_postfix_operators(lexer, scope, pop_operand(&stacks)));
+        continue;
+      }
+
+      if (current_token->type == TokenType::QuestionMark && conditional_precedence >= operator_minimum_precedence) {
+        reduce_for_incoming_operator(&stacks, scope, conditional_precedence, Associativity::Right);
+        push_operator(&stacks, { PendingOperatorKind::TernaryCondition, ASTNodeType::ConditionalExpression, conditional_precedence, 0 });
+        get_next_token(lexer);
+        break;
+      }
+
+      // a : only belongs to us if it closes a ?, it may also end a case label
+      if (current_token->type == TokenType::Colon && marker && marker->kind == PendingOperatorKind::TernaryCondition) {
+        // the else branch is an operand of the ternary, no longer a marker
+        reduce_to_marker(&stacks, scope);
+        stacks.operators.back().kind = PendingOperatorKind::TernaryBranches;
+        stacks.markers.pop_back();
+        get_next_token(lexer);
+        break;
+      }
+
+      BinaryOperator binary_operator;
+      if (binary_operator_from_token(current_token, &binary_operator) && binary_operator.precedence >= operator_minimum_precedence) {
+        reduce_for_incoming_operator(&stacks, scope, binary_operator.precedence, binary_operator.associativity);
+        push_operator(&stacks, { PendingOperatorKind::Binary, binary_operator.node_type, binary_operator.precedence, 0 });
+        get_next_token(lexer);
+        break;
+      }
+
+      // nothing continues the expression, fold up whatever is pending
+      reduce_to_marker(&stacks, scope);
+      if (!stacks.operators.empty()) {
+        if (stacks.operators.back().kind == PendingOperatorKind::TernaryCondition)
+          error_token(lexer, "Parsing ternary expression: expected ':' after expression\n");
+        else if (stacks.operators.back().kind == PendingOperatorKind::Subscript)
+          error_token(lexer, "Expected ] after subscript\n");
+        else
+          error_token(lexer, "Expected closing parenthesis in expression\n");
+      }
+
+      assert(stacks.operands.size() == 1);
+      return stacks.operands.back();
+    }
   }
-
-  return root;
 }
 
 // 6.5.15 conditional-expression
 //          logical-or-expr
 //          logical-or-expr ? expression : conditional-expression
-// implement as
-//          logical-or (? expression : logical-or)*
-// the ast here looks like
-//          ?
-//       /  |   \
-// or-expr if  else
 ASTNode* parse_conditional_expression(Lexer* lexer, Scope* scope)
 {
-  ASTNode* root = parse_logical_or_expression(lexer, scope);
-
-  while (get_current_token(lexer)->type == TokenType::QuestionMark) {
-
-    ASTNode* conditional_node = new_ast_node(scope, ASTNodeType::ConditionalExpression);
-    conditional_node->conditional = root;
-    get_next_token(lexer);
-
-    conditional_node->lhs = parse_expression(lexer, scope);
-    expect_and_get_next_token(lexer, TokenType::Colon, "Parsing ternary expression: expected ':' after expression");
-
-    conditional_node->rhs = parse_logical_or_expression(lexer, scope);
-
-    return conditional_node;
-  }
-
-  return root;
+  return parse_binary_expression(lexer, scope, conditional_precedence);
 }
 
 // 6.5.16
 // Assignment expression:
 //      conditional expression
 //      unary-expression assignment-operator assignment-expression
-static bool is_assignment_operator(Token* token)
-{
-  TokenType t = token->type;
-  return (t == TokenType::Equals || t == TokenType::TimesEquals || t == TokenType::DividedByEquals || t == TokenType::ModuloEquals
-      || t == TokenType::PlusEquals || t == TokenType::MinusEquals || t == TokenType::BitShiftLeftEquals || t == TokenType::BitShiftRightEquals
-      || t == TokenType::BitwiseAndEquals || t == TokenType::XorEquals || t == TokenType::BitwiseOrEquals);
-}
-
 ASTNode* parse_assignment_expression(Lexer* lexer, Scope* scope)
 {
-  ASTNode* root = parse_conditional_expression(lexer, scope);
-
-  while (is_assignment_operator(get_current_token(lexer))) {
-    // FIXME:
-    break;
-  }
-
-  return root;
+  return parse_binary_expression(lexer, scope, assignment_precedence);
 }
 
 // 6.5.17 Comma operator
@@ -3,27 +3,29 @@
 #include "type.h"
 
 #include <cassert>
+#include <vector>
 
+// nothing is declared in the scopes around a scope while it is being parsed,
+// so a block scope that is still empty when a scope is made in it, e.g. an
+// if's, has nothing the new scope can see, and is passed over. Deeply nested
+// statements then don't make every lookup walk all of their scopes
 Scope* new_scope(Scope* parent_scope, Type const* return_type = nullptr)
 {
-  Scope* current_scope = (Scope*)malloc(sizeof(Scope));
+  while (parent_scope && parent_scope->parent_scope && parent_scope->variables.empty() && parent_scope->typedef_names.empty()
+         && parent_scope->tags.empty())
+    parent_scope = parent_scope->parent_scope;
+
+  Scope* current_scope = new Scope;
 
   current_scope->parent_scope = parent_scope;
   current_scope->return_type = return_type;
-  current_scope->variables = std::unordered_map<std::string, Object*>();
-  current_scope->typedef_names = std::unordered_map<std::string, Object*>();
 
   return current_scope;
 }
 
-static ASTNode* parse_compound_statement(Lexer*, Scope*, Type const* = nullptr);
 static ASTNode* parse_jump_statement(Lexer*, Scope*);
-static ASTNode* parse_expression_statement(Lexer*, Scope*);
-static ASTNode* parse_iteration_statement(Lexer*, Scope*);
-static ASTNode* parse_selection_statement(Lexer*, Scope*);
-static ASTNode* parse_labeled_statement(Lexer*, Scope*);
 
-static ExternalDeclaration* new_external_declaration(ExternalDeclarationType type, ASTNode const* head_node)
+static ExternalDeclaration* new_external_declaration(ExternalDeclarationType type, ASTNode* head_node)
 {
   ExternalDeclaration* new_ext_dec = (ExternalDeclaration*)malloc(sizeof(ExternalDeclaration));
 
@@ -39,9 +41,24 @@ Type const* declaration_to_fundamental_type(DeclarationSpecifierFlags* declarati
 
   FundamentalType fundamental_type = fundamental_type_from_declaration(declaration);
 
-  return get_fundamental_type_pointer(fundamental_type);
+  Type const* type;
+  if (declaration->typedef_type)
+    type = declaration->typedef_type;
+  else if (fundamental_type == FundamentalType::Struct || fundamental_type == FundamentalType::Union)
+    type = declaration->tag_type;
+  else
+    type = get_fundamental_type_pointer(fundamental_type);
+
+  // 6.7.3 unlike const and restrict, which stay with the declared object,
+  // _Atomic and volatile change how every access to the object is made, also
+  // through a pointer to it
+  if (declaration->flags & TypeModifierFlag::Atomic)
+    type = intern_atomic_type(type);
+  if (declaration->flags & TypeModifierFlag::Volatile)
+    type = intern_volatile_type(type);
+
+  return type;
 }
-
 // 6.8 Statements
 //      labeled statement
 //      compound statement
@@ -49,40 +66,38 @@ Type const* declaration_to_fundamental_type(DeclarationSpecifierFlags* declarati
 //      selection statement
 //      iteration statement
 //      jump statement
-ASTNode* parse_statement(Lexer* lexer, Scope* scope)
-{
-  ASTNode* ast_node = new_ast_node(scope, ASTNodeType::Void);
-  switch (get_current_token(lexer)->type) {
-
-  case TokenType::Identifier:
-  case TokenType::Case:
-  case TokenType::Default:
-    return parse_labeled_statement(lexer, scope);
-
-  case TokenType::LBrace:
-    return parse_compound_statement(lexer, scope);
-
-  case TokenType::If:
-  case TokenType::Switch:
-    return parse_selection_statement(lexer, scope);
-
-  case TokenType::While:
-  case TokenType::For:
-  case TokenType::Do:
-    return parse_iteration_statement(lexer, scope);
-
-  case TokenType::GoTo:
-  case TokenType::Continue:
-  case TokenType::Break:
-  case TokenType::Return:
-    return parse_jump_statement(lexer, scope);
-
-  default:
-    return parse_expression_statement(lexer, scope);
-  }
-
-  return ast_node;
-}
+//
+// Statements nest as deep as the source does, e.g. blocks in blocks or ifs in
+// ifs, so rather than recursing per level, a statement that contains others
+// waits on a stack of pending statements while the statement inside it is
+// parsed, and is completed by it
+
+enum class PendingStatementKind {
+  // { seen, declarations and statements are parsed until the }
+  Compound,
+  // if ( expression ) seen, waiting for a branch
+  If,
+  // while ( expression ) or for ( ... ) seen, waiting for the body
+  Loop,
+  // do seen, waiting for the body before while ( expression ) ;
+  DoWhile
+};
+
+struct PendingStatement {
+  PendingStatementKind kind;
+  // the scope of the statements inside
+  Scope* scope;
+  // the if, the last one of an else if chain, or the loop
+  ASTNode* node;
+
+  // compound statements: the statements so far, ifs: the first if of the chain
+  ASTNode* head;
+  ASTNode* tail;
+
+  // ifs: the scope enclosing the chain, and whether the else branch is next
+  Scope* enclosing_scope;
+  bool is_in_else;
+};
 
 // labeled statements
 //      identifier : statement for use with goto
@@ -91,41 +106,38 @@ ASTNode* parse_statement(Lexer* lexer, Scope* scope)
 static ASTNode* parse_labeled_statement(Lexer* lexer, Scope* scope)
 {
   (void)scope;
-  ASTNode* ast_node = new_ast_node(scope, ASTNodeType::Void);
-  get_current_token(lexer);
-  return ast_node;
+  // FIXME
+  error_token(lexer, "Labeled statements not implemented\n");
+  return nullptr;
 }
 
-// compound statement are blocks of declarations and other statements wrapped in
-// {}, for use in basically everything, e.g. for loops
+// GNU statement attributes, of which only musttail is understood
 //
-// compound-statement: ( declaration | statement )*
-static ASTNode* parse_compound_statement(Lexer* lexer, Scope* scope, Type const* return_type)
+//      __attribute__ (( musttail )) return call-expression ;
+//
+// the call has to be made so the caller's frame is gone, or compilation fails
+static ASTNode* parse_attributed_statement(Lexer* lexer, Scope* scope)
 {
-  Scope* current_scope = new_scope(scope, return_type);
-
-  assert(get_current_token(lexer)->type == TokenType::LBrace);
   get_next_token(lexer);
+  expect_and_get_next_token(lexer, TokenType::LParen, "Expected (( after __attribute__\n");
+  expect_and_get_next_token(lexer, TokenType::LParen, "Expected (( after __attribute__\n");
 
-  ASTNode ast_node_anchor;
-  ast_node_anchor.next = nullptr;
-  ASTNode* previous_ast_node = &ast_node_anchor;
+  Token const* attribute_token = get_current_token(lexer);
+  if (attribute_token->type != TokenType::Identifier || (attribute_token->string != "musttail" && attribute_token->string != "__musttail__"))
+    error_token(lexer, "Unsupported statement attribute\n");
+  get_next_token(lexer);
 
-  while (get_current_token(lexer)->type != TokenType::RBrace) {
+  expect_and_get_next_token(lexer, TokenType::RParen, "Expected )) after attribute list\n");
+  expect_and_get_next_token(lexer, TokenType::RParen, "Expected )) after attribute list\n");
 
-    ASTNode* current_ast_node;
-    if (token_is_declaration_specifier(get_current_token(lexer), current_scope)) {
-      current_ast_node = parse_declaration(lexer, current_scope);
-    } else {
-      current_ast_node = parse_statement(lexer, current_scope);
-    }
-
-    previous_ast_node->next = current_ast_node;
-    previous_ast_node = previous_ast_node->next;
-  }
+  if (get_current_token(lexer)->type != TokenType::Return)
+    error_token(lexer, "musttail only applies to return statements\n");
+  ASTNode* return_node = parse_jump_statement(lexer, scope);
+  if (!return_node->rhs || return_node->rhs->type != ASTNodeType::FunctionCall)
+    error_token(lexer, "A musttail return needs a function call as its operand\n");
 
-  expect_and_get_next_token(lexer, TokenType::RBrace, "Expected closing brace after compound statement\n");
-  return ast_node_anchor.next;
+  return_node->rhs->tail_call_kind = TailCallKind::MustTail;
+  return return_node;
 }
 
 // expression statements are expr(opt);
@@ -141,34 +153,82 @@ static ASTNode* parse_expression_statement(Lexer* lexer, Scope* scope)
   return expression;
 }
 
+// compound statement are blocks of declarations and other statements wrapped in
+// {}, for use in basically everything, e.g. for loops
+//
+// compound-statement: ( declaration | statement )*
+static void begin_compound_statement(Lexer* lexer, Scope* scope, std::vector<PendingStatement>* pending)
+{
+  assert(get_current_token(lexer)->type == TokenType::LBrace);
+  get_next_token(lexer);
+
+  // blocks nested in a function body return from the same function
+  pending->push_back({ PendingStatementKind::Compound, new_scope(scope, scope->return_type), nullptr, nullptr, nullptr, nullptr, false });
+}
+
+// declarations and nested blocks hand back lists, append after their last node
+static void append_to_compound_statement(PendingStatement* compound, ASTNode* list, ASTNode* list_tail)
+{
+  if (compound->tail)
+    compound->tail->next = list;
+  else
+    compound->head = list;
+
+  if (!list_tail)
+    for (list_tail = list; list_tail->next; list_tail = list_tail->next)
+      ;
+  compound->tail = list_tail;
+}
+
+// parses the declarations up to the next statement, which is left to the
+// caller. At the } the block is done, and its list is returned
+static ASTNode* continue_compound_statement(Lexer* lexer, std::vector<PendingStatement>* pending, ASTNode** list_tail)
+{
+  PendingStatement* compound = &pending->back();
+  while (token_is_declaration_specifier(get_current_token(lexer), compound->scope))
+    append_to_compound_statement(compound, parse_declaration(lexer, compound->scope), nullptr);
+
+  if (get_current_token(lexer)->type != TokenType::RBrace)
+    return nullptr;
+  get_next_token(lexer);
+
+  ASTNode* list = compound->head ? compound->head : new_ast_node(compound->scope, ASTNodeType::Void);
+  *list_tail = compound->tail;
+  pending->pop_back();
+  return list;
+}
+
 // selection statements are ifs/switches
 // if ( expression ) statement
 // if ( expression ) statement else statement
 // switch ( expression ) statement
-static ASTNode* parse_selection_statement(Lexer* lexer, Scope* scope)
+//
+// an else if chain is an if nested in the else branch of the previous one. The
+// chain's ifs share one pending if, each new if becoming the rhs of the one
+// before it
+static ASTNode* begin_if(Lexer* lexer, Scope* scope)
+{
+  ASTNode* ast_node = new_ast_node(scope, ASTNodeType::If);
+  expect_next_token_and_skip(lexer, TokenType::LParen, "Expected parenthesis after if\n");
+
+  ast_node->conditional = parse_expression(lexer, scope);
+  expect_and_get_next_token(lexer, TokenType::RParen, "Expected closing parentheses after if condition\n");
+  return ast_node;
+}
+
+// a switch is complete, an if waits for its branches
+static ASTNode* begin_selection_statement(Lexer* lexer, Scope* scope, std::vector<PendingStatement>* pending)
 {
   if (!scope->return_type)
     error_token(lexer, "Selection statement not allowed in global scope\n");
 
-  Scope* current_scope = new_scope(scope);
+  Scope* current_scope = new_scope(scope, scope->return_type);
 
   switch (get_current_token(lexer)->type) {
-
   case TokenType::If: {
-    ASTNode* ast_node = new_ast_node(current_scope, ASTNodeType::If);
-    expect_next_token_and_skip(lexer, TokenType::LParen, "Expected parenthesis after if\n");
-
-    ast_node->conditional = parse_expression(lexer, current_scope);
-    expect_and_get_next_token(lexer, TokenType::RParen, "Expected closing parentheses after if condition\n");
-
-    ast_node->lhs = parse_statement(lexer, scope);
-
-    if (get_current_token(lexer)->type == TokenType::Else) {
-      get_next_token(lexer);
-      ast_node->rhs = parse_statement(lexer, current_scope);
-    }
-
-    return ast_node;
+    ASTNode* ast_node = begin_if(lexer, current_scope);
+    pending->push_back({ PendingStatementKind::If, current_scope, ast_node, ast_node, nullptr, scope, false });
+    return nullptr;
   }
 
   case TokenType::Switch: {
@@ -185,26 +245,57 @@ static ASTNode* parse_selection_statement(Lexer* lexer, Scope* scope)
   }
 }
 
-// iteration statements are (do) while and for
-static ASTNode* parse_iteration_statement(Lexer* lexer, Scope* scope)
+// a branch is done, the if is complete after its else branch, or the then
+// branch without an else
+static ASTNode* continue_if(Lexer* lexer, std::vector<PendingStatement>* pending, ASTNode* branch)
+{
+  PendingStatement* pending_if = &pending->back();
+  if (pending_if->is_in_else) {
+    pending_if->node->rhs = branch;
+  } else {
+    pending_if->node->lhs = branch;
+    if (get_current_token(lexer)->type == TokenType::Else) {
+      get_next_token(lexer);
+      if (get_current_token(lexer)->type != TokenType::If) {
+        pending_if->is_in_else = true;
+        return nullptr;
+      }
+
+      // nothing can be declared in an if's own scope, only in its branches,
+      // so the chained ifs can share a parent rather than nest ever deeper
+      pending_if->scope = new_scope(pending_if->enclosing_scope, pending_if->enclosing_scope->return_type);
+      ASTNode* next_if = begin_if(lexer, pending_if->scope);
+      pending_if->node->rhs = next_if;
+      pending_if->node = next_if;
+      return nullptr;
+    }
+  }
+
+  ASTNode* head_if_node = pending_if->head;
+  pending->pop_back();
+  return head_if_node;
+}
+
+// iteration statements are (do) while and for, all of them wait for their body
+static void begin_iteration_statement(Lexer* lexer, Scope* scope, std::vector<PendingStatement>* pending)
 {
   if (!scope->return_type)
     error_token(lexer, "Iteration statement not allowed in global scope\n");
 
   Scope* current_scope = new_scope(scope, scope->return_type);
   ASTNode* ast_node = new_ast_node(current_scope, ASTNodeType::For);
+  PendingStatementKind kind = PendingStatementKind::Loop;
 
   switch (get_current_token(lexer)->type) {
     // while ( expression ) statement
   case TokenType::While:
+    ast_node->type = ASTNodeType::While;
 
     expect_next_token_and_skip(lexer, TokenType::LParen, "Expected parentheses after while\n");
     ast_node->conditional = parse_expression(lexer, current_scope);
 
     expect_and_get_next_token(lexer, TokenType::RParen, "Expected closing parentheses after while condition\n");
-    ast_node->next = parse_statement(lexer, current_scope);
-
-    return ast_node;
+    break;
 
   case TokenType::For:
     // for (expression(opt); expression(opt); expression(opt)) statement OR
@@ -238,28 +329,121 @@ static ASTNode* parse_iteration_statement(Lexer* lexer, Scope* scope)
       ast_node->rhs = parse_expression(lexer, current_scope);
       expect_and_get_next_token(lexer, TokenType::RParen, "Expected closing parenthesis after for loop\n");
     }
-
-    ast_node->next = parse_statement(lexer, current_scope);
-    return ast_node;
+    break;
 
   case TokenType::Do:
+    ast_node->type = ASTNodeType::DoWhile;
     expect_and_get_next_token(lexer, TokenType::Do, "should be skipping do in do while\n");
+    kind = PendingStatementKind::DoWhile;
+    break;
 
-    ast_node->next = parse_statement(lexer, current_scope);
+  default:
+    assert(false && "Parsing iteration statement not starting with do/while/for");
+  }
+
+  pending->push_back({ kind, current_scope, ast_node, nullptr, nullptr, nullptr, false });
+}
 
+static ASTNode* finish_iteration_statement(Lexer* lexer, std::vector<PendingStatement>* pending, ASTNode* body)
+{
+  PendingStatement loop = pending->back();
+  pending->pop_back();
+  ASTNode* ast_node = loop.node;
+  ast_node->body = body;
+
+  if (loop.kind == PendingStatementKind::DoWhile) {
     expect_and_get_next_token(lexer, TokenType::While, "Expected while after statement in do while\n");
     expect_and_get_next_token(lexer, TokenType::LParen, "Expected parentheses after while in do while\n");
-    ast_node->conditional = parse_expression(lexer, current_scope);
+    ast_node->conditional = parse_expression(lexer, loop.scope);
     expect_and_get_next_token(lexer, TokenType::RParen, "Expected closing parentheses after condition in do while\n");
     expect_and_get_next_token(lexer, TokenType::Semicolon, "Expected semicolon after condition in do while\n");
+  }
 
-    return ast_node;
+  return ast_node;
+}
+
+// a statement without statements inside is returned complete, any other one
+// is pushed, and nullptr returned
+static ASTNode* begin_statement(Lexer* lexer, Scope* scope, std::vector<PendingStatement>* pending)
+{
+  switch (get_current_token(lexer)->type) {
+
+    // an identifier starts a labeled statement only when followed by a colon
+  case TokenType::Identifier:
+    if (get_current_token(lexer)->string == "__attribute__")
+      return parse_attributed_statement(lexer, scope);
+    if (peek_next_token(lexer).type != TokenType::Colon)
+      return parse_expression_statement(lexer, scope);
+    [[fallthrough]];
+  case TokenType::Case:
+  case TokenType::Default:
+    return parse_labeled_statement(lexer, scope);
+
+  case TokenType::LBrace:
+    begin_compound_statement(lexer, scope, pending);
+    return nullptr;
+
+  case TokenType::If:
+  case TokenType::Switch:
+    return begin_selection_statement(lexer, scope, pending);
+
+  case TokenType::While:
+  case TokenType::For:
+  case TokenType::Do:
+    begin_iteration_statement(lexer, scope, pending);
+    return nullptr;
+
+  case TokenType::GoTo:
+  case TokenType::Continue:
+  case TokenType::Break:
+  case TokenType::Return:
+    return parse_jump_statement(lexer, scope);
 
   default:
-    assert(false && "Parsing iteration statement not starting with do/while/for");
+    return parse_expression_statement(lexer, scope);
   }
+}
 
-  return ast_node;
+ASTNode* parse_statement(Lexer* lexer, Scope* scope)
+{
+  std::vector<PendingStatement> pending;
+  ASTNode* statement = begin_statement(lexer, scope, &pending);
+  // the last node of a block's list, so appending it to the enclosing block
+  // doesn't walk it again
+  ASTNode* statement_tail = nullptr;
+
+  for (;;) {
+    // a complete statement goes to the innermost pending one, which may be
+    // complete in turn
+    if (statement) {
+      if (pending.empty())
+        return statement;
+
+      PendingStatement* innermost = &pending.back();
+      ASTNode* list_tail = statement_tail;
+      statement_tail = nullptr;
+      switch (innermost->kind) {
+      case PendingStatementKind::Compound:
+        append_to_compound_statement(innermost, statement, list_tail);
+        statement = nullptr;
+        break;
+      case PendingStatementKind::If:
+        statement = continue_if(lexer, &pending, statement);
+        break;
+      case PendingStatementKind::Loop:
+      case PendingStatementKind::DoWhile:
+        statement = finish_iteration_statement(lexer, &pending, statement);
+        break;
+      }
+      continue;
+    }
+
+    // the innermost pending statement waits for a statement, a block may have
+    // declarations first, or end instead
+    if (pending.back().kind == PendingStatementKind::Compound && (statement = continue_compound_statement(lexer, &pending, &statement_tail)))
+      continue;
+    statement = begin_statement(lexer, pending.back().scope, &pending);
+  }
 }
 
 // jumps are goto identifier; continue; break; return;
@@ -277,14 +461,13 @@ static ASTNode* parse_jump_statement(Lexer* lexer, Scope* scope)
 
   case TokenType::Return: {
     get_next_token(lexer);
-    if (get_current_token(lexer)->type != TokenType::Semicolon) {
+    ASTNode* return_statement_node = new_ast_node(scope, ASTNodeType::Return);
 
-      ASTNode* return_statement_node = new_ast_node(scope, ASTNodeType::Return);
-      ASTNode* return_value_node = parse_expression(lexer, scope);
-      return_statement_node->rhs = return_value_node;
-      expect_and_get_next_token(lexer, TokenType::Semicolon, "Expected semicolon after return statement\n");
-      return return_statement_node;
-    }
+    if (get_current_token(lexer)->type != TokenType::Semicolon)
+      return_statement_node->rhs = parse_expression(lexer, scope);
+
+    expect_and_get_next_token(lexer, TokenType::Semicolon, "Expected semicolon after return statement\n");
+    return return_statement_node;
   }
 
   case TokenType::Continue:
@@ -300,6 +483,29 @@ static ASTNode* parse_jump_statement(Lexer* lexer, Scope* scope)
   assert(false);
 }
 
+// the parameters of a function definition are in scope for its body, so they
+// get a scope of their own wrapping the body's, holding an object for each
+// parameters take the first local slots, in order
+static Scope* new_parameter_scope(Scope* file_scope, Object* function_object)
+{
+  FunctionData const* function_data = function_object->type->function_data;
+  Scope* parameter_scope = new_scope(file_scope, function_data->return_type);
+
+  int slot = 0;
+  for (FunctionParameter const* current_param = function_data->parameter_list; current_param; current_param = current_param->next_parameter) {
+    std::string const& identifier = function_object->parameter_identifiers[slot];
+    Object* parameter_object = new_object(identifier, current_param->parameter_type);
+    parameter_object->local_slot = slot++;
+    function_object->parameter_objects.push_back(parameter_object);
+
+    if (!identifier.empty())
+      parameter_scope->variables[identifier] = parameter_object;
+  }
+
+  function_object->local_count = slot;
+  return parameter_scope;
+}
+
 // a translation unit is ( function definition | declaration )*
 //
 // function-definition:
@@ -316,6 +522,7 @@ ExternalDeclaration* parse_translation_unit(char const* file)
   Lexer lexer = new_lexer(file);
   Scope current_scope;
   current_scope.parent_scope = nullptr;
+  current_scope.return_type = nullptr;
 
   ExternalDeclaration declaration_anchor;
   declaration_anchor.next = nullptr;
@@ -331,18 +538,27 @@ ExternalDeclaration* parse_translation_unit(char const* file)
     DeclarationSpecifierFlags declaration_specifiers = parse_declaration_specifiers(&lexer, &current_scope);
     Type const* fundamental_type_ptr = declaration_to_fundamental_type(&declaration_specifiers);
 
+    // e.g. struct s { int x; }; only declares the tag
+    if (declaration_specifiers.tag_type && get_current_token(&lexer)->type == TokenType::Semicolon) {
+      get_next_token(&lexer);
+      continue;
+    }
+
     // prepare to parse declaration - overwrite declaration types if we find a function definition in the switch
     ASTNode* ast_node = new_ast_node(&current_scope, ASTNodeType::Declaration);
     ExternalDeclarationType declaration_type = ExternalDeclarationType::Declaration;
 
     ast_node->object = parse_declarator(&lexer, fundamental_type_ptr, &current_scope);
+    ast_node->object->declaration_specifiers = declaration_specifiers;
+    declare_identifier(&current_scope, ast_node->object);
 
     switch (ast_node->object->type->fundamental_type) {
     case FundamentalType::Function:
       // if the current object is a function followed by a {, this is a function definition
       if (get_current_token(&lexer)->type == TokenType::LBrace) {
         declaration_type = ExternalDeclarationType::FunctionDefinition;
-        ast_node->object->function_body = parse_compound_statement(&lexer, &current_scope, fundamental_type_ptr);
+        Scope* parameter_scope = new_parameter_scope(&current_scope, ast_node->object);
+        ast_node->object->function_body = parse_statement(&lexer, parameter_scope);
         break;
       }
 
@@ -0,0 +1,869 @@
+#include "semantic_analysis.h"
+#include "ast_walk.h"
+#include "function_attributes.h"
+#include "layout.h"
+#include "target.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+// null while analyzing the initializers of file scope objects
+struct FunctionAnalysisContext {
+  Object const* function_object;
+};
+
+static void semantic_error(char const* message)
+{
+  fprintf(stderr, "%s", message);
+  exit(1);
+}
+
+static FundamentalType fundamental_type_of(ASTNode const* expression) { return expression->expression_type->fundamental_type; }
+
+// 6.3.2.1 anything but a function designator or the result of & on one
+static bool is_lvalue(ASTNode const* expression)
+{
+  switch (expression->type) {
+  case ASTNodeType::VariableReference:
+    return expression->object->type->fundamental_type != FundamentalType::Function;
+  case ASTNodeType::Dereference:
+  case ASTNodeType::PointerMemberAccess:
+    return true;
+  case ASTNodeType::MemberAccess:
+    return is_lvalue(expression->lhs);
+  case ASTNodeType::Subscript:
+    return fundamental_type_of(expression->lhs) == FundamentalType::Pointer || is_lvalue(expression->lhs);
+  default:
+    return false;
+  }
+}
+
+// wraps an expression in a conversion, the conversion takes over the
+// expression's place in a list like the arguments of a call
+static ASTNode* convert_to(ASTNode* expression, Type const* type)
+{
+  // types are interned, equal types are the same object
+  if (expression->expression_type == type)
+    return expression;
+
+  ASTNode* conversion = new_ast_node(expression->scope, ASTNodeType::ImplicitConversion);
+  conversion->expression_type = type;
+  conversion->lhs = expression;
+  conversion->next = expression->next;
+  expression->next = nullptr;
+  return conversion;
+}
+
+// 6.3.1.1 integer promotions
+static Type const* promoted_type(Type const* type)
+{
+  FundamentalType fundamental_type = type->fundamental_type;
+  if (is_integer_type(fundamental_type) && integer_conversion_rank(fundamental_type) < integer_conversion_rank(FundamentalType::Int))
+    return IntType;
+
+  return non_atomic_type(type);
+}
+
+// 6.3.1.8 usual arithmetic conversions
+static Type const* usual_arithmetic_conversion_type(Type const* lhs, Type const* rhs)
+{
+  for (FundamentalType floating_type : { FundamentalType::LongDouble, FundamentalType::Double, FundamentalType::Float })
+    if (lhs->fundamental_type == floating_type || rhs->fundamental_type == floating_type)
+      return get_fundamental_type_pointer(floating_type);
+
+  FundamentalType promoted_lhs = promoted_type(lhs)->fundamental_type;
+  FundamentalType promoted_rhs = promoted_type(rhs)->fundamental_type;
+  if (promoted_lhs == promoted_rhs)
+    return get_fundamental_type_pointer(promoted_lhs);
+
+  bool lhs_is_unsigned = is_unsigned_integer_type(promoted_lhs);
+  if (lhs_is_unsigned == is_unsigned_integer_type(promoted_rhs))
+    return get_fundamental_type_pointer(integer_conversion_rank(promoted_lhs) > integer_conversion_rank(promoted_rhs) ? promoted_lhs : promoted_rhs);
+
+  FundamentalType unsigned_operand = lhs_is_unsigned ? promoted_lhs : promoted_rhs;
+  FundamentalType signed_operand = lhs_is_unsigned ? promoted_rhs : promoted_lhs;
+
+  if (integer_conversion_rank(unsigned_operand) >= integer_conversion_rank(signed_operand))
+    return get_fundamental_type_pointer(unsigned_operand);
+
+  // the signed type can represent every value of the unsigned one
+  if (fundamental_type_bit_width(signed_operand) > fundamental_type_bit_width(unsigned_operand))
+    return get_fundamental_type_pointer(signed_operand);
+
+  return get_fundamental_type_pointer(unsigned_integer_type(signed_operand));
+}
+
+static Type const* apply_usual_arithmetic_conversions(ASTNode* binary_node)
+{
+  Type const* common_type = usual_arithmetic_conversion_type(binary_node->lhs->expression_type, binary_node->rhs->expression_type);
+  binary_node->lhs = convert_to(binary_node->lhs, common_type);
+  binary_node->rhs = convert_to(binary_node->rhs, common_type);
+  return common_type;
+}
+
+// 6.3.2.1 a function designator used as a value is a pointer to the function
+static ASTNode* decay_function_designator(ASTNode* expression)
+{
+  if (fundamental_type_of(expression) != FundamentalType::Function)
+    return expression;
+
+  return convert_to(expression, intern_pointer_type(expression->expression_type));
+}
+
+// 6.5.16.1 simple assignment, also used for initializers, arguments and returns
+static ASTNode* convert_as_if_by_assignment(ASTNode* expression, Type const* type)
+{
+  expression = decay_function_designator(expression);
+  type = non_atomic_type(type);
+
+  FundamentalType to = type->fundamental_type;
+  FundamentalType from = fundamental_type_of(expression);
+
+  // FIXME: only null pointer constants convert to pointers without a cast
+  bool is_allowed = (is_arithmetic_type(to) && is_arithmetic_type(from)) || (to == FundamentalType::Pointer && (from == FundamentalType::Pointer || is_integer_type(from)))
+      || ((to == FundamentalType::Struct || to == FundamentalType::Union || to == FundamentalType::Vector) && expression->expression_type == type);
+
+  if (!is_allowed)
+    semantic_error("Incompatible types in assignment\n");
+
+  return convert_to(expression, type);
+}
+
+// 6.5.2.2 arguments are converted as if by assignment to their parameter's
+// type, arguments without a parameter get the default argument promotions
+static void analyze_function_call(ASTNode* call_node)
+{
+  Type const* callee_type = call_node->lhs->expression_type;
+  if (callee_type->fundamental_type == FundamentalType::Pointer)
+    callee_type = callee_type->pointed_type;
+
+  if (callee_type->fundamental_type != FundamentalType::Function)
+    semantic_error("Called object is not a function\n");
+
+  FunctionData const* function_data = callee_type->function_data;
+  FunctionParameter const* current_param = function_data->parameter_list;
+
+  for (ASTNode** argument = &call_node->rhs; *argument; argument = &(*argument)->next) {
+    if (current_param) {
+      *argument = convert_as_if_by_assignment(*argument, current_param->parameter_type);
+      current_param = current_param->next_parameter;
+      continue;
+    }
+
+    if (function_data->parameter_list && !function_data->is_variadic)
+      semantic_error("Too many arguments in function call\n");
+
+    *argument = decay_function_designator(*argument);
+    Type const* argument_type = (*argument)->expression_type;
+    *argument = convert_to(*argument, argument_type->fundamental_type == FundamentalType::Float ? DoubleType : promoted_type(argument_type));
+  }
+
+  if (current_param)
+    semantic_error("Too few arguments in function call\n");
+
+  call_node->expression_type = function_data->return_type;
+}
+
+// 6.5.2.3 the lhs of . is a struct or union, the lhs of -> points to one
+static void analyze_member_access(ASTNode* access_node)
+{
+  Type const* struct_type = access_node->lhs->expression_type;
+
+  if (access_node->type == ASTNodeType::PointerMemberAccess) {
+    if (struct_type->fundamental_type != FundamentalType::Pointer)
+      semantic_error("Left operand of -> is not a pointer\n");
+    struct_type = struct_type->pointed_type;
+  }
+
+  if (!struct_type->struct_data)
+    semantic_error("Member access on something that is not a struct or union\n");
+  if (!struct_type->struct_data->is_complete)
+    semantic_error("Member access on an incomplete struct or union\n");
+
+  int member_index = find_struct_member(struct_type, access_node->referenced_variable);
+  if (member_index < 0)
+    semantic_error("No member with that name in struct or union\n");
+
+  access_node->member_index = (unsigned)member_index;
+  access_node->expression_type = struct_type->struct_data->members[member_index].member_type;
+}
+
+// 6.5.6 additive operators, either operand of + may be the pointer
+static void analyze_additive_expression(ASTNode* additive_node)
+{
+  FundamentalType lhs_type = fundamental_type_of(additive_node->lhs);
+  FundamentalType rhs_type = fundamental_type_of(additive_node->rhs);
+
+  if (is_arithmetic_type(lhs_type) && is_arithmetic_type(rhs_type)) {
+    additive_node->expression_type = apply_usual_arithmetic_conversions(additive_node);
+    return;
+  }
+
+  bool is_subtraction = additive_node->type == ASTNodeType::Subtraction;
+
+  // the difference of two pointers is a ptrdiff_t
+  if (is_subtraction && lhs_type == FundamentalType::Pointer && rhs_type == FundamentalType::Pointer) {
+    additive_node->expression_type = ptrdiff_type();
+    return;
+  }
+
+  // the integer operand is an index, converted to the width of a pointer
+  if (lhs_type == FundamentalType::Pointer && is_integer_type(rhs_type)) {
+    additive_node->rhs = convert_to(additive_node->rhs, ptrdiff_type());
+    additive_node->expression_type = non_atomic_type(additive_node->lhs->expression_type);
+    return;
+  }
+
+  if (!is_subtraction && is_integer_type(lhs_type) && rhs_type == FundamentalType::Pointer) {
+    additive_node->lhs = convert_to(additive_node->lhs, ptrdiff_type());
+    additive_node->expression_type = non_atomic_type(additive_node->rhs->expression_type);
+    return;
+  }
+
+  semantic_error("Invalid operands to additive operator\n");
+}
+
+// 6.5.2.1 E1[E2] is *((E1) + (E2)) for a pointer. Arrays and vectors are
+// indexed in place, an lvalue element of an lvalue
+static void analyze_subscript(ASTNode* subscript_node)
+{
+  Type const* base_type = subscript_node->lhs->expression_type;
+
+  switch (base_type->fundamental_type) {
+  case FundamentalType::Pointer:
+    if (base_type->pointed_type->fundamental_type == FundamentalType::Void || base_type->pointed_type->fundamental_type == FundamentalType::Function)
+      semantic_error("Subscripting a pointer to void or to a function\n");
+    break;
+  case FundamentalType::Array:
+  case FundamentalType::Vector:
+    break;
+  default:
+    semantic_error("Subscripted value is not a pointer, array or vector\n");
+  }
+
+  if (!is_integer_type(fundamental_type_of(subscript_node->rhs)))
+    semantic_error("Subscript is not an integer\n");
+
+  subscript_node->rhs = convert_to(subscript_node->rhs, ptrdiff_type());
+  subscript_node->expression_type = base_type->pointed_type;
+}
+
+// GCC vector extensions
+//
+// the arithmetic, bitwise, shift and comparison operators apply to each
+// element of vectors of the same type. A scalar operand is converted to the
+// element type and copied into every element. Comparisons give a vector of
+// signed integers as wide as the elements, -1 for true and 0 for false
+
+static bool is_element_wise_operator(ASTNodeType node_type)
+{
+  switch (node_type) {
+  case ASTNodeType::Negation:
+  case ASTNodeType::BitwiseNot:
+  case ASTNodeType::Multiplication:
+  case ASTNodeType::Division:
+  case ASTNodeType::Modulo:
+  case ASTNodeType::Addition:
+  case ASTNodeType::Subtraction:
+  case ASTNodeType::BitShiftLeft:
+  case ASTNodeType::BitShiftRight:
+  case ASTNodeType::GreaterThan:
+  case ASTNodeType::GreaterThanOrEqualTo:
+  case ASTNodeType::LessThan:
+  case ASTNodeType::LessThanOrEqualTo:
+  case ASTNodeType::EqualityComparison:
+  case ASTNodeType::InequalityComparison:
+  case ASTNodeType::BitwiseAnd:
+  case ASTNodeType::BitwiseXor:
+  case ASTNodeType::BitwiseOr:
+    return true;
+  default:
+    return false;
+  }
+}
+
+static bool has_vector_operand(ASTNode const* operator_node)
+{
+  return fundamental_type_of(operator_node->lhs) == FundamentalType::Vector
+      || (operator_node->rhs && fundamental_type_of(operator_node->rhs) == FundamentalType::Vector);
+}
+
+static ASTNode* convert_to_vector_operand(ASTNode* operand, Type const* vector_type)
+{
+  if (operand->expression_type == vector_type)
+    return operand;
+
+  if (!is_arithmetic_type(fundamental_type_of(operand)))
+    semantic_error("Vector operands must have the same type\n");
+
+  return convert_to(convert_to(operand, vector_type->pointed_type), vector_type);
+}
+
+static Type const* comparison_result_type(Type const* vector_type)
+{
+  switch (size_of_type(vector_type->pointed_type)) {
+  case 1:
+    return intern_vector_type(SignedCharType, vector_type->array_length);
+  case 2:
+    return intern_vector_type(ShortType, vector_type->array_length);
+  case 4:
+    return intern_vector_type(IntType, vector_type->array_length);
+  default:
+    return intern_vector_type(LongLongType, vector_type->array_length);
+  }
+}
+
+static void analyze_vector_operator(ASTNode* operator_node)
+{
+  Type const* vector_type = fundamental_type_of(operator_node->lhs) == FundamentalType::Vector ? operator_node->lhs->expression_type
+                                                                                             : operator_node->rhs->expression_type;
+
+  bool needs_integer_elements = false;
+  bool is_comparison = false;
+  switch (operator_node->type) {
+  case ASTNodeType::BitwiseNot:
+  case ASTNodeType::Modulo:
+  case ASTNodeType::BitShiftLeft:
+  case ASTNodeType::BitShiftRight:
+  case ASTNodeType::BitwiseAnd:
+  case ASTNodeType::BitwiseXor:
+  case ASTNodeType::BitwiseOr:
+    needs_integer_elements = true;
+    break;
+  case ASTNodeType::GreaterThan:
+  case ASTNodeType::GreaterThanOrEqualTo:
+  case ASTNodeType::LessThan:
+  case ASTNodeType::LessThanOrEqualTo:
+  case ASTNodeType::EqualityComparison:
+  case ASTNodeType::InequalityComparison:
+    is_comparison = true;
+    break;
+  default:
+    break;
+  }
+
+  if (needs_integer_elements && !is_integer_type(vector_type->pointed_type->fundamental_type))
+    semantic_error("Invalid operands to vector operator, it needs integer elements\n");
+
+  operator_node->lhs = convert_to_vector_operand(operator_node->lhs, vector_type);
+  if (operator_node->rhs)
+    operator_node->rhs = convert_to_vector_operand(operator_node->rhs, vector_type);
+
+  operator_node->expression_type = is_comparison ? comparison_result_type(vector_type) : vector_type;
+}
+
+// picks elements out of two vectors of the same type
+static void analyze_shufflevector(ASTNode* shuffle_node)
+{
+  Type const* vector_type = shuffle_node->lhs->expression_type;
+  if (vector_type->fundamental_type != FundamentalType::Vector || shuffle_node->rhs->expression_type != vector_type)
+    semantic_error("__builtin_shufflevector needs two vectors of the same type\n");
+
+  for (int index : shuffle_node->shuffle_mask)
+    if (index >= 2 * vector_type->array_length)
+      semantic_error("Shuffle index out of range\n");
+
+  shuffle_node->expression_type = intern_vector_type(vector_type->pointed_type, (long long)shuffle_node->shuffle_mask.size());
+}
+
+// the result type came from the type name, when parsing
+static void analyze_convertvector(ASTNode* convert_node)
+{
+  Type const* from = convert_node->lhs->expression_type;
+  Type const* to = convert_node->expression_type;
+
+  if (from->fundamental_type != FundamentalType::Vector || to->fundamental_type != FundamentalType::Vector)
+    semantic_error("__builtin_convertvector converts a vector to a vector type\n");
+  if (from->array_length != to->array_length)
+    semantic_error("__builtin_convertvector needs vectors with as many elements\n");
+}
+
+// 6.5.8, 6.5.9 relational and equality operators give an int
+static void analyze_comparison(ASTNode* comparison_node)
+{
+  FundamentalType lhs_type = fundamental_type_of(comparison_node->lhs);
+  FundamentalType rhs_type = fundamental_type_of(comparison_node->rhs);
+  comparison_node->expression_type = IntType;
+
+  if (is_arithmetic_type(lhs_type) && is_arithmetic_type(rhs_type)) {
+    apply_usual_arithmetic_conversions(comparison_node);
+    return;
+  }
+
+  if (lhs_type == FundamentalType::Pointer && rhs_type == FundamentalType::Pointer)
+    return;
+
+  // comparing a pointer with a null pointer constant
+  // FIXME: check the integer is a constant 0
+  if (lhs_type == FundamentalType::Pointer && is_integer_type(rhs_type)) {
+    comparison_node->rhs = convert_to(comparison_node->rhs, non_atomic_type(comparison_node->lhs->expression_type));
+    return;
+  }
+
+  if (is_integer_type(lhs_type) && rhs_type == FundamentalType::Pointer) {
+    comparison_node->lhs = convert_to(comparison_node->lhs, non_atomic_type(comparison_node->rhs->expression_type));
+    return;
+  }
+
+  semantic_error("Invalid operands to comparison\n");
+}
+
+// 6.5.15 both branches get the same type, the conditional is any scalar
+static void analyze_conditional_expression(ASTNode* conditional_node)
+{
+  if (!is_scalar_type(fundamental_type_of(conditional_node->conditional)))
+    semantic_error("Conditional expression condition must have scalar type\n");
+
+  conditional_node->lhs = decay_function_designator(conditional_node->lhs);
+  conditional_node->rhs = decay_function_designator(conditional_node->rhs);
+
+  FundamentalType lhs_type = fundamental_type_of(conditional_node->lhs);
+  FundamentalType rhs_type = fundamental_type_of(conditional_node->rhs);
+
+  if (is_arithmetic_type(lhs_type) && is_arithmetic_type(rhs_type)) {
+    conditional_node->expression_type = apply_usual_arithmetic_conversions(conditional_node);
+    return;
+  }
+
+  if (lhs_type == rhs_type && (lhs_type == FundamentalType::Void || lhs_type == FundamentalType::Pointer)) {
+    conditional_node->expression_type = non_atomic_type(conditional_node->lhs->expression_type);
+    return;
+  }
+
+  semantic_error("Incompatible operand types in conditional expression\n");
+}
+
+// 6.5.16.2 E1 op= E2 converts like E1 op E2 would, then like the assignment
+// of the result to E1. The rhs is converted to the type the operation is done
+// in, even for shifts, whose rhs is only an amount
+static void analyze_compound_assignment(ASTNode* assignment_node)
+{
+  if (!is_lvalue(assignment_node->lhs))
+    semantic_error("Assigning to something that is not an lvalue\n");
+
+  Type const* lhs_type = non_atomic_type(assignment_node->lhs->expression_type);
+  FundamentalType rhs_type = fundamental_type_of(assignment_node->rhs);
+  ASTNodeType operator_type = compound_assignment_operator(assignment_node->type);
+  assignment_node->expression_type = lhs_type;
+
+  if (lhs_type->fundamental_type == FundamentalType::Vector) {
+    if (!is_element_wise_operator(operator_type))
+      semantic_error("Invalid compound assignment to a vector\n");
+    assignment_node->rhs = convert_to_vector_operand(assignment_node->rhs, lhs_type);
+    return;
+  }
+
+  bool is_additive = operator_type == ASTNodeType::Addition || operator_type == ASTNodeType::Subtraction;
+  if (is_additive && lhs_type->fundamental_type == FundamentalType::Pointer) {
+    if (!is_integer_type(rhs_type))
+      semantic_error("Invalid operands to additive operator\n");
+    assignment_node->rhs = convert_to(assignment_node->rhs, ptrdiff_type());
+    return;
+  }
+
+  bool needs_integers = !is_additive && operator_type != ASTNodeType::Multiplication && operator_type != ASTNodeType::Division;
+  bool is_valid = needs_integers ? is_integer_type(lhs_type->fundamental_type) && is_integer_type(rhs_type)
+                                 : is_arithmetic_type(lhs_type->fundamental_type) && is_arithmetic_type(rhs_type);
+  if (!is_valid)
+    semantic_error("Invalid operands to compound assignment\n");
+
+  bool is_shift = operator_type == ASTNodeType::BitShiftLeft || operator_type == ASTNodeType::BitShiftRight;
+  Type const* operation_type
+      = is_shift ? promoted_type(lhs_type) : usual_arithmetic_conversion_type(lhs_type, assignment_node->rhs->expression_type);
+  assignment_node->rhs = convert_to(assignment_node->rhs, operation_type);
+}
+
+// 7.17.3 a memory order is an int. Orders the operation can't have are only
+// caught when they are constants, others are made sequentially consistent
+static ASTNode* analyze_memory_order(ASTNode* order, bool is_load, bool is_store)
+{
+  if (!is_integer_type(fundamental_type_of(order)))
+    semantic_error("Memory order is not an integer\n");
+
+  if (order->type == ASTNodeType::NumericConstant) {
+    long long value = numeric_constant_value(order);
+    if (value < (long long)MemoryOrder::Relaxed || value > (long long)MemoryOrder::SequentiallyConsistent)
+      semantic_error("Invalid memory order\n");
+
+    MemoryOrder memory_order = (MemoryOrder)value;
+    bool is_release = memory_order == MemoryOrder::Release || memory_order == MemoryOrder::AcquireRelease;
+    bool is_acquire = memory_order == MemoryOrder::Consume || memory_order == MemoryOrder::Acquire || memory_order == MemoryOrder::AcquireRelease;
+    if ((is_load && is_release) || (is_store && is_acquire))
+      semantic_error("Invalid memory order for the atomic operation\n");
+  }
+
+  return convert_to(order, IntType);
+}
+
+// 7.17.7 the first argument points to the atomic object, the others are
+// values of its non-atomic type, except for the pointer to the expected value
+// of a compare exchange, and the amount a pointer is moved by
+static void analyze_atomic_operation(ASTNode* atomic_node)
+{
+  ASTNode* object = atomic_node->rhs;
+  if (fundamental_type_of(object) != FundamentalType::Pointer || !is_atomic_type(object->expression_type->pointed_type))
+    semantic_error("The first argument of an atomic operation must point to an _Atomic object\n");
+
+  Type const* value_type = non_atomic_type(object->expression_type->pointed_type);
+  FundamentalType value_fundamental_type = value_type->fundamental_type;
+  ASTNode** argument = &object->next;
+
+  switch (atomic_node->type) {
+  case ASTNodeType::AtomicLoad:
+    atomic_node->expression_type = value_type;
+    *argument = analyze_memory_order(*argument, true, false);
+    return;
+
+  case ASTNodeType::AtomicStore:
+    atomic_node->expression_type = VoidType;
+    *argument = convert_as_if_by_assignment(*argument, value_type);
+    argument = &(*argument)->next;
+    *argument = analyze_memory_order(*argument, false, true);
+    return;
+
+  case ASTNodeType::AtomicExchange:
+    atomic_node->expression_type = value_type;
+    *argument = convert_as_if_by_assignment(*argument, value_type);
+    argument = &(*argument)->next;
+    *argument = analyze_memory_order(*argument, false, false);
+    return;
+
+  case ASTNodeType::AtomicCompareExchangeStrong:
+  case ASTNodeType::AtomicCompareExchangeWeak: {
+    Type const* expected_type = (*argument)->expression_type;
+    if (expected_type->fundamental_type != FundamentalType::Pointer || non_atomic_type(expected_type->pointed_type) != value_type
+        || is_atomic_type(expected_type->pointed_type))
+      semantic_error("The expected value of a compare exchange must be a pointer to the non-atomic type\n");
+
+    atomic_node->expression_type = BoolType;
+    argument = &(*argument)->next;
+    *argument = convert_as_if_by_assignment(*argument, value_type);
+    argument = &(*argument)->next;
+    *argument = analyze_memory_order(*argument, false, false);
+    argument = &(*argument)->next;
+    *argument = analyze_memory_order(*argument, true, false);
+    return;
+  }
+
+  default: {
+    bool is_additive = atomic_node->type == ASTNodeType::AtomicFetchAdd || atomic_node->type == ASTNodeType::AtomicFetchSub;
+    bool is_integer = is_integer_type(value_fundamental_type) && value_fundamental_type != FundamentalType::Bool;
+    if (!is_integer && !(is_additive && value_fundamental_type == FundamentalType::Pointer))
+      semantic_error("Atomic fetch operations need an integer object, or a pointer for add and subtract\n");
+
+    if (!is_integer_type(fundamental_type_of(*argument)))
+      semantic_error("The operand of an atomic fetch operation must be an integer\n");
+
+    atomic_node->expression_type = value_type;
+    *argument = convert_to(*argument, is_integer ? value_type : ptrdiff_type());
+    argument = &(*argument)->next;
+    *argument = analyze_memory_order(*argument, false, false);
+    return;
+  }
+  }
+}
+
+static void require_scalar_condition(ASTNode const* conditional)
+{
+  if (conditional && !is_scalar_type(fundamental_type_of(conditional)))
+    semantic_error("Controlling expression must have scalar type\n");
+}
+
+// visited in post order, so every operand has its type by the time the
+// operator using it is analyzed
+static void analyze_node(ASTNode* ast_node, void* context_pointer)
+{
+  FunctionAnalysisContext const* context = (FunctionAnalysisContext const*)context_pointer;
+
+  if (is_element_wise_operator(ast_node->type) && has_vector_operand(ast_node)) {
+    analyze_vector_operator(ast_node);
+    return;
+  }
+
+  switch (ast_node->type) {
+  case ASTNodeType::Void:
+    return;
+
+  case ASTNodeType::NumericConstant:
+    ast_node->expression_type = get_fundamental_type_pointer(ast_node->data_type);
+    return;
+
+  case ASTNodeType::VariableReference:
+    ast_node->expression_type = ast_node->object->type;
+    return;
+
+  case ASTNodeType::FunctionCall:
+    analyze_function_call(ast_node);
+    return;
+
+  case ASTNodeType::MemberAccess:
+  case ASTNodeType::PointerMemberAccess:
+    analyze_member_access(ast_node);
+    return;
+
+  case ASTNodeType::Subscript:
+    analyze_subscript(ast_node);
+    return;
+
+  case ASTNodeType::ShuffleVector:
+    analyze_shufflevector(ast_node);
+    return;
+
+  case ASTNodeType::ConvertVector:
+    analyze_convertvector(ast_node);
+    return;
+
+    // 6.5.3.3 unary arithmetic operators promote their operand
+  case ASTNodeType::Negation:
+  case ASTNodeType::BitwiseNot: {
+    FundamentalType operand_type = fundamental_type_of(ast_node->lhs);
+    bool is_valid = ast_node->type == ASTNodeType::Negation ? is_arithmetic_type(operand_type) : is_integer_type(operand_type);
+    if (!is_valid)
+      semantic_error("Invalid operand to unary operator\n");
+
+    ast_node->expression_type = promoted_type(ast_node->lhs->expression_type);
+    ast_node->lhs = convert_to(ast_node->lhs, ast_node->expression_type);
+    return;
+  }
+
+  case ASTNodeType::LogicalNot:
+    ast_node->lhs = decay_function_designator(ast_node->lhs);
+    if (!is_scalar_type(fundamental_type_of(ast_node->lhs)))
+      semantic_error("Invalid operand to !\n");
+    ast_node->expression_type = IntType;
+    return;
+
+  case ASTNodeType::AddressOf:
+    if (!is_lvalue(ast_node->lhs) && fundamental_type_of(ast_node->lhs) != FundamentalType::Function)
+      semantic_error("Taking the address of something that is not an lvalue\n");
+    // locals belong to the function being analyzed, no other thread sees them
+    if (ast_node->lhs->type == ASTNodeType::VariableReference && ast_node->lhs->object->local_slot >= 0)
+      ast_node->lhs->object->is_address_taken = true;
+    ast_node->expression_type = intern_pointer_type(ast_node->lhs->expression_type);
+    return;
+
+  case ASTNodeType::Dereference:
+    ast_node->lhs = decay_function_designator(ast_node->lhs);
+    if (fundamental_type_of(ast_node->lhs) != FundamentalType::Pointer)
+      semantic_error("Dereferencing something that is not a pointer\n");
+    ast_node->expression_type = ast_node->lhs->expression_type->pointed_type;
+    return;
+
+  case ASTNodeType::Multiplication:
+  case ASTNodeType::Division:
+    if (!is_arithmetic_type(fundamental_type_of(ast_node->lhs)) || !is_arithmetic_type(fundamental_type_of(ast_node->rhs)))
+      semantic_error("Invalid operands to multiplicative operator\n");
+    ast_node->expression_type = apply_usual_arithmetic_conversions(ast_node);
+    return;
+
+  case ASTNodeType::Modulo:
+  case ASTNodeType::BitwiseAnd:
+  case ASTNodeType::BitwiseXor:
+  case ASTNodeType::BitwiseOr:
+    if (!is_integer_type(fundamental_type_of(ast_node->lhs)) || !is_integer_type(fundamental_type_of(ast_node->rhs)))
+      semantic_error("Invalid operands to integer operator\n");
+    ast_node->expression_type = apply_usual_arithmetic_conversions(ast_node);
+    return;
+
+  case ASTNodeType::Addition:
+  case ASTNodeType::Subtraction:
+    analyze_additive_expression(ast_node);
+    return;
+
+    // 6.5.7 each operand of a shift is promoted on its own
+  case ASTNodeType::BitShiftLeft:
+  case ASTNodeType::BitShiftRight:
+    if (!is_integer_type(fundamental_type_of(ast_node->lhs)) || !is_integer_type(fundamental_type_of(ast_node->rhs)))
+      semantic_error("Invalid operands to shift operator\n");
+    ast_node->expression_type = promoted_type(ast_node->lhs->expression_type);
+    ast_node->lhs = convert_to(ast_node->lhs, ast_node->expression_type);
+    ast_node->rhs = convert_to(ast_node->rhs, promoted_type(ast_node->rhs->expression_type));
+    return;
+
+  case ASTNodeType::GreaterThan:
+  case ASTNodeType::GreaterThanOrEqualTo:
+  case ASTNodeType::LessThan:
+  case ASTNodeType::LessThanOrEqualTo:
+  case ASTNodeType::EqualityComparison:
+  case ASTNodeType::InequalityComparison:
+    analyze_comparison(ast_node);
+    return;
+
+  case ASTNodeType::LogicalAnd:
+  case ASTNodeType::LogicalOr:
+    ast_node->lhs = decay_function_designator(ast_node->lhs);
+    ast_node->rhs = decay_function_designator(ast_node->rhs);
+    if (!is_scalar_type(fundamental_type_of(ast_node->lhs)) || !is_scalar_type(fundamental_type_of(ast_node->rhs)))
+      semantic_error("Invalid operands to logical operator\n");
+    ast_node->expression_type = IntType;
+    return;
+
+  case ASTNodeType::ConditionalExpression:
+    analyze_conditional_expression(ast_node);
+    return;
+
+  case ASTNodeType::Assignment:
+    if (!is_lvalue(ast_node->lhs))
+      semantic_error("Assigning to something that is not an lvalue\n");
+    ast_node->expression_type = non_atomic_type(ast_node->lhs->expression_type);
+    ast_node->rhs = convert_as_if_by_assignment(ast_node->rhs, ast_node->expression_type);
+    return;
+
+  case ASTNodeType::MultiplicationAssignment:
+  case ASTNodeType::DivisionAssignment:
+  case ASTNodeType::ModuloAssignment:
+  case ASTNodeType::AdditionAssignment:
+  case ASTNodeType::SubtractionAssignment:
+  case ASTNodeType::BitShiftLeftAssignment:
+  case ASTNodeType::BitShiftRightAssignment:
+  case ASTNodeType::BitwiseAndAssignment:
+  case ASTNodeType::BitwiseXorAssignment:
+  case ASTNodeType::BitwiseOrAssignment:
+    analyze_compound_assignment(ast_node);
+    return;
+
+  case ASTNodeType::AtomicLoad:
+  case ASTNodeType::AtomicStore:
+  case ASTNodeType::AtomicExchange:
+  case ASTNodeType::AtomicCompareExchangeStrong:
+  case ASTNodeType::AtomicCompareExchangeWeak:
+  case ASTNodeType::AtomicFetchAdd:
+  case ASTNodeType::AtomicFetchSub:
+  case ASTNodeType::AtomicFetchAnd:
+  case ASTNodeType::AtomicFetchOr:
+  case ASTNodeType::AtomicFetchXor:
+    analyze_atomic_operation(ast_node);
+    return;
+
+  case ASTNodeType::AtomicThreadFence:
+    ast_node->rhs = analyze_memory_order(ast_node->rhs, false, false);
+    ast_node->expression_type = VoidType;
+    return;
+
+    // conversions are inserted above nodes that were already analyzed
+  case ASTNodeType::ImplicitConversion:
+    return;
+
+  case ASTNodeType::If:
+  case ASTNodeType::For:
+  case ASTNodeType::While:
+  case ASTNodeType::DoWhile:
+    require_scalar_condition(ast_node->conditional);
+    return;
+
+  case ASTNodeType::Switch:
+    if (!is_integer_type(fundamental_type_of(ast_node->conditional)))
+      semantic_error("Switch condition must have integer type\n");
+    ast_node->conditional = convert_to(ast_node->conditional, promoted_type(ast_node->conditional->expression_type));
+    return;
+
+  case ASTNodeType::Return: {
+    assert(context->function_object && "Return statement outside of a function");
+    Type const* return_type = context->function_object->type->function_data->return_type;
+
+    if (!ast_node->rhs)
+      return;
+
+    if (return_type->fundamental_type == FundamentalType::Void)
+      semantic_error("Returning a value from a function returning void\n");
+
+    // a call whose value is returned as it is can be the caller's last act.
+    // musttail asks for it to be, which only works when the callee's
+    // arguments and return value are passed the way the caller's were
+    ASTNode* returned_call = ast_node->rhs->type == ASTNodeType::FunctionCall ? ast_node->rhs : nullptr;
+    if (returned_call && returned_call->tail_call_kind == TailCallKind::MustTail) {
+      Type const* callee_type = returned_call->lhs->expression_type;
+      if (callee_type->fundamental_type == FundamentalType::Pointer)
+        callee_type = callee_type->pointed_type;
+      if (callee_type != context->function_object->type)
+        semantic_error("A musttail call needs the callee to have the caller's prototype\n");
+    }
+
+    ast_node->rhs = convert_as_if_by_assignment(ast_node->rhs, return_type);
+    if (returned_call && ast_node->rhs == returned_call && returned_call->tail_call_kind == TailCallKind::None)
+      returned_call->tail_call_kind = TailCallKind::Tail;
+    return;
+  }
+
+  case ASTNodeType::Declaration: {
+    int flags = ast_node->object->declaration_specifiers.flags;
+
+    if (ast_node->rhs && ast_node->object->type->fundamental_type == FundamentalType::Function)
+      semantic_error("Function declarations cannot have initializers\n");
+
+    // 6.7.1: _Thread_local is for objects only, and at block scope it needs
+    // static or extern as well
+    if (flags & TypeModifierFlag::ThreadLocal) {
+      if (ast_node->object->type->fundamental_type == FundamentalType::Function)
+        semantic_error("_Thread_local cannot be applied to functions\n");
+      if (context->function_object && !(flags & (TypeModifierFlag::Static | TypeModifierFlag::Extern)))
+        semantic_error("_Thread_local at block scope needs static or extern\n");
+    }
+
+    // 6.7.5.2 and 6.7.5.4: _Alignas is for objects that have an address, and
+    // can't weaken the alignment of their type
+    if (ast_node->object->declaration_specifiers.alignment || ast_node->object->alignment) {
+      if (flags & (TypeModifierFlag::TypeDef | TypeModifierFlag::Register))
+        semantic_error("Alignment can't be specified for typedefs and register objects\n");
+      if (ast_node->object->type->fundamental_type == FundamentalType::Function)
+        semantic_error("Alignment can't be specified for functions\n");
+      if (!is_incomplete_type(ast_node->object->type) && ast_node->object->declaration_specifiers.alignment
+          && ast_node->object->declaration_specifiers.alignment < alignment_of_type(ast_node->object->type))
+        semantic_error("_Alignas can't weaken the alignment of an object's type\n");
+    }
+
+    if (ast_node->rhs)
+      ast_node->rhs = convert_as_if_by_assignment(ast_node->rhs, ast_node->object->type);
+    return;
+  }
+  }
+}
+
+static void analyze_function_definition(void* function_object_pointer)
+{
+  Object const* function_object = (Object const*)function_object_pointer;
+  FunctionAnalysisContext context = { function_object };
+
+  for (ASTNode* statement = function_object->function_body; statement; statement = statement->next)
+    walk_ast_post_order(statement, analyze_node, &context);
+}
+
+void analyze_translation_unit(ExternalDeclaration* external_declarations, unsigned thread_count)
+{
+  std::vector<Object*> function_definitions;
+  FunctionAnalysisContext file_scope_context = { nullptr };
+
+  // file scope initializers are few and cheap, analyze them up front
+  for (ExternalDeclaration* declaration = external_declarations; declaration; declaration = declaration->next) {
+    if (declaration->type == ExternalDeclarationType::FunctionDefinition) {
+      function_definitions.push_back(declaration->root_ast_node->object);
+      continue;
+    }
+
+    for (ASTNode* declaration_node = declaration->root_ast_node; declaration_node; declaration_node = declaration_node->next) {
+      if (declaration_node->rhs)
+        walk_ast_post_order(declaration_node->rhs, analyze_node, &file_scope_context);
+      analyze_node(declaration_node, &file_scope_context);
+    }
+  }
+
+  thread_count = std::min<size_t>(thread_count, function_definitions.size());
+  if (thread_count <= 1) {
+    for (Object* function_object : function_definitions)
+      analyze_function_definition(function_object);
+  } else {
+    ThreadPool* thread_pool = new_thread_pool(thread_count);
+    for (Object* function_object : function_definitions)
+      thread_pool_submit(thread_pool, analyze_function_definition, function_object);
+
+    thread_pool_wait(thread_pool);
+    free_thread_pool(thread_pool);
+  }
+
+  // needs the whole call graph, so it runs once every body has been analyzed
+  infer_function_attributes(external_declarations);
+}
@@ -0,0 +1,60 @@
+#include "target.h"
+
+#include <string.h>
+
+// datalayouts as LLVM's own backends spell them, a module whose datalayout
+// differs from the backend's is miscompiled or rejected
+static TargetDescription const targets[] = {
+  { "x86_64-unknown-linux-gnu", "x86_64", "e-m:e-p270:32:32-p271:32:32-p272:64:64-i64:64-f80:128-n8:16:32:64-S128", 64, 64, 8, 8, "x86_fp80", 80, 16,
+      16, true },
+  { "aarch64-unknown-linux-gnu", "aarch64", "e-m:e-i8:8:32-i16:16:32-i64:64-i128:128-n32:64-S128", 64, 64, 8, 8, "fp128", 128, 16, 16, false },
+  { "riscv64-unknown-linux-gnu", "riscv64", "e-m:e-p:64:64-i64:64-i128:128-n64-S128", 64, 64, 8, 8, "fp128", 128, 16, 16, false },
+  { "i686-unknown-linux-gnu", "i686", "e-m:e-p:32:32-p270:32:32-p271:32:32-p272:64:64-f64:32:64-f80:32-n8:16:32-S128", 32, 32, 4, 4, "x86_fp80", 80, 12, 4,
+      true },
+  // LLP64, and long double is just double
+  { "x86_64-pc-windows-msvc", "x86_64-windows", "e-m:w-p270:32:32-p271:32:32-p272:64:64-i64:64-f80:128-n8:16:32:64-S128", 64, 32, 8, 8, "double", 64, 8, 8,
+      true },
+  // Apple's arm64 ABI keeps char signed and long double as double
+  { "arm64-apple-macosx", "arm64", "e-m:o-i64:64-i128:128-n32:64-S128", 64, 64, 8, 8, "double", 64, 8, 8, true },
+};
+
+static constexpr size_t target_count = sizeof(targets) / sizeof(targets[0]);
+
+// the machine the compiler runs on
+#if defined(__x86_64__) && defined(_WIN32)
+static constexpr size_t host_target_index = 4;
+#elif defined(__aarch64__) && defined(__APPLE__)
+static constexpr size_t host_target_index = 5;
+#elif defined(__aarch64__)
+static constexpr size_t host_target_index = 1;
+#elif defined(__riscv) && __riscv_xlen == 64
+static constexpr size_t host_target_index = 2;
+#elif defined(__i386__)
+static constexpr size_t host_target_index = 3;
+#else
+static constexpr size_t host_target_index = 0;
+#endif
+
+constinit TargetDescription const* current_target = &targets[host_target_index];
+
+TargetDescription const* host_target() { return &targets[host_target_index]; }
+
+bool set_target(char const* name)
+{
+  for (size_t i = 0; i < target_count; i++) {
+    if (strcmp(name, targets[i].triple) == 0 || strcmp(name, targets[i].architecture) == 0) {
+      current_target = &targets[i];
+      return true;
+    }
+  }
+
+  return false;
+}
+
+Type const* ptrdiff_type()
+{
+  // the ILP32 ABIs pick int, LLP64 has no long wide enough
+  if (current_target->pointer_width == 32)
+    return IntType;
+  return current_target->long_width == 64 ? LongType : LongLongType;
+}
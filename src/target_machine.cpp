@@ -0,0 +1,138 @@
+#include "target_machine.h"
+#include "target.h"
+
+#include <llvm-c/Target.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/MC/MCSubtargetInfo.h>
+#include <llvm/MC/SubtargetFeature.h>
+#include <llvm/MC/TargetRegistry.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Target/TargetOptions.h>
+
+#include <stdio.h>
+
+// only the backends of the targets in target.cpp are linked in
+void initialize_backends()
+{
+  static bool initialized = false;
+  if (initialized)
+    return;
+
+  LLVMInitializeX86TargetInfo();
+  LLVMInitializeX86Target();
+  LLVMInitializeX86TargetMC();
+  LLVMInitializeX86AsmPrinter();
+
+  LLVMInitializeAArch64TargetInfo();
+  LLVMInitializeAArch64Target();
+  LLVMInitializeAArch64TargetMC();
+  LLVMInitializeAArch64AsmPrinter();
+
+  LLVMInitializeRISCVTargetInfo();
+  LLVMInitializeRISCVTarget();
+  LLVMInitializeRISCVTargetMC();
+  LLVMInitializeRISCVAsmPrinter();
+
+  initialized = true;
+}
+
+// -mcpu=native also turns on everything the host has, as clang's does
+static std::string host_features()
+{
+  llvm::StringMap<bool> host_features;
+  llvm::SubtargetFeatures features;
+  if (llvm::sys::getHostCPUFeatures(host_features))
+    for (auto const& feature : host_features)
+      features.AddFeature(feature.first(), feature.second);
+  return features.getString();
+}
+
+static llvm::CodeGenOpt::Level codegen_level(OptimizationLevel level)
+{
+  switch (level) {
+  case OptimizationLevel::O0:
+    return llvm::CodeGenOpt::None;
+  case OptimizationLevel::O1:
+    return llvm::CodeGenOpt::Less;
+  case OptimizationLevel::O2:
+  case OptimizationLevel::Os:
+    return llvm::CodeGenOpt::Default;
+  case OptimizationLevel::O3:
+    return llvm::CodeGenOpt::Aggressive;
+  }
+  return llvm::CodeGenOpt::Default;
+}
+
+std::unique_ptr<llvm::TargetMachine> create_target_machine(MachineOptions const& machine_options, CodegenOptions const& codegen_options,
+    OptimizationLevel level)
+{
+  initialize_backends();
+
+  std::string error;
+  llvm::Target const* target = llvm::TargetRegistry::lookupTarget(current_target->triple, error);
+  if (!target) {
+    fprintf(stderr, "No backend for %s: %s, aborting.\n", current_target->triple, error.c_str());
+    exit(1);
+  }
+
+  std::string cpu = machine_options.cpu;
+  std::string features = machine_options.features;
+  if (cpu == "native") {
+    cpu = llvm::sys::getHostCPUName().str();
+    std::string native_features = host_features();
+    features = features.empty() ? native_features : native_features + "," + features;
+  }
+
+  llvm::Optional<llvm::Reloc::Model> relocation_model = codegen_options.pic_level ? llvm::Reloc::PIC_ : llvm::Reloc::Static;
+  llvm::TargetMachine* machine
+      = target->createTargetMachine(current_target->triple, cpu, features, llvm::TargetOptions(), relocation_model, llvm::None, codegen_level(level));
+  if (!machine) {
+    fprintf(stderr, "Could not create a target machine for %s, aborting.\n", current_target->triple);
+    exit(1);
+  }
+
+  // LLVM only warns, then compiles for a CPU that may not even be 64 bit
+  if (!cpu.empty() && !machine->getMCSubtargetInfo()->isCPUStringValid(cpu)) {
+    fprintf(stderr, "Unknown CPU %s for %s, aborting.\n", cpu.c_str(), current_target->triple);
+    exit(1);
+  }
+
+  // the module's datalayout comes from target.cpp, and the backend only
+  // compiles modules laid out its own way
+  if (machine->createDataLayout().getStringRepresentation() != current_target->datalayout) {
+    fprintf(stderr, "The datalayout for %s disagrees with LLVM's %s, aborting.\n", current_target->triple,
+        machine->createDataLayout().getStringRepresentation().c_str());
+    exit(1);
+  }
+
+  return std::unique_ptr<llvm::TargetMachine>(machine);
+}
+
+// the MC layer still runs under the legacy pass manager
+static void compile_module(llvm::Module& module, llvm::TargetMachine& machine, llvm::raw_pwrite_stream& stream, llvm::CodeGenFileType file_type)
+{
+  llvm::legacy::PassManager passes;
+  if (machine.addPassesToEmitFile(passes, stream, nullptr, file_type)) {
+    fprintf(stderr, "%s can't emit %s files, aborting.\n", current_target->triple, file_type == llvm::CGFT_ObjectFile ? "object" : "assembly");
+    exit(1);
+  }
+
+  passes.run(module);
+}
+
+void emit_object_file(llvm::Module& module, llvm::TargetMachine& machine, FILE* outfile)
+{
+  fflush(outfile);
+  llvm::raw_fd_ostream stream(fileno(outfile), false);
+  compile_module(module, machine, stream, llvm::CGFT_ObjectFile);
+}
+
+llvm::SmallVector<char, 0> compile_module_to_memory(llvm::Module& module, llvm::TargetMachine& machine, llvm::CodeGenFileType file_type)
+{
+  llvm::SmallVector<char, 0> compiled;
+  llvm::raw_svector_ostream stream(compiled);
+  compile_module(module, machine, stream, file_type);
+  return compiled;
+}
@@ -0,0 +1,225 @@
+#include "tbaa.h"
+#include "ast_walk.h"
+#include "layout.h"
+
+#include <map>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+
+char const* const tbaa_scalar_type_names[tbaa_scalar_type_count]
+    = { "omnipotent char", "short", "int", "long", "long long", "float", "double", "long double", "_Bool", "any pointer" };
+
+TBAAAccess tbaa_member_access(TBAAAccess struct_access, Type const* struct_type, unsigned member_index)
+{
+  bool is_in_union = struct_access.base_type && struct_access.base_type->fundamental_type != FundamentalType::Struct;
+  if (struct_type->fundamental_type == FundamentalType::Union || is_in_union)
+    return { CharType, 0 };
+
+  unsigned long long offset = struct_layout(struct_type)->member_offsets[member_index];
+  if (struct_access.base_type)
+    return { struct_access.base_type, struct_access.offset + offset };
+  return { struct_type, offset };
+}
+
+bool has_tbaa_type(Type const* type)
+{
+  switch (type->fundamental_type) {
+  case FundamentalType::Void:
+  case FundamentalType::Struct:
+  case FundamentalType::Union:
+  case FundamentalType::Array:
+  case FundamentalType::Function:
+    return false;
+  default:
+    return true;
+  }
+}
+
+unsigned tbaa_scalar_type(Type const* type)
+{
+  switch (type->fundamental_type) {
+  case FundamentalType::Short:
+  case FundamentalType::UnsignedShort:
+    return 1;
+  case FundamentalType::Int:
+  case FundamentalType::UnsignedInt:
+  case FundamentalType::Enum:
+  case FundamentalType::EnumeratedValue:
+    return 2;
+  case FundamentalType::Long:
+  case FundamentalType::UnsignedLong:
+    return 3;
+  case FundamentalType::LongLong:
+  case FundamentalType::UnsignedLongLong:
+    return 4;
+  case FundamentalType::Float:
+    return 5;
+  case FundamentalType::Double:
+    return 6;
+  case FundamentalType::LongDouble:
+    return 7;
+  case FundamentalType::Bool:
+    return 8;
+  case FundamentalType::Pointer:
+    return 9;
+  default:
+    // the character types, and vectors and complex numbers, which clang
+    // doesn't give a type of their own either
+    return 0;
+  }
+}
+
+// the type a member's field is, an array being its first element's
+static Type const* field_type(Type const* member_type)
+{
+  while (member_type->fundamental_type == FundamentalType::Array)
+    member_type = member_type->pointed_type;
+  return member_type->fundamental_type == FundamentalType::Union ? CharType : non_atomic_type(member_type);
+}
+
+std::vector<TBAAField> tbaa_struct_fields(Type const* struct_type)
+{
+  StructLayout const* layout = struct_layout(struct_type);
+  std::vector<TBAAField> fields;
+  for (unsigned member_index : layout->member_order) {
+    // a flexible array member has no element that is part of the struct, its
+    // elements are only accessed by subscript
+    Type const* member_type = struct_type->struct_data->members[member_index].member_type;
+    if (member_type->fundamental_type == FundamentalType::Array && member_type->array_length <= 0)
+      continue;
+    fields.push_back({ field_type(member_type), layout->member_offsets[member_index] });
+  }
+  return fields;
+}
+
+// the root, then the scalar type nodes, then their access tags, then the
+// struct type nodes and struct-path tags as they are found
+constexpr unsigned tbaa_root_number = 1;
+constexpr unsigned scalar_type_number(unsigned scalar_type) { return tbaa_root_number + 1 + scalar_type; }
+constexpr unsigned scalar_tag_number(unsigned scalar_type) { return tbaa_root_number + 1 + tbaa_scalar_type_count + scalar_type; }
+constexpr unsigned first_struct_number = tbaa_root_number + 1 + 2 * tbaa_scalar_type_count;
+
+struct TBAAMetadata {
+  // struct type nodes and tags as printed, numbered from first_struct_number
+  std::vector<std::string> nodes;
+  std::unordered_map<Type const*, unsigned> struct_type_numbers;
+  // by base type, access type node and offset
+  std::map<std::tuple<Type const*, unsigned, unsigned long long>, unsigned> struct_tags;
+};
+
+static unsigned add_node(TBAAMetadata* metadata, std::string node)
+{
+  metadata->nodes.push_back(std::move(node));
+  return first_struct_number + (unsigned)metadata->nodes.size() - 1;
+}
+
+// the nodes of the struct's members go first, a struct can only contain
+// complete types, so this ends
+static unsigned type_node_number(TBAAMetadata* metadata, Type const* type)
+{
+  if (type->fundamental_type != FundamentalType::Struct)
+    return scalar_type_number(tbaa_scalar_type(type));
+
+  auto found = metadata->struct_type_numbers.find(type);
+  if (found != metadata->struct_type_numbers.end())
+    return found->second;
+
+  std::string node = "!{!\"" + type->struct_data->tag + "\"";
+  for (TBAAField const& field : tbaa_struct_fields(type))
+    node += ", !" + std::to_string(type_node_number(metadata, field.type)) + ", i64 " + std::to_string(field.offset);
+  node += "}";
+
+  unsigned number = add_node(metadata, std::move(node));
+  metadata->struct_type_numbers.emplace(type, number);
+  return number;
+}
+
+struct TBAACollection {
+  TBAAMetadata* metadata;
+  // the accesses of the member accesses seen so far, for the ones on them
+  std::unordered_map<ASTNode const*, TBAAAccess> member_accesses;
+};
+
+static void collect_member_access(ASTNode const* ast_node, void* collection_pointer)
+{
+  TBAACollection* collection = (TBAACollection*)collection_pointer;
+  if (ast_node->type != ASTNodeType::MemberAccess && ast_node->type != ASTNodeType::PointerMemberAccess)
+    return;
+
+  // as codegen finds it, from the lvalue the member is accessed through
+  TBAAAccess access;
+  if (ast_node->type == ASTNodeType::PointerMemberAccess) {
+    access = tbaa_member_access({}, ast_node->lhs->expression_type->pointed_type, ast_node->member_index);
+  } else {
+    auto struct_access = collection->member_accesses.find(ast_node->lhs);
+    TBAAAccess through = struct_access != collection->member_accesses.end() ? struct_access->second : TBAAAccess {};
+    access = tbaa_member_access(through, ast_node->lhs->expression_type, ast_node->member_index);
+  }
+  collection->member_accesses.emplace(ast_node, access);
+
+  Type const* access_type = ast_node->expression_type;
+  if (!access.base_type || access.base_type->fundamental_type != FundamentalType::Struct || !has_tbaa_type(access_type) || is_atomic_type(access_type))
+    return;
+
+  TBAAMetadata* metadata = collection->metadata;
+  unsigned access_node = tbaa_scalar_type(access_type);
+  auto key = std::make_tuple(access.base_type, access_node, access.offset);
+  if (metadata->struct_tags.count(key))
+    return;
+
+  unsigned base_node = type_node_number(metadata, access.base_type);
+  std::string tag = "!{!" + std::to_string(base_node) + ", !" + std::to_string(scalar_type_number(access_node)) + ", i64 " + std::to_string(access.offset) + "}";
+  metadata->struct_tags.emplace(key, add_node(metadata, std::move(tag)));
+}
+
+TBAAMetadata* collect_tbaa_metadata(ExternalDeclaration const* external_declarations)
+{
+  TBAACollection collection = { new TBAAMetadata, {} };
+  bool has_definitions = false;
+  for (ExternalDeclaration const* declaration = external_declarations; declaration; declaration = declaration->next) {
+    if (declaration->type != ExternalDeclarationType::FunctionDefinition)
+      continue;
+    has_definitions = true;
+    for (ASTNode const* statement = declaration->root_ast_node->object->function_body; statement; statement = statement->next)
+      walk_ast_post_order(statement, collect_member_access, &collection);
+  }
+
+  // without code there is nothing to annotate
+  if (!has_definitions) {
+    delete collection.metadata;
+    return nullptr;
+  }
+  return collection.metadata;
+}
+
+void free_tbaa_metadata(TBAAMetadata* metadata) { delete metadata; }
+
+unsigned tbaa_tag(TBAAMetadata const* metadata, TBAAAccess access, Type const* access_type)
+{
+  if (!metadata || !has_tbaa_type(access_type) || is_atomic_type(access_type))
+    return 0;
+
+  unsigned access_node = tbaa_scalar_type(access_type);
+  if (!access.base_type)
+    return scalar_tag_number(access_node);
+  if (access.base_type->fundamental_type != FundamentalType::Struct)
+    return scalar_tag_number(tbaa_scalar_type(access.base_type));
+
+  // a member access collect_tbaa_metadata didn't see still has its type
+  auto found = metadata->struct_tags.find(std::make_tuple(access.base_type, access_node, access.offset));
+  return found != metadata->struct_tags.end() ? found->second : scalar_tag_number(access_node);
+}
+
+void print_tbaa_metadata(TBAAMetadata const* metadata, OutputBuffer* output)
+{
+  print(output, "\n!", tbaa_root_number, " = !{!\"Simple C/C++ TBAA\"}\n");
+  for (unsigned i = 0; i < tbaa_scalar_type_count; i++) {
+    unsigned parent = i ? scalar_type_number(0) : tbaa_root_number;
+    print(output, "!", scalar_type_number(i), " = !{!\"", tbaa_scalar_type_names[i], "\", !", parent, ", i64 0}\n");
+  }
+  for (unsigned i = 0; i < tbaa_scalar_type_count; i++)
+    print(output, "!", scalar_tag_number(i), " = !{!", scalar_type_number(i), ", !", scalar_type_number(i), ", i64 0}\n");
+  for (size_t i = 0; i < metadata->nodes.size(); i++)
+    print(output, "!", first_struct_number + (unsigned)i, " = ", metadata->nodes[i], "\n");
+}
@@ -0,0 +1,77 @@
+#include "thread_pool.h"
+
+#include <cassert>
+
+unsigned default_thread_count()
+{
+  unsigned hardware_threads = std::thread::hardware_concurrency();
+  return hardware_threads ? hardware_threads : 1;
+}
+
+static void worker_loop(ThreadPool* thread_pool)
+{
+  std::unique_lock<std::mutex> lock(thread_pool->mutex);
+
+  for (;;) {
+    thread_pool->job_available.wait(lock, [thread_pool] { return thread_pool->shutting_down || !thread_pool->jobs.empty(); });
+
+    if (thread_pool->jobs.empty())
+      return;
+
+    ThreadPoolJob job = thread_pool->jobs.front();
+    thread_pool->jobs.pop_front();
+    thread_pool->running_jobs++;
+
+    lock.unlock();
+    job.function(job.argument);
+    lock.lock();
+
+    thread_pool->running_jobs--;
+    if (thread_pool->jobs.empty() && thread_pool->running_jobs == 0)
+      thread_pool->all_jobs_done.notify_all();
+  }
+}
+
+ThreadPool* new_thread_pool(unsigned thread_count)
+{
+  assert(thread_count > 0 && "new_thread_pool: a pool needs at least one thread");
+
+  ThreadPool* thread_pool = new ThreadPool;
+  thread_pool->running_jobs = 0;
+  thread_pool->shutting_down = false;
+
+  thread_pool->workers.reserve(thread_count);
+  for (unsigned i = 0; i < thread_count; i++)
+    thread_pool->workers.emplace_back(worker_loop, thread_pool);
+
+  return thread_pool;
+}
+
+void thread_pool_submit(ThreadPool* thread_pool, void (*function)(void*), void* argument)
+{
+  {
+    std::lock_guard<std::mutex> lock(thread_pool->mutex);
+    thread_pool->jobs.push_back({ function, argument });
+  }
+  thread_pool->job_available.notify_one();
+}
+
+void thread_pool_wait(ThreadPool* thread_pool)
+{
+  std::unique_lock<std::mutex> lock(thread_pool->mutex);
+  thread_pool->all_jobs_done.wait(lock, [thread_pool] { return thread_pool->jobs.empty() && thread_pool->running_jobs == 0; });
+}
+
+void free_thread_pool(ThreadPool* thread_pool)
+{
+  {
+    std::lock_guard<std::mutex> lock(thread_pool->mutex);
+    thread_pool->shutting_down = true;
+  }
+  thread_pool->job_available.notify_all();
+
+  for (std::thread& worker : thread_pool->workers)
+    worker.join();
+
+  delete thread_pool;
+}
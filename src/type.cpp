@@ -1,8 +1,12 @@
 #include "type.h"
+#include "target.h"
 
+#include <array>
 #include <cassert>
 #include <cstdio>
 #include <cstdlib>
+#include <mutex>
+#include <unordered_map>
 
 static void set_declaration_flag(TypeModifierFlag flag,
     DeclarationSpecifierFlags* declaration)
@@ -10,18 +14,291 @@ static void set_declaration_flag(TypeModifierFlag flag,
   declaration->flags |= flag;
 }
 
-Type* new_type(FundamentalType fundamental_type, Type* pointed_type)
+static Type* new_type(FundamentalType fundamental_type, Type const* pointed_type = nullptr)
 {
-  Type* new_type = (Type*)malloc(sizeof(Type));
+  // the codegen string cache is atomic, so Types are constructed, not malloc'd
+  Type* new_type = new Type;
 
   new_type->function_data = nullptr;
   new_type->pointed_type = pointed_type;
   new_type->fundamental_type = fundamental_type;
   new_type->declaration_specifier_flags.flags = 0;
+  new_type->array_length = 0;
+  new_type->struct_data = nullptr;
+  new_type->codegen_string.store(nullptr, std::memory_order_relaxed);
 
   return new_type;
 }
 
+// Type interning
+//
+// Derived types are hash consed. Each one is built from parts that are already
+// interned, so it is identified by the addresses of its parts, and hashing or
+// comparing it never has to walk further than one level down. Parameter lists
+// are interned one cell at a time, from the back, so lists share their tails.
+//
+// Semantic analysis builds pointer types from several threads, so the tables
+// are guarded by a mutex.
+
+struct PointerTypeKey {
+  Type const* pointed_type;
+  int qualifiers;
+
+  bool operator==(PointerTypeKey const&) const = default;
+};
+
+struct ParameterListKey {
+  Type const* parameter_type;
+  FunctionParameter const* rest_of_list;
+
+  bool operator==(ParameterListKey const&) const = default;
+};
+
+struct FunctionTypeKey {
+  Type const* return_type;
+  FunctionParameter const* parameter_list;
+  bool is_variadic;
+
+  bool operator==(FunctionTypeKey const&) const = default;
+};
+
+struct ArrayTypeKey {
+  Type const* element_type;
+  long long array_length;
+
+  bool operator==(ArrayTypeKey const&) const = default;
+};
+
+static size_t hash_combine(size_t seed, size_t value) { return seed ^ (value + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2)); }
+
+struct InternedTypeHash {
+  size_t operator()(PointerTypeKey const& key) const { return hash_combine(std::hash<void const*>()(key.pointed_type), key.qualifiers); }
+
+  size_t operator()(ParameterListKey const& key) const
+  {
+    return hash_combine(std::hash<void const*>()(key.parameter_type), std::hash<void const*>()(key.rest_of_list));
+  }
+
+  size_t operator()(FunctionTypeKey const& key) const
+  {
+    size_t hash = hash_combine(std::hash<void const*>()(key.return_type), std::hash<void const*>()(key.parameter_list));
+    return hash_combine(hash, key.is_variadic);
+  }
+
+  size_t operator()(ArrayTypeKey const& key) const { return hash_combine(std::hash<void const*>()(key.element_type), key.array_length); }
+};
+
+static std::mutex interned_types_mutex;
+static std::unordered_map<PointerTypeKey, Type const*, InternedTypeHash> interned_pointer_types;
+static std::unordered_map<ParameterListKey, FunctionParameter const*, InternedTypeHash> interned_parameter_lists;
+static std::unordered_map<FunctionTypeKey, Type const*, InternedTypeHash> interned_function_types;
+static std::unordered_map<ArrayTypeKey, Type const*, InternedTypeHash> interned_array_types;
+static std::unordered_map<ArrayTypeKey, Type const*, InternedTypeHash> interned_vector_types;
+static std::unordered_map<Type const*, Type const*> interned_atomic_types;
+static std::unordered_map<Type const*, Type const*> interned_volatile_types;
+
+Type const* intern_pointer_type(Type const* pointed_type, DeclarationSpecifierFlags qualifiers)
+{
+  std::lock_guard<std::mutex> lock(interned_types_mutex);
+
+  Type const*& interned_type = interned_pointer_types[{ pointed_type, qualifiers.flags }];
+  if (!interned_type) {
+    Type* pointer_type = new_type(FundamentalType::Pointer);
+    pointer_type->pointed_type = pointed_type;
+    pointer_type->declaration_specifier_flags = qualifiers;
+    interned_type = pointer_type;
+  }
+
+  return interned_type;
+}
+
+FunctionParameter const* intern_parameter_list(Type const* parameter_type, FunctionParameter const* rest_of_list)
+{
+  std::lock_guard<std::mutex> lock(interned_types_mutex);
+
+  FunctionParameter const*& interned_list = interned_parameter_lists[{ parameter_type, rest_of_list }];
+  if (!interned_list)
+    interned_list = new FunctionParameter { parameter_type, rest_of_list };
+
+  return interned_list;
+}
+
+Type const* intern_function_type(Type const* return_type, FunctionParameter const* parameter_list, bool is_variadic)
+{
+  std::lock_guard<std::mutex> lock(interned_types_mutex);
+
+  Type const*& interned_type = interned_function_types[{ return_type, parameter_list, is_variadic }];
+  if (!interned_type) {
+    Type* function_type = new_type(FundamentalType::Function);
+    function_type->function_data = new FunctionData { return_type, parameter_list, is_variadic };
+    interned_type = function_type;
+  }
+
+  return interned_type;
+}
+
+Type const* intern_array_type(Type const* element_type, long long array_length)
+{
+  std::lock_guard<std::mutex> lock(interned_types_mutex);
+
+  Type const*& interned_type = interned_array_types[{ element_type, array_length }];
+  if (!interned_type) {
+    Type* array_type = new_type(FundamentalType::Array, element_type);
+    array_type->array_length = array_length;
+    interned_type = array_type;
+  }
+
+  return interned_type;
+}
+
+// vectors are keyed like arrays, in a table of their own
+Type const* intern_vector_type(Type const* element_type, long long element_count)
+{
+  std::lock_guard<std::mutex> lock(interned_types_mutex);
+
+  Type const*& interned_type = interned_vector_types[{ element_type, element_count }];
+  if (!interned_type) {
+    Type* vector_type = new_type(FundamentalType::Vector, element_type);
+    vector_type->array_length = element_count;
+    interned_type = vector_type;
+  }
+
+  return interned_type;
+}
+
+// 6.7.2.4 _Atomic makes a type of its own, with the same representation. An
+// atomic pointer is a pointer with the qualifier, like a const one, the other
+// atomic types are keyed by their non-atomic version
+//
+// atomic operations are lowered to single LLVM instructions, which only exist
+// for integers, pointers, float and double
+Type const* intern_atomic_type(Type const* type)
+{
+  if (type->fundamental_type == FundamentalType::Pointer) {
+    DeclarationSpecifierFlags qualifiers = type->declaration_specifier_flags;
+    qualifiers.flags |= TypeModifierFlag::Atomic;
+    return intern_pointer_type(type->pointed_type, qualifiers);
+  }
+
+  if (type->fundamental_type == FundamentalType::Array || type->fundamental_type == FundamentalType::Function) {
+    fprintf(stderr, "_Atomic cannot be applied to an array or function type\n");
+    exit(1);
+  }
+
+  if (is_atomic_type(type))
+    return type;
+
+  bool is_lock_free = is_integer_type(type->fundamental_type)
+      || (is_floating_type(type->fundamental_type) && fundamental_type_bit_width(type->fundamental_type) <= 64);
+  if (!is_lock_free) {
+    fprintf(stderr, "_Atomic is only implemented for integer, pointer, float and double types\n");
+    exit(1);
+  }
+
+  std::lock_guard<std::mutex> lock(interned_types_mutex);
+
+  Type const*& interned_type = interned_atomic_types[type];
+  if (!interned_type) {
+    Type* atomic_type = new_type(type->fundamental_type);
+    atomic_type->declaration_specifier_flags.flags = TypeModifierFlag::Atomic;
+    interned_type = atomic_type;
+  }
+
+  return interned_type;
+}
+
+bool is_atomic_type(Type const* type) { return type->declaration_specifier_flags.flags & TypeModifierFlag::Atomic; }
+
+// 6.3.2.1 reading an atomic lvalue gives a value of the non-atomic type
+Type const* non_atomic_type(Type const* type)
+{
+  if (!is_atomic_type(type))
+    return type;
+
+  if (type->fundamental_type == FundamentalType::Pointer) {
+    DeclarationSpecifierFlags qualifiers = type->declaration_specifier_flags;
+    qualifiers.flags &= ~TypeModifierFlag::Atomic;
+    return intern_pointer_type(type->pointed_type, qualifiers);
+  }
+
+  return get_fundamental_type_pointer(type->fundamental_type);
+}
+
+// 6.7.3p7 every access to a volatile object is a side effect, so what an lvalue
+// is accessed through, e.g. *p of a volatile int* p, has to say so. A volatile
+// pointer is a pointer with the qualifier, the other scalars are keyed by their
+// unqualified version. Structs, unions and vectors keep their identity, the
+// qualifier stays with the object declared with them
+Type const* intern_volatile_type(Type const* type)
+{
+  if (type->fundamental_type == FundamentalType::Pointer) {
+    DeclarationSpecifierFlags qualifiers = type->declaration_specifier_flags;
+    qualifiers.flags |= TypeModifierFlag::Volatile;
+    return intern_pointer_type(type->pointed_type, qualifiers);
+  }
+
+  switch (type->fundamental_type) {
+  case FundamentalType::Void:
+  case FundamentalType::Struct:
+  case FundamentalType::Union:
+  case FundamentalType::Array:
+  case FundamentalType::Vector:
+  case FundamentalType::Function:
+    return type;
+  default:
+    break;
+  }
+
+  if (is_volatile_type(type))
+    return type;
+
+  std::lock_guard<std::mutex> lock(interned_types_mutex);
+
+  Type const*& interned_type = interned_volatile_types[type];
+  if (!interned_type) {
+    // an _Atomic volatile type stays atomic
+    Type* volatile_type = new_type(type->fundamental_type);
+    volatile_type->struct_data = type->struct_data;
+    volatile_type->declaration_specifier_flags.flags = type->declaration_specifier_flags.flags | TypeModifierFlag::Volatile;
+    interned_type = volatile_type;
+  }
+
+  return interned_type;
+}
+
+bool is_volatile_type(Type const* type) { return type->declaration_specifier_flags.flags & TypeModifierFlag::Volatile; }
+
+Type* new_struct_type(FundamentalType struct_or_union, std::string const& tag)
+{
+  assert(struct_or_union == FundamentalType::Struct || struct_or_union == FundamentalType::Union);
+
+  Type* struct_type = new_type(struct_or_union);
+  struct_type->struct_data = new StructData;
+  struct_type->struct_data->tag = tag;
+  struct_type->struct_data->is_complete = false;
+  struct_type->struct_data->is_packed = false;
+  struct_type->struct_data->alignment = 0;
+  struct_type->struct_data->may_reorder_members = false;
+  struct_type->struct_data->layout.store(nullptr, std::memory_order_relaxed);
+
+  return struct_type;
+}
+
+bool is_incomplete_type(Type const* type)
+{
+  switch (type->fundamental_type) {
+  case FundamentalType::Void:
+    return true;
+  case FundamentalType::Array:
+    return type->array_length < 0 || is_incomplete_type(type->pointed_type);
+  case FundamentalType::Struct:
+  case FundamentalType::Union:
+    return !type->struct_data || !type->struct_data->is_complete;
+  default:
+    return false;
+  }
+}
+
 static void
 handle_storage_class_specifier_flag(TypeModifierFlag flag,
     DeclarationSpecifierFlags* declaration)
@@ -40,7 +317,7 @@ handle_storage_class_specifier_flag(TypeModifierFlag flag,
     bool new_flag_is_extern_or_static = (flag == Static || flag == Extern);
 
     bool set_flag_is_thread_local = (declaration->flags & ThreadLocal);
-    bool set_flag_is_extern_or_static = (declaration->flags == Static || declaration->flags == Extern);
+    bool set_flag_is_extern_or_static = (declaration->flags & (Static | Extern));
 
     bool new_is_thread_and_set_is_extern_or_static = new_flag_is_thread_local && set_flag_is_extern_or_static;
     bool new_is_extern_or_static_and_set_is_thread = new_flag_is_extern_or_static && set_flag_is_thread_local;
@@ -127,6 +404,9 @@ void update_declaration_specifiers(Token const* token,
   case TokenType::Enum:
     check_flag_set_and_update_if_not(TypeModifierFlag::Enum, declaration);
     return;
+  case TokenType::Union:
+    check_flag_set_and_update_if_not(TypeModifierFlag::Union, declaration);
+    return;
 
   case TokenType::Long:
     if (declaration->flags & TypeModifierFlag::LongTest)
@@ -195,93 +475,128 @@ void update_declaration_specifiers(Token const* token,
   }
 }
 
-FundamentalType
-fundamental_type_from_declaration(DeclarationSpecifierFlags* declaration)
+// 6.7.2.2 the valid multisets of type specifiers, each written as the sum of
+// its flags. long is added once per occurrence, so long long is LongTest
+// structs and unions carry their type in DeclarationSpecifierFlags::tag_type,
+// and typedef names in typedef_type
+// FIXME: enums
+struct TypeSpecifierCombination {
+  int flags;
+  FundamentalType fundamental_type;
+};
+
+static constexpr TypeSpecifierCombination type_specifier_combinations[] = {
+  { TypeModifierFlag::Void, FundamentalType::Void },
+
+  { TypeModifierFlag::Char, FundamentalType::Char },
+  { TypeModifierFlag::Signed + TypeModifierFlag::Char, FundamentalType::SignedChar },
+  { TypeModifierFlag::Unsigned + TypeModifierFlag::Char, FundamentalType::UnsignedChar },
+
+  { TypeModifierFlag::Short, FundamentalType::Short },
+  { TypeModifierFlag::Signed + TypeModifierFlag::Short, FundamentalType::Short },
+  { TypeModifierFlag::Short + TypeModifierFlag::Int, FundamentalType::Short },
+  { TypeModifierFlag::Signed + TypeModifierFlag::Short + TypeModifierFlag::Int, FundamentalType::Short },
+
+  { TypeModifierFlag::Unsigned + TypeModifierFlag::Short, FundamentalType::UnsignedShort },
+  { TypeModifierFlag::Unsigned + TypeModifierFlag::Short + TypeModifierFlag::Int, FundamentalType::UnsignedShort },
+
+  { TypeModifierFlag::Int, FundamentalType::Int },
+  { TypeModifierFlag::Signed, FundamentalType::Int },
+  { TypeModifierFlag::Signed + TypeModifierFlag::Int, FundamentalType::Int },
+
+  { TypeModifierFlag::Unsigned, FundamentalType::UnsignedInt },
+  { TypeModifierFlag::Unsigned + TypeModifierFlag::Int, FundamentalType::UnsignedInt },
+
+  { TypeModifierFlag::Long, FundamentalType::Long },
+  { TypeModifierFlag::Signed + TypeModifierFlag::Long, FundamentalType::Long },
+  { TypeModifierFlag::Long + TypeModifierFlag::Int, FundamentalType::Long },
+  { TypeModifierFlag::Signed + TypeModifierFlag::Long + TypeModifierFlag::Int, FundamentalType::Long },
+
+  { TypeModifierFlag::Unsigned + TypeModifierFlag::Long, FundamentalType::UnsignedLong },
+  { TypeModifierFlag::Unsigned + TypeModifierFlag::Long + TypeModifierFlag::Int, FundamentalType::UnsignedLong },
+
+  { TypeModifierFlag::LongTest, FundamentalType::LongLong },
+  { TypeModifierFlag::Signed + TypeModifierFlag::LongTest, FundamentalType::LongLong },
+  { TypeModifierFlag::LongTest + TypeModifierFlag::Int, FundamentalType::LongLong },
+  { TypeModifierFlag::Signed + TypeModifierFlag::LongTest + TypeModifierFlag::Int, FundamentalType::LongLong },
+
+  { TypeModifierFlag::Unsigned + TypeModifierFlag::LongTest, FundamentalType::UnsignedLongLong },
+  { TypeModifierFlag::Unsigned + TypeModifierFlag::LongTest + TypeModifierFlag::Int, FundamentalType::UnsignedLongLong },
+
+  { TypeModifierFlag::Float, FundamentalType::Float },
+  { TypeModifierFlag::Double, FundamentalType::Double },
+  { TypeModifierFlag::Long + TypeModifierFlag::Double, FundamentalType::LongDouble },
+
+  { TypeModifierFlag::Bool, FundamentalType::Bool },
+
+  { TypeModifierFlag::Float + TypeModifierFlag::Complex, FundamentalType::FloatComplex },
+  { TypeModifierFlag::Double + TypeModifierFlag::Complex, FundamentalType::DoubleComplex },
+  { TypeModifierFlag::Long + TypeModifierFlag::Double + TypeModifierFlag::Complex, FundamentalType::LongDoubleComplex },
+};
+
+// the type specifiers are the first 12 flags, Void through Complex
+static constexpr int type_specifier_mask = (TypeModifierFlag::Complex << 1) - 1;
+static constexpr signed char invalid_type_specifiers = -1;
+
+// every subset of the type specifier flags, mapped to the FundamentalType it
+// names, or invalid_type_specifiers. Built at compile time, so resolving a
+// declaration's type is a single load
+static constexpr std::array<signed char, type_specifier_mask + 1> build_type_specifier_table()
 {
-  // following ChibiCC's approach for handling the multiset
-  // specification for type specifiers
-  // augmenting by adding that e.g. long long long has too many longs
-
-  // the first 13 types in TypeSpecifierFlag enum are type specifiers
-  // 13 consecutive 1s in hex is 0x1fff
-  int declaration_type_as_int = declaration->flags & 0x1fff;
+  std::array<signed char, type_specifier_mask + 1> table {};
+  table.fill(invalid_type_specifiers);
 
-  switch (declaration_type_as_int) {
-  case 0:
-    // FIXME: typedef name? error?
-    break;
+  for (TypeSpecifierCombination const& combination : type_specifier_combinations)
+    table[combination.flags] = (signed char)combination.fundamental_type;
 
-  case TypeModifierFlag::Void:
-    return FundamentalType::Void;
-
-    // fixme?
-  case TypeModifierFlag::Char:
-  case TypeModifierFlag::Signed + TypeModifierFlag::Char:
-  case TypeModifierFlag::Unsigned + TypeModifierFlag::Char:
-    return FundamentalType::Char;
-
-  case TypeModifierFlag::Short:
-  case TypeModifierFlag::Short + TypeModifierFlag::Signed:
-  case TypeModifierFlag::Short + TypeModifierFlag::Int:
-  case TypeModifierFlag::Signed + TypeModifierFlag::Short + TypeModifierFlag::Int:
-    return FundamentalType::Short;
-
-  case TypeModifierFlag::Unsigned + TypeModifierFlag::Short:
-  case TypeModifierFlag::Unsigned + TypeModifierFlag::Short + TypeModifierFlag::Int:
-    return FundamentalType::UnsignedShort;
-
-  case TypeModifierFlag::Int:
-  case TypeModifierFlag::Signed:
-  case TypeModifierFlag::Signed + TypeModifierFlag::Int:
-    return FundamentalType::Int;
-
-  case TypeModifierFlag::Unsigned:
-  case TypeModifierFlag::Unsigned + TypeModifierFlag::Int:
-    return FundamentalType::UnsignedInt;
-
-  case TypeModifierFlag::Long:
-  case TypeModifierFlag::Signed + TypeModifierFlag::Long:
-  case TypeModifierFlag::Long + TypeModifierFlag::Int:
-  case TypeModifierFlag::Signed + TypeModifierFlag::Long + TypeModifierFlag::Int:
-    return FundamentalType::Long;
-
-  case TypeModifierFlag::Unsigned + TypeModifierFlag::Long:
-  case TypeModifierFlag::Unsigned + TypeModifierFlag::Long + TypeModifierFlag::Int:
-    return FundamentalType::UnsignedLong;
-
-  case TypeModifierFlag::Long + TypeModifierFlag::Long:
-  case TypeModifierFlag::Signed + TypeModifierFlag::Long + TypeModifierFlag::Long:
-  case TypeModifierFlag::Long + TypeModifierFlag::Long + TypeModifierFlag::Int:
-    return FundamentalType::LongLong;
-
-  case TypeModifierFlag::Float:
-    return FundamentalType::Float;
+  return table;
+}
 
-  case TypeModifierFlag::Double:
-    return FundamentalType::Double;
+static constexpr std::array<signed char, type_specifier_mask + 1> type_specifier_table = build_type_specifier_table();
 
-  case TypeModifierFlag::Long + TypeModifierFlag::Double:
-    return FundamentalType::LongDouble;
+static_assert(type_specifier_table[TypeModifierFlag::Unsigned + TypeModifierFlag::LongTest + TypeModifierFlag::Int]
+    == (signed char)FundamentalType::UnsignedLongLong);
+static_assert(type_specifier_table[TypeModifierFlag::Signed + TypeModifierFlag::Double] == invalid_type_specifiers);
 
-  case TypeModifierFlag::Bool:
-    return FundamentalType::Bool;
+FundamentalType fundamental_type_from_declaration(DeclarationSpecifierFlags* declaration)
+{
+  // a struct or union specifier is the only type specifier in its declaration
+  if (declaration->tag_type) {
+    bool is_struct_and_union = (declaration->flags & TypeModifierFlag::Struct) && (declaration->flags & TypeModifierFlag::Union);
+    if ((declaration->flags & (type_specifier_mask | TypeModifierFlag::Enum)) || is_struct_and_union) {
+      fprintf(stderr, "Invalid combination of type specifiers\n");
+      exit(1);
+    }
+    return declaration->tag_type->fundamental_type;
+  }
 
-  case TypeModifierFlag::Float + TypeModifierFlag::Complex:
-    return FundamentalType::FloatComplex;
+  // so is a typedef name, 6.7.2.2
+  if (declaration->typedef_type) {
+    if (declaration->flags & (type_specifier_mask | TypeModifierFlag::Enum)) {
+      fprintf(stderr, "Invalid combination of type specifiers\n");
+      exit(1);
+    }
+    return declaration->typedef_type->fundamental_type;
+  }
 
-  case TypeModifierFlag::Double + TypeModifierFlag::Complex:
-    return FundamentalType::DoubleComplex;
+  signed char fundamental_type = type_specifier_table[declaration->flags & type_specifier_mask];
 
-  case TypeModifierFlag::Long + TypeModifierFlag::Double + TypeModifierFlag::Complex:
-    return FundamentalType::LongDoubleComplex;
+  if (fundamental_type == invalid_type_specifiers) {
+    fprintf(stderr, "Invalid combination of type specifiers\n");
+    exit(1);
   }
-  assert(false && "TypeKind from declaration UNREACHABLE");
+
+  return (FundamentalType)fundamental_type;
 }
 
+// 6.2.5.17 char, the signed and unsigned integer types, and enumerated types
+// _Bool is one of the unsigned integer types
 bool is_integer_type(FundamentalType t)
 {
   switch (t) {
+  case FundamentalType::Bool:
   case FundamentalType::SignedChar:
+  case FundamentalType::UnsignedChar:
   case FundamentalType::Char:
   case FundamentalType::Int:
   case FundamentalType::UnsignedInt:
@@ -317,84 +632,182 @@ bool is_arithmetic_type(FundamentalType t)
   return is_integer_type(t) || is_floating_type(t);
 }
 
-extern Type const* const VoidType = new_type(FundamentalType::Void);
-extern Type const* const CharType = new_type(FundamentalType::Char);
-extern Type const* const SignedCharType = new_type(FundamentalType::SignedChar);
-extern Type const* const UnsignedCharType = new_type(FundamentalType::UnsignedChar);
-extern Type const* const ShortType = new_type(FundamentalType::Short);
-extern Type const* const UnsignedShortType = new_type(FundamentalType::UnsignedShort);
-extern Type const* const IntType = new_type(FundamentalType::Int);
-extern Type const* const UnsignedIntType = new_type(FundamentalType::UnsignedInt);
-extern Type const* const LongType = new_type(FundamentalType::Long);
-extern Type const* const UnsignedLongType = new_type(FundamentalType::UnsignedLong);
-extern Type const* const LongLongType = new_type(FundamentalType::LongLong);
-extern Type const* const UnsignedLongLongType = new_type(FundamentalType::UnsignedLongLong);
-extern Type const* const FloatType = new_type(FundamentalType::Float);
-extern Type const* const DoubleType = new_type(FundamentalType::Double);
-extern Type const* const LongDoubleType = new_type(FundamentalType::LongDouble);
-extern Type const* const FloatComplexType = new_type(FundamentalType::FloatComplex);
-extern Type const* const DoubleComplexType = new_type(FundamentalType::DoubleComplex);
-extern Type const* const LongDoubleComplexType = new_type(FundamentalType::LongDoubleComplex);
-extern Type const* const BoolType = new_type(FundamentalType::Bool);
-extern Type const* const StructType = new_type(FundamentalType::Struct);
-extern Type const* const UnionType = new_type(FundamentalType::Union);
-extern Type const* const EnumType = new_type(FundamentalType::Enum);
-extern Type const* const EnumeratedValueType = new_type(FundamentalType::EnumeratedValue);
-extern Type const* const TypedefNameType = new_type(FundamentalType::TypedefName);
+// 6.2.5.21 arithmetic types and pointer types are collectively called scalar types
+bool is_scalar_type(FundamentalType t)
+{
+  return is_arithmetic_type(t) || t == FundamentalType::Pointer;
+}
 
-Type const* get_fundamental_type_pointer(FundamentalType type)
+bool is_unsigned_integer_type(FundamentalType t)
 {
-  switch (type) {
-  case FundamentalType::Void:
-    return VoidType;
+  switch (t) {
+  // 6.2.5.15 plain char is signed or unsigned as the target decides
+  case FundamentalType::Char:
+    return !current_target->char_is_signed;
+
+  case FundamentalType::UnsignedChar:
+  case FundamentalType::UnsignedShort:
+  case FundamentalType::UnsignedInt:
+  case FundamentalType::UnsignedLong:
+  case FundamentalType::UnsignedLongLong:
+  case FundamentalType::Bool:
+    return true;
+
+  default:
+    return false;
+  }
+}
+
+// 6.3.1.1 integer conversion rank, only the relative order matters
+unsigned integer_conversion_rank(FundamentalType t)
+{
+  switch (t) {
+  case FundamentalType::Bool:
+    return 1;
   case FundamentalType::Char:
-    return CharType;
   case FundamentalType::SignedChar:
-    return SignedCharType;
   case FundamentalType::UnsignedChar:
-    return UnsignedCharType;
+    return 2;
   case FundamentalType::Short:
-    return ShortType;
   case FundamentalType::UnsignedShort:
-    return UnsignedShortType;
+    return 3;
   case FundamentalType::Int:
-    return IntType;
   case FundamentalType::UnsignedInt:
-    return UnsignedIntType;
+  case FundamentalType::Enum:
+  case FundamentalType::EnumeratedValue:
+    return 4;
   case FundamentalType::Long:
-    return LongType;
   case FundamentalType::UnsignedLong:
-    return UnsignedLongType;
+    return 5;
   case FundamentalType::LongLong:
-    return LongLongType;
   case FundamentalType::UnsignedLongLong:
-    return UnsignedLongLongType;
-  case FundamentalType::Float:
-    return FloatType;
-  case FundamentalType::Double:
-    return DoubleType;
+    return 6;
+
+  default:
+    assert(false && "integer_conversion_rank: not an integer type");
+    return 0;
+  }
+}
+
+// widths of the scalar types as emitted, these have to agree with codegen
+unsigned fundamental_type_bit_width(FundamentalType t)
+{
+  switch (t) {
+  case FundamentalType::Long:
+  case FundamentalType::UnsignedLong:
+    return current_target->long_width;
+  case FundamentalType::Pointer:
+    return current_target->pointer_width;
   case FundamentalType::LongDouble:
-    return LongDoubleType;
-  case FundamentalType::FloatComplex:
-    return FloatComplexType;
-  case FundamentalType::DoubleComplex:
-    return DoubleComplexType;
-  case FundamentalType::LongDoubleComplex:
-    return LongDoubleComplexType;
+    return current_target->long_double_width;
+
   case FundamentalType::Bool:
-    return BoolType;
-  case FundamentalType::Struct:
-    return StructType;
-  case FundamentalType::Union:
-    return UnionType;
+    return 1;
+  case FundamentalType::Char:
+  case FundamentalType::SignedChar:
+  case FundamentalType::UnsignedChar:
+    return 8;
+  case FundamentalType::Short:
+  case FundamentalType::UnsignedShort:
+    return 16;
+  case FundamentalType::Int:
+  case FundamentalType::UnsignedInt:
   case FundamentalType::Enum:
-    return EnumType;
   case FundamentalType::EnumeratedValue:
-    return EnumeratedValueType;
-  case FundamentalType::TypedefName:
-    return TypedefNameType;
-  case FundamentalType::Pointer:
-  case FundamentalType::Function:
-    return nullptr;
+  case FundamentalType::Float:
+    return 32;
+  case FundamentalType::LongLong:
+  case FundamentalType::UnsignedLongLong:
+  case FundamentalType::Double:
+    return 64;
+
+  default:
+    assert(false && "fundamental_type_bit_width: not a scalar type");
+    return 0;
+  }
+}
+
+// the unsigned type with the same rank, for the usual arithmetic conversions
+FundamentalType unsigned_integer_type(FundamentalType t)
+{
+  switch (t) {
+  case FundamentalType::Char:
+  case FundamentalType::SignedChar:
+    return FundamentalType::UnsignedChar;
+  case FundamentalType::Short:
+    return FundamentalType::UnsignedShort;
+  case FundamentalType::Int:
+    return FundamentalType::UnsignedInt;
+  case FundamentalType::Long:
+    return FundamentalType::UnsignedLong;
+  case FundamentalType::LongLong:
+    return FundamentalType::UnsignedLongLong;
+  default:
+    return t;
   }
 }
+
+// the fundamental types, in FundamentalType order, constant initialized so
+// they cost nothing at startup
+static constexpr size_t fundamental_type_count = (size_t)FundamentalType::TypedefName + 1;
+
+static constinit Type const fundamental_types[fundamental_type_count] = {
+  { nullptr, nullptr, FundamentalType::Void, { 0 }, 0, nullptr, nullptr },
+  { nullptr, nullptr, FundamentalType::Char, { 0 }, 0, nullptr, nullptr },
+  { nullptr, nullptr, FundamentalType::SignedChar, { 0 }, 0, nullptr, nullptr },
+  { nullptr, nullptr, FundamentalType::UnsignedChar, { 0 }, 0, nullptr, nullptr },
+  { nullptr, nullptr, FundamentalType::Short, { 0 }, 0, nullptr, nullptr },
+  { nullptr, nullptr, FundamentalType::UnsignedShort, { 0 }, 0, nullptr, nullptr },
+  { nullptr, nullptr, FundamentalType::Int, { 0 }, 0, nullptr, nullptr },
+  { nullptr, nullptr, FundamentalType::UnsignedInt, { 0 }, 0, nullptr, nullptr },
+  { nullptr, nullptr, FundamentalType::Long, { 0 }, 0, nullptr, nullptr },
+  { nullptr, nullptr, FundamentalType::UnsignedLong, { 0 }, 0, nullptr, nullptr },
+  { nullptr, nullptr, FundamentalType::LongLong, { 0 }, 0, nullptr, nullptr },
+  { nullptr, nullptr, FundamentalType::UnsignedLongLong, { 0 }, 0, nullptr, nullptr },
+  { nullptr, nullptr, FundamentalType::Float, { 0 }, 0, nullptr, nullptr },
+  { nullptr, nullptr, FundamentalType::Double, { 0 }, 0, nullptr, nullptr },
+  { nullptr, nullptr, FundamentalType::LongDouble, { 0 }, 0, nullptr, nullptr },
+  { nullptr, nullptr, FundamentalType::FloatComplex, { 0 }, 0, nullptr, nullptr },
+  { nullptr, nullptr, FundamentalType::DoubleComplex, { 0 }, 0, nullptr, nullptr },
+  { nullptr, nullptr, FundamentalType::LongDoubleComplex, { 0 }, 0, nullptr, nullptr },
+  { nullptr, nullptr, FundamentalType::Bool, { 0 }, 0, nullptr, nullptr },
+  { nullptr, nullptr, FundamentalType::Struct, { 0 }, 0, nullptr, nullptr },
+  { nullptr, nullptr, FundamentalType::Union, { 0 }, 0, nullptr, nullptr },
+  { nullptr, nullptr, FundamentalType::Enum, { 0 }, 0, nullptr, nullptr },
+  { nullptr, nullptr, FundamentalType::EnumeratedValue, { 0 }, 0, nullptr, nullptr },
+  { nullptr, nullptr, FundamentalType::TypedefName, { 0 }, 0, nullptr, nullptr },
+};
+
+constinit Type const* const VoidType = &fundamental_types[(size_t)FundamentalType::Void];
+constinit Type const* const CharType = &fundamental_types[(size_t)FundamentalType::Char];
+constinit Type const* const SignedCharType = &fundamental_types[(size_t)FundamentalType::SignedChar];
+constinit Type const* const UnsignedCharType = &fundamental_types[(size_t)FundamentalType::UnsignedChar];
+constinit Type const* const ShortType = &fundamental_types[(size_t)FundamentalType::Short];
+constinit Type const* const UnsignedShortType = &fundamental_types[(size_t)FundamentalType::UnsignedShort];
+constinit Type const* const IntType = &fundamental_types[(size_t)FundamentalType::Int];
+constinit Type const* const UnsignedIntType = &fundamental_types[(size_t)FundamentalType::UnsignedInt];
+constinit Type const* const LongType = &fundamental_types[(size_t)FundamentalType::Long];
+constinit Type const* const UnsignedLongType = &fundamental_types[(size_t)FundamentalType::UnsignedLong];
+constinit Type const* const LongLongType = &fundamental_types[(size_t)FundamentalType::LongLong];
+constinit Type const* const UnsignedLongLongType = &fundamental_types[(size_t)FundamentalType::UnsignedLongLong];
+constinit Type const* const FloatType = &fundamental_types[(size_t)FundamentalType::Float];
+constinit Type const* const DoubleType = &fundamental_types[(size_t)FundamentalType::Double];
+constinit Type const* const LongDoubleType = &fundamental_types[(size_t)FundamentalType::LongDouble];
+constinit Type const* const FloatComplexType = &fundamental_types[(size_t)FundamentalType::FloatComplex];
+constinit Type const* const DoubleComplexType = &fundamental_types[(size_t)FundamentalType::DoubleComplex];
+constinit Type const* const LongDoubleComplexType = &fundamental_types[(size_t)FundamentalType::LongDoubleComplex];
+constinit Type const* const BoolType = &fundamental_types[(size_t)FundamentalType::Bool];
+constinit Type const* const StructType = &fundamental_types[(size_t)FundamentalType::Struct];
+constinit Type const* const UnionType = &fundamental_types[(size_t)FundamentalType::Union];
+constinit Type const* const EnumType = &fundamental_types[(size_t)FundamentalType::Enum];
+constinit Type const* const EnumeratedValueType = &fundamental_types[(size_t)FundamentalType::EnumeratedValue];
+constinit Type const* const TypedefNameType = &fundamental_types[(size_t)FundamentalType::TypedefName];
+
+// pointers and functions are derived types, see the interning functions above
+Type const* get_fundamental_type_pointer(FundamentalType type)
+{
+  if ((size_t)type >= fundamental_type_count)
+    return nullptr;
+
+  return &fundamental_types[(size_t)type];
+}
@@ -0,0 +1,650 @@
+#include "x86_assembler.h"
+
+#include <llvm/BinaryFormat/ELF.h>
+
+#include <cassert>
+
+// https://www.intel.com/content/www/us/en/developer/articles/technical/intel-sdm.html
+// volume 2, chapter 2 for the encoding and appendix A for the opcodes
+
+static char const* const register_names[4][x86_register_count] = {
+  { "%al", "%cl", "%dl", "%bl", "%spl", "%bpl", "%sil", "%dil", "%r8b", "%r9b", "%r10b", "%r11b", "%r12b", "%r13b", "%r14b", "%r15b" },
+  { "%ax", "%cx", "%dx", "%bx", "%sp", "%bp", "%si", "%di", "%r8w", "%r9w", "%r10w", "%r11w", "%r12w", "%r13w", "%r14w", "%r15w" },
+  { "%eax", "%ecx", "%edx", "%ebx", "%esp", "%ebp", "%esi", "%edi", "%r8d", "%r9d", "%r10d", "%r11d", "%r12d", "%r13d", "%r14d", "%r15d" },
+  { "%rax", "%rcx", "%rdx", "%rbx", "%rsp", "%rbp", "%rsi", "%rdi", "%r8", "%r9", "%r10", "%r11", "%r12", "%r13", "%r14", "%r15" },
+};
+
+// Always is the "mp" of jmp
+static char const* const condition_names[] = { "o", "no", "b", "ae", "e", "ne", "be", "a", "s", "ns", "p", "np", "l", "ge", "le", "g", "mp" };
+
+static char const* const integer_suffixes[] = { "b", "w", "l", "q" };
+
+static char const* float_suffix(X86Width width) { return width == X86Width::Double ? "sd" : "ss"; }
+
+static bool fits_int8(long long value) { return value >= INT8_MIN && value <= INT8_MAX; }
+
+static void print_label(X86Assembler* assembler, uint32_t label) { print(assembler->text, ".L", *assembler->label_prefix, ".", label); }
+
+static void print_operand(X86Assembler* assembler, X86Operand const& operand, X86Width width)
+{
+  OutputBuffer* text = assembler->text;
+  switch (operand.kind) {
+  case X86OperandKind::Register:
+    print(text, register_names[(unsigned)width][operand.reg]);
+    return;
+  case X86OperandKind::Xmm:
+    print(text, "%xmm", (unsigned)operand.reg);
+    return;
+  case X86OperandKind::Immediate:
+    print(text, "$", operand.value);
+    return;
+  case X86OperandKind::Memory:
+    break;
+  default:
+    assert(false && "No operand to print");
+    return;
+  }
+
+  if (operand.reg == x86_fs) {
+    print(text, "%fs:", operand.value);
+    return;
+  }
+
+  switch (operand.relocation) {
+  case X86Relocation::None:
+    if (operand.value)
+      print(text, operand.value);
+    break;
+  case X86Relocation::PcRelative:
+    print(text, *operand.symbol);
+    break;
+  case X86Relocation::GotPcRelative:
+    print(text, *operand.symbol, "@GOTPCREL");
+    break;
+  case X86Relocation::GotThreadPointerOffset:
+    print(text, *operand.symbol, "@gottpoff");
+    break;
+  case X86Relocation::ThreadPointerOffset:
+    print(text, *operand.symbol, "@tpoff");
+    break;
+  }
+  print(text, "(", operand.reg == x86_rip ? "%rip" : register_names[3][operand.reg], ")");
+}
+
+// "  mnemonic source, destination\n", either operand may be missing
+static void print_instruction(X86Assembler* assembler, char const* mnemonic, char const* suffix, X86Operand const& source, X86Width source_width,
+    X86Operand const& destination, X86Width destination_width)
+{
+  OutputBuffer* text = assembler->text;
+  print(text, "  ", mnemonic, suffix);
+  char const* separator = " ";
+  if (source.kind != X86OperandKind::None) {
+    print(text, separator);
+    print_operand(assembler, source, source_width);
+    separator = ", ";
+  }
+  if (destination.kind != X86OperandKind::None) {
+    print(text, separator);
+    print_operand(assembler, destination, destination_width);
+  }
+  print(text, "\n");
+}
+
+static void emit_byte(X86Assembler* assembler, uint8_t byte) { append_bytes(assembler->code, (char const*)&byte, 1); }
+
+static void emit_u32(X86Assembler* assembler, uint32_t value)
+{
+  char bytes[4] = { (char)value, (char)(value >> 8), (char)(value >> 16), (char)(value >> 24) };
+  append_bytes(assembler->code, bytes, 4);
+}
+
+static void emit_immediate(X86Assembler* assembler, long long value, unsigned size)
+{
+  for (unsigned i = 0; i < size; i++)
+    emit_byte(assembler, (uint8_t)((unsigned long long)value >> (8 * i)));
+}
+
+static uint32_t code_offset(X86Assembler const* assembler) { return (uint32_t)assembler->code->size; }
+
+static uint32_t relocation_type(X86Relocation relocation)
+{
+  switch (relocation) {
+  case X86Relocation::PcRelative:
+    return llvm::ELF::R_X86_64_PC32;
+  case X86Relocation::GotPcRelative:
+    return llvm::ELF::R_X86_64_GOTPCREL;
+  case X86Relocation::GotThreadPointerOffset:
+    return llvm::ELF::R_X86_64_GOTTPOFF;
+  case X86Relocation::ThreadPointerOffset:
+    return llvm::ELF::R_X86_64_TPOFF32;
+  default:
+    assert(false && "Not a relocation");
+    return 0;
+  }
+}
+
+// the byte registers 4 to 7 are %spl to %dil with a REX prefix, and %ah to
+// %bh without
+static bool needs_byte_rex(X86Operand const& operand, bool is_byte)
+{
+  return is_byte && operand.kind == X86OperandKind::Register && operand.reg >= 4 && operand.reg < 8;
+}
+
+// an instruction with a ModRM byte: its prefixes, opcode, the register or
+// opcode extension in reg, and rm as a register or memory operand. The
+// immediate, immediate_size bytes of it, comes after, which a displacement
+// relative to %rip has to allow for
+static void emit_modrm(X86Assembler* assembler, uint8_t prefix, bool is_wide, std::initializer_list<uint8_t> opcode, X86Operand const& reg, X86Operand const& rm,
+    bool is_byte, unsigned immediate_size = 0)
+{
+  bool is_memory = rm.kind == X86OperandKind::Memory;
+  bool has_base = is_memory && rm.reg < x86_rip;
+
+  if (is_memory && rm.reg == x86_fs)
+    emit_byte(assembler, 0x64);
+  if (prefix)
+    emit_byte(assembler, prefix);
+
+  uint8_t rex = 0x40 | (is_wide ? 8 : 0) | (reg.reg >= 8 ? 4 : 0);
+  if ((!is_memory || has_base) && rm.reg >= 8)
+    rex |= 1;
+  if (rex != 0x40 || needs_byte_rex(reg, is_byte) || needs_byte_rex(rm, is_byte))
+    emit_byte(assembler, rex);
+
+  for (uint8_t byte : opcode)
+    emit_byte(assembler, byte);
+
+  uint8_t reg_bits = (uint8_t)((reg.reg & 7) << 3);
+  if (!is_memory) {
+    emit_byte(assembler, 0xc0 | reg_bits | (rm.reg & 7));
+    return;
+  }
+
+  if (rm.reg == x86_fs) {
+    emit_byte(assembler, reg_bits | 4);
+    emit_byte(assembler, 0x25);
+    emit_u32(assembler, (uint32_t)rm.value);
+    return;
+  }
+
+  if (rm.reg == x86_rip) {
+    emit_byte(assembler, reg_bits | 5);
+    assembler->symbol_fixups.push_back({ code_offset(assembler), relocation_type(rm.relocation), rm.value - 4 - (long long)immediate_size, rm.symbol });
+    emit_u32(assembler, 0);
+    return;
+  }
+
+  // %rsp and %r12 as a base take a SIB byte, and %rbp and %r13 a
+  // displacement, even if it is 0
+  uint8_t base = rm.reg & 7;
+  bool is_relocated = rm.relocation != X86Relocation::None;
+  uint8_t mod = is_relocated || !fits_int8(rm.value) ? 0x80 : rm.value || base == 5 ? 0x40 : 0;
+  emit_byte(assembler, mod | reg_bits | base);
+  if (base == 4)
+    emit_byte(assembler, 0x24);
+
+  if (mod == 0x40) {
+    emit_byte(assembler, (uint8_t)rm.value);
+  } else if (mod == 0x80) {
+    if (is_relocated)
+      assembler->symbol_fixups.push_back({ code_offset(assembler), relocation_type(rm.relocation), rm.value, rm.symbol });
+    emit_u32(assembler, is_relocated ? 0 : (uint32_t)rm.value);
+  }
+}
+
+// an opcode extension in the reg field of ModRM, written /digit in the
+// manuals
+static X86Operand digit(unsigned value) { return { X86OperandKind::None, (uint8_t)value, X86Relocation::None, 0, nullptr }; }
+
+static uint8_t operand_size_prefix(X86Width width) { return width == X86Width::Word ? 0x66 : 0; }
+
+static uint8_t float_prefix(X86Width width) { return width == X86Width::Double ? 0xf2 : 0xf3; }
+
+// add, or, and, sub, xor and cmp share their encodings, told apart by a
+// digit that is also where their opcodes start
+static unsigned arithmetic_digit(X86Opcode opcode)
+{
+  switch (opcode) {
+  case X86Opcode::Add:
+    return 0;
+  case X86Opcode::Or:
+    return 1;
+  case X86Opcode::And:
+    return 4;
+  case X86Opcode::Sub:
+    return 5;
+  case X86Opcode::Xor:
+    return 6;
+  default:
+    return 7;
+  }
+}
+
+static unsigned shift_digit(X86Opcode opcode) { return opcode == X86Opcode::Shl ? 4 : opcode == X86Opcode::Shr ? 5 : 7; }
+
+static void encode_instruction(X86Assembler* assembler, X86Opcode opcode, X86Width width, X86Operand const& source, X86Operand const& destination)
+{
+  bool is_byte = width == X86Width::Byte;
+  bool is_wide = width == X86Width::Quad;
+  uint8_t size_prefix = operand_size_prefix(width);
+  bool is_immediate = source.kind == X86OperandKind::Immediate;
+
+  switch (opcode) {
+  case X86Opcode::Add:
+  case X86Opcode::Or:
+  case X86Opcode::And:
+  case X86Opcode::Sub:
+  case X86Opcode::Xor:
+  case X86Opcode::Cmp: {
+    uint8_t base = (uint8_t)(arithmetic_digit(opcode) * 8);
+    if (is_immediate) {
+      unsigned size = is_byte || fits_int8(source.value) ? 1 : width == X86Width::Word ? 2 : 4;
+      uint8_t immediate_opcode = is_byte ? 0x80 : size == 1 ? 0x83 : 0x81;
+      emit_modrm(assembler, size_prefix, is_wide, { immediate_opcode }, digit(arithmetic_digit(opcode)), destination, is_byte, size);
+      emit_immediate(assembler, source.value, size);
+    } else if (source.kind == X86OperandKind::Memory) {
+      emit_modrm(assembler, size_prefix, is_wide, { (uint8_t)(base + (is_byte ? 2 : 3)) }, destination, source, is_byte);
+    } else {
+      emit_modrm(assembler, size_prefix, is_wide, { (uint8_t)(base + (is_byte ? 0 : 1)) }, source, destination, is_byte);
+    }
+    return;
+  }
+
+  case X86Opcode::Test:
+    if (is_immediate) {
+      unsigned size = is_byte ? 1 : width == X86Width::Word ? 2 : 4;
+      emit_modrm(assembler, size_prefix, is_wide, { (uint8_t)(is_byte ? 0xf6 : 0xf7) }, digit(0), destination, is_byte, size);
+      emit_immediate(assembler, source.value, size);
+    } else {
+      emit_modrm(assembler, size_prefix, is_wide, { (uint8_t)(is_byte ? 0x84 : 0x85) }, source, destination, is_byte);
+    }
+    return;
+
+  case X86Opcode::Mov:
+    if (is_immediate && destination.kind == X86OperandKind::Register && width == X86Width::Long) {
+      if (destination.reg >= 8)
+        emit_byte(assembler, 0x41);
+      emit_byte(assembler, (uint8_t)(0xb8 + (destination.reg & 7)));
+      emit_u32(assembler, (uint32_t)source.value);
+    } else if (is_immediate) {
+      // sign extended to a quad
+      unsigned size = is_byte ? 1 : width == X86Width::Word ? 2 : 4;
+      emit_modrm(assembler, size_prefix, is_wide, { (uint8_t)(is_byte ? 0xc6 : 0xc7) }, digit(0), destination, is_byte, size);
+      emit_immediate(assembler, source.value, size);
+    } else if (source.kind == X86OperandKind::Memory) {
+      emit_modrm(assembler, size_prefix, is_wide, { (uint8_t)(is_byte ? 0x8a : 0x8b) }, destination, source, is_byte);
+    } else {
+      emit_modrm(assembler, size_prefix, is_wide, { (uint8_t)(is_byte ? 0x88 : 0x89) }, source, destination, is_byte);
+    }
+    return;
+
+  case X86Opcode::Lea:
+    emit_modrm(assembler, 0, is_wide, { 0x8d }, destination, source, false);
+    return;
+
+  case X86Opcode::IMul:
+    if (is_immediate) {
+      unsigned size = fits_int8(source.value) ? 1 : 4;
+      emit_modrm(assembler, 0, is_wide, { (uint8_t)(size == 1 ? 0x6b : 0x69) }, destination, destination, false, size);
+      emit_immediate(assembler, source.value, size);
+    } else {
+      emit_modrm(assembler, 0, is_wide, { 0x0f, 0xaf }, destination, source, false);
+    }
+    return;
+
+  case X86Opcode::Shl:
+  case X86Opcode::Shr:
+  case X86Opcode::Sar: {
+    X86Operand extension = digit(shift_digit(opcode));
+    if (is_immediate) {
+      emit_modrm(assembler, size_prefix, is_wide, { (uint8_t)(is_byte ? 0xc0 : 0xc1) }, extension, destination, is_byte, 1);
+      emit_immediate(assembler, source.value, 1);
+    } else if (source.kind == X86OperandKind::Register) {
+      assert(source.reg == RCX && "Shifts by a register shift by %cl");
+      emit_modrm(assembler, size_prefix, is_wide, { (uint8_t)(is_byte ? 0xd2 : 0xd3) }, extension, destination, is_byte);
+    } else {
+      emit_modrm(assembler, size_prefix, is_wide, { (uint8_t)(is_byte ? 0xd0 : 0xd1) }, extension, destination, is_byte);
+    }
+    return;
+  }
+
+  case X86Opcode::Btc:
+    emit_modrm(assembler, size_prefix, is_wide, { 0x0f, 0xba }, digit(7), destination, false, 1);
+    emit_immediate(assembler, source.value, 1);
+    return;
+
+  case X86Opcode::Neg:
+  case X86Opcode::Div:
+  case X86Opcode::IDiv: {
+    unsigned extension = opcode == X86Opcode::Neg ? 3 : opcode == X86Opcode::Div ? 6 : 7;
+    emit_modrm(assembler, size_prefix, is_wide, { (uint8_t)(is_byte ? 0xf6 : 0xf7) }, digit(extension), destination, is_byte);
+    return;
+  }
+
+  case X86Opcode::Push:
+    if (destination.reg >= 8)
+      emit_byte(assembler, 0x41);
+    emit_byte(assembler, (uint8_t)(0x50 + (destination.reg & 7)));
+    return;
+
+  case X86Opcode::MovZX:
+  case X86Opcode::MovSX: {
+    uint8_t second = (uint8_t)((opcode == X86Opcode::MovZX ? 0xb6 : 0xbe) + (is_byte ? 0 : 1));
+    emit_modrm(assembler, 0, false, { 0x0f, second }, destination, source, is_byte);
+    return;
+  }
+
+  case X86Opcode::MovSXD:
+    emit_modrm(assembler, 0, true, { 0x63 }, destination, source, false);
+    return;
+
+  case X86Opcode::MovAbs:
+    emit_byte(assembler, destination.reg >= 8 ? 0x49 : 0x48);
+    emit_byte(assembler, (uint8_t)(0xb8 + (destination.reg & 7)));
+    emit_immediate(assembler, source.value, 8);
+    return;
+
+  case X86Opcode::Leave:
+    emit_byte(assembler, 0xc9);
+    return;
+
+  case X86Opcode::Ret:
+    emit_byte(assembler, 0xc3);
+    return;
+
+  case X86Opcode::Ud2:
+    emit_byte(assembler, 0x0f);
+    emit_byte(assembler, 0x0b);
+    return;
+
+  case X86Opcode::SignExtendAccumulator:
+    if (is_wide)
+      emit_byte(assembler, 0x48);
+    emit_byte(assembler, 0x99);
+    return;
+
+  case X86Opcode::MovS:
+    if (destination.kind == X86OperandKind::Memory)
+      emit_modrm(assembler, float_prefix(width), false, { 0x0f, 0x11 }, source, destination, false);
+    else
+      emit_modrm(assembler, float_prefix(width), false, { 0x0f, 0x10 }, destination, source, false);
+    return;
+
+  case X86Opcode::AddS:
+  case X86Opcode::SubS:
+  case X86Opcode::MulS:
+  case X86Opcode::DivS: {
+    uint8_t second = opcode == X86Opcode::AddS ? 0x58 : opcode == X86Opcode::MulS ? 0x59 : opcode == X86Opcode::SubS ? 0x5c : 0x5e;
+    emit_modrm(assembler, float_prefix(width), false, { 0x0f, second }, destination, source, false);
+    return;
+  }
+
+  case X86Opcode::UComiS:
+    emit_modrm(assembler, width == X86Width::Double ? 0x66 : 0, false, { 0x0f, 0x2e }, destination, source, false);
+    return;
+
+  case X86Opcode::XorPS:
+    emit_modrm(assembler, 0, false, { 0x0f, 0x57 }, destination, source, false);
+    return;
+
+  case X86Opcode::ConvertFloat:
+    emit_modrm(assembler, float_prefix(width), false, { 0x0f, 0x5a }, destination, source, false);
+    return;
+
+  case X86Opcode::MovQToXmm:
+    emit_modrm(assembler, 0x66, true, { 0x0f, 0x6e }, destination, source, false);
+    return;
+  }
+}
+
+static char const* mnemonic(X86Opcode opcode)
+{
+  switch (opcode) {
+  case X86Opcode::Add:
+    return "add";
+  case X86Opcode::Or:
+    return "or";
+  case X86Opcode::And:
+    return "and";
+  case X86Opcode::Sub:
+    return "sub";
+  case X86Opcode::Xor:
+    return "xor";
+  case X86Opcode::Cmp:
+    return "cmp";
+  case X86Opcode::Test:
+    return "test";
+  case X86Opcode::Mov:
+    return "mov";
+  case X86Opcode::Lea:
+    return "lea";
+  case X86Opcode::IMul:
+    return "imul";
+  case X86Opcode::Shl:
+    return "shl";
+  case X86Opcode::Shr:
+    return "shr";
+  case X86Opcode::Sar:
+    return "sar";
+  case X86Opcode::Btc:
+    return "btc";
+  case X86Opcode::Neg:
+    return "neg";
+  case X86Opcode::Div:
+    return "div";
+  case X86Opcode::IDiv:
+    return "idiv";
+  case X86Opcode::Push:
+    return "push";
+  case X86Opcode::MovAbs:
+    return "movabs";
+  case X86Opcode::Leave:
+    return "leave";
+  case X86Opcode::Ret:
+    return "ret";
+  case X86Opcode::Ud2:
+    return "ud2";
+  case X86Opcode::MovS:
+    return "mov";
+  case X86Opcode::AddS:
+    return "add";
+  case X86Opcode::SubS:
+    return "sub";
+  case X86Opcode::MulS:
+    return "mul";
+  case X86Opcode::DivS:
+    return "div";
+  case X86Opcode::UComiS:
+    return "ucomi";
+  case X86Opcode::XorPS:
+    return "xorps";
+  case X86Opcode::MovQToXmm:
+    return "movq";
+  default:
+    assert(false && "Printed on its own");
+    return "";
+  }
+}
+
+static void print_x86(X86Assembler* assembler, X86Opcode opcode, X86Width width, X86Operand const& source, X86Operand const& destination)
+{
+  char const* suffix = width <= X86Width::Quad ? integer_suffixes[(unsigned)width] : float_suffix(width);
+
+  switch (opcode) {
+  case X86Opcode::IMul:
+    // the three operand form, the product of the immediate and the second
+    // operand goes to the third
+    if (source.kind == X86OperandKind::Immediate) {
+      print(assembler->text, "  imul", suffix, " $", source.value, ", ");
+      print_operand(assembler, destination, width);
+      print(assembler->text, ", ");
+      print_operand(assembler, destination, width);
+      print(assembler->text, "\n");
+      return;
+    }
+    print_instruction(assembler, "imul", suffix, source, width, destination, width);
+    return;
+  case X86Opcode::Shl:
+  case X86Opcode::Shr:
+  case X86Opcode::Sar:
+    print_instruction(assembler, mnemonic(opcode), suffix, source, X86Width::Byte, destination, width);
+    return;
+  case X86Opcode::MovZX:
+  case X86Opcode::MovSX:
+    print(assembler->text, "  ", opcode == X86Opcode::MovZX ? "movz" : "movs", suffix, "l ");
+    print_operand(assembler, source, width);
+    print(assembler->text, ", ");
+    print_operand(assembler, destination, X86Width::Long);
+    print(assembler->text, "\n");
+    return;
+  case X86Opcode::MovSXD:
+    print_instruction(assembler, "movslq", "", source, X86Width::Long, destination, X86Width::Quad);
+    return;
+  case X86Opcode::Leave:
+  case X86Opcode::Ret:
+  case X86Opcode::Ud2:
+  case X86Opcode::XorPS:
+    print_instruction(assembler, mnemonic(opcode), "", source, width, destination, width);
+    return;
+  case X86Opcode::SignExtendAccumulator:
+    print(assembler->text, width == X86Width::Quad ? "  cqto\n" : "  cltd\n");
+    return;
+  case X86Opcode::ConvertFloat:
+    print_instruction(assembler, width == X86Width::Single ? "cvtss2sd" : "cvtsd2ss", "", source, width, destination, width);
+    return;
+  case X86Opcode::MovQToXmm:
+    print_instruction(assembler, "movq", "", source, X86Width::Quad, destination, width);
+    return;
+  default:
+    print_instruction(assembler, mnemonic(opcode), suffix, source, width, destination, width);
+    return;
+  }
+}
+
+void emit_x86(X86Assembler* assembler, X86Opcode opcode, X86Width width, X86Operand source, X86Operand destination)
+{
+  if (assembler->text)
+    print_x86(assembler, opcode, width, source, destination);
+  else
+    encode_instruction(assembler, opcode, width, source, destination);
+}
+
+void emit_x86_float_to_integer(X86Assembler* assembler, X86Width from, X86Width to, unsigned xmm, X86Register destination)
+{
+  if (assembler->text) {
+    print(assembler->text, "  cvtt", float_suffix(from), "2si", integer_suffixes[(unsigned)to], " %xmm", xmm, ", ", register_names[(unsigned)to][destination], "\n");
+    return;
+  }
+  emit_modrm(assembler, float_prefix(from), to == X86Width::Quad, { 0x0f, 0x2c }, x86_register(destination), x86_xmm(xmm), false);
+}
+
+void emit_x86_integer_to_float(X86Assembler* assembler, X86Width to, X86Register source, unsigned xmm)
+{
+  if (assembler->text) {
+    print(assembler->text, "  cvtsi2", float_suffix(to), "q ", register_names[3][source], ", %xmm", xmm, "\n");
+    return;
+  }
+  emit_modrm(assembler, float_prefix(to), true, { 0x0f, 0x2a }, x86_xmm(xmm), x86_register(source), false);
+}
+
+void emit_x86_set(X86Assembler* assembler, X86Condition condition, X86Register destination)
+{
+  if (assembler->text) {
+    print(assembler->text, "  set", condition_names[(unsigned)condition], " ", register_names[0][destination], "\n");
+    return;
+  }
+  emit_modrm(assembler, 0, false, { 0x0f, (uint8_t)(0x90 + (unsigned)condition) }, digit(0), x86_register(destination), true);
+}
+
+void begin_x86_function(X86Assembler* assembler, std::string const* label_prefix, uint32_t label_count)
+{
+  assembler->label_prefix = label_prefix;
+  assembler->labels.assign(label_count, UINT32_MAX);
+  assembler->label_fixups.clear();
+  assembler->symbol_fixups.clear();
+}
+
+uint32_t new_x86_label(X86Assembler* assembler)
+{
+  assembler->labels.push_back(UINT32_MAX);
+  return (uint32_t)assembler->labels.size() - 1;
+}
+
+void bind_x86_label(X86Assembler* assembler, uint32_t label)
+{
+  if (assembler->text) {
+    print_label(assembler, label);
+    print(assembler->text, ":\n");
+    return;
+  }
+  assembler->labels[label] = code_offset(assembler);
+}
+
+void emit_x86_jump(X86Assembler* assembler, X86Condition condition, uint32_t label)
+{
+  bool is_unconditional = condition == X86Condition::Always;
+  if (assembler->text) {
+    print(assembler->text, "  j", condition_names[(unsigned)condition], " ");
+    print_label(assembler, label);
+    print(assembler->text, "\n");
+    return;
+  }
+
+  // the displacement counts from the end of the jump, 2 bytes for the short
+  // form
+  uint32_t target = assembler->labels[label];
+  long long short_displacement = (long long)target - (code_offset(assembler) + 2);
+  if (target != UINT32_MAX && fits_int8(short_displacement)) {
+    emit_byte(assembler, is_unconditional ? 0xeb : (uint8_t)(0x70 + (unsigned)condition));
+    emit_byte(assembler, (uint8_t)short_displacement);
+    return;
+  }
+
+  if (is_unconditional) {
+    emit_byte(assembler, 0xe9);
+  } else {
+    emit_byte(assembler, 0x0f);
+    emit_byte(assembler, (uint8_t)(0x80 + (unsigned)condition));
+  }
+  if (target != UINT32_MAX) {
+    emit_u32(assembler, (uint32_t)(target - (code_offset(assembler) + 4)));
+    return;
+  }
+  assembler->label_fixups.push_back({ code_offset(assembler), label });
+  emit_u32(assembler, 0);
+}
+
+void end_x86_function(X86Assembler* assembler)
+{
+  if (assembler->text)
+    return;
+
+  for (auto [offset, label] : assembler->label_fixups) {
+    assert(assembler->labels[label] != UINT32_MAX && "Jump to a label that was never bound");
+    uint32_t displacement = assembler->labels[label] - (offset + 4);
+    memcpy(assembler->code->data + offset, &displacement, sizeof(displacement));
+  }
+}
+
+// R_X86_64_PLT32 goes through the PLT for functions in a shared library and
+// straight to the function otherwise, which is what GNU as uses for both
+void emit_x86_call(X86Assembler* assembler, std::string const* symbol, bool is_defined, bool is_jump)
+{
+  if (assembler->text) {
+    print(assembler->text, is_jump ? "  jmp " : "  call ", *symbol, is_defined ? "" : "@PLT", "\n");
+    return;
+  }
+
+  emit_byte(assembler, is_jump ? 0xe9 : 0xe8);
+  assembler->symbol_fixups.push_back({ code_offset(assembler), llvm::ELF::R_X86_64_PLT32, -4, symbol });
+  emit_u32(assembler, 0);
+}
+
+void emit_x86_indirect_call(X86Assembler* assembler, X86Register callee, bool is_jump)
+{
+  if (assembler->text) {
+    print(assembler->text, is_jump ? "  jmp *" : "  call *", register_names[3][callee], "\n");
+    return;
+  }
+  emit_modrm(assembler, 0, false, { 0xff }, digit(is_jump ? 4 : 2), x86_register(callee), false);
+}
@@ -1,5 +1,30 @@
-define i32 @add(i32 %0, i32 %1){
+target datalayout = "e-m:e-p270:32:32-p271:32:32-p272:64:64-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+define i32 @add(i32 %0, i32 %1) nounwind readnone norecurse willreturn speculatable {
 entry:
-  %2 = alloca i32
-  ret i32 %0
+  %2 = add nsw i32 %0, %1
+  ret i32 %2
 }
+
+!1 = !{!"Simple C/C++ TBAA"}
+!2 = !{!"omnipotent char", !1, i64 0}
+!3 = !{!"short", !2, i64 0}
+!4 = !{!"int", !2, i64 0}
+!5 = !{!"long", !2, i64 0}
+!6 = !{!"long long", !2, i64 0}
+!7 = !{!"float", !2, i64 0}
+!8 = !{!"double", !2, i64 0}
+!9 = !{!"long double", !2, i64 0}
+!10 = !{!"_Bool", !2, i64 0}
+!11 = !{!"any pointer", !2, i64 0}
+!12 = !{!2, !2, i64 0}
+!13 = !{!3, !3, i64 0}
+!14 = !{!4, !4, i64 0}
+!15 = !{!5, !5, i64 0}
+!16 = !{!6, !6, i64 0}
+!17 = !{!7, !7, i64 0}
+!18 = !{!8, !8, i64 0}
+!19 = !{!9, !9, i64 0}
+!20 = !{!10, !10, i64 0}
+!21 = !{!11, !11, i64 0}
@@ -1,7 +1,28 @@
 #include "parser.h"
+#include "ast_walk.h"
+#include "jit.h"
+#include "codegen.h"
+#include "layout.h"
 #include "lexer.h"
+#include "llvm_codegen.h"
+#include "mir.h"
+#include "native_codegen.h"
+#include "name_resolution.h"
+#include "optimizer.h"
+#include "semantic_analysis.h"
+#include "target.h"
+#include "target_machine.h"
 #include "type.h"
 #include <cassert>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/IRReader/IRReader.h>
+#include <llvm/Support/SourceMgr.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 void test1()
 {
@@ -282,6 +303,1361 @@ void test11()
   printf("test 11 passed\n\n");
 }
 
+void test12()
+{
+  printf("Running parser test 12: Precedence and associativity...\n");
+
+  char const* source = "a = b = 2 + 3 * -(4 - 1) == 7 ? x : y";
+  Lexer lexer = new_lexer(source);
+  get_next_token(&lexer);
+
+  Scope scope;
+  scope.parent_scope = nullptr;
+  ASTNode* node = parse_expression(&lexer, &scope);
+
+  // assignment is right associative, and binds loosest
+  assert(node->type == ASTNodeType::Assignment);
+  assert(node->lhs->referenced_variable == "a");
+  assert(node->rhs->type == ASTNodeType::Assignment);
+  assert(node->rhs->lhs->referenced_variable == "b");
+
+  ASTNode* conditional_node = node->rhs->rhs;
+  assert(conditional_node->type == ASTNodeType::ConditionalExpression);
+  assert(conditional_node->lhs->referenced_variable == "x");
+  assert(conditional_node->rhs->referenced_variable == "y");
+
+  ASTNode* equality_node = conditional_node->conditional;
+  assert(equality_node->type == ASTNodeType::EqualityComparison);
+  assert(equality_node->rhs->data_as.int_data == 7);
+
+  ASTNode* add_node = equality_node->lhs;
+  assert(add_node->type == ASTNodeType::Addition);
+  assert(add_node->lhs->data_as.int_data == 2);
+  assert(add_node->rhs->type == ASTNodeType::Multiplication);
+  assert(add_node->rhs->rhs->type == ASTNodeType::Negation);
+  assert(add_node->rhs->rhs->lhs->type == ASTNodeType::Subtraction);
+
+  assert(get_current_token(&lexer)->type == TokenType::Eof);
+
+  printf("test 12 passed\n\n");
+}
+
+static void count_node(ASTNode const*, void* context) { (*(unsigned*)context)++; }
+
+void test13()
+{
+  printf("Running parser test 13: Pathologically nested expression...\n");
+
+  // a+(a+(a+(...))), deep enough to blow the native stack if parsing or
+  // walking the tree recursed per level
+  unsigned const depth = 100000;
+  std::string source;
+  for (unsigned i = 0; i < depth; i++)
+    source += "a+(";
+  source += "a";
+  for (unsigned i = 0; i < depth; i++)
+    source += ")";
+
+  Lexer lexer = new_lexer(source.c_str());
+  get_next_token(&lexer);
+
+  Scope scope;
+  scope.parent_scope = nullptr;
+  ASTNode* node = parse_expression(&lexer, &scope);
+  assert(get_current_token(&lexer)->type == TokenType::Eof);
+
+  ASTNode const* current_node = node;
+  for (unsigned i = 0; i < depth; i++) {
+    assert(current_node->type == ASTNodeType::Addition);
+    assert(current_node->lhs->referenced_variable == "a");
+    current_node = current_node->rhs;
+  }
+  assert(current_node->type == ASTNodeType::VariableReference);
+
+  unsigned node_count = 0;
+  walk_ast_post_order(node, count_node, &node_count);
+  assert(node_count == 2 * depth + 1);
+
+  // a[a[a[...]]], where each index is a whole expression of its own
+  std::string subscripts;
+  for (unsigned i = 0; i < depth; i++)
+    subscripts += "a[";
+  subscripts += "a";
+  for (unsigned i = 0; i < depth; i++)
+    subscripts += "]";
+
+  lexer = new_lexer(subscripts.c_str());
+  get_next_token(&lexer);
+  node = parse_expression(&lexer, &scope);
+  assert(get_current_token(&lexer)->type == TokenType::Eof);
+
+  current_node = node;
+  for (unsigned i = 0; i < depth; i++) {
+    assert(current_node->type == ASTNodeType::Subscript);
+    assert(current_node->lhs->referenced_variable == "a");
+    current_node = current_node->rhs;
+  }
+  assert(current_node->type == ASTNodeType::VariableReference);
+
+  // subscripts chain left to right and bind tighter than prefix operators
+  lexer = new_lexer("-a[b + 1][c]");
+  get_next_token(&lexer);
+  node = parse_expression(&lexer, &scope);
+  assert(get_current_token(&lexer)->type == TokenType::Eof);
+  assert(node->lhs->type == ASTNodeType::Subscript && node->lhs->rhs->referenced_variable == "c");
+  assert(node->lhs->lhs->type == ASTNodeType::Subscript && node->lhs->lhs->lhs->referenced_variable == "a");
+  assert(node->lhs->lhs->rhs->type == ASTNodeType::Addition);
+
+  printf("test 13 passed\n\n");
+}
+
+void test14()
+{
+  printf("Running parser test 14: Long else if chain...\n");
+
+  unsigned const branches = 50000;
+  std::string source = "{";
+  for (unsigned i = 0; i < branches; i++)
+    source += "if (x == 1) return 1; else ";
+  source += "return 0;}";
+
+  Lexer lexer = new_lexer(source.c_str());
+  get_next_token(&lexer);
+
+  Scope scope;
+  scope.parent_scope = nullptr;
+  scope.return_type = get_fundamental_type_pointer(FundamentalType::Int);
+  ASTNode* node = parse_statement(&lexer, &scope);
+  assert(get_current_token(&lexer)->type == TokenType::Eof);
+
+  ASTNode const* current_node = node;
+  for (unsigned i = 0; i < branches; i++) {
+    assert(current_node->type == ASTNodeType::If);
+    assert(current_node->lhs->type == ASTNodeType::Return);
+    current_node = current_node->rhs;
+  }
+  assert(current_node->type == ASTNodeType::Return);
+
+  unsigned node_count = 0;
+  walk_ast_post_order(node, count_node, &node_count);
+  // each branch has an if, a comparison with two operands, a return and its value
+  assert(node_count == 6 * branches + 2);
+
+  printf("test 14 passed\n\n");
+}
+
+void test15()
+{
+  printf("Running parser test 15: Name resolution...\n");
+
+  char const* source = "int g;"
+                       "int f(int a, int b);"
+                       "int main() { int x = 1; { int y = x; } return f(x, g); }"
+                       "int f(int a, int b) { return a + b; }";
+
+  ExternalDeclaration* external_declarations = parse_translation_unit(source);
+  resolve_names(external_declarations);
+
+  Object const* global = external_declarations->root_ast_node->object;
+  Object const* prototype = external_declarations->next->root_ast_node->object;
+  Object const* main_function = external_declarations->next->next->root_ast_node->object;
+  Object const* definition = external_declarations->next->next->next->root_ast_node->object;
+
+  assert(global->is_canonical && global->local_slot == -1);
+  // the definition of f wins over its earlier prototype
+  assert(!prototype->is_canonical);
+  assert(definition->is_canonical);
+
+  // x and y, the inner block's y gets a slot of its own
+  assert(main_function->local_count == 2);
+  ASTNode const* x_declaration = main_function->function_body;
+  ASTNode const* inner_block = x_declaration->next;
+  assert(x_declaration->object->local_slot == 0);
+  assert(inner_block->object->local_slot == 1);
+  assert(inner_block->rhs->object == x_declaration->object);
+
+  ASTNode const* call = inner_block->next->rhs;
+  assert(call->type == ASTNodeType::FunctionCall);
+  assert(call->lhs->object == definition);
+  assert(call->rhs->object == x_declaration->object);
+  assert(call->rhs->next->object == global);
+  assert(call->rhs->next->next == nullptr);
+
+  // parameters take the first slots
+  assert(definition->local_count == 2);
+  ASTNode const* sum = definition->function_body->rhs;
+  assert(sum->lhs->object->local_slot == 0);
+  assert(sum->rhs->object->local_slot == 1);
+
+  printf("test 15 passed\n\n");
+}
+
+void test16()
+{
+  printf("Running parser test 16: Semantic analysis...\n");
+
+  char const* source = "long widen(char c, unsigned u) { return c + u; }"
+                       "int take(long x);"
+                       "int give(char c) { return take(c); }";
+
+  ExternalDeclaration* external_declarations = parse_translation_unit(source);
+  resolve_names(external_declarations);
+  analyze_translation_unit(external_declarations, 1);
+
+  // char + unsigned is unsigned, and the result is converted to long on return
+  ASTNode const* return_value = external_declarations->root_ast_node->object->function_body->rhs;
+  assert(return_value->type == ASTNodeType::ImplicitConversion);
+  assert(return_value->expression_type == LongType);
+
+  ASTNode const* sum = return_value->lhs;
+  assert(sum->type == ASTNodeType::Addition);
+  assert(sum->expression_type == UnsignedIntType);
+  assert(sum->lhs->type == ASTNodeType::ImplicitConversion);
+  assert(sum->lhs->expression_type == UnsignedIntType);
+  assert(sum->lhs->lhs->expression_type == CharType);
+  assert(sum->rhs->type == ASTNodeType::VariableReference);
+
+  // arguments are converted to their parameter's type
+  ASTNode const* call = external_declarations->next->next->root_ast_node->object->function_body->rhs;
+  assert(call->type == ASTNodeType::FunctionCall);
+  assert(call->expression_type == IntType);
+  assert(call->rhs->type == ASTNodeType::ImplicitConversion);
+  assert(call->rhs->expression_type == LongType);
+  assert(call->rhs->next == nullptr);
+
+  printf("test 16 passed\n\n");
+}
+
+void test17()
+{
+  printf("Running parser test 17: Semantic analysis on several threads...\n");
+
+  unsigned const function_count = 2000;
+  std::string source;
+  for (unsigned i = 0; i < function_count; i++)
+    source += "int f" + std::to_string(i) + "(int a, char b) { return a + b; }";
+
+  ExternalDeclaration* external_declarations = parse_translation_unit(source.c_str());
+  resolve_names(external_declarations);
+  analyze_translation_unit(external_declarations, 4);
+
+  unsigned analyzed_functions = 0;
+  for (ExternalDeclaration const* declaration = external_declarations; declaration; declaration = declaration->next) {
+    ASTNode const* sum = declaration->root_ast_node->object->function_body->rhs;
+    assert(sum->expression_type == IntType);
+    assert(sum->rhs->type == ASTNodeType::ImplicitConversion);
+    analyzed_functions++;
+  }
+  assert(analyzed_functions == function_count);
+
+  printf("test 17 passed\n\n");
+}
+
+void test18()
+{
+  printf("Running parser test 18: Interned types...\n");
+
+  char const* source = "int* a; int* b; int* const c;"
+                       "int f(int, char*); int g(int x, char* y); int h(long, int, char*);";
+
+  ExternalDeclaration* external_declarations = parse_translation_unit(source);
+
+  Type const* a_type = external_declarations->root_ast_node->object->type;
+  Type const* b_type = external_declarations->next->root_ast_node->object->type;
+  Type const* c_type = external_declarations->next->next->root_ast_node->object->type;
+  assert(a_type == b_type);
+  assert(a_type == intern_pointer_type(IntType));
+  assert(a_type != c_type);
+  assert(c_type->pointed_type == IntType);
+
+  ExternalDeclaration const* f_declaration = external_declarations->next->next->next;
+  Type const* f_type = f_declaration->root_ast_node->object->type;
+  Type const* g_type = f_declaration->next->root_ast_node->object->type;
+  Type const* h_type = f_declaration->next->next->root_ast_node->object->type;
+
+  // parameter names are not part of the type
+  assert(f_type == g_type);
+  assert(g_type != h_type);
+  std::vector<std::string> const& g_parameters = f_declaration->next->root_ast_node->object->parameter_identifiers;
+  assert(g_parameters.size() == 2 && g_parameters[0] == "x" && g_parameters[1] == "y");
+
+  // parameter lists share their tails
+  assert(h_type->function_data->parameter_list->next_parameter == f_type->function_data->parameter_list);
+
+  printf("test 18 passed\n\n");
+}
+
+void test19()
+{
+  printf("Running parser test 19: Type specifier combinations...\n");
+
+  for (int i = (int)FundamentalType::Void; i <= (int)FundamentalType::TypedefName; i++)
+    assert(get_fundamental_type_pointer((FundamentalType)i)->fundamental_type == (FundamentalType)i);
+  assert(get_fundamental_type_pointer(FundamentalType::Pointer) == nullptr);
+
+  char const* source = "signed char a; unsigned char b; long int c; unsigned long long d;"
+                       "long signed long int e; short unsigned f; long double g; unsigned h;";
+
+  FundamentalType const expected_types[] = { FundamentalType::SignedChar, FundamentalType::UnsignedChar, FundamentalType::Long,
+    FundamentalType::UnsignedLongLong, FundamentalType::LongLong, FundamentalType::UnsignedShort, FundamentalType::LongDouble,
+    FundamentalType::UnsignedInt };
+
+  ExternalDeclaration const* declaration = parse_translation_unit(source);
+  for (FundamentalType expected_type : expected_types) {
+    assert(declaration->root_ast_node->object->type == get_fundamental_type_pointer(expected_type));
+    declaration = declaration->next;
+  }
+  assert(!declaration);
+
+  printf("test 19 passed\n\n");
+}
+
+void test20()
+{
+  printf("Running parser test 20: Struct layout...\n");
+
+  char const* source = "struct point { char tag; long long x; int y; } p;"
+                       "struct __attribute__((packed)) wire { char kind; int length; } w;"
+                       "struct buffer { int length; _Alignas(16) char data[]; } *b;"
+                       "union number { int i; double d; char bytes[12]; } n;"
+                       "struct local { char c; double d; };"
+                       "static struct local l;"
+                       "int main() { return p.y + b->length + l.c; }";
+
+  ExternalDeclaration* external_declarations = parse_translation_unit(source);
+  resolve_names(external_declarations);
+  analyze_translation_unit(external_declarations, 1);
+  mark_reorderable_structs(external_declarations);
+
+  Type const* point_type = external_declarations->root_ast_node->object->type;
+  StructLayout const* point_layout = struct_layout(point_type);
+  assert(point_layout->size == 24 && point_layout->alignment == 8);
+  assert(point_layout->member_offsets[0] == 0 && point_layout->member_offsets[1] == 8 && point_layout->member_offsets[2] == 16);
+  // computed once, then cached
+  assert(struct_layout(point_type) == point_layout);
+
+  StructPaddingReport point_report = struct_padding_report(point_type);
+  assert(point_report.padding == 11 && point_report.holes.size() == 2);
+  assert(point_report.holes[0].member_index == 0 && point_report.holes[0].size == 7);
+  assert(point_report.optimal_size == 16);
+  assert(point_report.optimal_order == std::vector<unsigned>({ 1, 2, 0 }));
+
+  ExternalDeclaration const* wire_declaration = external_declarations->next;
+  StructLayout const* wire_layout = struct_layout(wire_declaration->root_ast_node->object->type);
+  assert(wire_layout->size == 5 && wire_layout->alignment == 1 && wire_layout->member_offsets[1] == 1);
+
+  // the flexible array member adds alignment but no size
+  Type const* buffer_type = wire_declaration->next->root_ast_node->object->type->pointed_type;
+  StructLayout const* buffer_layout = struct_layout(buffer_type);
+  assert(buffer_layout->size == 16 && buffer_layout->alignment == 16 && buffer_layout->member_offsets[1] == 16);
+
+  Type const* number_type = wire_declaration->next->next->root_ast_node->object->type;
+  assert(size_of_type(number_type) == 16 && alignment_of_type(number_type) == 8);
+  assert(struct_layout(number_type)->member_offsets[2] == 0);
+
+  // only reachable from a static object, so its members may be reordered
+  Type const* local_type = wire_declaration->next->next->next->root_ast_node->object->type;
+  assert(local_type->struct_data->may_reorder_members && !point_type->struct_data->may_reorder_members);
+  assert(struct_layout(local_type)->member_offsets[0] == 8 && size_of_type(local_type) == 16);
+
+  // member accesses get the member's type
+  ASTNode const* sum = wire_declaration->next->next->next->next->root_ast_node->object->function_body->rhs;
+  assert(sum->lhs->lhs->type == ASTNodeType::MemberAccess && sum->lhs->lhs->expression_type == IntType);
+  assert(sum->lhs->rhs->type == ASTNodeType::PointerMemberAccess && sum->lhs->rhs->member_index == 0);
+  assert(sum->rhs->type == ASTNodeType::ImplicitConversion && sum->rhs->lhs->expression_type == CharType);
+
+  printf("test 20 passed\n\n");
+}
+
+// layouts are cached on their structs, so each target parses its own copy
+static Type const* parse_struct_for_target(char const* target, char const* source)
+{
+  bool known_target = set_target(target);
+  assert(known_target);
+
+  ExternalDeclaration* external_declarations = parse_translation_unit(source);
+  resolve_names(external_declarations);
+  analyze_translation_unit(external_declarations, 1);
+  return external_declarations->root_ast_node->object->type;
+}
+
+void test21()
+{
+  printf("Running parser test 21: Target descriptions...\n");
+
+  char const* source = "struct mixed { char c; long long ll; long l; long double ld; char* p; } m;";
+
+  // LP64, long double is x86_fp80 in 16 bytes
+  Type const* lp64_type = parse_struct_for_target("x86_64-unknown-linux-gnu", source);
+  assert(size_of_type(LongType) == 8 && fundamental_type_bit_width(FundamentalType::Pointer) == 64);
+  StructLayout const* lp64_layout = struct_layout(lp64_type);
+  assert(lp64_layout->member_offsets[1] == 8 && lp64_layout->member_offsets[2] == 16 && lp64_layout->member_offsets[3] == 32);
+  assert(lp64_layout->size == 64 && lp64_layout->alignment == 16);
+  assert(ptrdiff_type() == LongType);
+  assert(is_unsigned_integer_type(FundamentalType::Char) == false);
+
+  // ILP32, long long only 4 byte aligned and long double in 12 bytes
+  Type const* ilp32_type = parse_struct_for_target("i686", source);
+  assert(size_of_type(LongType) == 4 && fundamental_type_bit_width(FundamentalType::Pointer) == 32);
+  StructLayout const* ilp32_layout = struct_layout(ilp32_type);
+  assert(ilp32_layout->member_offsets[1] == 4 && ilp32_layout->member_offsets[2] == 12 && ilp32_layout->member_offsets[3] == 16);
+  assert(ilp32_layout->size == 32 && ilp32_layout->alignment == 4);
+  assert(ptrdiff_type() == IntType);
+
+  // LLP64, long stays 32 bits and long double is double
+  Type const* llp64_type = parse_struct_for_target("x86_64-pc-windows-msvc", source);
+  assert(size_of_type(LongType) == 4 && ptrdiff_type() == LongLongType);
+  assert(struct_layout(llp64_type)->size == 40);
+
+  // plain char is unsigned on AArch64 Linux
+  set_target("aarch64-unknown-linux-gnu");
+  assert(is_unsigned_integer_type(FundamentalType::Char));
+  assert(fundamental_type_bit_width(FundamentalType::LongDouble) == 128);
+
+  assert(!set_target("pdp11"));
+  current_target = host_target();
+
+  printf("test 21 passed\n\n");
+}
+
+void test22()
+{
+  printf("Running parser test 22: Vector extensions...\n");
+
+  char const* source = "typedef float v4f __attribute__((vector_size(16)));"
+                       "typedef int v8i __attribute__((vector_size(32)));"
+                       "typedef int v4i __attribute__((vector_size(16)));"
+                       "v4f a;"
+                       "v8i b;"
+                       "v4i less = a < 2;"
+                       "float element = a[1];"
+                       "v8i scaled = b * 3;"
+                       "v4i converted = __builtin_convertvector(a, v4i);"
+                       "v4f shuffled = __builtin_shufflevector(a, a, 7, 0, -1, 4);";
+
+  ExternalDeclaration* external_declarations = parse_translation_unit(source);
+  resolve_names(external_declarations);
+  analyze_translation_unit(external_declarations, 1);
+
+  ExternalDeclaration const* declaration = external_declarations;
+  Type const* v4f_type = declaration->root_ast_node->object->type;
+  assert(v4f_type->fundamental_type == FundamentalType::Vector && v4f_type->pointed_type == FloatType && v4f_type->array_length == 4);
+  assert(size_of_type(v4f_type) == 16 && alignment_of_type(v4f_type) == 16);
+
+  Type const* v8i_type = declaration->next->root_ast_node->object->type;
+  assert(size_of_type(v8i_type) == 32 && alignment_of_type(v8i_type) == 32);
+  // interned, like the other derived types
+  assert(v8i_type == intern_vector_type(IntType, 8));
+
+  Type const* v4i_type = declaration->next->next->root_ast_node->object->type;
+  ExternalDeclaration const* first_variable = declaration->next->next->next;
+  assert(first_variable->root_ast_node->object->type == v4f_type);
+
+  // comparisons give signed integer elements as wide as the operands'
+  ASTNode const* comparison = first_variable->next->next->root_ast_node->rhs;
+  assert(comparison->expression_type == v4i_type);
+  // the scalar is converted to float, then to the vector
+  assert(comparison->rhs->type == ASTNodeType::ImplicitConversion && comparison->rhs->expression_type == v4f_type);
+  assert(comparison->rhs->lhs->expression_type == FloatType);
+
+  ASTNode const* subscript = first_variable->next->next->next->root_ast_node->rhs;
+  assert(subscript->type == ASTNodeType::Subscript && subscript->expression_type == FloatType);
+
+  ASTNode const* product = first_variable->next->next->next->next->root_ast_node->rhs;
+  assert(product->expression_type == v8i_type);
+
+  ASTNode const* conversion = first_variable->next->next->next->next->next->root_ast_node->rhs;
+  assert(conversion->type == ASTNodeType::ConvertVector && conversion->expression_type == v4i_type);
+
+  ASTNode const* shuffle = first_variable->next->next->next->next->next->next->root_ast_node->rhs;
+  assert(shuffle->expression_type == v4f_type && shuffle->shuffle_mask == std::vector<int>({ 7, 0, -1, 4 }));
+
+  printf("test 22 passed\n\n");
+}
+
+void test23()
+{
+  printf("Running parser test 23: Atomics...\n");
+
+  char const* source = "_Atomic int a;"
+                       "_Atomic(int) same;"
+                       "char* _Atomic p;"
+                       "int f() {"
+                       "  a += 2;"
+                       "  atomic_fetch_add_explicit(&a, 1, memory_order_relaxed);"
+                       "  return atomic_load(&a) + *p;"
+                       "}";
+
+  ExternalDeclaration* external_declarations = parse_translation_unit(source);
+  resolve_names(external_declarations);
+  analyze_translation_unit(external_declarations, 1);
+
+  // _Atomic int and _Atomic(int) are one interned type, accessed as int
+  Type const* atomic_int_type = external_declarations->root_ast_node->object->type;
+  assert(is_atomic_type(atomic_int_type) && non_atomic_type(atomic_int_type) == IntType);
+  assert(external_declarations->next->root_ast_node->object->type == atomic_int_type);
+  assert(intern_atomic_type(IntType) == atomic_int_type && !is_atomic_type(IntType));
+
+  // an atomic pointer is a qualified pointer, to a plain char
+  Type const* atomic_pointer_type = external_declarations->next->next->root_ast_node->object->type;
+  assert(is_atomic_type(atomic_pointer_type) && atomic_pointer_type->pointed_type == CharType);
+  assert(non_atomic_type(atomic_pointer_type) == intern_pointer_type(CharType));
+
+  ASTNode const* compound_assignment = external_declarations->next->next->next->root_ast_node->object->function_body;
+  assert(compound_assignment->type == ASTNodeType::AdditionAssignment && compound_assignment->expression_type == IntType);
+  assert(compound_assignment_operator(compound_assignment->type) == ASTNodeType::Addition);
+
+  // the memory order is the last argument
+  ASTNode const* fetch_add = compound_assignment->next;
+  assert(fetch_add->type == ASTNodeType::AtomicFetchAdd && fetch_add->expression_type == IntType);
+  ASTNode const* order = fetch_add->rhs->next->next;
+  assert(order->type == ASTNodeType::NumericConstant && numeric_constant_value(order) == (long long)MemoryOrder::Relaxed);
+
+  // without _explicit, operations are sequentially consistent
+  ASTNode const* load = fetch_add->next->rhs->lhs;
+  assert(load->type == ASTNodeType::AtomicLoad && load->expression_type == IntType);
+  assert(numeric_constant_value(load->rhs->next) == (long long)MemoryOrder::SequentiallyConsistent);
+
+  // atomic long long is 8 byte aligned even where long long is not
+  set_target("i686");
+  assert(alignment_of_type(LongLongType) == 4 && alignment_of_type(intern_atomic_type(LongLongType)) == 8);
+  current_target = host_target();
+
+  printf("test 23 passed\n\n");
+}
+
+static std::string emit_llvm_to_string(char const* source, CodegenOptions const& options)
+{
+  ExternalDeclaration* external_declarations = parse_translation_unit(source);
+  resolve_names(external_declarations);
+  analyze_translation_unit(external_declarations, 1);
+
+  FILE* file = tmpfile();
+  emit_llvm_from_translation_unit(external_declarations, file, options);
+
+  std::string output(ftell(file), '\0');
+  rewind(file);
+  size_t bytes_read = fread(output.data(), 1, output.size(), file);
+  assert(bytes_read == output.size());
+  (void)bytes_read;
+  fclose(file);
+  return output;
+}
+
+void test24()
+{
+  printf("Running parser test 24: Thread local storage models...\n");
+
+  char const* source = "_Thread_local static int counter;"
+                       "extern _Thread_local int shared;"
+                       "_Thread_local int own = 1;"
+                       "int f() { return counter + shared + own; }";
+
+  // static and _Thread_local in either order
+  ExternalDeclaration* external_declarations = parse_translation_unit(source);
+  int counter_flags = external_declarations->root_ast_node->object->declaration_specifiers.flags;
+  assert((counter_flags & TypeModifierFlag::ThreadLocal) && (counter_flags & TypeModifierFlag::Static));
+
+  // an executable knows where its own objects are, and those of the libraries
+  // it is linked against once they are loaded
+  std::string executable = emit_llvm_to_string(source, {});
+  assert(executable.find("@counter = internal thread_local(localexec) global i32 0") != std::string::npos);
+  assert(executable.find("@shared = external thread_local(initialexec) global i32") != std::string::npos);
+  assert(executable.find("@own = thread_local(localexec) global i32 1") != std::string::npos);
+  assert(executable.find("PIC Level") == std::string::npos);
+
+  // a shared library only knows about its internal objects
+  std::string library = emit_llvm_to_string(source, { .pic_level = 2 });
+  assert(library.find("@counter = internal thread_local(localdynamic) global i32 0") != std::string::npos);
+  assert(library.find("@shared = external thread_local global i32") != std::string::npos);
+  assert(library.find("@own = thread_local global i32 1") != std::string::npos);
+  assert(library.find("!{i32 7, !\"PIC Level\", i32 2}") != std::string::npos);
+
+  printf("test 24 passed\n\n");
+}
+
+void test25()
+{
+  printf("Running parser test 25: Object alignment...\n");
+
+  char const* source = "struct slot { long count __attribute__((aligned(64))); };"
+                       "_Alignas(16) int a, b __attribute__((aligned(32)));"
+                       "int buffer[16];"
+                       "int f() { _Alignas(32) int x = 1; struct slot s; return x; }";
+
+  // aligned applies to its declarator only, _Alignas to all of them
+  ExternalDeclaration* external_declarations = parse_translation_unit(source);
+  Object const* a = external_declarations->root_ast_node->object;
+  Object const* b = external_declarations->root_ast_node->next->object;
+  assert(a->declaration_specifiers.alignment == 16 && a->alignment == 0);
+  assert(b->declaration_specifiers.alignment == 16 && b->alignment == 32);
+
+  std::string output = emit_llvm_to_string(source, {});
+  assert(output.find("@a = global i32 0, align 16") != std::string::npos);
+  assert(output.find("@b = global i32 0, align 32") != std::string::npos);
+  assert(output.find("@buffer = global [16 x i32] zeroinitializer, align 4") != std::string::npos);
+  assert(output.find("alloca i32, align 32") != std::string::npos);
+  assert(output.find("store i32 1, ptr %0, align 32") != std::string::npos);
+
+  // and to members, here padding the struct out to a cache line
+  assert(output.find("alloca <{ i64, [56 x i8] }>, align 64") != std::string::npos);
+
+  // large arrays are aligned on request
+  CodegenOptions options;
+  options.large_array_alignment = 64;
+  output = emit_llvm_to_string(source, options);
+  assert(output.find("@buffer = global [16 x i32] zeroinitializer, align 64") != std::string::npos);
+
+  printf("test 25 passed\n\n");
+}
+
+void test26()
+{
+  printf("Running parser test 26: Building an llvm::Module...\n");
+
+  char const* source = "_Thread_local static int counter;"
+                       "_Alignas(32) int a = 3;"
+                       "_Atomic int hits;"
+                       "int add(int x, int y) { return x + y; }"
+                       "int f(int* p) { counter += 1; hits += *p; return add(counter, a); }";
+
+  ExternalDeclaration* external_declarations = parse_translation_unit(source);
+  resolve_names(external_declarations);
+  analyze_translation_unit(external_declarations, 1);
+
+  llvm::LLVMContext context;
+  std::unique_ptr<llvm::Module> module = build_llvm_module(external_declarations, context);
+  assert(!llvm::verifyModule(*module));
+  assert(module->getTargetTriple() == current_target->triple);
+
+  // the same lowering decisions as the text emitter
+  llvm::GlobalVariable const* counter = module->getGlobalVariable("counter", true);
+  assert(counter && counter->hasInternalLinkage() && counter->getThreadLocalMode() == llvm::GlobalValue::LocalExecTLSModel);
+  llvm::GlobalVariable const* a = module->getGlobalVariable("a");
+  assert(a && a->getAlign() == llvm::MaybeAlign(32));
+  assert(llvm::cast<llvm::ConstantInt>(a->getInitializer())->getSExtValue() == 3);
+
+  // the compound assignment to an _Atomic object is one atomicrmw
+  llvm::Function const* f = module->getFunction("f");
+  assert(f && !f->isDeclaration() && f->arg_size() == 1);
+  bool has_atomicrmw = false;
+  for (llvm::BasicBlock const& block : *f)
+    for (llvm::Instruction const& instruction : block)
+      has_atomicrmw |= llvm::isa<llvm::AtomicRMWInst>(instruction);
+  assert(has_atomicrmw);
+
+  printf("test 26 passed\n\n");
+}
+
+// the single instruction f's entry block is left with
+static llvm::Instruction const* only_instruction(llvm::Module const& module)
+{
+  llvm::BasicBlock const& entry = module.getFunction("f")->getEntryBlock();
+  assert(entry.size() == 1);
+  return &entry.front();
+}
+
+void test27()
+{
+  printf("Running parser test 27: Optimizing in process...\n");
+
+  char const* source = "static int square(int x) { return x * x; }"
+                       "int f() { int a = 3; a += 4; return square(a); }";
+
+  ExternalDeclaration* external_declarations = parse_translation_unit(source);
+  resolve_names(external_declarations);
+  analyze_translation_unit(external_declarations, 1);
+
+  OptimizationOptions options;
+  assert(!runs_passes(options));
+
+  // -O2 promotes the locals, inlines square and folds it all to a constant
+  llvm::LLVMContext context;
+  std::unique_ptr<llvm::Module> module = build_llvm_module(external_declarations, context);
+  options.level = OptimizationLevel::O2;
+  assert(runs_passes(options));
+  optimize_module(*module, options);
+  assert(!llvm::verifyModule(*module));
+  assert(!module->getFunction("square"));
+  llvm::ReturnInst const* return_instruction = llvm::dyn_cast<llvm::ReturnInst>(only_instruction(*module));
+  assert(return_instruction && llvm::cast<llvm::ConstantInt>(return_instruction->getReturnValue())->getSExtValue() == 49);
+
+  // --passes runs only what it names, so square is still called
+  module = build_llvm_module(external_declarations, context);
+  options.passes = "function(sroa,instcombine)";
+  optimize_module(*module, options);
+  assert(module->getFunction("square"));
+  assert(llvm::isa<llvm::ReturnInst>(module->getFunction("f")->getEntryBlock().getTerminator()));
+  assert(module->getFunction("f")->getEntryBlock().size() == 2);
+
+  printf("test 27 passed\n\n");
+}
+
+void test28()
+{
+  printf("Running parser test 28: Object file emission...\n");
+
+  char const* source = "int add(int a, int b) { return a + b; }";
+
+  ExternalDeclaration* external_declarations = parse_translation_unit(source);
+  resolve_names(external_declarations);
+  analyze_translation_unit(external_declarations, 1);
+
+  llvm::LLVMContext context;
+  std::unique_ptr<llvm::Module> module = build_llvm_module(external_declarations, context);
+
+  // for the host, whatever it is
+  std::unique_ptr<llvm::TargetMachine> machine = create_target_machine({}, {}, OptimizationLevel::O2);
+  assert(machine->getTargetTriple().str() == current_target->triple);
+  assert(machine->getRelocationModel() == llvm::Reloc::Static);
+
+  FILE* file = tmpfile();
+  emit_object_file(*module, *machine, file);
+  long size = ftell(file);
+  rewind(file);
+  char header[5] = {};
+  size_t bytes_read = fread(header, 1, 4, file);
+  fclose(file);
+  assert(bytes_read == 4 && size > 4);
+  if (strstr(current_target->triple, "linux"))
+    assert(memcmp(header, "\x7f" "ELF", 4) == 0);
+
+  // shared libraries need position independent code
+  machine = create_target_machine({}, { .pic_level = 2 }, OptimizationLevel::O0);
+  assert(machine->getRelocationModel() == llvm::Reloc::PIC_);
+
+  printf("test 28 passed\n\n");
+}
+
+void test29()
+{
+  printf("Running parser test 29: Running main in the JIT...\n");
+
+  // abs comes from this process's libc
+  char const* source = "int abs(int);"
+                       "int main(int argc, char** argv) { return abs(-40) + argc; }";
+
+  ExternalDeclaration* external_declarations = parse_translation_unit(source);
+  resolve_names(external_declarations);
+  analyze_translation_unit(external_declarations, 1);
+
+  auto context = std::make_unique<llvm::LLVMContext>();
+  std::unique_ptr<llvm::Module> module = build_llvm_module(external_declarations, *context);
+
+  JitSession* session = new_jit_session(OptimizationLevel::O0);
+  add_module_to_jit(session, std::move(module), std::move(context));
+  MainFunction main_function = compile_main(session);
+  assert(main_function);
+  assert(run_main(main_function, { "program", "argument" }) == 42);
+  free_jit_session(session);
+
+  printf("test 29 passed\n\n");
+}
+
+void test30()
+{
+  printf("Running parser test 30: Emitting functions in parallel...\n");
+
+  // declarations between the definitions stay where they are, and every
+  // function numbers its registers and labels from the start
+  std::string source = "int g;";
+  for (int i = 0; i < 64; i++) {
+    std::string index = std::to_string(i);
+    source += "int f" + index + "(int a) { int b = a * " + index + "; g = b + g; return b; }";
+    source += "int d" + index + "(int);";
+  }
+
+  std::string serial = emit_llvm_to_string(source.c_str(), {});
+  std::string parallel = emit_llvm_to_string(source.c_str(), { .thread_count = 4 });
+  assert(parallel == serial);
+  assert(serial.find("define i32 @f0(") < serial.find("declare i32 @d0(") && serial.find("declare i32 @d0(") < serial.find("define i32 @f1("));
+
+  // more threads than functions
+  std::string single = emit_llvm_to_string("int main() { return 0; }", { .thread_count = 8 });
+  assert(single == emit_llvm_to_string("int main() { return 0; }", {}));
+
+  printf("test 30 passed\n\n");
+}
+
+void test31()
+{
+  printf("Running parser test 31: SSA construction for locals...\n");
+
+  // b has its address taken and keeps its stack slot, a and the parameter
+  // become values. c is read after the retry loop of x *= 3, whose phi for it
+  // is trivial
+  char const* source = "_Atomic int x;"
+                       "int f(int n) { int a = n + 1; int b = 2; int* p = &b; a = a * 3; *p = a; int c = a; x *= 3; return a + b + c + n; }";
+
+  std::string text = emit_llvm_to_string(source, {});
+  assert(text.find("alloca i32\n") != std::string::npos);
+  assert(text.find("alloca i32\n", text.find("alloca i32\n") + 1) == std::string::npos);
+  assert(text.find("%1 = add nsw i32 %0, 1") != std::string::npos);
+  assert(text.find("mul nsw i32 %1, 3") != std::string::npos);
+  assert(text.find(" phi ") == std::string::npos);
+
+  ExternalDeclaration* external_declarations = parse_translation_unit(source);
+  resolve_names(external_declarations);
+  analyze_translation_unit(external_declarations, 1);
+
+  Object const* f = external_declarations->next->root_ast_node->object;
+  assert(is_promoted_local(f->parameter_objects[0]));
+  ASTNode const* b_declaration = f->function_body->next;
+  assert(b_declaration->object->is_address_taken && !is_promoted_local(b_declaration->object));
+
+  llvm::LLVMContext context;
+  std::unique_ptr<llvm::Module> module = build_llvm_module(external_declarations, context);
+  assert(!llvm::verifyModule(*module));
+
+  unsigned allocas = 0;
+  unsigned phis = 0;
+  for (llvm::BasicBlock const& block : *module->getFunction("f"))
+    for (llvm::Instruction const& instruction : block) {
+      allocas += llvm::isa<llvm::AllocaInst>(instruction);
+      phis += llvm::isa<llvm::PHINode>(instruction);
+    }
+  assert(allocas == 1 && phis == 0);
+
+  // every x *= 3 is a join, a local read after many of them is looked up
+  // without recursing per join, as is removing the phis that turn out trivial
+  unsigned const joins = 50000;
+  std::string long_chain = "_Atomic int x; int g(int n) {";
+  for (unsigned i = 0; i < joins; i++)
+    long_chain += " x *= 3;";
+  long_chain += " return n; }";
+
+  text = emit_llvm_to_string(long_chain.c_str(), {});
+  assert(text.find(" phi ") == std::string::npos && text.find("ret i32 %0") != std::string::npos);
+
+  ExternalDeclaration* chain_declarations = parse_translation_unit(long_chain.c_str());
+  resolve_names(chain_declarations);
+  analyze_translation_unit(chain_declarations, 1);
+  llvm::LLVMContext chain_context;
+  std::unique_ptr<llvm::Module> chain_module = build_llvm_module(chain_declarations, chain_context);
+  assert(!llvm::verifyModule(*chain_module));
+  for (llvm::BasicBlock const& block : *chain_module->getFunction("g"))
+    assert(!llvm::isa<llvm::PHINode>(block.front()));
+
+  printf("test 31 passed\n\n");
+}
+
+static unsigned count_mir_instructions(MirFunction const* function, MirOpcode opcode)
+{
+  unsigned count = 0;
+  for (MirBlock const& block : function->blocks)
+    if (!block.is_removed)
+      for (MirValue value : block.instructions)
+        count += function->values[value].opcode == opcode;
+  return count;
+}
+
+void test32()
+{
+  printf("Running parser test 32: Mid-level IR passes...\n");
+
+  char const* source = "_Atomic int shared;"
+                       "int sum(int n, int k) { int total = 0;"
+                       "  for (int i = 0; i < n; i = i + 1) { int scale = k * 4 + 1; if (i % 2 == 0) total = total + i * scale; else total = total - 1; }"
+                       "  return total; }"
+                       "int folded() { int x = 3; int y = x * 7; if (y > 20) return y + 1; return 0; }"
+                       "int same(int a, int b) { int c = a * b; int d = b * a; return a > b ? c : d; }"
+                       "int count(int n) { int i = 0; while (i < n) i = i + 3; do { i = i - 1; } while (i > 100); return i || n && 0; }"
+                       "int atomic() { return shared += 1; }"
+                       "int chain() { int a = 1; if (a == 0) a = 0; else if (a == 1) a = 2; else if (a == 1) a = 2; else if (a == 1) a = 2; return a; }"
+                       "int main() { return sum(10, 2) + folded() + same(3, 4) + count(10) + chain(); }";
+
+  ExternalDeclaration* external_declarations = parse_translation_unit(source);
+  resolve_names(external_declarations);
+  analyze_translation_unit(external_declarations, 1);
+
+  auto find_function = [&](char const* name) -> Object const* {
+    for (ExternalDeclaration const* current = external_declarations; current; current = current->next)
+      if (current->type == ExternalDeclarationType::FunctionDefinition && current->root_ast_node->object->identifier == name)
+        return current->root_ast_node->object;
+    assert(false && "No such function");
+    return nullptr;
+  };
+
+  std::string error;
+  std::vector<MirPass const*> passes;
+  std::string unknown_pass;
+
+  // k * 4 + 1 leaves the loop for the block before it
+  MirFunction* sum = lower_function_to_mir(find_function("sum"), {});
+  assert(sum && verify_mir_function(sum, &error));
+  assert(count_mir_instructions(sum, MirOpcode::Alloca) == 0 && count_mir_instructions(sum, MirOpcode::Phi) == 3);
+  assert(parse_mir_pipeline("licm", &passes, &unknown_pass));
+  run_mir_passes(sum, passes);
+  unsigned multiplications_in_entry = 0;
+  for (MirValue value : sum->blocks[0].instructions)
+    multiplications_in_entry += sum->values[value].opcode == MirOpcode::Mul;
+  assert(multiplications_in_entry == 1);
+  free_mir_function(sum);
+
+  // the branch on y > 20 is taken, the other return is gone
+  MirFunction* folded = lower_function_to_mir(find_function("folded"), {});
+  assert(parse_mir_pipeline("sccp,dce", &passes, &unknown_pass));
+  run_mir_passes(folded, passes);
+  assert(count_mir_instructions(folded, MirOpcode::Ret) == 1 && count_mir_instructions(folded, MirOpcode::CondBr) == 0);
+  assert(count_mir_instructions(folded, MirOpcode::Mul) == 0);
+  free_mir_function(folded);
+
+  // a * b and b * a are one value, and both sides of ?: give it
+  MirFunction* same = lower_function_to_mir(find_function("same"), {});
+  assert(parse_mir_pipeline(default_mir_pipeline, &passes, &unknown_pass));
+  run_mir_passes(same, passes);
+  assert(count_mir_instructions(same, MirOpcode::Mul) == 1);
+  free_mir_function(same);
+
+  // the unreachable else ifs branch to each other, and to the join
+  MirFunction* chain = lower_function_to_mir(find_function("chain"), {});
+  run_mir_passes(chain, passes);
+  assert(verify_mir_function(chain, &error) && count_mir_instructions(chain, MirOpcode::CondBr) == 0);
+  free_mir_function(chain);
+
+  // a local read after a long chain of joins is looked up without recursing
+  // per join, as is removing the phis that turn out trivial
+  unsigned const branches = 50000;
+  std::string long_chain = "int pick(int x) { int b = 0; if (x == 0) b = 1;";
+  for (unsigned i = 1; i < branches; i++)
+    long_chain += " else if (x == " + std::to_string(i) + ") b = " + std::to_string(i % 2) + ";";
+  long_chain += " return b; }";
+  ExternalDeclaration* chain_declarations = parse_translation_unit(long_chain.c_str());
+  resolve_names(chain_declarations);
+  analyze_translation_unit(chain_declarations, 1);
+  MirFunction* pick = lower_function_to_mir(chain_declarations->root_ast_node->object, {});
+  assert(pick && verify_mir_function(pick, &error) && count_mir_instructions(pick, MirOpcode::Phi) == branches);
+  // and looking for loops in it answers each dominance query in constant time
+  assert(parse_mir_pipeline("licm", &passes, &unknown_pass));
+  run_mir_passes(pick, passes);
+  assert(verify_mir_function(pick, &error));
+  free_mir_function(pick);
+
+  assert(!lower_function_to_mir(find_function("atomic"), {}));
+  assert(!parse_mir_pipeline("sccp,inline", &passes, &unknown_pass) && unknown_pass == "inline");
+  assert(parse_mir_pipeline("", &passes, &unknown_pass) && passes.empty());
+
+  // the text is what LLVM reads, and runs the same with and without the passes
+  for (char const* pipeline : { "", default_mir_pipeline }) {
+    std::string text = emit_llvm_to_string(source, { .mid_level_ir = true, .mir_pipeline = pipeline });
+    auto context = std::make_unique<llvm::LLVMContext>();
+    context->enableOpaquePointers();
+    llvm::SMDiagnostic diagnostic;
+    std::unique_ptr<llvm::Module> module = llvm::parseIR(llvm::MemoryBufferRef(text, "mir"), diagnostic, *context);
+    assert(module && !llvm::verifyModule(*module));
+
+    JitSession* session = new_jit_session(OptimizationLevel::O0);
+    add_module_to_jit(session, std::move(module), std::move(context));
+    assert(run_main(compile_main(session), { "program" }) == 175 + 22 + 12 + 1 + 2);
+    free_jit_session(session);
+  }
+
+  printf("test 32 passed\n\n");
+}
+
+void test33()
+{
+  printf("Running parser test 33: Native backend...\n");
+
+  char const* straight_line = "struct point { char tag; short s; int x; long y; double d; float f; };"
+                              "static int counter = 5; _Thread_local int tl = 7; unsigned char uc = 200;"
+                              "int many(int a, int b, int c, int d, int e, int f, int g, int h, double x, float y) {"
+                              "  int xi = x * 2; int yi = y; return a - b + c * d - e + f * g - h + xi + yi; }"
+                              "double mix(double a, float b, long c, unsigned u) { return a * b + c - u / 2; }"
+                              "signed char narrow(signed char a, unsigned short b) { return a + b; }"
+                              "unsigned long shifts(unsigned long a, long b, int c) { unsigned uc = c; return (a >> 3) + (b >> 2) + (c << 4) + uc / 3 + c % 7; }"
+                              "int floats(double a, double b) { return (a < b) + (a <= b) * 2 + (a > b) * 4 + (a >= b) * 8 + (a == b) * 16 + (a != b) * 32; }"
+                              "int structs() { struct point p; p.tag = 97; p.s = -3; p.x = 100; p.y = -50; p.d = 5; p.d = p.d / 2; p.f = 3; p.f = p.f / 2;"
+                              "  struct point* q = &p; int product = q->d * q->f; return q->tag + q->s + q->x + q->y / 7 + product; }"
+                              "int main() { double half = 19; half = half / 2; float quarter = 43; quarter = quarter / 4; double zero = 0;"
+                              "  int total = many(1, 2, 3, 4, 5, 6, 7, 8, half, quarter) + mix(half, 2, -3, 7) + narrow(100, 60) + shifts(1000, -64, 9);"
+                              "  total = total + floats(1, 2) + floats(2, 2) + floats(zero / zero, 1) + structs();"
+                              "  counter = counter + 1; tl = tl * 3; int neg = -17; unsigned uneg = neg;"
+                              "  return total + counter + tl + uc + neg / 5 + neg % 5 + (neg >> 1) + (uneg >> 28); }";
+
+  // the LLVM backend doesn't lower branches yet, so these are checked against
+  // what they compute: fib(15) is 610, the squares up to 81 sum to 285
+  char const* control_flow = "int fib(int n) { if (n < 2) return n; return fib(n - 1) + fib(n - 2); }"
+                             "int arrays() { int a[10]; for (int i = 0; i < 10; i = i + 1) a[i] = i * i;"
+                             "  int s = 0; int* p = &a[0]; while (p < &a[0] + 10) { s = s + *p; p = p + 1; } return s; }"
+                             "int main() { return fib(15) + arrays(); }";
+
+  // atomics and structs by value are left to LLVM, in the same file, and
+  // call and are called by what the native backend compiled: bump leaves
+  // counter at 3, made(5) is 7 and bump(4) twice 7
+  char const* fallback = "_Atomic int counter; struct pair { int x; long y; };"
+                         "static int twice(int x) { return x * 2; }"
+                         "int bump(int x) { counter += x; return twice(counter); }"
+                         "static struct pair make(int x) { struct pair p; p.x = x; p.y = 2; return p; }"
+                         "long take(struct pair p) { return p.x + p.y; }"
+                         "long made(int x) { return take(make(x)); }"
+                         "int main() { bump(3); return made(5) + bump(4); }";
+
+  // the reference is the LLVM backend's code for the same source, which
+  // doesn't go through the mid-level IR the native backend is built on
+  ExternalDeclaration* reference_declarations = parse_translation_unit(straight_line);
+  resolve_names(reference_declarations);
+  analyze_translation_unit(reference_declarations, 1);
+  auto context = std::make_unique<llvm::LLVMContext>();
+  std::unique_ptr<llvm::Module> module = build_llvm_module(reference_declarations, *context);
+  assert(module && !llvm::verifyModule(*module));
+  JitSession* session = new_jit_session(OptimizationLevel::O0);
+  add_module_to_jit(session, std::move(module), std::move(context));
+  int straight_line_expected = run_main(compile_main(session), { "program" }) & 0xFF;
+  free_jit_session(session);
+
+  char directory[] = "/tmp/miniclang_native_XXXXXX";
+  assert(mkdtemp(directory));
+  std::string executable_path = std::string(directory) + "/program";
+
+  // the passes and the threads don't change what the programs do, and cc
+  // assembles the assembly to the same program as the object
+  for (CodegenOptions const& options : { CodegenOptions {}, CodegenOptions { .thread_count = 4, .mid_level_ir = true, .mir_pipeline = default_mir_pipeline } }) {
+    for (auto [source, expected] :
+        { std::pair { straight_line, straight_line_expected }, std::pair { control_flow, (610 + 285) & 0xFF }, std::pair { fallback, 7 + 14 } }) {
+      for (NativeFileKind file_kind : { NativeFileKind::Assembly, NativeFileKind::Object }) {
+        ExternalDeclaration* external_declarations = parse_translation_unit(source);
+        resolve_names(external_declarations);
+        analyze_translation_unit(external_declarations, 1);
+
+        std::string path = std::string(directory) + (file_kind == NativeFileKind::Object ? "/program.o" : "/program.s");
+        FILE* file = fopen(path.c_str(), "w");
+        assert(file);
+        emit_native_from_translation_unit(external_declarations, file, file_kind, {}, options);
+        fclose(file);
+
+        std::string link = "cc -o " + executable_path + " " + path;
+        assert(system(link.c_str()) == 0);
+        int status = system(executable_path.c_str());
+        assert(WIFEXITED(status) && WEXITSTATUS(status) == expected);
+        unlink(path.c_str());
+      }
+    }
+  }
+
+  unlink(executable_path.c_str());
+  rmdir(directory);
+
+  printf("test 33 passed\n\n");
+}
+
+// the call in the entry block of the named function
+static llvm::CallInst const* first_call(llvm::Module const& module, char const* name)
+{
+  for (llvm::Instruction const& instruction : module.getFunction(name)->getEntryBlock())
+    if (llvm::CallInst const* call = llvm::dyn_cast<llvm::CallInst>(&instruction))
+      return call;
+  assert(false && "No call");
+  return nullptr;
+}
+
+void test34()
+{
+  printf("Running parser test 34: Tail calls...\n");
+
+  char const* calls = "int helper(int x);"
+                      "int forward(int x) { return helper(x + 1); }"
+                      "int escaped(int x) { int local = x; int* p = &local; return helper(*p); }"
+                      "long widened(int x) { return helper(x); }"
+                      "int required(int x) { __attribute__((musttail)) return helper(x); }";
+
+  // a local in memory might have been handed to the callee
+  std::string text = emit_llvm_to_string(calls, {});
+  assert(text.find("tail call i32 @helper") != std::string::npos && text.find("musttail call i32 @helper") != std::string::npos);
+  size_t plain_calls = 0;
+  for (size_t position = text.find("= call i32 @helper"); position != std::string::npos; position = text.find("= call i32 @helper", position + 1))
+    plain_calls++;
+  assert(plain_calls == 2);
+
+  ExternalDeclaration* external_declarations = parse_translation_unit(calls);
+  resolve_names(external_declarations);
+  analyze_translation_unit(external_declarations, 1);
+  llvm::LLVMContext context;
+  std::unique_ptr<llvm::Module> module = build_llvm_module(external_declarations, context);
+  assert(!llvm::verifyModule(*module));
+  assert(first_call(*module, "forward")->getTailCallKind() == llvm::CallInst::TCK_Tail);
+  assert(first_call(*module, "escaped")->getTailCallKind() == llvm::CallInst::TCK_None);
+  assert(first_call(*module, "widened")->getTailCallKind() == llvm::CallInst::TCK_None);
+  assert(first_call(*module, "required")->getTailCallKind() == llvm::CallInst::TCK_MustTail);
+
+  // ten million calls deep would overflow the stack, as a loop it doesn't
+  char const* source = "int helper(int x) { return x * 2; }"
+                       "int count(int n, int total) { if (n == 0) return total; return count(n - 1, total + 1); }"
+                       "int forward(int x) { return helper(x + 1); }"
+                       "int main() { return count(10000000, 0) % 256 + forward(1); }";
+
+  external_declarations = parse_translation_unit(source);
+  resolve_names(external_declarations);
+  analyze_translation_unit(external_declarations, 1);
+  for (ExternalDeclaration const* current = external_declarations; current; current = current->next) {
+    if (current->root_ast_node->object->identifier != "count")
+      continue;
+    MirFunction* count = lower_function_to_mir(current->root_ast_node->object, {});
+    std::string error;
+    assert(count && verify_mir_function(count, &error));
+    assert(count_mir_instructions(count, MirOpcode::Call) == 0 && count_mir_instructions(count, MirOpcode::Phi) == 2);
+    free_mir_function(count);
+  }
+
+  text = emit_llvm_to_string(source, { .mid_level_ir = true, .mir_pipeline = "" });
+  auto jit_context = std::make_unique<llvm::LLVMContext>();
+  jit_context->enableOpaquePointers();
+  llvm::SMDiagnostic diagnostic;
+  module = llvm::parseIR(llvm::MemoryBufferRef(text, "tail"), diagnostic, *jit_context);
+  assert(module && !llvm::verifyModule(*module));
+  JitSession* session = new_jit_session(OptimizationLevel::O0);
+  add_module_to_jit(session, std::move(module), std::move(jit_context));
+  assert(run_main(compile_main(session), { "program" }) == 128 + 4);
+  free_jit_session(session);
+
+  // the native backend jumps to the callee after tearing down the frame
+  FILE* file = tmpfile();
+  emit_native_from_translation_unit(external_declarations, file, NativeFileKind::Assembly);
+  std::string assembly(ftell(file), '\0');
+  rewind(file);
+  size_t bytes_read = fread(assembly.data(), 1, assembly.size(), file);
+  assert(bytes_read == assembly.size());
+  (void)bytes_read;
+  fclose(file);
+  assert(assembly.find("  leave\n  jmp helper\n") != std::string::npos);
+  size_t count_start = assembly.find("\ncount:\n");
+  assert(count_start != std::string::npos && assembly.find("call", count_start) > assembly.find(".size count", count_start));
+
+  printf("test 34 passed\n\n");
+}
+
+void test35()
+{
+  printf("Running parser test 35: Wrap flags...\n");
+
+  char const* source = "int add(int a, int b) { return a + b; }"
+                       "unsigned add_unsigned(unsigned a, unsigned b) { return a + b; }"
+                       "int load(int* p, long i) { return p[i] + p[-i]; }"
+                       "long distance(int* a, int* b) { return a - b; }";
+
+  // signed overflow is undefined, unsigned arithmetic wraps
+  std::string text = emit_llvm_to_string(source, {});
+  assert(text.find("add nsw i32") != std::string::npos && text.find("= add i32") != std::string::npos);
+  assert(text.find("getelementptr inbounds i32") != std::string::npos && text.find("getelementptr i32") == std::string::npos);
+  assert(text.find("sub nsw i64") != std::string::npos && text.find("sdiv exact i64") != std::string::npos);
+
+  ExternalDeclaration* external_declarations = parse_translation_unit(source);
+  resolve_names(external_declarations);
+  analyze_translation_unit(external_declarations, 1);
+  llvm::LLVMContext context;
+  std::unique_ptr<llvm::Module> module = build_llvm_module(external_declarations, context);
+  assert(!llvm::verifyModule(*module));
+  auto first_binary_operator = [&](char const* function_name) -> llvm::BinaryOperator* {
+    for (llvm::Instruction& instruction : llvm::instructions(module->getFunction(function_name)))
+      if (auto* binary_operator = llvm::dyn_cast<llvm::BinaryOperator>(&instruction))
+        return binary_operator;
+    return nullptr;
+  };
+  assert(first_binary_operator("add")->hasNoSignedWrap() && !first_binary_operator("add_unsigned")->hasNoSignedWrap());
+  assert(!first_binary_operator("add")->hasNoUnsignedWrap());
+  for (llvm::Instruction& instruction : llvm::instructions(module->getFunction("load")))
+    if (auto* element_pointer = llvm::dyn_cast<llvm::GetElementPtrInst>(&instruction))
+      assert(element_pointer->isInBounds());
+
+  text = emit_llvm_to_string(source, { .mid_level_ir = true, .mir_pipeline = "" });
+  assert(text.find("add nsw i32") != std::string::npos && text.find("= add i32") != std::string::npos);
+  assert(text.find("mul nsw i64") != std::string::npos && text.find("getelementptr inbounds i8") != std::string::npos);
+  assert(text.find("sdiv exact i64") != std::string::npos);
+
+  // the negation of an unsigned index may wrap, so when value numbering finds
+  // it computes the same as the nsw one of the pointer subtraction, the flag
+  // goes
+  char const* merged = "long merged(int* p, unsigned long u) { return (p - u) - p + -u; }";
+  text = emit_llvm_to_string(merged, { .mid_level_ir = true, .mir_pipeline = "" });
+  assert(text.find("sub nsw i64 0,") != std::string::npos && text.find("sub i64 0,") != std::string::npos);
+  text = emit_llvm_to_string(merged, { .mid_level_ir = true, .mir_pipeline = "gvn" });
+  assert(text.find("sub nsw i64 0,") == std::string::npos && text.find("sub i64 0,") != std::string::npos);
+
+  printf("test 35 passed\n\n");
+}
+
+void test36()
+{
+  printf("Running parser test 36: Pointer parameter attributes...\n");
+
+  char const* source = "void scale(float* restrict out, const float* restrict in, float* alias) { out[0] = in[0] + alias[0]; }"
+                       "int sum(int const a[static 4], int b[restrict], int c[][4]) { return a[3] + b[0] + c[1][2]; }";
+
+  std::string text = emit_llvm_to_string(source, {});
+  assert(text.find("@scale(ptr noalias %0, ptr noalias readonly %1, ptr %2)") != std::string::npos);
+  assert(text.find("@sum(ptr nonnull align 4 dereferenceable(16) %0, ptr noalias %1, ptr %2)") != std::string::npos);
+
+  // the mid-level IR prints the same define lines
+  text = emit_llvm_to_string(source, { .mid_level_ir = true, .mir_pipeline = "" });
+  assert(text.find("@scale(ptr noalias %0, ptr noalias readonly %1, ptr %2)") != std::string::npos);
+
+  ExternalDeclaration* external_declarations = parse_translation_unit(source);
+  resolve_names(external_declarations);
+  analyze_translation_unit(external_declarations, 1);
+  llvm::LLVMContext context;
+  std::unique_ptr<llvm::Module> module = build_llvm_module(external_declarations, context);
+  assert(!llvm::verifyModule(*module));
+  llvm::Function const* scale = module->getFunction("scale");
+  assert(scale->hasParamAttribute(0, llvm::Attribute::NoAlias) && !scale->hasParamAttribute(0, llvm::Attribute::ReadOnly));
+  assert(scale->hasParamAttribute(1, llvm::Attribute::NoAlias) && scale->hasParamAttribute(1, llvm::Attribute::ReadOnly));
+  assert(!scale->hasParamAttribute(2, llvm::Attribute::NoAlias));
+  llvm::Function const* sum = module->getFunction("sum");
+  assert(sum->hasParamAttribute(0, llvm::Attribute::NonNull) && sum->getParamDereferenceableBytes(0) == 16);
+  assert(sum->getParamAlign(0) == llvm::Align(4) && !sum->hasParamAttribute(0, llvm::Attribute::NoAlias));
+  assert(sum->hasParamAttribute(1, llvm::Attribute::NoAlias) && sum->getParamDereferenceableBytes(1) == 0);
+
+  printf("test 36 passed\n\n");
+}
+
+void test37()
+{
+  printf("Running parser test 37: Function attributes...\n");
+
+  char const* source = "int g; void exit(int);"
+                       "int square(int x) { return x * x; }"
+                       "int get(int* p) { return *p; }"
+                       "void put(int* p, int v) { *p = v; }"
+                       "int global_read(void) { return g; }"
+                       "void die(void) { exit(1); }"
+                       "int twice(int x) { return square(x) + square(x); }"
+                       "int local(void) { int x = 1; put(&x, 2); return x; }"
+                       "struct V { volatile int x; };"
+                       "int read_volatile(volatile int* p) { return *p; }"
+                       "int read_member(struct V* v) { return v->x; }";
+  // the builder can't emit the if, only the mid-level IR can
+  std::string recursive = std::string(source) + "int fact(int n) { if (n < 2) return 1; return n * fact(n - 1); }";
+
+  std::string text = emit_llvm_to_string(recursive.c_str(), { .mid_level_ir = true, .mir_pipeline = "" });
+  assert(text.find("declare void @exit(i32) nounwind noreturn\n") != std::string::npos);
+  assert(text.find("@square(i32 %0) nounwind readnone norecurse willreturn speculatable {") != std::string::npos);
+  assert(text.find("@get(ptr %0) nounwind readonly argmemonly norecurse willreturn {") != std::string::npos);
+  assert(text.find("@put(ptr %0, i32 %1) nounwind argmemonly norecurse willreturn {") != std::string::npos);
+  assert(text.find("@global_read() nounwind readonly norecurse willreturn {") != std::string::npos);
+  assert(text.find("@fact(i32 %0) nounwind readnone {") != std::string::npos);
+  assert(text.find("@die() nounwind noreturn {") != std::string::npos);
+  // passing the address of a local only touches the caller's own memory
+  assert(text.find("@local() nounwind readnone norecurse willreturn {") != std::string::npos);
+  assert(text.find("call void @exit(i32 1) nounwind noreturn") != std::string::npos);
+  // reading through a pointer to volatile is a side effect
+  assert(text.find("@read_volatile(ptr %0) nounwind norecurse willreturn {") != std::string::npos);
+  assert(text.find("@read_member(ptr %0) nounwind norecurse willreturn {") != std::string::npos);
+
+  // calls to functions that touch no memory are merged like arithmetic
+  text = emit_llvm_to_string(source, { .mid_level_ir = true, .mir_pipeline = "gvn" });
+  size_t twice = text.find("@twice(");
+  size_t first_call = text.find("call i32 @square", twice);
+  assert(first_call != std::string::npos && text.find("call i32 @square", first_call + 1) == std::string::npos);
+
+  ExternalDeclaration* external_declarations = parse_translation_unit(source);
+  resolve_names(external_declarations);
+  analyze_translation_unit(external_declarations, 1);
+  llvm::LLVMContext context;
+  std::unique_ptr<llvm::Module> module = build_llvm_module(external_declarations, context);
+  assert(!llvm::verifyModule(*module));
+  llvm::Function const* square = module->getFunction("square");
+  assert(square->doesNotAccessMemory() && square->doesNotRecurse() && square->willReturn() && square->doesNotThrow());
+  assert(square->hasFnAttribute(llvm::Attribute::Speculatable));
+  llvm::Function const* get = module->getFunction("get");
+  assert(get->onlyReadsMemory() && get->onlyAccessesArgMemory());
+  assert(!module->getFunction("read_volatile")->onlyReadsMemory());
+  assert(module->getFunction("exit")->doesNotReturn() && module->getFunction("die")->doesNotReturn());
+
+  printf("test 37 passed\n\n");
+}
+
+void test38()
+{
+  printf("Running parser test 38: Type-based alias analysis metadata...\n");
+
+  char const* source = "struct Inner { int x; float y; };"
+                       "struct S { int a; int b; struct Inner inner; union { int i; float f; } u; };"
+                       "int mix(int* i, float* f) { *i = 1; *f = 2; return *i; }"
+                       "int path(struct S* s) { s->a = 1; s->b = 2; s->inner.y = 3; s->u.f = 5; return s->inner.x; }";
+
+  std::string text = emit_llvm_to_string(source, {});
+  assert(text.find("!1 = !{!\"Simple C/C++ TBAA\"}") != std::string::npos);
+  assert(text.find("!4 = !{!\"int\", !2, i64 0}") != std::string::npos);
+  assert(text.find("store i32 1, ptr %0, !tbaa !14\n") != std::string::npos);
+  assert(text.find("store float %2, ptr %1, !tbaa !17\n") != std::string::npos);
+  // members of one struct at different offsets, through a nested struct
+  assert(text.find("!{!\"Inner\", !4, i64 0, !7, i64 4}") != std::string::npos);
+  assert(text.find("!{!\"S\", !4, i64 0, !4, i64 4, !") != std::string::npos);
+  assert(text.find(", !7, i64 12}") != std::string::npos && text.find(", !4, i64 8}") != std::string::npos);
+  // a union member is accessed as char
+  assert(text.find("store float %6, ptr %5, !tbaa !12\n") != std::string::npos);
+
+  CodegenOptions options;
+  options.mid_level_ir = true;
+  assert(emit_llvm_to_string(source, options).find(", !tbaa !14\n") != std::string::npos);
+  options.strict_aliasing = false;
+  assert(emit_llvm_to_string(source, options).find("!tbaa") == std::string::npos);
+
+  ExternalDeclaration* external_declarations = parse_translation_unit(source);
+  resolve_names(external_declarations);
+  analyze_translation_unit(external_declarations, 1);
+  llvm::LLVMContext context;
+  std::unique_ptr<llvm::Module> module = build_llvm_module(external_declarations, context);
+  assert(!llvm::verifyModule(*module));
+  unsigned annotated = 0;
+  for (llvm::Instruction const& instruction : llvm::instructions(*module->getFunction("path")))
+    if (llvm::isa<llvm::LoadInst>(instruction) || llvm::isa<llvm::StoreInst>(instruction))
+      annotated += instruction.getMetadata(llvm::LLVMContext::MD_tbaa) != nullptr;
+  assert(annotated == 5);
+
+  printf("test 38 passed\n\n");
+}
+
+void test39()
+{
+  printf("Running parser test 39: Pathologically nested statements...\n");
+
+  // blocks in blocks and ifs in loops in ifs, deep enough to blow the native
+  // stack if statements were parsed recursively
+  unsigned const depth = 100000;
+  std::string source = "{ int a = 1;";
+  for (unsigned i = 0; i < depth; i++)
+    source += i % 2 ? "{ a = a + 1; " : "if (a) while (a) ";
+  source += "a = 0;";
+  for (unsigned i = 0; i < depth / 2; i++)
+    source += "}";
+  source += "}";
+
+  Lexer lexer = new_lexer(source.c_str());
+  get_next_token(&lexer);
+
+  Scope scope;
+  scope.parent_scope = nullptr;
+  scope.return_type = get_fundamental_type_pointer(FundamentalType::Int);
+  ASTNode* node = parse_statement(&lexer, &scope);
+  assert(get_current_token(&lexer)->type == TokenType::Eof);
+
+  // nested blocks are flattened into the list of the block around them
+  ASTNode const* current_node = node->next;
+  for (unsigned i = 0; i < depth / 2; i++) {
+    assert(current_node->type == ASTNodeType::If && current_node->lhs->type == ASTNodeType::While);
+    ASTNode const* increment = current_node->lhs->body;
+    assert(increment->type == ASTNodeType::Assignment && increment->lhs->object == node->object);
+    current_node = increment->next;
+  }
+  assert(current_node->type == ASTNodeType::Assignment && !current_node->next);
+
+  // a = a = ... = 1 is as deep, and each = finds the innermost ( or ? at once
+  std::string assignments;
+  for (unsigned i = 0; i < depth; i++)
+    assignments += "a = ";
+  assignments += "1";
+  lexer = new_lexer(assignments.c_str());
+  get_next_token(&lexer);
+  node = parse_expression(&lexer, &scope);
+  for (unsigned i = 0; i < depth; i++) {
+    assert(node->type == ASTNodeType::Assignment);
+    node = node->rhs;
+  }
+  assert(node->type == ASTNodeType::NumericConstant);
+
+  printf("test 39 passed\n\n");
+}
+
 int main()
 {
   test1();
@@ -295,4 +1671,32 @@ int main()
   test9();
   // test10();
   test11();
+  test12();
+  test13();
+  test14();
+  test15();
+  test16();
+  test17();
+  test18();
+  test19();
+  test20();
+  test21();
+  test22();
+  test23();
+  test24();
+  test25();
+  test26();
+  test27();
+  test28();
+  test29();
+  test30();
+  test31();
+  test32();
+  test33();
+  test34();
+  test35();
+  test36();
+  test37();
+  test38();
+  test39();
 }